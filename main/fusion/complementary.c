@@ -0,0 +1,67 @@
+#include <math.h>
+#include "complementary.h"
+#include "quaternion.h"
+
+/* Skip the correction when the measured gravity is within this of pointing down */
+#define COMPLEMENTARY_FLIP_EPS (1e-6F)
+
+void complementary_init(complementary_t *filter, float gain, float sample_freq){
+    filter->q[0] = 1.0F;
+    filter->q[1] = 0.0F;
+    filter->q[2] = 0.0F;
+    filter->q[3] = 0.0F;
+    filter->gain = gain;
+    filter->dt = 1.0F / sample_freq;
+}
+
+/*!
+* One update step
+*   1. Integrate the gyroscope (first order)
+*   2. Rotate the measured gravity into the earth frame with the prediction
+*   3. Delta quaternion taking it onto the vertical: axis (gy, -gx, 0), no yaw part
+*   4. Scale the delta by the gain (linear interpolation with the identity) and apply
+*      it on the earth side, q = dq q
+*/
+void complementary_update_imu(complementary_t *filter, const gyro_float_data_t *gyro, const raw_float_data_t *accel){
+    float *q = filter->q;
+    float hx = 0.5F * gyro->x * filter->dt;
+    float hy = 0.5F * gyro->y * filter->dt;
+    float hz = 0.5F * gyro->z * filter->dt;
+    float q0 = q[0];
+    float q1 = q[1];
+    float q2 = q[2];
+    float q3 = q[3];
+
+    q[0] += -q1 * hx - q2 * hy - q3 * hz;
+    q[1] += q0 * hx + q2 * hz - q3 * hy;
+    q[2] += q0 * hy - q1 * hz + q3 * hx;
+    q[3] += q0 * hz + q1 * hy - q2 * hx;
+    quat_normalize(q);
+
+    float norm = accel->x * accel->x + accel->y * accel->y + accel->z * accel->z;
+    if(norm == 0.0F)
+        return;
+    float recip_norm = 1.0F / sqrtf(norm);
+    float a[3] = {accel->x * recip_norm, accel->y * recip_norm, accel->z * recip_norm};
+    float g[3];
+    quat_rotate(q, a, g);
+
+    float w2 = 2.0F * (1.0F + g[2]);
+    if(w2 < COMPLEMENTARY_FLIP_EPS)
+        return;
+    float s = 1.0F / sqrtf(w2);
+    float dq[4];
+    dq[0] = (1.0F - filter->gain) + filter->gain * 0.5F * w2 * s;
+    dq[1] = filter->gain * g[1] * s;
+    dq[2] = -filter->gain * g[0] * s;
+    dq[3] = 0.0F;
+    quat_normalize(dq);
+
+    float out[4];
+    quat_mul(dq, q, out);
+    q[0] = out[0];
+    q[1] = out[1];
+    q[2] = out[2];
+    q[3] = out[3];
+    quat_normalize(q);
+}
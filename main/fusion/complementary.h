@@ -0,0 +1,43 @@
+/*!
+* @file complementary.h
+* @author Ethan Lew
+* @brief Quaternion complementary filter (6 DoF)
+*
+* The gyroscope is integrated for the high frequency attitude, and the tilt is pulled
+* toward the accelerometer with a fixed gain, after R. Valenti et al., "Keeping a Good
+* Attitude: A Quaternion-Based Orientation Filter for IMUs and MARGs" (2015). The
+* correction is a rotation about a horizontal axis, so it never disturbs the heading.
+* A gain of 0 is pure gyroscope integration, 1 snaps the tilt to the accelerometer.
+*/
+
+#ifndef COMPLEMENTARY_H
+#define COMPLEMENTARY_H
+
+#include "fxas21002c.h"
+#include "fxos8700.h"
+
+#define COMPLEMENTARY_GAIN_DEFAULT (0.02F)
+
+typedef struct complementary_s {
+    float q[4];     /**< Orientation, {w, x, y, z}, body to earth */
+    float gain;     /**< Fraction of the accelerometer tilt correction applied per sample */
+    float dt;       /**< Sample period (s) */
+} complementary_t;
+
+/*!
+* @brief reset to the identity orientation
+* @param filter the filter state
+* @param gain the accelerometer gain, in [0, 1]
+* @param sample_freq the update rate (Hz)
+*/
+void complementary_init(complementary_t *filter, float gain, float sample_freq);
+
+/*!
+* @brief 6 DoF update
+* @param filter the filter state
+* @param gyro angular rate (rad/s)
+* @param accel acceleration, any unit; a zero vector skips the correction
+*/
+void complementary_update_imu(complementary_t *filter, const gyro_float_data_t *gyro, const raw_float_data_t *accel);
+
+#endif
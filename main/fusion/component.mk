@@ -0,0 +1,4 @@
+#
+# Sensor fusion filters
+#
+COMPONENT_ADD_INCLUDEDIRS := .
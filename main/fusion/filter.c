@@ -0,0 +1,193 @@
+#include <string.h>
+#include "filter.h"
+#include "quaternion.h"
+
+static void filter_seed(filter_t *filter, const float *q);
+
+static void filter_update_fixed(filter_t *filter, const gyro_float_data_t *gyro, const raw_float_data_t *accel);
+
+filter_err_t filter_init(filter_t *filter, filter_mode_t mode, float sample_freq){
+    filter->mode = mode;
+    filter->sample_freq = sample_freq;
+    filter->aligned = 0;
+
+    switch(mode){
+        case FILTER_MADGWICK:
+        case FILTER_MADGWICK_IMU:
+            madgwick_init(&filter->state.madgwick, MADGWICK_BETA_DEFAULT, sample_freq);
+            break;
+        case FILTER_MAHONY:
+            mahony_init(&filter->state.mahony, MAHONY_KP_DEFAULT, MAHONY_KI_DEFAULT, sample_freq);
+            break;
+        case FILTER_COMPLEMENTARY:
+            complementary_init(&filter->state.complementary, COMPLEMENTARY_GAIN_DEFAULT, sample_freq);
+            break;
+        case FILTER_UKF:
+            ukf_init(&filter->state.ukf, sample_freq);
+            break;
+        case FILTER_MAHONY_FIXED:
+            mahony_fixed_init(&filter->state.mahony_fixed, MAHONY_KP_DEFAULT, MAHONY_KI_DEFAULT, sample_freq);
+            break;
+        default:
+            return FILTER_BAD_MODE;
+    }
+    return FILTER_SUCCESS;
+}
+
+/*!
+* Switching between the two Madgwick modes keeps the state as is; anything else is
+* reinitialized and seeded with the current orientation. The UKF needs a magnetic
+* reference, so it realigns from its first 9 DoF sample instead.
+*/
+filter_err_t filter_set_mode(filter_t *filter, filter_mode_t mode){
+    float q[4];
+
+    if(mode >= FILTER_MODE_COUNT)
+        return FILTER_BAD_MODE;
+    if((filter->mode == FILTER_MADGWICK || filter->mode == FILTER_MADGWICK_IMU) &&
+       (mode == FILTER_MADGWICK || mode == FILTER_MADGWICK_IMU)){
+        filter->mode = mode;
+        return FILTER_SUCCESS;
+    }
+
+    filter_quaternion(filter, q);
+    filter_init(filter, mode, filter->sample_freq);
+    filter_seed(filter, q);
+    return FILTER_SUCCESS;
+}
+
+/*!
+* The gain is set in place, so the orientation and any integral state carry on
+*/
+filter_err_t filter_set_gain(filter_t *filter, float gain){
+    switch(filter->mode){
+        case FILTER_MADGWICK:
+        case FILTER_MADGWICK_IMU:
+            filter->state.madgwick.beta = gain;
+            break;
+        case FILTER_MAHONY:
+            filter->state.mahony.kp = gain;
+            break;
+        case FILTER_COMPLEMENTARY:
+            filter->state.complementary.gain = gain;
+            break;
+        case FILTER_MAHONY_FIXED:
+            filter->state.mahony_fixed.kp = q16_from_float(gain);
+            break;
+        default:
+            return FILTER_BAD_MODE;
+    }
+    return FILTER_SUCCESS;
+}
+
+uint8_t filter_uses_magn(filter_mode_t mode){
+    return mode == FILTER_MADGWICK || mode == FILTER_UKF;
+}
+
+filter_err_t filter_update(filter_t *filter, const gyro_float_data_t *gyro,
+                           const raw_float_data_t *accel, const raw_float_data_t *magn){
+    switch(filter->mode){
+        case FILTER_MADGWICK:
+            if(magn){
+                madgwick_update(&filter->state.madgwick, gyro, accel, magn);
+            } else {
+                madgwick_update_imu(&filter->state.madgwick, gyro, accel);
+            }
+            break;
+        case FILTER_MADGWICK_IMU:
+            madgwick_update_imu(&filter->state.madgwick, gyro, accel);
+            break;
+        case FILTER_MAHONY:
+            mahony_update_imu(&filter->state.mahony, gyro, accel);
+            break;
+        case FILTER_COMPLEMENTARY:
+            complementary_update_imu(&filter->state.complementary, gyro, accel);
+            break;
+        case FILTER_UKF:
+            if(magn && !filter->aligned){
+                ukf_align(&filter->state.ukf, accel, magn);
+                filter->aligned = 1;
+            }
+            if(ukf_predict(&filter->state.ukf, gyro) != UKF_SUCCESS)
+                return FILTER_DIVERGED;
+            if(magn && ukf_update(&filter->state.ukf, accel, magn) != UKF_SUCCESS)
+                return FILTER_DIVERGED;
+            break;
+        case FILTER_MAHONY_FIXED:
+            filter_update_fixed(filter, gyro, accel);
+            break;
+        default:
+            return FILTER_BAD_MODE;
+    }
+    return FILTER_SUCCESS;
+}
+
+void filter_quaternion(const filter_t *filter, float *q){
+    switch(filter->mode){
+        case FILTER_MADGWICK:
+        case FILTER_MADGWICK_IMU:
+            q[0] = filter->state.madgwick.q0;
+            q[1] = filter->state.madgwick.q1;
+            q[2] = filter->state.madgwick.q2;
+            q[3] = filter->state.madgwick.q3;
+            break;
+        case FILTER_MAHONY:
+            memcpy(q, filter->state.mahony.q, 4 * sizeof(float));
+            break;
+        case FILTER_COMPLEMENTARY:
+            memcpy(q, filter->state.complementary.q, 4 * sizeof(float));
+            break;
+        case FILTER_UKF:
+            memcpy(q, filter->state.ukf.q, 4 * sizeof(float));
+            break;
+        case FILTER_MAHONY_FIXED:
+            for(int i = 0; i < 4; i++)
+                q[i] = q30_to_float(filter->state.mahony_fixed.q[i]);
+            break;
+        default:
+            q[0] = 1.0F;
+            q[1] = 0.0F;
+            q[2] = 0.0F;
+            q[3] = 0.0F;
+            break;
+    }
+}
+
+void filter_euler(const filter_t *filter, float *roll, float *pitch, float *yaw){
+    float q[4];
+    filter_quaternion(filter, q);
+    quat_euler(q, roll, pitch, yaw);
+}
+
+static void filter_seed(filter_t *filter, const float *q){
+    switch(filter->mode){
+        case FILTER_MADGWICK:
+        case FILTER_MADGWICK_IMU:
+            filter->state.madgwick.q0 = q[0];
+            filter->state.madgwick.q1 = q[1];
+            filter->state.madgwick.q2 = q[2];
+            filter->state.madgwick.q3 = q[3];
+            break;
+        case FILTER_MAHONY:
+            memcpy(filter->state.mahony.q, q, 4 * sizeof(float));
+            break;
+        case FILTER_COMPLEMENTARY:
+            memcpy(filter->state.complementary.q, q, 4 * sizeof(float));
+            break;
+        case FILTER_UKF:
+            memcpy(filter->state.ukf.q, q, 4 * sizeof(float));
+            break;
+        case FILTER_MAHONY_FIXED:
+            for(int i = 0; i < 4; i++)
+                filter->state.mahony_fixed.q[i] = q30_from_float(q[i]);
+            break;
+        default:
+            break;
+    }
+}
+
+static void filter_update_fixed(filter_t *filter, const gyro_float_data_t *gyro, const raw_float_data_t *accel){
+    gyro_fixed_data_t rate = {q16_from_float(gyro->x), q16_from_float(gyro->y), q16_from_float(gyro->z)};
+    raw_fixed_data_t acc = {q16_from_float(accel->x), q16_from_float(accel->y), q16_from_float(accel->z)};
+    mahony_fixed_update_imu(&filter->state.mahony_fixed, &rate, &acc);
+}
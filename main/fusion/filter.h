@@ -0,0 +1,124 @@
+/*!
+* @file filter.h
+* @author Ethan Lew
+* @brief Attitude filter front end with a runtime selectable mode
+*
+* Wraps every fusion filter behind one update call so the sampling loop does not care
+* which one is running, and so the mode can be switched on the fly (the current
+* orientation is carried over to the new filter).
+*
+* Modes without a magnetometer let the FXOS8700 run accelerometer only, which shortens
+* its burst read. Per fused sample, as measured by otis_filter_sweep on an x86-64 host
+* build: I2C payload bytes (register address and bus overhead not included) and the
+* cost of one update, also relative to the 9 DoF Madgwick:
+*
+*   mode                   gyro   fxos8700   total     ns    relative
+*   FILTER_MADGWICK         7       13         20      ~90     1
+*   FILTER_MADGWICK_IMU     7        7         14      ~60     ~0.65
+*   FILTER_MAHONY           7        7         14      ~55     ~0.6
+*   FILTER_COMPLEMENTARY    7        7         14     ~130     ~1.4
+*   FILTER_UKF              7       13         20    ~5000     ~55
+*   FILTER_MAHONY_FIXED     7        7         14     ~110     ~1.2
+*
+* The times vary by about 20% from run to run (the UKF by more), so they are rounded.
+* Every mode reads both sensors in one batched transaction.
+*
+* FILTER_MAHONY_FIXED is Mahony in integer arithmetic (mahony_fixed.h), for parts
+* without an FPU, and the default mode of OTIS_FIXED_POINT builds. Its inputs are
+* taken from the float arguments with q16_from_float, which is exact for the values
+* the fixed point drivers produce (see fixed.h).
+*/
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include "madgwick.h"
+#include "mahony.h"
+#include "complementary.h"
+#include "ukf.h"
+#include "mahony_fixed.h"
+
+typedef enum {
+    FILTER_MADGWICK = 0x0,       /**< Madgwick, 9 DoF */
+    FILTER_MADGWICK_IMU = 0x1,   /**< Madgwick, 6 DoF */
+    FILTER_MAHONY = 0x2,         /**< Mahony, 6 DoF */
+    FILTER_COMPLEMENTARY = 0x3,  /**< Quaternion complementary, 6 DoF */
+    FILTER_UKF = 0x4,            /**< Unscented Kalman filter, 9 DoF */
+    FILTER_MAHONY_FIXED = 0x5,   /**< Mahony in fixed point, 6 DoF */
+    FILTER_MODE_COUNT = 0x6,
+} filter_mode_t;
+
+typedef enum {
+    FILTER_SUCCESS = 0x0,
+    FILTER_BAD_MODE = 0x1,
+    FILTER_DIVERGED = 0x2,       /**< The UKF rejected a step, see ukf_err_t */
+} filter_err_t;
+
+typedef struct filter_s {
+    filter_mode_t mode;
+    float sample_freq;
+    uint8_t aligned;             /**< UKF has been aligned from accel/magn */
+    union {
+        madgwick_t madgwick;
+        mahony_t mahony;
+        complementary_t complementary;
+        ukf_t ukf;
+        mahony_fixed_t mahony_fixed;
+    } state;
+} filter_t;
+
+/*!
+* @brief reset the filter in the given mode with its default gains
+* @param filter the filter
+* @param mode the filter mode
+* @param sample_freq the update rate (Hz)
+* @returns FILTER_BAD_MODE for an unknown mode
+*/
+filter_err_t filter_init(filter_t *filter, filter_mode_t mode, float sample_freq);
+
+/*!
+* @brief switch mode, keeping the current orientation
+* @param filter the filter
+* @param mode the new mode
+* @returns FILTER_BAD_MODE for an unknown mode
+*/
+filter_err_t filter_set_mode(filter_t *filter, filter_mode_t mode);
+
+/*!
+* @brief set the mode's main gain: Madgwick beta, Mahony kp (float and fixed point),
+* the complementary gain
+* @param filter the filter
+* @param gain the gain, as the mode's default (e.g. MADGWICK_BETA_DEFAULT)
+* @returns FILTER_BAD_MODE for the UKF, whose noise model has no single gain
+*/
+filter_err_t filter_set_gain(filter_t *filter, float gain);
+
+/*!
+* @brief whether a mode reads the magnetometer
+*/
+uint8_t filter_uses_magn(filter_mode_t mode);
+
+/*!
+* @brief one fused update
+* @param filter the filter
+* @param gyro angular rate (rad/s)
+* @param accel acceleration, any unit
+* @param magn magnetic field, any unit; NULL (or a 6 DoF mode) ignores it, and 9 DoF
+*        modes then fall back to their gyro/accel only step
+* @returns filter status
+*/
+filter_err_t filter_update(filter_t *filter, const gyro_float_data_t *gyro,
+                           const raw_float_data_t *accel, const raw_float_data_t *magn);
+
+/*!
+* @brief current orientation, {w, x, y, z}, body to earth
+*/
+void filter_quaternion(const filter_t *filter, float *q);
+
+/*!
+* @brief orientation as aerospace (ZYX) Euler angles in radians
+*/
+void filter_euler(const filter_t *filter, float *roll, float *pitch, float *yaw);
+
+#endif
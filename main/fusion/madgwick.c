@@ -0,0 +1,213 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "madgwick.h"
+
+/* Keeps inverse square roots finite for zero vectors, which then normalize to zero */
+#define MADGWICK_EPS (1e-30F)
+
+static inline float madgwick_inv_sqrt(float x);
+
+void madgwick_init(madgwick_t *filter, float beta, float sample_freq){
+    filter->q0 = 1.0F;
+    filter->q1 = 0.0F;
+    filter->q2 = 0.0F;
+    filter->q3 = 0.0F;
+    filter->beta = beta;
+    filter->dt = 1.0F / sample_freq;
+}
+
+/*!
+* One update step
+*   1. Rate of change of the quaternion from the gyroscope
+*   2. Normalize the accelerometer and magnetometer
+*   3. Reference direction of the earth's magnetic field (bx, bz)
+*   4. Gradient of the objective function; its six residuals f1..f6 are shared by
+*      all four gradient components, so they are formed once
+*   5. Apply the normalized gradient step with gain beta, integrate and normalize
+*/
+void madgwick_update(madgwick_t *filter, const gyro_float_data_t *gyro,
+                     const raw_float_data_t *accel, const raw_float_data_t *magn){
+    float q0 = filter->q0;
+    float q1 = filter->q1;
+    float q2 = filter->q2;
+    float q3 = filter->q3;
+    float recip_norm;
+
+    /* Rate of change of quaternion from gyroscope */
+    float qdot0 = 0.5F * (-q1 * gyro->x - q2 * gyro->y - q3 * gyro->z);
+    float qdot1 = 0.5F * (q0 * gyro->x + q2 * gyro->z - q3 * gyro->y);
+    float qdot2 = 0.5F * (q0 * gyro->y - q1 * gyro->z + q3 * gyro->x);
+    float qdot3 = 0.5F * (q0 * gyro->z + q1 * gyro->y - q2 * gyro->x);
+
+    /* Normalize accelerometer measurement */
+    float ax = accel->x;
+    float ay = accel->y;
+    float az = accel->z;
+    recip_norm = madgwick_inv_sqrt(ax * ax + ay * ay + az * az + MADGWICK_EPS);
+    ax *= recip_norm;
+    ay *= recip_norm;
+    az *= recip_norm;
+
+    /* Normalize magnetometer measurement */
+    float mx = magn->x;
+    float my = magn->y;
+    float mz = magn->z;
+    recip_norm = madgwick_inv_sqrt(mx * mx + my * my + mz * mz + MADGWICK_EPS);
+    mx *= recip_norm;
+    my *= recip_norm;
+    mz *= recip_norm;
+
+    /* Auxiliary variables to avoid repeated arithmetic */
+    float _2q0mx = 2.0F * q0 * mx;
+    float _2q0my = 2.0F * q0 * my;
+    float _2q0mz = 2.0F * q0 * mz;
+    float _2q1mx = 2.0F * q1 * mx;
+    float _2q0 = 2.0F * q0;
+    float _2q1 = 2.0F * q1;
+    float _2q2 = 2.0F * q2;
+    float _2q3 = 2.0F * q3;
+    float q0q0 = q0 * q0;
+    float q0q1 = q0 * q1;
+    float q0q2 = q0 * q2;
+    float q0q3 = q0 * q3;
+    float q1q1 = q1 * q1;
+    float q1q2 = q1 * q2;
+    float q1q3 = q1 * q3;
+    float q2q2 = q2 * q2;
+    float q2q3 = q2 * q3;
+    float q3q3 = q3 * q3;
+
+    /* Reference direction of Earth's magnetic field */
+    float hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+    float hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+    float hxy = hx * hx + hy * hy + MADGWICK_EPS;
+    float _2bx = hxy * madgwick_inv_sqrt(hxy);
+    float _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+    float _4bx = 2.0F * _2bx;
+    float _4bz = 2.0F * _2bz;
+
+    /* Objective function residuals */
+    float f1 = 2.0F * (q1q3 - q0q2) - ax;
+    float f2 = 2.0F * (q0q1 + q2q3) - ay;
+    float f3 = 1.0F - 2.0F * (q1q1 + q2q2) - az;
+    float f4 = _2bx * (0.5F - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx;
+    float f5 = _2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my;
+    float f6 = _2bx * (q0q2 + q1q3) + _2bz * (0.5F - q1q1 - q2q2) - mz;
+
+    /* Gradient decent algorithm corrective step */
+    float s0 = -_2q2 * f1 + _2q1 * f2 - _2bz * q2 * f4 + (-_2bx * q3 + _2bz * q1) * f5 + _2bx * q2 * f6;
+    float s1 = _2q3 * f1 + _2q0 * f2 - 4.0F * q1 * f3 + _2bz * q3 * f4 + (_2bx * q2 + _2bz * q0) * f5 + (_2bx * q3 - _4bz * q1) * f6;
+    float s2 = -_2q0 * f1 + _2q3 * f2 - 4.0F * q2 * f3 + (-_4bx * q2 - _2bz * q0) * f4 + (_2bx * q1 + _2bz * q3) * f5 + (_2bx * q0 - _4bz * q2) * f6;
+    float s3 = _2q1 * f1 + _2q2 * f2 + (-_4bx * q3 + _2bz * q1) * f4 + (-_2bx * q0 + _2bz * q2) * f5 + _2bx * q1 * f6;
+    recip_norm = filter->beta * madgwick_inv_sqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3 + MADGWICK_EPS);
+
+    /* Apply feedback step and integrate */
+    q0 += (qdot0 - recip_norm * s0) * filter->dt;
+    q1 += (qdot1 - recip_norm * s1) * filter->dt;
+    q2 += (qdot2 - recip_norm * s2) * filter->dt;
+    q3 += (qdot3 - recip_norm * s3) * filter->dt;
+
+    /* Normalize quaternion */
+    recip_norm = madgwick_inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    filter->q0 = q0 * recip_norm;
+    filter->q1 = q1 * recip_norm;
+    filter->q2 = q2 * recip_norm;
+    filter->q3 = q3 * recip_norm;
+}
+
+void madgwick_update_imu(madgwick_t *filter, const gyro_float_data_t *gyro, const raw_float_data_t *accel){
+    float q0 = filter->q0;
+    float q1 = filter->q1;
+    float q2 = filter->q2;
+    float q3 = filter->q3;
+    float recip_norm;
+
+    /* Rate of change of quaternion from gyroscope */
+    float qdot0 = 0.5F * (-q1 * gyro->x - q2 * gyro->y - q3 * gyro->z);
+    float qdot1 = 0.5F * (q0 * gyro->x + q2 * gyro->z - q3 * gyro->y);
+    float qdot2 = 0.5F * (q0 * gyro->y - q1 * gyro->z + q3 * gyro->x);
+    float qdot3 = 0.5F * (q0 * gyro->z + q1 * gyro->y - q2 * gyro->x);
+
+    /* Normalize accelerometer measurement */
+    float ax = accel->x;
+    float ay = accel->y;
+    float az = accel->z;
+    recip_norm = madgwick_inv_sqrt(ax * ax + ay * ay + az * az + MADGWICK_EPS);
+    ax *= recip_norm;
+    ay *= recip_norm;
+    az *= recip_norm;
+
+    /* Auxiliary variables to avoid repeated arithmetic */
+    float _2q0 = 2.0F * q0;
+    float _2q1 = 2.0F * q1;
+    float _2q2 = 2.0F * q2;
+    float _2q3 = 2.0F * q3;
+    float _4q0 = 4.0F * q0;
+    float _4q1 = 4.0F * q1;
+    float _4q2 = 4.0F * q2;
+    float _8q1 = 8.0F * q1;
+    float _8q2 = 8.0F * q2;
+    float q0q0 = q0 * q0;
+    float q1q1 = q1 * q1;
+    float q2q2 = q2 * q2;
+    float q3q3 = q3 * q3;
+
+    /* Gradient decent algorithm corrective step */
+    float s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+    float s1 = _4q1 * q3q3 - _2q3 * ax + 4.0F * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+    float s2 = 4.0F * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+    float s3 = 4.0F * q1q1 * q3 - _2q1 * ax + 4.0F * q2q2 * q3 - _2q2 * ay;
+    recip_norm = filter->beta * madgwick_inv_sqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3 + MADGWICK_EPS);
+
+    /* Apply feedback step and integrate */
+    q0 += (qdot0 - recip_norm * s0) * filter->dt;
+    q1 += (qdot1 - recip_norm * s1) * filter->dt;
+    q2 += (qdot2 - recip_norm * s2) * filter->dt;
+    q3 += (qdot3 - recip_norm * s3) * filter->dt;
+
+    /* Normalize quaternion */
+    recip_norm = madgwick_inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    filter->q0 = q0 * recip_norm;
+    filter->q1 = q1 * recip_norm;
+    filter->q2 = q2 * recip_norm;
+    filter->q3 = q3 * recip_norm;
+}
+
+void madgwick_euler(const madgwick_t *filter, float *roll, float *pitch, float *yaw){
+    float q0 = filter->q0;
+    float q1 = filter->q1;
+    float q2 = filter->q2;
+    float q3 = filter->q3;
+    float sinp = 2.0F * (q0 * q2 - q3 * q1);
+
+    /* Clamp for numerical noise at the poles */
+    if(sinp > 1.0F)
+        sinp = 1.0F;
+    if(sinp < -1.0F)
+        sinp = -1.0F;
+
+    *roll = atan2f(2.0F * (q0 * q1 + q2 * q3), 1.0F - 2.0F * (q1 * q1 + q2 * q2));
+    *pitch = asinf(sinp);
+    *yaw = atan2f(2.0F * (q0 * q3 + q1 * q2), 1.0F - 2.0F * (q2 * q2 + q3 * q3));
+}
+
+/*!
+* Inverse square root. The fast variant is the classic bit-level initial guess refined
+* by one Newton-Raphson iteration, type punned through memcpy to stay within strict
+* aliasing rules (it compiles to register moves).
+*/
+static inline float madgwick_inv_sqrt(float x){
+#if MADGWICK_FAST_INV_SQRT
+    float halfx = 0.5F * x;
+    float y;
+    uint32_t i;
+    memcpy(&i, &x, sizeof(i));
+    i = 0x5f3759df - (i >> 1);
+    memcpy(&y, &i, sizeof(y));
+    y = y * (1.5F - (halfx * y * y));
+    return y;
+#else
+    return 1.0F / sqrtf(x);
+#endif
+}
@@ -0,0 +1,294 @@
+#include <math.h>
+#include <string.h>
+#include "magcal.h"
+
+/* Quadric coefficients: the design vector and the constant */
+#define MAGCAL_QUADRIC (MAGCAL_PARAMS + 1)
+/* Cyclic Jacobi sweeps; 10x10 converges in about 8, 3x3 in about 4 */
+#define MAGCAL_JACOBI_SWEEPS 32
+
+static void magcal_eigen(const double *a, double *v, double *w, int n);
+
+static double magcal_det3(const double *a);
+
+static double magcal_spread(const double *cov);
+
+void magcal_init(magcal_t *cal){
+    memset(cal, 0, sizeof(magcal_t));
+}
+
+/*!
+* Take a sample
+*   1. Skip it when it is within MAGCAL_MIN_SPACING_UT of the last one taken
+*   2. Design vector d = [x^2, y^2, z^2, 2xy, 2xz, 2yz, 2x, 2y, 2z] of the normalized
+*      sample; accumulate d d^T (upper triangle) and d
+*   3. Halve everything once the window is full
+*/
+magcal_err_t magcal_add(magcal_t *cal, const raw_float_data_t *m){
+    if(cal->samples > 0){
+        float dx = m->x - cal->last[0];
+        float dy = m->y - cal->last[1];
+        float dz = m->z - cal->last[2];
+        if(dx * dx + dy * dy + dz * dz < MAGCAL_MIN_SPACING_UT * MAGCAL_MIN_SPACING_UT){
+            cal->skipped++;
+            return MAGCAL_SKIPPED;
+        }
+    }
+    cal->last[0] = m->x;
+    cal->last[1] = m->y;
+    cal->last[2] = m->z;
+    cal->samples++;
+
+    double x = m->x / MAGCAL_SCALE_UT;
+    double y = m->y / MAGCAL_SCALE_UT;
+    double z = m->z / MAGCAL_SCALE_UT;
+    const double d[MAGCAL_PARAMS] = {x * x, y * y, z * z, 2.0 * x * y, 2.0 * x * z, 2.0 * y * z, 2.0 * x, 2.0 * y, 2.0 * z};
+
+    double *s = cal->stats;
+    for(int i = 0; i < MAGCAL_PARAMS; i++){
+        for(int j = i; j < MAGCAL_PARAMS; j++)
+            *s++ += d[i] * d[j];
+        cal->sum_d[i] += d[i];
+    }
+    cal->n += 1.0;
+
+    if(cal->n >= MAGCAL_WINDOW){
+        for(int i = 0; i < MAGCAL_STATS; i++)
+            cal->stats[i] *= 0.5;
+        for(int i = 0; i < MAGCAL_PARAMS; i++)
+            cal->sum_d[i] *= 0.5;
+        cal->n *= 0.5;
+    }
+    return MAGCAL_SUCCESS;
+}
+
+/*!
+* Fit
+*   1. The quadric p = [a b c d e f g h i j] with d p + j about 0 for every sample and
+*      |p| = 1 is the eigenvector of the smallest eigenvalue of the scatter matrix
+*      G = sum [d 1]^T [d 1], which the statistics hold. Unlike fixing j, this does
+*      not break down when the hard iron moves the origin onto the ellipsoid
+*   2. A = [a d e; d b f; e f c], v = [g h i]; the center is c = -A^-1 v and the
+*      ellipsoid (u - c)^T M (u - c) = 1 with M = A / k, k = c^T A c - j
+*   3. M = V diag(l) V^T must be positive definite. W = V diag(sqrt(l)) V^T, scaled to
+*      determinant 1, maps the ellipsoid onto the sphere of radius det(M)^(-1/6)
+*   4. The smallest eigenvalue is the residual sum of squares of [d 1] p, and
+*      [d 1] p is k ((u - c)^T M (u - c) - 1), about 2k times the relative radial error
+*   5. Coverage from the covariance of the samples, both as measured and mapped through
+*      W: a wrong W fitted to an arc of samples can make the mapped ones look spread
+*/
+magcal_err_t magcal_fit(const magcal_t *cal, magcal_result_t *out){
+    if(cal->n < MAGCAL_MIN_SAMPLES)
+        return MAGCAL_FEW_SAMPLES;
+
+    double g[MAGCAL_QUADRIC * MAGCAL_QUADRIC];
+    double gv[MAGCAL_QUADRIC * MAGCAL_QUADRIC];
+    double gl[MAGCAL_QUADRIC];
+    const double *s = cal->stats;
+    for(int i = 0; i < MAGCAL_PARAMS; i++){
+        for(int j = i; j < MAGCAL_PARAMS; j++){
+            g[i * MAGCAL_QUADRIC + j] = *s;
+            g[j * MAGCAL_QUADRIC + i] = *s++;
+        }
+        g[i * MAGCAL_QUADRIC + MAGCAL_PARAMS] = cal->sum_d[i];
+        g[MAGCAL_PARAMS * MAGCAL_QUADRIC + i] = cal->sum_d[i];
+    }
+    g[MAGCAL_QUADRIC * MAGCAL_QUADRIC - 1] = cal->n;
+    magcal_eigen(g, gv, gl, MAGCAL_QUADRIC);
+    int smallest_p = 0;
+    for(int i = 1; i < MAGCAL_QUADRIC; i++){
+        if(gl[i] < gl[smallest_p])
+            smallest_p = i;
+    }
+    double p[MAGCAL_QUADRIC];
+    for(int i = 0; i < MAGCAL_QUADRIC; i++)
+        p[i] = gv[i * MAGCAL_QUADRIC + smallest_p];
+    double sse = gl[smallest_p] > 0.0 ? gl[smallest_p] : 0.0;
+
+    const double a[9] = {p[0], p[3], p[4], p[3], p[1], p[5], p[4], p[5], p[2]};
+    const double v[3] = {p[6], p[7], p[8]};
+    double det = magcal_det3(a);
+    if(fabs(det) < 1e-12)
+        return MAGCAL_NO_FIT;
+    /* c = -A^-1 v by the adjugate */
+    double c[3];
+    c[0] = -((a[4] * a[8] - a[5] * a[7]) * v[0] + (a[2] * a[7] - a[1] * a[8]) * v[1] + (a[1] * a[5] - a[2] * a[4]) * v[2]) / det;
+    c[1] = -((a[5] * a[6] - a[3] * a[8]) * v[0] + (a[0] * a[8] - a[2] * a[6]) * v[1] + (a[2] * a[3] - a[0] * a[5]) * v[2]) / det;
+    c[2] = -((a[3] * a[7] - a[4] * a[6]) * v[0] + (a[1] * a[6] - a[0] * a[7]) * v[1] + (a[0] * a[4] - a[1] * a[3]) * v[2]) / det;
+    /* c^T A c = -c^T v */
+    double k = -(c[0] * v[0] + c[1] * v[1] + c[2] * v[2]) - p[9];
+    if(k == 0.0)
+        return MAGCAL_NO_FIT;
+
+    double m[9], vec[9], l[3];
+    for(int i = 0; i < 9; i++)
+        m[i] = a[i] / k;
+    magcal_eigen(m, vec, l, 3);
+    if(l[0] <= 0.0 || l[1] <= 0.0 || l[2] <= 0.0)
+        return MAGCAL_NO_FIT;
+    double radius = pow(l[0] * l[1] * l[2], -1.0 / 6.0);
+    double w[9];
+    for(int i = 0; i < 3; i++){
+        for(int j = 0; j < 3; j++){
+            double sum = 0.0;
+            for(int e = 0; e < 3; e++)
+                sum += vec[i * 3 + e] * sqrt(l[e]) * vec[j * 3 + e];
+            w[i * 3 + j] = sum * radius;
+        }
+    }
+
+    /* Covariance E[u u^T] - E[u] E[u]^T, then W cov W^T */
+    double n = cal->n;
+    const double mean[3] = {cal->sum_d[6] / (2.0 * n), cal->sum_d[7] / (2.0 * n), cal->sum_d[8] / (2.0 * n)};
+    double cov[9] = {
+        cal->sum_d[0] / n, cal->sum_d[3] / (2.0 * n), cal->sum_d[4] / (2.0 * n),
+        cal->sum_d[3] / (2.0 * n), cal->sum_d[1] / n, cal->sum_d[5] / (2.0 * n),
+        cal->sum_d[4] / (2.0 * n), cal->sum_d[5] / (2.0 * n), cal->sum_d[2] / n,
+    };
+    for(int i = 0; i < 3; i++){
+        for(int j = 0; j < 3; j++)
+            cov[i * 3 + j] -= mean[i] * mean[j];
+    }
+    double wc[9], spread[9];
+    for(int i = 0; i < 3; i++){
+        for(int j = 0; j < 3; j++){
+            wc[i * 3 + j] = w[i * 3] * cov[j] + w[i * 3 + 1] * cov[3 + j] + w[i * 3 + 2] * cov[6 + j];
+        }
+    }
+    for(int i = 0; i < 3; i++){
+        for(int j = 0; j < 3; j++){
+            spread[i * 3 + j] = wc[i * 3] * w[j * 3] + wc[i * 3 + 1] * w[j * 3 + 1] + wc[i * 3 + 2] * w[j * 3 + 2];
+        }
+    }
+    double coverage = fmin(magcal_spread(cov), magcal_spread(spread));
+
+    for(int i = 0; i < 3; i++)
+        out->cal.offset[i] = (float)(c[i] * MAGCAL_SCALE_UT);
+    for(int i = 0; i < 9; i++)
+        out->cal.soft[i] = (float)w[i];
+    out->field = (float)(radius * MAGCAL_SCALE_UT);
+    out->fit_error = (float)(sqrt(sse / n) / (2.0 * fabs(k)));
+    out->coverage = (float)fmax(0.0, fmin(1.0, coverage));
+    out->anisotropy = (float)sqrt(fmax(l[0], fmax(l[1], l[2])) / fmin(l[0], fmin(l[1], l[2])));
+    out->samples = (uint32_t)n;
+    return MAGCAL_SUCCESS;
+}
+
+uint8_t magcal_usable(const magcal_result_t *fit){
+    return fit->samples >= MAGCAL_MIN_SAMPLES && fit->fit_error <= MAGCAL_MAX_FIT_ERROR &&
+           fit->coverage >= MAGCAL_MIN_COVERAGE && fit->anisotropy <= MAGCAL_MAX_ANISOTROPY;
+}
+
+uint8_t magcal_is_identity(const magcal_result_t *fit){
+    const fxos8700_magn_cal_t *cal = &fit->cal;
+    float offset = sqrtf(cal->offset[0] * cal->offset[0] + cal->offset[1] * cal->offset[1] +
+                         cal->offset[2] * cal->offset[2]);
+    if(offset > MAGCAL_IDENTITY_OFFSET_UT)
+        return 0;
+    for(int i = 0; i < 9; i++){
+        float identity = (i % 4 == 0) ? 1.0F : 0.0F;
+        if(fabsf(cal->soft[i] - identity) > MAGCAL_IDENTITY_SOFT)
+            return 0;
+    }
+    return 1;
+}
+
+/*!
+* next(first(m)) = Wn (Wf (m - bf) - bn) = Wn Wf (m - (bf + Wf^-1 bn))
+*/
+void magcal_compose(const fxos8700_magn_cal_t *first, const fxos8700_magn_cal_t *next, fxos8700_magn_cal_t *out){
+    if(!first){
+        *out = *next;
+        return;
+    }
+    const float *f = first->soft;
+    double fd[9];
+    for(int i = 0; i < 9; i++)
+        fd[i] = f[i];
+    double det = magcal_det3(fd);
+    const float *bn = next->offset;
+    float offset[3];
+    /* Wf^-1 bn by the adjugate; a correction is never singular */
+    offset[0] = first->offset[0] + (float)(((f[4] * f[8] - f[5] * f[7]) * bn[0] + (f[2] * f[7] - f[1] * f[8]) * bn[1] +
+                                            (f[1] * f[5] - f[2] * f[4]) * bn[2]) / det);
+    offset[1] = first->offset[1] + (float)(((f[5] * f[6] - f[3] * f[8]) * bn[0] + (f[0] * f[8] - f[2] * f[6]) * bn[1] +
+                                            (f[2] * f[3] - f[0] * f[5]) * bn[2]) / det);
+    offset[2] = first->offset[2] + (float)(((f[3] * f[7] - f[4] * f[6]) * bn[0] + (f[1] * f[6] - f[0] * f[7]) * bn[1] +
+                                            (f[0] * f[4] - f[1] * f[3]) * bn[2]) / det);
+    float soft[9];
+    for(int i = 0; i < 3; i++){
+        for(int j = 0; j < 3; j++)
+            soft[i * 3 + j] = next->soft[i * 3] * f[j] + next->soft[i * 3 + 1] * f[3 + j] + next->soft[i * 3 + 2] * f[6 + j];
+    }
+    memcpy(out->offset, offset, sizeof(offset));
+    memcpy(out->soft, soft, sizeof(soft));
+}
+
+/*!
+* Eigen decomposition of a symmetric n x n (n <= MAGCAL_QUADRIC) by cyclic Jacobi
+* rotations: a = v diag(w) v^T, eigenvectors in the columns of v
+*/
+static void magcal_eigen(const double *a, double *v, double *w, int n){
+    double m[MAGCAL_QUADRIC * MAGCAL_QUADRIC];
+    double total = 0.0;
+    for(int i = 0; i < n * n; i++){
+        m[i] = a[i];
+        v[i] = (i % (n + 1) == 0) ? 1.0 : 0.0;
+        total += a[i] * a[i];
+    }
+
+    for(int sweep = 0; sweep < MAGCAL_JACOBI_SWEEPS; sweep++){
+        double off = 0.0;
+        for(int p = 0; p < n - 1; p++){
+            for(int q = p + 1; q < n; q++)
+                off += m[p * n + q] * m[p * n + q];
+        }
+        if(off <= 1e-32 * total)
+            break;
+        for(int p = 0; p < n - 1; p++){
+            for(int q = p + 1; q < n; q++){
+                double apq = m[p * n + q];
+                if(apq == 0.0)
+                    continue;
+                double theta = (m[q * n + q] - m[p * n + p]) / (2.0 * apq);
+                double t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                double c = 1.0 / sqrt(t * t + 1.0);
+                double s = t * c;
+                for(int k = 0; k < n; k++){
+                    double mkp = m[k * n + p];
+                    double mkq = m[k * n + q];
+                    m[k * n + p] = c * mkp - s * mkq;
+                    m[k * n + q] = s * mkp + c * mkq;
+                }
+                for(int k = 0; k < n; k++){
+                    double mpk = m[p * n + k];
+                    double mqk = m[q * n + k];
+                    m[p * n + k] = c * mpk - s * mqk;
+                    m[q * n + k] = s * mpk + c * mqk;
+                }
+                for(int k = 0; k < n; k++){
+                    double vkp = v[k * n + p];
+                    double vkq = v[k * n + q];
+                    v[k * n + p] = c * vkp - s * vkq;
+                    v[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+    for(int i = 0; i < n; i++)
+        w[i] = m[i * n + i];
+}
+
+static double magcal_det3(const double *a){
+    return a[0] * (a[4] * a[8] - a[5] * a[7]) - a[1] * (a[3] * a[8] - a[5] * a[6]) + a[2] * (a[3] * a[7] - a[4] * a[6]);
+}
+
+/*!
+* 3 times the smallest eigenvalue of a covariance over its trace
+*/
+static double magcal_spread(const double *cov){
+    double vec[9], l[3];
+    magcal_eigen(cov, vec, l, 3);
+    double trace = l[0] + l[1] + l[2];
+    return trace > 0.0 ? 3.0 * fmin(l[0], fmin(l[1], l[2])) / trace : 0.0;
+}
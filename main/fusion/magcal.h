@@ -0,0 +1,128 @@
+/*!
+* @file magcal.h
+* @author Ethan Lew
+* @brief Online magnetometer hard and soft iron calibration
+*
+* A magnetometer in a fixed hard and soft iron environment measures points on an
+* ellipsoid, m = S h + b, instead of on a sphere of the field strength. The
+* calibrator fits the quadric
+*
+*     a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz + 2g x + 2h y + 2i z = 1
+*
+* by least squares. Each sample only adds its outer product to the 9x9 normal
+* equations (running sufficient statistics), so nothing is buffered and a fit can be
+* taken at any time, at the cost of one 9x9 Cholesky solve and a 3x3 eigen
+* decomposition. The fit gives the offset b (hard iron) and a symmetric correction W
+* (soft iron, determinant 1) with |W (m - b)| equal to the fitted field strength.
+*
+* Samples closer than MAGCAL_MIN_SPACING_UT to the last one taken are skipped, so
+* holding still does not weigh one direction. Once MAGCAL_WINDOW samples are in,
+* the statistics are halved, which makes the fit forget old data and follow a
+* changed environment.
+*
+* The fit reports
+*   - fit_error: rms radial distance of the samples from the ellipsoid, relative to
+*     the field strength, computed from the statistics
+*   - coverage: how evenly the corrected samples spread over the sphere, 3 times the
+*     smallest eigenvalue of their covariance over its trace; 1 for samples all over
+*     the sphere, about 1/3 for a hemisphere, 0 for a single plane of rotation
+*   - anisotropy: how far the soft iron correction is from a rotation, the ratio of its
+*     largest and smallest gain
+*
+* Accumulation is in double precision: the fourth order sums are badly conditioned in
+* float. A sample costs 54 multiply-adds; apply the result with magn_set_calibration,
+* which costs the conversion 9 multiply-adds and 3 subtractions per sample.
+*/
+
+#ifndef MAGCAL_H
+#define MAGCAL_H
+
+#include <stdint.h>
+#include "fxos8700.h"
+
+#define MAGCAL_PARAMS 9
+#define MAGCAL_STATS (MAGCAL_PARAMS * (MAGCAL_PARAMS + 1) / 2)
+
+/* Samples are normalized by this before accumulating, keeping the sums near 1 */
+#define MAGCAL_SCALE_UT (50.0F)
+#define MAGCAL_MIN_SPACING_UT (2.0F)
+#define MAGCAL_WINDOW (2000)
+/* Acceptance of a fit, see magcal_usable */
+#define MAGCAL_MIN_SAMPLES (60)
+#define MAGCAL_MAX_FIT_ERROR (0.03F)
+#define MAGCAL_MIN_COVERAGE (0.4F)
+/* Soft iron on a board is mild; a fit needing more than this is stretching an arc of
+   samples into a small ellipsoid */
+#define MAGCAL_MAX_ANISOTROPY (2.0F)
+/* A fit closer than this to no correction is not worth applying, see magcal_is_identity */
+#define MAGCAL_IDENTITY_OFFSET_UT (0.5F)
+#define MAGCAL_IDENTITY_SOFT (0.01F)
+
+typedef enum {
+    MAGCAL_SUCCESS = 0x0,
+    MAGCAL_SKIPPED = 0x1,        /**< Sample too close to the previous one, not used */
+    MAGCAL_FEW_SAMPLES = 0x2,    /**< Fewer than MAGCAL_MIN_SAMPLES samples */
+    MAGCAL_NO_FIT = 0x3,         /**< The samples do not describe an ellipsoid */
+} magcal_err_t;
+
+typedef struct magcal_s {
+    double stats[MAGCAL_STATS];  /**< Upper triangle of sum d d^T, row by row */
+    double sum_d[MAGCAL_PARAMS]; /**< sum d */
+    double n;                    /**< Weight of the samples in the sums */
+    float last[3];               /**< Last sample taken (uT) */
+    uint32_t samples;            /**< Samples taken since magcal_init */
+    uint32_t skipped;            /**< Samples skipped since magcal_init */
+} magcal_t;
+
+typedef struct magcal_result_s {
+    fxos8700_magn_cal_t cal;     /**< Offset and soft iron correction */
+    float field;                 /**< Fitted field strength (uT) */
+    float fit_error;             /**< rms radial error, relative to field */
+    float coverage;              /**< Spread of the samples over the sphere, 0 to 1 */
+    float anisotropy;            /**< Largest over smallest gain of the soft iron correction */
+    uint32_t samples;            /**< Samples in the fit */
+} magcal_result_t;
+
+/*!
+* @brief start over with no samples
+*/
+void magcal_init(magcal_t *cal);
+
+/*!
+* @brief take one magnetometer sample
+* @param cal the calibrator
+* @param m the field (uT) as converted; when a correction is already applied, compose
+*          the fit with it (magcal_compose)
+* @returns MAGCAL_SKIPPED if the sample was too close to the previous one
+*/
+magcal_err_t magcal_add(magcal_t *cal, const raw_float_data_t *m);
+
+/*!
+* @brief fit the samples taken so far
+* @param cal the calibrator
+* @param out the correction, field strength and quality
+* @returns MAGCAL_FEW_SAMPLES or MAGCAL_NO_FIT if there is no result
+*/
+magcal_err_t magcal_fit(const magcal_t *cal, magcal_result_t *out);
+
+/*!
+* @brief whether a fit has the samples, fit error, coverage and anisotropy to be applied
+*/
+uint8_t magcal_usable(const magcal_result_t *fit);
+
+/*!
+* @brief whether a fit is within MAGCAL_IDENTITY_* of no correction
+*/
+uint8_t magcal_is_identity(const magcal_result_t *fit);
+
+/*!
+* @brief the correction of applying first, then next: out = next(first(m))
+* Refits of samples that were already corrected are composed with the correction in
+* use this way.
+* @param first the correction applied first, NULL for none
+* @param next the correction applied to its output
+* @param out the combined correction, may alias next
+*/
+void magcal_compose(const fxos8700_magn_cal_t *first, const fxos8700_magn_cal_t *next, fxos8700_magn_cal_t *out);
+
+#endif
@@ -0,0 +1,71 @@
+#include <math.h>
+#include "mahony.h"
+#include "quaternion.h"
+
+void mahony_init(mahony_t *filter, float kp, float ki, float sample_freq){
+    filter->q[0] = 1.0F;
+    filter->q[1] = 0.0F;
+    filter->q[2] = 0.0F;
+    filter->q[3] = 0.0F;
+    filter->integral[0] = 0.0F;
+    filter->integral[1] = 0.0F;
+    filter->integral[2] = 0.0F;
+    filter->kp = kp;
+    filter->ki = ki;
+    filter->dt = 1.0F / sample_freq;
+}
+
+/*!
+* One update step
+*   1. Predicted gravity direction in the body frame, the third row of R(q)
+*   2. Error is the cross product of the measured and predicted directions
+*   3. Integral and proportional feedback onto the angular rate
+*   4. Integrate q' = q (0, w) / 2 and normalize
+*/
+void mahony_update_imu(mahony_t *filter, const gyro_float_data_t *gyro, const raw_float_data_t *accel){
+    float *q = filter->q;
+    float gx = gyro->x;
+    float gy = gyro->y;
+    float gz = gyro->z;
+    float norm = accel->x * accel->x + accel->y * accel->y + accel->z * accel->z;
+
+    if(norm > 0.0F){
+        float recip_norm = 1.0F / sqrtf(norm);
+        float ax = accel->x * recip_norm;
+        float ay = accel->y * recip_norm;
+        float az = accel->z * recip_norm;
+
+        /* Estimated direction of gravity */
+        float vx = 2.0F * (q[1] * q[3] - q[0] * q[2]);
+        float vy = 2.0F * (q[0] * q[1] + q[2] * q[3]);
+        float vz = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+
+        /* Error between measured and estimated direction */
+        float ex = ay * vz - az * vy;
+        float ey = az * vx - ax * vz;
+        float ez = ax * vy - ay * vx;
+
+        if(filter->ki > 0.0F){
+            filter->integral[0] += filter->ki * ex * filter->dt;
+            filter->integral[1] += filter->ki * ey * filter->dt;
+            filter->integral[2] += filter->ki * ez * filter->dt;
+        }
+        gx += filter->kp * ex + filter->integral[0];
+        gy += filter->kp * ey + filter->integral[1];
+        gz += filter->kp * ez + filter->integral[2];
+    }
+
+    /* Integrate rate of change of quaternion */
+    gx *= 0.5F * filter->dt;
+    gy *= 0.5F * filter->dt;
+    gz *= 0.5F * filter->dt;
+    float q0 = q[0];
+    float q1 = q[1];
+    float q2 = q[2];
+    float q3 = q[3];
+    q[0] += -q1 * gx - q2 * gy - q3 * gz;
+    q[1] += q0 * gx + q2 * gz - q3 * gy;
+    q[2] += q0 * gy - q1 * gz + q3 * gx;
+    q[3] += q0 * gz + q1 * gy - q2 * gx;
+    quat_normalize(q);
+}
@@ -0,0 +1,49 @@
+/*!
+* @file mahony.h
+* @author Ethan Lew
+* @brief Mahony nonlinear complementary filter (6 DoF)
+*
+* R. Mahony, T. Hamel, J.-M. Pflimlin, "Nonlinear complementary filters on the special
+* orthogonal group" (2008), explicit form with a PI correction on the gyroscope: the
+* error between the measured and the predicted gravity direction is fed back with a
+* proportional gain kp, and integrated with ki into a gyroscope bias estimate.
+*
+* Cost: one inverse square root for the accelerometer and one for the quaternion, and
+* about 60 float multiplies/adds.
+*/
+
+#ifndef MAHONY_H
+#define MAHONY_H
+
+#include "fxas21002c.h"
+#include "fxos8700.h"
+
+#define MAHONY_KP_DEFAULT (1.0F)
+#define MAHONY_KI_DEFAULT (0.05F)
+
+typedef struct mahony_s {
+    float q[4];          /**< Orientation, {w, x, y, z}, body to earth */
+    float integral[3];   /**< Integral feedback, the negated gyroscope bias (rad/s) */
+    float kp;            /**< Proportional gain */
+    float ki;            /**< Integral gain, 0 disables bias estimation */
+    float dt;            /**< Sample period (s) */
+} mahony_t;
+
+/*!
+* @brief reset to the identity orientation
+* @param filter the filter state
+* @param kp the proportional gain
+* @param ki the integral gain
+* @param sample_freq the update rate (Hz)
+*/
+void mahony_init(mahony_t *filter, float kp, float ki, float sample_freq);
+
+/*!
+* @brief 6 DoF update
+* @param filter the filter state
+* @param gyro angular rate (rad/s)
+* @param accel acceleration, any unit; a zero vector skips the correction
+*/
+void mahony_update_imu(mahony_t *filter, const gyro_float_data_t *gyro, const raw_float_data_t *accel);
+
+#endif
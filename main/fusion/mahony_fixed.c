@@ -0,0 +1,114 @@
+#include "mahony_fixed.h"
+
+/* Seed of the inverse square root on [0.25, 1): 2.25 - 1.25 x, within 17% */
+#define MAHONY_FIXED_SEED_A (2415919104LL)   /* 2.25, Q30 */
+#define MAHONY_FIXED_SEED_B (1342177280LL)   /* 1.25, Q30 */
+#define MAHONY_FIXED_NEWTON 3
+
+static uint8_t mahony_fixed_normalize(int32_t *v, int n);
+
+void mahony_fixed_init(mahony_fixed_t *filter, float kp, float ki, float sample_freq){
+    filter->q[0] = Q30_ONE;
+    filter->q[1] = 0;
+    filter->q[2] = 0;
+    filter->q[3] = 0;
+    filter->integral[0] = 0;
+    filter->integral[1] = 0;
+    filter->integral[2] = 0;
+    filter->kp = q16_from_float(kp);
+    filter->ki_dt = q30_from_float(ki / sample_freq);
+    filter->half_dt = q30_from_float(0.5F / sample_freq);
+}
+
+/*!
+* One update step, as mahony_update_imu
+*   1. Predicted gravity direction in the body frame, the third row of R(q)
+*   2. Error is the cross product of the measured and predicted directions
+*   3. Integral and proportional feedback onto the angular rate
+*   4. Integrate q' = q (0, w) / 2 and normalize
+*/
+void mahony_fixed_update_imu(mahony_fixed_t *filter, const gyro_fixed_data_t *gyro, const raw_fixed_data_t *accel){
+    q30_t *q = filter->q;
+    int64_t q0 = q[0];
+    int64_t q1 = q[1];
+    int64_t q2 = q[2];
+    int64_t q3 = q[3];
+    q16_t gx = gyro->x;
+    q16_t gy = gyro->y;
+    q16_t gz = gyro->z;
+    int32_t a[3] = {accel->x, accel->y, accel->z};
+
+    if(mahony_fixed_normalize(a, 3)){
+        /* Estimated direction of gravity */
+        int64_t vx = (q1 * q3 - q0 * q2) >> 29;
+        int64_t vy = (q0 * q1 + q2 * q3) >> 29;
+        int64_t vz = (q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3) >> 30;
+
+        /* Error between measured and estimated direction */
+        q30_t e[3];
+        e[0] = (q30_t)((a[1] * vz - a[2] * vy) >> 30);
+        e[1] = (q30_t)((a[2] * vx - a[0] * vz) >> 30);
+        e[2] = (q30_t)((a[0] * vy - a[1] * vx) >> 30);
+
+        if(filter->ki_dt > 0){
+            for(int i = 0; i < 3; i++){
+                int32_t next = filter->integral[i] + q30_mul(filter->ki_dt, e[i]);
+                if(next > MAHONY_FIXED_MAX_INTEGRAL)
+                    next = MAHONY_FIXED_MAX_INTEGRAL;
+                if(next < -MAHONY_FIXED_MAX_INTEGRAL)
+                    next = -MAHONY_FIXED_MAX_INTEGRAL;
+                filter->integral[i] = next;
+            }
+        }
+        /* kp e is Q16 * Q30 >> 30, the integral Q30 >> 14, both Q16 rad/s */
+        gx += (q16_t)(((int64_t)filter->kp * e[0]) >> 30) + (filter->integral[0] >> 14);
+        gy += (q16_t)(((int64_t)filter->kp * e[1]) >> 30) + (filter->integral[1] >> 14);
+        gz += (q16_t)(((int64_t)filter->kp * e[2]) >> 30) + (filter->integral[2] >> 14);
+    }
+
+    /* Integrate rate of change of quaternion, half angles in Q30 */
+    int64_t hx = ((int64_t)gx * filter->half_dt) >> 16;
+    int64_t hy = ((int64_t)gy * filter->half_dt) >> 16;
+    int64_t hz = ((int64_t)gz * filter->half_dt) >> 16;
+    q[0] = (q30_t)(q0 + ((-q1 * hx - q2 * hy - q3 * hz) >> 30));
+    q[1] = (q30_t)(q1 + ((q0 * hx + q2 * hz - q3 * hy) >> 30));
+    q[2] = (q30_t)(q2 + ((q0 * hy - q1 * hz + q3 * hx) >> 30));
+    q[3] = (q30_t)(q3 + ((q0 * hz + q1 * hy - q2 * hx) >> 30));
+    if(!mahony_fixed_normalize(q, 4)){
+        q[0] = Q30_ONE;
+        q[1] = q[2] = q[3] = 0;
+    }
+}
+
+/*!
+* Scale a vector of any Q format to unit length in Q30; 0 for a zero vector
+*   1. Sum of squares s, shifted by an even sh into [2^60, 2^62), so x = s 2^sh / 2^62
+*      is in [0.25, 1)
+*   2. y = 1 / sqrt(x) by Newton, y' = y (3 - x y^2) / 2, from a linear seed
+*   3. 1 / sqrt(s) = y 2^(sh/2 - 31), so v_i y >> (31 - sh/2) is v_i / |v| in Q30
+* Components must be below 2^31 / sqrt(n) in magnitude; Q30 quaternions and Q16
+* accelerations are far inside that.
+*/
+static uint8_t mahony_fixed_normalize(int32_t *v, int n){
+    uint64_t s = 0;
+    for(int i = 0; i < n; i++)
+        s += (uint64_t)((int64_t)v[i] * v[i]);
+    if(s == 0)
+        return 0;
+
+    int sh = __builtin_clzll(s) - 3;
+    if(sh & 1)
+        sh++;
+    uint64_t m = sh >= 0 ? s << sh : s >> -sh;
+    int64_t x = (int64_t)(m >> 32);
+    int64_t y = MAHONY_FIXED_SEED_A - ((MAHONY_FIXED_SEED_B * x) >> 30);
+    for(int k = 0; k < MAHONY_FIXED_NEWTON; k++){
+        int64_t t = (((x * y) >> 30) * y) >> 30;
+        y = (y * ((3LL << 30) - t)) >> 31;
+    }
+
+    int shift = 31 - sh / 2;
+    for(int i = 0; i < n; i++)
+        v[i] = (int32_t)(((int64_t)v[i] * y) >> shift);
+    return 1;
+}
@@ -0,0 +1,90 @@
+#include <math.h>
+#include "matrix.h"
+
+/*!
+* Cholesky-Banachiewicz, row by row. Only the lower triangle of the input is read.
+*/
+matrix_err_t mat_cholesky(float *a, int n){
+    for(int i = 0; i < n; i++){
+        for(int j = 0; j <= i; j++){
+            float sum = a[i * n + j];
+            for(int k = 0; k < j; k++)
+                sum -= a[i * n + k] * a[j * n + k];
+            if(i == j){
+                if(sum <= 0.0F)
+                    return MATRIX_NOT_PD;
+                a[i * n + i] = sqrtf(sum);
+            } else {
+                a[i * n + j] = sum / a[j * n + j];
+            }
+        }
+        for(int j = i + 1; j < n; j++)
+            a[i * n + j] = 0.0F;
+    }
+    return MATRIX_SUCCESS;
+}
+
+/*!
+* Forward substitution with L, then back substitution with L^T, column by column
+*/
+void mat_chol_solve(const float *l, float *b, int n, int m){
+    for(int c = 0; c < m; c++){
+        for(int i = 0; i < n; i++){
+            float sum = b[i * m + c];
+            for(int k = 0; k < i; k++)
+                sum -= l[i * n + k] * b[k * m + c];
+            b[i * m + c] = sum / l[i * n + i];
+        }
+        for(int i = n - 1; i >= 0; i--){
+            float sum = b[i * m + c];
+            for(int k = i + 1; k < n; k++)
+                sum -= l[k * n + i] * b[k * m + c];
+            b[i * m + c] = sum / l[i * n + i];
+        }
+    }
+}
+
+void mat_mul(const float *a, const float *b, float *c, int n, int m, int p){
+    for(int i = 0; i < n; i++){
+        for(int j = 0; j < p; j++){
+            float sum = 0.0F;
+            for(int k = 0; k < m; k++)
+                sum += a[i * m + k] * b[k * p + j];
+            c[i * p + j] = sum;
+        }
+    }
+}
+
+void mat_mul_abt(const float *a, const float *b, float *c, int n, int m, int p){
+    for(int i = 0; i < n; i++){
+        for(int j = 0; j < p; j++){
+            float sum = 0.0F;
+            for(int k = 0; k < m; k++)
+                sum += a[i * m + k] * b[j * m + k];
+            c[i * p + j] = sum;
+        }
+    }
+}
+
+void mat_add_outer(float *c, const float *u, const float *v, float w, int n, int m){
+    for(int i = 0; i < n; i++){
+        float wu = w * u[i];
+        for(int j = 0; j < m; j++)
+            c[i * m + j] += wu * v[j];
+    }
+}
+
+void mat_symmetrize(float *a, int n){
+    for(int i = 0; i < n; i++){
+        for(int j = i + 1; j < n; j++){
+            float avg = 0.5F * (a[i * n + j] + a[j * n + i]);
+            a[i * n + j] = avg;
+            a[j * n + i] = avg;
+        }
+    }
+}
+
+void mat_zero(float *a, int n, int m){
+    for(int i = 0; i < n * m; i++)
+        a[i] = 0.0F;
+}
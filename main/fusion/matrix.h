@@ -0,0 +1,61 @@
+/*!
+* @file matrix.h
+* @author Ethan Lew
+* @brief Small dense matrix kernels for the fusion filters
+*
+* Matrices are row-major float arrays owned by the caller. Sizes are passed explicitly
+* but are compile-time constants at every call site (e.g. UKF_N), with storage declared
+* as fixed arrays in static or stack memory: nothing here allocates. All routines
+* work in place or into a caller provided output that must not alias the inputs.
+*/
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+typedef enum {
+    MATRIX_SUCCESS = 0x0,
+    MATRIX_NOT_PD = 0x1, /**< Matrix is not positive definite */
+} matrix_err_t;
+
+/*!
+* @brief in-place Cholesky factorization A = L L^T
+* On success the lower triangle of a holds L and the strict upper triangle is zeroed.
+* @param a the n x n symmetric matrix
+* @param n the dimension
+* @returns MATRIX_NOT_PD if a pivot is not positive
+*/
+matrix_err_t mat_cholesky(float *a, int n);
+
+/*!
+* @brief solve (L L^T) X = B in place, given the factor from mat_cholesky
+* @param l the n x n Cholesky factor
+* @param b the n x m right hand side, overwritten with X
+*/
+void mat_chol_solve(const float *l, float *b, int n, int m);
+
+/*!
+* @brief c = a b with a n x m and b m x p
+*/
+void mat_mul(const float *a, const float *b, float *c, int n, int m, int p);
+
+/*!
+* @brief c = a b^T with a n x m and b p x m
+*/
+void mat_mul_abt(const float *a, const float *b, float *c, int n, int m, int p);
+
+/*!
+* @brief c += w u v^T with u of length n and v of length m (c is n x m)
+*/
+void mat_add_outer(float *c, const float *u, const float *v, float w, int n, int m);
+
+/*!
+* @brief a = (a + a^T) / 2, removing round-off asymmetry
+*/
+void mat_symmetrize(float *a, int n);
+
+/*!
+* @brief a = 0
+*/
+void mat_zero(float *a, int n, int m);
+
+#endif
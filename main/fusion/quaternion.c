@@ -0,0 +1,88 @@
+#include <math.h>
+#include "quaternion.h"
+
+/* Below this angle exp/log use their series expansion */
+#define QUAT_SMALL_ANGLE (1e-6F)
+
+void quat_mul(const float *a, const float *b, float *out){
+    out[0] = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+    out[1] = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+    out[2] = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+    out[3] = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+}
+
+void quat_exp(const float *v, float *out){
+    float angle = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if(angle < QUAT_SMALL_ANGLE){
+        out[0] = 1.0F;
+        out[1] = 0.5F * v[0];
+        out[2] = 0.5F * v[1];
+        out[3] = 0.5F * v[2];
+        quat_normalize(out);
+        return;
+    }
+    float s = sinf(0.5F * angle) / angle;
+    out[0] = cosf(0.5F * angle);
+    out[1] = s * v[0];
+    out[2] = s * v[1];
+    out[3] = s * v[2];
+}
+
+void quat_log(const float *q, float *v){
+    /* q and -q are the same rotation, take the one with w >= 0 */
+    float sign = q[0] < 0.0F ? -1.0F : 1.0F;
+    float w = sign * q[0];
+    float n = sqrtf(q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    float s;
+    if(n < QUAT_SMALL_ANGLE){
+        s = 2.0F / w;
+    } else {
+        s = 2.0F * atan2f(n, w) / n;
+    }
+    s *= sign;
+    v[0] = s * q[1];
+    v[1] = s * q[2];
+    v[2] = s * q[3];
+}
+
+void quat_normalize(float *q){
+    float recip_norm = 1.0F / sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    q[0] *= recip_norm;
+    q[1] *= recip_norm;
+    q[2] *= recip_norm;
+    q[3] *= recip_norm;
+}
+
+/*!
+* Rotation matrix form of q* v q, i.e. R^T v
+*/
+void quat_rotate_inv(const float *q, const float *v, float *out){
+    float w = q[0], x = q[1], y = q[2], z = q[3];
+    out[0] = (1.0F - 2.0F * (y * y + z * z)) * v[0] + 2.0F * (x * y + w * z) * v[1] + 2.0F * (x * z - w * y) * v[2];
+    out[1] = 2.0F * (x * y - w * z) * v[0] + (1.0F - 2.0F * (x * x + z * z)) * v[1] + 2.0F * (y * z + w * x) * v[2];
+    out[2] = 2.0F * (x * z + w * y) * v[0] + 2.0F * (y * z - w * x) * v[1] + (1.0F - 2.0F * (x * x + y * y)) * v[2];
+}
+
+/*!
+* Rotation matrix form of q v q*, i.e. R v
+*/
+void quat_rotate(const float *q, const float *v, float *out){
+    float w = q[0], x = q[1], y = q[2], z = q[3];
+    out[0] = (1.0F - 2.0F * (y * y + z * z)) * v[0] + 2.0F * (x * y - w * z) * v[1] + 2.0F * (x * z + w * y) * v[2];
+    out[1] = 2.0F * (x * y + w * z) * v[0] + (1.0F - 2.0F * (x * x + z * z)) * v[1] + 2.0F * (y * z - w * x) * v[2];
+    out[2] = 2.0F * (x * z - w * y) * v[0] + 2.0F * (y * z + w * x) * v[1] + (1.0F - 2.0F * (x * x + y * y)) * v[2];
+}
+
+void quat_euler(const float *q, float *roll, float *pitch, float *yaw){
+    float sinp = 2.0F * (q[0] * q[2] - q[3] * q[1]);
+
+    /* Clamp for numerical noise at the poles */
+    if(sinp > 1.0F)
+        sinp = 1.0F;
+    if(sinp < -1.0F)
+        sinp = -1.0F;
+
+    *roll = atan2f(2.0F * (q[0] * q[1] + q[2] * q[3]), 1.0F - 2.0F * (q[1] * q[1] + q[2] * q[2]));
+    *pitch = asinf(sinp);
+    *yaw = atan2f(2.0F * (q[0] * q[3] + q[1] * q[2]), 1.0F - 2.0F * (q[2] * q[2] + q[3] * q[3]));
+}
@@ -0,0 +1,48 @@
+/*!
+* @file quaternion.h
+* @author Ethan Lew
+* @brief Quaternion helpers shared by the fusion filters
+*
+* Quaternions are float[4] arrays {w, x, y, z} (Hamilton convention). A filter
+* quaternion q rotates body vectors into the earth frame: v_e = q v_b q*.
+*/
+
+#ifndef QUATERNION_H
+#define QUATERNION_H
+
+/*!
+* @brief out = a b (out must not alias a or b)
+*/
+void quat_mul(const float *a, const float *b, float *out);
+
+/*!
+* @brief unit quaternion of the rotation vector v (axis * angle, rad)
+*/
+void quat_exp(const float *v, float *out);
+
+/*!
+* @brief rotation vector (axis * angle, rad) of a unit quaternion, shortest path
+*/
+void quat_log(const float *q, float *v);
+
+/*!
+* @brief normalize q in place
+*/
+void quat_normalize(float *q);
+
+/*!
+* @brief rotate an earth frame vector into the body frame: out = q* v q
+*/
+void quat_rotate_inv(const float *q, const float *v, float *out);
+
+/*!
+* @brief rotate a body frame vector into the earth frame: out = q v q*
+*/
+void quat_rotate(const float *q, const float *v, float *out);
+
+/*!
+* @brief aerospace (ZYX) Euler angles (rad)
+*/
+void quat_euler(const float *q, float *roll, float *pitch, float *yaw);
+
+#endif
@@ -0,0 +1,218 @@
+#include <math.h>
+#include <string.h>
+#include "stillcal.h"
+#include "matrix.h"
+
+/* Unknowns of the accelerometer fit */
+#define STILLCAL_FIT_N 6
+
+static void stillcal_pose(stillcal_t *still, const float *mean);
+
+static uint8_t stillcal_covered(const stillcal_t *still);
+
+static uint8_t stillcal_fit_accel(stillcal_t *still, float *offset, float *gain);
+
+void stillcal_init(stillcal_t *still){
+    memset(still, 0, sizeof(stillcal_t));
+}
+
+/*!
+* Take a sample
+*   1. Accumulate sums and squares relative to the block's first sample, which keeps
+*      the float variance of a 9.8 m/s^2 axis from cancelling
+*   2. At the end of a block, still means every axis within its standard deviation
+*      bound; a still block leaves its mean rate for stillcal_update and adds its mean
+*      acceleration to a pose
+*/
+stillcal_err_t stillcal_add(stillcal_t *still, const gyro_float_data_t *gyro, const raw_float_data_t *accel){
+    const float v[6] = {gyro->x, gyro->y, gyro->z, accel->x, accel->y, accel->z};
+    if(still->count == 0){
+        memcpy(still->ref, v, sizeof(v));
+        memset(still->sum, 0, sizeof(still->sum));
+        memset(still->sq, 0, sizeof(still->sq));
+    }
+    for(int i = 0; i < 6; i++){
+        float d = v[i] - still->ref[i];
+        still->sum[i] += d;
+        still->sq[i] += d * d;
+    }
+    if(++still->count < STILLCAL_BLOCK)
+        return STILLCAL_SUCCESS;
+
+    const float n = (float)still->count;
+    float mean[6];
+    uint8_t is_still = 1;
+    for(int i = 0; i < 6; i++){
+        float m = still->sum[i] / n;
+        float var = still->sq[i] / n - m * m;
+        float bound = i < 3 ? STILLCAL_GYRO_STD : STILLCAL_ACCEL_STD;
+        if(var > bound * bound)
+            is_still = 0;
+        mean[i] = still->ref[i] + m;
+    }
+    still->count = 0;
+    still->blocks++;
+    if(!is_still)
+        return STILLCAL_MOVING;
+
+    still->still_blocks++;
+    memcpy(still->gyro_residual, mean, sizeof(still->gyro_residual));
+    still->gyro_pending = 1;
+    stillcal_pose(still, mean + 3);
+    return STILLCAL_STILL;
+}
+
+/*!
+* Fold in
+*   1. Gyroscope: bias += residual / min(blocks, STILLCAL_GYRO_BLOCKS), the running
+*      mean of the bias seen by the recent still blocks
+*   2. Accelerometer: the fit (o, k) of samples already corrected with (offset, gain)
+*      composes as (a - offset) gain - o) k = (a - (offset + o / gain)) gain k
+*   3. Restart the block in progress, which has samples of the old calibration
+*/
+uint32_t stillcal_update(stillcal_t *still, imu_cal_t *cal){
+    uint32_t changed = 0;
+
+    if(still->gyro_pending){
+        still->gyro_pending = 0;
+        float *r = still->gyro_residual;
+        if(sqrtf(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]) <= STILLCAL_MAX_GYRO_BIAS){
+            if(still->gyro_blocks < STILLCAL_GYRO_BLOCKS)
+                still->gyro_blocks++;
+            float w = 1.0F / (float)still->gyro_blocks;
+            for(int i = 0; i < 3; i++)
+                cal->gyro_bias[i] += w * r[i];
+            cal->flags |= IMU_CAL_GYRO;
+            changed |= IMU_CAL_GYRO;
+        }
+    }
+
+    float offset[3], gain[3];
+    if(stillcal_covered(still) && stillcal_fit_accel(still, offset, gain)){
+        if(!(cal->flags & IMU_CAL_ACCEL)){
+            for(int i = 0; i < 3; i++){
+                cal->accel_offset[i] = 0.0F;
+                cal->accel_gain[i] = 1.0F;
+            }
+        }
+        for(int i = 0; i < 3; i++){
+            cal->accel_offset[i] += offset[i] / cal->accel_gain[i];
+            cal->accel_gain[i] *= gain[i];
+        }
+        cal->flags |= IMU_CAL_ACCEL;
+        changed |= IMU_CAL_ACCEL;
+        still->n_poses = 0;
+    }
+
+    if(changed)
+        still->count = 0;
+    return changed;
+}
+
+/*!
+* Add a still block's mean acceleration to the pose it matches, or start a pose; once
+* all STILLCAL_POSES are taken, blocks matching none are dropped
+*/
+static void stillcal_pose(stillcal_t *still, const float *mean){
+    float norm = sqrtf(mean[0] * mean[0] + mean[1] * mean[1] + mean[2] * mean[2]);
+    if(norm <= 0.0F)
+        return;
+    const float dir[3] = {mean[0] / norm, mean[1] / norm, mean[2] / norm};
+
+    stillcal_pose_t *best = NULL;
+    float best_cos = STILLCAL_POSE_COS;
+    for(int p = 0; p < still->n_poses; p++){
+        const float *d = still->poses[p].dir;
+        float c = d[0] * dir[0] + d[1] * dir[1] + d[2] * dir[2];
+        if(c > best_cos){
+            best_cos = c;
+            best = &still->poses[p];
+        }
+    }
+    if(!best){
+        if(still->n_poses == STILLCAL_POSES)
+            return;
+        best = &still->poses[still->n_poses++];
+        memset(best, 0, sizeof(stillcal_pose_t));
+        memcpy(best->dir, dir, sizeof(dir));
+    }
+    for(int i = 0; i < 3; i++)
+        best->sum[i] += mean[i];
+    best->blocks++;
+}
+
+/*!
+* Enough poses, with every axis seen pointing up and down
+*/
+static uint8_t stillcal_covered(const stillcal_t *still){
+    if(still->n_poses < STILLCAL_MIN_POSES)
+        return 0;
+    for(int i = 0; i < 3; i++){
+        uint8_t up = 0;
+        uint8_t down = 0;
+        for(int p = 0; p < still->n_poses; p++){
+            if(still->poses[p].dir[i] > STILLCAL_POSE_AXIS)
+                up = 1;
+            if(still->poses[p].dir[i] < -STILLCAL_POSE_AXIS)
+                down = 1;
+        }
+        if(!up || !down)
+            return 0;
+    }
+    return 1;
+}
+
+/*!
+* Accelerometer fit
+*   1. Normal equations of [x^2 y^2 z^2 x y z] p = 1 over the pose means in g, one
+*      row per pose, solved by Cholesky
+*   2. Offset and gain per axis from p, see stillcal.h; reject a fit outside the
+*      STILLCAL_MAX_* bounds
+*   3. Keep the rms distance of the corrected poses from g
+*/
+static uint8_t stillcal_fit_accel(stillcal_t *still, float *offset, float *gain){
+    float ata[STILLCAL_FIT_N * STILLCAL_FIT_N];
+    float atb[STILLCAL_FIT_N];
+    mat_zero(ata, STILLCAL_FIT_N, STILLCAL_FIT_N);
+    mat_zero(atb, STILLCAL_FIT_N, 1);
+    for(int p = 0; p < still->n_poses; p++){
+        const stillcal_pose_t *pose = &still->poses[p];
+        float u[3];
+        for(int i = 0; i < 3; i++)
+            u[i] = pose->sum[i] / ((float)pose->blocks * SENSORS_GRAVITY_STANDARD);
+        const float row[STILLCAL_FIT_N] = {u[0] * u[0], u[1] * u[1], u[2] * u[2], u[0], u[1], u[2]};
+        mat_add_outer(ata, row, row, 1.0F, STILLCAL_FIT_N, STILLCAL_FIT_N);
+        for(int i = 0; i < STILLCAL_FIT_N; i++)
+            atb[i] += row[i];
+    }
+    if(mat_cholesky(ata, STILLCAL_FIT_N) != MATRIX_SUCCESS)
+        return 0;
+    mat_chol_solve(ata, atb, STILLCAL_FIT_N, 1);
+
+    float g = 1.0F;
+    for(int i = 0; i < 3; i++){
+        if(atb[i] <= 0.0F)
+            return 0;
+        g += atb[3 + i] * atb[3 + i] / (4.0F * atb[i]);
+    }
+    for(int i = 0; i < 3; i++){
+        offset[i] = -atb[3 + i] / (2.0F * atb[i]) * SENSORS_GRAVITY_STANDARD;
+        gain[i] = sqrtf(atb[i] / g);
+        if(fabsf(offset[i]) > STILLCAL_MAX_OFFSET || fabsf(gain[i] - 1.0F) > STILLCAL_MAX_GAIN_ERROR)
+            return 0;
+    }
+
+    float sq = 0.0F;
+    for(int p = 0; p < still->n_poses; p++){
+        const stillcal_pose_t *pose = &still->poses[p];
+        float r = 0.0F;
+        for(int i = 0; i < 3; i++){
+            float a = (pose->sum[i] / (float)pose->blocks - offset[i]) * gain[i];
+            r += a * a;
+        }
+        float e = sqrtf(r) - SENSORS_GRAVITY_STANDARD;
+        sq += e * e;
+    }
+    still->pose_error = sqrtf(sq / (float)still->n_poses);
+    return 1;
+}
@@ -0,0 +1,103 @@
+/*!
+* @file stillcal.h
+* @author Ethan Lew
+* @brief Gyroscope bias and accelerometer offset/gain calibration from still periods
+*
+* Samples are taken in blocks of STILLCAL_BLOCK. A block is still when every gyroscope
+* and accelerometer axis stays within STILLCAL_GYRO_STD and STILLCAL_ACCEL_STD of its
+* mean. Then
+*   - the mean rate is gyroscope bias. The bias is the running mean of the last
+*     STILLCAL_GYRO_BLOCKS still blocks, so the first estimate is ready after one block
+*     (half a second at 100Hz) and later ones follow drift with temperature
+*   - the mean acceleration is gravity seen in one orientation (a pose). Still blocks
+*     within STILLCAL_POSE_COS of a pose are averaged into it. Once the poses hold
+*     each axis pointing up and down, the per axis offset and gain that put every pose
+*     on the sphere of radius g are fitted by least squares: with u = a / g,
+*
+*         A x^2 + B y^2 + C z^2 + D x + E y + F z = 1
+*
+*     is linear in A..F, and gives offset_x = -D / 2A and gain_x = sqrt(A / G) with
+*     G = 1 + D^2/4A + E^2/4B + F^2/4C (and the same for y, z)
+*
+* stillcal works on samples the drivers have already corrected, so it estimates what
+* is left over; stillcal_update folds that into the calibration in use, which the
+* caller then applies (imu_dev calibrate) before feeding more samples.
+*/
+
+#ifndef STILLCAL_H
+#define STILLCAL_H
+
+#include <stdint.h>
+#include "fxas21002c.h"
+#include "fxos8700.h"
+#include "imu_cal.h"
+
+/* Samples per stillness test */
+#define STILLCAL_BLOCK 50
+/* Largest standard deviation of a still block, per axis */
+#define STILLCAL_GYRO_STD (0.02F)        /* rad/s */
+#define STILLCAL_ACCEL_STD (0.1F)        /* m/s^2 */
+/* A larger mean rate is a slow turn, not bias */
+#define STILLCAL_MAX_GYRO_BIAS (0.2F)    /* rad/s */
+#define STILLCAL_GYRO_BLOCKS 8
+/* Accelerometer poses */
+#define STILLCAL_POSES 12
+#define STILLCAL_MIN_POSES 6
+#define STILLCAL_POSE_COS (0.94F)        /* Same pose within about 20 degrees */
+#define STILLCAL_POSE_AXIS (0.5F)        /* Each axis must be seen up and down beyond this, in g */
+/* Acceptance of an accelerometer fit */
+#define STILLCAL_MAX_GAIN_ERROR (0.1F)
+#define STILLCAL_MAX_OFFSET (1.5F)       /* m/s^2 */
+
+typedef enum {
+    STILLCAL_SUCCESS = 0x0,      /**< Sample taken */
+    STILLCAL_STILL = 0x1,        /**< Sample completed a still block */
+    STILLCAL_MOVING = 0x2,       /**< Sample completed a block with motion */
+} stillcal_err_t;
+
+typedef struct stillcal_pose_s {
+    float sum[3];                /**< Sum of the still block means (m/s^2) */
+    float dir[3];                /**< Unit direction of gravity when first seen */
+    uint32_t blocks;
+} stillcal_pose_t;
+
+typedef struct stillcal_s {
+    float ref[6];                /**< First gyro/accel sample of the block; sums are relative to it */
+    float sum[6];
+    float sq[6];
+    uint32_t count;              /**< Samples in the block */
+    float gyro_residual[3];      /**< Mean rate of the last still block (rad/s) */
+    uint8_t gyro_pending;        /**< gyro_residual not folded in yet */
+    uint32_t gyro_blocks;        /**< Still blocks folded into the bias */
+    stillcal_pose_t poses[STILLCAL_POSES];
+    uint8_t n_poses;
+    float pose_error;            /**< rms distance of the poses from g after the last accelerometer fit (m/s^2) */
+    uint32_t blocks;             /**< Blocks completed */
+    uint32_t still_blocks;       /**< Of those, still */
+} stillcal_t;
+
+/*!
+* @brief start over, with no blocks or poses
+*/
+void stillcal_init(stillcal_t *still);
+
+/*!
+* @brief take one sample
+* @param still the calibrator
+* @param gyro the rate (rad/s) as corrected by the driver
+* @param accel the acceleration (m/s^2) as corrected by the driver
+* @returns STILLCAL_STILL or STILLCAL_MOVING when the sample completed a block
+*/
+stillcal_err_t stillcal_add(stillcal_t *still, const gyro_float_data_t *gyro, const raw_float_data_t *accel);
+
+/*!
+* @brief fold what was learnt since the last call into a calibration
+* The gyroscope bias is updated after every still block, the accelerometer once the
+* poses allow a fit that passes the STILLCAL_MAX_* bounds; the poses then start over.
+* @param still the calibrator
+* @param cal the calibration the samples were corrected with, updated
+* @returns the IMU_CAL_* parts that changed; apply them before feeding more samples
+*/
+uint32_t stillcal_update(stillcal_t *still, imu_cal_t *cal);
+
+#endif
@@ -0,0 +1,283 @@
+#include <math.h>
+#include <string.h>
+#include "ukf.h"
+#include "quaternion.h"
+
+static ukf_err_t ukf_sigma(ukf_t *ukf);
+static float ukf_direction(const raw_float_data_t *in, float *out);
+
+void ukf_init(ukf_t *ukf, float sample_freq){
+    float lambda = UKF_ALPHA * UKF_ALPHA * (UKF_N + UKF_KAPPA) - UKF_N;
+
+    memset(ukf, 0, sizeof(ukf_t));
+    ukf->q[0] = 1.0F;
+    ukf->dt = 1.0F / sample_freq;
+    ukf->gamma = sqrtf(UKF_N + lambda);
+    ukf->wm0 = lambda / (UKF_N + lambda);
+    ukf->wc0 = ukf->wm0 + (1.0F - UKF_ALPHA * UKF_ALPHA + UKF_BETA);
+    ukf->wi = 0.5F / (UKF_N + lambda);
+
+    for(int i = 0; i < 3; i++){
+        ukf->P[i * UKF_N + i] = UKF_ATT_INIT * UKF_ATT_INIT;
+        ukf->P[(i + 3) * UKF_N + i + 3] = UKF_BIAS_INIT * UKF_BIAS_INIT;
+        ukf->Q[i] = UKF_GYRO_NOISE * UKF_GYRO_NOISE;
+        ukf->Q[i + 3] = UKF_BIAS_WALK * UKF_BIAS_WALK;
+        ukf->R[i] = UKF_ACCEL_NOISE * UKF_ACCEL_NOISE;
+        ukf->R[i + 3] = UKF_MAGN_NOISE * UKF_MAGN_NOISE;
+    }
+
+    /* Until aligned, assume a horizontal field pointing north */
+    ukf->m_ref[0] = 1.0F;
+}
+
+/*!
+* TRIAD alignment
+*   1. Up is the accelerometer direction, west is up x magn, north is west x up; these
+*      are the rows of the body to earth rotation matrix
+*   2. Convert the rotation matrix to a quaternion
+*   3. The magnetic reference is the field rotated into the earth frame, which has no
+*      west component by construction
+*/
+void ukf_align(ukf_t *ukf, const raw_float_data_t *accel, const raw_float_data_t *magn){
+    float up[3], m[3], west[3], north[3];
+    float r[3][3];
+    float norm;
+
+    if(ukf_direction(accel, up) == 0.0F || ukf_direction(magn, m) == 0.0F)
+        return;
+
+    west[0] = up[1] * m[2] - up[2] * m[1];
+    west[1] = up[2] * m[0] - up[0] * m[2];
+    west[2] = up[0] * m[1] - up[1] * m[0];
+    norm = sqrtf(west[0] * west[0] + west[1] * west[1] + west[2] * west[2]);
+    if(norm == 0.0F)
+        return;
+    for(int i = 0; i < 3; i++)
+        west[i] /= norm;
+
+    north[0] = west[1] * up[2] - west[2] * up[1];
+    north[1] = west[2] * up[0] - west[0] * up[2];
+    north[2] = west[0] * up[1] - west[1] * up[0];
+
+    for(int i = 0; i < 3; i++){
+        r[0][i] = north[i];
+        r[1][i] = west[i];
+        r[2][i] = up[i];
+    }
+
+    float trace = r[0][0] + r[1][1] + r[2][2];
+    float *q = ukf->q;
+    if(trace > 0.0F){
+        float s = 0.5F / sqrtf(trace + 1.0F);
+        q[0] = 0.25F / s;
+        q[1] = (r[2][1] - r[1][2]) * s;
+        q[2] = (r[0][2] - r[2][0]) * s;
+        q[3] = (r[1][0] - r[0][1]) * s;
+    } else if(r[0][0] > r[1][1] && r[0][0] > r[2][2]){
+        float s = 2.0F * sqrtf(1.0F + r[0][0] - r[1][1] - r[2][2]);
+        q[0] = (r[2][1] - r[1][2]) / s;
+        q[1] = 0.25F * s;
+        q[2] = (r[0][1] + r[1][0]) / s;
+        q[3] = (r[0][2] + r[2][0]) / s;
+    } else if(r[1][1] > r[2][2]){
+        float s = 2.0F * sqrtf(1.0F + r[1][1] - r[0][0] - r[2][2]);
+        q[0] = (r[0][2] - r[2][0]) / s;
+        q[1] = (r[0][1] + r[1][0]) / s;
+        q[2] = 0.25F * s;
+        q[3] = (r[1][2] + r[2][1]) / s;
+    } else {
+        float s = 2.0F * sqrtf(1.0F + r[2][2] - r[0][0] - r[1][1]);
+        q[0] = (r[1][0] - r[0][1]) / s;
+        q[1] = (r[0][2] + r[2][0]) / s;
+        q[2] = (r[1][2] + r[2][1]) / s;
+        q[3] = 0.25F * s;
+    }
+    quat_normalize(q);
+
+    float mn = north[0] * m[0] + north[1] * m[1] + north[2] * m[2];
+    float mu = up[0] * m[0] + up[1] * m[1] + up[2] * m[2];
+    norm = sqrtf(mn * mn + mu * mu);
+    ukf->m_ref[0] = mn / norm;
+    ukf->m_ref[1] = 0.0F;
+    ukf->m_ref[2] = mu / norm;
+}
+
+/*!
+* Time update
+*   1. Sigma points of the error state around the current estimate
+*   2. Propagate each through its own bias-corrected rate: q_i = q exp(dtheta_i) exp((w - b_i) dt)
+*   3. Express every propagated point as an error relative to the central one
+*   4. Weighted mean error, folded back into q and b
+*   5. Covariance of the errors about their mean, plus process noise
+*/
+ukf_err_t ukf_predict(ukf_t *ukf, const gyro_float_data_t *gyro){
+    float q_sig[UKF_SIGMA][4];
+    float tmp[4], dq[4], rot[3];
+    float q_conj[4];
+    float mean[UKF_N];
+
+    if(ukf_sigma(ukf) != UKF_SUCCESS)
+        return UKF_NOT_PD;
+
+    for(int i = 0; i < UKF_SIGMA; i++){
+        quat_exp(ukf->chi[i], dq);
+        quat_mul(ukf->q, dq, tmp);
+        rot[0] = (gyro->x - ukf->bias[0] - ukf->chi[i][3]) * ukf->dt;
+        rot[1] = (gyro->y - ukf->bias[1] - ukf->chi[i][4]) * ukf->dt;
+        rot[2] = (gyro->z - ukf->bias[2] - ukf->chi[i][5]) * ukf->dt;
+        quat_exp(rot, dq);
+        quat_mul(tmp, dq, q_sig[i]);
+    }
+
+    /* The bias is a random walk, so chi[i][3..5] are already the propagated bias errors */
+    q_conj[0] = q_sig[0][0];
+    q_conj[1] = -q_sig[0][1];
+    q_conj[2] = -q_sig[0][2];
+    q_conj[3] = -q_sig[0][3];
+    for(int i = 0; i < UKF_SIGMA; i++){
+        quat_mul(q_conj, q_sig[i], tmp);
+        quat_log(tmp, ukf->chi[i]);
+    }
+
+    for(int j = 0; j < UKF_N; j++){
+        mean[j] = ukf->wm0 * ukf->chi[0][j];
+        for(int i = 1; i < UKF_SIGMA; i++)
+            mean[j] += ukf->wi * ukf->chi[i][j];
+    }
+
+    quat_exp(mean, dq);
+    quat_mul(q_sig[0], dq, ukf->q);
+    quat_normalize(ukf->q);
+    ukf->bias[0] += mean[3];
+    ukf->bias[1] += mean[4];
+    ukf->bias[2] += mean[5];
+
+    mat_zero(ukf->P, UKF_N, UKF_N);
+    for(int i = 0; i < UKF_SIGMA; i++){
+        for(int j = 0; j < UKF_N; j++)
+            ukf->chi[i][j] -= mean[j];
+        mat_add_outer(ukf->P, ukf->chi[i], ukf->chi[i], i == 0 ? ukf->wc0 : ukf->wi, UKF_N, UKF_N);
+    }
+    for(int j = 0; j < UKF_N; j++)
+        ukf->P[j * UKF_N + j] += ukf->Q[j] * ukf->dt;
+    mat_symmetrize(ukf->P, UKF_N);
+
+    return UKF_SUCCESS;
+}
+
+/*!
+* Measurement update
+*   1. Sigma points around the predicted state, mapped to the expected body frame
+*      gravity and magnetic field directions
+*   2. Predicted measurement, its covariance Pzz and the cross covariance Pxz (the
+*      error sigma points have zero mean by symmetry)
+*   3. K^T = Pzz^-1 Pxz^T by Cholesky solve
+*   4. Correct q and b with K (z - z_mean), and P -= K Pzz K^T = Pxz K^T
+*/
+ukf_err_t ukf_update(ukf_t *ukf, const raw_float_data_t *accel, const raw_float_data_t *magn){
+    static const float up[3] = {0.0F, 0.0F, 1.0F};
+    float meas[UKF_M], z_mean[UKF_M], dz[UKF_M];
+    float dq[4], q_i[4];
+    float dx[UKF_N];
+
+    if(ukf_direction(accel, meas) == 0.0F || ukf_direction(magn, meas + 3) == 0.0F)
+        return UKF_SUCCESS;
+
+    if(ukf_sigma(ukf) != UKF_SUCCESS)
+        return UKF_NOT_PD;
+
+    for(int i = 0; i < UKF_SIGMA; i++){
+        quat_exp(ukf->chi[i], dq);
+        quat_mul(ukf->q, dq, q_i);
+        quat_rotate_inv(q_i, up, ukf->z[i]);
+        quat_rotate_inv(q_i, ukf->m_ref, ukf->z[i] + 3);
+    }
+
+    for(int k = 0; k < UKF_M; k++){
+        z_mean[k] = ukf->wm0 * ukf->z[0][k];
+        for(int i = 1; i < UKF_SIGMA; i++)
+            z_mean[k] += ukf->wi * ukf->z[i][k];
+    }
+
+    mat_zero(ukf->Pzz, UKF_M, UKF_M);
+    mat_zero(ukf->Pxz, UKF_N, UKF_M);
+    for(int i = 0; i < UKF_SIGMA; i++){
+        float w = i == 0 ? ukf->wc0 : ukf->wi;
+        for(int k = 0; k < UKF_M; k++)
+            dz[k] = ukf->z[i][k] - z_mean[k];
+        mat_add_outer(ukf->Pzz, dz, dz, w, UKF_M, UKF_M);
+        mat_add_outer(ukf->Pxz, ukf->chi[i], dz, w, UKF_N, UKF_M);
+    }
+    for(int k = 0; k < UKF_M; k++)
+        ukf->Pzz[k * UKF_M + k] += ukf->R[k];
+
+    if(mat_cholesky(ukf->Pzz, UKF_M) != MATRIX_SUCCESS)
+        return UKF_NOT_PD;
+    for(int k = 0; k < UKF_M; k++){
+        for(int j = 0; j < UKF_N; j++)
+            ukf->Kt[k * UKF_N + j] = ukf->Pxz[j * UKF_M + k];
+    }
+    mat_chol_solve(ukf->Pzz, ukf->Kt, UKF_M, UKF_N);
+
+    for(int k = 0; k < UKF_M; k++)
+        dz[k] = meas[k] - z_mean[k];
+    for(int j = 0; j < UKF_N; j++){
+        dx[j] = 0.0F;
+        for(int k = 0; k < UKF_M; k++)
+            dx[j] += ukf->Kt[k * UKF_N + j] * dz[k];
+    }
+
+    quat_exp(dx, dq);
+    quat_mul(ukf->q, dq, q_i);
+    memcpy(ukf->q, q_i, sizeof(q_i));
+    quat_normalize(ukf->q);
+    ukf->bias[0] += dx[3];
+    ukf->bias[1] += dx[4];
+    ukf->bias[2] += dx[5];
+
+    /* L is free scratch once the sigma points exist */
+    mat_mul(ukf->Pxz, ukf->Kt, ukf->L, UKF_N, UKF_M, UKF_N);
+    for(int j = 0; j < UKF_N * UKF_N; j++)
+        ukf->P[j] -= ukf->L[j];
+    mat_symmetrize(ukf->P, UKF_N);
+
+    return UKF_SUCCESS;
+}
+
+void ukf_euler(const ukf_t *ukf, float *roll, float *pitch, float *yaw){
+    quat_euler(ukf->q, roll, pitch, yaw);
+}
+
+/*!
+* Error state sigma points: chi_0 = 0, chi_{1+j} = gamma L_j, chi_{1+N+j} = -gamma L_j,
+* with L_j the columns of the Cholesky factor of P
+*/
+static ukf_err_t ukf_sigma(ukf_t *ukf){
+    memcpy(ukf->L, ukf->P, sizeof(ukf->L));
+    if(mat_cholesky(ukf->L, UKF_N) != MATRIX_SUCCESS)
+        return UKF_NOT_PD;
+
+    for(int r = 0; r < UKF_N; r++)
+        ukf->chi[0][r] = 0.0F;
+    for(int j = 0; j < UKF_N; j++){
+        for(int r = 0; r < UKF_N; r++){
+            float v = ukf->gamma * ukf->L[r * UKF_N + j];
+            ukf->chi[1 + j][r] = v;
+            ukf->chi[1 + UKF_N + j][r] = -v;
+        }
+    }
+    return UKF_SUCCESS;
+}
+
+/*!
+* Unit vector of a sample, returns its norm (0 leaves out untouched)
+*/
+static float ukf_direction(const raw_float_data_t *in, float *out){
+    float norm = sqrtf(in->x * in->x + in->y * in->y + in->z * in->z);
+    if(norm == 0.0F)
+        return 0.0F;
+    out[0] = in->x / norm;
+    out[1] = in->y / norm;
+    out[2] = in->z / norm;
+    return norm;
+}
@@ -0,0 +1,8 @@
+#
+# Hardware abstraction layer. Headers are exported so the fusion component can
+# consume the sensor types.
+#
+COMPONENT_ADD_INCLUDEDIRS := .
+
+# The conversion kernels must round like the scalar reference, see conv.h
+conv.o: CFLAGS += -ffp-contract=off
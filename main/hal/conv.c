@@ -0,0 +1,308 @@
+#include <string.h>
+#include "conv.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CONV_X86 1
+#include <immintrin.h>
+#else
+#define CONV_X86 0
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define CONV_NEON 1
+#include <arm_neon.h>
+#else
+#define CONV_NEON 0
+#endif
+
+static const float conv_identity[9] = {1.0F, 0.0F, 0.0F, 0.0F, 1.0F, 0.0F, 0.0F, 0.0F, 1.0F};
+
+static inline int16_t conv_count(const uint8_t *b, uint8_t shift){
+    return (int16_t)((b[0] << 8) | b[1]) >> shift;
+}
+
+/*!
+* The reference arithmetic of one sample; the kernels' tails use it too
+*/
+static inline void conv_one(const conv_params_t *p, int16_t r0, int16_t r1, int16_t r2, float *o){
+    const float *m = p->m;
+    float v0 = (float)r0 * p->scale - p->bias[0];
+    float v1 = (float)r1 * p->scale - p->bias[1];
+    float v2 = (float)r2 * p->scale - p->bias[2];
+    if(p->diagonal){
+        o[0] = m[0] * v0;
+        o[1] = m[4] * v1;
+        o[2] = m[8] * v2;
+    } else {
+        o[0] = (m[0] * v0 + m[1] * v1) + m[2] * v2;
+        o[1] = (m[3] * v0 + m[4] * v1) + m[5] * v2;
+        o[2] = (m[6] * v0 + m[7] * v1) + m[8] * v2;
+    }
+}
+
+#if CONV_X86 || CONV_NEON
+/*!
+* Counts of up to CONV_BLOCK frames into per axis lanes: straight into raw when it
+* is given, else into the block buffer
+*/
+static void conv_gather(const conv_params_t *p, const uint8_t *src, size_t stride, size_t len,
+                        int16_t blk[3][CONV_BLOCK], int16_t *const raw[3], size_t base, int16_t *lane[3]){
+    for(int a = 0; a < 3; a++)
+        lane[a] = raw ? raw[a] + base : blk[a];
+    for(size_t k = 0; k < len; k++, src += stride){
+        lane[0][k] = conv_count(src, p->shift);
+        lane[1][k] = conv_count(src + 2, p->shift);
+        lane[2][k] = conv_count(src + 4, p->shift);
+    }
+}
+
+static void conv_tail(const conv_params_t *p, int16_t *const lane[3], size_t k, size_t len,
+                      float *const out[3], size_t base){
+    for(; k < len; k++){
+        float o[3];
+        conv_one(p, lane[0][k], lane[1][k], lane[2][k], o);
+        out[0][base + k] = o[0];
+        out[1][base + k] = o[1];
+        out[2][base + k] = o[2];
+    }
+}
+#endif
+
+void conv_init(conv_params_t *p, uint8_t shift){
+    memset(p, 0, sizeof(conv_params_t));
+    p->shift = shift;
+    conv_set_scale(p, 1.0F);
+    conv_set_bias(p, NULL);
+    conv_set_matrix(p, NULL);
+}
+
+void conv_set_scale(conv_params_t *p, float scale){
+    p->scale = scale;
+    p->scale_q = q31_from_float(scale);
+}
+
+void conv_set_bias(conv_params_t *p, const float *bias){
+    for(int i = 0; i < 3; i++){
+        p->bias[i] = bias ? bias[i] : 0.0F;
+        p->bias_q[i] = q16_from_float(p->bias[i]);
+    }
+}
+
+void conv_set_matrix(conv_params_t *p, const float *m){
+    if(!m)
+        m = conv_identity;
+    p->diagonal = 1;
+    for(int i = 0; i < 9; i++){
+        p->m[i] = m[i];
+        p->m_q[i] = q30_from_float(m[i]);
+        if(i % 4 != 0 && m[i] != 0.0F)
+            p->diagonal = 0;
+    }
+}
+
+void conv_set_gain(conv_params_t *p, const float *gain){
+    float m[9] = {0};
+    for(int i = 0; i < 3; i++)
+        m[4 * i] = gain ? gain[i] : 1.0F;
+    conv_set_matrix(p, m);
+}
+
+void conv_float_ref(const conv_params_t *p, const uint8_t *src, size_t stride, size_t n,
+                    int16_t *const raw[3], float *const out[3]){
+    for(size_t k = 0; k < n; k++, src += stride){
+        int16_t r0 = conv_count(src, p->shift);
+        int16_t r1 = conv_count(src + 2, p->shift);
+        int16_t r2 = conv_count(src + 4, p->shift);
+        if(raw){
+            raw[0][k] = r0;
+            raw[1][k] = r1;
+            raw[2][k] = r2;
+        }
+        float o[3];
+        conv_one(p, r0, r1, r2, o);
+        out[0][k] = o[0];
+        out[1][k] = o[1];
+        out[2][k] = o[2];
+    }
+}
+
+#if CONV_X86
+/*!
+* 4 lanes: counts sign extended to int32 by unpacking with themselves and shifting
+*/
+static void conv_float_sse2(const conv_params_t *p, const uint8_t *src, size_t stride, size_t n,
+                            int16_t *const raw[3], float *const out[3]){
+    int16_t blk[3][CONV_BLOCK];
+    int16_t *lane[3];
+    const __m128 scale = _mm_set1_ps(p->scale);
+    __m128 bias[3], m[9];
+    for(int a = 0; a < 3; a++)
+        bias[a] = _mm_set1_ps(p->bias[a]);
+    for(int i = 0; i < 9; i++)
+        m[i] = _mm_set1_ps(p->m[i]);
+
+    for(size_t base = 0; base < n; base += CONV_BLOCK){
+        size_t len = n - base < CONV_BLOCK ? n - base : CONV_BLOCK;
+        conv_gather(p, src + base * stride, stride, len, blk, raw, base, lane);
+        size_t k = 0;
+        for(; k + 4 <= len; k += 4){
+            __m128 v[3], o[3];
+            for(int a = 0; a < 3; a++){
+                __m128i w = _mm_loadl_epi64((const __m128i*)&lane[a][k]);
+                w = _mm_srai_epi32(_mm_unpacklo_epi16(w, w), 16);
+                v[a] = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(w), scale), bias[a]);
+            }
+            if(p->diagonal){
+                for(int a = 0; a < 3; a++)
+                    o[a] = _mm_mul_ps(m[4 * a], v[a]);
+            } else {
+                for(int a = 0; a < 3; a++)
+                    o[a] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[3 * a], v[0]), _mm_mul_ps(m[3 * a + 1], v[1])),
+                                      _mm_mul_ps(m[3 * a + 2], v[2]));
+            }
+            for(int a = 0; a < 3; a++)
+                _mm_storeu_ps(out[a] + base + k, o[a]);
+        }
+        conv_tail(p, lane, k, len, out, base);
+    }
+}
+
+/*!
+* 8 lanes, compiled for AVX2 whatever the build flags and only run where supported
+*/
+__attribute__((target("avx2")))
+static void conv_float_avx2(const conv_params_t *p, const uint8_t *src, size_t stride, size_t n,
+                            int16_t *const raw[3], float *const out[3]){
+    int16_t blk[3][CONV_BLOCK];
+    int16_t *lane[3];
+    const __m256 scale = _mm256_set1_ps(p->scale);
+    __m256 bias[3], m[9];
+    for(int a = 0; a < 3; a++)
+        bias[a] = _mm256_set1_ps(p->bias[a]);
+    for(int i = 0; i < 9; i++)
+        m[i] = _mm256_set1_ps(p->m[i]);
+
+    for(size_t base = 0; base < n; base += CONV_BLOCK){
+        size_t len = n - base < CONV_BLOCK ? n - base : CONV_BLOCK;
+        conv_gather(p, src + base * stride, stride, len, blk, raw, base, lane);
+        size_t k = 0;
+        for(; k + 8 <= len; k += 8){
+            __m256 v[3], o[3];
+            for(int a = 0; a < 3; a++){
+                __m256i w = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)&lane[a][k]));
+                v[a] = _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(w), scale), bias[a]);
+            }
+            if(p->diagonal){
+                for(int a = 0; a < 3; a++)
+                    o[a] = _mm256_mul_ps(m[4 * a], v[a]);
+            } else {
+                for(int a = 0; a < 3; a++)
+                    o[a] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[3 * a], v[0]), _mm256_mul_ps(m[3 * a + 1], v[1])),
+                                         _mm256_mul_ps(m[3 * a + 2], v[2]));
+            }
+            for(int a = 0; a < 3; a++)
+                _mm256_storeu_ps(out[a] + base + k, o[a]);
+        }
+        conv_tail(p, lane, k, len, out, base);
+    }
+}
+#endif
+
+#if CONV_NEON
+static void conv_float_neon(const conv_params_t *p, const uint8_t *src, size_t stride, size_t n,
+                            int16_t *const raw[3], float *const out[3]){
+    int16_t blk[3][CONV_BLOCK];
+    int16_t *lane[3];
+    const float32x4_t scale = vdupq_n_f32(p->scale);
+    float32x4_t bias[3], m[9];
+    for(int a = 0; a < 3; a++)
+        bias[a] = vdupq_n_f32(p->bias[a]);
+    for(int i = 0; i < 9; i++)
+        m[i] = vdupq_n_f32(p->m[i]);
+
+    for(size_t base = 0; base < n; base += CONV_BLOCK){
+        size_t len = n - base < CONV_BLOCK ? n - base : CONV_BLOCK;
+        conv_gather(p, src + base * stride, stride, len, blk, raw, base, lane);
+        size_t k = 0;
+        for(; k + 4 <= len; k += 4){
+            float32x4_t v[3], o[3];
+            for(int a = 0; a < 3; a++){
+                int32x4_t w = vmovl_s16(vld1_s16(&lane[a][k]));
+                v[a] = vsubq_f32(vmulq_f32(vcvtq_f32_s32(w), scale), bias[a]);
+            }
+            if(p->diagonal){
+                for(int a = 0; a < 3; a++)
+                    o[a] = vmulq_f32(m[4 * a], v[a]);
+            } else {
+                for(int a = 0; a < 3; a++)
+                    o[a] = vaddq_f32(vaddq_f32(vmulq_f32(m[3 * a], v[0]), vmulq_f32(m[3 * a + 1], v[1])),
+                                     vmulq_f32(m[3 * a + 2], v[2]));
+            }
+            for(int a = 0; a < 3; a++)
+                vst1q_f32(out[a] + base + k, o[a]);
+        }
+        conv_tail(p, lane, k, len, out, base);
+    }
+}
+#endif
+
+void conv_float(const conv_params_t *p, const uint8_t *src, size_t stride, size_t n,
+                int16_t *const raw[3], float *const out[3]){
+#if CONV_X86
+    if(n >= 8 && __builtin_cpu_supports("avx2")){
+        conv_float_avx2(p, src, stride, n, raw, out);
+    } else if(n >= 4){
+        conv_float_sse2(p, src, stride, n, raw, out);
+    } else {
+        conv_float_ref(p, src, stride, n, raw, out);
+    }
+#elif CONV_NEON
+    if(n >= 4){
+        conv_float_neon(p, src, stride, n, raw, out);
+    } else {
+        conv_float_ref(p, src, stride, n, raw, out);
+    }
+#else
+    conv_float_ref(p, src, stride, n, raw, out);
+#endif
+}
+
+/*!
+* As gyro_convert_fixed / accel_convert_fixed: rounded Q31 scaling, Q16 bias, then
+* the Q30 matrix with one rounding per output
+*/
+void conv_fixed(const conv_params_t *p, const uint8_t *src, size_t stride, size_t n,
+                int16_t *const raw[3], q16_t *const out[3]){
+    const q30_t *m = p->m_q;
+    for(size_t k = 0; k < n; k++, src += stride){
+        int16_t r[3] = {conv_count(src, p->shift), conv_count(src + 2, p->shift), conv_count(src + 4, p->shift)};
+        q16_t v[3];
+        for(int a = 0; a < 3; a++){
+            v[a] = q16_scale(r[a], p->scale_q) - p->bias_q[a];
+            if(raw)
+                raw[a][k] = r[a];
+        }
+        for(int a = 0; a < 3; a++){
+            if(p->diagonal){
+                out[a][k] = q30_mul(m[4 * a], v[a]);
+            } else {
+                int64_t s = (int64_t)m[3 * a] * v[0] + (int64_t)m[3 * a + 1] * v[1] + (int64_t)m[3 * a + 2] * v[2];
+                out[a][k] = (q16_t)((s + (1 << 29)) >> 30);
+            }
+        }
+    }
+}
+
+const conv_kernel_t *conv_kernels(size_t *count){
+    static conv_kernel_t kernels[3];
+    size_t n = 0;
+    kernels[n++] = (conv_kernel_t){"scalar", conv_float_ref, 1};
+#if CONV_X86
+    kernels[n++] = (conv_kernel_t){"sse2", conv_float_sse2, 1};
+    kernels[n++] = (conv_kernel_t){"avx2", conv_float_avx2, (uint8_t)(__builtin_cpu_supports("avx2") != 0)};
+#elif CONV_NEON
+    kernels[n++] = (conv_kernel_t){"neon", conv_float_neon, 1};
+#endif
+    *count = n;
+    return kernels;
+}
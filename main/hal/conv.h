@@ -0,0 +1,117 @@
+/*!
+* @file conv.h
+* @author Ethan Lew
+* @brief Batch conversion of big endian sensor frames into SoA SI buffers
+*
+* One pass over n frames of X/Y/Z big endian registers, stride bytes apart (a FIFO
+* burst, or a single sample with n = 1):
+*
+*     raw = (int16)(msb << 8 | lsb) >> shift       shift 2 for the 14 bit accelerometer
+*     v   = raw * scale - bias
+*     out = M v                                    row major 3x3, misalignment and gain
+*
+* The results go to separate x, y and z arrays (SoA), so the arithmetic runs across
+* samples in SIMD lanes. conv_float picks the widest kernel the host has: AVX2 or SSE2
+* on x86-64 (chosen at run time), NEON on AArch64, else the scalar reference. The
+* kernels gather the bytes of a block of samples into lanes first, then do the same
+* IEEE operations in the same order as the reference, one rounding each; with
+* contraction into fused multiply-adds turned off for conv.c (-ffp-contract=off),
+* every kernel gives bit for bit the reference's results. A diagonal M (no
+* misalignment terms) skips the off-diagonal products, in every kernel alike.
+*
+* conv_fixed is the integer counterpart (see fixed.h), bit for bit the drivers'
+* gyro_convert_fixed and accel_convert_fixed. It is scalar only: the parts it is for
+* (ESP32-S2/C3) have no SIMD unit.
+*/
+
+#ifndef CONV_H
+#define CONV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "fixed.h"
+
+/* Samples gathered per block by the SIMD kernels */
+#define CONV_BLOCK 32
+
+/*!
+* Conversion of one sensor, float and fixed point forms kept together
+*/
+typedef struct conv_params_s {
+    float scale;             /**< SI units per count */
+    float bias[3];           /**< Subtracted after scaling */
+    float m[9];              /**< Row major, applied after the bias */
+    uint8_t diagonal;        /**< m has no off-diagonal terms */
+    uint8_t shift;           /**< Right shift of the left aligned counts */
+    q31_t scale_q;
+    q16_t bias_q[3];
+    q30_t m_q[9];
+} conv_params_t;
+
+typedef void (*conv_float_fn)(const conv_params_t *p, const uint8_t *src, size_t stride, size_t n,
+                              int16_t *const raw[3], float *const out[3]);
+
+/*!
+* A float kernel, for benchmarks and checks
+*/
+typedef struct conv_kernel_s {
+    const char *name;
+    conv_float_fn fn;
+    uint8_t available;       /**< The host can run it */
+} conv_kernel_t;
+
+/*!
+* @brief unit scale, no bias, identity matrix
+* @param p the parameters
+* @param shift right shift of the counts, 0 for 16 bit data
+*/
+void conv_init(conv_params_t *p, uint8_t shift);
+
+void conv_set_scale(conv_params_t *p, float scale);
+
+/*!
+* @brief bias subtracted after scaling, NULL for none
+*/
+void conv_set_bias(conv_params_t *p, const float *bias);
+
+/*!
+* @brief matrix applied after the bias, row major; NULL for the identity
+*/
+void conv_set_matrix(conv_params_t *p, const float *m);
+
+/*!
+* @brief diagonal matrix, e.g. per axis gains; NULL for the identity
+*/
+void conv_set_gain(conv_params_t *p, const float *gain);
+
+/*!
+* @brief convert n frames with the best kernel of the host
+* @param p the parameters
+* @param src the first frame, at its X MSB
+* @param stride bytes from one frame to the next
+* @param n number of frames
+* @param raw x, y and z arrays of n counts, or NULL
+* @param out x, y and z arrays of n values
+*/
+void conv_float(const conv_params_t *p, const uint8_t *src, size_t stride, size_t n,
+                int16_t *const raw[3], float *const out[3]);
+
+/*!
+* @brief the scalar reference of conv_float
+*/
+void conv_float_ref(const conv_params_t *p, const uint8_t *src, size_t stride, size_t n,
+                    int16_t *const raw[3], float *const out[3]);
+
+/*!
+* @brief convert n frames in integer arithmetic, out in Q16; arguments as conv_float
+*/
+void conv_fixed(const conv_params_t *p, const uint8_t *src, size_t stride, size_t n,
+                int16_t *const raw[3], q16_t *const out[3]);
+
+/*!
+* @brief the float kernels compiled in, the reference first
+* @param count set to their number
+*/
+const conv_kernel_t *conv_kernels(size_t *count);
+
+#endif
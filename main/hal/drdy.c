@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+#include "drdy.h"
+
+#ifdef OTIS_HOST
+#include <time.h>
+#include <errno.h>
+#else
+#include "esp_attr.h"
+#include "driver/gpio.h"
+
+/* The GPIO ISR service is shared by all sources */
+static int DRDY_ISR_INSTALLED = 0;
+
+static void IRAM_ATTR drdy_isr(void *arg);
+#endif
+
+static void drdy_hist_add(drdy_hist_t *hist, uint32_t latency);
+
+drdy_err_t drdy_group_init(drdy_group_t *group){
+    if(!group)
+        return DRDY_INVALID;
+#ifdef OTIS_HOST
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->cond, NULL);
+    group->pending = 0;
+#else
+    group->task = xTaskGetCurrentTaskHandle();
+#endif
+    return DRDY_SUCCESS;
+}
+
+/*!
+* Installing a source on target works as follows
+*   1. Configure the pin as an input interrupting on the rising edge (the sensors
+*      are configured push-pull, active high)
+*   2. Install the shared GPIO ISR service once
+*   3. Attach drdy_isr with the source as its argument
+*/
+drdy_err_t drdy_source_init(drdy_source_t *source, drdy_group_t *group, int pin, uint32_t bit){
+    if(!source || !group || bit == 0)
+        return DRDY_INVALID;
+
+    memset(source, 0, sizeof(drdy_source_t));
+    source->pin = pin;
+    source->bit = bit;
+    source->group = group;
+
+    if(pin == DRDY_NO_PIN)
+        return DRDY_SUCCESS;
+#ifdef OTIS_HOST
+    return DRDY_INVALID;
+#else
+    gpio_config_t conf;
+    conf.pin_bit_mask = (1ULL << pin);
+    conf.mode = GPIO_MODE_INPUT;
+    conf.pull_up_en = GPIO_PULLUP_DISABLE;
+    conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+    conf.intr_type = GPIO_INTR_POSEDGE;
+    if(gpio_config(&conf) != ESP_OK)
+        return DRDY_GPIO_FAIL;
+
+    if(DRDY_ISR_INSTALLED == 0){
+        if(gpio_install_isr_service(0) != ESP_OK)
+            return DRDY_GPIO_FAIL;
+        DRDY_ISR_INSTALLED = 1;
+    }
+    if(gpio_isr_handler_add(pin, drdy_isr, source) != ESP_OK)
+        return DRDY_GPIO_FAIL;
+    return DRDY_SUCCESS;
+#endif
+}
+
+drdy_err_t drdy_source_destroy(drdy_source_t *source){
+    if(!source)
+        return DRDY_INVALID;
+#ifndef OTIS_HOST
+    if(source->pin != DRDY_NO_PIN)
+        gpio_isr_handler_remove(source->pin);
+#endif
+    source->group = NULL;
+    return DRDY_SUCCESS;
+}
+
+#ifdef OTIS_HOST
+void drdy_signal(drdy_source_t *source, uint64_t stamp){
+    drdy_group_t *group = source->group;
+    source->stamp = stamp;
+    source->edges++;
+    pthread_mutex_lock(&group->lock);
+    group->pending |= source->bit;
+    pthread_cond_signal(&group->cond);
+    pthread_mutex_unlock(&group->lock);
+}
+
+uint32_t drdy_wait(drdy_group_t *group, uint32_t timeout_ms){
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&group->lock);
+    while(group->pending == 0){
+        if(pthread_cond_timedwait(&group->cond, &group->lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    uint32_t bits = group->pending;
+    group->pending = 0;
+    pthread_mutex_unlock(&group->lock);
+    return bits;
+}
+
+#else
+void IRAM_ATTR drdy_signal(drdy_source_t *source, uint64_t stamp){
+    BaseType_t woken = pdFALSE;
+    source->stamp = stamp;
+    source->edges++;
+    xTaskNotifyFromISR(source->group->task, source->bit, eSetBits, &woken);
+    if(woken == pdTRUE)
+        portYIELD_FROM_ISR();
+}
+
+uint32_t drdy_wait(drdy_group_t *group, uint32_t timeout_ms){
+    uint32_t bits = 0;
+    if(xTaskNotifyWait(0, 0xFFFFFFFF, &bits, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+        return 0;
+    return bits;
+}
+
+static void IRAM_ATTR drdy_isr(void *arg){
+    drdy_signal((drdy_source_t*)arg, get_time_micros());
+}
+#endif
+
+/*!
+* The 64 bit stamp takes two loads on the ESP32, so an edge landing in between could
+* tear it. The ISR (on the core that installed it, the same as the reader) writes the
+* stamp before counting the edge: re-read until the edge count is stable.
+*/
+uint64_t drdy_serve(drdy_source_t *source){
+    uint32_t edges;
+    uint64_t stamp;
+    do {
+        edges = source->edges;
+        stamp = source->stamp;
+    } while(edges != source->edges);
+
+    /* More than one new edge means samples were overwritten before being read */
+    if(edges - source->served > 1)
+        source->missed += edges - source->served - 1;
+    source->served = edges;
+
+    drdy_hist_add(&source->latency, (uint32_t)(get_time_micros() - stamp));
+    return stamp;
+}
+
+void drdy_print(const drdy_source_t *source, const char *name){
+    const drdy_hist_t *hist = &source->latency;
+    uint32_t mean = hist->count ? (uint32_t)(hist->sum / hist->count) : 0;
+    printf("%s: served %u missed %u mean %uus max %uus\n", name,
+           (unsigned)source->served, (unsigned)source->missed, (unsigned)mean, (unsigned)hist->max);
+    for(int i = 0; i < DRDY_HIST_BUCKETS; i++){
+        if(hist->bucket[i] == 0)
+            continue;
+        printf("  <%6uus %u\n", (unsigned)(1u << i), (unsigned)hist->bucket[i]);
+    }
+}
+
+static void drdy_hist_add(drdy_hist_t *hist, uint32_t latency){
+    int idx = 0;
+    while(idx < DRDY_HIST_BUCKETS - 1 && (latency >> idx) != 0)
+        idx++;
+    hist->bucket[idx]++;
+    hist->count++;
+    hist->sum += latency;
+    if(latency > hist->max)
+        hist->max = latency;
+}
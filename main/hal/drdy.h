@@ -0,0 +1,120 @@
+/*!
+* @file drdy.h
+* @author Ethan Lew
+* @brief Data-ready interrupt sources for event driven sampling
+*
+* Each sensor INT pin is a drdy source. An edge on the pin timestamps the sample in the
+* ISR and wakes the sampling task through a notification bit, so every sample is read
+* once, as soon as it exists. Sources can also be driven without a GPIO by calling
+* drdy_signal directly, which is how a simulated interrupt generator exercises the same
+* scheduling path on host builds (OTIS_HOST).
+*/
+
+#ifndef DRDY_H
+#define DRDY_H
+
+#include <stdint.h>
+#include "time_utils.h"
+
+#ifdef OTIS_HOST
+#include <pthread.h>
+#else
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+/* Number of log2 buckets in a latency histogram (bucket i counts [2^(i-1), 2^i) us) */
+#define DRDY_HIST_BUCKETS 16
+/* Source without a GPIO, driven by drdy_signal */
+#define DRDY_NO_PIN (-1)
+
+/*!
+* Sample-to-read latency histogram
+*/
+typedef struct drdy_hist_s {
+    uint32_t bucket[DRDY_HIST_BUCKETS]; /**< log2 buckets in microseconds */
+    uint32_t count;                     /**< Number of recorded latencies */
+    uint32_t max;                       /**< Worst latency (us) */
+    uint64_t sum;                       /**< Sum of latencies (us) */
+} drdy_hist_t;
+
+/*!
+* The task waiting on a set of sources
+*/
+typedef struct drdy_group_s {
+#ifdef OTIS_HOST
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t pending;
+#else
+    TaskHandle_t task;
+#endif
+} drdy_group_t;
+
+/*!
+* One interrupt source
+*/
+typedef struct drdy_source_s {
+    int pin;                 /**< GPIO number or DRDY_NO_PIN */
+    uint32_t bit;            /**< Notification bit reported by drdy_wait */
+    drdy_group_t *group;     /**< Group notified on an edge */
+    volatile uint64_t stamp; /**< Time (us) of the last edge, taken in the ISR */
+    volatile uint32_t edges; /**< Edges seen */
+    uint32_t served;         /**< Edges consumed by drdy_serve */
+    uint32_t missed;         /**< Edges that were never served */
+    drdy_hist_t latency;     /**< Edge to read latency */
+} drdy_source_t;
+
+typedef enum {
+    DRDY_SUCCESS = 0x0,
+    DRDY_GPIO_FAIL = 0x1,
+    DRDY_INVALID = 0x2,
+} drdy_err_t;
+
+/*!
+* @brief bind a group to the calling task
+*/
+drdy_err_t drdy_group_init(drdy_group_t *group);
+
+/*!
+* @brief setup a source; with a pin, a rising edge ISR is installed on it
+* @param source the source
+* @param group the group to notify
+* @param pin the GPIO wired to the sensor INT pin, or DRDY_NO_PIN
+* @param bit the notification bit for this source
+*/
+drdy_err_t drdy_source_init(drdy_source_t *source, drdy_group_t *group, int pin, uint32_t bit);
+
+/*!
+* @brief remove the ISR of a source
+*/
+drdy_err_t drdy_source_destroy(drdy_source_t *source);
+
+/*!
+* @brief signal a data-ready edge; safe from the GPIO ISR
+* @param source the source
+* @param stamp time (us) of the edge, from get_time_micros
+*/
+void drdy_signal(drdy_source_t *source, uint64_t stamp);
+
+/*!
+* @brief block until at least one source signals
+* @param group the group
+* @param timeout_ms how long to wait
+* @returns the notification bits of the sources that signalled, 0 on timeout
+*/
+uint32_t drdy_wait(drdy_group_t *group, uint32_t timeout_ms);
+
+/*!
+* @brief mark the last edge of a source as read, recording its latency
+* Call right before reading the sensor.
+* @returns the edge timestamp (us) of the sample about to be read
+*/
+uint64_t drdy_serve(drdy_source_t *source);
+
+/*!
+* @brief print the latency histogram of a source
+*/
+void drdy_print(const drdy_source_t *source, const char *name);
+
+#endif
@@ -0,0 +1,79 @@
+/*!
+* @file fixed.h
+* @author Ethan Lew
+* @brief Q-format fixed point types for the integer conversion and fusion path
+*
+* For parts with a slow or no FPU (ESP32-S2, ESP32-C3), where every float multiply
+* is a library call. Formats, all two's complement:
+*   - Q15: the sensors' int16 counts, a fraction of the full scale range
+*   - Q31: conversion scales, SI units per count. Every scale of the supported
+*     ranges is below 1 (at most 0.0096 m/s^2 per count), so a count converts with
+*     one 16x32 multiply and a shift
+*   - Q30: unit magnitudes (quaternions, directions, gains near 1), with room for 1.0
+*     and the overshoot of an update step before renormalization
+*   - Q16: SI values (rad/s, m/s^2, uT), 15 integer bits, resolution 1.5e-5
+*
+* With OTIS_FIXED_POINT set to 1, the drivers convert through these formats instead
+* of float arithmetic. The float fields of the sample record then carry the Q16 values
+* exactly: below 128 (every rate and acceleration of the supported ranges) a Q16
+* value and its rounding fit the 24 bit float mantissa, so q16_from_float recovers
+* them bit for bit.
+*/
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <stdint.h>
+
+#ifndef OTIS_FIXED_POINT
+#define OTIS_FIXED_POINT 0
+#endif
+
+typedef int16_t q15_t;
+typedef int32_t q31_t;
+typedef int32_t q30_t;
+typedef int32_t q16_t;
+
+#define Q30_ONE (1L << 30)
+#define Q16_ONE (1L << 16)
+
+/*!
+* @brief a Q15 count times a Q31 scale, as Q16
+* Rounded: a plain shift rounds down, which would add half an LSB of bias to every
+* rate, and the yaw would drift with it
+*/
+static inline q16_t q16_scale(int16_t count, q31_t scale){
+    return (q16_t)(((int64_t)count * scale + (1 << 14)) >> 15);
+}
+
+/*!
+* @brief product of a Q30 and any Q format, in the latter, rounded
+*/
+static inline int32_t q30_mul(q30_t a, int32_t b){
+    return (int32_t)(((int64_t)a * b + (1 << 29)) >> 30);
+}
+
+/*!
+* @brief round to nearest; meant for constants and calibration, not per sample
+*/
+static inline q31_t q31_from_float(float v){
+    return (q31_t)(v * 2147483648.0F + (v < 0.0F ? -0.5F : 0.5F));
+}
+
+static inline q30_t q30_from_float(float v){
+    return (q30_t)(v * 1073741824.0F + (v < 0.0F ? -0.5F : 0.5F));
+}
+
+static inline q16_t q16_from_float(float v){
+    return (q16_t)(v * 65536.0F + (v < 0.0F ? -0.5F : 0.5F));
+}
+
+static inline float q30_to_float(q30_t v){
+    return (float)v * (1.0F / 1073741824.0F);
+}
+
+static inline float q16_to_float(q16_t v){
+    return (float)v * (1.0F / 65536.0F);
+}
+
+#endif
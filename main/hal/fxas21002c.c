@@ -1,4 +1,20 @@
+#include <string.h>
 #include "fxas21002c.h"
+#include "time_utils.h"
+#include "perf.h"
+
+/* Output data period in microseconds, indexed by CTRL_REG1 DR[2:0] */
+static const uint32_t gyro_period_us[8] = {
+    1250, 2500, 5000, 10000, 20000, 40000, 80000, 80000
+};
+
+static void gyro_convert(gyro_t *gyro, const uint8_t *frames, size_t n, gyro_float_data_t *out);
+
+static gyro_err_t gyro_write_reg(gyro_t *gyro, uint8_t reg, uint8_t value);
+
+static gyro_err_t gyro_fifo_links(gyro_t *gyro);
+
+static void gyro_fifo_links_destroy(gyro_t *gyro);
 
 gyro_err_t gyro_init(gyro_t **gyro){
     if(gyro != NULL){
@@ -7,8 +23,13 @@ gyro_err_t gyro_init(gyro_t **gyro){
 
     /* Setup the I2C device */
     i2c_err_t ret;
-    uint8_t* data_rd = (uint8_t*)malloc(sizeof(uint8_t)*GYRO_BUFF_SIZE);
-    uint8_t* data_wr = (uint8_t*)malloc(sizeof(uint8_t)*GYRO_BUFF_SIZE);
+    uint8_t data_wr[2];
+    uint8_t* data_rd = (*gyro)->data_rd;
+    (*gyro)->rd_link = NULL;
+    (*gyro)->fifo.status_link = NULL;
+    for(size_t k = 0; k < GYRO_FIFO_SIZE; k++)
+        (*gyro)->fifo.burst_link[k] = NULL;
+    (*gyro)->i2c.port = I2C_MASTER_PORT;
     (*gyro)->i2c.addr = FXAS21002C_ADDRESS;
     (*gyro)->i2c.clk_speed = I2C_MASTER_FAST_FREQ_HZ;
     (*gyro)->i2c.mode =I2C_MODE_TYPE_MASTER;
@@ -23,30 +44,29 @@ gyro_err_t gyro_init(gyro_t **gyro){
     (*gyro)->raw.y = 0;
     (*gyro)->raw.z = 0;
 
+    /* Start with the stored bias, if any */
+    imu_cal_t cal;
+    conv_init(&(*gyro)->conv, 0);
+    gyro_set_bias(*gyro, NULL);
+    if(imu_cal_load(&cal) == IMU_CAL_SUCCESS && (cal.flags & IMU_CAL_GYRO))
+        gyro_set_bias(*gyro, cal.gyro_bias);
+
+    /* FIFO starts disabled */
+    (*gyro)->fifo.enabled = 0;
+    (*gyro)->fifo.watermark = 0;
+    (*gyro)->fifo.count = 0;
+    (*gyro)->fifo.last_stamp = 0;
+    (*gyro)->fifo.follow = 0;
+    (*gyro)->fifo.held = 0;
+    (*gyro)->fifo.held_at = 0;
+    (*gyro)->fifo.overflows = 0;
+
     /* Check device ID */
     ret = i2c_utils_read((*gyro)->i2c, GYRO_REGISTER_WHO_AM_I, data_rd, 8);
     if(data_rd[0] != FXAS21002C_ID)
         return GYRO_ID_FAIL;
     
-    /* Setup the gyro range */
-    (*gyro)->range = GYRO_RANGE;
-    uint8_t ctrlReg0 = 0x00;
-    switch((*gyro)->range)
-    {
-        case GYRO_RANGE_250DPS:
-        ctrlReg0 = 0x03;
-        break;
-        case GYRO_RANGE_500DPS:
-        ctrlReg0 = 0x02;
-        break;
-        case GYRO_RANGE_1000DPS:
-        ctrlReg0 = 0x01;
-        break;
-        case GYRO_RANGE_2000DPS:
-        ctrlReg0 = 0x00;
-        break;
-    }
-
+    /* Reset to standby, then apply the default rate and range */
     data_wr[0] = GYRO_REGISTER_CTRL_REG1;
     data_wr[1] = 0x00;
     ret = i2c_utils_write((*gyro)->i2c, data_wr, 2);
@@ -54,16 +74,17 @@ gyro_err_t gyro_init(gyro_t **gyro){
     data_wr[1] = (1 << 6);
     ret = i2c_utils_write((*gyro)->i2c, data_wr, 2);
 
-    data_wr[0] = GYRO_REGISTER_CTRL_REG0;
-    data_wr[1] = ctrlReg0;
-    ret = i2c_utils_write((*gyro)->i2c, data_wr, 2);
+    (*gyro)->ctrl_reg0 = 0x00;
+    (*gyro)->ctrl_reg1 = 0x00;
+    gyro_config_t config = {GYRO_ODR, GYRO_RANGE};
+    gyro_err_t err = gyro_configure(*gyro, &config);
+    if(err != GYRO_SUCCESS)
+        return err;
 
-    data_wr[0] = GYRO_REGISTER_CTRL_REG1;
-    data_wr[1] = 0x0E;
-    ret = i2c_utils_write((*gyro)->i2c, data_wr, 2);
-    
-    free(data_rd);
-    free(data_wr);
+    /* Prebuild the sample read so updates do not touch the heap */
+    ret = i2c_utils_link_read((*gyro)->i2c, GYRO_REGISTER_STATUS | 0x80, data_rd, GYRO_SAMPLE_SIZE, &(*gyro)->rd_link);
+    if(ret != I2C_SUCCESS)
+        return GYRO_NMALLOC;
 
     return GYRO_SUCCESS;
 
@@ -74,75 +95,402 @@ gyro_err_t gyro_update(gyro_t *gyro){
         return GYRO_NMALLOC;
     }
 
-    i2c_err_t ret;
-    uint8_t* data_rd = (uint8_t*)malloc(sizeof(uint8_t)*GYRO_BUFF_SIZE);
-    uint8_t* data_wr = (uint8_t*)malloc(sizeof(uint8_t)*GYRO_BUFF_SIZE);
+    PERF_BEGIN(start);
+
+    gyro_err_t err = gyro_complete(gyro, i2c_utils_link_exec(gyro->rd_link));
+    if(err != GYRO_SUCCESS)
+        return err;
+    PERF_END(PERF_GYRO_READ, start);
+
+    return GYRO_SUCCESS;
+}
+
+gyro_err_t gyro_sample_op(gyro_t *gyro, i2c_op_t *op){
+    if(!gyro || !op) {
+        return GYRO_NMALLOC;
+    }
+    *op = (i2c_op_t){I2C_XFER_READ, gyro->i2c, GYRO_REGISTER_STATUS | 0x80, gyro->data_rd, GYRO_SAMPLE_SIZE};
+    return GYRO_SUCCESS;
+}
+
+gyro_err_t gyro_complete(gyro_t *gyro, i2c_err_t result){
+    if(!gyro) {
+        return GYRO_NMALLOC;
+    }
 
     /* Clear raw data */
     gyro->raw.x = 0;
     gyro->raw.y = 0;
     gyro->raw.z = 0;
 
-    ret = i2c_utils_read(gyro->i2c, GYRO_REGISTER_STATUS | 0x80, data_rd, 7);
-    if(ret != I2C_SUCCESS)
+    if(result != I2C_SUCCESS)
         return GYRO_BUS_FAIL;
 
-    //uint8_t status = data_rd[0];
-    uint8_t xhi = data_rd[1];
-    uint8_t xlo = data_rd[2];
-    uint8_t yhi = data_rd[3];
-    uint8_t ylo = data_rd[4];
-    uint8_t zhi = data_rd[5];
-    uint8_t zlo = data_rd[6];
+    //uint8_t status = gyro->data_rd[0];
+    gyro_convert(gyro, gyro->data_rd + 1, 1, &gyro->converted);
+    return GYRO_SUCCESS;
+}
+
+gyro_err_t gyro_set_bias(gyro_t *gyro, const float *bias){
+    if(!gyro){
+        return GYRO_NMALLOC;
+    }
+    for(int i = 0; i < 3; i++){
+        gyro->bias[i] = bias ? bias[i] : 0.0F;
+    }
+    conv_set_bias(&gyro->conv, gyro->bias);
+    return GYRO_SUCCESS;
+}
 
-    gyro->converted.x = (int16_t)((xhi << 8) | xlo);
-    gyro->converted.y = (int16_t)((yhi << 8) | ylo);
-    gyro->converted.z = (int16_t)((zhi << 8) | zlo);
+void gyro_convert_fixed(const gyro_t *gyro, const gyro_int_data_t *raw, gyro_fixed_data_t *out){
+    const conv_params_t *p = &gyro->conv;
+    out->x = q16_scale(raw->x, p->scale_q) - p->bias_q[0];
+    out->y = q16_scale(raw->y, p->scale_q) - p->bias_q[1];
+    out->z = q16_scale(raw->z, p->scale_q) - p->bias_q[2];
+}
 
-    gyro->raw.x = gyro->converted.x;
-    gyro->raw.y =  gyro->converted.y;
-    gyro->raw.z = gyro->converted.z;
+/*!
+* Reconfiguration
+*   1. Look up the CTRL_REG0 FS and the sensitivity for the range; nothing is written
+*      for a configuration the part does not have
+*   2. Standby, since CTRL_REG0 and the CTRL_REG1 rate only change out of active mode
+*   3. With the FIFO on, disable and re-arm it in F_SETUP, which flushes the samples
+*      measured at the old setting
+*   4. Write CTRL_REG0, then CTRL_REG1 with the new rate, which returns to active;
+*      with the standby, one bus transaction
+*   5. Keep the scale and period, so conversions do not look at the range again
+*/
+gyro_err_t gyro_configure(gyro_t *gyro, const gyro_config_t *config){
+    if(!gyro || !config) {
+        return GYRO_NMALLOC;
+    }
 
-    switch(gyro->range)
+    uint8_t fs;
+    float sensitivity;
+    switch(config->range)
     {
         case GYRO_RANGE_250DPS:
-        gyro->converted.x *= GYRO_SENSITIVITY_250DPS;
-        gyro->converted.y *= GYRO_SENSITIVITY_250DPS;
-        gyro->converted.z *= GYRO_SENSITIVITY_250DPS;
+        fs = 0x03;
+        sensitivity = GYRO_SENSITIVITY_250DPS;
         break;
         case GYRO_RANGE_500DPS:
-        gyro->converted.x *= GYRO_SENSITIVITY_500DPS;
-        gyro->converted.y *= GYRO_SENSITIVITY_500DPS;
-        gyro->converted.z *= GYRO_SENSITIVITY_500DPS;
+        fs = 0x02;
+        sensitivity = GYRO_SENSITIVITY_500DPS;
         break;
         case GYRO_RANGE_1000DPS:
-        gyro->converted.x *= GYRO_SENSITIVITY_1000DPS;
-        gyro->converted.y *= GYRO_SENSITIVITY_1000DPS;
-        gyro->converted.z *= GYRO_SENSITIVITY_1000DPS;
+        fs = 0x01;
+        sensitivity = GYRO_SENSITIVITY_1000DPS;
         break;
         case GYRO_RANGE_2000DPS:
-        gyro->converted.x *= GYRO_SENSITIVITY_2000DPS;
-        gyro->converted.y *= GYRO_SENSITIVITY_2000DPS;
-        gyro->converted.z *= GYRO_SENSITIVITY_2000DPS;
+        fs = 0x00;
+        sensitivity = GYRO_SENSITIVITY_2000DPS;
         break;
+        default:
+        return GYRO_INVALID;
     }
+    if((unsigned)config->odr > GYRO_ODR_12_5HZ)
+        return GYRO_INVALID;
+
+    uint8_t ctrl_reg0 = (gyro->ctrl_reg0 & ~GYRO_CTRL_REG0_FS) | fs;
+    uint8_t ctrl_reg1 = (gyro->ctrl_reg1 & ~GYRO_CTRL_REG1_DR) |
+                        (uint8_t)(config->odr << GYRO_CTRL_REG1_DR_SHIFT) | GYRO_CTRL_REG1_ACTIVE;
 
-    gyro->converted.x *= SENSORS_DPS_TO_RADS;
-    gyro->converted.y *= SENSORS_DPS_TO_RADS;
-    gyro->converted.z *= SENSORS_DPS_TO_RADS;
-        
-    free(data_rd);
-    free(data_wr);
+    uint8_t standby_wr[2] = {GYRO_REGISTER_CTRL_REG1, gyro->ctrl_reg1 & ~GYRO_CTRL_REG1_ACTIVE};
+    uint8_t flush_wr[2] = {GYRO_REGISTER_F_SETUP, GYRO_F_MODE_DISABLED};
+    uint8_t f_setup_wr[2] = {GYRO_REGISTER_F_SETUP, GYRO_F_MODE_CIRCULAR | (gyro->fifo.watermark & GYRO_F_STATUS_CNT)};
+    uint8_t reg0_wr[2] = {GYRO_REGISTER_CTRL_REG0, ctrl_reg0};
+    uint8_t reg1_wr[2] = {GYRO_REGISTER_CTRL_REG1, ctrl_reg1};
+    i2c_op_t ops[5];
+    size_t n = 0;
+    if(gyro->ctrl_reg1 & GYRO_CTRL_REG1_ACTIVE)
+        ops[n++] = (i2c_op_t){I2C_XFER_WRITE, gyro->i2c, 0, standby_wr, 2};
+    /* Queued samples were measured at the old rate and range: flush them in standby */
+    if(gyro->fifo.enabled){
+        ops[n++] = (i2c_op_t){I2C_XFER_WRITE, gyro->i2c, 0, flush_wr, 2};
+        ops[n++] = (i2c_op_t){I2C_XFER_WRITE, gyro->i2c, 0, f_setup_wr, 2};
+    }
+    ops[n++] = (i2c_op_t){I2C_XFER_WRITE, gyro->i2c, 0, reg0_wr, 2};
+    ops[n++] = (i2c_op_t){I2C_XFER_WRITE, gyro->i2c, 0, reg1_wr, 2};
+    if(i2c_utils_batch(ops, n) != I2C_SUCCESS)
+        return GYRO_BUS_FAIL;
+
+    gyro->ctrl_reg0 = ctrl_reg0;
+    gyro->ctrl_reg1 = ctrl_reg1;
+    gyro->range = config->range;
+    gyro->odr = config->odr;
+    gyro->scale = sensitivity * SENSORS_DPS_TO_RADS;
+    conv_set_scale(&gyro->conv, gyro->scale);
+    gyro->period_us = gyro_period_us[config->odr];
+    /* Stamps restart from the read time, still after the last one */
+    gyro->fifo.follow = 0;
+    gyro->fifo.held = 0;
+    gyro->fifo.count = 0;
+
+    return GYRO_SUCCESS;
+}
+
+gyro_err_t gyro_drdy_enable(gyro_t *gyro){
+    if(!gyro) {
+        return GYRO_NMALLOC;
+    }
+
+    /* Interrupt configuration is only changed out of active mode */
+    if(gyro_write_reg(gyro, GYRO_REGISTER_CTRL_REG1, gyro->ctrl_reg1 & ~GYRO_CTRL_REG1_ACTIVE) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
+    if(gyro_write_reg(gyro, GYRO_REGISTER_CTRL_REG2,
+                      GYRO_CTRL_REG2_INT_CFG_DRDY | GYRO_CTRL_REG2_INT_EN_DRDY | GYRO_CTRL_REG2_IPOL) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
+    if(gyro_write_reg(gyro, GYRO_REGISTER_CTRL_REG1, gyro->ctrl_reg1) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
 
     return GYRO_SUCCESS;
 }
 
 gyro_err_t gyro_destroy(gyro_t **gyro){
     if(gyro){
+        if(*gyro){
+            i2c_utils_link_destroy(&(*gyro)->rd_link);
+            gyro_fifo_links_destroy(*gyro);
+        }
         free(*gyro);
         *gyro = NULL;
         return GYRO_SUCCESS;
     } else {
         return GYRO_NMALLOC;
     }
-}
\ No newline at end of file
+}
+
+gyro_err_t gyro_fifo_enable(gyro_t *gyro, uint8_t watermark){
+    if(!gyro) {
+        return GYRO_NMALLOC;
+    }
+    if(watermark == 0 || watermark > GYRO_FIFO_SIZE) {
+        watermark = GYRO_FIFO_WATERMARK;
+    }
+    if(gyro_fifo_links(gyro) != GYRO_SUCCESS)
+        return GYRO_NMALLOC;
+
+    /* FIFO setup is only changed out of active mode */
+    if(gyro_write_reg(gyro, GYRO_REGISTER_CTRL_REG1, gyro->ctrl_reg1 & ~GYRO_CTRL_REG1_ACTIVE) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
+
+    /* Wrap bursts back to OUT_X_MSB so consecutive samples are contiguous */
+    if(gyro_write_reg(gyro, GYRO_REGISTER_CTRL_REG3, GYRO_CTRL_REG3_WRAPTOONE) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
+
+    /* Disabling first flushes the FIFO and clears a pending overflow */
+    if(gyro_write_reg(gyro, GYRO_REGISTER_F_SETUP, GYRO_F_MODE_DISABLED) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
+
+    /* Circular mode keeps the newest samples if the reader falls behind */
+    if(gyro_write_reg(gyro, GYRO_REGISTER_F_SETUP, GYRO_F_MODE_CIRCULAR | (watermark & GYRO_F_STATUS_CNT)) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
+
+    if(gyro_write_reg(gyro, GYRO_REGISTER_CTRL_REG1, gyro->ctrl_reg1) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
+
+    gyro->fifo.enabled = 1;
+    gyro->fifo.watermark = watermark;
+    gyro->fifo.count = 0;
+    gyro->fifo.follow = 0;
+    gyro->fifo.held = 0;
+
+    return GYRO_SUCCESS;
+}
+
+gyro_err_t gyro_fifo_disable(gyro_t *gyro){
+    if(!gyro) {
+        return GYRO_NMALLOC;
+    }
+
+    if(gyro_write_reg(gyro, GYRO_REGISTER_CTRL_REG1, gyro->ctrl_reg1 & ~GYRO_CTRL_REG1_ACTIVE) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
+    if(gyro_write_reg(gyro, GYRO_REGISTER_F_SETUP, GYRO_F_MODE_DISABLED) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
+    if(gyro_write_reg(gyro, GYRO_REGISTER_CTRL_REG3, 0x00) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
+    if(gyro_write_reg(gyro, GYRO_REGISTER_CTRL_REG1, gyro->ctrl_reg1) != GYRO_SUCCESS)
+        return GYRO_BUS_FAIL;
+
+    gyro->fifo.enabled = 0;
+    gyro->fifo.count = 0;
+    gyro->fifo.held = 0;
+    gyro_fifo_links_destroy(gyro);
+
+    return GYRO_SUCCESS;
+}
+
+/*!
+* Draining the FIFO works as follows
+*   1. Frames held from an overflow drain are returned first, without a bus read
+*   2. Read F_STATUS to get the overflow flag and the queued sample count
+*   3. Burst read the queued frames starting at OUT_X_MSB in one transaction
+*      (WRAPTOONE keeps the address pointer inside the output registers). There
+*      is a prebuilt link for every burst length, so draining never allocates.
+*      After an overflow the re-arm flushes the FIFO, so every queued frame is read
+*      and those beyond max are held.
+*   4. Convert every frame returned and stamp every frame read. The newest sample is
+*      taken to have been produced at the read time, older ones one output period
+*      apart. When the FIFO ran continuously since the last drain, stamps continue
+*      from the previous newest sample instead, so the sequence stays evenly spaced.
+*      Either way the first stamp comes after the last one: a fast oscillator or a
+*      late read can put the read time estimate at or before it.
+*   5. On overflow, samples were dropped: re-arm the FIFO to clear the flag and
+*      restart the timestamp sequence from the read time.
+*/
+gyro_err_t gyro_read_batch(gyro_t *gyro, gyro_float_data_t *out, size_t max){
+    if(!gyro || !out) {
+        return GYRO_NMALLOC;
+    }
+    gyro_fifo_t *fifo = &gyro->fifo;
+    fifo->count = 0;
+    if(!fifo->enabled) {
+        return GYRO_BUS_FAIL;
+    }
+
+    /*! 1. Held frames */
+    if(fifo->held > 0) {
+        size_t n = fifo->held < max ? fifo->held : max;
+        if(n > 0) {
+            gyro_convert(gyro, fifo->data_rd + fifo->held_at * GYRO_FIFO_FRAME_SIZE, n, out);
+            memmove(fifo->stamp, fifo->stamp + fifo->held_at, n * sizeof(fifo->stamp[0]));
+            gyro->converted = out[n - 1];
+            fifo->held -= n;
+            fifo->held_at += n;
+            fifo->count = n;
+        }
+        return GYRO_SUCCESS;
+    }
+
+    /*! 2. Status */
+    i2c_err_t ret;
+    PERF_BEGIN(start);
+    ret = i2c_utils_link_exec(fifo->status_link);
+    if(ret != I2C_SUCCESS)
+        return GYRO_BUS_FAIL;
+    uint64_t now = get_time_micros();
+
+    uint8_t f_status = fifo->f_status;
+    size_t queued = f_status & GYRO_F_STATUS_CNT;
+    /* The count field is 6 bits wide; more than the FIFO holds is a corrupt read */
+    if(queued > GYRO_FIFO_SIZE)
+        queued = GYRO_FIFO_SIZE;
+    size_t n = queued < max ? queued : max;
+    uint8_t overflow = (f_status & GYRO_F_STATUS_OVF) != 0;
+    size_t burst = overflow ? queued : n;
+
+    /*! 3. and 4. Frames */
+    if(burst > 0) {
+        ret = i2c_utils_link_exec(fifo->burst_link[burst - 1]);
+        if(ret != I2C_SUCCESS)
+            return GYRO_BUS_FAIL;
+        if(n > 0) {
+            gyro_convert(gyro, fifo->data_rd, n, out);
+            gyro->converted = out[n - 1];
+        }
+
+        /* Samples left behind in the FIFO are newer than the ones drained */
+        uint64_t newest = now - (uint64_t)(queued - burst) * gyro->period_us;
+        uint64_t first = newest - (uint64_t)(burst - 1) * gyro->period_us;
+        if(!overflow && fifo->follow) {
+            uint64_t next = fifo->last_stamp + gyro->period_us;
+            /* Only follow on while the continuation does not run past the clock */
+            if(first >= next) {
+                first = next;
+            }
+        }
+        if(fifo->last_stamp != 0 && first <= fifo->last_stamp) {
+            first = fifo->last_stamp + 1;
+        }
+        for(size_t i = 0; i < burst; i++) {
+            fifo->stamp[i] = first + (uint64_t)i * gyro->period_us;
+        }
+        fifo->last_stamp = fifo->stamp[burst - 1];
+        fifo->follow = 1;
+        fifo->held = burst - n;
+        fifo->held_at = n;
+        fifo->count = n;
+    }
+    PERF_END(PERF_GYRO_READ, start);
+
+    /*! 5. Overflow */
+    if(overflow) {
+        /* Re-arm the FIFO to clear the overflow flag */
+        fifo->overflows++;
+        PERF_COUNT(PERF_GYRO_OVERFLOWS, 1);
+        size_t held = fifo->held;
+        if(gyro_fifo_enable(gyro, fifo->watermark) != GYRO_SUCCESS)
+            return GYRO_BUS_FAIL;
+        fifo->held = held;
+        fifo->count = n;
+        return GYRO_FIFO_OVF;
+    }
+
+    return GYRO_SUCCESS;
+}
+
+/*!
+* Convert n big endian X/Y/Z frames in one kernel pass (conv.h) into rad/s less the
+* bias, leaving the last frame's counts in gyro->raw; in fixed point builds through
+* Q16, so the float is the exact fixed point value
+*/
+static void gyro_convert(gyro_t *gyro, const uint8_t *frames, size_t n, gyro_float_data_t *out){
+    gyro_fifo_t *fifo = &gyro->fifo;
+    int16_t *const raw[3] = {fifo->soa_raw[0], fifo->soa_raw[1], fifo->soa_raw[2]};
+
+#if OTIS_FIXED_POINT
+    q16_t *const rate[3] = {fifo->soa.q[0], fifo->soa.q[1], fifo->soa.q[2]};
+    conv_fixed(&gyro->conv, frames, GYRO_FIFO_FRAME_SIZE, n, raw, rate);
+    for(size_t k = 0; k < n; k++){
+        out[k].x = q16_to_float(rate[0][k]);
+        out[k].y = q16_to_float(rate[1][k]);
+        out[k].z = q16_to_float(rate[2][k]);
+    }
+#else
+    float *const rate[3] = {fifo->soa.f[0], fifo->soa.f[1], fifo->soa.f[2]};
+    conv_float(&gyro->conv, frames, GYRO_FIFO_FRAME_SIZE, n, raw, rate);
+    for(size_t k = 0; k < n; k++){
+        out[k].x = rate[0][k];
+        out[k].y = rate[1][k];
+        out[k].z = rate[2][k];
+    }
+#endif
+
+    gyro->raw.x = raw[0][n - 1];
+    gyro->raw.y = raw[1][n - 1];
+    gyro->raw.z = raw[2][n - 1];
+}
+
+static gyro_err_t gyro_write_reg(gyro_t *gyro, uint8_t reg, uint8_t value){
+    uint8_t data_wr[2] = {reg, value};
+    if(i2c_utils_write(gyro->i2c, data_wr, 2) != I2C_SUCCESS)
+        return GYRO_BUS_FAIL;
+    return GYRO_SUCCESS;
+}
+
+/*!
+* Build the FIFO links: the F_STATUS read and a burst read of every length from one
+* frame to a full FIFO. They do not depend on the watermark, so they are built when
+* the FIFO is first enabled and kept until it is disabled.
+*/
+static gyro_err_t gyro_fifo_links(gyro_t *gyro){
+    if(gyro->fifo.status_link)
+        return GYRO_SUCCESS;
+
+    if(i2c_utils_link_read(gyro->i2c, GYRO_REGISTER_F_STATUS, &gyro->fifo.f_status, 1, &gyro->fifo.status_link) != I2C_SUCCESS)
+        return GYRO_NMALLOC;
+    for(size_t k = 0; k < GYRO_FIFO_SIZE; k++){
+        if(i2c_utils_link_read(gyro->i2c, GYRO_REGISTER_OUT_X_MSB, gyro->fifo.data_rd, (k + 1) * GYRO_FIFO_FRAME_SIZE,
+                               &gyro->fifo.burst_link[k]) != I2C_SUCCESS) {
+            gyro_fifo_links_destroy(gyro);
+            return GYRO_NMALLOC;
+        }
+    }
+    return GYRO_SUCCESS;
+}
+
+static void gyro_fifo_links_destroy(gyro_t *gyro){
+    i2c_utils_link_destroy(&gyro->fifo.status_link);
+    for(size_t k = 0; k < GYRO_FIFO_SIZE; k++)
+        i2c_utils_link_destroy(&gyro->fifo.burst_link[k]);
+}
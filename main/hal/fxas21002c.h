@@ -12,6 +12,9 @@
 
 #include <stdlib.h>
 #include "i2c_utils.h"
+#include "imu_cal.h"
+#include "fixed.h"
+#include "conv.h"
 
 /* 7-bit address for this sensor */
 #define FXAS21002C_ADDRESS       (0x21)       // 0100001
@@ -27,10 +30,20 @@
 #define GYRO_SENSITIVITY_2000DPS (0.0625F)
 /* Gyroscope Buffer Size */
 #define GYRO_BUFF_SIZE 8
+/* Bytes of a sample read: STATUS and the three axes */
+#define GYRO_SAMPLE_SIZE 7
+/* Depth of the on-chip sample FIFO */
+#define GYRO_FIFO_SIZE 32
+/* Bytes per FIFO sample (X, Y, Z MSB/LSB pairs) */
+#define GYRO_FIFO_FRAME_SIZE 6
+/* Default FIFO watermark (samples) */
+#define GYRO_FIFO_WATERMARK 8
 /* Conversion factor for sensor */
 #define SENSORS_DPS_TO_RADS (0.017453293F) /**< Degrees/s to rad/s multiplier */
 
-#define GYRO_RANGE 250
+/* Configuration applied by gyro_init */
+#define GYRO_RANGE GYRO_RANGE_250DPS
+#define GYRO_ODR GYRO_ODR_100HZ
 
 /*!
     Raw register addresses used to communicate with the sensor.
@@ -43,12 +56,36 @@ typedef enum {
     GYRO_REGISTER_OUT_Y_LSB           = 0x04, /**< 0x04 */
     GYRO_REGISTER_OUT_Z_MSB           = 0x05, /**< 0x05 */
     GYRO_REGISTER_OUT_Z_LSB           = 0x06, /**< 0x06 */
+    GYRO_REGISTER_DR_STATUS           = 0x07, /**< 0x07 */
+    GYRO_REGISTER_F_STATUS            = 0x08, /**< 0x08 (FIFO overflow, watermark and sample count) */
+    GYRO_REGISTER_F_SETUP             = 0x09, /**< 0x09 (FIFO mode and watermark, read/write) */
+    GYRO_REGISTER_F_EVENT             = 0x0A, /**< 0x0A */
+    GYRO_REGISTER_INT_SRC_FLAG        = 0x0B, /**< 0x0B */
     GYRO_REGISTER_WHO_AM_I            = 0x0C, /**< 0x0C (default value = 0b11010111, read only) */
     GYRO_REGISTER_CTRL_REG0           = 0x0D, /**< 0x0D (default value = 0b00000000, read/write) */
     GYRO_REGISTER_CTRL_REG1           = 0x13, /**< 0x13 (default value = 0b00000000, read/write) */
     GYRO_REGISTER_CTRL_REG2           = 0x14, /**< 0x14 (default value = 0b00000000, read/write) */
+    GYRO_REGISTER_CTRL_REG3           = 0x15, /**< 0x15 (default value = 0b00000000, read/write) */
 } gyro_registers_t;
 
+/*!
+    F_STATUS / F_SETUP bit fields
+*/
+#define GYRO_F_STATUS_OVF    (0x80)  /**< FIFO overflowed, oldest samples were lost */
+#define GYRO_F_STATUS_WMKF   (0x40)  /**< FIFO sample count reached the watermark */
+#define GYRO_F_STATUS_CNT    (0x3F)  /**< Number of samples queued in the FIFO */
+#define GYRO_F_MODE_DISABLED (0x00)  /**< FIFO disabled */
+#define GYRO_F_MODE_CIRCULAR (0x40)  /**< FIFO keeps the newest 32 samples */
+#define GYRO_F_MODE_STOP     (0x80)  /**< FIFO stops accepting samples once full */
+#define GYRO_CTRL_REG0_FS    (0x03)  /**< Full scale range field of CTRL_REG0 */
+#define GYRO_CTRL_REG1_ACTIVE (0x02) /**< Active mode bit of CTRL_REG1 */
+#define GYRO_CTRL_REG1_DR    (0x1C)  /**< Output data rate field of CTRL_REG1 */
+#define GYRO_CTRL_REG1_DR_SHIFT 2
+#define GYRO_CTRL_REG3_WRAPTOONE (0x08) /**< Burst reads wrap from OUT_Z_LSB to OUT_X_MSB */
+#define GYRO_CTRL_REG2_INT_CFG_DRDY (0x08) /**< Route data-ready to INT1 */
+#define GYRO_CTRL_REG2_INT_EN_DRDY  (0x04) /**< Enable the data-ready interrupt */
+#define GYRO_CTRL_REG2_IPOL         (0x02) /**< Active high interrupt polarity */
+
 /*!
     Enum to define valid gyroscope range values
 */
@@ -59,6 +96,27 @@ typedef enum {
     GYRO_RANGE_2000DPS = 2000     /**< 2000dps */
 } gyro_range_t;
 
+/*!
+    Output data rates, the CTRL_REG1 DR[2:0] values
+*/
+typedef enum {
+    GYRO_ODR_800HZ  = 0x0,        /**< 800Hz */
+    GYRO_ODR_400HZ  = 0x1,        /**< 400Hz */
+    GYRO_ODR_200HZ  = 0x2,        /**< 200Hz */
+    GYRO_ODR_100HZ  = 0x3,        /**< 100Hz */
+    GYRO_ODR_50HZ   = 0x4,        /**< 50Hz */
+    GYRO_ODR_25HZ   = 0x5,        /**< 25Hz */
+    GYRO_ODR_12_5HZ = 0x6         /**< 12.5Hz */
+} gyro_odr_t;
+
+/*!
+    Runtime configuration
+*/
+typedef struct gyro_config_s {
+    gyro_odr_t odr;       /**< Output data rate */
+    gyro_range_t range;   /**< Full scale range */
+} gyro_config_t;
+
 
 /*!
     Struct to store a single raw (integer-based) gyroscope vector
@@ -75,12 +133,53 @@ typedef struct gyro_float_data_s {
       float z;    /**< Raw int16_t value for the z axis */
 } gyro_float_data_t;
 
+typedef struct gyro_fixed_data_s {
+      q16_t x;    /**< rad/s, Q16 */
+      q16_t y;
+      q16_t z;
+} gyro_fixed_data_t;
+
+/*!
+    On-chip FIFO state. Samples drained by gyro_read_batch are stamped by counting
+    back from the read time in units of the output data period.
+*/
+typedef struct gyro_fifo_s {
+    uint8_t enabled;                                  /**< Non-zero when the FIFO is running */
+    uint8_t watermark;                                /**< Watermark programmed into F_SETUP */
+    size_t count;                                     /**< Samples returned by the last gyro_read_batch */
+    uint64_t stamp[GYRO_FIFO_SIZE];                   /**< Reconstructed timestamps (us) of those samples */
+    uint64_t last_stamp;                              /**< Timestamp of the newest sample drained so far, 0 for none */
+    uint8_t follow;                                   /**< The FIFO ran unbroken since the last drain */
+    size_t held;                                      /**< Frames read at an overflow beyond max, for the next drains */
+    size_t held_at;                                   /**< Index in data_rd and stamp of the first held frame */
+    uint32_t overflows;                               /**< Number of FIFO overflows recovered from */
+    uint8_t f_status;                                 /**< F_STATUS read buffer */
+    uint8_t data_rd[GYRO_FIFO_SIZE * GYRO_FIFO_FRAME_SIZE]; /**< Burst read buffer */
+    int16_t soa_raw[3][GYRO_FIFO_SIZE];               /**< Per axis counts of a converted burst */
+    union {
+        float f[3][GYRO_FIFO_SIZE];
+        q16_t q[3][GYRO_FIFO_SIZE];
+    } soa;                                            /**< Per axis rates of a converted burst */
+    i2c_link_t status_link;                           /**< Prebuilt F_STATUS read */
+    i2c_link_t burst_link[GYRO_FIFO_SIZE];            /**< Prebuilt burst reads, burst_link[k] of k + 1 frames */
+} gyro_fifo_t;
+
 typedef struct gyro_s {
     gyro_int_data_t raw;
     gyro_float_data_t converted;
     gyro_range_t range;
+    gyro_odr_t odr;
+    float scale;          /**< rad/s per count at the configured range */
+    float bias[3];        /**< rad/s subtracted from every sample, see gyro_set_bias */
+    conv_params_t conv;   /**< scale and bias, for the kernels */
+    uint8_t ctrl_reg0;
+    uint8_t ctrl_reg1;
+    uint32_t period_us;
     int32_t id;
     i2c_peripheral_t i2c;
+    uint8_t data_rd[GYRO_BUFF_SIZE];
+    i2c_link_t rd_link;
+    gyro_fifo_t fifo;
 } gyro_t;
 
 
@@ -89,6 +188,8 @@ typedef enum {
     GYRO_ID_FAIL = 0x1,   
     GYRO_BUS_FAIL = 0x2, 
     GYRO_NMALLOC = 0x3,
+    GYRO_FIFO_OVF = 0x4,
+    GYRO_INVALID = 0x6,
 } gyro_err_t;
 
 
@@ -96,6 +197,91 @@ gyro_err_t gyro_init(gyro_t **gyro);
 
 gyro_err_t gyro_update(gyro_t *gyro);
 
+/*!
+* @brief change the output data rate and full scale range
+* The part is put in standby for the writes and made active again, and the
+* conversion scale and sample period are updated. With the FIFO on, the samples
+* queued or held in it were measured at the old setting and are flushed in standby;
+* the next drain restarts the stamps from the read time.
+* @param gyro the gyroscope context
+* @param config the configuration
+* @returns gyro status, GYRO_INVALID for a rate or range the part does not have
+*/
+gyro_err_t gyro_configure(gyro_t *gyro, const gyro_config_t *config);
+
+/*!
+* @brief subtract a zero-rate bias from every sample converted from now on
+* gyro_init starts with the stored bias (imu_cal_load), if there is one.
+* @param gyro the gyroscope context
+* @param bias rad/s per axis, NULL for none
+* @returns gyro status
+*/
+gyro_err_t gyro_set_bias(gyro_t *gyro, const float *bias);
+
+/*!
+* @brief convert raw counts to rad/s less the bias in integer arithmetic
+* The conversion of every sample when OTIS_FIXED_POINT is 1, see fixed.h.
+* @param gyro the gyroscope context, for its scale and bias
+* @param raw the counts
+* @param out the rate, Q16
+*/
+void gyro_convert_fixed(const gyro_t *gyro, const gyro_int_data_t *raw, gyro_fixed_data_t *out);
+
+/*!
+* @brief describe the sample read, for a batch with other devices' reads
+* (i2c_utils_link_batch); once the batch has run, pass its result to gyro_complete
+* @param gyro the gyroscope context
+* @param op the read, into the driver's buffer
+* @returns gyro status
+*/
+gyro_err_t gyro_sample_op(gyro_t *gyro, i2c_op_t *op);
+
+/*!
+* @brief convert a sample read made through gyro_sample_op
+* @param gyro the gyroscope context
+* @param result the result of the transaction that carried the read
+* @returns gyro status, GYRO_BUS_FAIL for a failed read
+*/
+gyro_err_t gyro_complete(gyro_t *gyro, i2c_err_t result);
+
+/*!
+* @brief route the data-ready interrupt to INT1 (push-pull, active high)
+* A rising edge on INT1 then announces every new sample.
+* @param gyro the gyroscope context
+* @returns gyro status
+*/
+gyro_err_t gyro_drdy_enable(gyro_t *gyro);
+
+/*!
+* @brief enable the on-chip FIFO in circular mode
+* @param gyro the gyroscope context
+* @param watermark number of samples (1-32) that raises the watermark flag
+* @returns gyro status
+*/
+gyro_err_t gyro_fifo_enable(gyro_t *gyro, uint8_t watermark);
+
+/*!
+* @brief disable the on-chip FIFO and return to single sample reads
+* @param gyro the gyroscope context
+* @returns gyro status
+*/
+gyro_err_t gyro_fifo_disable(gyro_t *gyro);
+
+/*!
+* @brief drain up to max queued FIFO samples in one burst read
+* Counts above GYRO_FIFO_SIZE are clamped, so out never needs more than that.
+* The number of samples written to out is left in gyro->fifo.count, with the
+* reconstructed timestamp of out[i] in gyro->fifo.stamp[i]. The newest sample is
+* also copied into gyro->raw/gyro->converted. Stamps only increase, across drains
+* and overflows. At an overflow the FIFO is read whole before it is re-armed; frames
+* beyond max are held and returned by the next calls, without a bus read.
+* @param gyro the gyroscope context
+* @param out converted samples, oldest first
+* @param max capacity of out
+* @returns gyro status, GYRO_FIFO_OVF if samples were lost since the last drain
+*/
+gyro_err_t gyro_read_batch(gyro_t *gyro, gyro_float_data_t *out, size_t max);
+
 gyro_err_t gyro_destroy(gyro_t **gyro);
 
 
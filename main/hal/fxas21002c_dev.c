@@ -0,0 +1,216 @@
+/*!
+* @file fxas21002c_dev.c
+* @author Ethan Lew
+* @brief FXAS21002C adapter of the imu_dev interface (gyroscope)
+*/
+
+#include <string.h>
+#include "imu_dev.h"
+#include "time_utils.h"
+
+/* Self test: data must be ready within this many output periods */
+#define FXAS_SELF_TEST_PERIODS 3
+#define FXAS_DR_ZYXDR (0x08)
+
+typedef struct fxas21002c_dev_s {
+    gyro_t *gyro;
+    gyro_float_data_t batch[GYRO_FIFO_SIZE];   /**< FIFO drain buffer */
+} fxas21002c_dev_t;
+
+const imu_dev_ops_t fxas21002c_dev_ops = {
+    "fxas21002c",
+    fxas21002c_dev_init,
+    fxas21002c_dev_configure,
+    fxas21002c_dev_read_batch,
+    fxas21002c_dev_self_test,
+    fxas21002c_dev_calibrate,
+    fxas21002c_dev_destroy,
+    fxas21002c_dev_sample_op,
+    fxas21002c_dev_sample_done,
+};
+
+static imu_dev_err_t fxas21002c_dev_err(gyro_err_t err);
+
+static void fxas21002c_dev_sample(imu_dev_t *dev, imu_sample_t *out, uint64_t stamp, const gyro_float_data_t *rate);
+
+imu_dev_err_t fxas21002c_dev_init(imu_dev_t *dev){
+    fxas21002c_dev_t *ctx = (fxas21002c_dev_t*)malloc(sizeof(fxas21002c_dev_t));
+    if(!ctx)
+        return IMU_DEV_NMALLOC;
+
+    dev->ops = &fxas21002c_dev_ops;
+    dev->drv = ctx;
+    dev->sensors = IMU_DEV_GYRO;
+    dev->config = (imu_dev_config_t){IMU_DEV_GYRO, 0, 0};
+    ctx->gyro = NULL;
+
+    gyro_err_t ret = gyro_init(&ctx->gyro);
+    if(ret != GYRO_SUCCESS){
+        fxas21002c_dev_destroy(dev);
+        return fxas21002c_dev_err(ret);
+    }
+    return IMU_DEV_SUCCESS;
+}
+
+/*!
+* Only the changes from the configuration in effect are written
+*   1. The gyroscope cannot be turned off on its own
+*   2. FIFO on, off or to a new watermark
+*   3. Data-ready routing, which the driver can only turn on
+*/
+imu_dev_err_t fxas21002c_dev_configure(imu_dev_t *dev, const imu_dev_config_t *config){
+    fxas21002c_dev_t *ctx = (fxas21002c_dev_t*)dev->drv;
+    gyro_err_t ret = GYRO_SUCCESS;
+
+    if(config->sensors != IMU_DEV_GYRO)
+        return IMU_DEV_UNSUPPORTED;
+    if(dev->config.drdy && !config->drdy)
+        return IMU_DEV_UNSUPPORTED;
+
+    if(config->fifo_watermark != dev->config.fifo_watermark){
+        if(config->fifo_watermark == 0){
+            ret = gyro_fifo_disable(ctx->gyro);
+        } else {
+            ret = gyro_fifo_enable(ctx->gyro, config->fifo_watermark);
+        }
+        if(ret != GYRO_SUCCESS)
+            return fxas21002c_dev_err(ret);
+        dev->config.fifo_watermark = ctx->gyro->fifo.enabled ? ctx->gyro->fifo.watermark : 0;
+    }
+    if(config->drdy && !dev->config.drdy){
+        ret = gyro_drdy_enable(ctx->gyro);
+        if(ret != GYRO_SUCCESS)
+            return fxas21002c_dev_err(ret);
+        dev->config.drdy = 1;
+    }
+    return IMU_DEV_SUCCESS;
+}
+
+/*!
+* FIFO mode drains the queued samples with their reconstructed stamps; otherwise one
+* sample is read and stamped now. Raw counts are kept for single sample reads.
+*/
+imu_dev_err_t fxas21002c_dev_read_batch(imu_dev_t *dev, imu_sample_t *out, size_t max, size_t *count){
+    fxas21002c_dev_t *ctx = (fxas21002c_dev_t*)dev->drv;
+    gyro_t *gyro = ctx->gyro;
+    gyro_err_t ret;
+
+    *count = 0;
+    if(max == 0)
+        return IMU_DEV_SUCCESS;
+
+    if(!gyro->fifo.enabled){
+        ret = gyro_update(gyro);
+        if(ret != GYRO_SUCCESS)
+            return fxas21002c_dev_err(ret);
+        fxas21002c_dev_sample(dev, out, get_time_micros(), &gyro->converted);
+        out->gyro_raw = gyro->raw;
+        *count = 1;
+        return IMU_DEV_SUCCESS;
+    }
+
+    ret = gyro_read_batch(gyro, ctx->batch, max < GYRO_FIFO_SIZE ? max : GYRO_FIFO_SIZE);
+    if(ret != GYRO_SUCCESS && ret != GYRO_FIFO_OVF)
+        return fxas21002c_dev_err(ret);
+    for(size_t i = 0; i < gyro->fifo.count; i++)
+        fxas21002c_dev_sample(dev, &out[i], gyro->fifo.stamp[i], &ctx->batch[i]);
+    *count = gyro->fifo.count;
+    return ret == GYRO_FIFO_OVF ? IMU_DEV_OVERFLOW : IMU_DEV_SUCCESS;
+}
+
+/*!
+* Self test
+*   1. WHO_AM_I must match
+*   2. In single sample mode, read the pending sample so the data-ready flag clears,
+*      then a new one must be flagged within FXAS_SELF_TEST_PERIODS output periods;
+*      in FIFO mode samples must queue within the same time
+*   3. The sample read must not sit at full scale
+*/
+imu_dev_err_t fxas21002c_dev_self_test(imu_dev_t *dev){
+    fxas21002c_dev_t *ctx = (fxas21002c_dev_t*)dev->drv;
+    gyro_t *gyro = ctx->gyro;
+    uint8_t value;
+
+    if(i2c_utils_read(gyro->i2c, GYRO_REGISTER_WHO_AM_I, &value, 1) != I2C_SUCCESS)
+        return IMU_DEV_BUS_FAIL;
+    if(value != FXAS21002C_ID)
+        return IMU_DEV_ID_FAIL;
+
+    uint8_t reg = gyro->fifo.enabled ? GYRO_REGISTER_F_STATUS : GYRO_REGISTER_DR_STATUS;
+    uint8_t mask = gyro->fifo.enabled ? GYRO_F_STATUS_CNT : FXAS_DR_ZYXDR;
+    if(!gyro->fifo.enabled && gyro_update(gyro) != GYRO_SUCCESS)
+        return IMU_DEV_BUS_FAIL;
+
+    uint64_t start = get_time_micros();
+    uint64_t timeout = (uint64_t)FXAS_SELF_TEST_PERIODS * gyro->period_us;
+    do {
+        if(i2c_utils_read(gyro->i2c, reg, &value, 1) != I2C_SUCCESS)
+            return IMU_DEV_BUS_FAIL;
+        if(value & mask)
+            break;
+    } while(get_time_micros() - start < timeout);
+    if(!(value & mask))
+        return IMU_DEV_SELF_TEST_FAIL;
+
+    if(!gyro->fifo.enabled){
+        if(gyro_update(gyro) != GYRO_SUCCESS)
+            return IMU_DEV_BUS_FAIL;
+        if(abs(gyro->raw.x) >= INT16_MAX || abs(gyro->raw.y) >= INT16_MAX || abs(gyro->raw.z) >= INT16_MAX)
+            return IMU_DEV_SELF_TEST_FAIL;
+    }
+    return IMU_DEV_SUCCESS;
+}
+
+imu_dev_err_t fxas21002c_dev_calibrate(imu_dev_t *dev, const imu_cal_t *cal){
+    fxas21002c_dev_t *ctx = (fxas21002c_dev_t*)dev->drv;
+    return fxas21002c_dev_err(gyro_set_bias(ctx->gyro, (cal->flags & IMU_CAL_GYRO) ? cal->gyro_bias : NULL));
+}
+
+/*!
+* Single sample reads only: the FIFO is drained by read_batch
+*/
+imu_dev_err_t fxas21002c_dev_sample_op(imu_dev_t *dev, i2c_op_t *op){
+    fxas21002c_dev_t *ctx = (fxas21002c_dev_t*)dev->drv;
+    if(ctx->gyro->fifo.enabled)
+        return IMU_DEV_UNSUPPORTED;
+    return fxas21002c_dev_err(gyro_sample_op(ctx->gyro, op));
+}
+
+imu_dev_err_t fxas21002c_dev_sample_done(imu_dev_t *dev, i2c_err_t result, imu_sample_t *out){
+    fxas21002c_dev_t *ctx = (fxas21002c_dev_t*)dev->drv;
+    gyro_t *gyro = ctx->gyro;
+    gyro_err_t ret = gyro_complete(gyro, result);
+    if(ret != GYRO_SUCCESS)
+        return fxas21002c_dev_err(ret);
+    fxas21002c_dev_sample(dev, out, get_time_micros(), &gyro->converted);
+    out->gyro_raw = gyro->raw;
+    return IMU_DEV_SUCCESS;
+}
+
+void fxas21002c_dev_destroy(imu_dev_t *dev){
+    fxas21002c_dev_t *ctx = (fxas21002c_dev_t*)dev->drv;
+    if(ctx){
+        if(ctx->gyro)
+            gyro_destroy(&ctx->gyro);
+        free(ctx);
+    }
+    dev->drv = NULL;
+}
+
+static void fxas21002c_dev_sample(imu_dev_t *dev, imu_sample_t *out, uint64_t stamp, const gyro_float_data_t *rate){
+    memset(out, 0, sizeof(imu_sample_t));
+    out->stamp = stamp;
+    out->seq = dev->seq++;
+    out->gyro = *rate;
+    out->status = IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_GYRO_FRESH;
+}
+
+static imu_dev_err_t fxas21002c_dev_err(gyro_err_t err){
+    switch(err){
+        case GYRO_SUCCESS: return IMU_DEV_SUCCESS;
+        case GYRO_ID_FAIL: return IMU_DEV_ID_FAIL;
+        case GYRO_NMALLOC: return IMU_DEV_NMALLOC;
+        case GYRO_FIFO_OVF: return IMU_DEV_OVERFLOW;
+        default: return IMU_DEV_BUS_FAIL;
+    }
+}
@@ -1,60 +1,103 @@
 #include "fxos8700.h"
-
-/** Macro for mg per LSB at +/- 2g sensitivity (1 LSB = 0.000244mg) */
-#define ACCEL_MG_LSB_2G (0.000244F)
-/** Macro for mg per LSB at +/- 4g sensitivity (1 LSB = 0.000488mg) */
-#define ACCEL_MG_LSB_4G (0.000488F)
-/** Macro for mg per LSB at +/- 8g sensitivity (1 LSB = 0.000976mg) */
-#define ACCEL_MG_LSB_8G (0.000976F)
-/** Macro for micro tesla (uT) per LSB (1 LSB = 0.1uT) */
-#define MAG_UT_LSB (0.1F)
-/** Resample threshold */
-#define FXOS_US_THRESHOLD 2000
-
-/* Static ("singleton") device context */
-static fxos8700_t* fxos8700; 
-/* Resample trigger mechanism */
-static timer_hal_t* fxos_timer;
-/* How many sensors are programmer accessible */
-static uint8_t fxos_reference_count = 0;
+#include "imu_cal.h"
+#include "perf.h"
+
+#include <string.h>
+#ifdef OTIS_HOST
+#include <pthread.h>
+#include <sched.h>
+#else
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+/* Output data period in microseconds of one sensor, indexed by CTRL_REG1 DR[2:0] */
+static const uint32_t fxos_period_us[8] = {
+    1250, 2500, 5000, 10000, 20000, 80000, 160000, 640000
+};
+
+/* Open devices, keyed by port and address; each is shared by its accel and magn views */
+static fxos8700_t* fxos_devices[FXOS8700_MAX_DEVICES];
+
+#ifdef OTIS_HOST
+static pthread_mutex_t fxos_lock = PTHREAD_MUTEX_INITIALIZER;
+#define FXOS_LOCK()   pthread_mutex_lock(&fxos_lock)
+#define FXOS_UNLOCK() pthread_mutex_unlock(&fxos_lock)
+#define FXOS_YIELD()  sched_yield()
+#else
+static portMUX_TYPE fxos_mux = portMUX_INITIALIZER_UNLOCKED;
+#define FXOS_LOCK()   portENTER_CRITICAL(&fxos_mux)
+#define FXOS_UNLOCK() portEXIT_CRITICAL(&fxos_mux)
+#define FXOS_YIELD()  vTaskDelay(1)
+#endif
+
+static fxos8700_t *fxos8700_acquire(uint8_t port, uint8_t addr, fxos8700_err_t *err);
+
+static void fxos8700_release(fxos8700_t *fxos);
+
+static fxos8700_t *fxos8700_find(uint8_t port, uint8_t addr);
 
 static fxos8700_err_t fxos8700_init(fxos8700_t *fxos);
 
+static fxos8700_err_t fxos8700_configure(fxos8700_t *fxos, const fxos8700_config_t *config);
+
+static uint8_t fxos8700_mctrl_reg1(uint8_t magn_osr, fxos8700_mode_t mode);
+
+static uint32_t fxos8700_period_us(const fxos8700_t *fxos);
+
 static fxos8700_err_t fxos8700_update(fxos8700_t *fxos);
 
+static fxos8700_err_t fxos8700_complete(fxos8700_t *fxos, i2c_err_t result);
+
 static fxos8700_err_t fxos8700_destroy(fxos8700_t **fxos);
 
+static fxos8700_err_t fxos8700_write_reg(fxos8700_t *fxos, uint8_t reg, uint8_t value);
+
+static void fxos8700_convert(fxos8700_t *fxos);
+
+static void fxos8700_epoch(fxos8700_t *fxos);
+
+static void accel_copy(accel_t *accel, fxos8700_t *fxos);
+
+static void magn_copy(magn_t *magn, fxos8700_t *fxos);
+
+static void fxos8700_accel_cal(fxos8700_t *fxos, const fxos8700_accel_cal_t *cal);
+
+static void fxos8700_accel_fixed(const fxos8700_t *fxos, const raw_int_data_t *raw, raw_fixed_data_t *out);
+
 accel_err_t accel_init(accel_t **accel){
-    if(accel != NULL){
-        *accel = (accel_t*)malloc(sizeof(accel_t));
+    return accel_init_at(accel, I2C_MASTER_PORT, FXOS8700_ADDRESS);
+}
+
+accel_err_t accel_init_at(accel_t **accel, uint8_t port, uint8_t addr){
+    if(!accel){
+        return ACCEL_NMALLOC;
+    }
+    *accel = (accel_t*)malloc(sizeof(accel_t));
+    if(!*accel){
+        return ACCEL_NMALLOC;
     }
 
-    /* If the static type hasn't been created, construct it*/
+    /* Share the device with the other views of it, constructing it on first use */
     fxos8700_err_t ret;
-    if(fxos8700){
-        ret = 0;
-    } else {
-        /* Startup sampling timer */
-        fxos_timer = (timer_hal_t*)malloc(sizeof(timer_hal_t));
-        start_hal_timer(fxos_timer);
-        /* Create sensor context and update reference count */
-        fxos8700 = (fxos8700_t*)malloc(sizeof(fxos8700_t));
-        ret = fxos8700_init(fxos8700);
-        fxos_reference_count++;
+    fxos8700_t *fxos = fxos8700_acquire(port, addr, &ret);
+    if(!fxos){
+        free(*accel);
+        *accel = NULL;
+        return ret == FXOS8700_ID_FAIL ? ACCEL_ID_FAIL : (ret == FXOS8700_NMALLOC ? ACCEL_NMALLOC : ACCEL_BUS_FAIL);
     }
 
-    /* If error, return */
-    if(ret != 0)
-        return ret; 
-
     /*  Default out the values */
-    (*accel)->fxos = fxos8700;
+    (*accel)->fxos = fxos;
     (*accel)->raw.x = 0;
     (*accel)->raw.y = 0;
     (*accel)->raw.z = 0; 
     (*accel)->converted.x = 0;
     (*accel)->converted.y = 0;
     (*accel)->converted.z = 0;
+    (*accel)->seq = fxos->epoch;
+    (*accel)->read_seq = fxos->read_seq;
+    (*accel)->missed = 0;
 
     return ACCEL_SUCCESS;
 }
@@ -63,36 +106,25 @@ accel_err_t accel_update(accel_t *accel){
     if(!accel){
         return ACCEL_NMALLOC;
     }
-    /* Update the timer diff */
-    update_hal_timer(fxos_timer);
-    fxos8700_err_t ret;
-    /* If diff time great anough, resample the data */
-    if(fxos_timer->diff > FXOS_US_THRESHOLD) {
-        /* Reset timer ewent -- exceed sample threshold */
-        reset_hal_timer(fxos_timer);
-        ret =  fxos8700_update(fxos8700);
+    fxos8700_t *fxos = accel->fxos;
+    /* Read only once this view has the last read, else share the other view's */
+    if(accel->read_seq == fxos->read_seq) {
+        if(fxos8700_update(fxos) != FXOS8700_SUCCESS)
+            return ACCEL_BUS_FAIL;
     } else {
-        ret =  ACCEL_SUCCESS;
+        fxos->stats.coalesced++;
     }
 
     /* Update in structure */
-    accel->raw.x = fxos8700->a_raw.x;
-    accel->raw.y = fxos8700->a_raw.y;
-    accel->raw.z = fxos8700->a_raw.z;
-    accel->converted.x = fxos8700->a_converted.x;
-    accel->converted.y = fxos8700->a_converted.y;
-    accel->converted.z = fxos8700->a_converted.z;
+    accel_copy(accel, fxos);
 
-    return ret;
+    return ACCEL_SUCCESS;
 }
 
 accel_err_t accel_destroy(accel_t **accel){
-    if(accel){
+    if(accel && *accel){
         /* Destroy entire device if no longer avilable to the programmer */
-        fxos_reference_count--;
-        if(fxos_reference_count == 0) {
-            fxos8700_destroy(&((*accel)->fxos));
-        }
+        fxos8700_release((*accel)->fxos);
         free(*accel);
         *accel = NULL;
         return ACCEL_SUCCESS;
@@ -101,32 +133,161 @@ accel_err_t accel_destroy(accel_t **accel){
     }
 }
 
+/*!
+* The FXOS8700 signals data-ready as follows
+*   1. Standby (interrupt registers are only written out of active mode)
+*   2. CTRL_REG3: push-pull, active high
+*   3. CTRL_REG4: enable the data-ready interrupt
+*   4. CTRL_REG5: route it to INT1
+*   5. Restore CTRL_REG1
+*/
+accel_err_t accel_drdy_enable(accel_t *accel){
+    if(!accel || !accel->fxos){
+        return ACCEL_NMALLOC;
+    }
+    fxos8700_t *fxos = accel->fxos;
+
+    if(fxos8700_write_reg(fxos, FXOS8700_REGISTER_CTRL_REG1, fxos->ctrl_reg1 & ~FXOS8700_CTRL_REG1_ACTIVE) != FXOS8700_SUCCESS)
+        return ACCEL_BUS_FAIL;
+    if(fxos8700_write_reg(fxos, FXOS8700_REGISTER_CTRL_REG3, FXOS8700_CTRL_REG3_IPOL) != FXOS8700_SUCCESS)
+        return ACCEL_BUS_FAIL;
+    if(fxos8700_write_reg(fxos, FXOS8700_REGISTER_CTRL_REG4, FXOS8700_CTRL_REG4_INT_EN_DRDY) != FXOS8700_SUCCESS)
+        return ACCEL_BUS_FAIL;
+    if(fxos8700_write_reg(fxos, FXOS8700_REGISTER_CTRL_REG5, FXOS8700_CTRL_REG5_INT_CFG_DRDY) != FXOS8700_SUCCESS)
+        return ACCEL_BUS_FAIL;
+    if(fxos8700_write_reg(fxos, FXOS8700_REGISTER_CTRL_REG1, fxos->ctrl_reg1) != FXOS8700_SUCCESS)
+        return ACCEL_BUS_FAIL;
+
+    return ACCEL_SUCCESS;
+}
+
+/*!
+* Mode change
+*   1. Standby
+*   2. M_CTRL_REG1: magnetometer on or off, same oversampling
+*   3. Restore CTRL_REG1
+*   4. Point the queued read at the matching prebuilt link
+*/
+accel_err_t accel_set_mode(accel_t *accel, fxos8700_mode_t mode){
+    if(!accel || !accel->fxos){
+        return ACCEL_NMALLOC;
+    }
+    fxos8700_t *fxos = accel->fxos;
+    uint8_t mctrl = fxos8700_mctrl_reg1(fxos->magn_osr, mode);
+
+    if(fxos8700_write_reg(fxos, FXOS8700_REGISTER_CTRL_REG1, fxos->ctrl_reg1 & ~FXOS8700_CTRL_REG1_ACTIVE) != FXOS8700_SUCCESS)
+        return ACCEL_BUS_FAIL;
+    if(fxos8700_write_reg(fxos, FXOS8700_REGISTER_MCTRL_REG1, mctrl) != FXOS8700_SUCCESS)
+        return ACCEL_BUS_FAIL;
+    if(fxos8700_write_reg(fxos, FXOS8700_REGISTER_CTRL_REG1, fxos->ctrl_reg1) != FXOS8700_SUCCESS)
+        return ACCEL_BUS_FAIL;
+
+    fxos->mode = mode;
+    fxos->period_us = fxos8700_period_us(fxos);
+
+    return ACCEL_SUCCESS;
+}
+
+accel_err_t accel_set_calibration(accel_t *accel, const fxos8700_accel_cal_t *cal){
+    if(!accel || !accel->fxos){
+        return ACCEL_NMALLOC;
+    }
+    fxos8700_accel_cal(accel->fxos, cal);
+    return ACCEL_SUCCESS;
+}
+
+void accel_convert_fixed(const accel_t *accel, const raw_int_data_t *raw, raw_fixed_data_t *out){
+    fxos8700_accel_fixed(accel->fxos, raw, out);
+}
+
+accel_err_t accel_configure(accel_t *accel, const fxos8700_config_t *config){
+    if(!accel || !accel->fxos || !config){
+        return ACCEL_NMALLOC;
+    }
+    switch(fxos8700_configure(accel->fxos, config)){
+        case FXOS8700_SUCCESS:
+        return ACCEL_SUCCESS;
+        case FXOS8700_INVALID:
+        return ACCEL_INVALID;
+        default:
+        return ACCEL_BUS_FAIL;
+    }
+}
+
+accel_err_t accel_magn_update(accel_t *accel, magn_t *magn){
+    fxos8700_t *fxos = accel ? accel->fxos : (magn ? magn->fxos : NULL);
+    if(!fxos){
+        return ACCEL_NMALLOC;
+    }
+
+    if(fxos8700_update(fxos) != FXOS8700_SUCCESS)
+        return ACCEL_BUS_FAIL;
+
+    if(accel)
+        accel_copy(accel, fxos);
+    if(magn && fxos->mode == FXOS8700_MODE_HYBRID)
+        magn_copy(magn, fxos);
+
+    return ACCEL_SUCCESS;
+}
+
+accel_err_t accel_magn_sample_op(accel_t *accel, i2c_op_t *op){
+    if(!accel || !accel->fxos || !op){
+        return ACCEL_NMALLOC;
+    }
+    fxos8700_t *fxos = accel->fxos;
+    *op = (i2c_op_t){I2C_XFER_READ, fxos->i2c, FXOS8700_REGISTER_STATUS, fxos->data_rd,
+                     fxos->mode == FXOS8700_MODE_ACCEL_ONLY ? FXOS_ACCEL_READ_SIZE : FXOS_BUFF_SIZE};
+    return ACCEL_SUCCESS;
+}
+
+accel_err_t accel_magn_complete(accel_t *accel, magn_t *magn, i2c_err_t result){
+    fxos8700_t *fxos = accel ? accel->fxos : (magn ? magn->fxos : NULL);
+    if(!fxos){
+        return ACCEL_NMALLOC;
+    }
+    if(fxos8700_complete(fxos, result) != FXOS8700_SUCCESS)
+        return ACCEL_BUS_FAIL;
+
+    if(accel)
+        accel_copy(accel, fxos);
+    if(magn && fxos->mode == FXOS8700_MODE_HYBRID)
+        magn_copy(magn, fxos);
+
+    return ACCEL_SUCCESS;
+}
+
 magn_err_t magn_init(magn_t **magn){
-    if (magn != NULL){
-        *magn = (magn_t*)malloc(sizeof(magn_t));
+    return magn_init_at(magn, I2C_MASTER_PORT, FXOS8700_ADDRESS);
+}
+
+magn_err_t magn_init_at(magn_t **magn, uint8_t port, uint8_t addr){
+    if(!magn){
+        return MAGN_NMALLOC;
     }
-    /* If the static type hasn't been created, construct it*/
-    fxos8700_err_t ret;
-    if(fxos8700){
-        ret = 0;
-    } else {
-        fxos_timer = (timer_hal_t*)malloc(sizeof(timer_hal_t));
-        start_hal_timer(fxos_timer);
-        fxos8700 = (fxos8700_t*)malloc(sizeof(fxos8700_t));
-        ret = fxos8700_init(fxos8700);
-        fxos_reference_count++;
+    *magn = (magn_t*)malloc(sizeof(magn_t));
+    if(!*magn){
+        return MAGN_NMALLOC;
     }
 
-    if(ret != 0)
-        return ret; 
+    fxos8700_err_t ret;
+    fxos8700_t *fxos = fxos8700_acquire(port, addr, &ret);
+    if(!fxos){
+        free(*magn);
+        *magn = NULL;
+        return ret == FXOS8700_ID_FAIL ? MAGN_ID_FAIL : (ret == FXOS8700_NMALLOC ? MAGN_NMALLOC : MAGN_BUS_FAIL);
+    }
 
-    (*magn)->fxos = fxos8700;
+    (*magn)->fxos = fxos;
     (*magn)->raw.x = 0;
     (*magn)->raw.y = 0;
     (*magn)->raw.z = 0; 
     (*magn)->converted.x = 0;
     (*magn)->converted.y = 0;
-    (*magn)->converted.z = 0; 
+    (*magn)->converted.z = 0;
+    (*magn)->seq = fxos->epoch;
+    (*magn)->read_seq = fxos->read_seq;
+    (*magn)->missed = 0; 
 
     return MAGN_SUCCESS;
 }
@@ -135,36 +296,53 @@ magn_err_t magn_update(magn_t *magn){
     if(!magn){
         return MAGN_NMALLOC;
     }
-    /* Update the timer diff */
-    update_hal_timer(fxos_timer);
-    fxos8700_err_t ret;
-    /* If diff time great anough, resample the data */
-    if(fxos_timer->diff > FXOS_US_THRESHOLD) {
-        reset_hal_timer(fxos_timer);
-        ret =  fxos8700_update(fxos8700);
+    if(magn->fxos->mode != FXOS8700_MODE_HYBRID){
+        return MAGN_DISABLED;
+    }
+    fxos8700_t *fxos = magn->fxos;
+    /* Read only once this view has the last read, else share the other view's */
+    if(magn->read_seq == fxos->read_seq) {
+        if(fxos8700_update(fxos) != FXOS8700_SUCCESS)
+            return MAGN_BUS_FAIL;
     } else {
-        ret = MAGN_SUCCESS;
+        fxos->stats.coalesced++;
     }
 
      /* Update in structure */
-    magn->raw.x = fxos8700->m_raw.x;
-    magn->raw.y = fxos8700->m_raw.y;
-    magn->raw.z = fxos8700->m_raw.z;
+    magn_copy(magn, fxos);
 
-    magn->converted.x = fxos8700->m_converted.x;
-    magn->converted.y = fxos8700->m_converted.y;
-    magn->converted.z = fxos8700->m_converted.z;
+    return MAGN_SUCCESS;
+}
 
-    return ret;
+/*!
+* The correction is written into the slot not in use, then published, so a
+* conversion running meanwhile sees either the old or the new one whole
+*/
+magn_err_t magn_set_calibration(magn_t *magn, const fxos8700_magn_cal_t *cal){
+    if(!magn || !magn->fxos){
+        return MAGN_NMALLOC;
+    }
+    fxos8700_t *fxos = magn->fxos;
+    if(!cal){
+        __atomic_store_n(&fxos->magn_cal_active, NULL, __ATOMIC_RELEASE);
+        return MAGN_SUCCESS;
+    }
+    fxos8700_magn_cal_t *next = fxos->magn_cal_active == &fxos->magn_cal[0] ? &fxos->magn_cal[1] : &fxos->magn_cal[0];
+    *next = *cal;
+    __atomic_store_n(&fxos->magn_cal_active, next, __ATOMIC_RELEASE);
+    return MAGN_SUCCESS;
+}
+
+const fxos8700_magn_cal_t *magn_get_calibration(const magn_t *magn){
+    if(!magn || !magn->fxos)
+        return NULL;
+    return __atomic_load_n(&magn->fxos->magn_cal_active, __ATOMIC_ACQUIRE);
 }
 
 magn_err_t magn_destroy(magn_t **magn){
-    if(magn){
+    if(magn && *magn){
         /* Destroy entire device if no longer avilable to the programmer */
-        fxos_reference_count--;
-        if(fxos_reference_count == 0) {
-            fxos8700_destroy(&((*magn)->fxos));
-        }
+        fxos8700_release((*magn)->fxos);
         free(*magn);
         *magn = NULL;
         return MAGN_SUCCESS;
@@ -174,14 +352,131 @@ magn_err_t magn_destroy(magn_t **magn){
 }
 
 
+uint8_t fxos8700_open_devices(void){
+    uint8_t n = 0;
+    FXOS_LOCK();
+    for(int i = 0; i < FXOS8700_MAX_DEVICES; i++)
+        n += fxos_devices[i] != NULL;
+    FXOS_UNLOCK();
+    return n;
+}
+
+/*!
+* Take a reference on the device at port/addr
+*   1. An open device gains a view
+*   2. A device being set up by another caller is waited for
+*   3. Otherwise reserve a slot and set the device up, outside the lock since setup
+*      talks to the bus; it is only shared once ready, so the chip is never
+*      configured by two callers at once
+*/
+static fxos8700_t *fxos8700_acquire(uint8_t port, uint8_t addr, fxos8700_err_t *err){
+    fxos8700_t *created = (fxos8700_t*)malloc(sizeof(fxos8700_t));
+    if(!created){
+        *err = FXOS8700_NMALLOC;
+        return NULL;
+    }
+    memset(created, 0, sizeof(fxos8700_t));
+    created->i2c.port = port;
+    created->i2c.addr = addr;
+
+    for(;;){
+        uint8_t full = 0;
+        uint8_t shared = 0;
+        FXOS_LOCK();
+        fxos8700_t *fxos = fxos8700_find(port, addr);
+        if(fxos && fxos->ready){
+            fxos->refs++;
+            shared = 1;
+        } else if(!fxos){
+            full = 1;
+            for(int i = 0; i < FXOS8700_MAX_DEVICES; i++){
+                if(!fxos_devices[i]){
+                    fxos_devices[i] = created;
+                    created->refs = 1;
+                    full = 0;
+                    break;
+                }
+            }
+        }
+        FXOS_UNLOCK();
+
+        if(shared){
+            free(created);
+            *err = FXOS8700_SUCCESS;
+            return fxos;
+        }
+        if(full){
+            free(created);
+            *err = FXOS8700_NMALLOC;
+            return NULL;
+        }
+        if(!fxos)
+            break;
+        FXOS_YIELD();
+    }
+
+    *err = fxos8700_init(created);
+    if(*err != FXOS8700_SUCCESS){
+        FXOS_LOCK();
+        for(int i = 0; i < FXOS8700_MAX_DEVICES; i++){
+            if(fxos_devices[i] == created)
+                fxos_devices[i] = NULL;
+        }
+        FXOS_UNLOCK();
+        fxos8700_destroy(&created);
+        return NULL;
+    }
+    FXOS_LOCK();
+    created->ready = 1;
+    FXOS_UNLOCK();
+    return created;
+}
+
+/*!
+* Drop a view; the last one out destroys the device
+*/
+static void fxos8700_release(fxos8700_t *fxos){
+    if(!fxos)
+        return;
+    uint8_t last = 0;
+    FXOS_LOCK();
+    if(--fxos->refs == 0){
+        last = 1;
+        for(int i = 0; i < FXOS8700_MAX_DEVICES; i++){
+            if(fxos_devices[i] == fxos)
+                fxos_devices[i] = NULL;
+        }
+    }
+    FXOS_UNLOCK();
+    if(last)
+        fxos8700_destroy(&fxos);
+}
+
+/*!
+* Open device at port/addr, NULL if none; call with the lock held
+*/
+static fxos8700_t *fxos8700_find(uint8_t port, uint8_t addr){
+    for(int i = 0; i < FXOS8700_MAX_DEVICES; i++){
+        fxos8700_t *fxos = fxos_devices[i];
+        if(fxos && fxos->i2c.port == port && fxos->i2c.addr == addr)
+            return fxos;
+    }
+    return NULL;
+}
+
+/*!
+* Set up the device at fxos->i2c.port/addr, which the caller fills in
+*/
 static fxos8700_err_t fxos8700_init(fxos8700_t *fxos){
 
+
     i2c_err_t ret;
-    uint8_t* data_rd = (uint8_t*)malloc(sizeof(uint8_t)*FXOS_BUFF_SIZE);
-    uint8_t* data_wr = (uint8_t*)malloc(sizeof(uint8_t)*FXOS_BUFF_SIZE);
+    uint8_t* data_rd = fxos->data_rd;
+    fxos->rd_link = NULL;
+    fxos->rd_link_accel = NULL;
+    fxos->mode = FXOS8700_MODE_HYBRID;
 
-    /* Setup the i2c device from macros */
-    fxos->i2c.addr = FXOS8700_ADDRESS;
+    /* Setup the i2c device */
     fxos->i2c.clk_speed = I2C_MASTER_FAST_FREQ_HZ;
     fxos->i2c.mode =I2C_MODE_TYPE_MASTER;
     fxos->i2c.tx_buff_len = ACCEL_BUFF_SIZE;
@@ -189,75 +484,142 @@ static fxos8700_err_t fxos8700_init(fxos8700_t *fxos){
 
     ret = i2c_utils_setup(fxos->i2c);
     if(ret != I2C_SUCCESS){
-        while(1){
-            printf("%d\n", ret );
-        }
-        return ACCEL_BUS_FAIL;
+        return FXOS8700_BUS_FAIL;
     }
 
-    /* Setup the range */
-    fxos->range = ACCEL_RANGE;
+    /* The stored correction is the default device's */
+    conv_init(&fxos->accel_conv, 2);
+    fxos8700_accel_cal(fxos, NULL);
+    imu_cal_t cal;
+    if(fxos->i2c.port == I2C_MASTER_PORT && fxos->i2c.addr == FXOS8700_ADDRESS &&
+       imu_cal_load(&cal) == IMU_CAL_SUCCESS && (cal.flags & IMU_CAL_ACCEL)){
+        fxos8700_accel_cal_t accel_cal;
+        memcpy(accel_cal.offset, cal.accel_offset, sizeof(accel_cal.offset));
+        memcpy(accel_cal.gain, cal.accel_gain, sizeof(accel_cal.gain));
+        fxos8700_accel_cal(fxos, &accel_cal);
+    }
 
     /* Check device ID */
     ret = i2c_utils_read(fxos->i2c, FXOS8700_REGISTER_WHO_AM_I, data_rd, 1);
+    if(ret != I2C_SUCCESS){
+        return FXOS8700_BUS_FAIL;
+    }
     if(data_rd[0] != FXOS8700_ID) {
         return FXOS8700_ID_FAIL;
     }
 
-    /* Place 0x00 into accel CTRL register to place device into standby*/
-    data_wr[0] = FXOS8700_REGISTER_CTRL_REG1;
-    data_wr[1] = 0x00;
-    /* Set to standby mode (required to make changes to this register) */
-    ret = i2c_utils_write(fxos->i2c, data_wr, 2);
-    
-    /* Configure the accelerometer */
-    switch (fxos->range) {
+    /* One transaction: place 0x00 into accel CTRL register to place device into
+    * standby (required to make changes to the others), high resolution, and jump to
+    * reg 0x33 after reading 0x06 */
+    uint8_t standby_wr[2] = {FXOS8700_REGISTER_CTRL_REG1, 0x00};
+    uint8_t ctrl_reg2_wr[2] = {FXOS8700_REGISTER_CTRL_REG2, 0x02};
+    uint8_t mctrl_reg2_wr[2] = {FXOS8700_REGISTER_MCTRL_REG2, 0x20};
+    i2c_op_t ops[3] = {
+        {I2C_XFER_WRITE, fxos->i2c, 0, standby_wr, 2},
+        {I2C_XFER_WRITE, fxos->i2c, 0, ctrl_reg2_wr, 2},
+        {I2C_XFER_WRITE, fxos->i2c, 0, mctrl_reg2_wr, 2},
+    };
+    ret = i2c_utils_batch(ops, 3);
+    if(ret != I2C_SUCCESS)
+        return FXOS8700_BUS_FAIL;
+    fxos->ctrl_reg1 = 0x00;
+
+    /* Range, rate and oversampling, then active: low noise, 4g, 100Hz in hybrid mode */
+    fxos8700_config_t config = {FXOS8700_ODR, ACCEL_RANGE, FXOS8700_MAGN_OSR};
+    fxos8700_err_t err = fxos8700_configure(fxos, &config);
+    if(err != FXOS8700_SUCCESS)
+        return err;
+
+    /* Prebuild the 13 byte sample read so updates do not touch the heap */
+    ret = i2c_utils_link_read(fxos->i2c, FXOS8700_REGISTER_STATUS, data_rd, FXOS_BUFF_SIZE, &fxos->rd_link);
+    if(ret != I2C_SUCCESS)
+        return FXOS8700_NMALLOC;
+    /* And the 7 byte one for accelerometer only mode */
+    ret = i2c_utils_link_read(fxos->i2c, FXOS8700_REGISTER_STATUS, data_rd, FXOS_ACCEL_READ_SIZE, &fxos->rd_link_accel);
+    if(ret != I2C_SUCCESS)
+        return FXOS8700_NMALLOC;
+
+    return FXOS8700_SUCCESS;
+
+}
+
+/*!
+* Reconfiguration
+*   1. Look up XYZ_DATA_CFG FS and the sensitivity for the range; nothing is written
+*      for a configuration the part does not have
+*   2. Standby, since XYZ_DATA_CFG, M_CTRL_REG1 and the CTRL_REG1 rate only change
+*      out of active mode
+*   3. Write the range and the oversampling (keeping the sensor mode), then CTRL_REG1
+*      with the new rate, which returns to active. Low noise is kept up to 4g. With the
+*      standby, one bus transaction.
+*   4. Keep the scale and period, so conversions do not look at the range again
+*/
+static fxos8700_err_t fxos8700_configure(fxos8700_t *fxos, const fxos8700_config_t *config){
+    float sensitivity;
+    switch(config->range) {
         case (ACCEL_RANGE_2G):
-        data_wr[0] = FXOS8700_REGISTER_XYZ_DATA_CFG;
-        data_wr[1] = 0x00;
-        ret = i2c_utils_write(fxos->i2c, data_wr, 2);
+        sensitivity = ACCEL_MG_LSB_2G;
         break;
-        
         case (ACCEL_RANGE_4G):
-        data_wr[0] = FXOS8700_REGISTER_XYZ_DATA_CFG;
-        data_wr[1] = 0x01;
-        ret = i2c_utils_write(fxos->i2c, data_wr, 2);
+        sensitivity = ACCEL_MG_LSB_4G;
         break;
-        
         case (ACCEL_RANGE_8G):
-        data_wr[0] = FXOS8700_REGISTER_XYZ_DATA_CFG;
-        data_wr[1] = 0x02;
-        ret = i2c_utils_write(fxos->i2c, data_wr, 2);
+        sensitivity = ACCEL_MG_LSB_8G;
         break;
+        default:
+        return FXOS8700_INVALID;
     }
+    if((unsigned)config->odr > FXOS8700_ODR_1_56HZ || config->magn_osr > FXOS8700_MCTRL_REG1_OS_MAX)
+        return FXOS8700_INVALID;
+
+    uint8_t ctrl_reg1 = (fxos->ctrl_reg1 & ~(FXOS8700_CTRL_REG1_DR | FXOS8700_CTRL_REG1_LNOISE)) |
+                        (uint8_t)(config->odr << FXOS8700_CTRL_REG1_DR_SHIFT) | FXOS8700_CTRL_REG1_ACTIVE;
+    if(config->range != ACCEL_RANGE_8G)
+        ctrl_reg1 |= FXOS8700_CTRL_REG1_LNOISE;
+    uint8_t mctrl = fxos8700_mctrl_reg1(config->magn_osr, fxos->mode);
+
+    uint8_t standby_wr[2] = {FXOS8700_REGISTER_CTRL_REG1, fxos->ctrl_reg1 & ~FXOS8700_CTRL_REG1_ACTIVE};
+    uint8_t range_wr[2] = {FXOS8700_REGISTER_XYZ_DATA_CFG, (uint8_t)config->range};
+    uint8_t mctrl_wr[2] = {FXOS8700_REGISTER_MCTRL_REG1, mctrl};
+    uint8_t ctrl_reg1_wr[2] = {FXOS8700_REGISTER_CTRL_REG1, ctrl_reg1};
+    i2c_op_t ops[4];
+    size_t n = 0;
+    if(fxos->ctrl_reg1 & FXOS8700_CTRL_REG1_ACTIVE)
+        ops[n++] = (i2c_op_t){I2C_XFER_WRITE, fxos->i2c, 0, standby_wr, 2};
+    ops[n++] = (i2c_op_t){I2C_XFER_WRITE, fxos->i2c, 0, range_wr, 2};
+    ops[n++] = (i2c_op_t){I2C_XFER_WRITE, fxos->i2c, 0, mctrl_wr, 2};
+    ops[n++] = (i2c_op_t){I2C_XFER_WRITE, fxos->i2c, 0, ctrl_reg1_wr, 2};
+    if(i2c_utils_batch(ops, n) != I2C_SUCCESS)
+        return FXOS8700_BUS_FAIL;
 
-    /* High resolution */
-    data_wr[0] = FXOS8700_REGISTER_CTRL_REG2;
-    data_wr[1] = 0x02;
-    ret = i2c_utils_write(fxos->i2c, data_wr, 2);
-
-    /* Active, Normal Mode, Low Noise, 100Hz in Hybrid Mode */
-    data_wr[0] = FXOS8700_REGISTER_CTRL_REG1;
-    data_wr[1] = 0x0D;
-    //data_wr[1] = 0x15;
-    ret = i2c_utils_write(fxos->i2c, data_wr, 2);
-
-     /* Configure the magnetometer */
-    /* Hybrid Mode, Over Sampling Rate = 16 */
-    data_wr[0] = FXOS8700_REGISTER_MCTRL_REG1;
-    data_wr[1] = 0x1F;
-    ret = i2c_utils_write(fxos->i2c, data_wr, 2);
-    /* Jump to reg 0x33 after reading 0x06 */
-    data_wr[0] = FXOS8700_REGISTER_MCTRL_REG2;
-    data_wr[1] = 0x20;
-    ret = i2c_utils_write(fxos->i2c, data_wr, 2);
-
-
-    free(data_rd);
-    free(data_wr);
+    fxos->ctrl_reg1 = ctrl_reg1;
+    fxos->range = config->range;
+    fxos->odr = config->odr;
+    fxos->magn_osr = config->magn_osr;
+    fxos->accel_scale = sensitivity * SENSORS_GRAVITY_STANDARD;
+    conv_set_scale(&fxos->accel_conv, fxos->accel_scale);
+    fxos->period_us = fxos8700_period_us(fxos);
 
     return FXOS8700_SUCCESS;
+}
+
+/*!
+* M_CTRL_REG1 for an oversampling setting and sensor mode
+*/
+static uint8_t fxos8700_mctrl_reg1(uint8_t magn_osr, fxos8700_mode_t mode){
+    uint8_t hms = mode == FXOS8700_MODE_ACCEL_ONLY ? FXOS8700_MCTRL_REG1_ACCEL_ONLY : FXOS8700_MCTRL_REG1_HYBRID;
+    return (uint8_t)(magn_osr << FXOS8700_MCTRL_REG1_OS_SHIFT) | hms;
+}
 
+/*!
+* Sample period of the programmed rate; hybrid mode alternates the sensors and
+* doubles it
+*/
+static uint32_t fxos8700_period_us(const fxos8700_t *fxos){
+    uint32_t period = fxos_period_us[fxos->odr];
+    if(fxos->mode == FXOS8700_MODE_HYBRID)
+        period *= 2;
+    return period;
 }
 
 static fxos8700_err_t fxos8700_update(fxos8700_t *fxos){
@@ -265,18 +627,7 @@ static fxos8700_err_t fxos8700_update(fxos8700_t *fxos){
         return FXOS8700_NMALLOC;
     }
 
-    i2c_err_t ret;
-    uint8_t* data_rd = (uint8_t*)malloc(sizeof(uint8_t)*ACCEL_BUFF_SIZE);
-    uint8_t* data_wr = (uint8_t*)malloc(sizeof(uint8_t)*ACCEL_BUFF_SIZE);
-
-    /* clear the raw data */
-    fxos->a_raw.x = 0;
-    fxos->a_raw.y = 0;
-    fxos->a_raw.z = 0;
-
-    fxos->m_raw.x = 0;
-    fxos->m_raw.y = 0;
-    fxos->m_raw.z = 0;
+    PERF_BEGIN(start);
 
     /* Read in 13 bytes:
     * [0] dev status
@@ -293,16 +644,110 @@ static fxos8700_err_t fxos8700_update(fxos8700_t *fxos){
     * [11] upper magnetometer z-axis byte
     * [12] lower magnetometer z-axis byte
     */
-    ret = i2c_utils_read(fxos->i2c, FXOS8700_REGISTER_STATUS, data_rd, 13);
-    if(ret != I2C_SUCCESS)
+    i2c_err_t ret = i2c_utils_link_exec(fxos->mode == FXOS8700_MODE_ACCEL_ONLY ? fxos->rd_link_accel : fxos->rd_link);
+    fxos8700_err_t err = fxos8700_complete(fxos, ret);
+    if(err != FXOS8700_SUCCESS)
+        return err;
+    PERF_END(PERF_FXOS_READ, start);
+
+    return FXOS8700_SUCCESS;
+}
+
+/*!
+* Account and convert a sample read, however it was carried
+*/
+static fxos8700_err_t fxos8700_complete(fxos8700_t *fxos, i2c_err_t result){
+    /* clear the raw data */
+    fxos->a_raw.x = 0;
+    fxos->a_raw.y = 0;
+    fxos->a_raw.z = 0;
+
+    fxos->m_raw.x = 0;
+    fxos->m_raw.y = 0;
+    fxos->m_raw.z = 0;
+
+    if(result != I2C_SUCCESS)
         return FXOS8700_BUS_FAIL;
 
-    uint8_t axhi = data_rd[1];
-    uint8_t axlo = data_rd[2];
-    uint8_t ayhi = data_rd[3];
-    uint8_t aylo = data_rd[4];
-    uint8_t azhi = data_rd[5];
-    uint8_t azlo = data_rd[6];
+    fxos8700_epoch(fxos);
+    return FXOS8700_SUCCESS;
+}
+
+static fxos8700_err_t fxos8700_destroy(fxos8700_t **fxos){
+    if(fxos) {
+        if(*fxos) {
+            i2c_utils_link_destroy(&(*fxos)->rd_link);
+            i2c_utils_link_destroy(&(*fxos)->rd_link_accel);
+        }
+        free(*fxos);
+        *fxos = NULL;
+        return FXOS8700_SUCCESS;
+    } else {
+        return FXOS8700_NMALLOC;
+    }
+}
+
+static fxos8700_err_t fxos8700_write_reg(fxos8700_t *fxos, uint8_t reg, uint8_t value){
+    uint8_t data_wr[2] = {reg, value};
+    if(i2c_utils_write(fxos->i2c, data_wr, 2) != I2C_SUCCESS)
+        return FXOS8700_BUS_FAIL;
+    return FXOS8700_SUCCESS;
+}
+
+static void accel_copy(accel_t *accel, fxos8700_t *fxos){
+    if(fxos->epoch - accel->seq > 1)
+        accel->missed += fxos->epoch - accel->seq - 1;
+    accel->seq = fxos->epoch;
+    accel->read_seq = fxos->read_seq;
+    accel->raw.x = fxos->a_raw.x;
+    accel->raw.y = fxos->a_raw.y;
+    accel->raw.z = fxos->a_raw.z;
+    accel->converted.x = fxos->a_converted.x;
+    accel->converted.y = fxos->a_converted.y;
+    accel->converted.z = fxos->a_converted.z;
+}
+
+static void magn_copy(magn_t *magn, fxos8700_t *fxos){
+    if(fxos->epoch - magn->seq > 1)
+        magn->missed += fxos->epoch - magn->seq - 1;
+    magn->seq = fxos->epoch;
+    magn->read_seq = fxos->read_seq;
+    magn->raw.x = fxos->m_raw.x;
+    magn->raw.y = fxos->m_raw.y;
+    magn->raw.z = fxos->m_raw.z;
+    magn->converted.x = fxos->m_converted.x;
+    magn->converted.y = fxos->m_converted.y;
+    magn->converted.z = fxos->m_converted.z;
+}
+
+/*!
+* Account a completed sample read by its status byte, then convert it
+*   1. ZYXDR: the read carried a new sample, which starts a new epoch
+*   2. Otherwise the read returned the current epoch's sample again
+*   3. ZYXOW: the device overwrote at least one sample the host never read
+*/
+static void fxos8700_epoch(fxos8700_t *fxos){
+    uint8_t status = fxos->data_rd[0];
+    fxos->read_seq++;
+    fxos->stats.reads++;
+    if(status & FXOS8700_STATUS_ZYXDR) {
+        fxos->epoch++;
+        fxos->stats.samples++;
+    } else {
+        fxos->stats.stale++;
+    }
+    if(status & FXOS8700_STATUS_ZYXOW){
+        fxos->stats.overwritten++;
+        PERF_COUNT(PERF_FXOS_OVERWRITTEN, 1);
+    }
+    fxos8700_convert(fxos);
+}
+
+/*!
+* Convert the 13 (or 7) byte block in data_rd into raw counts and SI units
+*/
+static void fxos8700_convert(fxos8700_t *fxos){
+    uint8_t* data_rd = fxos->data_rd;
 
     uint8_t mxhi = data_rd[7];
     uint8_t mxlo = data_rd[8];
@@ -311,33 +756,23 @@ static fxos8700_err_t fxos8700_update(fxos8700_t *fxos){
     uint8_t mzhi = data_rd[11];
     uint8_t mzlo = data_rd[12];
 
-    /* form accelerometer values */
-    fxos->a_converted.x = (int16_t)((axhi << 8) | axlo) >> 2;
-    fxos->a_converted.y = (int16_t)((ayhi << 8) | aylo) >> 2;
-    fxos->a_converted.z = (int16_t)((azhi << 8) | azlo) >> 2;
-
-    fxos->a_raw.x = fxos->a_converted.x;
-    fxos->a_raw.y =  fxos->a_converted.y;
-    fxos->a_raw.z = fxos->a_converted.z;
-
-    /* Apply range correction */
-    switch (fxos->range) {
-      case (ACCEL_RANGE_2G):
-          fxos->a_converted.x *= ACCEL_MG_LSB_2G * SENSORS_GRAVITY_STANDARD;
-          fxos->a_converted.y *= ACCEL_MG_LSB_2G * SENSORS_GRAVITY_STANDARD;
-          fxos->a_converted.z *= ACCEL_MG_LSB_2G * SENSORS_GRAVITY_STANDARD;
-      break;
-      case (ACCEL_RANGE_4G):
-          fxos->a_converted.x *= ACCEL_MG_LSB_4G * SENSORS_GRAVITY_STANDARD;
-          fxos->a_converted.y *= ACCEL_MG_LSB_4G * SENSORS_GRAVITY_STANDARD;
-          fxos->a_converted.z *= ACCEL_MG_LSB_4G * SENSORS_GRAVITY_STANDARD;
-      break;
-      case (ACCEL_RANGE_8G):
-          fxos->a_converted.x *= ACCEL_MG_LSB_8G * SENSORS_GRAVITY_STANDARD;
-          fxos->a_converted.y *= ACCEL_MG_LSB_8G * SENSORS_GRAVITY_STANDARD;
-          fxos->a_converted.z *= ACCEL_MG_LSB_8G * SENSORS_GRAVITY_STANDARD;
-      break;
-    }   
+    /* Accelerometer counts, range, offset and gain correction */
+    int16_t *const a_raw[3] = {&fxos->a_raw.x, &fxos->a_raw.y, &fxos->a_raw.z};
+#if OTIS_FIXED_POINT
+    q16_t ax, ay, az;
+    q16_t *const a_q[3] = {&ax, &ay, &az};
+    conv_fixed(&fxos->accel_conv, data_rd + 1, 6, 1, a_raw, a_q);
+    fxos->a_converted.x = q16_to_float(ax);
+    fxos->a_converted.y = q16_to_float(ay);
+    fxos->a_converted.z = q16_to_float(az);
+#else
+    float *const a_out[3] = {&fxos->a_converted.x, &fxos->a_converted.y, &fxos->a_converted.z};
+    conv_float(&fxos->accel_conv, data_rd + 1, 6, 1, a_raw, a_out);
+#endif
+
+    /* Only the first 7 bytes were read in accelerometer only mode */
+    if(fxos->mode != FXOS8700_MODE_HYBRID)
+        return;
 
     /* form magnetometer values */
     fxos->m_converted.x = (int16_t)((mxhi << 8) | mxlo);
@@ -353,18 +788,37 @@ static fxos8700_err_t fxos8700_update(fxos8700_t *fxos){
     fxos->m_converted.y *= MAG_UT_LSB;
     fxos->m_converted.z *= MAG_UT_LSB;
 
-    free(data_rd);
-    free(data_wr);
-
-    return FXOS8700_SUCCESS;
+    /* Hard and soft iron correction */
+    const fxos8700_magn_cal_t *cal = __atomic_load_n(&fxos->magn_cal_active, __ATOMIC_ACQUIRE);
+    if(cal){
+        float x = fxos->m_converted.x - cal->offset[0];
+        float y = fxos->m_converted.y - cal->offset[1];
+        float z = fxos->m_converted.z - cal->offset[2];
+        fxos->m_converted.x = cal->soft[0] * x + cal->soft[1] * y + cal->soft[2] * z;
+        fxos->m_converted.y = cal->soft[3] * x + cal->soft[4] * y + cal->soft[5] * z;
+        fxos->m_converted.z = cal->soft[6] * x + cal->soft[7] * y + cal->soft[8] * z;
+    }
 }
 
-static fxos8700_err_t fxos8700_destroy(fxos8700_t **fxos){
-    if(fxos) {
-        free(*fxos);
-        *fxos = NULL;
-        return FXOS8700_SUCCESS;
-    } else {
-        return FXOS8700_NMALLOC;
+/*!
+* Set the accelerometer correction, none for NULL
+*/
+static void fxos8700_accel_cal(fxos8700_t *fxos, const fxos8700_accel_cal_t *cal){
+    for(int i = 0; i < 3; i++){
+        fxos->accel_cal.offset[i] = cal ? cal->offset[i] : 0.0F;
+        fxos->accel_cal.gain[i] = cal ? cal->gain[i] : 1.0F;
     }
-}
\ No newline at end of file
+    conv_set_bias(&fxos->accel_conv, fxos->accel_cal.offset);
+    conv_set_gain(&fxos->accel_conv, fxos->accel_cal.gain);
+}
+
+/*!
+* (count * scale - offset) * gain, with the Q31 scale and Q16 offset giving Q16 and
+* the Q30 gain keeping it there
+*/
+static void fxos8700_accel_fixed(const fxos8700_t *fxos, const raw_int_data_t *raw, raw_fixed_data_t *out){
+    const conv_params_t *p = &fxos->accel_conv;
+    out->x = q30_mul(p->m_q[0], q16_scale(raw->x, p->scale_q) - p->bias_q[0]);
+    out->y = q30_mul(p->m_q[4], q16_scale(raw->y, p->scale_q) - p->bias_q[1]);
+    out->z = q30_mul(p->m_q[8], q16_scale(raw->z, p->scale_q) - p->bias_q[2]);
+}
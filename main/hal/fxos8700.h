@@ -11,17 +11,39 @@
 
 #include "i2c_utils.h"
 #include "time_utils.h"
+#include "fixed.h"
+#include "conv.h"
 
 /** 7-bit I2C address for this sensor */
 #define FXOS8700_ADDRESS           (0x1F)     // 0011111
 /** Device ID for this sensor (used as sanity check during init) */
 #define FXOS8700_ID (0xC7) // 1100 0111
+/** Devices open at once: SA1/SA0 strapping gives four addresses, 0x1C-0x1F, on each
+    of the two I2C ports */
+#define FXOS8700_MAX_DEVICES 8
 
+/* Configuration applied when a device is opened */
 #define ACCEL_RANGE ACCEL_RANGE_4G
+/* 100Hz per sensor in hybrid mode, the gyroscope's GYRO_ODR and the 10 ms sample period:
+   a faster rate only has the device overwrite samples between reads */
+#define FXOS8700_ODR FXOS8700_ODR_200HZ
+#define FXOS8700_MAGN_OSR 7
 
 #define ACCEL_BUFF_SIZE 13
 #define MAGN_BUFF_SIZE 13
 #define FXOS_BUFF_SIZE 13
+/** Status plus accelerometer X/Y/Z, the burst read in accelerometer only mode */
+#define FXOS_ACCEL_READ_SIZE 7
+
+/** Macro for mg per LSB at +/- 2g sensitivity (1 LSB = 0.000244mg) */
+#define ACCEL_MG_LSB_2G (0.000244F)
+/** Macro for mg per LSB at +/- 4g sensitivity (1 LSB = 0.000488mg) */
+#define ACCEL_MG_LSB_4G (0.000488F)
+/** Macro for mg per LSB at +/- 8g sensitivity (1 LSB = 0.000976mg) */
+#define ACCEL_MG_LSB_8G (0.000976F)
+
+/** Micro tesla (uT) per magnetometer count */
+#define MAG_UT_LSB (0.1F)
 
 #define SENSORS_GRAVITY_EARTH (9.80665F) /**< Earth's gravity in m/s^2 */
 #define SENSORS_GRAVITY_STANDARD (SENSORS_GRAVITY_EARTH)
@@ -57,6 +79,42 @@ typedef enum
     FXOS8700_REGISTER_MCTRL_REG3      = 0x5D, /**< 0x5D (default value = 0b00000000, read/write) */
 } fxos8700Registers_t;
 
+/*!
+    STATUS (DR_STATUS) bits, the first byte of every sample read
+*/
+#define FXOS8700_STATUS_ZYXDR           (0x08) /**< A new sample is available */
+#define FXOS8700_STATUS_ZYXOW           (0x80) /**< A sample was overwritten before it was read */
+
+/*!
+    Interrupt control bits
+*/
+#define FXOS8700_CTRL_REG1_ACTIVE       (0x01) /**< Active mode bit of CTRL_REG1 */
+#define FXOS8700_CTRL_REG1_LNOISE       (0x04) /**< Low noise mode, limited to +/- 4g */
+#define FXOS8700_CTRL_REG1_DR           (0x38) /**< Output data rate field of CTRL_REG1 */
+#define FXOS8700_CTRL_REG1_DR_SHIFT     3
+#define FXOS8700_XYZ_DATA_CFG_FS        (0x03) /**< Accelerometer full scale range field */
+#define FXOS8700_CTRL_REG3_IPOL         (0x02) /**< Active high interrupt polarity */
+#define FXOS8700_CTRL_REG4_INT_EN_DRDY  (0x01) /**< Enable the data-ready interrupt */
+#define FXOS8700_CTRL_REG5_INT_CFG_DRDY (0x01) /**< Route data-ready to INT1 */
+
+/*!
+    Magnetometer control: oversampling ratio (bits 4:2) and sensor mode (bits 1:0)
+*/
+#define FXOS8700_MCTRL_REG1_OS_SHIFT    2
+#define FXOS8700_MCTRL_REG1_OS_MAX      7      /**< Highest oversampling setting */
+#define FXOS8700_MCTRL_REG1_HYBRID      (0x03) /**< Accelerometer and magnetometer */
+#define FXOS8700_MCTRL_REG1_ACCEL_ONLY  (0x00) /**< Accelerometer only */
+
+/*!
+    Sensor mode. Accelerometer only turns the magnetometer off and cuts the sample
+    read from 13 to 7 bytes.
+*/
+typedef enum
+{
+    FXOS8700_MODE_HYBRID              = 0x00, /**< Accelerometer and magnetometer */
+    FXOS8700_MODE_ACCEL_ONLY          = 0x01  /**< Accelerometer only */
+} fxos8700_mode_t;
+
 /*!
     Range settings for the accelerometer sensor.
 */
@@ -67,6 +125,32 @@ typedef enum
     ACCEL_RANGE_8G                    = 0x02  /**< +/- 8g range */
 } fxos8700AccelRange_t;
 
+/*!
+    Output data rates, the CTRL_REG1 DR[2:0] values. The rates are those of a single
+    sensor; hybrid mode alternates the accelerometer and magnetometer and halves them.
+*/
+typedef enum
+{
+    FXOS8700_ODR_800HZ                = 0x00, /**< 800Hz, 400Hz hybrid */
+    FXOS8700_ODR_400HZ                = 0x01, /**< 400Hz, 200Hz hybrid */
+    FXOS8700_ODR_200HZ                = 0x02, /**< 200Hz, 100Hz hybrid */
+    FXOS8700_ODR_100HZ                = 0x03, /**< 100Hz, 50Hz hybrid */
+    FXOS8700_ODR_50HZ                 = 0x04, /**< 50Hz, 25Hz hybrid */
+    FXOS8700_ODR_12_5HZ               = 0x05, /**< 12.5Hz, 6.25Hz hybrid */
+    FXOS8700_ODR_6_25HZ               = 0x06, /**< 6.25Hz, 3.125Hz hybrid */
+    FXOS8700_ODR_1_56HZ               = 0x07  /**< 1.5625Hz, 0.78Hz hybrid */
+} fxos8700_odr_t;
+
+/*!
+    Runtime configuration of a device
+*/
+typedef struct fxos8700_config_s {
+    fxos8700_odr_t odr;             /**< Output data rate */
+    fxos8700AccelRange_t range;     /**< Accelerometer full scale range */
+    uint8_t magn_osr;               /**< Magnetometer oversampling setting, 0-7; the ratio
+                                         it gives depends on the rate (datasheet M_CTRL_REG1) */
+} fxos8700_config_t;
+
 
 /*!
     Struct to store a single raw (integer-based) gyroscope vector
@@ -83,26 +167,91 @@ typedef struct raw_float_data_s {
       float z;    /**< Raw int16_t value for the z axis */
 } raw_float_data_t;
 
+typedef struct raw_fixed_data_s {
+      q16_t x;    /**< SI value, Q16 */
+      q16_t y;
+      q16_t z;
+} raw_fixed_data_t;
+
+/*!
+    Magnetometer hard and soft iron correction, m' = soft (m - offset), in uT
+*/
+typedef struct fxos8700_magn_cal_s {
+    float offset[3];         /**< Hard iron offset (uT) */
+    float soft[9];           /**< Soft iron correction, row major */
+} fxos8700_magn_cal_t;
+
+/*!
+    Accelerometer offset and gain correction, a' = (a - offset) * gain per axis, in m/s^2
+*/
+typedef struct fxos8700_accel_cal_s {
+    float offset[3];         /**< m/s^2 */
+    float gain[3];
+} fxos8700_accel_cal_t;
+
+/*!
+    Sample read counters of a device
+*/
+typedef struct fxos8700_stats_s {
+    uint32_t reads;          /**< Sample reads on the bus */
+    uint32_t samples;        /**< Reads that carried a new sample, i.e. epochs */
+    uint32_t stale;          /**< Reads that returned the sample of the current epoch again */
+    uint32_t overwritten;    /**< Reads flagged ZYXOW: the device dropped samples before them */
+    uint32_t coalesced;      /**< View updates served by another view's read, new or stale */
+} fxos8700_stats_t;
+
+/*!
+    Device context, shared by its accelerometer and magnetometer views.
+    Every sample read that carries new data (STATUS ZYXDR) starts a new epoch; the
+    views record the epoch they hold, so a caller can tell a new sample from a repeated
+    one. They also record the last read they took, new or stale, so accel_update and
+    magn_update share every read: polled faster than the output rate, a stale read is
+    not repeated for the other view.
+*/
 typedef struct fxos8700_s {
     raw_int_data_t a_raw;
     raw_float_data_t a_converted;
     raw_int_data_t m_raw;
     raw_float_data_t m_converted;
     fxos8700AccelRange_t range;
+    fxos8700_odr_t odr;
+    uint8_t magn_osr;
+    fxos8700_mode_t mode;
+    float accel_scale;       /**< m/s^2 per count at the configured range */
+    uint32_t period_us;      /**< Sample period of the configured rate and mode */
+    uint8_t ctrl_reg1;
+    uint8_t refs;            /**< Views (accel_t, magn_t) sharing the device */
+    uint8_t ready;           /**< Set once setup finished and the device can be shared */
+    uint32_t epoch;          /**< Epoch of the sample in a_raw/m_raw */
+    uint32_t read_seq;       /**< Sample reads completed, stale ones included */
+    fxos8700_stats_t stats;
+    fxos8700_accel_cal_t accel_cal;                /**< Applied to every accelerometer sample */
+    conv_params_t accel_conv;                      /**< accel_scale and accel_cal, for the kernels */
+    fxos8700_magn_cal_t magn_cal[2];               /**< Correction in use and the next one */
+    const fxos8700_magn_cal_t *magn_cal_active;    /**< NULL when uncorrected */
     int32_t id;
     i2c_peripheral_t i2c;
+    uint8_t data_rd[FXOS_BUFF_SIZE];
+    i2c_link_t rd_link;
+    i2c_link_t rd_link_accel;
 } fxos8700_t;
 
 typedef struct accel_s {
     fxos8700_t* fxos;
     raw_int_data_t raw;
     raw_float_data_t converted;
+    uint32_t seq;            /**< Epoch of the sample held */
+    uint32_t read_seq;       /**< Device read_seq of the read held */
+    uint32_t missed;         /**< Epochs this view skipped */
 } accel_t;
 
 typedef struct magn_s {
     fxos8700_t* fxos;
     raw_int_data_t raw;
     raw_float_data_t converted;
+    uint32_t seq;            /**< Epoch of the sample held */
+    uint32_t read_seq;       /**< Device read_seq of the read held */
+    uint32_t missed;         /**< Epochs this view skipped */
 } magn_t;
 
 typedef enum {
@@ -110,6 +259,7 @@ typedef enum {
     ACCEL_BUS_FAIL = 0x1,
     ACCEL_ID_FAIL = 0x2,
     ACCEL_NMALLOC = 0x3,
+    ACCEL_INVALID = 0x5,
 } accel_err_t;
 
 typedef enum {
@@ -117,25 +267,168 @@ typedef enum {
     MAGN_BUS_FAIL = 0x1,
     MAGN_ID_FAIL = 0x2,
     MAGN_NMALLOC = 0x3,
+    MAGN_DISABLED = 0x4,
 } magn_err_t;
 
 typedef enum {
     FXOS8700_SUCCESS = 0x0,
     FXOS8700_BUS_FAIL = 0x1,
     FXOS8700_ID_FAIL = 0x2,
-    FXOS8700_NMALLOC = 0x3
+    FXOS8700_NMALLOC = 0x3,
+    FXOS8700_INVALID = 0x4
 } fxos8700_err_t;
 
+/*!
+* @brief open an accelerometer view of the FXOS8700 at the default port and address
+* @param accel the view
+* @returns accel status
+*/
 accel_err_t accel_init(accel_t **accel);
 
+/*!
+* @brief open an accelerometer view of the FXOS8700 at port/addr
+* Views of the same device (accel_t and magn_t alike) share one context and one
+* sample read, which is set up with the first view and released with the last.
+* Several devices, e.g. redundant IMUs on one bus, can be open at once. Opening and
+* closing views is safe from any task, as is magn_set_calibration; every other call
+* on the views of one device must come from one task, as they share its sample
+* buffer, epoch and counters without a lock.
+* @param accel the view
+* @param port the i2c controller of the bus
+* @param addr the 7-bit address
+* @returns accel status
+*/
+accel_err_t accel_init_at(accel_t **accel, uint8_t port, uint8_t addr);
+
+/*!
+* @brief bring the accelerometer view to the newest sample
+* The device is read only when this view already holds its last read; if the
+* magnetometer view read since, with a new sample or not, that read is taken without a
+* bus transaction. accel->seq is unchanged when the device had no new sample.
+* @param accel the accelerometer view
+* @returns accel status
+*/
 accel_err_t accel_update(accel_t *accel);
 
 accel_err_t accel_destroy(accel_t **accel);
 
+/*!
+* @brief route the FXOS8700 data-ready interrupt to INT1 (push-pull, active high)
+* In hybrid mode one edge announces a combined accelerometer/magnetometer sample.
+* @param accel any accelerometer view of the device
+* @returns accel status
+*/
+accel_err_t accel_drdy_enable(accel_t *accel);
+
+/*!
+* @brief switch between hybrid and accelerometer only operation
+* The device is put in standby for the change. In accelerometer only mode
+* magn_update returns MAGN_DISABLED and the combined reads leave the magnetometer
+* view untouched.
+* @param accel any accelerometer view of the device
+* @param mode the sensor mode
+* @returns accel status
+*/
+accel_err_t accel_set_mode(accel_t *accel, fxos8700_mode_t mode);
+
+/*!
+* @brief correct the accelerometer for offset and gain error, e.g. with a stillcal fit
+* The correction applies to every sample converted from then on, for all views of the
+* device; change it from the task that samples. The device at the default address
+* starts with the stored correction (imu_cal_load), if there is one.
+* @param accel any accelerometer view of the device
+* @param cal the correction, NULL for none
+* @returns accel status
+*/
+accel_err_t accel_set_calibration(accel_t *accel, const fxos8700_accel_cal_t *cal);
+
+/*!
+* @brief convert raw counts to corrected m/s^2 in integer arithmetic
+* The accelerometer conversion of every sample when OTIS_FIXED_POINT is 1, see
+* fixed.h; the magnetometer stays in float, the fixed point filter does not use it.
+* @param accel any accelerometer view, for the device's scale and correction
+* @param raw the counts
+* @param out the acceleration, Q16
+*/
+void accel_convert_fixed(const accel_t *accel, const raw_int_data_t *raw, raw_fixed_data_t *out);
+
+/*!
+* @brief change the output data rate, accelerometer range and magnetometer oversampling
+* The device is put in standby for the writes and made active again, and the
+* conversion scale and sample period are updated. The change applies to every view
+* of the device. +/- 8g turns low noise mode off, which the part only has up to 4g.
+* @param accel any accelerometer view of the device
+* @param config the configuration
+* @returns accel status, ACCEL_INVALID for a rate, range or oversampling setting the
+* part does not have
+*/
+accel_err_t accel_configure(accel_t *accel, const fxos8700_config_t *config);
+
+/*!
+* @brief read the FXOS8700 once and update both views
+* Unlike accel_update/magn_update this always reads the device, for use when a
+* data-ready edge has announced a new sample. Both views receive the same epoch.
+* @param accel the accelerometer view, may be NULL
+* @param magn the magnetometer view, may be NULL
+* @returns accel status
+*/
+accel_err_t accel_magn_update(accel_t *accel, magn_t *magn);
+
+/*!
+* @brief describe the FXOS8700 sample read of the current mode, for a batch with other
+* devices' reads (i2c_utils_link_batch); once the batch has run, pass its result to
+* accel_magn_complete. Describe it again after accel_set_mode.
+* @param accel any accelerometer view of the device
+* @param op the read, into the device's buffer
+* @returns accel status
+*/
+accel_err_t accel_magn_sample_op(accel_t *accel, i2c_op_t *op);
+
+/*!
+* @brief convert a sample read made through accel_magn_sample_op into both views, as
+* accel_magn_update
+* @param accel the accelerometer view, may be NULL
+* @param magn the magnetometer view, may be NULL
+* @param result the result of the transaction that carried the read
+* @returns accel status, ACCEL_BUS_FAIL for a failed read
+*/
+accel_err_t accel_magn_complete(accel_t *accel, magn_t *magn, i2c_err_t result);
+
 magn_err_t magn_init(magn_t **magn);
 
+/*!
+* @brief open a magnetometer view of the FXOS8700 at port/addr, see accel_init_at
+*/
+magn_err_t magn_init_at(magn_t **magn, uint8_t port, uint8_t addr);
+
+/*!
+* @brief bring the magnetometer view to the newest sample, see accel_update
+* @param magn the magnetometer view
+* @returns magn status, MAGN_DISABLED in accelerometer only mode
+*/
 magn_err_t magn_update(magn_t *magn);
 
+/*!
+* @brief correct the magnetometer for hard and soft iron, e.g. with a magcal fit
+* The correction is applied to every sample converted from then on, for all views
+* of the device. It may be changed from another task than the one sampling, at most
+* once per sample period.
+* @param magn the magnetometer view
+* @param cal the correction, NULL for none
+* @returns magn status
+*/
+magn_err_t magn_set_calibration(magn_t *magn, const fxos8700_magn_cal_t *cal);
+
+/*!
+* @brief the correction in use, NULL for none
+*/
+const fxos8700_magn_cal_t *magn_get_calibration(const magn_t *magn);
+
 magn_err_t magn_destroy(magn_t **magn);
 
+/*!
+* @brief number of FXOS8700 devices currently open (with at least one view)
+*/
+uint8_t fxos8700_open_devices(void);
+
 #endif
\ No newline at end of file
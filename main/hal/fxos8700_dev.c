@@ -0,0 +1,203 @@
+/*!
+* @file fxos8700_dev.c
+* @author Ethan Lew
+* @brief FXOS8700 adapter of the imu_dev interface (accelerometer, magnetometer)
+*/
+
+#include <string.h>
+#include "imu_dev.h"
+#include "time_utils.h"
+
+/* Self test: data must be ready within this many output periods */
+#define FXOS_SELF_TEST_PERIODS 3
+
+typedef struct fxos8700_dev_s {
+    accel_t *accel;
+    magn_t *magn;
+} fxos8700_dev_t;
+
+const imu_dev_ops_t fxos8700_dev_ops = {
+    "fxos8700",
+    fxos8700_dev_init,
+    fxos8700_dev_configure,
+    fxos8700_dev_read_batch,
+    fxos8700_dev_self_test,
+    fxos8700_dev_calibrate,
+    fxos8700_dev_destroy,
+    fxos8700_dev_sample_op,
+    fxos8700_dev_sample_done,
+};
+
+static void fxos8700_dev_sample(imu_dev_t *dev, imu_sample_t *out, uint32_t seq);
+
+imu_dev_err_t fxos8700_dev_init(imu_dev_t *dev){
+    fxos8700_dev_t *ctx = (fxos8700_dev_t*)malloc(sizeof(fxos8700_dev_t));
+    if(!ctx)
+        return IMU_DEV_NMALLOC;
+
+    dev->ops = &fxos8700_dev_ops;
+    dev->drv = ctx;
+    dev->sensors = IMU_DEV_ACCEL | IMU_DEV_MAGN;
+    dev->config = (imu_dev_config_t){IMU_DEV_ACCEL | IMU_DEV_MAGN, 0, 0};
+    ctx->accel = NULL;
+    ctx->magn = NULL;
+
+    if(accel_init(&ctx->accel) != ACCEL_SUCCESS || magn_init(&ctx->magn) != MAGN_SUCCESS){
+        fxos8700_dev_destroy(dev);
+        return IMU_DEV_BUS_FAIL;
+    }
+    return IMU_DEV_SUCCESS;
+}
+
+/*!
+* Only the changes from the configuration in effect are written
+*   1. The accelerometer always runs; the magnetometer is switched with the sensor
+*      mode
+*   2. The on-chip FIFO is not supported by the driver
+*   3. Data-ready routing, which the driver can only turn on
+*/
+imu_dev_err_t fxos8700_dev_configure(imu_dev_t *dev, const imu_dev_config_t *config){
+    fxos8700_dev_t *ctx = (fxos8700_dev_t*)dev->drv;
+
+    if(!(config->sensors & IMU_DEV_ACCEL) || (config->sensors & ~dev->sensors))
+        return IMU_DEV_UNSUPPORTED;
+    if(config->fifo_watermark != 0)
+        return IMU_DEV_UNSUPPORTED;
+    if(dev->config.drdy && !config->drdy)
+        return IMU_DEV_UNSUPPORTED;
+
+    if(config->sensors != dev->config.sensors){
+        fxos8700_mode_t mode = (config->sensors & IMU_DEV_MAGN) ? FXOS8700_MODE_HYBRID : FXOS8700_MODE_ACCEL_ONLY;
+        if(accel_set_mode(ctx->accel, mode) != ACCEL_SUCCESS)
+            return IMU_DEV_BUS_FAIL;
+        dev->config.sensors = config->sensors;
+    }
+    if(config->drdy && !dev->config.drdy){
+        if(accel_drdy_enable(ctx->accel) != ACCEL_SUCCESS)
+            return IMU_DEV_BUS_FAIL;
+        dev->config.drdy = 1;
+    }
+    return IMU_DEV_SUCCESS;
+}
+
+/*!
+* One accelerometer (and magnetometer) sample per call, stamped now; flagged fresh
+* only when the read started a new epoch
+*/
+imu_dev_err_t fxos8700_dev_read_batch(imu_dev_t *dev, imu_sample_t *out, size_t max, size_t *count){
+    fxos8700_dev_t *ctx = (fxos8700_dev_t*)dev->drv;
+
+    *count = 0;
+    if(max == 0)
+        return IMU_DEV_SUCCESS;
+    uint32_t seq = ctx->accel->seq;
+    if(accel_magn_update(ctx->accel, ctx->magn) != ACCEL_SUCCESS)
+        return IMU_DEV_BUS_FAIL;
+
+    fxos8700_dev_sample(dev, out, seq);
+    *count = 1;
+    return IMU_DEV_SUCCESS;
+}
+
+imu_dev_err_t fxos8700_dev_sample_op(imu_dev_t *dev, i2c_op_t *op){
+    fxos8700_dev_t *ctx = (fxos8700_dev_t*)dev->drv;
+    if(accel_magn_sample_op(ctx->accel, op) != ACCEL_SUCCESS)
+        return IMU_DEV_NMALLOC;
+    return IMU_DEV_SUCCESS;
+}
+
+imu_dev_err_t fxos8700_dev_sample_done(imu_dev_t *dev, i2c_err_t result, imu_sample_t *out){
+    fxos8700_dev_t *ctx = (fxos8700_dev_t*)dev->drv;
+    uint32_t seq = ctx->accel->seq;
+    if(accel_magn_complete(ctx->accel, ctx->magn, result) != ACCEL_SUCCESS)
+        return IMU_DEV_BUS_FAIL;
+
+    fxos8700_dev_sample(dev, out, seq);
+    return IMU_DEV_SUCCESS;
+}
+
+/*!
+* Self test
+*   1. WHO_AM_I must match
+*   2. Read the pending sample so the data-ready flag clears, then a new one must be
+*      flagged within FXOS_SELF_TEST_PERIODS output periods
+*   3. The accelerometer must not sit at full scale
+*/
+imu_dev_err_t fxos8700_dev_self_test(imu_dev_t *dev){
+    fxos8700_dev_t *ctx = (fxos8700_dev_t*)dev->drv;
+    fxos8700_t *fxos = ctx->accel->fxos;
+    uint8_t value;
+
+    if(i2c_utils_read(fxos->i2c, FXOS8700_REGISTER_WHO_AM_I, &value, 1) != I2C_SUCCESS)
+        return IMU_DEV_BUS_FAIL;
+    if(value != FXOS8700_ID)
+        return IMU_DEV_ID_FAIL;
+
+    if(accel_magn_update(ctx->accel, ctx->magn) != ACCEL_SUCCESS)
+        return IMU_DEV_BUS_FAIL;
+
+    uint64_t period = fxos->period_us;
+    uint64_t start = get_time_micros();
+    do {
+        if(i2c_utils_read(fxos->i2c, FXOS8700_REGISTER_STATUS, &value, 1) != I2C_SUCCESS)
+            return IMU_DEV_BUS_FAIL;
+        if(value & FXOS8700_STATUS_ZYXDR)
+            break;
+    } while(get_time_micros() - start < FXOS_SELF_TEST_PERIODS * period);
+    if(!(value & FXOS8700_STATUS_ZYXDR))
+        return IMU_DEV_SELF_TEST_FAIL;
+
+    if(accel_magn_update(ctx->accel, ctx->magn) != ACCEL_SUCCESS)
+        return IMU_DEV_BUS_FAIL;
+    /* 14 bit counts */
+    raw_int_data_t *a = &ctx->accel->raw;
+    if(abs(a->x) >= 8191 || abs(a->y) >= 8191 || abs(a->z) >= 8191)
+        return IMU_DEV_SELF_TEST_FAIL;
+    return IMU_DEV_SUCCESS;
+}
+
+imu_dev_err_t fxos8700_dev_calibrate(imu_dev_t *dev, const imu_cal_t *cal){
+    fxos8700_dev_t *ctx = (fxos8700_dev_t*)dev->drv;
+    if(!(cal->flags & IMU_CAL_ACCEL)){
+        accel_set_calibration(ctx->accel, NULL);
+        return IMU_DEV_SUCCESS;
+    }
+    fxos8700_accel_cal_t accel_cal;
+    memcpy(accel_cal.offset, cal->accel_offset, sizeof(accel_cal.offset));
+    memcpy(accel_cal.gain, cal->accel_gain, sizeof(accel_cal.gain));
+    accel_set_calibration(ctx->accel, &accel_cal);
+    return IMU_DEV_SUCCESS;
+}
+
+void fxos8700_dev_destroy(imu_dev_t *dev){
+    fxos8700_dev_t *ctx = (fxos8700_dev_t*)dev->drv;
+    if(ctx){
+        if(ctx->accel)
+            accel_destroy(&ctx->accel);
+        if(ctx->magn)
+            magn_destroy(&ctx->magn);
+        free(ctx);
+    }
+    dev->drv = NULL;
+}
+
+/*!
+* Stamped now; flagged fresh only when the read started a new epoch (seq, the
+* accelerometer view's epoch before it)
+*/
+static void fxos8700_dev_sample(imu_dev_t *dev, imu_sample_t *out, uint32_t seq){
+    fxos8700_dev_t *ctx = (fxos8700_dev_t*)dev->drv;
+    memset(out, 0, sizeof(imu_sample_t));
+    out->stamp = get_time_micros();
+    out->seq = dev->seq++;
+    out->accel = ctx->accel->converted;
+    out->accel_raw = ctx->accel->raw;
+    out->status = IMU_SAMPLE_ACCEL_VALID;
+    if(ctx->accel->seq != seq)
+        out->status |= IMU_SAMPLE_ACCEL_FRESH;
+    if(dev->config.sensors & IMU_DEV_MAGN){
+        out->magn = ctx->magn->converted;
+        out->magn_raw = ctx->magn->raw;
+        out->status |= IMU_SAMPLE_MAGN_VALID;
+    }
+}
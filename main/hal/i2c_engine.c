@@ -0,0 +1,205 @@
+/*!
+* @file i2c_engine.c
+* @author Ethan Lew
+*
+* Asynchronous transaction engine for i2c_utils. A single bus owner task executes
+* queued transactions back to back, so callers never block on the bus. Submissions go
+* into a fixed-size ring of transaction pointers; the transactions themselves are owned
+* by the caller, so the engine never allocates.
+*/
+
+#include "i2c_utils.h"
+
+#ifdef OTIS_HOST
+#include <pthread.h>
+#else
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+#define I2C_ENGINE_RING_MASK (I2C_ENGINE_RING_SIZE - 1)
+/* Stack of the bus task, in words */
+#define I2C_ENGINE_STACK_SIZE 2048
+
+/* Transaction ring: head is the next transaction to run, tail the next free slot */
+static i2c_xfer_t *engine_ring[I2C_ENGINE_RING_SIZE];
+static uint32_t engine_head = 0;
+static uint32_t engine_tail = 0;
+static const i2c_backend_t *engine_backend = NULL;
+static i2c_engine_stats_t engine_stats;
+static volatile int engine_running = 0;
+
+#ifdef OTIS_HOST
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t engine_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t engine_thread;
+#define ENGINE_LOCK()   pthread_mutex_lock(&engine_lock)
+#define ENGINE_UNLOCK() pthread_mutex_unlock(&engine_lock)
+#else
+static portMUX_TYPE engine_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t engine_task = NULL;
+#define ENGINE_LOCK()   portENTER_CRITICAL(&engine_mux)
+#define ENGINE_UNLOCK() portEXIT_CRITICAL(&engine_mux)
+#endif
+
+static void i2c_engine_drain(void);
+
+static void i2c_engine_complete(i2c_xfer_t *xfer, i2c_err_t ret);
+
+#ifdef OTIS_HOST
+static void *i2c_engine_task(void *arg){
+    (void)arg;
+    while(1){
+        pthread_mutex_lock(&engine_lock);
+        while(engine_head == engine_tail && engine_running)
+            pthread_cond_wait(&engine_cond, &engine_lock);
+        int running = engine_running;
+        pthread_mutex_unlock(&engine_lock);
+
+        i2c_engine_drain();
+        if(!running)
+            break;
+    }
+    return NULL;
+}
+#else
+static void i2c_engine_task(void *arg){
+    (void)arg;
+    while(engine_running){
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        i2c_engine_drain();
+    }
+    engine_task = NULL;
+    vTaskDelete(NULL);
+}
+#endif
+
+i2c_err_t i2c_utils_engine_start(const i2c_backend_t *backend, uint32_t priority){
+    if(engine_running)
+        return I2C_INVALID_STATE;
+
+    engine_backend = backend ? backend : i2c_utils_get_backend();
+    if(!engine_backend)
+        return I2C_INVALID_SETUP;
+    engine_head = 0;
+    engine_tail = 0;
+    engine_stats = (i2c_engine_stats_t){0};
+    engine_running = 1;
+
+#ifdef OTIS_HOST
+    (void)priority;
+    if(pthread_create(&engine_thread, NULL, i2c_engine_task, NULL) != 0){
+        engine_running = 0;
+        return I2C_FAIL;
+    }
+#else
+    if(xTaskCreate(i2c_engine_task, "i2c_engine", I2C_ENGINE_STACK_SIZE, NULL, priority, &engine_task) != pdPASS){
+        engine_running = 0;
+        return I2C_FAIL;
+    }
+#endif
+    return I2C_SUCCESS;
+}
+
+void i2c_utils_engine_stop(void){
+    if(!engine_running)
+        return;
+#ifdef OTIS_HOST
+    pthread_mutex_lock(&engine_lock);
+    engine_running = 0;
+    pthread_cond_signal(&engine_cond);
+    pthread_mutex_unlock(&engine_lock);
+    pthread_join(engine_thread, NULL);
+#else
+    engine_running = 0;
+    xTaskNotifyGive(engine_task);
+#endif
+}
+
+i2c_err_t i2c_utils_submit(i2c_xfer_t *xfer){
+    if(!xfer)
+        return I2C_INVALID_SETUP;
+    if(!engine_running)
+        return I2C_INVALID_STATE;
+
+    ENGINE_LOCK();
+    uint32_t depth = engine_tail - engine_head;
+    if(depth == I2C_ENGINE_RING_SIZE){
+        engine_stats.rejected++;
+        ENGINE_UNLOCK();
+        return I2C_QUEUE_FULL;
+    }
+    xfer->busy = 1;
+    engine_ring[engine_tail & I2C_ENGINE_RING_MASK] = xfer;
+    engine_tail++;
+    engine_stats.submitted++;
+    if(depth + 1 > engine_stats.max_depth)
+        engine_stats.max_depth = depth + 1;
+#ifdef OTIS_HOST
+    pthread_cond_signal(&engine_cond);
+    ENGINE_UNLOCK();
+#else
+    ENGINE_UNLOCK();
+    xTaskNotifyGive(engine_task);
+#endif
+    return I2C_SUCCESS;
+}
+
+void i2c_utils_engine_stats(i2c_engine_stats_t *stats){
+    ENGINE_LOCK();
+    *stats = engine_stats;
+    ENGINE_UNLOCK();
+}
+
+/*!
+* Run queued transactions until the ring is empty. The slot is only released after
+* the transaction ran, so the ring depth includes the transaction on the bus.
+*/
+static void i2c_engine_drain(void){
+    while(1){
+        ENGINE_LOCK();
+        if(engine_head == engine_tail){
+            ENGINE_UNLOCK();
+            return;
+        }
+        i2c_xfer_t *xfer = engine_ring[engine_head & I2C_ENGINE_RING_MASK];
+        ENGINE_UNLOCK();
+
+        i2c_err_t ret;
+        switch(xfer->type){
+            case I2C_XFER_READ:
+            ret = engine_backend->read(xfer->i2c_dev, xfer->i2c_reg, xfer->data, xfer->size);
+            break;
+            case I2C_XFER_WRITE:
+            ret = engine_backend->write(xfer->i2c_dev, xfer->data, xfer->size);
+            break;
+            case I2C_XFER_LINK:
+            ret = engine_backend->link_exec(xfer->link);
+            break;
+            default:
+            ret = I2C_INVALID_SETUP;
+            break;
+        }
+
+        ENGINE_LOCK();
+        engine_head++;
+        engine_stats.completed++;
+        if(ret != I2C_SUCCESS)
+            engine_stats.errors++;
+        ENGINE_UNLOCK();
+
+        i2c_engine_complete(xfer, ret);
+    }
+}
+
+static void i2c_engine_complete(i2c_xfer_t *xfer, i2c_err_t ret){
+    xfer->result = ret;
+    /* Publish the result and data before releasing the transaction */
+    __atomic_store_n(&xfer->busy, 0, __ATOMIC_RELEASE);
+    if(xfer->done)
+        xfer->done(xfer);
+#ifndef OTIS_HOST
+    if(xfer->notify)
+        xTaskNotify(xfer->notify, xfer->notify_bit, eSetBits);
+#endif
+}
@@ -0,0 +1,301 @@
+/*!
+* @file i2c_esp.c
+* @author Ethan Lew
+*
+* ESP32 driver backend of i2c_utils (target builds only).
+*/
+
+#include "i2c_utils.h"
+
+#ifndef OTIS_HOST
+
+/* Ports with the driver installed, one bit per port */
+static int I2C_DRIVER_INSTALLED = 0;
+
+/*!
+* A prebuilt read: the command link and the port it is executed on
+*/
+typedef struct i2c_esp_link_s {
+    i2c_port_t port;
+    i2c_cmd_handle_t cmd;
+} i2c_esp_link_t;
+
+static i2c_err_t i2c_esp_setup(i2c_peripheral_t i2c_setup);
+
+static i2c_err_t i2c_esp_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size);
+
+static i2c_err_t i2c_esp_write(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size);
+
+static i2c_err_t i2c_esp_link_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link);
+
+static i2c_err_t i2c_esp_link_exec(i2c_link_t link);
+
+static void i2c_esp_link_destroy(i2c_link_t *link);
+
+static i2c_err_t i2c_esp_link_batch(const i2c_op_t *ops, size_t count, i2c_link_t *link);
+
+static void i2c_esp_queue_read(i2c_cmd_handle_t cmd, i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size);
+
+static void i2c_esp_queue_write(i2c_cmd_handle_t cmd, i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size);
+
+static i2c_err_t i2c_esp_err(esp_err_t ret);
+
+/*!
+*  The i2c_setup for a ESP32 i2c peripheral works as follows
+*   1. Setup a i2c_config_t struct
+*   2. Setup the operation mode with a i2c_opmode_t struct (optional)
+*   3. Setup the clock speed
+*   4. Setup mode (master in this case)
+* 
+*   In this case, the clock speed is setup in the master configuration. The driver is
+*   installed once per port; master ports 0 and 1 use the I2C_MASTER_* and
+*   I2C_MASTER1_* pins.
+*/
+static i2c_err_t i2c_esp_setup(i2c_peripheral_t i2c_setup)
+{
+    esp_err_t ret = ESP_OK;
+
+    /* Populate a i2c_config_t type*/
+    i2c_config_t conf_dev;
+    conf_dev.sda_pullup_en = GPIO_PULLUP_ENABLE;
+    conf_dev.scl_pullup_en = GPIO_PULLUP_ENABLE;
+
+    /* Slave/Master Specific Configuration */
+    if (i2c_setup.mode == I2C_MODE_TYPE_SLAVE){
+        int i2c_port = I2C_SLAVE_NUM;
+        conf_dev.sda_io_num = I2C_SLAVE_SDA_IO;
+        conf_dev.scl_io_num = I2C_SLAVE_SCL_IO;
+        conf_dev.mode = I2C_MODE_SLAVE;
+        conf_dev.slave.addr_10bit_en = 0;
+        conf_dev.slave.slave_addr = i2c_setup.addr;
+        i2c_param_config(i2c_port, &conf_dev);
+        if (!(I2C_DRIVER_INSTALLED & (1 << i2c_port))){
+            ret =  i2c_driver_install(i2c_port, conf_dev.mode,
+                                    i2c_setup.rx_buff_len,
+                                    i2c_setup.tx_buff_len, 0);
+            I2C_DRIVER_INSTALLED |= 1 << i2c_port;
+        }
+    } else {
+        if (i2c_setup.port >= I2C_PORT_COUNT) {
+            return I2C_INVALID_SETUP;
+        }
+        int i2c_port = i2c_setup.port;
+        conf_dev.sda_io_num = i2c_port == 0 ? I2C_MASTER_SDA_IO : I2C_MASTER1_SDA_IO;
+        conf_dev.scl_io_num = i2c_port == 0 ? I2C_MASTER_SCL_IO : I2C_MASTER1_SCL_IO;
+        conf_dev.mode = I2C_MODE_MASTER;
+        conf_dev.master.clk_speed = i2c_setup.clk_speed;
+
+        i2c_param_config(i2c_port, &conf_dev);
+        if (!(I2C_DRIVER_INSTALLED & (1 << i2c_port))){
+            ret =  i2c_driver_install(i2c_port, conf_dev.mode,
+                                    i2c_setup.rx_buff_len,
+                                    i2c_setup.tx_buff_len, 0);
+            I2C_DRIVER_INSTALLED |= 1 << i2c_port;
+        }
+    }
+
+    /* Interpret Error Results */
+    if(ret == ESP_OK){
+        return I2C_SUCCESS;
+    } else if (ret == ESP_ERR_INVALID_ARG) {
+        return I2C_INVALID_SETUP;
+    } else {
+        return I2C_INSTALL_ERROR;
+    }
+}
+
+/*!
+* 1. Create a command link
+* 2. Queue the register read (see i2c_esp_queue_read) and a stop bit
+* 3. Start the transmission
+* 4. Delete the command link
+*/
+static i2c_err_t i2c_esp_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size)
+{
+    esp_err_t ret;
+
+    /* Nothing to read case */
+    if (size == 0) {
+        return I2C_SUCCESS;
+    }
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_esp_queue_read(cmd, i2c_dev, i2c_reg, data_rd, size);
+    i2c_master_stop(cmd);
+    /* Start the transmission */
+    ret = i2c_master_cmd_begin(i2c_dev.port, cmd, 500 / portTICK_RATE_MS);
+    /* delete the link */
+    i2c_cmd_link_delete(cmd);
+
+    return i2c_esp_err(ret);
+}
+
+/*!
+* 1. Create a command link
+* 2. Queue the write (see i2c_esp_queue_write)
+* 3. Add stop bit
+* 4. Begin transmission
+* 5. Delete the command link
+*/
+static i2c_err_t i2c_esp_write(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size)
+{
+    esp_err_t ret;
+
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_esp_queue_write(cmd, i2c_dev, data_wr, size);
+    i2c_master_stop(cmd);
+    ret = i2c_master_cmd_begin(i2c_dev.port, cmd, 500 / portTICK_RATE_MS);
+    i2c_cmd_link_delete(cmd);
+
+    return i2c_esp_err(ret);
+}
+
+/*!
+* A prebuilt read link holds the same command sequence as i2c_esp_read. The ESP32
+* driver does not consume a command link when it is executed, so the link is created
+* once and replayed for every sample, on the port of the device it was built for.
+*/
+static i2c_err_t i2c_esp_link_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link)
+{
+    if (link == NULL || size == 0) {
+        return I2C_INVALID_SETUP;
+    }
+    i2c_esp_link_t *l = (i2c_esp_link_t*)malloc(sizeof(i2c_esp_link_t));
+    if (l == NULL) {
+        return I2C_FAIL;
+    }
+    l->port = i2c_dev.port;
+    l->cmd = i2c_cmd_link_create();
+    if (l->cmd == NULL) {
+        free(l);
+        return I2C_FAIL;
+    }
+    i2c_esp_queue_read(l->cmd, i2c_dev, i2c_reg, data_rd, size);
+    i2c_master_stop(l->cmd);
+    *link = l;
+    return I2C_SUCCESS;
+}
+
+static i2c_err_t i2c_esp_link_exec(i2c_link_t link)
+{
+    i2c_esp_link_t *l = (i2c_esp_link_t*)link;
+    if (l == NULL) {
+        return I2C_INVALID_STATE;
+    }
+    return i2c_esp_err(i2c_master_cmd_begin(l->port, l->cmd, 500 / portTICK_RATE_MS));
+}
+
+static void i2c_esp_link_destroy(i2c_link_t *link)
+{
+    if (link && *link) {
+        i2c_esp_link_t *l = (i2c_esp_link_t*)*link;
+        i2c_cmd_link_delete(l->cmd);
+        free(l);
+        *link = NULL;
+    }
+}
+
+/*!
+* A batch is one command link: each transfer begins with a (repeated) start and only
+* the last is followed by a stop, so the bus is held from the first transfer to the
+* last and the whole list costs one i2c_master_cmd_begin, one wait for the driver's
+* interrupt and one task switch, instead of one each per transfer. The ESP32 driver
+* stops at the first missing ACK and reports it for the whole link.
+*/
+static i2c_err_t i2c_esp_link_batch(const i2c_op_t *ops, size_t count, i2c_link_t *link)
+{
+    i2c_esp_link_t *l = (i2c_esp_link_t*)malloc(sizeof(i2c_esp_link_t));
+    if (l == NULL) {
+        return I2C_FAIL;
+    }
+    l->port = ops[0].i2c_dev.port;
+    l->cmd = i2c_cmd_link_create();
+    if (l->cmd == NULL) {
+        free(l);
+        return I2C_FAIL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (ops[i].type == I2C_XFER_READ) {
+            i2c_esp_queue_read(l->cmd, ops[i].i2c_dev, ops[i].i2c_reg, ops[i].data, ops[i].size);
+        } else {
+            i2c_esp_queue_write(l->cmd, ops[i].i2c_dev, ops[i].data, ops[i].size);
+        }
+    }
+    i2c_master_stop(l->cmd);
+    *link = l;
+    return I2C_SUCCESS;
+}
+
+/*!
+* The ESP32 initiates as master read as
+* 1. Add a start bit
+* 2. Address the peripheral by writing a byte
+* 3. Write the register to start from
+* 4. Send a repeated start and readdress the peripheral for reading
+* 5. Read N-1 bytes with ACK
+* 6. Read last byte with NACK
+* The stop bit is left to the caller, so reads can be chained with repeated starts.
+*/
+static void i2c_esp_queue_read(i2c_cmd_handle_t cmd, i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size)
+{
+    /* Add a start bit */
+    i2c_master_start(cmd);
+    /* Address the peripheral */
+    i2c_master_write_byte(cmd, (i2c_dev.addr << 1), ACK_CHECK_EN); 
+    /* Write register */
+    i2c_master_write_byte(cmd, i2c_reg, ACK_CHECK_EN);
+    /* Send repeated start */
+    i2c_master_start(cmd);
+    /* Readdress the peripheral */
+    i2c_master_write_byte(cmd, (i2c_dev.addr << 1) | READ_BIT, ACK_CHECK_EN); 
+    /* ACK all but last byte */
+    if (size > 1) {
+        i2c_master_read(cmd, data_rd, size - 1, ACK_VAL);
+    }
+    /* NACK the last byte */
+    i2c_master_read_byte(cmd, data_rd + size - 1, NACK_VAL);
+}
+
+/*!
+* 1. Add a (repeated) start bit
+* 2. Address peripheral by write byte
+* 3. Send N bytes of data, the register first
+*/
+static void i2c_esp_queue_write(i2c_cmd_handle_t cmd, i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size)
+{
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (i2c_dev.addr << 1) | WRITE_BIT, ACK_CHECK_EN);
+    i2c_master_write(cmd, data_wr, size, ACK_CHECK_EN);
+}
+
+/*!
+* Interpret ESP32 driver results
+*/
+static i2c_err_t i2c_esp_err(esp_err_t ret)
+{
+    switch(ret) {
+        case ESP_OK:
+            return I2C_SUCCESS;
+            break;
+        case I2C_INVALID_SETUP:
+            return I2C_INVALID_SETUP;
+            break;
+        case ESP_ERR_TIMEOUT:
+            return I2C_TIMEOUT;
+            break;
+        default:
+            return I2C_FAIL;
+    }
+}
+
+const i2c_backend_t i2c_utils_esp_backend = {
+    i2c_esp_setup,
+    i2c_esp_read,
+    i2c_esp_write,
+    i2c_esp_link_read,
+    i2c_esp_link_exec,
+    i2c_esp_link_destroy,
+    i2c_esp_link_batch,
+};
+
+#endif
+
@@ -0,0 +1,486 @@
+#include <string.h>
+#include "i2c_rec.h"
+#include "time_utils.h"
+
+#ifdef OTIS_HOST
+#include <pthread.h>
+#else
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#endif
+
+/* A TIME record: header and the u64 absolute time */
+#define I2C_REC_TIME_SIZE (I2C_REC_HEADER + 8)
+
+typedef struct i2c_rec_link_s {
+    i2c_link_t inner;
+    size_t count;
+    i2c_op_t ops[];
+} i2c_rec_link_t;
+
+static const i2c_backend_t *rec_inner = NULL;
+static uint8_t rec_running = 0;
+static volatile uint8_t rec_paused = 0;
+/* Time of the last record, and whether the log has set its clock yet */
+static uint64_t rec_prev_us = 0;
+static uint8_t rec_clock = 0;
+static i2c_rec_stats_t rec_stats;
+
+#ifdef OTIS_HOST
+static FILE *rec_file = NULL;
+#endif
+
+/* Ring memory: the records kept by i2c_rec_keep first, then the ring proper, where
+* rec_head is the oldest record and rec_fill the bytes in use; rec_base_us is the time
+* the oldest record's delta counts from */
+static uint8_t *rec_mem = NULL;
+static size_t rec_keep = 0;
+static uint8_t *rec_ring = NULL;
+static size_t rec_ring_size = 0;
+static size_t rec_head = 0;
+static size_t rec_fill = 0;
+static uint64_t rec_base_us = 0;
+
+#ifdef OTIS_HOST
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+#define REC_LOCK()   pthread_mutex_lock(&rec_lock)
+#define REC_UNLOCK() pthread_mutex_unlock(&rec_lock)
+#else
+static portMUX_TYPE rec_mux = portMUX_INITIALIZER_UNLOCKED;
+#define REC_LOCK()   portENTER_CRITICAL(&rec_mux)
+#define REC_UNLOCK() portEXIT_CRITICAL(&rec_mux)
+#endif
+
+static i2c_err_t i2c_rec_setup(i2c_peripheral_t i2c_setup);
+
+static i2c_err_t i2c_rec_bus_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size);
+
+static i2c_err_t i2c_rec_bus_write(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size);
+
+static i2c_err_t i2c_rec_link_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link);
+
+static i2c_err_t i2c_rec_link_exec(i2c_link_t link);
+
+static void i2c_rec_link_destroy(i2c_link_t *link);
+
+static i2c_err_t i2c_rec_link_batch(const i2c_op_t *ops, size_t count, i2c_link_t *link);
+
+static void i2c_rec_log(i2c_rec_type_t type, i2c_peripheral_t i2c_dev, uint8_t i2c_reg, const uint8_t *data, size_t size, i2c_err_t result);
+
+static uint8_t i2c_rec_emit(const uint8_t *header, const uint8_t *data, size_t size);
+
+static void i2c_rec_header(uint8_t *header, uint8_t type, uint8_t addr, uint8_t reg, uint8_t size, uint8_t result, uint32_t delta);
+
+static void i2c_rec_put_u64(uint8_t *buf, uint64_t v);
+
+static void i2c_rec_put_file_header(uint8_t *buf);
+
+static void i2c_rec_evict(void);
+
+static i2c_rec_err_t i2c_rec_begin(void);
+
+static const i2c_backend_t i2c_rec_backend = {
+    i2c_rec_setup,
+    i2c_rec_bus_read,
+    i2c_rec_bus_write,
+    i2c_rec_link_read,
+    i2c_rec_link_exec,
+    i2c_rec_link_destroy,
+    i2c_rec_link_batch,
+};
+
+#ifdef OTIS_HOST
+/*!
+* The file header goes out at once; records follow through the stdio buffer
+*/
+i2c_rec_err_t i2c_rec_start_file(const char *path){
+    if(rec_running)
+        return I2C_REC_RUNNING;
+    if(i2c_utils_get_backend() == NULL)
+        return I2C_REC_INVALID;
+    rec_file = fopen(path, "wb");
+    if(rec_file == NULL)
+        return I2C_REC_OPEN_FAIL;
+
+    uint8_t header[I2C_REC_FILE_HEADER];
+    i2c_rec_put_file_header(header);
+    if(fwrite(header, 1, sizeof(header), rec_file) != sizeof(header)){
+        fclose(rec_file);
+        rec_file = NULL;
+        return I2C_REC_OPEN_FAIL;
+    }
+    i2c_rec_err_t err = i2c_rec_begin();
+    rec_stats.bytes = sizeof(header);
+    return err;
+}
+#endif
+
+/*!
+* The ring must hold the largest record and a TIME record; it goes in PSRAM on target
+* when there is any, internal memory otherwise
+*/
+i2c_rec_err_t i2c_rec_start_ring(size_t size){
+    if(rec_running)
+        return I2C_REC_RUNNING;
+    if(i2c_utils_get_backend() == NULL || size < I2C_REC_TIME_SIZE + I2C_REC_HEADER + 0xFF)
+        return I2C_REC_INVALID;
+
+#ifdef OTIS_HOST
+    rec_mem = (uint8_t*)malloc(size);
+#else
+    rec_mem = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if(rec_mem == NULL)
+        rec_mem = (uint8_t*)malloc(size);
+#endif
+    if(rec_mem == NULL)
+        return I2C_REC_NMALLOC;
+    rec_keep = 0;
+    rec_ring = rec_mem;
+    rec_ring_size = size;
+    rec_head = 0;
+    rec_fill = 0;
+    rec_base_us = 0;
+    return i2c_rec_begin();
+}
+
+void i2c_rec_stop(void){
+    if(!rec_running)
+        return;
+    i2c_utils_set_backend(rec_inner);
+    REC_LOCK();
+    rec_running = 0;
+    REC_UNLOCK();
+#ifdef OTIS_HOST
+    if(rec_file){
+        fclose(rec_file);
+        rec_file = NULL;
+    }
+#endif
+    if(rec_mem){
+#ifdef OTIS_HOST
+        free(rec_mem);
+#else
+        heap_caps_free(rec_mem);
+#endif
+        rec_mem = NULL;
+        rec_ring = NULL;
+        rec_ring_size = 0;
+        rec_keep = 0;
+    }
+}
+
+/*!
+* The records so far move out of the ring: they stay at the start of the memory and
+* the ring starts after them, empty, counting from the last one's time
+*/
+i2c_rec_err_t i2c_rec_keep(void){
+    i2c_rec_err_t err = I2C_REC_SUCCESS;
+    REC_LOCK();
+    if(rec_mem == NULL || rec_keep != 0 || rec_stats.evicted != 0 || rec_ring_size - rec_fill < I2C_REC_TIME_SIZE + I2C_REC_HEADER + 0xFF){
+        err = I2C_REC_INVALID;
+    } else {
+        rec_keep = rec_fill;
+        rec_ring = rec_mem + rec_keep;
+        rec_ring_size -= rec_keep;
+        rec_head = 0;
+        rec_fill = 0;
+        rec_base_us = rec_prev_us;
+    }
+    REC_UNLOCK();
+    return err;
+}
+
+void i2c_rec_pause(uint8_t paused){
+    rec_paused = paused;
+}
+
+/*!
+* The memory read as a log file: the file header, the kept records, a TIME record of
+* the time the ring's oldest record counts from, then the ring from that record on
+*/
+size_t i2c_rec_read(size_t offset, uint8_t *buf, size_t size){
+    size_t copied = 0;
+    REC_LOCK();
+    if(rec_mem == NULL){
+        REC_UNLOCK();
+        return 0;
+    }
+
+    uint8_t file_header[I2C_REC_FILE_HEADER];
+    uint8_t base[I2C_REC_TIME_SIZE];
+    i2c_rec_put_file_header(file_header);
+    i2c_rec_header(base, I2C_REC_TIME, 0, 0, 8, I2C_SUCCESS, 0);
+    i2c_rec_put_u64(&base[I2C_REC_HEADER], rec_base_us);
+    const uint8_t *part[3] = {file_header, rec_mem, base};
+    const size_t part_size[3] = {sizeof(file_header), rec_keep, sizeof(base)};
+
+    for(int i = 0; i < 3; i++){
+        if(offset >= part_size[i]){
+            offset -= part_size[i];
+            continue;
+        }
+        size_t n = part_size[i] - offset;
+        if(n > size - copied)
+            n = size - copied;
+        memcpy(&buf[copied], &part[i][offset], n);
+        copied += n;
+        offset = 0;
+    }
+    while(copied < size && offset < rec_fill){
+        size_t pos = (rec_head + offset) % rec_ring_size;
+        size_t n = rec_fill - offset;
+        if(n > size - copied)
+            n = size - copied;
+        if(n > rec_ring_size - pos)
+            n = rec_ring_size - pos;
+        memcpy(&buf[copied], &rec_ring[pos], n);
+        copied += n;
+        offset += n;
+    }
+    REC_UNLOCK();
+    return copied;
+}
+
+void i2c_rec_stats(i2c_rec_stats_t *stats){
+    REC_LOCK();
+    *stats = rec_stats;
+    stats->size = rec_mem ? I2C_REC_FILE_HEADER + rec_keep + I2C_REC_TIME_SIZE + rec_fill : 0;
+    REC_UNLOCK();
+}
+
+i2c_rec_err_t i2c_rec_check(const uint8_t *log, size_t size){
+    if(size < I2C_REC_FILE_HEADER || memcmp(log, I2C_REC_MAGIC, sizeof(I2C_REC_MAGIC)) != 0)
+        return I2C_REC_INVALID;
+    if(((uint16_t)log[8] | ((uint16_t)log[9] << 8)) != I2C_REC_VERSION)
+        return I2C_REC_INVALID;
+    return I2C_REC_SUCCESS;
+}
+
+size_t i2c_rec_parse(const uint8_t *buf, size_t size, uint64_t *clock_us, i2c_rec_record_t *rec){
+    if(size < I2C_REC_HEADER || size < (size_t)I2C_REC_HEADER + buf[3])
+        return 0;
+    rec->type = (i2c_rec_type_t)(buf[0] & 0x0F);
+    rec->port = buf[0] >> 4;
+    rec->addr = buf[1];
+    rec->reg = buf[2];
+    rec->size = buf[3];
+    rec->result = (i2c_err_t)buf[4];
+    rec->data = &buf[I2C_REC_HEADER];
+    if(rec->type == I2C_REC_TIME && rec->size == 8){
+        uint64_t abs_us = 0;
+        for(int i = 7; i >= 0; i--)
+            abs_us = (abs_us << 8) | rec->data[i];
+        *clock_us = abs_us;
+    } else {
+        *clock_us += (uint32_t)buf[5] | ((uint32_t)buf[6] << 8) | ((uint32_t)buf[7] << 16);
+    }
+    rec->t_us = *clock_us;
+    return I2C_REC_HEADER + rec->size;
+}
+
+/*!
+* Common start: wrap the backend in use; the clock is set by the first record
+*/
+static i2c_rec_err_t i2c_rec_begin(void){
+    rec_inner = i2c_utils_get_backend();
+    rec_stats = (i2c_rec_stats_t){0};
+    rec_clock = 0;
+    rec_paused = 0;
+    rec_running = 1;
+    i2c_utils_set_backend(&i2c_rec_backend);
+    return I2C_REC_SUCCESS;
+}
+
+static i2c_err_t i2c_rec_setup(i2c_peripheral_t i2c_setup){
+    return rec_inner->setup(i2c_setup);
+}
+
+static i2c_err_t i2c_rec_bus_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size){
+    i2c_err_t ret = rec_inner->read(i2c_dev, i2c_reg, data_rd, size);
+    i2c_rec_log(I2C_REC_READ, i2c_dev, i2c_reg, data_rd, size, ret);
+    return ret;
+}
+
+static i2c_err_t i2c_rec_bus_write(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size){
+    i2c_err_t ret = rec_inner->write(i2c_dev, data_wr, size);
+    i2c_rec_log(I2C_REC_WRITE, i2c_dev, 0, data_wr, size, ret);
+    return ret;
+}
+
+static i2c_err_t i2c_rec_link_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link){
+    if(link == NULL)
+        return I2C_INVALID_SETUP;
+    i2c_rec_link_t *l = (i2c_rec_link_t*)malloc(sizeof(i2c_rec_link_t) + sizeof(i2c_op_t));
+    if(l == NULL)
+        return I2C_FAIL;
+    i2c_err_t ret = rec_inner->link_read(i2c_dev, i2c_reg, data_rd, size, &l->inner);
+    if(ret != I2C_SUCCESS){
+        free(l);
+        return ret;
+    }
+    l->count = 1;
+    l->ops[0] = (i2c_op_t){I2C_XFER_READ, i2c_dev, i2c_reg, data_rd, size};
+    *link = l;
+    return I2C_SUCCESS;
+}
+
+static i2c_err_t i2c_rec_link_batch(const i2c_op_t *ops, size_t count, i2c_link_t *link){
+    i2c_rec_link_t *l = (i2c_rec_link_t*)malloc(sizeof(i2c_rec_link_t) + count * sizeof(i2c_op_t));
+    if(l == NULL)
+        return I2C_FAIL;
+    i2c_err_t ret = rec_inner->link_batch(ops, count, &l->inner);
+    if(ret != I2C_SUCCESS){
+        free(l);
+        return ret;
+    }
+    l->count = count;
+    memcpy(l->ops, ops, count * sizeof(i2c_op_t));
+    *link = l;
+    return I2C_SUCCESS;
+}
+
+/*!
+* A failed execution is logged too, with whatever the buffer holds, so a replay fails
+* in the same place. A batch is logged as its transfers, one record each with the
+* batch's result: the log format does not know batches, and the bus cannot tell which
+* transfer failed.
+*/
+static i2c_err_t i2c_rec_link_exec(i2c_link_t link){
+    i2c_rec_link_t *l = (i2c_rec_link_t*)link;
+    if(l == NULL)
+        return I2C_INVALID_STATE;
+    i2c_err_t ret = rec_inner->link_exec(l->inner);
+    for(size_t i = 0; i < l->count; i++){
+        const i2c_op_t *op = &l->ops[i];
+        if(op->type == I2C_XFER_READ)
+            i2c_rec_log(I2C_REC_READ, op->i2c_dev, op->i2c_reg, op->data, op->size, ret);
+        else
+            i2c_rec_log(I2C_REC_WRITE, op->i2c_dev, 0, op->data, op->size, ret);
+    }
+    return ret;
+}
+
+static void i2c_rec_link_destroy(i2c_link_t *link){
+    if(link && *link){
+        i2c_rec_link_t *l = (i2c_rec_link_t*)*link;
+        rec_inner->link_destroy(&l->inner);
+        free(l);
+        *link = NULL;
+    }
+}
+
+/*!
+* Append a record
+*   1. Time after the transaction, read outside the lock
+*   2. A TIME record first on a new log or after a gap the u24 delta cannot hold
+*   3. The record
+*/
+static void i2c_rec_log(i2c_rec_type_t type, i2c_peripheral_t i2c_dev, uint8_t i2c_reg, const uint8_t *data, size_t size, i2c_err_t result){
+    /*! 1. Time */
+    uint64_t now = get_time_micros();
+
+    REC_LOCK();
+    if(!rec_running || rec_paused || size > 0xFF){
+        rec_stats.skipped++;
+        REC_UNLOCK();
+        return;
+    }
+
+    /*! 2. Clock */
+    uint8_t header[I2C_REC_HEADER];
+    if(!rec_clock || now - rec_prev_us > I2C_REC_MAX_DELTA){
+        uint8_t abs_us[8];
+        i2c_rec_put_u64(abs_us, now);
+        i2c_rec_header(header, I2C_REC_TIME, 0, 0, sizeof(abs_us), I2C_SUCCESS, 0);
+        if(!i2c_rec_emit(header, abs_us, sizeof(abs_us))){
+            rec_stats.skipped++;
+            REC_UNLOCK();
+            return;
+        }
+        rec_clock = 1;
+        rec_prev_us = now;
+    }
+
+    /*! 3. Record */
+    i2c_rec_header(header, (uint8_t)(type | (i2c_dev.port << 4)), i2c_dev.addr, i2c_reg, (uint8_t)size, (uint8_t)result,
+                   (uint32_t)(now - rec_prev_us));
+    if(i2c_rec_emit(header, data, size))
+        rec_prev_us = now;
+    else
+        rec_stats.skipped++;
+    REC_UNLOCK();
+}
+
+/*!
+* Write one record to the sink, making room in a ring first; call locked
+*/
+static uint8_t i2c_rec_emit(const uint8_t *header, const uint8_t *data, size_t size){
+    size_t n = I2C_REC_HEADER + size;
+#ifdef OTIS_HOST
+    if(rec_file){
+        if(fwrite(header, 1, I2C_REC_HEADER, rec_file) != I2C_REC_HEADER || fwrite(data, 1, size, rec_file) != size)
+            return 0;
+        rec_stats.records++;
+        rec_stats.bytes += n;
+        return 1;
+    }
+#endif
+    if(rec_ring == NULL)
+        return 0;
+    while(rec_ring_size - rec_fill < n)
+        i2c_rec_evict();
+    size_t pos = (rec_head + rec_fill) % rec_ring_size;
+    for(size_t i = 0; i < n; i++){
+        rec_ring[pos] = i < I2C_REC_HEADER ? header[i] : data[i - I2C_REC_HEADER];
+        pos = pos + 1 == rec_ring_size ? 0 : pos + 1;
+    }
+    rec_fill += n;
+    rec_stats.records++;
+    rec_stats.bytes += n;
+    return 1;
+}
+
+/*!
+* Drop the oldest record of the ring, moving the base time on to it
+*/
+static void i2c_rec_evict(void){
+    uint8_t header[I2C_REC_HEADER];
+    for(size_t i = 0; i < I2C_REC_HEADER; i++)
+        header[i] = rec_ring[(rec_head + i) % rec_ring_size];
+    size_t n = I2C_REC_HEADER + header[3];
+    if((header[0] & 0x0F) == I2C_REC_TIME){
+        uint64_t abs_us = 0;
+        for(int i = 7; i >= 0; i--)
+            abs_us = (abs_us << 8) | rec_ring[(rec_head + I2C_REC_HEADER + i) % rec_ring_size];
+        rec_base_us = abs_us;
+    } else {
+        rec_base_us += (uint32_t)header[5] | ((uint32_t)header[6] << 8) | ((uint32_t)header[7] << 16);
+    }
+    rec_head = (rec_head + n) % rec_ring_size;
+    rec_fill -= n;
+    rec_stats.evicted++;
+}
+
+static void i2c_rec_header(uint8_t *header, uint8_t type, uint8_t addr, uint8_t reg, uint8_t size, uint8_t result, uint32_t delta){
+    header[0] = type;
+    header[1] = addr;
+    header[2] = reg;
+    header[3] = size;
+    header[4] = result;
+    header[5] = delta & 0xFF;
+    header[6] = (delta >> 8) & 0xFF;
+    header[7] = (delta >> 16) & 0xFF;
+}
+
+static void i2c_rec_put_u64(uint8_t *buf, uint64_t v){
+    for(int i = 0; i < 8; i++)
+        buf[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void i2c_rec_put_file_header(uint8_t *buf){
+    memset(buf, 0, I2C_REC_FILE_HEADER);
+    memcpy(buf, I2C_REC_MAGIC, sizeof(I2C_REC_MAGIC));
+    buf[8] = I2C_REC_VERSION & 0xFF;
+    buf[9] = I2C_REC_VERSION >> 8;
+}
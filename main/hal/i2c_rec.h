@@ -0,0 +1,160 @@
+/*!
+* @file i2c_rec.h
+* @author Ethan Lew
+* @brief Recording of every bus transaction the drivers make, for replay
+*
+* The recorder is an i2c_utils backend wrapped around the one in use: each read,
+* write and link execution goes through to the real bus, then is appended to a log
+* with its time, device, register, result and the bytes that moved. The log holds
+* everything the drivers saw, from the WHO_AM_I probe to the last sample read, so
+* sim/i2c_replay.h can feed it back to the same drivers on Linux and the whole driver and
+* fusion stack runs again as it did in the field.
+*
+* Log format, all fields little-endian. A file header
+*
+*     offset  size  field
+*     0       8     magic "OTISI2C\0"
+*     8       2     version (I2C_REC_VERSION)
+*     10      2     reserved
+*
+* followed by records of an 8 byte header and size data bytes:
+*
+*     0       1     type (I2C_REC_*) | port << 4
+*     1       1     7 bit device address
+*     2       1     register (READ), 0 otherwise
+*     3       1     size
+*     4       1     result (i2c_err_t)
+*     5       3     time since the previous record (us, u24)
+*     8       size  READ: the bytes read; WRITE: the bytes written; TIME: absolute
+*                   time (us, u64)
+*
+* A TIME record sets the clock: the first record of a log, and any gap longer than
+* the u24 delta. A gyroscope sample is 15 bytes and an FXOS8700 sample 21. A batch
+* (i2c_utils_link_batch) is logged as its transfers, each with the batch's result.
+*
+* Two sinks:
+*   - a file (host), written through a stdio buffer as records come
+*   - a ring in memory, in PSRAM when there is any (target): the oldest records give
+*     way to new ones, so it holds the last ring size bytes before a problem. Call
+*     i2c_rec_keep once the devices are set up to keep their initialization out of
+*     the ring, so a dump can still be replayed from the start. Dump it with
+*     i2c_rec_read after i2c_rec_pause, e.g. as REC telemetry frames; the bytes are a
+*     log file as above.
+*
+* Start recording before the devices are set up, so links are built through the
+* recorder and the log begins with the initialization.
+*/
+
+#ifndef I2C_REC_H
+#define I2C_REC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "i2c_utils.h"
+
+#define I2C_REC_MAGIC "OTISI2C"
+#define I2C_REC_VERSION 1
+#define I2C_REC_FILE_HEADER 12
+#define I2C_REC_HEADER 8
+/* Largest delta of a record header (us) */
+#define I2C_REC_MAX_DELTA 0xFFFFFF
+
+typedef enum {
+    I2C_REC_READ = 0x1,
+    I2C_REC_WRITE = 0x2,
+    I2C_REC_TIME = 0x3,
+} i2c_rec_type_t;
+
+typedef enum {
+    I2C_REC_SUCCESS = 0x0,
+    I2C_REC_OPEN_FAIL = 0x1,
+    I2C_REC_NMALLOC = 0x2,
+    I2C_REC_RUNNING = 0x3,
+    I2C_REC_INVALID = 0x4,
+} i2c_rec_err_t;
+
+/*!
+* Recorder counters
+*/
+typedef struct i2c_rec_stats_s {
+    uint32_t records;    /**< Records logged */
+    uint64_t bytes;      /**< Log bytes written, headers included */
+    uint32_t evicted;    /**< Oldest records overwritten in the ring */
+    uint32_t skipped;    /**< Transactions not logged: paused, over 255 bytes, or a write error */
+    size_t size;         /**< Bytes i2c_rec_read can return (ring) */
+} i2c_rec_stats_t;
+
+/*!
+* A record read back from a log
+*/
+typedef struct i2c_rec_record_s {
+    i2c_rec_type_t type;
+    uint8_t port;
+    uint8_t addr;
+    uint8_t reg;
+    uint8_t size;
+    i2c_err_t result;
+    uint64_t t_us;          /**< Absolute time, the clock after this record */
+    const uint8_t *data;    /**< size bytes, in the log */
+} i2c_rec_record_t;
+
+#ifdef OTIS_HOST
+/*!
+* @brief record into a new file, wrapping the current backend
+* @returns recorder status
+*/
+i2c_rec_err_t i2c_rec_start_file(const char *path);
+#endif
+
+/*!
+* @brief record into a memory ring of size bytes, wrapping the current backend
+* @returns recorder status, I2C_REC_NMALLOC if the ring cannot be allocated
+*/
+i2c_rec_err_t i2c_rec_start_ring(size_t size);
+
+/*!
+* @brief stop recording and put the wrapped backend back; a file is closed, a ring
+* freed. Destroy the devices first: the links built while recording are the
+* recorder's.
+*/
+void i2c_rec_stop(void);
+
+/*!
+* @brief keep the records logged so far, the device setup, when the ring wraps
+* @returns I2C_REC_INVALID if not a ring, already kept or wrapped, or too little
+* room would be left
+*/
+i2c_rec_err_t i2c_rec_keep(void);
+
+/*!
+* @brief hold the log still (transactions still run, unrecorded), e.g. while the
+* ring is read out
+*/
+void i2c_rec_pause(uint8_t paused);
+
+/*!
+* @brief copy bytes of the ring's log from offset on, file header included
+* @returns the number of bytes copied, 0 past the end
+*/
+size_t i2c_rec_read(size_t offset, uint8_t *buf, size_t size);
+
+/*!
+* @brief counters since the recording started
+*/
+void i2c_rec_stats(i2c_rec_stats_t *stats);
+
+/*!
+* @brief check a log's file header
+* @returns I2C_REC_SUCCESS, I2C_REC_INVALID for a bad magic or version
+*/
+i2c_rec_err_t i2c_rec_check(const uint8_t *log, size_t size);
+
+/*!
+* @brief decode the record at the start of buf
+* @param clock_us the log clock, advanced past the record
+* @param rec the record, its data pointing into buf
+* @returns the record's length, 0 if buf ends inside it
+*/
+size_t i2c_rec_parse(const uint8_t *buf, size_t size, uint64_t *clock_us, i2c_rec_record_t *rec);
+
+#endif
@@ -9,16 +9,21 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#ifndef OTIS_HOST
 #include "driver/i2c.h"
 #include "sdkconfig.h"
+#endif
 
+#define I2C_MASTER_FAST_FREQ_HZ 400000        /*!< I2C master clock frequency */
+#define I2C_MASTER_NORMAL_FREQ_HZ 100000        /*!< I2C master clock frequency */
+#define I2C_MASTER_PORT 0                     /*!< controller the sensors are wired to */
+#define I2C_PORT_COUNT 2                      /*!< number of i2c controllers */
 
+#ifndef OTIS_HOST
 #define _I2C_NUMBER(num) I2C_NUM_##num
 #define I2C_NUMBER(num) _I2C_NUMBER(num)
 
-#define I2C_MASTER_FAST_FREQ_HZ 400000        /*!< I2C master clock frequency */
-#define I2C_MASTER_NORMAL_FREQ_HZ 100000        /*!< I2C master clock frequency */
-
 #define I2C_SLAVE_NUM I2C_NUMBER(1) /*!< I2C port number for slave dev */
 #define I2C_MASTER_NUM I2C_NUMBER(0) /*!< I2C port number for master dev */
 
@@ -26,6 +31,8 @@
 #define I2C_MASTER_SDA_IO 21               /*!< gpio number for I2C master data  */
 #define I2C_SLAVE_SCL_IO 36               /*!< gpio number for i2c slave clock */
 #define I2C_SLAVE_SDA_IO 39               /*!< gpio number for i2c slave data */
+#define I2C_MASTER1_SCL_IO 18             /*!< gpio number for a second master bus clock */
+#define I2C_MASTER1_SDA_IO 19             /*!< gpio number for a second master bus data */
 
 #define I2C_MASTER_TX_BUF_DISABLE 0                           /*!< I2C master doesn't need buffer */
 #define I2C_MASTER_RX_BUF_DISABLE 0                           /*!< I2C master doesn't need buffer */
@@ -36,6 +43,7 @@
 #define ACK_CHECK_DIS 0x0                       /*!< I2C master will not check ack from slave */
 #define ACK_VAL 0x0                             /*!< I2C ack value */
 #define NACK_VAL 0x1                            /*!< I2C nack value */
+#endif
 
 /*!
 * The driver should be installed ONCE, so do no reinstall if a new device is added
@@ -53,6 +61,7 @@ typedef enum {
 /*!
 * Parameters of the i2c peripheral 
 * To setup the ESP32 peripheral, it is necessary to specify
+*   port (eg        I2C_MASTER_PORT, the controller of the bus)
 *   addr (eg        I2C_ADDRESS)
 *   mode (eg        I2C_MODE_MASTER/I2C_MODE_SLAVE)
 *   clk_speed (eg   I2C_MASTER_FREQ_HZ)
@@ -60,6 +69,7 @@ typedef enum {
 *   rx_buffer_len (eg  I2C_MASTER_RX_BUF_DISABLE/I2C_SLAVE_RX_BUF_LEN)
 */
 typedef struct i2c_peripheral_s {
+    uint8_t port;
     uint8_t addr;
     i2c_mode_type_t mode;
     uint32_t clk_speed;
@@ -67,6 +77,14 @@ typedef struct i2c_peripheral_s {
     size_t rx_buff_len;
 } i2c_peripheral_t;
 
+/*!
+* A prebuilt transaction. Links are built once, outside the sampling path, and can be
+* executed any number of times; each execution transfers into the buffer given at
+* build time. The link is opaque and owned by the backend, which also records the
+* port it runs on.
+*/
+typedef void* i2c_link_t;
+
 /*!
 * Generic i2c errors
 */
@@ -77,8 +95,98 @@ typedef enum {
     I2C_TIMEOUT = 0x3,
     I2C_INVALID_STATE = 0x4,
     I2C_FAIL = 0x5,
+    I2C_QUEUE_FULL = 0x6,
 } i2c_err_t;
 
+/*!
+* Transaction kinds accepted by i2c_utils_submit
+*/
+typedef enum {
+    I2C_XFER_READ = 0x0,  /**< Read size bytes from reg into data */
+    I2C_XFER_WRITE = 0x1, /**< Write size bytes from data (register first) */
+    I2C_XFER_LINK = 0x2,  /**< Execute a prebuilt link */
+} i2c_xfer_type_t;
+
+/*!
+* One transfer of a batch (i2c_utils_link_batch): a register read or a write
+*/
+typedef struct i2c_op_s {
+    i2c_xfer_type_t type;      /**< I2C_XFER_READ or I2C_XFER_WRITE */
+    i2c_peripheral_t i2c_dev;  /**< Target device */
+    uint8_t i2c_reg;           /**< Start register (READ) */
+    uint8_t *data;             /**< Read buffer, or bytes to write register first; must outlive the link */
+    size_t size;               /**< Bytes to transfer */
+} i2c_op_t;
+
+/*!
+* Bus operations behind every i2c_utils call and the transaction engine. The default
+* backend is the blocking ESP32 driver (i2c_esp.c); host builds install a simulated
+* bus with i2c_utils_set_backend, so the sensor drivers run unmodified on Linux.
+*/
+typedef struct i2c_backend_s {
+    i2c_err_t (*setup)(i2c_peripheral_t i2c_setup);
+    i2c_err_t (*read)(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size);
+    i2c_err_t (*write)(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size);
+    i2c_err_t (*link_read)(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link);
+    i2c_err_t (*link_exec)(i2c_link_t link);
+    void (*link_destroy)(i2c_link_t *link);
+    i2c_err_t (*link_batch)(const i2c_op_t *ops, size_t count, i2c_link_t *link);
+} i2c_backend_t;
+
+struct i2c_xfer_s;
+
+/*!
+* Completion callback, run on the bus task once a transaction finished. busy is
+* already cleared, so the callback may resubmit the transaction.
+*/
+typedef void (*i2c_xfer_cb_t)(struct i2c_xfer_s *xfer);
+
+/*!
+* An asynchronous transaction. The caller owns the storage, which must stay valid
+* (and unmodified) until the transaction completes.
+*/
+typedef struct i2c_xfer_s {
+    i2c_xfer_type_t type;      /**< What to do */
+    i2c_peripheral_t i2c_dev;  /**< Target device (READ/WRITE) */
+    uint8_t i2c_reg;           /**< Start register (READ) */
+    uint8_t *data;             /**< Data buffer (READ/WRITE) */
+    size_t size;               /**< Bytes to transfer (READ/WRITE) */
+    i2c_link_t link;           /**< Prebuilt link (LINK) */
+    i2c_xfer_cb_t done;        /**< Completion callback, may be NULL */
+    void *ctx;                 /**< User context for the callback */
+#ifndef OTIS_HOST
+    TaskHandle_t notify;       /**< Task notified on completion, may be NULL */
+    uint32_t notify_bit;       /**< Notification bit set on completion */
+#endif
+    volatile uint8_t busy;     /**< Non-zero from submit until completion */
+    volatile i2c_err_t result; /**< Transaction result, valid once busy is cleared */
+} i2c_xfer_t;
+
+/* Depth of the transaction ring (power of two) */
+#define I2C_ENGINE_RING_SIZE 16
+
+/*!
+* Engine counters
+*/
+typedef struct i2c_engine_stats_s {
+    uint32_t submitted;  /**< Transactions accepted */
+    uint32_t completed;  /**< Transactions executed */
+    uint32_t rejected;   /**< Submissions refused because the ring was full */
+    uint32_t errors;     /**< Transactions that did not return I2C_SUCCESS */
+    uint32_t max_depth;  /**< Deepest the ring has been */
+} i2c_engine_stats_t;
+
+
+/*!
+* @brief select the bus backend; call before any device is set up
+* @param backend the bus operations
+*/
+void i2c_utils_set_backend(const i2c_backend_t *backend);
+
+/*!
+* @brief the current bus backend, NULL on host until one is set
+*/
+const i2c_backend_t *i2c_utils_get_backend(void);
 
 /*!
 * @brief setup an i2c peripheral before use in master mode
@@ -105,4 +213,83 @@ i2c_err_t i2c_utils_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *dat
 */
 i2c_err_t i2c_utils_write(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size);
 
+/*!
+* @brief build a reusable register read transaction (master mode)
+* @param i2c_dev the target peripheral parameters
+* @param i2c_reg the first register to read
+* @param data_rd the read data buffer, must outlive the link
+* @param size the number of bytes read
+* @param link the prebuilt link
+* @returns i2c status
+*/
+i2c_err_t i2c_utils_link_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link);
+
+/*!
+* @brief execute a prebuilt link without allocating
+* @param link the prebuilt link
+* @returns i2c status
+*/
+i2c_err_t i2c_utils_link_exec(i2c_link_t link);
+
+/*!
+* @brief release a prebuilt link
+* @param link the prebuilt link, set to NULL
+*/
+void i2c_utils_link_destroy(i2c_link_t *link);
+
+/*!
+* @brief build a reusable transaction of several transfers, to one or more devices on
+* one port, run in order in a single bus transaction: one command link on the ESP32,
+* repeated starts between the transfers and one stop at the end
+* Execute it with i2c_utils_link_exec (or queue it as an I2C_XFER_LINK), release it
+* with i2c_utils_link_destroy. The first transfer that fails ends the transaction, and
+* its error is the link's: which one failed is not known.
+* @param ops the transfers, copied; their buffers must outlive the link
+* @param count the number of transfers
+* @param link the prebuilt link
+* @returns i2c status, I2C_INVALID_SETUP for no transfers, an empty one or several ports
+*/
+i2c_err_t i2c_utils_link_batch(const i2c_op_t *ops, size_t count, i2c_link_t *link);
+
+/*!
+* @brief run transfers once as one bus transaction, e.g. a register sequence that
+* configures a device; see i2c_utils_link_batch
+* @returns i2c status
+*/
+i2c_err_t i2c_utils_batch(const i2c_op_t *ops, size_t count);
+
+#ifndef OTIS_HOST
+/*!
+* @brief the blocking ESP32 backend
+*/
+extern const i2c_backend_t i2c_utils_esp_backend;
+#endif
+
+/*!
+* @brief start the bus owner task
+* @param backend the bus operations, NULL for the current i2c_utils backend
+* @param priority the bus task priority
+* @returns i2c status
+*/
+i2c_err_t i2c_utils_engine_start(const i2c_backend_t *backend, uint32_t priority);
+
+/*!
+* @brief stop the bus owner task once queued transactions have run
+*/
+void i2c_utils_engine_stop(void);
+
+/*!
+* @brief queue a transaction without blocking
+* Transactions are executed in submission order by the bus task, which then runs
+* xfer->done and notifies xfer->notify.
+* @param xfer the transaction
+* @returns I2C_SUCCESS when queued, I2C_QUEUE_FULL if the ring is full
+*/
+i2c_err_t i2c_utils_submit(i2c_xfer_t *xfer);
+
+/*!
+* @brief snapshot of the engine counters
+*/
+void i2c_utils_engine_stats(i2c_engine_stats_t *stats);
+
 #endif
\ No newline at end of file
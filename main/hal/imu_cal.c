@@ -0,0 +1,191 @@
+#include <string.h>
+#include "imu_cal.h"
+
+#ifdef OTIS_HOST
+#include <stdio.h>
+#include <stdlib.h>
+#else
+#include "nvs.h"
+#endif
+
+/* Offsets into the record */
+#define IMU_CAL_AT_VERSION 4
+#define IMU_CAL_AT_SIZE 6
+#define IMU_CAL_AT_FLAGS 8
+#define IMU_CAL_AT_COEFFS 12
+#define IMU_CAL_AT_CRC (IMU_CAL_RECORD_SIZE - 4)
+
+#ifdef OTIS_HOST
+static const char *imu_cal_path;
+#endif
+
+static uint32_t imu_cal_crc32(const uint8_t *data, size_t size);
+
+static void imu_cal_put32(uint8_t *p, uint32_t v);
+
+static uint32_t imu_cal_get32(const uint8_t *p);
+
+void imu_cal_identity(imu_cal_t *cal){
+    memset(cal, 0, sizeof(imu_cal_t));
+    for(int i = 0; i < 3; i++)
+        cal->accel_gain[i] = 1.0F;
+}
+
+/*!
+* Little endian throughout, floats as their IEEE-754 bits, so the record reads the
+* same on target and host
+*/
+void imu_cal_encode(const imu_cal_t *cal, uint8_t *record){
+    const float *coeffs[3] = {cal->gyro_bias, cal->accel_offset, cal->accel_gain};
+    imu_cal_put32(record, IMU_CAL_MAGIC);
+    record[IMU_CAL_AT_VERSION] = IMU_CAL_VERSION & 0xFF;
+    record[IMU_CAL_AT_VERSION + 1] = IMU_CAL_VERSION >> 8;
+    record[IMU_CAL_AT_SIZE] = IMU_CAL_RECORD_SIZE & 0xFF;
+    record[IMU_CAL_AT_SIZE + 1] = IMU_CAL_RECORD_SIZE >> 8;
+    imu_cal_put32(record + IMU_CAL_AT_FLAGS, cal->flags);
+    uint8_t *p = record + IMU_CAL_AT_COEFFS;
+    for(int c = 0; c < 3; c++){
+        for(int i = 0; i < 3; i++){
+            uint32_t bits;
+            memcpy(&bits, &coeffs[c][i], sizeof(bits));
+            imu_cal_put32(p, bits);
+            p += 4;
+        }
+    }
+    imu_cal_put32(record + IMU_CAL_AT_CRC, imu_cal_crc32(record, IMU_CAL_AT_CRC));
+}
+
+/*!
+* Checked in the order that tells the causes apart: the magic and the CRC say
+* whether these are our bytes at all, then the version and size whether this build
+* can read them
+*/
+imu_cal_err_t imu_cal_decode(const uint8_t *record, size_t size, imu_cal_t *cal){
+    if(size < IMU_CAL_AT_COEFFS || imu_cal_get32(record) != IMU_CAL_MAGIC)
+        return IMU_CAL_CORRUPT;
+    uint16_t version = (uint16_t)(record[IMU_CAL_AT_VERSION] | (record[IMU_CAL_AT_VERSION + 1] << 8));
+    uint16_t stored = (uint16_t)(record[IMU_CAL_AT_SIZE] | (record[IMU_CAL_AT_SIZE + 1] << 8));
+    if(stored != size)
+        return IMU_CAL_CORRUPT;
+    if(imu_cal_get32(record + size - 4) != imu_cal_crc32(record, size - 4))
+        return IMU_CAL_CORRUPT;
+    if(version != IMU_CAL_VERSION || size != IMU_CAL_RECORD_SIZE)
+        return IMU_CAL_VERSION_MISMATCH;
+
+    float *coeffs[3] = {cal->gyro_bias, cal->accel_offset, cal->accel_gain};
+    cal->flags = imu_cal_get32(record + IMU_CAL_AT_FLAGS);
+    const uint8_t *p = record + IMU_CAL_AT_COEFFS;
+    for(int c = 0; c < 3; c++){
+        for(int i = 0; i < 3; i++){
+            uint32_t bits = imu_cal_get32(p);
+            memcpy(&coeffs[c][i], &bits, sizeof(bits));
+            p += 4;
+        }
+    }
+    return IMU_CAL_SUCCESS;
+}
+
+#ifdef OTIS_HOST
+void imu_cal_set_path(const char *path){
+    imu_cal_path = path;
+}
+
+imu_cal_err_t imu_cal_load(imu_cal_t *cal){
+    if(!imu_cal_path)
+        return IMU_CAL_NONE;
+    FILE *f = fopen(imu_cal_path, "rb");
+    if(!f)
+        return IMU_CAL_NONE;
+    /* One byte more than a record, so a longer one is seen as such */
+    uint8_t record[IMU_CAL_RECORD_SIZE + 1];
+    size_t n = fread(record, 1, sizeof(record), f);
+    fclose(f);
+    return imu_cal_decode(record, n, cal);
+}
+
+/*!
+* Write a temporary next to the file and rename it over, so a crash leaves the old
+* record or the new one
+*/
+imu_cal_err_t imu_cal_store(const imu_cal_t *cal){
+    if(!imu_cal_path)
+        return IMU_CAL_NONE;
+    uint8_t record[IMU_CAL_RECORD_SIZE];
+    imu_cal_encode(cal, record);
+
+    size_t len = strlen(imu_cal_path);
+    char *tmp = (char*)malloc(len + 5);
+    if(!tmp)
+        return IMU_CAL_IO_FAIL;
+    memcpy(tmp, imu_cal_path, len);
+    memcpy(tmp + len, ".tmp", 5);
+    imu_cal_err_t ret = IMU_CAL_IO_FAIL;
+    FILE *f = fopen(tmp, "wb");
+    if(f){
+        size_t n = fwrite(record, 1, sizeof(record), f);
+        if(fclose(f) == 0 && n == sizeof(record) && rename(tmp, imu_cal_path) == 0)
+            ret = IMU_CAL_SUCCESS;
+        else
+            remove(tmp);
+    }
+    free(tmp);
+    return ret;
+}
+#else
+imu_cal_err_t imu_cal_load(imu_cal_t *cal){
+    nvs_handle handle;
+    if(nvs_open(IMU_CAL_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return IMU_CAL_NONE;
+    uint8_t record[IMU_CAL_RECORD_SIZE + 1];
+    size_t n = sizeof(record);
+    esp_err_t err = nvs_get_blob(handle, IMU_CAL_NVS_KEY, record, &n);
+    nvs_close(handle);
+    if(err == ESP_ERR_NVS_NOT_FOUND)
+        return IMU_CAL_NONE;
+    if(err == ESP_ERR_NVS_INVALID_LENGTH)
+        return IMU_CAL_VERSION_MISMATCH;
+    if(err != ESP_OK)
+        return IMU_CAL_IO_FAIL;
+    return imu_cal_decode(record, n, cal);
+}
+
+/*!
+* NVS keeps the previous blob until the new one is committed
+*/
+imu_cal_err_t imu_cal_store(const imu_cal_t *cal){
+    uint8_t record[IMU_CAL_RECORD_SIZE];
+    imu_cal_encode(cal, record);
+    nvs_handle handle;
+    if(nvs_open(IMU_CAL_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+        return IMU_CAL_IO_FAIL;
+    esp_err_t err = nvs_set_blob(handle, IMU_CAL_NVS_KEY, record, sizeof(record));
+    if(err == ESP_OK)
+        err = nvs_commit(handle);
+    nvs_close(handle);
+    return err == ESP_OK ? IMU_CAL_SUCCESS : IMU_CAL_IO_FAIL;
+}
+#endif
+
+/*!
+* CRC-32 (IEEE 802.3, reflected), bit by bit: the record is read once at init
+*/
+static uint32_t imu_cal_crc32(const uint8_t *data, size_t size){
+    uint32_t crc = 0xFFFFFFFFU;
+    for(size_t i = 0; i < size; i++){
+        crc ^= data[i];
+        for(int b = 0; b < 8; b++)
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+    }
+    return ~crc;
+}
+
+static void imu_cal_put32(uint8_t *p, uint32_t v){
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t imu_cal_get32(const uint8_t *p){
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
@@ -0,0 +1,94 @@
+/*!
+* @file imu_cal.h
+* @author Ethan Lew
+* @brief Stored gyroscope bias and accelerometer offset/gain calibration
+*
+* The coefficients are corrections the drivers apply in their conversion:
+*
+*     gyro  = rate - gyro_bias                      (rad/s)
+*     accel = (accel - accel_offset) * accel_gain   (m/s^2, per axis)
+*
+* They are kept as one versioned binary record: a magic, the version and size of the
+* layout, the coefficients and a CRC-32 of all of it. A record that does not check
+* out is treated as absent, so a layout change only costs one recalibration. On
+* target the record is a blob in NVS (nvs_flash_init must have run); on host builds
+* it is a file, written to a temporary and renamed into place, once a path is set
+* with imu_cal_set_path.
+*
+* gyro_init and the construction of the FXOS8700 at its default address load the
+* stored record, so the filters start with corrected sensors.
+*/
+
+#ifndef IMU_CAL_H
+#define IMU_CAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Parts of a calibration */
+#define IMU_CAL_GYRO  (0x01)         /**< gyro_bias is valid */
+#define IMU_CAL_ACCEL (0x02)         /**< accel_offset and accel_gain are valid */
+
+#define IMU_CAL_MAGIC (0x4C43544FU)  /**< "OTCL" */
+#define IMU_CAL_VERSION 1
+/* Record: magic, version, size, flags, 9 coefficients, CRC */
+#define IMU_CAL_RECORD_SIZE (4 + 2 + 2 + 4 + 9 * 4 + 4)
+
+#define IMU_CAL_NVS_NAMESPACE "otis"
+#define IMU_CAL_NVS_KEY "imu_cal"
+
+typedef enum {
+    IMU_CAL_SUCCESS = 0x0,
+    IMU_CAL_NONE = 0x1,              /**< Nothing stored, or no storage selected */
+    IMU_CAL_CORRUPT = 0x2,           /**< Bad magic, size or CRC */
+    IMU_CAL_VERSION_MISMATCH = 0x3,  /**< Stored by another layout version */
+    IMU_CAL_IO_FAIL = 0x4,
+} imu_cal_err_t;
+
+typedef struct imu_cal_s {
+    uint32_t flags;                  /**< IMU_CAL_* parts that are valid */
+    float gyro_bias[3];              /**< rad/s, subtracted */
+    float accel_offset[3];           /**< m/s^2, subtracted */
+    float accel_gain[3];             /**< Multiplied after the offset */
+} imu_cal_t;
+
+/*!
+* @brief no correction: zero bias and offset, unit gain, no parts valid
+*/
+void imu_cal_identity(imu_cal_t *cal);
+
+/*!
+* @brief serialize a calibration into an IMU_CAL_RECORD_SIZE byte record
+*/
+void imu_cal_encode(const imu_cal_t *cal, uint8_t *record);
+
+/*!
+* @brief check and parse a record
+* @param record the bytes
+* @param size their number
+* @param cal the calibration, untouched on error
+* @returns IMU_CAL_CORRUPT or IMU_CAL_VERSION_MISMATCH if the record is not usable
+*/
+imu_cal_err_t imu_cal_decode(const uint8_t *record, size_t size, imu_cal_t *cal);
+
+/*!
+* @brief read the stored calibration
+* @returns imu_cal status, IMU_CAL_NONE if there is none
+*/
+imu_cal_err_t imu_cal_load(imu_cal_t *cal);
+
+/*!
+* @brief replace the stored calibration
+* On target this writes flash; do it when the coefficients changed, not per sample.
+* @returns imu_cal status
+*/
+imu_cal_err_t imu_cal_store(const imu_cal_t *cal);
+
+#ifdef OTIS_HOST
+/*!
+* @brief keep the calibration in the file at path, NULL (the default) for none
+*/
+void imu_cal_set_path(const char *path);
+#endif
+
+#endif
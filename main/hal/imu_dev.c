@@ -0,0 +1,142 @@
+/*!
+* @file imu_dev.c
+* @author Ethan Lew
+* @brief Sensor-agnostic device interface
+*/
+
+#include <string.h>
+#include "imu_dev.h"
+
+static void imu_dev_queue_done(i2c_xfer_t *xfer);
+
+imu_dev_err_t imu_dev_open(imu_dev_t *dev, const imu_dev_ops_t *ops){
+    if(!dev || !ops)
+        return IMU_DEV_NMALLOC;
+    memset(dev, 0, sizeof(imu_dev_t));
+    dev->ops = ops;
+    return ops->init(dev);
+}
+
+imu_dev_err_t imu_dev_sample_link(imu_dev_t *const *devs, size_t count, i2c_link_t *link){
+    i2c_op_t ops[IMU_DEV_LINK_MAX];
+    if(!devs || !link)
+        return IMU_DEV_NMALLOC;
+    if(count == 0 || count > IMU_DEV_LINK_MAX)
+        return IMU_DEV_UNSUPPORTED;
+    for(size_t i = 0; i < count; i++){
+        imu_dev_err_t ret = imu_dev_sample_op(devs[i], &ops[i]);
+        if(ret != IMU_DEV_SUCCESS)
+            return ret;
+    }
+    switch(i2c_utils_link_batch(ops, count, link)){
+        case I2C_SUCCESS: return IMU_DEV_SUCCESS;
+        case I2C_INVALID_SETUP: return IMU_DEV_UNSUPPORTED;
+        case I2C_FAIL: return IMU_DEV_NMALLOC;
+        default: return IMU_DEV_BUS_FAIL;
+    }
+}
+
+/*!
+* Each read is a one device sample link, so the queue takes the same devices as a
+* batch, and sample_done converts the bytes either way
+*/
+imu_dev_err_t imu_dev_queue_init(imu_dev_queue_t *queue, imu_dev_t *const *devs, size_t count){
+    if(!queue || !devs)
+        return IMU_DEV_NMALLOC;
+    if(count == 0 || count > IMU_DEV_LINK_MAX)
+        return IMU_DEV_UNSUPPORTED;
+    memset(queue, 0, sizeof(imu_dev_queue_t));
+    if(os_signal_init(&queue->done) != OS_SUCCESS)
+        return IMU_DEV_NMALLOC;
+    for(size_t i = 0; i < count; i++){
+        imu_dev_err_t ret = imu_dev_sample_link(&devs[i], 1, &queue->links[i]);
+        if(ret != IMU_DEV_SUCCESS){
+            imu_dev_queue_destroy(queue);
+            return ret;
+        }
+        queue->devs[i] = devs[i];
+        queue->xfers[i].type = I2C_XFER_LINK;
+        queue->xfers[i].link = queue->links[i];
+        queue->xfers[i].done = imu_dev_queue_done;
+        queue->xfers[i].ctx = queue;
+        queue->count = i + 1;
+    }
+    return IMU_DEV_SUCCESS;
+}
+
+imu_dev_err_t imu_dev_queue_submit(imu_dev_queue_t *queue){
+    imu_dev_err_t err = IMU_DEV_SUCCESS;
+    for(size_t i = 0; i < queue->count; i++){
+        i2c_xfer_t *xfer = &queue->xfers[i];
+        if(__atomic_load_n(&xfer->busy, __ATOMIC_ACQUIRE)){
+            err = IMU_DEV_BUS_FAIL;
+            continue;
+        }
+        /* Stays failed unless the engine takes the read */
+        xfer->result = I2C_FAIL;
+        if(i2c_utils_submit(xfer) != I2C_SUCCESS)
+            err = IMU_DEV_BUS_FAIL;
+    }
+    return err;
+}
+
+/*!
+* Collecting works as follows
+*   1. Sleep on the signal until no read is in flight; a give only wakes the wait, so
+*      the busy flags decide
+*   2. Hand each device its read's result, in device order, and merge what converted
+*/
+imu_dev_err_t imu_dev_queue_collect(imu_dev_queue_t *queue, imu_sample_t *sample, uint32_t timeout_us){
+    uint64_t deadline = get_time_micros() + timeout_us;
+    for(size_t i = 0; i < queue->count; i++){
+        while(__atomic_load_n(&queue->xfers[i].busy, __ATOMIC_ACQUIRE)){
+            uint64_t now = get_time_micros();
+            if(now >= deadline || !os_signal_wait(&queue->done, (uint32_t)(deadline - now))){
+                if(__atomic_load_n(&queue->xfers[i].busy, __ATOMIC_ACQUIRE))
+                    return IMU_DEV_BUS_FAIL;
+            }
+        }
+    }
+
+    imu_dev_err_t err = IMU_DEV_SUCCESS;
+    imu_sample_t reading;
+    for(size_t i = 0; i < queue->count; i++){
+        imu_dev_err_t ret = imu_dev_sample_done(queue->devs[i], queue->xfers[i].result, &reading);
+        if(ret == IMU_DEV_SUCCESS)
+            imu_dev_merge(sample, &reading);
+        else
+            err = ret;
+    }
+    return err;
+}
+
+void imu_dev_queue_destroy(imu_dev_queue_t *queue){
+    for(size_t i = 0; i < IMU_DEV_LINK_MAX; i++)
+        i2c_utils_link_destroy(&queue->links[i]);
+    os_signal_destroy(&queue->done);
+    queue->count = 0;
+}
+
+void imu_dev_merge(imu_sample_t *dst, const imu_sample_t *src){
+    if(src->status & IMU_DEV_GYRO){
+        dst->gyro = src->gyro;
+        dst->gyro_raw = src->gyro_raw;
+    }
+    if(src->status & IMU_DEV_ACCEL){
+        dst->accel = src->accel;
+        dst->accel_raw = src->accel_raw;
+    }
+    if(src->status & IMU_DEV_MAGN){
+        dst->magn = src->magn;
+        dst->magn_raw = src->magn_raw;
+    }
+    dst->status |= src->status;
+}
+
+/*!
+* Runs on the bus task once a read completed
+*/
+static void imu_dev_queue_done(i2c_xfer_t *xfer){
+    imu_dev_queue_t *queue = (imu_dev_queue_t*)xfer->ctx;
+    os_signal_give(&queue->done);
+}
@@ -0,0 +1,246 @@
+/*!
+* @file imu_dev.h
+* @author Ethan Lew
+* @brief Sensor-agnostic device interface
+*
+* Every sensor driver exposes the same operations through an imu_dev_ops_t table:
+* init, configure, read_batch, self_test, calibrate and destroy. A device reports which of the
+* gyroscope, accelerometer and magnetometer it provides, and read_batch returns
+* imu_sample_t records with only those sensors flagged valid, so a combo chip and a
+* single sensor part look the same to the sampling code. Adding a part (an LSM6DSx,
+* a BMI270, ...) means writing one adapter with these six functions, or eight with
+* the optional sample_op and sample_done below. calibrate applies the parts of an
+* imu_cal_t that concern the device's sensors.
+*
+* Two more, sample_op and sample_done, are optional (NULL, or IMU_DEV_UNSUPPORTED in
+* modes without single sample reads): they split a single sample read in two, so the
+* reads of several devices on one bus can go out as one transaction
+* (imu_dev_sample_link) and each device then converts its own bytes, or be queued
+* back to back on the I2C transaction engine (imu_dev_queue_t).
+*
+* Devices fill two roles, IMU_GYRO and IMU_ACCEL (accelerometer, plus magnetometer
+* when the part has one). Calls made through IMU_GYRO_CALL / IMU_ACCEL_CALL are
+*   - dispatched through the ops table when IMU_DEV_STATIC is 0, so drivers can be
+*     chosen at run time
+*   - direct calls to the role's driver (IMU_GYRO_DRIVER, IMU_ACCEL_DRIVER) when
+*     IMU_DEV_STATIC is 1, the default: no indirect call on the read path, and the
+*     same code as calling the driver by name
+*
+* Driver adapters declare their functions with IMU_DEV_DECLARE(prefix), which expects
+* prefix_dev_init, prefix_dev_configure, ... and the table prefix_dev_ops.
+*/
+
+#ifndef IMU_DEV_H
+#define IMU_DEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "imu_sample.h"
+#include "imu_cal.h"
+#include "os_utils.h"
+
+/* Sensors of a device, the same bits as the sample valid flags */
+#define IMU_DEV_ACCEL IMU_SAMPLE_ACCEL_VALID
+#define IMU_DEV_GYRO  IMU_SAMPLE_GYRO_VALID
+#define IMU_DEV_MAGN  IMU_SAMPLE_MAGN_VALID
+
+/* Devices of one imu_dev_sample_link */
+#define IMU_DEV_LINK_MAX 4
+
+/* Drivers bound to the roles */
+#ifndef IMU_GYRO_DRIVER
+#define IMU_GYRO_DRIVER fxas21002c
+#endif
+#ifndef IMU_ACCEL_DRIVER
+#define IMU_ACCEL_DRIVER fxos8700
+#endif
+#ifndef IMU_DEV_STATIC
+#define IMU_DEV_STATIC 1
+#endif
+
+typedef enum {
+    IMU_DEV_SUCCESS = 0x0,
+    IMU_DEV_ID_FAIL = 0x1,         /**< WHO_AM_I did not match */
+    IMU_DEV_BUS_FAIL = 0x2,
+    IMU_DEV_NMALLOC = 0x3,
+    IMU_DEV_UNSUPPORTED = 0x4,     /**< The configuration is not available on this part */
+    IMU_DEV_OVERFLOW = 0x5,        /**< Samples were lost; the returned batch is valid */
+    IMU_DEV_SELF_TEST_FAIL = 0x6,
+} imu_dev_err_t;
+
+/*!
+* Device configuration
+*/
+typedef struct imu_dev_config_s {
+    uint8_t sensors;          /**< IMU_DEV_* sensors to run, a subset of the device's */
+    uint8_t fifo_watermark;   /**< On-chip FIFO watermark (samples), 0 to read single samples */
+    uint8_t drdy;             /**< Non-zero to route data-ready to INT1 */
+} imu_dev_config_t;
+
+struct imu_dev_s;
+
+typedef struct imu_dev_ops_s {
+    const char *name;
+    /*! @brief probe and start the part with its default configuration */
+    imu_dev_err_t (*init)(struct imu_dev_s *dev);
+    /*! @brief apply a configuration */
+    imu_dev_err_t (*configure)(struct imu_dev_s *dev, const imu_dev_config_t *config);
+    /*! @brief read up to max samples, oldest first; *count is set to the number read */
+    imu_dev_err_t (*read_batch)(struct imu_dev_s *dev, imu_sample_t *out, size_t max, size_t *count);
+    /*! @brief check identity and that the part is producing data */
+    imu_dev_err_t (*self_test)(struct imu_dev_s *dev);
+    /*! @brief apply the calibration of the device's sensors, or remove it if not valid */
+    imu_dev_err_t (*calibrate)(struct imu_dev_s *dev, const imu_cal_t *cal);
+    /*! @brief stop using the part and release the driver */
+    void (*destroy)(struct imu_dev_s *dev);
+    /*! @brief describe the single sample read as a transfer of a batch */
+    imu_dev_err_t (*sample_op)(struct imu_dev_s *dev, i2c_op_t *op);
+    /*! @brief convert a sample_op read, once its transaction has run, into one sample */
+    imu_dev_err_t (*sample_done)(struct imu_dev_s *dev, i2c_err_t result, imu_sample_t *out);
+} imu_dev_ops_t;
+
+typedef struct imu_dev_s {
+    const imu_dev_ops_t *ops;
+    void *drv;                   /**< Driver context */
+    uint8_t sensors;             /**< IMU_DEV_* sensors the part provides */
+    imu_dev_config_t config;     /**< Configuration in effect */
+    uint32_t seq;                /**< Samples returned so far */
+} imu_dev_t;
+
+#define IMU_DEV_CAT_(a, b) a##b
+#define IMU_DEV_CAT(a, b) IMU_DEV_CAT_(a, b)
+#define IMU_DEV_FN(drv, op) IMU_DEV_CAT(drv, IMU_DEV_CAT(_dev_, op))
+#define IMU_DEV_OPS(drv) IMU_DEV_CAT(drv, _dev_ops)
+
+#define IMU_DEV_DECLARE(drv) \
+    imu_dev_err_t IMU_DEV_FN(drv, init)(imu_dev_t *dev); \
+    imu_dev_err_t IMU_DEV_FN(drv, configure)(imu_dev_t *dev, const imu_dev_config_t *config); \
+    imu_dev_err_t IMU_DEV_FN(drv, read_batch)(imu_dev_t *dev, imu_sample_t *out, size_t max, size_t *count); \
+    imu_dev_err_t IMU_DEV_FN(drv, self_test)(imu_dev_t *dev); \
+    imu_dev_err_t IMU_DEV_FN(drv, calibrate)(imu_dev_t *dev, const imu_cal_t *cal); \
+    void IMU_DEV_FN(drv, destroy)(imu_dev_t *dev); \
+    imu_dev_err_t IMU_DEV_FN(drv, sample_op)(imu_dev_t *dev, i2c_op_t *op); \
+    imu_dev_err_t IMU_DEV_FN(drv, sample_done)(imu_dev_t *dev, i2c_err_t result, imu_sample_t *out); \
+    extern const imu_dev_ops_t IMU_DEV_OPS(drv)
+
+IMU_DEV_DECLARE(IMU_GYRO_DRIVER);
+IMU_DEV_DECLARE(IMU_ACCEL_DRIVER);
+
+/*!
+* @brief initialize a device with a driver
+* @param dev the device
+* @param ops the driver
+* @returns device status
+*/
+imu_dev_err_t imu_dev_open(imu_dev_t *dev, const imu_dev_ops_t *ops);
+
+/*!
+* @brief copy the sensors valid in src into dst, e.g. to assemble one 9-DoF sample
+* from a gyroscope and an accelerometer/magnetometer reading
+*/
+void imu_dev_merge(imu_sample_t *dst, const imu_sample_t *src);
+
+/*!
+* @brief build one bus transaction that reads a sample from each device, in order;
+* run it with i2c_utils_link_exec and pass the result to each device's sample_done.
+* Rebuild it after a device is configured. A failed transfer fails every device's
+* sample, as the bus cannot tell which one it was.
+* @param devs the devices, on one port
+* @param count the number of devices, up to IMU_DEV_LINK_MAX
+* @param link the prebuilt link
+* @returns device status, IMU_DEV_UNSUPPORTED if a device cannot take part
+*/
+imu_dev_err_t imu_dev_sample_link(imu_dev_t *const *devs, size_t count, i2c_link_t *link);
+
+/*!
+* Sample reads of several devices queued back to back on the I2C transaction engine
+* (i2c_utils_submit), one transaction per device: the bus task runs them without a
+* gap while the caller sleeps on one signal, and a failed read only loses its own
+* device's data. Like imu_dev_sample_link, build it once the devices are configured,
+* and configure them only between a collect and the next submit.
+*/
+typedef struct imu_dev_queue_s {
+    imu_dev_t *devs[IMU_DEV_LINK_MAX];
+    size_t count;
+    i2c_link_t links[IMU_DEV_LINK_MAX];   /**< Each device's sample read */
+    i2c_xfer_t xfers[IMU_DEV_LINK_MAX];
+    os_signal_t done;                     /**< Given as each read completes */
+} imu_dev_queue_t;
+
+/*!
+* @brief build the sample read of each device; the engine must be running to submit
+* @param queue the queue
+* @param devs the devices
+* @param count the number of devices, up to IMU_DEV_LINK_MAX
+* @returns device status, IMU_DEV_UNSUPPORTED if a device has no single sample read
+*/
+imu_dev_err_t imu_dev_queue_init(imu_dev_queue_t *queue, imu_dev_t *const *devs, size_t count);
+
+/*!
+* @brief queue every device's sample read and return at once
+* @returns device status, IMU_DEV_BUS_FAIL if a read could not be queued (its
+* device then fails in collect) or the previous one is still in flight
+*/
+imu_dev_err_t imu_dev_queue_submit(imu_dev_queue_t *queue);
+
+/*!
+* @brief wait for the queued reads and merge each device's sample into one
+* @param queue the queue
+* @param sample receives the sensors of every device whose read succeeded
+* @param timeout_us longest wait for the reads
+* @returns device status, IMU_DEV_BUS_FAIL if a read failed or timed out
+*/
+imu_dev_err_t imu_dev_queue_collect(imu_dev_queue_t *queue, imu_sample_t *sample, uint32_t timeout_us);
+
+/*!
+* @brief release the reads, once collected
+*/
+void imu_dev_queue_destroy(imu_dev_queue_t *queue);
+
+/* Run time dispatch */
+static inline imu_dev_err_t imu_dev_init(imu_dev_t *dev){
+    return dev->ops->init(dev);
+}
+
+static inline imu_dev_err_t imu_dev_configure(imu_dev_t *dev, const imu_dev_config_t *config){
+    return dev->ops->configure(dev, config);
+}
+
+static inline imu_dev_err_t imu_dev_read_batch(imu_dev_t *dev, imu_sample_t *out, size_t max, size_t *count){
+    return dev->ops->read_batch(dev, out, max, count);
+}
+
+static inline imu_dev_err_t imu_dev_self_test(imu_dev_t *dev){
+    return dev->ops->self_test(dev);
+}
+
+static inline imu_dev_err_t imu_dev_calibrate(imu_dev_t *dev, const imu_cal_t *cal){
+    return dev->ops->calibrate(dev, cal);
+}
+
+static inline void imu_dev_destroy(imu_dev_t *dev){
+    dev->ops->destroy(dev);
+}
+
+static inline imu_dev_err_t imu_dev_sample_op(imu_dev_t *dev, i2c_op_t *op){
+    return dev->ops->sample_op ? dev->ops->sample_op(dev, op) : IMU_DEV_UNSUPPORTED;
+}
+
+static inline imu_dev_err_t imu_dev_sample_done(imu_dev_t *dev, i2c_err_t result, imu_sample_t *out){
+    return dev->ops->sample_done ? dev->ops->sample_done(dev, result, out) : IMU_DEV_UNSUPPORTED;
+}
+
+/* Role calls, e.g. IMU_GYRO_CALL(read_batch)(&gyro_dev, out, max, &n) */
+#if IMU_DEV_STATIC
+#define IMU_GYRO_CALL(op) IMU_DEV_FN(IMU_GYRO_DRIVER, op)
+#define IMU_ACCEL_CALL(op) IMU_DEV_FN(IMU_ACCEL_DRIVER, op)
+#else
+#define IMU_GYRO_CALL(op) imu_dev_##op
+#define IMU_ACCEL_CALL(op) imu_dev_##op
+#endif
+
+/* Open the role's driver */
+#define IMU_GYRO_OPEN(dev) imu_dev_open((dev), &IMU_DEV_OPS(IMU_GYRO_DRIVER))
+#define IMU_ACCEL_OPEN(dev) imu_dev_open((dev), &IMU_DEV_OPS(IMU_ACCEL_DRIVER))
+
+#endif
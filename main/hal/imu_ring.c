@@ -0,0 +1,47 @@
+#include <string.h>
+#include "imu_ring.h"
+
+void imu_ring_init(imu_ring_t *ring){
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+}
+
+/*!
+* 1. Check for space against the consumer's tail (acquire: its read of the slot is done)
+* 2. Copy the sample into the slot
+* 3. Publish by advancing head (release: the copy is visible before head moves)
+*/
+imu_ring_err_t imu_ring_push(imu_ring_t *ring, const imu_sample_t *sample){
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if(head - tail == IMU_RING_SIZE){
+        ring->dropped++;
+        return IMU_RING_FULL;
+    }
+    memcpy(&ring->slots[head & IMU_RING_MASK], sample, sizeof(imu_sample_t));
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return IMU_RING_SUCCESS;
+}
+
+/*!
+* 1. Check for data against the producer's head (acquire: the slot copy is visible)
+* 2. Copy the slot out
+* 3. Release the slot by advancing tail (release: the copy is done before reuse)
+*/
+imu_ring_err_t imu_ring_pop(imu_ring_t *ring, imu_sample_t *sample){
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if(head == tail){
+        return IMU_RING_EMPTY;
+    }
+    memcpy(sample, &ring->slots[tail & IMU_RING_MASK], sizeof(imu_sample_t));
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return IMU_RING_SUCCESS;
+}
+
+uint32_t imu_ring_count(const imu_ring_t *ring){
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
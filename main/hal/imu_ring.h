@@ -0,0 +1,59 @@
+/*!
+* @file imu_ring.h
+* @author Ethan Lew
+* @brief Lock-free single-producer/single-consumer ring of imu_sample_t
+*
+* The sampling task is the only writer of head and each consumer the only writer of
+* tail, so neither side takes a lock. Slots are published with release stores and
+* observed with acquire loads, which makes a popped sample always complete (never torn).
+* Each consumer (fusion, logging, telemetry) owns its own ring; the producer publishes
+* into all of them. A full ring drops the new sample and counts it, so a slow consumer
+* never stalls sampling.
+*/
+
+#ifndef IMU_RING_H
+#define IMU_RING_H
+
+#include <stdint.h>
+#include "imu_sample.h"
+
+/* Ring capacity in samples (power of two) */
+#define IMU_RING_SIZE 64
+#define IMU_RING_MASK (IMU_RING_SIZE - 1)
+
+typedef struct imu_ring_s {
+    imu_sample_t slots[IMU_RING_SIZE];
+    uint32_t head __attribute__((aligned(64))); /**< Next slot to write, producer owned */
+    uint32_t dropped;                           /**< Samples dropped on a full ring, producer owned */
+    uint32_t tail __attribute__((aligned(64))); /**< Next slot to read, consumer owned */
+} imu_ring_t;
+
+typedef enum {
+    IMU_RING_SUCCESS = 0x0,
+    IMU_RING_FULL = 0x1,
+    IMU_RING_EMPTY = 0x2,
+} imu_ring_err_t;
+
+/*!
+* @brief empty a ring; not safe while producer or consumer run
+*/
+void imu_ring_init(imu_ring_t *ring);
+
+/*!
+* @brief publish a sample (producer only)
+* @returns IMU_RING_FULL if the sample was dropped
+*/
+imu_ring_err_t imu_ring_push(imu_ring_t *ring, const imu_sample_t *sample);
+
+/*!
+* @brief take the oldest sample (consumer only)
+* @returns IMU_RING_EMPTY if there is none
+*/
+imu_ring_err_t imu_ring_pop(imu_ring_t *ring, imu_sample_t *sample);
+
+/*!
+* @brief number of queued samples (approximate while the other side runs)
+*/
+uint32_t imu_ring_count(const imu_ring_t *ring);
+
+#endif
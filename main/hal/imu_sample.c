@@ -0,0 +1,22 @@
+#include <string.h>
+#include "imu_sample.h"
+
+void imu_sample_fill(imu_sample_t *sample, const accel_t *accel, const gyro_t *gyro, const magn_t *magn,
+                     uint64_t stamp, uint32_t seq, uint8_t status){
+    memset(sample, 0, sizeof(imu_sample_t));
+    sample->stamp = stamp;
+    sample->seq = seq;
+    if(accel){
+        sample->accel = accel->converted;
+        sample->accel_raw = accel->raw;
+    }
+    if(gyro){
+        sample->gyro = gyro->converted;
+        sample->gyro_raw = gyro->raw;
+    }
+    if(magn){
+        sample->magn = magn->converted;
+        sample->magn_raw = magn->raw;
+    }
+    sample->status = status;
+}
@@ -0,0 +1,54 @@
+/*!
+* @file imu_sample.h
+* @author Ethan Lew
+* @brief Timestamped 9-DoF sample record
+*
+* One imu_sample_t is a consistent snapshot of all three sensors, taken by the sampling
+* task and handed to consumers through an imu_ring_t. The record is packed to 72 bytes
+* with every field naturally aligned, so copies are plain word moves.
+*/
+
+#ifndef IMU_SAMPLE_H
+#define IMU_SAMPLE_H
+
+#include <stdint.h>
+#include "fxas21002c.h"
+#include "fxos8700.h"
+
+/* Status flags of a sample */
+#define IMU_SAMPLE_ACCEL_VALID (0x01) /**< Accelerometer read succeeded */
+#define IMU_SAMPLE_GYRO_VALID  (0x02) /**< Gyroscope read succeeded */
+#define IMU_SAMPLE_MAGN_VALID  (0x04) /**< Magnetometer read succeeded */
+#define IMU_SAMPLE_ACCEL_FRESH (0x08) /**< Accelerometer/magnetometer were read for this sample */
+#define IMU_SAMPLE_GYRO_FRESH  (0x10) /**< Gyroscope was read for this sample */
+#define IMU_SAMPLE_RESAMPLED   (0x20) /**< Values were interpolated onto an output grid */
+
+typedef struct __attribute__((packed)) imu_sample_s {
+    uint64_t stamp;              /**< Sample time (us), from get_time_micros */
+    uint32_t seq;                /**< Sequence number, consecutive per producer */
+    raw_float_data_t accel;      /**< Acceleration (m/s^2) */
+    gyro_float_data_t gyro;      /**< Angular rate (rad/s) */
+    raw_float_data_t magn;       /**< Magnetic field (uT) */
+    raw_int_data_t accel_raw;    /**< Raw accelerometer counts */
+    gyro_int_data_t gyro_raw;    /**< Raw gyroscope counts */
+    raw_int_data_t magn_raw;     /**< Raw magnetometer counts */
+    uint8_t status;              /**< IMU_SAMPLE_* flags */
+    uint8_t reserved[5];
+} imu_sample_t;
+
+_Static_assert(sizeof(imu_sample_t) == 72, "imu_sample_t must stay 72 bytes");
+
+/*!
+* @brief fill a sample from the current sensor views
+* @param sample the record to fill
+* @param accel the accelerometer view, NULL if not present
+* @param gyro the gyroscope, NULL if not present
+* @param magn the magnetometer view, NULL if not present
+* @param stamp the sample time (us)
+* @param seq the sequence number
+* @param status IMU_SAMPLE_* flags
+*/
+void imu_sample_fill(imu_sample_t *sample, const accel_t *accel, const gyro_t *gyro, const magn_t *magn,
+                     uint64_t stamp, uint32_t seq, uint8_t status);
+
+#endif
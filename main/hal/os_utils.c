@@ -0,0 +1,229 @@
+#ifdef OTIS_HOST
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+#include "os_utils.h"
+
+#ifdef OTIS_HOST
+static void *os_task_entry(void *arg){
+    os_task_t *task = (os_task_t*)arg;
+    task->fn(task->arg);
+    return NULL;
+}
+
+static struct timespec os_timespec(uint64_t us){
+    struct timespec ts;
+    ts.tv_sec = (time_t)(us / 1000000ULL);
+    ts.tv_nsec = (long)(us % 1000000ULL) * 1000L;
+    return ts;
+}
+#else
+static void os_task_entry(void *arg){
+    os_task_t *task = (os_task_t*)arg;
+    task->fn(task->arg);
+    xSemaphoreGive(task->exited);
+    vTaskDelete(NULL);
+}
+#endif
+
+/*!
+* 1. Record the entry, so the new task never depends on the caller's stack
+* 2. Create the task: on target pinned at creation, on the host pinned by an
+*    affinity mask before it is started, so it never runs elsewhere
+*/
+os_err_t os_task_start(os_task_t *task, const char *name, os_task_fn fn, void *arg,
+                       uint32_t stack, uint32_t priority, int core){
+    if(!task || !fn)
+        return OS_INVALID;
+    memset(task, 0, sizeof(os_task_t));
+    task->fn = fn;
+    task->arg = arg;
+    task->core = core;
+
+#ifdef OTIS_HOST
+    (void)name;
+    (void)stack;
+    (void)priority;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(core >= 0 && (uint32_t)core < os_core_count()){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        if(pthread_attr_setaffinity_np(&attr, sizeof(set), &set) == 0)
+            task->pinned = 1;
+    }
+    int err = pthread_create(&task->thread, &attr, os_task_entry, task);
+    pthread_attr_destroy(&attr);
+    if(err != 0)
+        return OS_FAIL;
+#else
+    if(core >= (int)portNUM_PROCESSORS)
+        return OS_INVALID;
+    task->exited = xSemaphoreCreateBinary();
+    if(!task->exited)
+        return OS_FAIL;
+    if(xTaskCreatePinnedToCore(os_task_entry, name, stack, task, priority, &task->handle,
+                               core < 0 ? tskNO_AFFINITY : core) != pdPASS){
+        vSemaphoreDelete(task->exited);
+        return OS_FAIL;
+    }
+    task->pinned = core >= 0;
+#endif
+    return OS_SUCCESS;
+}
+
+void os_task_join(os_task_t *task){
+#ifdef OTIS_HOST
+    pthread_join(task->thread, NULL);
+#else
+    xSemaphoreTake(task->exited, portMAX_DELAY);
+    vSemaphoreDelete(task->exited);
+    task->exited = NULL;
+#endif
+}
+
+uint32_t os_core_count(void){
+#ifdef OTIS_HOST
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t)n : 1;
+#else
+    return portNUM_PROCESSORS;
+#endif
+}
+
+int os_core_id(void){
+#ifdef OTIS_HOST
+    return sched_getcpu();
+#else
+    return (int)xPortGetCoreID();
+#endif
+}
+
+void os_sleep_us(uint32_t us){
+#ifdef OTIS_HOST
+    struct timespec ts = os_timespec(us);
+    while(nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+#else
+    TickType_t ticks = pdMS_TO_TICKS(us / 1000);
+    vTaskDelay(ticks ? ticks : 1);
+#endif
+}
+
+void os_yield(void){
+#ifdef OTIS_HOST
+    sched_yield();
+#else
+    taskYIELD();
+#endif
+}
+
+os_err_t os_signal_init(os_signal_t *signal){
+#ifdef OTIS_HOST
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&signal->lock, NULL);
+    int err = pthread_cond_init(&signal->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    signal->set = 0;
+    return err == 0 ? OS_SUCCESS : OS_FAIL;
+#else
+    signal->sem = xSemaphoreCreateBinary();
+    return signal->sem ? OS_SUCCESS : OS_FAIL;
+#endif
+}
+
+void os_signal_destroy(os_signal_t *signal){
+#ifdef OTIS_HOST
+    pthread_cond_destroy(&signal->cond);
+    pthread_mutex_destroy(&signal->lock);
+#else
+    vSemaphoreDelete(signal->sem);
+    signal->sem = NULL;
+#endif
+}
+
+void os_signal_give(os_signal_t *signal){
+#ifdef OTIS_HOST
+    pthread_mutex_lock(&signal->lock);
+    signal->set = 1;
+    pthread_cond_signal(&signal->cond);
+    pthread_mutex_unlock(&signal->lock);
+#else
+    xSemaphoreGive(signal->sem);
+#endif
+}
+
+uint8_t os_signal_wait(os_signal_t *signal, uint32_t timeout_us){
+#ifdef OTIS_HOST
+    struct timespec deadline = os_timespec(get_time_micros() - time_utils_offset_us + timeout_us);
+    pthread_mutex_lock(&signal->lock);
+    while(!signal->set){
+        if(pthread_cond_timedwait(&signal->cond, &signal->lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    uint8_t set = signal->set;
+    signal->set = 0;
+    pthread_mutex_unlock(&signal->lock);
+    return set;
+#else
+    TickType_t ticks = pdMS_TO_TICKS(timeout_us / 1000);
+    return xSemaphoreTake(signal->sem, ticks ? ticks : 1) == pdTRUE;
+#endif
+}
+
+void os_period_init(os_period_t *period, uint32_t period_us){
+    period->period_us = period_us;
+    period->release_us = get_time_micros();
+    period->late_us = 0;
+#ifndef OTIS_HOST
+    period->wake = xTaskGetTickCount();
+    period->due_us = period->release_us;
+#endif
+}
+
+/*!
+* On the host the releases are exact multiples of the period, slept to with an
+* absolute CLOCK_MONOTONIC deadline (the get_time_micros clock). On target the
+* tick schedule of vTaskDelayUntil sets the pace and each release is the wake up
+* time; lateness is measured against that tick schedule in microseconds from the
+* first release, so it includes a constant offset below one tick. Either way a
+* release more than a period overdue is dropped.
+*/
+uint32_t os_period_wait(os_period_t *period){
+    uint64_t now = get_time_micros();
+    uint32_t skipped = 0;
+#ifdef OTIS_HOST
+    uint64_t next = period->release_us + period->period_us;
+    if(now >= next + period->period_us){
+        skipped = (uint32_t)((now - next) / period->period_us);
+        next += (uint64_t)skipped * period->period_us;
+    }
+    struct timespec ts = os_timespec(next - time_utils_offset_us);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+    period->release_us = next;
+    now = get_time_micros();
+    period->late_us = now > next ? (uint32_t)(now - next) : 0;
+#else
+    TickType_t ticks = pdMS_TO_TICKS(period->period_us / 1000);
+    if(ticks == 0)
+        ticks = 1;
+    if(now - period->release_us >= 2ULL * period->period_us){
+        skipped = (uint32_t)((now - period->release_us) / period->period_us) - 1;
+        period->wake = xTaskGetTickCount();
+        period->due_us = now;
+    }
+    vTaskDelayUntil(&period->wake, ticks);
+    period->due_us += (uint64_t)ticks * portTICK_PERIOD_MS * 1000ULL;
+    period->release_us = get_time_micros();
+    period->late_us = period->release_us > period->due_us ? (uint32_t)(period->release_us - period->due_us) : 0;
+#endif
+    return skipped;
+}
@@ -0,0 +1,141 @@
+/*!
+* @file os_utils.h
+* @author Ethan Lew
+* @brief Minimal task, signal and periodic timing abstraction over FreeRTOS and pthreads
+*
+* On target tasks are FreeRTOS tasks pinned with xTaskCreatePinnedToCore; on the host
+* (OTIS_HOST) they are pthreads with a CPU affinity mask, so code built on these calls
+* runs unchanged against the simulated sensors. Priorities only take effect on
+* target: host threads keep the default policy, which needs no privileges.
+*
+* Times are on the get_time_micros base (time_utils.h). A periodic wait on target
+* sleeps in ticks, so periods should be whole ticks there.
+*/
+
+#ifndef OS_UTILS_H
+#define OS_UTILS_H
+
+#include <stdint.h>
+#include "time_utils.h"
+
+#ifdef OTIS_HOST
+#include <pthread.h>
+#else
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#endif
+
+/* Let the scheduler place the task */
+#define OS_CORE_ANY (-1)
+
+typedef void (*os_task_fn)(void *arg);
+
+typedef struct os_task_s {
+    os_task_fn fn;
+    void *arg;
+    int core;                /**< Requested core, OS_CORE_ANY for none */
+    uint8_t pinned;          /**< The affinity was applied */
+#ifdef OTIS_HOST
+    pthread_t thread;
+#else
+    TaskHandle_t handle;
+    SemaphoreHandle_t exited; /**< Given when fn returns, for os_task_join */
+#endif
+} os_task_t;
+
+/*!
+* Binary event: gives before a wait are not lost, several collapse into one
+*/
+typedef struct os_signal_s {
+#ifdef OTIS_HOST
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t set;
+#else
+    SemaphoreHandle_t sem;
+#endif
+} os_signal_t;
+
+/*!
+* Fixed rate release times for a periodic task
+*/
+typedef struct os_period_s {
+    uint64_t release_us;     /**< Current release */
+    uint32_t period_us;
+    uint32_t late_us;        /**< How late the last wake up was against the schedule */
+#ifndef OTIS_HOST
+    TickType_t wake;
+    uint64_t due_us;         /**< Scheduled time of the current release */
+#endif
+} os_period_t;
+
+typedef enum {
+    OS_SUCCESS = 0x0,
+    OS_FAIL = 0x1,
+    OS_INVALID = 0x2,
+} os_err_t;
+
+/*!
+* @brief start a task
+* @param task the task record, kept by the caller until os_task_join
+* @param name task name (target)
+* @param fn entry, the task ends when it returns
+* @param arg passed to fn
+* @param stack stack size in bytes (target)
+* @param priority FreeRTOS priority (target)
+* @param core core to pin to, or OS_CORE_ANY; a core the host does not have leaves
+* the thread unpinned (task->pinned stays 0)
+* @returns OS_SUCCESS, OS_INVALID for a core the target does not have, OS_FAIL
+*/
+os_err_t os_task_start(os_task_t *task, const char *name, os_task_fn fn, void *arg,
+                       uint32_t stack, uint32_t priority, int core);
+
+/*!
+* @brief wait for a task's function to return
+*/
+void os_task_join(os_task_t *task);
+
+/*!
+* @brief number of cores
+*/
+uint32_t os_core_count(void);
+
+/*!
+* @brief core the caller runs on
+*/
+int os_core_id(void);
+
+void os_sleep_us(uint32_t us);
+
+void os_yield(void);
+
+os_err_t os_signal_init(os_signal_t *signal);
+
+void os_signal_destroy(os_signal_t *signal);
+
+/*!
+* @brief set the event and wake a waiter; not from an ISR
+*/
+void os_signal_give(os_signal_t *signal);
+
+/*!
+* @brief wait for the event and clear it
+* @returns 1 if it was set, 0 on timeout
+*/
+uint8_t os_signal_wait(os_signal_t *signal, uint32_t timeout_us);
+
+/*!
+* @brief first release one period from now
+*/
+void os_period_init(os_period_t *period, uint32_t period_us);
+
+/*!
+* @brief sleep until the next release
+* A release already a whole period in the past is skipped rather than run late
+* back to back, and the schedule restarts from now.
+* @returns number of releases skipped, 0 when on time
+*/
+uint32_t os_period_wait(os_period_t *period);
+
+#endif
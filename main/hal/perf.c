@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include "perf.h"
+
+static const char *const perf_probe_names[PERF_PROBES] = {
+    "gyro read", "fxos read", "i2c xfer", "fuse", "output", "sample wake", "sample read",
+};
+
+static const char *const perf_counter_names[PERF_COUNTERS] = {
+    "i2c timeouts", "i2c errors", "gyro overflows", "fxos overwritten", "samples dropped", "sample skipped",
+};
+
+const char *perf_probe_name(perf_probe_id_t id){
+    return id < PERF_PROBES ? perf_probe_names[id] : "?";
+}
+
+const char *perf_counter_name(perf_counter_id_t id){
+    return id < PERF_COUNTERS ? perf_counter_names[id] : "?";
+}
+
+perf_unit_t perf_probe_unit(perf_probe_id_t id){
+    return id == PERF_SAMPLE_WAKE ? PERF_UNIT_US : PERF_UNIT_CYCLES;
+}
+
+/*!
+* Bin k covers [2^(k-1), 2^k), so its upper bound is 2^k - 1; the last bin has none
+*/
+uint32_t perf_percentile(const uint32_t *hist, uint32_t count, float fraction){
+    uint32_t target = (uint32_t)(fraction * (float)count + 0.5F);
+    uint32_t seen = 0;
+    for(int k = 0; k < PERF_BINS; k++){
+        seen += hist[k];
+        if(seen >= target && seen > 0)
+            return k == PERF_BINS - 1 ? UINT32_MAX : (uint32_t)((1ULL << k) - 1);
+    }
+    return UINT32_MAX;
+}
+
+#if OTIS_PERF
+
+#include "time_utils.h"
+#ifdef OTIS_HOST
+#include "os_utils.h"
+#else
+#include "esp_clk.h"
+#endif
+
+static perf_probe_t perf_probes[PERF_PROBES];
+static uint32_t perf_counters[PERF_COUNTERS];
+/* Counter values at the last reset, so counters keep their single writer */
+static uint32_t perf_base[PERF_COUNTERS];
+static uint64_t perf_since_us;
+
+static void perf_clear(perf_probe_t *probe);
+
+/*!
+* Record a value
+*   1. A probe marked by perf_reset starts over here, on its writer
+*   2. Count, extremes, sum, then the bin of the value's bit length
+*/
+void perf_record(perf_probe_id_t id, uint32_t value){
+    perf_probe_t *probe = &perf_probes[id];
+    if(probe->reset)
+        perf_clear(probe);
+
+    if(probe->count == 0 || value < probe->min)
+        probe->min = value;
+    if(value > probe->max)
+        probe->max = value;
+    probe->sum += value;
+    int bin = value ? 32 - __builtin_clz(value) : 0;
+    probe->hist[bin < PERF_BINS ? bin : PERF_BINS - 1]++;
+    probe->count++;
+}
+
+void perf_count(perf_counter_id_t id, uint32_t n){
+    perf_counters[id] += n;
+}
+
+/*!
+* On x86 hosts the TSC rate is measured against CLOCK_MONOTONIC over 20 ms the first
+* time; the fallback clock counts nanoseconds
+*/
+uint32_t perf_cycles_per_us(void){
+#ifdef OTIS_HOST
+#if defined(__x86_64__) || defined(__i386__)
+    static uint32_t rate;
+    if(rate == 0){
+        uint64_t t0 = get_time_micros();
+        uint32_t c0 = perf_cycles();
+        os_sleep_us(20000);
+        uint32_t c1 = perf_cycles();
+        uint64_t t1 = get_time_micros();
+        uint32_t r = (uint32_t)((c1 - c0) / (t1 - t0));
+        rate = r ? r : 1;
+    }
+    return rate;
+#else
+    return 1000;
+#endif
+#else
+    return (uint32_t)(esp_clk_cpu_freq() / 1000000);
+#endif
+}
+
+void perf_reset(void){
+    for(int i = 0; i < PERF_PROBES; i++)
+        perf_probes[i].reset = 1;
+    for(int i = 0; i < PERF_COUNTERS; i++)
+        perf_base[i] = perf_counters[i];
+    perf_since_us = get_time_micros();
+}
+
+void perf_snapshot(perf_snapshot_t *snap){
+    for(int i = 0; i < PERF_PROBES; i++){
+        snap->probe[i] = perf_probes[i];
+        if(snap->probe[i].reset)
+            perf_clear(&snap->probe[i]);
+    }
+    for(int i = 0; i < PERF_COUNTERS; i++)
+        snap->counter[i] = perf_counters[i] - perf_base[i];
+    snap->cycles_per_us = perf_cycles_per_us();
+    snap->since_us = perf_since_us;
+}
+
+void perf_print(const perf_snapshot_t *snap){
+    for(int i = 0; i < PERF_PROBES; i++){
+        const perf_probe_t *p = &snap->probe[i];
+        if(p->count == 0)
+            continue;
+        float scale = perf_probe_unit((perf_probe_id_t)i) == PERF_UNIT_US ? 1.0F : 1.0F / (float)snap->cycles_per_us;
+        uint32_t p99 = perf_percentile(p->hist, p->count, 0.99F);
+        printf("%-11s %8u: min %8.2f, mean %8.2f, p99 <= %8.2f, max %8.2f us\n", perf_probe_names[i], p->count,
+               p->min * scale, (float)p->sum / (float)p->count * scale, (p99 < p->max ? p99 : p->max) * scale,
+               p->max * scale);
+    }
+    for(int i = 0; i < PERF_COUNTERS; i++)
+        printf("%s %u%s", perf_counter_names[i], snap->counter[i], i + 1 < PERF_COUNTERS ? ", " : "\n");
+}
+
+static void perf_clear(perf_probe_t *probe){
+    probe->count = 0;
+    probe->min = 0;
+    probe->max = 0;
+    probe->sum = 0;
+    memset(probe->hist, 0, sizeof(probe->hist));
+    probe->reset = 0;
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*!
+* @file perf.h
+* @author Ethan Lew
+* @brief Hot path cycle counters and event counters
+*
+* Probes time the driver and pipeline stages in CPU cycles: the CCOUNT register on
+* target, the TSC on x86 hosts (nanoseconds of CLOCK_MONOTONIC elsewhere). Each
+* probe keeps count, min, max and sum, and a log2 histogram: bin k holds values of k
+* significant bits, [2^(k-1), 2^k), so bin 0 is exactly 0 and the last bin takes
+* everything from 2^(PERF_BINS-2) up. A probe is cheap, a counter read, a count
+* leading zeros and a few adds, and has no lock: each probe and each counter has one
+* writer task at a time (the stage that owns the device or the bus), and readers take
+* an approximate snapshot, as for the pipeline counters.
+*
+* Event counters count what the probes cannot time: bus timeouts and errors, samples
+* lost in the sensors or between stages, skipped sampling releases.
+*
+* Everything is compiled out unless OTIS_PERF is 1: the macros expand to nothing and
+* only the name tables remain. With it, the firmware answers the TELEM_CMD_PERF
+* telemetry command with PERF and COUNTERS frames (telem_proto.h).
+*/
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+
+#ifndef OTIS_PERF
+#define OTIS_PERF 0
+#endif
+
+/* Histogram bins per probe */
+#define PERF_BINS 32
+
+typedef enum {
+    PERF_GYRO_READ = 0x0,     /**< gyro_update, or one FIFO drain in gyro_read_batch */
+    PERF_FXOS_READ = 0x1,     /**< fxos8700_update, the combined accel/magn read */
+    PERF_I2C_XFER = 0x2,      /**< One blocking bus transaction (i2c_utils) */
+    PERF_FUSE = 0x3,          /**< One sample through the fusion hook */
+    PERF_OUTPUT = 0x4,        /**< One record through the output hook */
+    PERF_SAMPLE_WAKE = 0x5,   /**< Lateness of a sampling release against its schedule (us) */
+    PERF_SAMPLE_READ = 0x6,   /**< One sample of every sensor, batched or queued on the engine */
+    PERF_PROBES = 0x7,
+} perf_probe_id_t;
+
+typedef enum {
+    PERF_I2C_TIMEOUTS = 0x0,     /**< Transactions that hit the bus timeout */
+    PERF_I2C_ERRORS = 0x1,       /**< Transactions failed otherwise (NACK, arbitration) */
+    PERF_GYRO_OVERFLOWS = 0x2,   /**< Gyroscope FIFO overflows, samples lost in the sensor */
+    PERF_FXOS_OVERWRITTEN = 0x3, /**< FXOS8700 samples overwritten before they were read */
+    PERF_SAMPLES_DROPPED = 0x4,  /**< Samples dropped on a full pipeline sample ring */
+    PERF_SAMPLE_SKIPPED = 0x5,   /**< Sampling releases skipped after an overrun */
+    PERF_COUNTERS = 0x6,
+} perf_counter_id_t;
+
+typedef enum {
+    PERF_UNIT_CYCLES = 0x0,
+    PERF_UNIT_US = 0x1,
+} perf_unit_t;
+
+typedef struct perf_probe_s {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t hist[PERF_BINS];
+    volatile uint8_t reset;   /**< Set by perf_reset, cleared by the writer */
+} perf_probe_t;
+
+/*!
+* A snapshot of every probe and counter
+*/
+typedef struct perf_snapshot_s {
+    perf_probe_t probe[PERF_PROBES];
+    uint32_t counter[PERF_COUNTERS];
+    uint32_t cycles_per_us;   /**< Probe cycles per microsecond */
+    uint64_t since_us;        /**< Time of the last perf_reset */
+} perf_snapshot_t;
+
+#if OTIS_PERF
+
+#ifdef OTIS_HOST
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#else
+#include "xtensa/hal.h"
+#endif
+
+/*!
+* @brief the probe clock, wrapping; differences are valid up to 2^32 cycles
+*/
+static inline uint32_t perf_cycles(void){
+#ifdef OTIS_HOST
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+#endif
+#else
+    return xthal_get_ccount();
+#endif
+}
+
+/*!
+* @brief add a value to a probe
+*/
+void perf_record(perf_probe_id_t id, uint32_t value);
+
+/*!
+* @brief count an event
+*/
+void perf_count(perf_counter_id_t id, uint32_t n);
+
+#define PERF_BEGIN(v) uint32_t v = perf_cycles()
+#define PERF_END(id, v) perf_record((id), perf_cycles() - (v))
+#define PERF_RECORD(id, value) perf_record((id), (value))
+#define PERF_COUNT(id, n) perf_count((id), (n))
+
+/*!
+* @brief probe clock frequency in cycles per microsecond (measured once on x86 hosts)
+*/
+uint32_t perf_cycles_per_us(void);
+
+/*!
+* @brief start every probe and counter over; each probe clears on its next record
+*/
+void perf_reset(void);
+
+/*!
+* @brief copy the probes and counters
+*/
+void perf_snapshot(perf_snapshot_t *snap);
+
+/*!
+* @brief print a snapshot, one line per probe with values and counters in us
+*/
+void perf_print(const perf_snapshot_t *snap);
+
+#else
+
+#define PERF_BEGIN(v)
+#define PERF_END(id, v) ((void)0)
+#define PERF_RECORD(id, value) ((void)0)
+#define PERF_COUNT(id, n) ((void)0)
+
+#endif
+
+/*!
+* @brief names and units, for reports and decoders
+*/
+const char *perf_probe_name(perf_probe_id_t id);
+
+const char *perf_counter_name(perf_counter_id_t id);
+
+perf_unit_t perf_probe_unit(perf_probe_id_t id);
+
+/*!
+* @brief upper bound of the histogram bin below which a fraction of the values lie
+* @param hist PERF_BINS bins
+* @param count the values in hist
+*/
+uint32_t perf_percentile(const uint32_t *hist, uint32_t count, float fraction);
+
+#endif
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <string.h>
+#include "pipeline.h"
+#include "perf.h"
+
+static const char *const pipeline_names[PIPELINE_STAGES] = {"sample", "fuse", "output"};
+
+static void pipeline_sample_task(void *arg);
+
+static void pipeline_fuse_task(void *arg);
+
+static void pipeline_output_task(void *arg);
+
+static uint8_t pipeline_fused_push(pipeline_fused_ring_t *ring, const pipeline_fused_t *fused);
+
+static uint8_t pipeline_fused_pop(pipeline_fused_ring_t *ring, pipeline_fused_t *fused);
+
+static uint8_t pipeline_release(pipeline_t *pipe, pipeline_stage_t stage, os_period_t *period);
+
+static void pipeline_done(pipeline_t *pipe, pipeline_stage_t stage, uint64_t stamp);
+
+void pipeline_default_config(pipeline_config_t *config){
+    memset(config, 0, sizeof(pipeline_config_t));
+    config->stage[PIPELINE_SAMPLE] = (pipeline_stage_config_t){.core = 0, .priority = 10, .stack = 1024 * 3};
+    config->stage[PIPELINE_FUSE] = (pipeline_stage_config_t){.core = 1, .priority = 6, .stack = 1024 * 3};
+    config->stage[PIPELINE_OUTPUT] = (pipeline_stage_config_t){.core = 1, .priority = 5, .stack = 1024 * 3};
+}
+
+/*!
+* Start up
+*   1. Empty the rings and counters, create the wake signals
+*   2. Start the consumers first, output then fuse, so nothing is published before
+*      the stage taking it runs
+*   3. On a failure stop what was started
+*/
+pipeline_err_t pipeline_start(pipeline_t *pipe, const pipeline_config_t *config){
+    if(!pipe || !config || !config->sample || !config->fuse || !config->output)
+        return PIPELINE_INVALID;
+
+    pipe->config = *config;
+    imu_ring_init(&pipe->samples);
+    pipe->fused.head = 0;
+    pipe->fused.tail = 0;
+    memset(pipe->stats, 0, sizeof(pipe->stats));
+    for(int s = 0; s < PIPELINE_STAGES; s++){
+        pipe->stats[s].core = OS_CORE_ANY;
+        if(os_signal_init(&pipe->wake[s]) != OS_SUCCESS)
+            return PIPELINE_TASK_FAIL;
+    }
+    pipe->running = 1;
+
+    static const os_task_fn entry[PIPELINE_STAGES] = {pipeline_sample_task, pipeline_fuse_task, pipeline_output_task};
+    for(int s = PIPELINE_STAGES - 1; s >= 0; s--){
+        const pipeline_stage_config_t *stage = &config->stage[s];
+        if(os_task_start(&pipe->task[s], pipeline_names[s], entry[s], pipe, stage->stack, stage->priority, stage->core) != OS_SUCCESS){
+            pipe->running = 0;
+            for(int t = s + 1; t < PIPELINE_STAGES; t++){
+                os_signal_give(&pipe->wake[t]);
+                os_task_join(&pipe->task[t]);
+            }
+            for(int t = 0; t < PIPELINE_STAGES; t++)
+                os_signal_destroy(&pipe->wake[t]);
+            return PIPELINE_TASK_FAIL;
+        }
+    }
+    return PIPELINE_SUCCESS;
+}
+
+void pipeline_stop(pipeline_t *pipe){
+    if(!pipe->running)
+        return;
+    __atomic_store_n(&pipe->running, 0, __ATOMIC_RELEASE);
+    for(int s = 0; s < PIPELINE_STAGES; s++){
+        os_signal_give(&pipe->wake[s]);
+        os_task_join(&pipe->task[s]);
+    }
+    for(int s = 0; s < PIPELINE_STAGES; s++)
+        os_signal_destroy(&pipe->wake[s]);
+}
+
+pipeline_err_t pipeline_publish(pipeline_t *pipe, const imu_sample_t *sample){
+    if(imu_ring_push(&pipe->samples, sample) != IMU_RING_SUCCESS){
+        pipe->stats[PIPELINE_SAMPLE].dropped++;
+        PERF_COUNT(PERF_SAMPLES_DROPPED, 1);
+        return PIPELINE_FULL;
+    }
+    pipeline_done(pipe, PIPELINE_SAMPLE, sample->stamp);
+    if(pipe->config.stage[PIPELINE_FUSE].period_us == 0)
+        os_signal_give(&pipe->wake[PIPELINE_FUSE]);
+    return PIPELINE_SUCCESS;
+}
+
+uint32_t pipeline_in_flight(const pipeline_t *pipe){
+    uint32_t out = __atomic_load_n(&pipe->stats[PIPELINE_OUTPUT].items, __ATOMIC_ACQUIRE);
+    uint32_t lost = __atomic_load_n(&pipe->stats[PIPELINE_FUSE].dropped, __ATOMIC_ACQUIRE);
+    uint32_t in = __atomic_load_n(&pipe->stats[PIPELINE_SAMPLE].items, __ATOMIC_ACQUIRE);
+    return in - lost - out;
+}
+
+void pipeline_stats(const pipeline_t *pipe, pipeline_stage_stats_t stats[PIPELINE_STAGES]){
+    memcpy(stats, pipe->stats, sizeof(pipe->stats));
+}
+
+void pipeline_print(const pipeline_t *pipe){
+    pipeline_stage_stats_t stats[PIPELINE_STAGES];
+    pipeline_stats(pipe, stats);
+    for(int s = 0; s < PIPELINE_STAGES; s++){
+        const pipeline_stage_stats_t *st = &stats[s];
+        printf("%-6s core %2d: %u records, %u deadline misses, %u skipped, %u dropped, max latency %u us, busy %llu us\n",
+               pipeline_names[s], st->core, st->items, st->misses, st->skipped, st->dropped, st->max_latency_us,
+               (unsigned long long)st->busy_us);
+    }
+}
+
+/*!
+* Sampling: the hook once per release, or back to back when it paces itself
+*/
+static void pipeline_sample_task(void *arg){
+    pipeline_t *pipe = (pipeline_t*)arg;
+    const pipeline_stage_config_t *stage = &pipe->config.stage[PIPELINE_SAMPLE];
+    pipeline_stage_stats_t *stats = &pipe->stats[PIPELINE_SAMPLE];
+    os_period_t period;
+
+    if(stage->start)
+        stage->start(stage->ctx);
+    os_period_init(&period, stage->period_us);
+    while(pipeline_release(pipe, PIPELINE_SAMPLE, &period)){
+        uint64_t t0 = get_time_micros();
+        pipe->config.sample(stage->ctx, pipe);
+        if(stage->period_us)
+            stats->busy_us += get_time_micros() - t0;
+    }
+    if(stage->stop)
+        stage->stop(stage->ctx);
+}
+
+/*!
+* Fusion: drain the sample ring, fuse each sample and pass it on; wake the output
+* stage once per drain
+*/
+static void pipeline_fuse_task(void *arg){
+    pipeline_t *pipe = (pipeline_t*)arg;
+    const pipeline_stage_config_t *stage = &pipe->config.stage[PIPELINE_FUSE];
+    pipeline_stage_stats_t *stats = &pipe->stats[PIPELINE_FUSE];
+    uint8_t signal_output = pipe->config.stage[PIPELINE_OUTPUT].period_us == 0;
+    os_period_t period;
+    pipeline_fused_t fused;
+
+    if(stage->start)
+        stage->start(stage->ctx);
+    os_period_init(&period, stage->period_us);
+    while(pipeline_release(pipe, PIPELINE_FUSE, &period)){
+        uint64_t t0 = get_time_micros();
+        uint32_t passed = 0;
+        while(imu_ring_pop(&pipe->samples, &fused.sample) == IMU_RING_SUCCESS){
+            PERF_BEGIN(start);
+            pipe->config.fuse(stage->ctx, &fused.sample, &fused);
+            PERF_END(PERF_FUSE, start);
+            if(!pipeline_fused_push(&pipe->fused, &fused)){
+                __atomic_store_n(&stats->dropped, stats->dropped + 1, __ATOMIC_RELEASE);
+                continue;
+            }
+            pipeline_done(pipe, PIPELINE_FUSE, fused.sample.stamp);
+            passed++;
+        }
+        if(passed && signal_output)
+            os_signal_give(&pipe->wake[PIPELINE_OUTPUT]);
+        stats->busy_us += get_time_micros() - t0;
+    }
+    if(stage->stop)
+        stage->stop(stage->ctx);
+}
+
+/*!
+* Output: drain the fused ring record by record, then flush, also after an empty
+* drain so the output stage's own periodic work goes on without samples
+*/
+static void pipeline_output_task(void *arg){
+    pipeline_t *pipe = (pipeline_t*)arg;
+    const pipeline_stage_config_t *stage = &pipe->config.stage[PIPELINE_OUTPUT];
+    pipeline_stage_stats_t *stats = &pipe->stats[PIPELINE_OUTPUT];
+    os_period_t period;
+    pipeline_fused_t fused;
+
+    if(stage->start)
+        stage->start(stage->ctx);
+    os_period_init(&period, stage->period_us);
+    while(pipeline_release(pipe, PIPELINE_OUTPUT, &period)){
+        uint64_t t0 = get_time_micros();
+        while(pipeline_fused_pop(&pipe->fused, &fused)){
+            PERF_BEGIN(start);
+            pipe->config.output(stage->ctx, &fused);
+            PERF_END(PERF_OUTPUT, start);
+            pipeline_done(pipe, PIPELINE_OUTPUT, fused.sample.stamp);
+        }
+        if(pipe->config.flush)
+            pipe->config.flush(stage->ctx);
+        stats->busy_us += get_time_micros() - t0;
+    }
+    if(stage->stop)
+        stage->stop(stage->ctx);
+}
+
+/*!
+* Wait for a stage's next cycle: its next release, or for a consumer without a
+* period a wake from the stage before it (the sample stage without a period runs
+* straight on). Counts skipped releases; 0 once the pipeline is stopping.
+*/
+static uint8_t pipeline_release(pipeline_t *pipe, pipeline_stage_t stage, os_period_t *period){
+    pipeline_stage_stats_t *stats = &pipe->stats[stage];
+    if(period->period_us){
+        uint32_t skipped = os_period_wait(period);
+        stats->skipped += skipped;
+        if(stage == PIPELINE_SAMPLE){
+            PERF_RECORD(PERF_SAMPLE_WAKE, period->late_us);
+            PERF_COUNT(PERF_SAMPLE_SKIPPED, skipped);
+        }
+    } else if(stage != PIPELINE_SAMPLE){
+        os_signal_wait(&pipe->wake[stage], PIPELINE_WAIT_US);
+    }
+    stats->core = os_core_id();
+    return __atomic_load_n(&pipe->running, __ATOMIC_ACQUIRE);
+}
+
+/*!
+* One record through a stage: its latency against the deadline. items is published
+* last (release) for pipeline_in_flight.
+*/
+static void pipeline_done(pipeline_t *pipe, pipeline_stage_t stage, uint64_t stamp){
+    pipeline_stage_stats_t *stats = &pipe->stats[stage];
+    uint64_t now = get_time_micros();
+    uint32_t latency = now > stamp ? (uint32_t)(now - stamp) : 0;
+    uint32_t deadline = pipe->config.stage[stage].deadline_us;
+    if(deadline && latency > deadline)
+        stats->misses++;
+    if(latency > stats->max_latency_us)
+        stats->max_latency_us = latency;
+    __atomic_store_n(&stats->items, stats->items + 1, __ATOMIC_RELEASE);
+}
+
+/*!
+* The imu_ring scheme for fused records: acquire the other side's index, copy,
+* publish the own index with release
+*/
+static uint8_t pipeline_fused_push(pipeline_fused_ring_t *ring, const pipeline_fused_t *fused){
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if(head - tail == PIPELINE_FUSED_RING_SIZE)
+        return 0;
+    memcpy(&ring->slots[head & PIPELINE_FUSED_RING_MASK], fused, sizeof(pipeline_fused_t));
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static uint8_t pipeline_fused_pop(pipeline_fused_ring_t *ring, pipeline_fused_t *fused){
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if(head == tail)
+        return 0;
+    memcpy(fused, &ring->slots[tail & PIPELINE_FUSED_RING_MASK], sizeof(pipeline_fused_t));
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
@@ -0,0 +1,168 @@
+/*!
+* @file pipeline.h
+* @author Ethan Lew
+* @brief Sample, fuse and output stages on their own tasks, joined by lock-free rings
+*
+*     sample task --imu_ring--> fuse task --fused ring--> output task
+*
+* Each stage is a task (os_utils.h) with its own core, priority, period and deadline,
+* so the cost of fusion and output never delays the bus reads: by default sampling
+* owns one core and fusion and output share the other. The rings are single
+* producer/single consumer (see imu_ring.h); a full ring drops the newest record and
+* counts it against the stage that could not hand it on.
+*
+* The work of each stage is the application's, as hooks:
+*   - sample: publishes samples with pipeline_publish. With a period the hook runs
+*     once per release; without one it paces itself (e.g. waiting on data-ready)
+*     and should return at least every PIPELINE_WAIT_US so the pipeline can stop
+*   - fuse: fills in the orientation of a fused record, its sample already set
+*   - output: consumes fused records one by one, then flush once per drain
+* Consumer stages with a period drain their ring once per release; without one they
+* are woken by the stage before them.
+*
+* Each stage keeps its counters: records handled, deadline misses (latency from the
+* sample stamp to the end of the stage's work above deadline_us), releases skipped
+* because a cycle overran its period, records dropped on the next ring, the worst
+* latency and the time spent working. Every counter has one writer, the stage's
+* task; pipeline_stats reads them while running, approximately.
+*
+* On the host the stages are pthreads pinned with CPU affinity, the same code
+* against the simulated sensors, see tools/otis_pipeline_bench.
+*/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "imu_sample.h"
+#include "imu_ring.h"
+#include "os_utils.h"
+
+/* Fused records between fusion and output (power of two) */
+#define PIPELINE_FUSED_RING_SIZE 64
+#define PIPELINE_FUSED_RING_MASK (PIPELINE_FUSED_RING_SIZE - 1)
+/* Longest a signalled stage waits before checking for a stop (us) */
+#define PIPELINE_WAIT_US 100000
+
+typedef enum {
+    PIPELINE_SAMPLE = 0x0,
+    PIPELINE_FUSE = 0x1,
+    PIPELINE_OUTPUT = 0x2,
+    PIPELINE_STAGES = 0x3,
+} pipeline_stage_t;
+
+/*!
+* A sample and the orientation fused from it
+*/
+typedef struct pipeline_fused_s {
+    imu_sample_t sample;
+    float q[4];              /**< {w, x, y, z}, body to earth */
+    float roll;              /**< Euler angles (degrees) */
+    float pitch;
+    float yaw;
+} pipeline_fused_t;
+
+typedef struct pipeline_fused_ring_s {
+    pipeline_fused_t slots[PIPELINE_FUSED_RING_SIZE];
+    uint32_t head __attribute__((aligned(64))); /**< Next slot to write, fuse task owned */
+    uint32_t tail __attribute__((aligned(64))); /**< Next slot to read, output task owned */
+} pipeline_fused_ring_t;
+
+typedef struct pipeline_s pipeline_t;
+
+typedef void (*pipeline_hook_fn)(void *ctx);
+typedef void (*pipeline_sample_fn)(void *ctx, pipeline_t *pipe);
+typedef void (*pipeline_fuse_fn)(void *ctx, const imu_sample_t *sample, pipeline_fused_t *fused);
+typedef void (*pipeline_output_fn)(void *ctx, const pipeline_fused_t *fused);
+
+typedef struct pipeline_stage_config_s {
+    int core;                /**< Core to pin to, OS_CORE_ANY for none */
+    uint32_t priority;       /**< Task priority (target) */
+    uint32_t stack;          /**< Stack size in bytes (target) */
+    uint32_t period_us;      /**< Release period, 0 for self paced or signalled */
+    uint32_t deadline_us;    /**< Sample stamp to done bound, 0 for none */
+    void *ctx;               /**< Passed to the stage's hooks */
+    pipeline_hook_fn start;  /**< Run on the task before the first cycle, may be NULL */
+    pipeline_hook_fn stop;   /**< Run on the task after the last cycle, may be NULL */
+} pipeline_stage_config_t;
+
+typedef struct pipeline_config_s {
+    pipeline_stage_config_t stage[PIPELINE_STAGES];
+    pipeline_sample_fn sample;
+    pipeline_fuse_fn fuse;
+    pipeline_output_fn output;
+    pipeline_hook_fn flush;  /**< Output stage, after each drain, may be NULL */
+} pipeline_config_t;
+
+typedef struct pipeline_stage_stats_s {
+    uint32_t items;          /**< Records through the stage */
+    uint32_t misses;         /**< Records done later than deadline_us after their stamp */
+    uint32_t skipped;        /**< Releases skipped after an overrun */
+    uint32_t dropped;        /**< Records lost on the full ring into the next stage */
+    uint32_t max_latency_us; /**< Worst sample stamp to done latency */
+    uint64_t busy_us;        /**< Time in the stage's work; 0 for a self paced sample stage */
+    int core;                /**< Core of the stage's last cycle */
+} pipeline_stage_stats_t;
+
+struct pipeline_s {
+    pipeline_config_t config;
+    imu_ring_t samples;              /**< Sample to fuse */
+    pipeline_fused_ring_t fused;     /**< Fuse to output */
+    os_signal_t wake[PIPELINE_STAGES]; /**< Wakes a signalled consumer stage */
+    os_task_t task[PIPELINE_STAGES];
+    pipeline_stage_stats_t stats[PIPELINE_STAGES];
+    volatile uint8_t running;
+};
+
+typedef enum {
+    PIPELINE_SUCCESS = 0x0,
+    PIPELINE_FULL = 0x1,
+    PIPELINE_INVALID = 0x2,
+    PIPELINE_TASK_FAIL = 0x3,
+} pipeline_err_t;
+
+/*!
+* @brief the default placement: sampling alone on core 0 at the highest priority,
+* fusion and output on core 1; no hooks, periods or deadlines
+*/
+void pipeline_default_config(pipeline_config_t *config);
+
+/*!
+* @brief start the three stage tasks
+* @param pipe the pipeline, kept by the caller until pipeline_stop
+* @param config stages and hooks; sample, fuse and output are required
+* @returns pipeline status, PIPELINE_TASK_FAIL if a task could not be started (the
+* ones started are stopped again)
+*/
+pipeline_err_t pipeline_start(pipeline_t *pipe, const pipeline_config_t *config);
+
+/*!
+* @brief stop the stages after their current cycle and wait for them; records still
+* queued are discarded
+*/
+void pipeline_stop(pipeline_t *pipe);
+
+/*!
+* @brief hand a sample to fusion (sample hook only)
+* @returns PIPELINE_FULL if the ring was full and the sample dropped
+*/
+pipeline_err_t pipeline_publish(pipeline_t *pipe, const imu_sample_t *sample);
+
+/*!
+* @brief records published and not yet through the output stage, nor dropped on
+* the way
+*/
+uint32_t pipeline_in_flight(const pipeline_t *pipe);
+
+/*!
+* @brief copy the counters of every stage
+*/
+void pipeline_stats(const pipeline_t *pipe, pipeline_stage_stats_t stats[PIPELINE_STAGES]);
+
+/*!
+* @brief print the counters, one line per stage
+*/
+void pipeline_print(const pipeline_t *pipe);
+
+#endif
@@ -0,0 +1,186 @@
+#include <string.h>
+#include "resample.h"
+
+static resample_err_t resample_push(resampler_t *rs, resample_channel_id_t id, uint64_t stamp,
+                                    float x, float y, float z);
+
+static uint8_t resample_ready(const resampler_t *rs, const resample_channel_t *ch, uint64_t t);
+
+static uint8_t resample_interp(const resampler_t *rs, const resample_channel_t *ch, uint64_t t, float *out);
+
+void resample_init(resampler_t *rs, uint32_t period_us, uint32_t max_delay_us,
+                   resample_order_t order, uint8_t channels){
+    memset(rs, 0, sizeof(resampler_t));
+    rs->period_us = period_us;
+    rs->max_delay_us = max_delay_us;
+    rs->order = order;
+    rs->channels = channels;
+}
+
+resample_err_t resample_push_gyro(resampler_t *rs, uint64_t stamp, const gyro_float_data_t *gyro){
+    return resample_push(rs, RESAMPLE_GYRO, stamp, gyro->x, gyro->y, gyro->z);
+}
+
+resample_err_t resample_push_accel(resampler_t *rs, uint64_t stamp, const raw_float_data_t *accel){
+    return resample_push(rs, RESAMPLE_ACCEL, stamp, accel->x, accel->y, accel->z);
+}
+
+resample_err_t resample_push_magn(resampler_t *rs, uint64_t stamp, const raw_float_data_t *magn){
+    return resample_push(rs, RESAMPLE_MAGN, stamp, magn->x, magn->y, magn->z);
+}
+
+/*!
+* Emit one grid point
+*   1. Ready when every channel in use has enough samples past t to interpolate
+*   2. Otherwise forced once the newest sample of any channel is max_delay_us past t
+*   3. Interpolate each channel; channels that could not be bracketed hold their
+*      newest value and are flagged invalid
+*   4. Advance the grid by exactly one period
+*/
+resample_err_t resample_pull(resampler_t *rs, imu_sample_t *out){
+    static const uint8_t valid_flag[RESAMPLE_CHANNELS] = {
+        IMU_SAMPLE_GYRO_VALID, IMU_SAMPLE_ACCEL_VALID, IMU_SAMPLE_MAGN_VALID
+    };
+    float v[RESAMPLE_CHANNELS][3] = {{0.0F}};
+    uint64_t t = rs->next_us;
+    uint8_t ready = 1;
+    uint8_t late = 0;
+
+    if(!rs->started)
+        return RESAMPLE_EMPTY;
+
+    for(int c = 0; c < RESAMPLE_CHANNELS; c++){
+        const resample_channel_t *ch = &rs->channel[c];
+        if(!(rs->channels & (1 << c)))
+            continue;
+        if(!resample_ready(rs, ch, t))
+            ready = 0;
+        if(ch->count > 0 && ch->stamp[(ch->count - 1) & RESAMPLE_HISTORY_MASK] >= t + rs->max_delay_us)
+            late = 1;
+    }
+    if(!ready && !late)
+        return RESAMPLE_EMPTY;
+
+    uint8_t status = IMU_SAMPLE_RESAMPLED;
+    for(int c = 0; c < RESAMPLE_CHANNELS; c++){
+        resample_channel_t *ch = &rs->channel[c];
+        if(!(rs->channels & (1 << c)))
+            continue;
+        if(resample_interp(rs, ch, t, v[c])){
+            status |= valid_flag[c];
+        } else {
+            ch->held++;
+        }
+    }
+
+    memset(out, 0, sizeof(imu_sample_t));
+    out->stamp = t;
+    out->seq = rs->seq++;
+    out->gyro.x = v[RESAMPLE_GYRO][0];
+    out->gyro.y = v[RESAMPLE_GYRO][1];
+    out->gyro.z = v[RESAMPLE_GYRO][2];
+    out->accel.x = v[RESAMPLE_ACCEL][0];
+    out->accel.y = v[RESAMPLE_ACCEL][1];
+    out->accel.z = v[RESAMPLE_ACCEL][2];
+    out->magn.x = v[RESAMPLE_MAGN][0];
+    out->magn.y = v[RESAMPLE_MAGN][1];
+    out->magn.z = v[RESAMPLE_MAGN][2];
+    if(status & IMU_SAMPLE_GYRO_VALID)
+        status |= IMU_SAMPLE_GYRO_FRESH;
+    if(status & IMU_SAMPLE_ACCEL_VALID)
+        status |= IMU_SAMPLE_ACCEL_FRESH;
+    out->status = status;
+
+    rs->next_us += rs->period_us;
+    return RESAMPLE_SUCCESS;
+}
+
+/*!
+* Store a sample; the first one of any channel starts the grid at the next multiple
+* of the period
+*/
+static resample_err_t resample_push(resampler_t *rs, resample_channel_id_t id, uint64_t stamp,
+                                    float x, float y, float z){
+    resample_channel_t *ch = &rs->channel[id];
+
+    if(ch->count > 0 && stamp <= ch->stamp[(ch->count - 1) & RESAMPLE_HISTORY_MASK]){
+        ch->stale++;
+        return RESAMPLE_STALE;
+    }
+
+    uint32_t i = ch->count & RESAMPLE_HISTORY_MASK;
+    ch->stamp[i] = stamp;
+    ch->v[i][0] = x;
+    ch->v[i][1] = y;
+    ch->v[i][2] = z;
+    ch->count++;
+
+    if(!rs->started){
+        rs->next_us = (stamp + rs->period_us - 1) / rs->period_us * rs->period_us;
+        rs->started = 1;
+    }
+    return RESAMPLE_SUCCESS;
+}
+
+/*!
+* A channel is ready for t once a sample at or after t exists, plus one more for the
+* cubic tangent
+*/
+static uint8_t resample_ready(const resampler_t *rs, const resample_channel_t *ch, uint64_t t){
+    uint32_t need = rs->order == RESAMPLE_CUBIC ? 2 : 1;
+    if(ch->count < need)
+        return 0;
+    return ch->stamp[(ch->count - need) & RESAMPLE_HISTORY_MASK] >= t;
+}
+
+/*!
+* Value of a channel at t
+*   1. Bracket t with samples i, i + 1 searching back from the newest
+*   2. Cubic Hermite when i - 1 and i + 2 are in the history, linear otherwise
+*   3. Outside the history hold the nearest end; returns 0 in that case
+*/
+static uint8_t resample_interp(const resampler_t *rs, const resample_channel_t *ch, uint64_t t, float *out){
+    if(ch->count == 0)
+        return 0;
+
+    uint32_t newest = ch->count - 1;
+    uint32_t oldest = ch->count > RESAMPLE_HISTORY ? ch->count - RESAMPLE_HISTORY : 0;
+    uint32_t i = newest;
+    while(i > oldest && ch->stamp[i & RESAMPLE_HISTORY_MASK] > t)
+        i--;
+
+    const uint64_t *s = ch->stamp;
+    uint32_t i0 = i & RESAMPLE_HISTORY_MASK;
+    if(s[i0] > t || i == newest){
+        /* Before the oldest or at/after the newest sample */
+        memcpy(out, ch->v[i0], 3 * sizeof(float));
+        return s[i0] == t;
+    }
+
+    uint32_t i1 = (i + 1) & RESAMPLE_HISTORY_MASK;
+    float h = (float)(s[i1] - s[i0]);
+    float a = (float)(t - s[i0]) / h;
+
+    if(rs->order == RESAMPLE_CUBIC && i > oldest && i + 1 < newest){
+        uint32_t im = (i - 1) & RESAMPLE_HISTORY_MASK;
+        uint32_t i2 = (i + 2) & RESAMPLE_HISTORY_MASK;
+        /* Tangents scaled to the bracket length */
+        float k0 = h / (float)(s[i1] - s[im]);
+        float k1 = h / (float)(s[i2] - s[i0]);
+        float a2 = a * a;
+        float a3 = a2 * a;
+        float h00 = 2.0F * a3 - 3.0F * a2 + 1.0F;
+        float h10 = a3 - 2.0F * a2 + a;
+        float h01 = -2.0F * a3 + 3.0F * a2;
+        float h11 = a3 - a2;
+        for(int k = 0; k < 3; k++){
+            float m0 = (ch->v[i1][k] - ch->v[im][k]) * k0;
+            float m1 = (ch->v[i2][k] - ch->v[i0][k]) * k1;
+            out[k] = h00 * ch->v[i0][k] + h10 * m0 + h01 * ch->v[i1][k] + h11 * m1;
+        }
+    } else {
+        for(int k = 0; k < 3; k++)
+            out[k] = ch->v[i0][k] + a * (ch->v[i1][k] - ch->v[i0][k]);
+    }
+    return 1;
+}
@@ -0,0 +1,109 @@
+/*!
+* @file resample.h
+* @author Ethan Lew
+* @brief Uniform resampler onto a fixed output grid
+*
+* The gyroscope and the FXOS8700 run from separate oscillators at unrelated rates and
+* their data-ready edges jitter. Each sensor pushes its samples with their own
+* timestamps into a short history, and the resampler emits imu_sample_t records at
+* exactly k * period_us by interpolating every channel at that time (linear, or cubic
+* Hermite with finite difference tangents when enough history is around it).
+*
+* Latency is bounded: a grid point is emitted as soon as every channel has data past
+* it, or at the latest when any channel is max_delay_us past it. A channel that is
+* still behind then holds its last value and its IMU_SAMPLE_*_VALID flag is cleared.
+*/
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+#include "imu_sample.h"
+
+/* Samples kept per channel (power of two) */
+#define RESAMPLE_HISTORY 8
+#define RESAMPLE_HISTORY_MASK (RESAMPLE_HISTORY - 1)
+
+/* Channel masks for resample_init */
+#define RESAMPLE_USE_GYRO  (1 << RESAMPLE_GYRO)
+#define RESAMPLE_USE_ACCEL (1 << RESAMPLE_ACCEL)
+#define RESAMPLE_USE_MAGN  (1 << RESAMPLE_MAGN)
+
+typedef enum {
+    RESAMPLE_GYRO = 0x0,
+    RESAMPLE_ACCEL = 0x1,
+    RESAMPLE_MAGN = 0x2,
+    RESAMPLE_CHANNELS = 0x3,
+} resample_channel_id_t;
+
+typedef enum {
+    RESAMPLE_LINEAR = 0x0,
+    RESAMPLE_CUBIC = 0x1,
+} resample_order_t;
+
+typedef enum {
+    RESAMPLE_SUCCESS = 0x0,
+    RESAMPLE_EMPTY = 0x1,    /**< No grid point can be emitted yet */
+    RESAMPLE_STALE = 0x2,    /**< Pushed stamp is not newer than the last one, dropped */
+} resample_err_t;
+
+typedef struct resample_channel_s {
+    uint64_t stamp[RESAMPLE_HISTORY];  /**< Sample times (us) */
+    float v[RESAMPLE_HISTORY][3];      /**< X/Y/Z values */
+    uint32_t count;                    /**< Samples pushed so far */
+    uint32_t stale;                    /**< Samples dropped for a non increasing stamp */
+    uint32_t held;                     /**< Grid points emitted with this channel held */
+} resample_channel_t;
+
+typedef struct resampler_s {
+    resample_channel_t channel[RESAMPLE_CHANNELS];
+    resample_order_t order;
+    uint8_t channels;                  /**< RESAMPLE_USE_* mask of channels in use */
+    uint8_t started;
+    uint32_t period_us;                /**< Output grid period */
+    uint32_t max_delay_us;             /**< Latest a grid point is emitted after its time */
+    uint64_t next_us;                  /**< Next grid point */
+    uint32_t seq;                      /**< Output sequence number */
+} resampler_t;
+
+/*!
+* @brief reset a resampler
+* @param rs the resampler
+* @param period_us the output period
+* @param max_delay_us the latency bound, should be more than the slowest input period
+* @param order linear or cubic interpolation
+* @param channels RESAMPLE_USE_* mask of the channels that will be pushed
+*/
+void resample_init(resampler_t *rs, uint32_t period_us, uint32_t max_delay_us,
+                   resample_order_t order, uint8_t channels);
+
+/*!
+* @brief add a gyroscope sample
+* @param rs the resampler
+* @param stamp the sample time (us)
+* @param gyro angular rate
+* @returns RESAMPLE_STALE if the stamp does not advance
+*/
+resample_err_t resample_push_gyro(resampler_t *rs, uint64_t stamp, const gyro_float_data_t *gyro);
+
+/*!
+* @brief add an accelerometer sample
+*/
+resample_err_t resample_push_accel(resampler_t *rs, uint64_t stamp, const raw_float_data_t *accel);
+
+/*!
+* @brief add a magnetometer sample
+*/
+resample_err_t resample_push_magn(resampler_t *rs, uint64_t stamp, const raw_float_data_t *magn);
+
+/*!
+* @brief emit the next grid point if it is ready; call until RESAMPLE_EMPTY
+* The sample carries interpolated converted values only (raw counts are zero) and
+* IMU_SAMPLE_RESAMPLED in its status.
+* @param rs the resampler
+* @param out the aligned sample
+* @returns RESAMPLE_EMPTY if nothing is ready
+*/
+resample_err_t resample_pull(resampler_t *rs, imu_sample_t *out);
+
+#endif
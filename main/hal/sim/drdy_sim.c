@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <time.h>
+#include "drdy_sim.h"
+#include "host_clock.h"
+
+static void *drdy_sim_thread(void *arg);
+
+int drdy_sim_start(drdy_sim_t *sim, drdy_source_t *source, uint32_t period_us, uint32_t jitter_us){
+    if(!sim || !source || period_us == 0)
+        return -1;
+    sim->source = source;
+    sim->period_us = period_us;
+    sim->jitter_us = jitter_us;
+    sim->edges = 0;
+    sim->skipped = 0;
+    __atomic_store_n(&sim->running, 1, __ATOMIC_RELEASE);
+    return pthread_create(&sim->thread, NULL, drdy_sim_thread, sim);
+}
+
+void drdy_sim_stop(drdy_sim_t *sim){
+    if(!sim || !__atomic_load_n(&sim->running, __ATOMIC_ACQUIRE))
+        return;
+    __atomic_store_n(&sim->running, 0, __ATOMIC_RELEASE);
+    pthread_join(sim->thread, NULL);
+}
+
+/*!
+* Edges are scheduled on an absolute grid so jitter does not accumulate into drift.
+* Jittered edges are at least period - 2 * jitter apart; a grid point whose edge would
+* come less than half that after the previous one is skipped and counted, as it only
+* can after a stall of the host (not of the reader), which would otherwise raise the
+* overdue edges back to back.
+*/
+static void *drdy_sim_thread(void *arg){
+    drdy_sim_t *sim = (drdy_sim_t*)arg;
+    unsigned int seed = (unsigned int)(uintptr_t)sim;
+    const uint64_t period_ns = (uint64_t)sim->period_us * 1000ULL;
+    const uint64_t jitter_ns = (uint64_t)sim->jitter_us * 1000ULL;
+    const uint64_t spacing_ns = period_ns > 2 * jitter_ns ? (period_ns - 2 * jitter_ns) / 2 : 0;
+    uint64_t next = host_clock_now_ns();
+    uint64_t last = 0;
+
+    while(__atomic_load_n(&sim->running, __ATOMIC_ACQUIRE)){
+        uint64_t edge;
+        for(;;){
+            next += period_ns;
+            edge = next;
+            if(jitter_ns)
+                edge += (uint64_t)(rand_r(&seed) % (2 * sim->jitter_us + 1)) * 1000ULL - jitter_ns;
+            if(last == 0 || edge >= last + spacing_ns)
+                break;
+            sim->skipped++;
+        }
+        struct timespec ts = {(time_t)(edge / 1000000000ULL), (long)(edge % 1000000000ULL)};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        last = host_clock_now_ns();
+
+        if(sim->on_edge)
+            sim->on_edge(sim->ctx);
+        drdy_signal(sim->source, get_time_micros());
+        sim->edges++;
+    }
+    return NULL;
+}
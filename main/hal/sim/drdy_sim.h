@@ -0,0 +1,43 @@
+/*!
+* @file drdy_sim.h
+* @author Ethan Lew
+*
+* Simulated data-ready interrupt generator for host (Linux) builds. A generator thread
+* raises edges on a drdy source at a fixed period with optional uniform jitter, standing
+* in for the sensor INT pin and GPIO ISR. Edges a stalled host would bunch up are
+* skipped rather than raised back to back; edges + skipped is the grid index of the
+* next edge. The on_edge hook runs before each edge so a
+* chip model can produce the sample the edge announces.
+*/
+
+#ifndef DRDY_SIM_H
+#define DRDY_SIM_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "../drdy.h"
+
+typedef struct drdy_sim_s {
+    drdy_source_t *source;       /**< Source the edges are signalled on */
+    uint32_t period_us;          /**< Nominal edge period */
+    uint32_t jitter_us;          /**< Peak edge jitter */
+    void (*on_edge)(void *ctx);  /**< Called before every edge, may be NULL */
+    void *ctx;                   /**< Argument of on_edge */
+    int running;                 /**< Cleared to stop the generator, accessed atomically */
+    uint32_t edges;              /**< Edges generated */
+    uint32_t skipped;            /**< Grid points skipped after a stall of the generator */
+    pthread_t thread;
+} drdy_sim_t;
+
+/*!
+* @brief start generating edges on a source
+* @returns 0 on success
+*/
+int drdy_sim_start(drdy_sim_t *sim, drdy_source_t *source, uint32_t period_us, uint32_t jitter_us);
+
+/*!
+* @brief stop the generator and join its thread
+*/
+void drdy_sim_stop(drdy_sim_t *sim);
+
+#endif
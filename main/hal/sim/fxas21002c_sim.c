@@ -0,0 +1,207 @@
+#include <string.h>
+#include "fxas21002c_sim.h"
+
+#define REG_STATUS     0x00
+#define REG_OUT_X_MSB  0x01
+#define REG_OUT_Z_LSB  0x06
+#define REG_DR_STATUS  0x07
+#define REG_F_STATUS   0x08
+#define REG_F_SETUP    0x09
+#define REG_WHO_AM_I   0x0C
+#define REG_CTRL_REG0  0x0D
+#define REG_CTRL_REG1  0x13
+#define REG_CTRL_REG3  0x15
+
+#define CTRL1_RST      0x40
+#define CTRL1_ACTIVE   0x02
+#define CTRL1_DR_MASK  0x1C
+#define CTRL3_WRAPTOONE 0x08
+#define F_MODE_MASK    0xC0
+#define F_MODE_CIRCULAR 0x40
+#define F_MODE_STOP    0x80
+#define F_WMRK_MASK    0x3F
+#define DR_ZYXDR       0x08
+#define DR_ZYXOW       0x80
+
+static const uint32_t fxas_sim_period[8] = {
+    1250, 2500, 5000, 10000, 20000, 40000, 80000, 80000
+};
+
+static uint8_t fxas_sim_f_status(const fxas_sim_t *sim);
+
+static uint8_t fxas_sim_read_byte(fxas_sim_t *sim, uint8_t reg);
+
+static uint8_t fxas_sim_next_reg(const fxas_sim_t *sim, uint8_t reg);
+
+void fxas_sim_init(fxas_sim_t *sim){
+    memset(sim, 0, sizeof(fxas_sim_t));
+    sim->regs[REG_WHO_AM_I] = FXAS_SIM_ID;
+}
+
+uint32_t fxas_sim_period_us(const fxas_sim_t *sim){
+    return fxas_sim_period[(sim->regs[REG_CTRL_REG1] >> 2) & 0x07];
+}
+
+void fxas_sim_push(fxas_sim_t *sim, int16_t x, int16_t y, int16_t z){
+    /* Standby and ready modes do not produce data */
+    if(!(sim->regs[REG_CTRL_REG1] & CTRL1_ACTIVE))
+        return;
+    sim->samples++;
+
+    uint8_t mode = sim->regs[REG_F_SETUP] & F_MODE_MASK;
+    if(mode == 0) {
+        /* Output registers hold the latest sample */
+        sim->regs[REG_OUT_X_MSB + 0] = (uint8_t)((uint16_t)x >> 8);
+        sim->regs[REG_OUT_X_MSB + 1] = (uint8_t)x;
+        sim->regs[REG_OUT_X_MSB + 2] = (uint8_t)((uint16_t)y >> 8);
+        sim->regs[REG_OUT_X_MSB + 3] = (uint8_t)y;
+        sim->regs[REG_OUT_X_MSB + 4] = (uint8_t)((uint16_t)z >> 8);
+        sim->regs[REG_OUT_X_MSB + 5] = (uint8_t)z;
+        if(sim->regs[REG_DR_STATUS] & DR_ZYXDR)
+            sim->regs[REG_DR_STATUS] |= DR_ZYXOW;
+        sim->regs[REG_DR_STATUS] |= DR_ZYXDR;
+        return;
+    }
+
+    if(sim->fifo_count == FXAS_SIM_FIFO_SIZE) {
+        sim->fifo_ovf = 1;
+        sim->dropped++;
+        if(mode == F_MODE_STOP)
+            return;
+        /* Circular mode discards the oldest sample */
+        sim->fifo_head = (sim->fifo_head + 1) % FXAS_SIM_FIFO_SIZE;
+        sim->fifo_count--;
+    }
+    uint8_t tail = (sim->fifo_head + sim->fifo_count) % FXAS_SIM_FIFO_SIZE;
+    sim->fifo[tail][0] = x;
+    sim->fifo[tail][1] = y;
+    sim->fifo[tail][2] = z;
+    sim->fifo_count++;
+}
+
+int fxas_sim_write(fxas_sim_t *sim, const uint8_t *data, size_t size){
+    if(size == 0)
+        return -1;
+    sim->transactions++;
+    sim->bytes += size;
+
+    uint8_t reg = data[0];
+    for(size_t i = 1; i < size; i++) {
+        uint8_t value = data[i];
+        switch(reg) {
+            case REG_F_SETUP:
+            /* The FIFO can only be reconfigured out of active mode */
+            if(sim->regs[REG_CTRL_REG1] & CTRL1_ACTIVE) {
+                sim->illegal_writes++;
+                break;
+            }
+            sim->regs[REG_F_SETUP] = value;
+            if((value & F_MODE_MASK) == 0) {
+                sim->fifo_head = 0;
+                sim->fifo_count = 0;
+                sim->fifo_ovf = 0;
+            }
+            break;
+            case REG_CTRL_REG1:
+            if(value & CTRL1_RST) {
+                uint32_t transactions = sim->transactions;
+                uint32_t bytes = sim->bytes;
+                fxas_sim_init(sim);
+                sim->transactions = transactions;
+                sim->bytes = bytes;
+                return 0;
+            }
+            /* The rate only changes out of active mode, or on the way out of it; the
+               part keeps the old one otherwise */
+            if((sim->regs[REG_CTRL_REG1] & CTRL1_ACTIVE) && (value & CTRL1_ACTIVE) &&
+               ((value ^ sim->regs[REG_CTRL_REG1]) & CTRL1_DR_MASK)) {
+                sim->illegal_writes++;
+                value = (value & ~CTRL1_DR_MASK) | (sim->regs[REG_CTRL_REG1] & CTRL1_DR_MASK);
+            }
+            sim->regs[REG_CTRL_REG1] = value;
+            break;
+            case REG_CTRL_REG0:
+            /* Full scale range and filters only change out of active mode */
+            if(sim->regs[REG_CTRL_REG1] & CTRL1_ACTIVE) {
+                sim->illegal_writes++;
+                break;
+            }
+            sim->regs[REG_CTRL_REG0] = value;
+            break;
+            default:
+            /* Status, output and ID registers are read only */
+            if(reg <= REG_WHO_AM_I) {
+                sim->illegal_writes++;
+            } else if(reg < FXAS_SIM_NUM_REGS) {
+                sim->regs[reg] = value;
+            }
+            break;
+        }
+        reg = fxas_sim_next_reg(sim, reg);
+    }
+    return 0;
+}
+
+int fxas_sim_read(fxas_sim_t *sim, uint8_t reg, uint8_t *data, size_t size){
+    if(size == 0)
+        return -1;
+    sim->transactions++;
+    sim->bytes += size;
+
+    for(size_t i = 0; i < size; i++) {
+        data[i] = fxas_sim_read_byte(sim, reg);
+        reg = fxas_sim_next_reg(sim, reg);
+    }
+    return 0;
+}
+
+static uint8_t fxas_sim_f_status(const fxas_sim_t *sim){
+    uint8_t wmrk = sim->regs[REG_F_SETUP] & F_WMRK_MASK;
+    uint8_t status = sim->fifo_count & 0x3F;
+    if(sim->fifo_ovf)
+        status |= 0x80;
+    if(wmrk != 0 && sim->fifo_count >= wmrk)
+        status |= 0x40;
+    return status;
+}
+
+static uint8_t fxas_sim_read_byte(fxas_sim_t *sim, uint8_t reg){
+    uint8_t fifo_mode = sim->regs[REG_F_SETUP] & F_MODE_MASK;
+
+    if(reg == REG_STATUS) {
+        /* STATUS mirrors F_STATUS in FIFO mode and DR_STATUS otherwise */
+        return fifo_mode ? fxas_sim_f_status(sim) : sim->regs[REG_DR_STATUS];
+    }
+    if(reg == REG_F_STATUS) {
+        return fxas_sim_f_status(sim);
+    }
+    if(reg >= REG_OUT_X_MSB && reg <= REG_OUT_Z_LSB) {
+        uint8_t idx = reg - REG_OUT_X_MSB;
+        if(!fifo_mode) {
+            uint8_t value = sim->regs[reg];
+            if(reg == REG_OUT_Z_LSB)
+                sim->regs[REG_DR_STATUS] = 0;
+            return value;
+        }
+        /* Reading an empty FIFO returns zeros */
+        if(sim->fifo_count == 0)
+            return 0;
+        int16_t word = sim->fifo[sim->fifo_head][idx / 2];
+        uint8_t value = (idx & 1) ? (uint8_t)word : (uint8_t)((uint16_t)word >> 8);
+        /* The frame is popped once its last byte has been read */
+        if(reg == REG_OUT_Z_LSB) {
+            sim->fifo_head = (sim->fifo_head + 1) % FXAS_SIM_FIFO_SIZE;
+            sim->fifo_count--;
+        }
+        return value;
+    }
+    if(reg < FXAS_SIM_NUM_REGS)
+        return sim->regs[reg];
+    return 0;
+}
+
+static uint8_t fxas_sim_next_reg(const fxas_sim_t *sim, uint8_t reg){
+    if(reg == REG_OUT_Z_LSB)
+        return (sim->regs[REG_CTRL_REG3] & CTRL3_WRAPTOONE) ? REG_OUT_X_MSB : REG_STATUS;
+    return (reg + 1) % FXAS_SIM_NUM_REGS;
+}
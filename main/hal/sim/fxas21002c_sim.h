@@ -0,0 +1,68 @@
+/*!
+* @file fxas21002c_sim.h
+* @author Ethan Lew
+*
+* Register level model of the FXAS21002C gyroscope for host (Linux) builds. The model
+* implements the parts of the register map used by the driver: WHO_AM_I, the control
+* registers, the output registers with burst auto-increment and the 32 sample FIFO in
+* circular and stop modes. It is deliberately independent of fxas21002c.h, so register
+* level mistakes in the driver are not mirrored by the model.
+*
+* These sources are not part of the ESP-IDF component and are only compiled for host.
+*/
+
+#ifndef FXAS21002C_SIM_H
+#define FXAS21002C_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FXAS_SIM_ID           (0xD7)
+#define FXAS_SIM_FIFO_SIZE    32
+#define FXAS_SIM_NUM_REGS     0x40
+
+/*!
+* Simulated device state
+*/
+typedef struct fxas_sim_s {
+    uint8_t regs[FXAS_SIM_NUM_REGS];     /**< Register file */
+    int16_t fifo[FXAS_SIM_FIFO_SIZE][3]; /**< FIFO sample storage */
+    uint8_t fifo_head;                   /**< Index of the oldest FIFO sample */
+    uint8_t fifo_count;                  /**< Number of queued FIFO samples */
+    uint8_t fifo_ovf;                    /**< Sticky overflow flag */
+    uint32_t samples;                    /**< Samples produced while active */
+    uint32_t dropped;                    /**< Samples lost to FIFO overflow */
+    uint32_t illegal_writes;             /**< Writes the real part would ignore (e.g. F_SETUP, CTRL_REG0 while active) */
+    uint32_t transactions;               /**< Bus transactions served */
+    uint32_t bytes;                      /**< Bytes transferred, excluding addressing */
+} fxas_sim_t;
+
+/*!
+* @brief reset the model to its power on state
+*/
+void fxas_sim_init(fxas_sim_t *sim);
+
+/*!
+* @brief produce one output sample, as the part does once per output data period
+* @param x,y,z raw angular rate counts
+*/
+void fxas_sim_push(fxas_sim_t *sim, int16_t x, int16_t y, int16_t z);
+
+/*!
+* @brief output data period (us) currently programmed in CTRL_REG1
+*/
+uint32_t fxas_sim_period_us(const fxas_sim_t *sim);
+
+/*!
+* @brief serve a register write transaction (data[0] is the start register)
+* @returns 0 on success
+*/
+int fxas_sim_write(fxas_sim_t *sim, const uint8_t *data, size_t size);
+
+/*!
+* @brief serve a register read transaction starting at reg
+* @returns 0 on success
+*/
+int fxas_sim_read(fxas_sim_t *sim, uint8_t reg, uint8_t *data, size_t size);
+
+#endif
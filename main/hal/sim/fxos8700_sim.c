@@ -0,0 +1,182 @@
+#include <string.h>
+#include "fxos8700_sim.h"
+
+#define REG_STATUS       0x00
+#define REG_OUT_X_MSB    0x01
+#define REG_OUT_Z_LSB    0x06
+#define REG_WHO_AM_I     0x0D
+#define REG_XYZ_DATA_CFG 0x0E
+#define REG_CTRL_REG1    0x2A
+#define REG_CTRL_REG2    0x2B
+#define REG_CTRL_REG3    0x2C
+#define REG_CTRL_REG5    0x2E
+#define REG_M_DR_STATUS  0x32
+#define REG_M_OUT_X_MSB  0x33
+#define REG_M_OUT_Z_LSB  0x38
+#define REG_M_CTRL_REG1  0x5B
+#define REG_M_CTRL_REG2  0x5C
+
+#define CTRL1_ACTIVE     0x01
+#define CTRL1_DR_MASK    0x38
+#define CTRL2_RST        0x40
+#define M_HMS_MASK       0x03
+#define M_HMS_ACCEL      0x00
+#define M_HMS_MAGN       0x01
+#define M_HYB_AUTOINC    0x20
+#define DR_ZYXDR         0x08
+#define DR_ZYXOW         0x80
+
+static const uint32_t fxos_sim_period[8] = {
+    1250, 2500, 5000, 10000, 20000, 80000, 160000, 640000
+};
+
+static uint8_t fxos_sim_read_byte(fxos_sim_t *sim, uint8_t reg);
+
+static uint8_t fxos_sim_next_reg(const fxos_sim_t *sim, uint8_t reg);
+
+static void fxos_sim_store(fxos_sim_t *sim, uint8_t out_reg, uint8_t status_reg, const int16_t *v);
+
+void fxos_sim_init(fxos_sim_t *sim){
+    memset(sim, 0, sizeof(fxos_sim_t));
+    sim->regs[REG_WHO_AM_I] = FXOS_SIM_ID;
+}
+
+uint32_t fxos_sim_period_us(const fxos_sim_t *sim){
+    uint32_t period = fxos_sim_period[(sim->regs[REG_CTRL_REG1] >> 3) & 0x07];
+    if((sim->regs[REG_M_CTRL_REG1] & M_HMS_MASK) == M_HMS_MASK)
+        period *= 2;
+    return period;
+}
+
+float fxos_sim_counts_per_g(const fxos_sim_t *sim){
+    return (float)(4096 >> (sim->regs[REG_XYZ_DATA_CFG] & 0x03));
+}
+
+void fxos_sim_push(fxos_sim_t *sim, const int16_t *accel, const int16_t *magn){
+    /* Standby does not produce data */
+    if(!(sim->regs[REG_CTRL_REG1] & CTRL1_ACTIVE))
+        return;
+    sim->samples++;
+
+    uint8_t hms = sim->regs[REG_M_CTRL_REG1] & M_HMS_MASK;
+    if(hms != M_HMS_MAGN){
+        /* 14 bit data, left justified */
+        int16_t counts[3];
+        for(int i = 0; i < 3; i++)
+            counts[i] = (int16_t)((uint16_t)accel[i] << 2);
+        fxos_sim_store(sim, REG_OUT_X_MSB, REG_STATUS, counts);
+    }
+    if(hms != M_HMS_ACCEL){
+        fxos_sim_store(sim, REG_M_OUT_X_MSB, REG_M_DR_STATUS, magn);
+    }
+}
+
+int fxos_sim_write(fxos_sim_t *sim, const uint8_t *data, size_t size){
+    if(size == 0)
+        return -1;
+    sim->transactions++;
+    sim->bytes += size;
+
+    uint8_t reg = data[0];
+    for(size_t i = 1; i < size; i++) {
+        uint8_t value = data[i];
+        uint8_t active = sim->regs[REG_CTRL_REG1] & CTRL1_ACTIVE;
+        switch(reg) {
+            case REG_CTRL_REG2:
+            if(value & CTRL2_RST) {
+                uint32_t transactions = sim->transactions;
+                uint32_t bytes = sim->bytes;
+                fxos_sim_init(sim);
+                sim->transactions = transactions;
+                sim->bytes = bytes;
+                return 0;
+            }
+            sim->regs[reg] = value;
+            break;
+            case REG_CTRL_REG1:
+            /* The rate only changes out of active mode, or on the way out of it; the
+               part keeps the old one otherwise */
+            if(active && (value & CTRL1_ACTIVE) && ((value ^ sim->regs[reg]) & CTRL1_DR_MASK)) {
+                sim->illegal_writes++;
+                value = (value & ~CTRL1_DR_MASK) | (sim->regs[reg] & CTRL1_DR_MASK);
+            }
+            sim->regs[reg] = value;
+            break;
+            case REG_XYZ_DATA_CFG:
+            case REG_M_CTRL_REG1:
+            case REG_CTRL_REG3:
+            case REG_CTRL_REG3 + 1:
+            case REG_CTRL_REG5:
+            /* Only written in standby */
+            if(active) {
+                sim->illegal_writes++;
+                break;
+            }
+            sim->regs[reg] = value;
+            break;
+            default:
+            /* Status, output and ID registers are read only */
+            if(reg <= REG_WHO_AM_I || (reg >= REG_M_DR_STATUS && reg <= REG_M_OUT_Z_LSB)) {
+                sim->illegal_writes++;
+            } else if(reg < FXOS_SIM_NUM_REGS) {
+                sim->regs[reg] = value;
+            }
+            break;
+        }
+        reg = (reg + 1) % FXOS_SIM_NUM_REGS;
+    }
+    return 0;
+}
+
+int fxos_sim_read(fxos_sim_t *sim, uint8_t reg, uint8_t *data, size_t size){
+    if(size == 0)
+        return -1;
+    sim->transactions++;
+    sim->bytes += size;
+
+    for(size_t i = 0; i < size; i++) {
+        data[i] = fxos_sim_read_byte(sim, reg);
+        reg = fxos_sim_next_reg(sim, reg);
+    }
+    return 0;
+}
+
+static void fxos_sim_store(fxos_sim_t *sim, uint8_t out_reg, uint8_t status_reg, const int16_t *v){
+    for(int i = 0; i < 3; i++) {
+        sim->regs[out_reg + 2 * i] = (uint8_t)((uint16_t)v[i] >> 8);
+        sim->regs[out_reg + 2 * i + 1] = (uint8_t)v[i];
+    }
+    if(sim->regs[status_reg] & DR_ZYXDR) {
+        sim->regs[status_reg] |= DR_ZYXOW;
+        sim->overwritten++;
+    }
+    sim->regs[status_reg] |= DR_ZYXDR;
+}
+
+/*!
+* Reading the last output byte of a sensor clears its data-ready flags
+*/
+static uint8_t fxos_sim_read_byte(fxos_sim_t *sim, uint8_t reg){
+    if(reg >= FXOS_SIM_NUM_REGS)
+        return 0;
+    uint8_t value = sim->regs[reg];
+    if(reg == REG_OUT_Z_LSB)
+        sim->regs[REG_STATUS] = 0;
+    if(reg == REG_M_OUT_Z_LSB)
+        sim->regs[REG_M_DR_STATUS] = 0;
+    return value;
+}
+
+/*!
+* With hyb_autoinc_mode a burst continues from the accelerometer into the
+* magnetometer registers, and from there back to STATUS
+*/
+static uint8_t fxos_sim_next_reg(const fxos_sim_t *sim, uint8_t reg){
+    if(sim->regs[REG_M_CTRL_REG2] & M_HYB_AUTOINC) {
+        if(reg == REG_OUT_Z_LSB)
+            return REG_M_OUT_X_MSB;
+        if(reg == REG_M_OUT_Z_LSB)
+            return REG_STATUS;
+    }
+    return (reg + 1) % FXOS_SIM_NUM_REGS;
+}
@@ -0,0 +1,71 @@
+/*!
+* @file fxos8700_sim.h
+* @author Ethan Lew
+*
+* Register level model of the FXOS8700 accelerometer/magnetometer for host (Linux)
+* builds. The model covers the registers used by the driver: WHO_AM_I, the control
+* registers, the accelerometer and magnetometer output registers with the hybrid
+* auto-increment jump from 0x06 to 0x33, and accelerometer only, magnetometer only and
+* hybrid operation. Like the gyroscope model it does not include fxos8700.h.
+*
+* These sources are not part of the ESP-IDF component and are only compiled for host.
+*/
+
+#ifndef FXOS8700_SIM_H
+#define FXOS8700_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FXOS_SIM_ID           (0xC7)
+#define FXOS_SIM_NUM_REGS     0x80
+
+/*!
+* Simulated device state
+*/
+typedef struct fxos_sim_s {
+    uint8_t regs[FXOS_SIM_NUM_REGS];     /**< Register file */
+    uint32_t samples;                    /**< Samples produced while active */
+    uint32_t overwritten;                /**< Samples replaced before being read */
+    uint32_t illegal_writes;             /**< Writes the real part would ignore (e.g. XYZ_DATA_CFG, M_CTRL_REG1 while active) */
+    uint32_t transactions;               /**< Bus transactions served */
+    uint32_t bytes;                      /**< Bytes transferred, excluding addressing */
+} fxos_sim_t;
+
+/*!
+* @brief reset the model to its power on state
+*/
+void fxos_sim_init(fxos_sim_t *sim);
+
+/*!
+* @brief produce one output sample, as the part does once per output data period
+* Only the enabled sensors (M_CTRL_REG1 m_hms) are updated.
+* @param accel 14 bit accelerometer counts
+* @param magn magnetometer counts (0.1 uT)
+*/
+void fxos_sim_push(fxos_sim_t *sim, const int16_t *accel, const int16_t *magn);
+
+/*!
+* @brief output data period (us) for the CTRL_REG1 rate and the sensor mode
+* Hybrid mode alternates the two sensors, halving the rate of each.
+*/
+uint32_t fxos_sim_period_us(const fxos_sim_t *sim);
+
+/*!
+* @brief accelerometer counts per g for the XYZ_DATA_CFG range
+*/
+float fxos_sim_counts_per_g(const fxos_sim_t *sim);
+
+/*!
+* @brief serve a register write transaction (data[0] is the start register)
+* @returns 0 on success
+*/
+int fxos_sim_write(fxos_sim_t *sim, const uint8_t *data, size_t size);
+
+/*!
+* @brief serve a register read transaction starting at reg
+* @returns 0 on success
+*/
+int fxos_sim_read(fxos_sim_t *sim, uint8_t reg, uint8_t *data, size_t size);
+
+#endif
@@ -0,0 +1,35 @@
+/*!
+* @file host_clock.h
+* @author Ethan Lew
+*
+* Nanosecond clock reads for host (Linux) builds, shared by the simulated sensors and
+* the host tools. host_clock_now_ns reads CLOCK_MONOTONIC, the clock of the time base
+* (time_utils.h); host_clock_ns takes another clock, CLOCK_THREAD_CPUTIME_ID to time
+* CPU use or CLOCK_MONOTONIC_RAW to check the rate of the time base against.
+*/
+
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*!
+* @brief read a clock
+* @returns nanoseconds since the clock's epoch
+*/
+static inline uint64_t host_clock_ns(clockid_t clock){
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*!
+* @brief read CLOCK_MONOTONIC
+* @returns nanoseconds since boot
+*/
+static inline uint64_t host_clock_now_ns(void){
+    return host_clock_ns(CLOCK_MONOTONIC);
+}
+
+#endif
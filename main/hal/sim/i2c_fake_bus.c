@@ -0,0 +1,175 @@
+#include <string.h>
+#include "i2c_fake_bus.h"
+#include "host_clock.h"
+
+/* Bits on the wire for a register read: start, address, register, repeated start, address, stop */
+#define FAKE_BUS_READ_OVERHEAD_BITS (1 + 9 + 9 + 1 + 9 + 1)
+/* Bits on the wire for a write: start, address, stop */
+#define FAKE_BUS_WRITE_OVERHEAD_BITS (1 + 9 + 1)
+
+typedef struct i2c_fake_link_s {
+    size_t count;
+    i2c_op_t ops[];
+} i2c_fake_link_t;
+
+static uint32_t bus_clk_hz = 0;
+static uint32_t bus_overhead_ns = 0;
+static i2c_fake_handler_t bus_handler = NULL;
+static void *bus_ctx = NULL;
+static i2c_fake_bus_stats_t bus_stats;
+
+static void i2c_fake_bus_hold(uint64_t ns);
+
+static void i2c_fake_bus_count(size_t size, uint64_t ns);
+
+static i2c_err_t i2c_fake_bus_setup(i2c_peripheral_t i2c_setup);
+
+static i2c_err_t i2c_fake_bus_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size);
+
+static i2c_err_t i2c_fake_bus_write(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size);
+
+static i2c_err_t i2c_fake_bus_link_exec(i2c_link_t link);
+
+const i2c_backend_t i2c_fake_bus_backend = {
+    i2c_fake_bus_setup,
+    i2c_fake_bus_read,
+    i2c_fake_bus_write,
+    i2c_fake_bus_link_read,
+    i2c_fake_bus_link_exec,
+    i2c_fake_bus_link_destroy,
+    i2c_fake_bus_link_batch,
+};
+
+void i2c_fake_bus_init(uint32_t clk_hz, i2c_fake_handler_t handler, void *ctx){
+    bus_clk_hz = clk_hz;
+    bus_handler = handler;
+    bus_ctx = ctx;
+    bus_overhead_ns = 0;
+    bus_stats = (i2c_fake_bus_stats_t){0};
+}
+
+void i2c_fake_bus_set_overhead(uint32_t ns){
+    bus_overhead_ns = ns;
+}
+
+uint64_t i2c_fake_bus_read_ns(size_t size){
+    if(bus_clk_hz == 0)
+        return 0;
+    return (FAKE_BUS_READ_OVERHEAD_BITS + 9ULL * size) * 1000000000ULL / bus_clk_hz;
+}
+
+uint64_t i2c_fake_bus_write_ns(size_t size){
+    if(bus_clk_hz == 0)
+        return 0;
+    return (FAKE_BUS_WRITE_OVERHEAD_BITS + 9ULL * size) * 1000000000ULL / bus_clk_hz;
+}
+
+i2c_err_t i2c_fake_bus_link_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link){
+    i2c_op_t op = {I2C_XFER_READ, i2c_dev, i2c_reg, data_rd, size};
+    if(link == NULL || size == 0)
+        return I2C_INVALID_SETUP;
+    return i2c_fake_bus_link_batch(&op, 1, link);
+}
+
+i2c_err_t i2c_fake_bus_link_batch(const i2c_op_t *ops, size_t count, i2c_link_t *link){
+    i2c_fake_link_t *l = (i2c_fake_link_t*)malloc(sizeof(i2c_fake_link_t) + count * sizeof(i2c_op_t));
+    if(l == NULL)
+        return I2C_FAIL;
+    l->count = count;
+    memcpy(l->ops, ops, count * sizeof(i2c_op_t));
+    *link = l;
+    return I2C_SUCCESS;
+}
+
+void i2c_fake_bus_link_destroy(i2c_link_t *link){
+    if(link && *link){
+        free(*link);
+        *link = NULL;
+    }
+}
+
+void i2c_fake_bus_stats(i2c_fake_bus_stats_t *stats){
+    *stats = bus_stats;
+}
+
+static i2c_err_t i2c_fake_bus_setup(i2c_peripheral_t i2c_setup){
+    if(i2c_setup.mode != I2C_MODE_TYPE_MASTER)
+        return I2C_INVALID_SETUP;
+    return I2C_SUCCESS;
+}
+
+static i2c_err_t i2c_fake_bus_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size){
+    if(size == 0)
+        return I2C_SUCCESS;
+    if(bus_handler == NULL)
+        return I2C_INVALID_STATE;
+    i2c_err_t ret = bus_handler(bus_ctx, i2c_dev.addr, i2c_reg, data_rd, size, 1);
+    uint64_t ns = i2c_fake_bus_read_ns(size);
+    i2c_fake_bus_count(size, ns);
+    i2c_fake_bus_hold(ns + bus_overhead_ns);
+    return ret;
+}
+
+static i2c_err_t i2c_fake_bus_write(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size){
+    if(size == 0)
+        return I2C_INVALID_SETUP;
+    if(bus_handler == NULL)
+        return I2C_INVALID_STATE;
+    i2c_err_t ret = bus_handler(bus_ctx, i2c_dev.addr, data_wr[0], data_wr, size, 0);
+    uint64_t ns = i2c_fake_bus_write_ns(size);
+    i2c_fake_bus_count(size, ns);
+    i2c_fake_bus_hold(ns + bus_overhead_ns);
+    return ret;
+}
+
+/*!
+* Transfers run in order until one fails, as the ESP32 driver stops at a missing ACK.
+* They are one transaction on the wire: every stop but the last is left out, the
+* next start becoming a repeated start.
+*/
+static i2c_err_t i2c_fake_bus_link_exec(i2c_link_t link){
+    i2c_fake_link_t *l = (i2c_fake_link_t*)link;
+    if(l == NULL || bus_handler == NULL)
+        return I2C_INVALID_STATE;
+    i2c_err_t ret = I2C_SUCCESS;
+    size_t bytes = 0;
+    uint64_t bits_ns = 0;
+    size_t i;
+    for(i = 0; i < l->count && ret == I2C_SUCCESS; i++){
+        const i2c_op_t *op = &l->ops[i];
+        if(op->type == I2C_XFER_READ){
+            ret = bus_handler(bus_ctx, op->i2c_dev.addr, op->i2c_reg, op->data, op->size, 1);
+            bits_ns += i2c_fake_bus_read_ns(op->size);
+        } else {
+            ret = bus_handler(bus_ctx, op->i2c_dev.addr, op->data[0], op->data, op->size, 0);
+            bits_ns += i2c_fake_bus_write_ns(op->size);
+        }
+        bytes += op->size;
+    }
+    if(bus_clk_hz != 0)
+        bits_ns -= (i - 1) * 1000000000ULL / bus_clk_hz;
+    i2c_fake_bus_count(bytes, bits_ns);
+    i2c_fake_bus_hold(bits_ns + bus_overhead_ns);
+    return ret;
+}
+
+/*!
+* Counters are updated atomically, devices may be driven from several threads
+*/
+static void i2c_fake_bus_count(size_t size, uint64_t ns){
+    __atomic_fetch_add(&bus_stats.transactions, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&bus_stats.bytes, (uint32_t)size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&bus_stats.busy_ns, ns, __ATOMIC_RELAXED);
+}
+
+/*!
+* Busy wait rather than sleep: transactions last tens to hundreds of microseconds,
+* below the useful resolution of a sleeping thread.
+*/
+static void i2c_fake_bus_hold(uint64_t ns){
+    if(ns == 0)
+        return;
+    uint64_t end = host_clock_now_ns() + ns;
+    while(host_clock_now_ns() < end)
+        ;
+}
@@ -0,0 +1,81 @@
+/*!
+* @file i2c_fake_bus.h
+* @author Ethan Lew
+*
+* Simulated I2C bus backend for host (Linux) builds. Each transaction is handed to a
+* device handler and then held for as long as it would occupy a real bus at the
+* configured clock (9 bit times per byte plus start, repeated start and stop), so the
+* transaction engine can be exercised and throughput measured against 400 kHz timing.
+* A batch (i2c_utils_link_batch) is one transaction: its transfers are joined by
+* repeated starts and share one stop. An optional fixed cost per transaction models
+* the driver around it on the target (building the command link, starting it and
+* waiting for its interrupt), which a batch pays once.
+*/
+
+#ifndef I2C_FAKE_BUS_H
+#define I2C_FAKE_BUS_H
+
+#include "../i2c_utils.h"
+
+/*!
+* Device handler: serve a read (is_read != 0, data filled from reg) or a write
+* (data[0] is the register) addressed to addr
+*/
+typedef i2c_err_t (*i2c_fake_handler_t)(void *ctx, uint8_t addr, uint8_t reg, uint8_t *data, size_t size, int is_read);
+
+/*!
+* Bus counters
+*/
+typedef struct i2c_fake_bus_stats_s {
+    uint32_t transactions; /**< Transactions served */
+    uint32_t bytes;        /**< Payload bytes moved */
+    uint64_t busy_ns;      /**< Modelled bus occupancy, wire time only */
+} i2c_fake_bus_stats_t;
+
+/*!
+* @brief configure the bus
+* @param clk_hz the modelled SCL frequency, 0 for no timing
+* @param handler the device handler
+* @param ctx the handler context
+*/
+void i2c_fake_bus_init(uint32_t clk_hz, i2c_fake_handler_t handler, void *ctx);
+
+/*!
+* @brief set the modelled cost of a transaction besides its wire time, held after
+* each one; 0 (the default after i2c_fake_bus_init) for none
+*/
+void i2c_fake_bus_set_overhead(uint32_t ns);
+
+/*!
+* @brief modelled duration (ns) of a register read of size bytes
+*/
+uint64_t i2c_fake_bus_read_ns(size_t size);
+
+/*!
+* @brief modelled duration (ns) of a write of size bytes (register included)
+*/
+uint64_t i2c_fake_bus_write_ns(size_t size);
+
+/*!
+* @brief build a link executable by the fake bus backend, a batch of one read
+*/
+i2c_err_t i2c_fake_bus_link_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link);
+
+/*!
+* @brief build a batch executable by the fake bus backend
+*/
+i2c_err_t i2c_fake_bus_link_batch(const i2c_op_t *ops, size_t count, i2c_link_t *link);
+
+/*!
+* @brief release a link built by i2c_fake_bus_link_read or i2c_fake_bus_link_batch
+*/
+void i2c_fake_bus_link_destroy(i2c_link_t *link);
+
+/*!
+* @brief counters since i2c_fake_bus_init
+*/
+void i2c_fake_bus_stats(i2c_fake_bus_stats_t *stats);
+
+extern const i2c_backend_t i2c_fake_bus_backend;
+
+#endif
@@ -0,0 +1,227 @@
+#include <string.h>
+#include "i2c_replay.h"
+#include "../i2c_rec.h"
+
+typedef struct i2c_replay_link_s {
+    size_t count;
+    i2c_op_t ops[];
+} i2c_replay_link_t;
+
+static const uint8_t *replay_log = NULL;
+static uint8_t *replay_owned = NULL;
+static size_t replay_size = 0;
+/* Next record, and the log clock before it */
+static size_t replay_pos = 0;
+static uint64_t replay_clock = 0;
+static uint64_t replay_now_us = 0;
+static i2c_replay_stats_t replay_stats;
+
+static i2c_err_t i2c_replay_setup(i2c_peripheral_t i2c_setup);
+
+static i2c_err_t i2c_replay_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size);
+
+static i2c_err_t i2c_replay_write(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size);
+
+static i2c_err_t i2c_replay_link_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link);
+
+static i2c_err_t i2c_replay_link_exec(i2c_link_t link);
+
+static void i2c_replay_link_destroy(i2c_link_t *link);
+
+static i2c_err_t i2c_replay_link_batch(const i2c_op_t *ops, size_t count, i2c_link_t *link);
+
+static const i2c_rec_record_t *i2c_replay_match(i2c_rec_type_t type, i2c_peripheral_t i2c_dev, uint8_t i2c_reg, size_t size);
+
+const i2c_backend_t i2c_replay_backend = {
+    i2c_replay_setup,
+    i2c_replay_read,
+    i2c_replay_write,
+    i2c_replay_link_read,
+    i2c_replay_link_exec,
+    i2c_replay_link_destroy,
+    i2c_replay_link_batch,
+};
+
+i2c_replay_err_t i2c_replay_init(const uint8_t *log, size_t size){
+    if(i2c_rec_check(log, size) != I2C_REC_SUCCESS)
+        return I2C_REPLAY_INVALID;
+    replay_log = log;
+    replay_size = size;
+    replay_pos = I2C_REC_FILE_HEADER;
+    replay_clock = 0;
+    replay_now_us = 0;
+    replay_stats = (i2c_replay_stats_t){0};
+    return I2C_REPLAY_SUCCESS;
+}
+
+i2c_replay_err_t i2c_replay_load(const char *path){
+    FILE *f = fopen(path, "rb");
+    if(f == NULL)
+        return I2C_REPLAY_OPEN_FAIL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(size <= 0){
+        fclose(f);
+        return I2C_REPLAY_INVALID;
+    }
+
+    uint8_t *log = (uint8_t*)malloc((size_t)size);
+    if(log == NULL){
+        fclose(f);
+        return I2C_REPLAY_NMALLOC;
+    }
+    size_t n = fread(log, 1, (size_t)size, f);
+    fclose(f);
+    i2c_replay_close();
+    i2c_replay_err_t err = n == (size_t)size ? i2c_replay_init(log, n) : I2C_REPLAY_OPEN_FAIL;
+    if(err != I2C_REPLAY_SUCCESS){
+        free(log);
+        return err;
+    }
+    replay_owned = log;
+    return I2C_REPLAY_SUCCESS;
+}
+
+void i2c_replay_close(void){
+    free(replay_owned);
+    replay_owned = NULL;
+    replay_log = NULL;
+    replay_size = 0;
+    replay_pos = 0;
+}
+
+uint64_t i2c_replay_now(void){
+    return replay_now_us;
+}
+
+/*!
+* Done when no whole record is left; a dumped ring may end inside one
+*/
+uint8_t i2c_replay_done(void){
+    i2c_rec_record_t rec;
+    uint64_t clock = replay_clock;
+    return replay_log == NULL || i2c_rec_parse(&replay_log[replay_pos], replay_size - replay_pos, &clock, &rec) == 0;
+}
+
+void i2c_replay_stats(i2c_replay_stats_t *stats){
+    *stats = replay_stats;
+}
+
+static i2c_err_t i2c_replay_setup(i2c_peripheral_t i2c_setup){
+    if(i2c_setup.mode != I2C_MODE_TYPE_MASTER)
+        return I2C_INVALID_SETUP;
+    return I2C_SUCCESS;
+}
+
+static i2c_err_t i2c_replay_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size){
+    const i2c_rec_record_t *rec = i2c_replay_match(I2C_REC_READ, i2c_dev, i2c_reg, size);
+    if(rec == NULL)
+        return I2C_FAIL;
+    memcpy(data_rd, rec->data, size);
+    replay_stats.reads++;
+    return rec->result;
+}
+
+/*!
+* Writes are matched by device, register and size; differing bytes are counted, the
+* recorded result returned all the same
+*/
+static i2c_err_t i2c_replay_write(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size){
+    if(size == 0)
+        return I2C_INVALID_SETUP;
+    const i2c_rec_record_t *rec = i2c_replay_match(I2C_REC_WRITE, i2c_dev, data_wr[0], size);
+    if(rec == NULL)
+        return I2C_FAIL;
+    if(memcmp(data_wr, rec->data, size) != 0)
+        replay_stats.diverged++;
+    replay_stats.writes++;
+    return rec->result;
+}
+
+static i2c_err_t i2c_replay_link_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link){
+    i2c_op_t op = {I2C_XFER_READ, i2c_dev, i2c_reg, data_rd, size};
+    if(link == NULL || size == 0)
+        return I2C_INVALID_SETUP;
+    return i2c_replay_link_batch(&op, 1, link);
+}
+
+static i2c_err_t i2c_replay_link_batch(const i2c_op_t *ops, size_t count, i2c_link_t *link){
+    i2c_replay_link_t *l = (i2c_replay_link_t*)malloc(sizeof(i2c_replay_link_t) + count * sizeof(i2c_op_t));
+    if(l == NULL)
+        return I2C_FAIL;
+    l->count = count;
+    memcpy(l->ops, ops, count * sizeof(i2c_op_t));
+    *link = l;
+    return I2C_SUCCESS;
+}
+
+/*!
+* A batch was recorded as one record per transfer, each with the batch's result; all
+* of them are played, so the position stays in step after a failed batch, and the
+* first failure is returned
+*/
+static i2c_err_t i2c_replay_link_exec(i2c_link_t link){
+    i2c_replay_link_t *l = (i2c_replay_link_t*)link;
+    if(l == NULL)
+        return I2C_INVALID_STATE;
+    i2c_err_t ret = I2C_SUCCESS;
+    for(size_t i = 0; i < l->count; i++){
+        const i2c_op_t *op = &l->ops[i];
+        i2c_err_t r = op->type == I2C_XFER_READ ? i2c_replay_read(op->i2c_dev, op->i2c_reg, op->data, op->size)
+                                                 : i2c_replay_write(op->i2c_dev, op->data, op->size);
+        if(ret == I2C_SUCCESS)
+            ret = r;
+    }
+    return ret;
+}
+
+static void i2c_replay_link_destroy(i2c_link_t *link){
+    if(link && *link){
+        free(*link);
+        *link = NULL;
+    }
+}
+
+/*!
+* Find a transaction's record
+*   1. Walk forward from the position over at most I2C_REPLAY_LOOKAHEAD records,
+*      TIME records only moving the clock
+*   2. On a match the position moves past it; the records passed over are counted
+*   3. Without one the position stays, and the transaction is counted unmatched
+*/
+static const i2c_rec_record_t *i2c_replay_match(i2c_rec_type_t type, i2c_peripheral_t i2c_dev, uint8_t i2c_reg, size_t size){
+    static i2c_rec_record_t rec;
+    if(replay_log == NULL){
+        replay_stats.unmatched++;
+        return NULL;
+    }
+
+    /*! 1. Walk */
+    size_t pos = replay_pos;
+    uint64_t clock = replay_clock;
+    uint32_t passed = 0;
+    while(passed <= I2C_REPLAY_LOOKAHEAD){
+        size_t n = i2c_rec_parse(&replay_log[pos], replay_size - pos, &clock, &rec);
+        if(n == 0)
+            break;
+        pos += n;
+        if(rec.type == I2C_REC_TIME)
+            continue;
+
+        /*! 2. Match */
+        if(rec.type == type && rec.port == i2c_dev.port && rec.addr == i2c_dev.addr && rec.reg == (type == I2C_REC_READ ? i2c_reg : 0) &&
+           rec.size == size && (type == I2C_REC_READ || rec.data[0] == i2c_reg)){
+            replay_pos = pos;
+            replay_clock = clock;
+            replay_now_us = rec.t_us;
+            replay_stats.skipped += passed;
+            return &rec;
+        }
+        passed++;
+    }
+
+    /*! 3. No match */
+    replay_stats.unmatched++;
+    return NULL;
+}
@@ -0,0 +1,77 @@
+/*!
+* @file i2c_replay.h
+* @author Ethan Lew
+*
+* I2C bus backend that plays back a log written by the recorder (i2c_rec.h). Every
+* read is served from the next record of the same device, register and size, with
+* the recorded bytes and result, and every write is checked off against the next
+* recorded write, so the unmodified drivers, and everything fused from them, run
+* again exactly as they did when the log was made: on Linux, and as fast as the host
+* can go, as nothing waits on the bus.
+*
+* A transaction that finds no record within I2C_REPLAY_LOOKAHEAD records fails with
+* I2C_FAIL and leaves the position where it was, so one divergent call (a driver
+* change, a different configuration) does not lose the rest of the log.
+*/
+
+#ifndef I2C_REPLAY_H
+#define I2C_REPLAY_H
+
+#include "../i2c_utils.h"
+
+/* Records searched for a transaction's match */
+#define I2C_REPLAY_LOOKAHEAD 64
+
+typedef enum {
+    I2C_REPLAY_SUCCESS = 0x0,
+    I2C_REPLAY_OPEN_FAIL = 0x1,
+    I2C_REPLAY_NMALLOC = 0x2,
+    I2C_REPLAY_INVALID = 0x3,
+} i2c_replay_err_t;
+
+/*!
+* Replay counters
+*/
+typedef struct i2c_replay_stats_s {
+    uint32_t reads;      /**< Reads served from the log */
+    uint32_t writes;     /**< Writes matched in the log */
+    uint32_t skipped;    /**< Records passed over to reach a match */
+    uint32_t unmatched;  /**< Transactions with no record in reach, failed */
+    uint32_t diverged;   /**< Matched writes whose bytes differ from the log */
+} i2c_replay_stats_t;
+
+/*!
+* @brief replay a log in memory, kept by the caller until i2c_replay_close
+* @returns I2C_REPLAY_INVALID for a bad file header
+*/
+i2c_replay_err_t i2c_replay_init(const uint8_t *log, size_t size);
+
+/*!
+* @brief read a log file and replay it
+*/
+i2c_replay_err_t i2c_replay_load(const char *path);
+
+/*!
+* @brief forget the log, freeing it if i2c_replay_load read it
+*/
+void i2c_replay_close(void);
+
+/*!
+* @brief time of the last record served (us, the recording's clock); stamps for
+* samples read under replay
+*/
+uint64_t i2c_replay_now(void);
+
+/*!
+* @brief non-zero once every record has been served or passed over
+*/
+uint8_t i2c_replay_done(void);
+
+/*!
+* @brief counters since the log was opened
+*/
+void i2c_replay_stats(i2c_replay_stats_t *stats);
+
+extern const i2c_backend_t i2c_replay_backend;
+
+#endif
@@ -0,0 +1,157 @@
+#include <math.h>
+#include <string.h>
+#include "imu_sim.h"
+#include "i2c_fake_bus.h"
+
+#define IMU_SIM_RAD_TO_DPS (57.2957795F)
+#define IMU_SIM_FXAS_CTRL_REG0 0x0D
+#define IMU_SIM_FXAS_CTRL_REG1 0x13
+#define IMU_SIM_FXAS_ACTIVE 0x02
+#define IMU_SIM_FXOS_CTRL_REG1 0x2A
+#define IMU_SIM_FXOS_ACTIVE 0x01
+/* Magnetometer counts per uT */
+#define IMU_SIM_MAGN_COUNTS (10.0F)
+
+static i2c_err_t imu_sim_handler(void *ctx, uint8_t addr, uint8_t reg, uint8_t *data, size_t size, int is_read);
+
+static void imu_sim_step_fxas(imu_sim_t *sim, uint64_t t_us);
+
+static void imu_sim_step_fxos(imu_sim_t *sim, fxos_sim_t *fxos, uint64_t *next_us);
+
+static int16_t imu_sim_counts(float v, float scale, int32_t limit);
+
+void imu_sim_init(imu_sim_t *sim, motion_sim_t *motion, imu_sim_clock_t clock){
+    fxas_sim_init(&sim->fxas);
+    fxos_sim_init(&sim->fxos);
+    fxos_sim_init(&sim->fxos_aux);
+    sim->motion = motion;
+    sim->clock = clock;
+    sim->now_us = clock ? clock() : 0;
+    sim->fxas_next_us = sim->now_us;
+    sim->fxos_next_us = sim->now_us;
+    sim->fxos_aux_next_us = sim->now_us;
+    sim->nacks = 0;
+    pthread_mutex_init(&sim->lock, NULL);
+}
+
+void imu_sim_attach(imu_sim_t *sim, uint32_t clk_hz){
+    i2c_fake_bus_init(clk_hz, imu_sim_handler, sim);
+    i2c_utils_set_backend(&i2c_fake_bus_backend);
+}
+
+/*!
+* Produce the samples due up to now_us
+*   1. A part in standby restarts its timing when it becomes active
+*   2. Samples of all parts are generated in time order, since the motion source
+*      only moves forward
+*/
+void imu_sim_advance(imu_sim_t *sim, uint64_t now_us){
+    pthread_mutex_lock(&sim->lock);
+    if(now_us <= sim->now_us){
+        pthread_mutex_unlock(&sim->lock);
+        return;
+    }
+
+    uint8_t fxas_on = sim->fxas.regs[IMU_SIM_FXAS_CTRL_REG1] & IMU_SIM_FXAS_ACTIVE;
+    uint8_t fxos_on = sim->fxos.regs[IMU_SIM_FXOS_CTRL_REG1] & IMU_SIM_FXOS_ACTIVE;
+    uint8_t aux_on = sim->fxos_aux.regs[IMU_SIM_FXOS_CTRL_REG1] & IMU_SIM_FXOS_ACTIVE;
+    if(!fxas_on)
+        sim->fxas_next_us = now_us;
+    if(!fxos_on)
+        sim->fxos_next_us = now_us;
+    if(!aux_on)
+        sim->fxos_aux_next_us = now_us;
+
+    for(;;){
+        uint8_t fxas_due = fxas_on && sim->fxas_next_us <= now_us;
+        uint8_t fxos_due = fxos_on && sim->fxos_next_us <= now_us;
+        uint8_t aux_due = aux_on && sim->fxos_aux_next_us <= now_us;
+        if(fxas_due && (!fxos_due || sim->fxas_next_us <= sim->fxos_next_us) &&
+           (!aux_due || sim->fxas_next_us <= sim->fxos_aux_next_us)){
+            imu_sim_step_fxas(sim, sim->fxas_next_us);
+        } else if(fxos_due && (!aux_due || sim->fxos_next_us <= sim->fxos_aux_next_us)){
+            imu_sim_step_fxos(sim, &sim->fxos, &sim->fxos_next_us);
+        } else if(aux_due){
+            imu_sim_step_fxos(sim, &sim->fxos_aux, &sim->fxos_aux_next_us);
+        } else {
+            break;
+        }
+    }
+    sim->now_us = now_us;
+    pthread_mutex_unlock(&sim->lock);
+}
+
+void imu_sim_destroy(imu_sim_t *sim){
+    pthread_mutex_destroy(&sim->lock);
+}
+
+/*!
+* Route a transaction to the model at addr, after catching up with the clock
+*/
+static i2c_err_t imu_sim_handler(void *ctx, uint8_t addr, uint8_t reg, uint8_t *data, size_t size, int is_read){
+    imu_sim_t *sim = (imu_sim_t*)ctx;
+    int ret;
+
+    if(sim->clock)
+        imu_sim_advance(sim, sim->clock());
+
+    pthread_mutex_lock(&sim->lock);
+    switch(addr) {
+        case IMU_SIM_FXAS_ADDR:
+        ret = is_read ? fxas_sim_read(&sim->fxas, reg, data, size) : fxas_sim_write(&sim->fxas, data, size);
+        break;
+        case IMU_SIM_FXOS_ADDR:
+        ret = is_read ? fxos_sim_read(&sim->fxos, reg, data, size) : fxos_sim_write(&sim->fxos, data, size);
+        break;
+        case IMU_SIM_FXOS_AUX_ADDR:
+        ret = is_read ? fxos_sim_read(&sim->fxos_aux, reg, data, size) : fxos_sim_write(&sim->fxos_aux, data, size);
+        break;
+        default:
+        sim->nacks++;
+        ret = -1;
+        break;
+    }
+    pthread_mutex_unlock(&sim->lock);
+
+    return ret == 0 ? I2C_SUCCESS : I2C_FAIL;
+}
+
+/*!
+* One gyroscope sample. CTRL_REG0 FS[1:0] selects 2000 dps >> FS full scale, i.e.
+* 16 << FS counts per dps.
+*/
+static void imu_sim_step_fxas(imu_sim_t *sim, uint64_t t_us){
+    motion_frame_t frame;
+    float scale = IMU_SIM_RAD_TO_DPS * (float)(16 << (sim->fxas.regs[IMU_SIM_FXAS_CTRL_REG0] & 0x03));
+    motion_sim_sample(sim->motion, t_us, &frame);
+    fxas_sim_push(&sim->fxas,
+                  imu_sim_counts(frame.gyro[0], scale, 32767),
+                  imu_sim_counts(frame.gyro[1], scale, 32767),
+                  imu_sim_counts(frame.gyro[2], scale, 32767));
+    sim->fxas_next_us += fxas_sim_period_us(&sim->fxas);
+}
+
+/*!
+* One accelerometer/magnetometer sample of fxos, 14 bit accelerometer counts
+*/
+static void imu_sim_step_fxos(imu_sim_t *sim, fxos_sim_t *fxos, uint64_t *next_us){
+    motion_frame_t frame;
+    int16_t accel[3], magn[3];
+    float scale = fxos_sim_counts_per_g(fxos);
+    motion_sim_sample(sim->motion, *next_us, &frame);
+    for(int i = 0; i < 3; i++){
+        accel[i] = imu_sim_counts(frame.accel[i], scale, 8191);
+        magn[i] = imu_sim_counts(frame.magn[i], IMU_SIM_MAGN_COUNTS, 32767);
+    }
+    fxos_sim_push(fxos, accel, magn);
+    *next_us += fxos_sim_period_us(fxos);
+}
+
+static int16_t imu_sim_counts(float v, float scale, int32_t limit){
+    float c = roundf(v * scale);
+    if(c > (float)limit)
+        return (int16_t)limit;
+    if(c < (float)-limit - 1.0F)
+        return (int16_t)(-limit - 1);
+    return (int16_t)c;
+}
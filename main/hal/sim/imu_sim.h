@@ -0,0 +1,75 @@
+/*!
+* @file imu_sim.h
+* @author Ethan Lew
+*
+* Host (Linux) stand-in for the sensor board: the FXAS21002C and FXOS8700 register
+* models on the simulated I2C bus, fed by a motion source. Once attached, the
+* unmodified drivers (gyro_init, accel_init, magn_init, ...) talk to the models through
+* i2c_utils. A second FXOS8700 sits at IMU_SIM_FXOS_AUX_ADDR, as on boards with a
+* redundant IMU; it stays in standby, and costs nothing, until a driver activates it.
+* The bus ports are not modelled: every port reaches the same chips.
+*
+* Each chip produces samples on its own programmed output data rate. By default the
+* models follow the monotonic clock, so every bus transaction first catches the chips
+* up to the current time; with a NULL clock time is virtual and only moves with
+* imu_sim_advance, which makes runs deterministic and as fast as the host allows.
+*
+* These sources are not part of the ESP-IDF component and are only compiled for host.
+*/
+
+#ifndef IMU_SIM_H
+#define IMU_SIM_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "fxas21002c_sim.h"
+#include "fxos8700_sim.h"
+#include "motion_sim.h"
+
+/* Bus addresses of the models, as strapped on the board */
+#define IMU_SIM_FXAS_ADDR (0x21)
+#define IMU_SIM_FXOS_ADDR (0x1F)
+#define IMU_SIM_FXOS_AUX_ADDR (0x1E)
+
+typedef uint64_t (*imu_sim_clock_t)(void);
+
+typedef struct imu_sim_s {
+    fxas_sim_t fxas;
+    fxos_sim_t fxos;
+    fxos_sim_t fxos_aux;         /**< Redundant FXOS8700 */
+    motion_sim_t *motion;        /**< Truth source, owned by the caller */
+    imu_sim_clock_t clock;       /**< Time source (us), NULL for virtual time */
+    uint64_t now_us;             /**< Time the models are valid at */
+    uint64_t fxas_next_us;       /**< Next gyroscope sample */
+    uint64_t fxos_next_us;       /**< Next accelerometer/magnetometer sample */
+    uint64_t fxos_aux_next_us;   /**< Next sample of the redundant FXOS8700 */
+    uint32_t nacks;              /**< Transactions to an address with no model */
+    pthread_mutex_t lock;
+} imu_sim_t;
+
+/*!
+* @brief reset both chip models
+* @param sim the simulator
+* @param motion the motion source
+* @param clock time source in microseconds, NULL for virtual time
+*/
+void imu_sim_init(imu_sim_t *sim, motion_sim_t *motion, imu_sim_clock_t clock);
+
+/*!
+* @brief install the simulator as the i2c_utils backend
+* @param sim the simulator
+* @param clk_hz the modelled SCL frequency, 0 to run transactions without bus timing
+*/
+void imu_sim_attach(imu_sim_t *sim, uint32_t clk_hz);
+
+/*!
+* @brief move the models to now_us, producing every sample due on the way
+*/
+void imu_sim_advance(imu_sim_t *sim, uint64_t now_us);
+
+/*!
+* @brief release the simulator
+*/
+void imu_sim_destroy(imu_sim_t *sim);
+
+#endif
@@ -0,0 +1,222 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "motion_sim.h"
+
+/* Longest integration step of the synthetic orientation */
+#define MOTION_SIM_MAX_STEP_US 1000
+#define MOTION_SIM_PI (3.14159265F)
+
+static void motion_sim_rate(const motion_sim_t *sim, uint64_t t_us, float *w);
+
+static void motion_sim_integrate(motion_sim_t *sim, uint64_t t_us);
+
+static void motion_sim_to_body(const float *q, const float *v, float *out);
+
+static float motion_sim_gauss(motion_sim_t *sim);
+
+void motion_sim_default_config(motion_sim_config_t *config){
+    static const motion_sim_config_t defaults = {
+        .amp = {0.6F, 0.4F, 0.8F},
+        .freq = {0.31F, 0.17F, 0.07F},
+        .phase = {0.0F, 1.0F, 2.0F},
+        .field = {20.0F, 0.0F, -45.0F},
+        .gyro_bias = {0.004F, -0.006F, 0.002F},
+        .accel_bias = {0.01F, -0.02F, 0.015F},
+        .magn_bias = {5.0F, -3.0F, 8.0F},
+        .gyro_noise = 0.002F,
+        .accel_noise = 0.003F,
+        .magn_noise = 0.3F,
+        .seed = 0x2545F491,
+    };
+    *config = defaults;
+}
+
+void motion_sim_init(motion_sim_t *sim, const motion_sim_config_t *config){
+    memset(sim, 0, sizeof(motion_sim_t));
+    sim->config = *config;
+    sim->q[0] = 1.0F;
+    sim->rng = config->seed ? config->seed : 1;
+}
+
+/*!
+* Load a replay log
+*   1. Parse every well formed line into a frame
+*   2. Rebase the timestamps so the first sample is at 0
+*/
+motion_sim_err_t motion_sim_open(motion_sim_t *sim, const char *path){
+    memset(sim, 0, sizeof(motion_sim_t));
+    sim->q[0] = 1.0F;
+    sim->rng = 1;
+
+    FILE *f = fopen(path, "r");
+    if(!f)
+        return MOTION_SIM_OPEN_FAIL;
+
+    uint32_t capacity = 1024;
+    sim->log = (motion_frame_t*)malloc(capacity * sizeof(motion_frame_t));
+    if(!sim->log){
+        fclose(f);
+        return MOTION_SIM_NMALLOC;
+    }
+
+    char line[512];
+    while(fgets(line, sizeof(line), f)){
+        if(line[0] == '#')
+            continue;
+        for(char *c = line; *c; c++){
+            if(*c == ',')
+                *c = ' ';
+        }
+        unsigned long long t;
+        motion_frame_t *fr = &sim->log[sim->log_len];
+        if(sscanf(line, "%llu %f %f %f %f %f %f %f %f %f", &t,
+                  &fr->accel[0], &fr->accel[1], &fr->accel[2],
+                  &fr->gyro[0], &fr->gyro[1], &fr->gyro[2],
+                  &fr->magn[0], &fr->magn[1], &fr->magn[2]) != 10)
+            continue;
+        fr->t_us = t;
+        if(++sim->log_len == capacity){
+            capacity *= 2;
+            motion_frame_t *grown = (motion_frame_t*)realloc(sim->log, capacity * sizeof(motion_frame_t));
+            if(!grown){
+                fclose(f);
+                motion_sim_close(sim);
+                return MOTION_SIM_NMALLOC;
+            }
+            sim->log = grown;
+        }
+    }
+    fclose(f);
+
+    if(sim->log_len == 0){
+        motion_sim_close(sim);
+        return MOTION_SIM_EMPTY;
+    }
+    uint64_t t0 = sim->log[0].t_us;
+    for(uint32_t i = 0; i < sim->log_len; i++)
+        sim->log[i].t_us -= t0;
+    return MOTION_SIM_SUCCESS;
+}
+
+void motion_sim_close(motion_sim_t *sim){
+    free(sim->log);
+    sim->log = NULL;
+    sim->log_len = 0;
+}
+
+/*!
+* Synthetic: integrate the orientation up to t_us, then rotate the references into the
+* body frame and add bias and noise. Replay: advance to the last sample at or before
+* t_us, wrapping with a time offset at the end of the log.
+*/
+void motion_sim_sample(motion_sim_t *sim, uint64_t t_us, motion_frame_t *frame){
+    if(sim->log){
+        uint64_t span = sim->log[sim->log_len - 1].t_us;
+        for(;;){
+            uint32_t next = sim->log_pos + 1;
+            if(next == sim->log_len){
+                if(sim->log_len == 1)
+                    break;
+                /* Loop one mean period after the last sample */
+                uint64_t wrap = span + (sim->log_len > 1 ? span / (sim->log_len - 1) : 1);
+                if(t_us < sim->log_offset + wrap)
+                    break;
+                sim->log_offset += wrap;
+                sim->log_pos = 0;
+                continue;
+            }
+            if(sim->log[next].t_us + sim->log_offset > t_us)
+                break;
+            sim->log_pos = next;
+        }
+        *frame = sim->log[sim->log_pos];
+        frame->t_us = t_us;
+        return;
+    }
+
+    const motion_sim_config_t *c = &sim->config;
+    static const float gravity[3] = {0.0F, 0.0F, 1.0F};
+    float a[3], m[3];
+
+    motion_sim_integrate(sim, t_us);
+    motion_sim_rate(sim, t_us, frame->gyro);
+    motion_sim_to_body(sim->q, gravity, a);
+    motion_sim_to_body(sim->q, c->field, m);
+
+    frame->t_us = t_us;
+    for(int i = 0; i < 3; i++){
+        frame->gyro[i] += c->gyro_bias[i] + c->gyro_noise * motion_sim_gauss(sim);
+        frame->accel[i] = a[i] + c->accel_bias[i] + c->accel_noise * motion_sim_gauss(sim);
+        frame->magn[i] = m[i] + c->magn_bias[i] + c->magn_noise * motion_sim_gauss(sim);
+    }
+}
+
+static void motion_sim_rate(const motion_sim_t *sim, uint64_t t_us, float *w){
+    float t = (float)((double)t_us * 1e-6);
+    for(int i = 0; i < 3; i++)
+        w[i] = sim->config.amp[i] * sinf(2.0F * MOTION_SIM_PI * sim->config.freq[i] * t + sim->config.phase[i]);
+}
+
+/*!
+* Midpoint rule in steps of at most MOTION_SIM_MAX_STEP_US, q = q exp(w dt / 2)
+*/
+static void motion_sim_integrate(motion_sim_t *sim, uint64_t t_us){
+    while(sim->t_us < t_us){
+        uint64_t step = t_us - sim->t_us;
+        if(step > MOTION_SIM_MAX_STEP_US)
+            step = MOTION_SIM_MAX_STEP_US;
+        float w[3];
+        motion_sim_rate(sim, sim->t_us + step / 2, w);
+
+        float dt = (float)step * 1e-6F;
+        float v[3] = {w[0] * dt, w[1] * dt, w[2] * dt};
+        float angle = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        float dq[4] = {1.0F, 0.5F * v[0], 0.5F * v[1], 0.5F * v[2]};
+        if(angle > 1e-9F){
+            float s = sinf(0.5F * angle) / angle;
+            dq[0] = cosf(0.5F * angle);
+            dq[1] = s * v[0];
+            dq[2] = s * v[1];
+            dq[3] = s * v[2];
+        }
+
+        float *q = sim->q;
+        float r[4];
+        r[0] = q[0] * dq[0] - q[1] * dq[1] - q[2] * dq[2] - q[3] * dq[3];
+        r[1] = q[0] * dq[1] + q[1] * dq[0] + q[2] * dq[3] - q[3] * dq[2];
+        r[2] = q[0] * dq[2] - q[1] * dq[3] + q[2] * dq[0] + q[3] * dq[1];
+        r[3] = q[0] * dq[3] + q[1] * dq[2] - q[2] * dq[1] + q[3] * dq[0];
+        float n = 1.0F / sqrtf(r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + r[3] * r[3]);
+        for(int i = 0; i < 4; i++)
+            q[i] = r[i] * n;
+        sim->t_us += step;
+    }
+}
+
+/*!
+* out = R(q)^T v
+*/
+static void motion_sim_to_body(const float *q, const float *v, float *out){
+    float w = q[0], x = q[1], y = q[2], z = q[3];
+    out[0] = (1.0F - 2.0F * (y * y + z * z)) * v[0] + 2.0F * (x * y + w * z) * v[1] + 2.0F * (x * z - w * y) * v[2];
+    out[1] = 2.0F * (x * y - w * z) * v[0] + (1.0F - 2.0F * (x * x + z * z)) * v[1] + 2.0F * (y * z + w * x) * v[2];
+    out[2] = 2.0F * (x * z + w * y) * v[0] + 2.0F * (y * z - w * x) * v[1] + (1.0F - 2.0F * (x * x + y * y)) * v[2];
+}
+
+/*!
+* Box-Muller over an xorshift32 generator, reproducible for a given seed
+*/
+static float motion_sim_gauss(motion_sim_t *sim){
+    float u[2];
+    for(int i = 0; i < 2; i++){
+        uint32_t x = sim->rng;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        sim->rng = x;
+        u[i] = ((float)(x >> 8) + 0.5F) * (1.0F / 16777216.0F);
+    }
+    return sqrtf(-2.0F * logf(u[0])) * cosf(2.0F * MOTION_SIM_PI * u[1]);
+}
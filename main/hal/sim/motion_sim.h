@@ -0,0 +1,97 @@
+/*!
+* @file motion_sim.h
+* @author Ethan Lew
+*
+* Motion source for the host sensor models. Either generates synthetic motion (a sum
+* of sinusoidal body rates integrated into an orientation, with the gravity and
+* magnetic field vectors rotated into the body frame, plus a constant bias and
+* Gaussian noise per sensor) or replays a recorded text log. Frames are in sensor
+* units: g, rad/s and uT.
+*
+* Replay files hold one sample per line, whitespace or comma separated:
+*     t_us ax ay az gx gy gz mx my mz
+* Lines starting with '#' are skipped. Samples are held until the next timestamp
+* and the log loops when it runs out.
+*
+* These sources are not part of the ESP-IDF component and are only compiled for host.
+*/
+
+#ifndef MOTION_SIM_H
+#define MOTION_SIM_H
+
+#include <stdint.h>
+
+#define MOTION_SIM_AXES 3
+
+/*!
+* One frame of sensor truth
+*/
+typedef struct motion_frame_s {
+    uint64_t t_us;      /**< Time of the frame */
+    float accel[3];     /**< Specific force (g) */
+    float gyro[3];      /**< Angular rate (rad/s) */
+    float magn[3];      /**< Magnetic field (uT) */
+} motion_frame_t;
+
+/*!
+* Synthetic motion parameters. Body rate on axis i is
+* amp[i] * sin(2 pi freq[i] t + phase[i]).
+*/
+typedef struct motion_sim_config_s {
+    float amp[MOTION_SIM_AXES];      /**< Rate amplitude (rad/s) */
+    float freq[MOTION_SIM_AXES];     /**< Rate frequency (Hz) */
+    float phase[MOTION_SIM_AXES];    /**< Rate phase (rad) */
+    float field[3];                  /**< Earth frame magnetic field (uT, north-west-up) */
+    float gyro_bias[3];              /**< rad/s */
+    float accel_bias[3];             /**< g */
+    float magn_bias[3];              /**< Hard iron offset (uT) */
+    float gyro_noise;                /**< Standard deviation (rad/s) */
+    float accel_noise;               /**< Standard deviation (g) */
+    float magn_noise;                /**< Standard deviation (uT) */
+    uint32_t seed;                   /**< Noise generator seed, non-zero */
+} motion_sim_config_t;
+
+typedef enum {
+    MOTION_SIM_SUCCESS = 0x0,
+    MOTION_SIM_OPEN_FAIL = 0x1,  /**< Replay file could not be read */
+    MOTION_SIM_EMPTY = 0x2,      /**< Replay file holds no samples */
+    MOTION_SIM_NMALLOC = 0x3,
+} motion_sim_err_t;
+
+typedef struct motion_sim_s {
+    motion_sim_config_t config;
+    float q[4];                  /**< Synthetic orientation, {w, x, y, z}, body to earth */
+    uint64_t t_us;               /**< Time the orientation is valid at */
+    uint32_t rng;                /**< xorshift32 state */
+    motion_frame_t *log;         /**< Replay samples, NULL for synthetic motion */
+    uint32_t log_len;
+    uint32_t log_pos;            /**< Sample currently held */
+    uint64_t log_offset;         /**< Time added to the log on each loop */
+} motion_sim_t;
+
+/*!
+* @brief a gentle three axis wobble in a 50 uT field, with MEMS grade bias and noise
+*/
+void motion_sim_default_config(motion_sim_config_t *config);
+
+/*!
+* @brief start synthetic motion from the identity orientation at time 0
+*/
+void motion_sim_init(motion_sim_t *sim, const motion_sim_config_t *config);
+
+/*!
+* @brief start replaying a recorded log, its first sample at time 0
+*/
+motion_sim_err_t motion_sim_open(motion_sim_t *sim, const char *path);
+
+/*!
+* @brief sensor frame at t_us; t_us must not decrease between calls
+*/
+void motion_sim_sample(motion_sim_t *sim, uint64_t t_us, motion_frame_t *frame);
+
+/*!
+* @brief release a replay log
+*/
+void motion_sim_close(motion_sim_t *sim);
+
+#endif
@@ -1,13 +1,12 @@
 #include "time_utils.h"
 
-uint32_t get_time_millis () {
-    return (uint32_t) (clock() * 1000 / CLOCKS_PER_SEC);
-}
-
-uint32_t get_time_micros () {
-    return (uint32_t) (clock() * 1000000 / CLOCKS_PER_SEC);
-}
+#ifdef OTIS_HOST
+uint64_t time_utils_offset_us;
+#endif
 
+/*!
+* The first diff counts from boot, so the first update after start always fires
+*/
 void start_hal_timer(timer_hal_t* timer){
     timer->curr = get_time_micros();
     timer->prev = 0;
@@ -24,4 +23,4 @@ void reset_hal_timer(timer_hal_t* timer){
     timer->prev = timer->curr;
     timer->curr = get_time_micros();
     timer->diff = timer->curr - timer->prev;
-}
\ No newline at end of file
+}
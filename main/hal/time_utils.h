@@ -2,6 +2,12 @@
 *  @author Ethan Lew
 *
 * Provide a very simple abstraction of timing functions.
+*
+* The time base is a monotonic 64 bit microsecond count since boot: the ESP32 high
+* resolution timer (esp_timer) on target and CLOCK_MONOTONIC on the host. It does not
+* wrap in practice and, unlike clock(), keeps counting wall time while tasks block.
+* The read is inline and safe from ISRs, so it is also the timestamp for data-ready
+* edges and every downstream sample stamp.
 */
 
 #ifndef TIME_UTILS_H
@@ -9,22 +15,41 @@
 
 #include <stdint.h>
 #include <time.h>
+#ifndef OTIS_HOST
+#include "esp_timer.h"
+#endif
+
+#ifdef OTIS_HOST
+/* Added to every host reading so that checks can start the clock anywhere, e.g. just
+   short of 2^32 us; 0 unless set. The absolute deadlines in os_utils.c take it off. */
+extern uint64_t time_utils_offset_us;
+#endif
 
 typedef struct timer_hal_s{
-    uint32_t prev;
-    uint32_t curr;
-    uint32_t diff; 
+    uint64_t prev;
+    uint64_t curr;
+    uint64_t diff; 
 } timer_hal_t;
 
 /*
-* @brief get the time in milliseconds
+* @brief get the time in microseconds
 */
-uint32_t get_time_millis();
+static inline uint64_t get_time_micros(void){
+#ifdef OTIS_HOST
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL + time_utils_offset_us;
+#else
+    return (uint64_t)esp_timer_get_time();
+#endif
+}
 
 /*
-* @brief get the time in microseconds
+* @brief get the time in milliseconds
 */
-uint32_t get_time_micros ();
+static inline uint64_t get_time_millis(void){
+    return get_time_micros() / 1000ULL;
+}
 
 /*!
 * @brief create a hal timer
@@ -41,4 +66,4 @@ void update_hal_timer(timer_hal_t* timer);
 */
 void reset_hal_timer(timer_hal_t* timer);
 
-#endif
\ No newline at end of file
+#endif
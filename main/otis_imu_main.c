@@ -2,55 +2,806 @@
 * @file otis_imu_main.c
 * @author Ethan Lew
 *
-* For now, the main task grabs gyroscope data and prints it to the serial device.
+* A three stage pipeline (hal/pipeline.h): the sampling task reads the sensors on one
+* core; on the other, the fusion task fuses each sample and the output task streams
+* it as binary telemetry frames (see telemetry/telem_proto.h), decoded on the host
+* with tools/otis_telem_csv.
+*
+* With I2C_RECORD, every bus transaction of the sensors is also kept in a ring in
+* PSRAM (hal/i2c_rec.h), sent on the host's TELEM_CMD_REC_DUMP (otis_telem_csv -l)
+* and replayed on Linux with tools/otis_replay_bench -r.
 */
-#include "hal/fxas21002c.h"
-#include "hal/fxos8700.h"
+#include <string.h>
+#include "hal/imu_dev.h"
 #include "hal/time_utils.h"
+#include "hal/drdy.h"
+#include "hal/pipeline.h"
+#include "hal/perf.h"
+#include "hal/i2c_rec.h"
+#include "hal/resample.h"
+#include "fusion/filter.h"
+#include "fusion/magcal.h"
+#include "fusion/stillcal.h"
+#include "telemetry/telemetry.h"
+#include "telemetry/telem_uart.h"
+#include "telemetry/telem_decode.h"
+#include "nvs_flash.h"
 
 #define SAMPLE_PERIOD 10
 
-static void gyro_test_task(void *arg)
+/* Sample on the sensors' data-ready interrupts instead of every SAMPLE_PERIOD ms */
+#ifndef SAMPLE_DRDY
+#define SAMPLE_DRDY 0
+#endif
+/* Read both sensors in one bus transaction every SAMPLE_PERIOD ms (not with SAMPLE_DRDY) */
+#ifndef SAMPLE_BATCH
+#define SAMPLE_BATCH 1
+#endif
+/* Otherwise queue the two reads back to back on the I2C transaction engine, so the
+   bus task runs them and the sampling task sleeps until both are in */
+#ifndef SAMPLE_ENGINE
+#define SAMPLE_ENGINE 1
+#endif
+#define SAMPLE_QUEUED (!SAMPLE_DRDY && !SAMPLE_BATCH && SAMPLE_ENGINE)
+/* The bus task runs above the sampling task it serves */
+#define SAMPLE_ENGINE_PRIORITY (PIPELINE_SAMPLE_PRIORITY + 1)
+/* Longest wait for the queued reads (us) */
+#define SAMPLE_ENGINE_TIMEOUT_US (SAMPLE_PERIOD * 1000)
+/* GPIOs wired to the INT1 pins */
+#define GYRO_INT1_IO 25
+#define FXOS_INT1_IO 26
+/* Notification bits of the data-ready sources */
+#define DRDY_BIT_GYRO (1 << 0)
+#define DRDY_BIT_FXOS (1 << 1)
+/* Longest wait for an edge before reporting a stall */
+#define DRDY_TIMEOUT_MS 100
+/* Data-ready samples are resampled onto the SAMPLE_PERIOD grid, emitted at most this late */
+#define RESAMPLE_MAX_DELAY_US 25000
+#define RESAMPLE_ORDER RESAMPLE_LINEAR
+/* Print latency histograms every this many gyroscope samples */
+#define DRDY_REPORT_SAMPLES 1000
+/* How often the output task drains its ring (ms) */
+#define OUTPUT_PERIOD 10
+/* Placement of the stages: sampling alone on one core, fusion and output on the other */
+#ifndef PIPELINE_SAMPLE_CORE
+#define PIPELINE_SAMPLE_CORE 0
+#endif
+#ifndef PIPELINE_FUSE_CORE
+#define PIPELINE_FUSE_CORE 1
+#endif
+#ifndef PIPELINE_SAMPLE_PRIORITY
+#define PIPELINE_SAMPLE_PRIORITY 10
+#endif
+#ifndef PIPELINE_FUSE_PRIORITY
+#define PIPELINE_FUSE_PRIORITY 6
+#endif
+#ifndef PIPELINE_OUTPUT_PRIORITY
+#define PIPELINE_OUTPUT_PRIORITY 5
+#endif
+/* Deadlines from the sample stamp (us): published within a sample period (plus the
+   resampling delay on data-ready), fused within two, sent by the next output drain */
+#if SAMPLE_DRDY
+#define PIPELINE_SAMPLE_DEADLINE_US (RESAMPLE_MAX_DELAY_US + SAMPLE_PERIOD * 1000)
+#else
+#define PIPELINE_SAMPLE_DEADLINE_US (SAMPLE_PERIOD * 1000)
+#endif
+#define PIPELINE_FUSE_DEADLINE_US (PIPELINE_SAMPLE_DEADLINE_US + SAMPLE_PERIOD * 1000)
+#define PIPELINE_OUTPUT_DEADLINE_US (PIPELINE_FUSE_DEADLINE_US + OUTPUT_PERIOD * 1000)
+/* Print the stage counters (and the perf.h probes, with OTIS_PERF) every this many samples */
+#define PIPELINE_REPORT_SAMPLES 6000
+/* Attitude filter, see filter_mode_t. 6 DoF modes run the FXOS8700 accelerometer only.
+   Fixed point builds (fixed.h) default to the integer Mahony */
+#ifndef FILTER_MODE
+#if OTIS_FIXED_POINT
+#define FILTER_MODE FILTER_MAHONY_FIXED
+#else
+#define FILTER_MODE FILTER_MADGWICK
+#endif
+#endif
+/* Refine the magnetometer hard/soft iron correction while running, see magcal.h */
+#ifndef MAGN_CALIBRATE
+#define MAGN_CALIBRATE 1
+#endif
+/* Samples between fits, a second at the filter rate */
+#define MAGN_CALIBRATE_FIT_SAMPLES 100
+/* Longest the fusion stage waits at start for the sampling stage to open the FXOS8700 (us) */
+#define MAGN_CALIBRATE_OPEN_US (2U * 1000000U)
+/* Learn gyroscope bias and accelerometer offset/gain while still, see stillcal.h */
+#ifndef IMU_CALIBRATE
+#define IMU_CALIBRATE 1
+#endif
+/* Shortest time between gyroscope bias writes to flash (us) */
+#define IMU_CAL_STORE_INTERVAL (600ULL * 1000000ULL)
+
+/* Frames sent per sample: RAW (sensor values) and/or QUAT (fused orientation) */
+#define TELEMETRY_RAW 1
+#define TELEMETRY_QUAT 1
+/* Stream parameters are re-sent every this many samples for late decoders */
+#define TELEMETRY_INFO_SAMPLES 500
+/* Frames are batched into one UART write per drain of up to this many bytes */
+#define TELEMETRY_BATCH 512
+/* Print the former "%2.3f" text lines instead of frames */
+#ifndef TELEMETRY_TEXT
+#define TELEMETRY_TEXT 0
+#endif
+/* Measure the encode cost of frames against the text line (CPU cycles) */
+#ifndef TELEMETRY_BENCH
+#define TELEMETRY_BENCH 0
+#endif
+#define TELEMETRY_BENCH_SAMPLES 1000
+/* Record the sensor bus into a ring for replay, see hal/i2c_rec.h */
+#ifndef I2C_RECORD
+#define I2C_RECORD 0
+#endif
+/* Ring size, in PSRAM when the module has it */
+#define I2C_RECORD_SIZE (256 * 1024)
+/* REC frames sent per output drain during a dump, a share of the UART the samples leave */
+#define I2C_RECORD_DUMP_CHUNKS 2
+/* The output stage reads commands from the host */
+#define SENDER_COMMANDS (OTIS_PERF || I2C_RECORD)
+
+#if TELEMETRY_BENCH
+#include "xtensa/hal.h"
+#endif
+
+static pipeline_t pipeline;
+#if MAGN_CALIBRATE
+/* Given by the sampling stage once the FXOS8700 is open, for the fusion stage's view */
+static os_signal_t fxos_opened;
+#endif
+
+/*!
+* State of the sampling stage, owned by its task
+*/
+typedef struct sampler_s {
+    imu_dev_t gyro_dev;
+    imu_dev_t fxos_dev;
+    uint32_t seq;
+#if !SAMPLE_DRDY && SAMPLE_BATCH
+    i2c_link_t sample_link;   /**< Both sample reads, NULL to read them one by one */
+#endif
+#if SAMPLE_QUEUED
+    imu_dev_queue_t queue;    /**< Both sample reads on the engine */
+    uint8_t queued;           /**< The queue is usable, else the reads are made here */
+#endif
+#if SAMPLE_DRDY
+    drdy_group_t drdy_group;
+    drdy_source_t gyro_drdy;
+    drdy_source_t fxos_drdy;
+    resampler_t resampler;
+    uint32_t timeouts;        /**< Waits that timed out, not posted yet */
+    uint8_t report_due;       /**< The latency histograms are due to be posted */
+#endif
+} sampler_t;
+
+/*!
+* State of the fusion stage
+*/
+typedef struct fuser_s {
+    filter_t filter;
+#if MAGN_CALIBRATE
+    magcal_t magn_cal;
+    magn_t *magn_view;
+#endif
+} fuser_t;
+
+/*!
+* State of the output stage: frames of the current drain
+*/
+typedef struct sender_s {
+    telem_encoder_t telem;
+    uint8_t batch[TELEMETRY_BATCH];
+    size_t n;
+    uint32_t samples;
+#if SENDER_COMMANDS
+    telem_decoder_t commands;     /**< CMD frames from the host */
+#endif
+#if OTIS_PERF
+    uint8_t report_due;
+    uint8_t report[TELEM_PERF_REPORT_MAX];
+#endif
+#if I2C_RECORD
+    uint8_t dumping;              /**< A recording dump is under way */
+    uint32_t dump_offset;         /**< Next log byte to send */
+    uint32_t dump_total;
+    uint8_t dump[I2C_RECORD_DUMP_CHUNKS * TELEM_REC_FRAME(TELEM_REC_CHUNK)];
+#endif
+} sender_t;
+
+#if SAMPLE_DRDY
+/*!
+* Data-ready counters on their way from the sampling task to the output task, which
+* prints them, so the console never delays a read. One slot, as cal_post_t: full is
+* set by the sampler with the copies in place and cleared by the output stage.
+*/
+typedef struct drdy_post_s {
+    drdy_source_t gyro;       /**< Copies of the sources, histograms included */
+    drdy_source_t fxos;
+    uint8_t report;           /**< The copies are to be printed */
+    uint32_t timeouts;        /**< Waits that timed out since the last post */
+    uint32_t full;
+} drdy_post_t;
+
+static drdy_post_t drdy_post;
+#endif
+
+#if IMU_CALIBRATE
+/*!
+* A calibration record on its way from the sampling task, which learns it, to the
+* output task, which prints and stores it, so neither flash nor the console ever
+* blocks a bus read. One slot: full is set by the sampler with the record in place and
+* cleared by the output stage once it has a copy.
+*/
+typedef struct cal_post_s {
+    imu_cal_t cal;
+    uint32_t changed;         /**< IMU_CAL_* parts that changed since the last post */
+    float pose_error;         /**< Of the accelerometer fit (m/s^2) */
+    uint32_t full;
+} cal_post_t;
+
+static cal_post_t cal_post;
+
+/*!
+* Still period calibration, on the sampling task that owns the devices
+*   1. Feed the merged sample, as the drivers corrected it
+*   2. After a still block, fold the residuals in and hand the changed parts to the
+*      drivers, so the next sample is corrected with them
+*   3. Post an accelerometer fit at once; a gyroscope bias the first time in a boot,
+*      then at most every IMU_CAL_STORE_INTERVAL to spare the flash. A post the output
+*      stage has not taken yet is retried on the next sample, with the latest record.
+*/
+static void imu_calibrate(imu_dev_t *gyro_dev, imu_dev_t *fxos_dev, const imu_sample_t *sample)
+{
+    static stillcal_t still;
+    static imu_cal_t cal;
+    static uint8_t started;
+    static uint64_t stored_us;
+    static uint32_t unposted;
+
+    if(!started){
+        stillcal_init(&still);
+        if(imu_cal_load(&cal) != IMU_CAL_SUCCESS)
+            imu_cal_identity(&cal);
+        started = 1;
+    }
+    if(unposted && !__atomic_load_n(&cal_post.full, __ATOMIC_ACQUIRE)){
+        cal_post.cal = cal;
+        cal_post.changed = unposted;
+        cal_post.pose_error = still.pose_error;
+        __atomic_store_n(&cal_post.full, 1, __ATOMIC_RELEASE);
+        unposted = 0;
+    }
+    if((sample->status & (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID)) !=
+       (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID))
+        return;
+    gyro_float_data_t gyro = sample->gyro;
+    raw_float_data_t accel = sample->accel;
+    if(stillcal_add(&still, &gyro, &accel) != STILLCAL_STILL)
+        return;
+
+    uint32_t changed = stillcal_update(&still, &cal);
+    if(changed & IMU_CAL_GYRO)
+        IMU_GYRO_CALL(calibrate)(gyro_dev, &cal);
+    if(changed & IMU_CAL_ACCEL)
+        IMU_ACCEL_CALL(calibrate)(fxos_dev, &cal);
+    uint64_t now = get_time_micros();
+    uint8_t due = stored_us == 0 || now - stored_us >= IMU_CAL_STORE_INTERVAL;
+    if((changed & IMU_CAL_ACCEL) || ((changed & IMU_CAL_GYRO) && due)){
+        unposted |= changed;
+        stored_us = now ? now : 1;
+    }
+}
+#endif
+
+/*!
+* Open and configure the sensors, on the sampling task so the data-ready group
+* binds to it
+*/
+static void sampler_start(void *ctx)
 {
-    /* Timing parameters */
-    const TickType_t init_wait = 100 / portTICK_PERIOD_MS;
-    TickType_t xLastWakeTime;
-    const TickType_t xPeriod = pdMS_TO_TICKS( SAMPLE_PERIOD );
-    xLastWakeTime = xTaskGetTickCount();
+    sampler_t *sp = (sampler_t*)ctx;
+    imu_sample_t reading;
+    size_t count;
+    (void)reading;
+    (void)count;
 
-    /* Create generic gyroscope */
-    gyro_t* gyro = NULL;
-    if(gyro_init(&gyro) != GYRO_SUCCESS){
+    /* Gyroscope and accelerometer/magnetometer devices, see imu_dev.h for the drivers */
+    if(IMU_GYRO_OPEN(&sp->gyro_dev) != IMU_DEV_SUCCESS){
         printf("Gyroscope initialization failed.\n");
     }
-    vTaskDelay(init_wait);
+    os_sleep_us(100000);
+
+    if(IMU_ACCEL_OPEN(&sp->fxos_dev) != IMU_DEV_SUCCESS){
+        printf("Accelerometer/magnetometer initialization failed.\n");
+    }
+    const uint8_t use_magn = filter_uses_magn(FILTER_MODE);
+    imu_dev_config_t fxos_config = sp->fxos_dev.config;
+    fxos_config.sensors = IMU_DEV_ACCEL | (use_magn ? IMU_DEV_MAGN : 0);
+    fxos_config.drdy = SAMPLE_DRDY;
+    if(IMU_ACCEL_CALL(configure)(&sp->fxos_dev, &fxos_config) != IMU_DEV_SUCCESS){
+        printf("Accelerometer configuration failed.\n");
+    }
+#if MAGN_CALIBRATE
+    os_signal_give(&fxos_opened);
+#endif
+    sp->seq = 0;
+
+#if SAMPLE_DRDY
+    /* Wake on data-ready edges and read each sensor exactly once per sample */
+    drdy_group_init(&sp->drdy_group);
+    if(drdy_source_init(&sp->gyro_drdy, &sp->drdy_group, GYRO_INT1_IO, DRDY_BIT_GYRO) != DRDY_SUCCESS ||
+       drdy_source_init(&sp->fxos_drdy, &sp->drdy_group, FXOS_INT1_IO, DRDY_BIT_FXOS) != DRDY_SUCCESS){
+        printf("Data-ready interrupt setup failed.\n");
+    }
+    imu_dev_config_t gyro_config = sp->gyro_dev.config;
+    gyro_config.drdy = 1;
+    IMU_GYRO_CALL(configure)(&sp->gyro_dev, &gyro_config);
+    /* Read once so the INT pins deassert and the first edges are not lost */
+    IMU_GYRO_CALL(read_batch)(&sp->gyro_dev, &reading, 1, &count);
+    IMU_ACCEL_CALL(read_batch)(&sp->fxos_dev, &reading, 1, &count);
+
+    sp->timeouts = 0;
+    sp->report_due = 0;
+
+    /* Align both sensors onto the SAMPLE_PERIOD grid the filter runs at */
+    resample_init(&sp->resampler, SAMPLE_PERIOD * 1000, RESAMPLE_MAX_DELAY_US, RESAMPLE_ORDER,
+                  RESAMPLE_USE_GYRO | RESAMPLE_USE_ACCEL | (use_magn ? RESAMPLE_USE_MAGN : 0));
+#elif SAMPLE_BATCH
+    /* Built once the sensors are configured, the read sizes depend on it */
+    imu_dev_t *const devs[2] = {&sp->gyro_dev, &sp->fxos_dev};
+    sp->sample_link = NULL;
+    if(imu_dev_sample_link(devs, 2, &sp->sample_link) != IMU_DEV_SUCCESS){
+        printf("Batched sample read unavailable, reading the sensors one by one.\n");
+        sp->sample_link = NULL;
+    }
+#elif SAMPLE_QUEUED
+    imu_dev_t *const devs[2] = {&sp->gyro_dev, &sp->fxos_dev};
+    sp->queued = i2c_utils_engine_start(NULL, SAMPLE_ENGINE_PRIORITY) == I2C_SUCCESS &&
+                 imu_dev_queue_init(&sp->queue, devs, 2) == IMU_DEV_SUCCESS;
+    if(!sp->queued){
+        printf("Queued sample reads unavailable, reading the sensors one by one.\n");
+    }
+#endif
+#if I2C_RECORD
+    /* The setup stays in the recording however long it runs */
+    if(i2c_rec_keep() != I2C_REC_SUCCESS){
+        printf("I2C recording cannot keep the sensor setup.\n");
+    }
+#endif
+}
+
+static void sampler_stop(void *ctx)
+{
+    sampler_t *sp = (sampler_t*)ctx;
+#if !SAMPLE_DRDY && SAMPLE_BATCH
+    i2c_utils_link_destroy(&sp->sample_link);
+#endif
+#if SAMPLE_QUEUED
+    i2c_utils_engine_stop();
+    if(sp->queued)
+        imu_dev_queue_destroy(&sp->queue);
+#endif
+    IMU_GYRO_CALL(destroy)(&sp->gyro_dev);
+    IMU_ACCEL_CALL(destroy)(&sp->fxos_dev);
+}
+
+#if SAMPLE_DRDY
+/*!
+* Post the timeouts and the due latency histograms for the output stage to print. A
+* post it has not taken yet is retried on the next wake, with the latest counts.
+*/
+static void sampler_post_drdy(sampler_t *sp)
+{
+    if((!sp->report_due && sp->timeouts == 0) || __atomic_load_n(&drdy_post.full, __ATOMIC_ACQUIRE))
+        return;
+    drdy_post.report = sp->report_due;
+    if(sp->report_due){
+        drdy_post.gyro = sp->gyro_drdy;
+        drdy_post.fxos = sp->fxos_drdy;
+    }
+    drdy_post.timeouts = sp->timeouts;
+    __atomic_store_n(&drdy_post.full, 1, __ATOMIC_RELEASE);
+    sp->report_due = 0;
+    sp->timeouts = 0;
+}
+
+/*!
+* One data-ready wake: read the sensors that signalled, publish what the resampler
+* has completed. Each sensor is stamped with its own data-ready edge; the packed
+* record is copied out for the resampler.
+*/
+static void sampler_step(void *ctx, pipeline_t *pipe)
+{
+    sampler_t *sp = (sampler_t*)ctx;
+    imu_sample_t sample;
+    imu_sample_t reading;
+    size_t count;
+
+    uint32_t bits = drdy_wait(&sp->drdy_group, DRDY_TIMEOUT_MS);
+    if(bits == 0){
+        sp->timeouts++;
+        sampler_post_drdy(sp);
+        return;
+    }
+    if(bits & DRDY_BIT_FXOS){
+        uint64_t stamp = drdy_serve(&sp->fxos_drdy);
+        if(IMU_ACCEL_CALL(read_batch)(&sp->fxos_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1){
+            raw_float_data_t accel = reading.accel;
+            raw_float_data_t magn = reading.magn;
+            resample_push_accel(&sp->resampler, stamp, &accel);
+            if(reading.status & IMU_SAMPLE_MAGN_VALID)
+                resample_push_magn(&sp->resampler, stamp, &magn);
+        }
+    }
+    if(bits & DRDY_BIT_GYRO){
+        uint64_t stamp = drdy_serve(&sp->gyro_drdy);
+        if(IMU_GYRO_CALL(read_batch)(&sp->gyro_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1){
+            gyro_float_data_t gyro = reading.gyro;
+            resample_push_gyro(&sp->resampler, stamp, &gyro);
+        }
+        if(sp->gyro_drdy.served % DRDY_REPORT_SAMPLES == 0)
+            sp->report_due = 1;
+    }
+    sampler_post_drdy(sp);
+    while(resample_pull(&sp->resampler, &sample) == RESAMPLE_SUCCESS){
+#if IMU_CALIBRATE
+        imu_calibrate(&sp->gyro_dev, &sp->fxos_dev, &sample);
+#endif
+        pipeline_publish(pipe, &sample);
+    }
+}
+#else
+/*!
+* One SAMPLE_PERIOD release: read both sensors into one sample and publish it. With
+* SAMPLE_BATCH the reads are one transaction, so a failure loses both sensors' data;
+* otherwise they are two, queued on the transaction engine with SAMPLE_ENGINE.
+*/
+static void sampler_step(void *ctx, pipeline_t *pipe)
+{
+    sampler_t *sp = (sampler_t*)ctx;
+    imu_sample_t sample;
+    imu_sample_t reading;
+    size_t count;
+
+    memset(&sample, 0, sizeof(imu_sample_t));
+    sample.stamp = get_time_micros();
+    sample.seq = sp->seq++;
+#if SAMPLE_BATCH
+    if(sp->sample_link){
+        PERF_BEGIN(start);
+        i2c_err_t ret = i2c_utils_link_exec(sp->sample_link);
+        if(IMU_GYRO_CALL(sample_done)(&sp->gyro_dev, ret, &reading) == IMU_DEV_SUCCESS)
+            imu_dev_merge(&sample, &reading);
+        if(IMU_ACCEL_CALL(sample_done)(&sp->fxos_dev, ret, &reading) == IMU_DEV_SUCCESS)
+            imu_dev_merge(&sample, &reading);
+        PERF_END(PERF_SAMPLE_READ, start);
+    } else
+#elif SAMPLE_QUEUED
+    if(sp->queued){
+        PERF_BEGIN(start);
+        imu_dev_queue_submit(&sp->queue);
+        imu_dev_queue_collect(&sp->queue, &sample, SAMPLE_ENGINE_TIMEOUT_US);
+        PERF_END(PERF_SAMPLE_READ, start);
+    } else
+#endif
+    {
+        if(IMU_GYRO_CALL(read_batch)(&sp->gyro_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+            imu_dev_merge(&sample, &reading);
+        if(IMU_ACCEL_CALL(read_batch)(&sp->fxos_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+            imu_dev_merge(&sample, &reading);
+    }
+#if IMU_CALIBRATE
+    imu_calibrate(&sp->gyro_dev, &sp->fxos_dev, &sample);
+#endif
+    pipeline_publish(pipe, &sample);
+}
+#endif
+
+#if TELEMETRY_BENCH
+/*!
+* Cycle cost of one sample as frames and as the former text line, formatted into
+* memory so the UART is not part of the measurement
+*/
+static void telemetry_bench(telem_encoder_t *telem, const imu_sample_t *sample, const float *q,
+                            float roll, float pitch, float yaw)
+{
+    static uint32_t samples, frame_cycles, text_cycles, frame_bytes, text_bytes;
+    uint8_t frames[TELEM_RAW_FRAME + TELEM_QUAT_FRAME];
+    char text[160];
+
+    uint32_t c0 = xthal_get_ccount();
+    size_t n = telem_encode_raw(telem, sample, frames);
+    n += telem_encode_quat(telem, sample->stamp, sample->status, q, frames + n);
+    uint32_t c1 = xthal_get_ccount();
+    int m = snprintf(text, sizeof(text), "%2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f \n",
+                     sample->accel.x, sample->accel.y, sample->accel.z,
+                     sample->gyro.x, sample->gyro.y, sample->gyro.z,
+                     sample->magn.x, sample->magn.y, sample->magn.z, roll, pitch, yaw);
+    uint32_t c2 = xthal_get_ccount();
+
+    frame_cycles += c1 - c0;
+    text_cycles += c2 - c1;
+    frame_bytes += n;
+    text_bytes += m;
+    if(++samples == TELEMETRY_BENCH_SAMPLES){
+        printf("telemetry per sample: frames %u B %u cycles, text %u B %u cycles\n",
+               frame_bytes / samples, frame_cycles / samples, text_bytes / samples, text_cycles / samples);
+        samples = frame_cycles = text_cycles = frame_bytes = text_bytes = 0;
+    }
+}
+#endif
+
+#if MAGN_CALIBRATE
+/*!
+* Online magnetometer calibration
+*   1. Feed the sample, already corrected by the driver, to the calibrator
+*   2. Fit every MAGN_CALIBRATE_FIT_SAMPLES samples; a usable fit that still changes
+*      something is composed with the correction in use and handed to the driver
+*   3. Start over after a usable fit, so the next one sees only samples taken with
+*      the correction now in use
+*/
+static void magn_calibrate(magcal_t *cal, magn_t *magn, const raw_float_data_t *m)
+{
+    static uint32_t count;
+    magcal_result_t fit;
+
+    magcal_add(cal, m);
+    if(++count % MAGN_CALIBRATE_FIT_SAMPLES != 0)
+        return;
+    if(magcal_fit(cal, &fit) != MAGCAL_SUCCESS || !magcal_usable(&fit))
+        return;
+    if(!magcal_is_identity(&fit)){
+        fxos8700_magn_cal_t next;
+        magcal_compose(magn_get_calibration(magn), &fit.cal, &next);
+        magn_set_calibration(magn, &next);
+        printf("Magnetometer calibrated: offset %.1f %.1f %.1f uT, field %.1f uT, fit error %.1f%%, coverage %.2f\n",
+               next.offset[0], next.offset[1], next.offset[2], fit.field, 100.0F * fit.fit_error, fit.coverage);
+    }
+    magcal_init(cal);
+}
+#endif
+
+static void fuser_start(void *ctx)
+{
+    fuser_t *fu = (fuser_t*)ctx;
+    filter_init(&fu->filter, FILTER_MODE, 1000.0F / SAMPLE_PERIOD);
+#if MAGN_CALIBRATE
+    /* The view shares the device the sampling task opened, so wait for it rather than
+       set the device up from here; corrections set through it apply to every view */
+    fu->magn_view = NULL;
+    magcal_init(&fu->magn_cal);
+    if(filter_uses_magn(FILTER_MODE) && os_signal_wait(&fxos_opened, MAGN_CALIBRATE_OPEN_US) &&
+       magn_init(&fu->magn_view) != MAGN_SUCCESS){
+        printf("Magnetometer calibration unavailable.\n");
+        fu->magn_view = NULL;
+    }
+#endif
+}
+
+/*!
+* Fuse one sample: the filter for a sample with rate and acceleration, then the
+* magnetometer calibration
+*/
+static void fuser_step(void *ctx, const imu_sample_t *sample, pipeline_fused_t *fused)
+{
+    fuser_t *fu = (fuser_t*)ctx;
+
+    if((sample->status & (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID)) ==
+       (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID)){
+        /* The record is packed, so take aligned copies for the filter */
+        gyro_float_data_t gyro = sample->gyro;
+        raw_float_data_t accel = sample->accel;
+        raw_float_data_t magn = sample->magn;
+        filter_update(&fu->filter, &gyro, &accel, (sample->status & IMU_SAMPLE_MAGN_VALID) ? &magn : NULL);
+    }
+#if MAGN_CALIBRATE
+    if(fu->magn_view && (sample->status & IMU_SAMPLE_MAGN_VALID)){
+        raw_float_data_t magn = sample->magn;
+        magn_calibrate(&fu->magn_cal, fu->magn_view, &magn);
+    }
+#endif
+    filter_quaternion(&fu->filter, fused->q);
+    filter_euler(&fu->filter, &fused->roll, &fused->pitch, &fused->yaw);
+}
+
+#if SENDER_COMMANDS
+/*!
+* Host commands: a report is sent with the next flush, a reset takes effect at once.
+* A dump holds the recording still until it is sent.
+*/
+static void sender_command(const telem_frame_t *frame, void *ctx)
+{
+    sender_t *se = (sender_t*)ctx;
+    if(frame->type != TELEM_TYPE_CMD)
+        return;
+#if OTIS_PERF
+    if(frame->cmd == TELEM_CMD_PERF)
+        se->report_due = 1;
+    else if(frame->cmd == TELEM_CMD_PERF_RESET)
+        perf_reset();
+#endif
+#if I2C_RECORD
+    if(frame->cmd == TELEM_CMD_REC_DUMP && !se->dumping){
+        i2c_rec_stats_t stats;
+        i2c_rec_pause(1);
+        i2c_rec_stats(&stats);
+        se->dump_offset = 0;
+        se->dump_total = (uint32_t)stats.size;
+        se->dumping = 1;
+    }
+#endif
+}
+
+/*!
+* Poll the UART for commands, then answer them, each in a write of its own
+*   1. A report request: the PERF and COUNTERS frames
+*   2. A dump: the next I2C_RECORD_DUMP_CHUNKS REC frames, and an empty one at the
+*      end, after which recording resumes
+*/
+static void sender_serve(sender_t *se)
+{
+    uint8_t rx[64];
+    size_t n;
+    while((n = telem_uart_read(rx, sizeof(rx))) > 0)
+        telem_decode_feed(&se->commands, rx, n);
+
+    /*! 1. Report */
+#if OTIS_PERF
+    if(se->report_due){
+        static perf_snapshot_t snap;
+        perf_snapshot(&snap);
+        telem_uart_write(se->report, telem_encode_perf_report(&se->telem, get_time_micros(), &snap, se->report));
+        se->report_due = 0;
+    }
+#endif
+
+    /*! 2. Dump */
+#if I2C_RECORD
+    if(!se->dumping)
+        return;
+    uint8_t chunk[TELEM_REC_CHUNK];
+    uint64_t stamp = get_time_micros();
+    size_t len = 0;
+    for(int i = 0; i < I2C_RECORD_DUMP_CHUNKS && se->dumping; i++){
+        n = i2c_rec_read(se->dump_offset, chunk, sizeof(chunk));
+        len += telem_encode_rec(&se->telem, stamp, se->dump_offset, se->dump_total, chunk, n, se->dump + len);
+        se->dump_offset += n;
+        if(n == 0){
+            se->dumping = 0;
+            i2c_rec_pause(0);
+        }
+    }
+    telem_uart_write(se->dump, len);
+#endif
+}
+#endif
+
+#if IMU_CALIBRATE
+/*!
+* Print and store a calibration the sampling task posted, then free the slot
+*/
+static void sender_store_cal(void)
+{
+    static cal_post_t post;
+    if(!__atomic_load_n(&cal_post.full, __ATOMIC_ACQUIRE))
+        return;
+    post = cal_post;
+    __atomic_store_n(&cal_post.full, 0, __ATOMIC_RELEASE);
 
-    /* Create generic magnetometer */
-    magn_t* magn = NULL;
-    if(magn_init(&magn) != MAGN_SUCCESS){
-        printf("Magnetometer initialization failed.\n");
+    const imu_cal_t *cal = &post.cal;
+    if(post.changed & IMU_CAL_ACCEL){
+        printf("Accelerometer calibrated: offset %.3f %.3f %.3f m/s^2, gain %.4f %.4f %.4f, pose error %.3f m/s^2\n",
+               cal->accel_offset[0], cal->accel_offset[1], cal->accel_offset[2],
+               cal->accel_gain[0], cal->accel_gain[1], cal->accel_gain[2], post.pose_error);
     }
+    if(imu_cal_store(cal) != IMU_CAL_SUCCESS)
+        printf("Calibration store failed.\n");
+}
+#endif
+
+#if SAMPLE_DRDY
+/*!
+* Print what the sampling task posted about data-ready, then free the slot
+*/
+static void sender_print_drdy(void)
+{
+    static drdy_post_t post;
+    if(!__atomic_load_n(&drdy_post.full, __ATOMIC_ACQUIRE))
+        return;
+    post = drdy_post;
+    __atomic_store_n(&drdy_post.full, 0, __ATOMIC_RELEASE);
 
-    /* Create generic accelerometer */
-    accel_t* accel = NULL;
-    if(accel_init(&accel) != ACCEL_SUCCESS){
-        printf("Accelerometer initialization failed.\n");
+    if(post.timeouts)
+        printf("Data-ready timeout (%u).\n", (unsigned)post.timeouts);
+    if(post.report){
+        drdy_print(&post.gyro, "gyro");
+        drdy_print(&post.fxos, "fxos8700");
     }
+}
+#endif
 
-    /* Print and update gyro mainloop */
-    while(1){
-        vTaskDelayUntil( &xLastWakeTime, xPeriod );
-        printf("%2.3f %2.3f %2.3f ", accel->converted.x, accel->converted.y, accel->converted.z);
-        printf("%2.3f %2.3f %2.3f ", gyro->converted.x, gyro->converted.y, gyro->converted.z);
-        printf("%2.3f %2.3f %2.3f \n", magn->converted.x, magn->converted.y, magn->converted.z);
-        gyro_update(gyro);
-        accel_update(accel);
-        magn_update(magn);
+static void sender_start(void *ctx)
+{
+    sender_t *se = (sender_t*)ctx;
+    telem_init(&se->telem, SAMPLE_PERIOD * 1000);
+    se->n = 0;
+    se->samples = 0;
+#if SENDER_COMMANDS
+    telem_decode_init(&se->commands, sender_command, se);
+#endif
+#if OTIS_PERF
+    se->report_due = 0;
+#endif
+#if I2C_RECORD
+    se->dumping = 0;
+#endif
+}
+
+/*!
+* Send one fused sample
+*   1. Encode its frames into the batch, with an INFO frame every
+*      TELEMETRY_INFO_SAMPLES samples
+*   2. Write the batch early when the next sample might not fit
+*/
+static void sender_step(void *ctx, const pipeline_fused_t *fused)
+{
+    sender_t *se = (sender_t*)ctx;
+    const imu_sample_t *sample = &fused->sample;
+
+#if TELEMETRY_BENCH
+    telemetry_bench(&se->telem, sample, fused->q, fused->roll, fused->pitch, fused->yaw);
+#endif
+#if TELEMETRY_TEXT
+    printf("%2.3f %2.3f %2.3f ", sample->accel.x, sample->accel.y, sample->accel.z);
+    printf("%2.3f %2.3f %2.3f ", sample->gyro.x, sample->gyro.y, sample->gyro.z);
+    printf("%2.3f %2.3f %2.3f ", sample->magn.x, sample->magn.y, sample->magn.z);
+    printf("%2.3f %2.3f %2.3f \n", fused->roll, fused->pitch, fused->yaw);
+#else
+    if(se->samples % TELEMETRY_INFO_SAMPLES == 0)
+        se->n += telem_encode_info(&se->telem, sample->stamp, se->batch + se->n);
+#if TELEMETRY_RAW
+    se->n += telem_encode_raw(&se->telem, sample, se->batch + se->n);
+#endif
+#if TELEMETRY_QUAT
+    se->n += telem_encode_quat(&se->telem, sample->stamp, sample->status, fused->q, se->batch + se->n);
+#endif
+    /* Room for the worst case sample: INFO, RAW and QUAT */
+    if(se->n > TELEMETRY_BATCH - (TELEM_INFO_FRAME + TELEM_RAW_FRAME + TELEM_QUAT_FRAME)){
+        telem_uart_write(se->batch, se->n);
+        se->n = 0;
+    }
+#endif
+    if(++se->samples % PIPELINE_REPORT_SAMPLES == 0){
+        pipeline_print(&pipeline);
+#if OTIS_PERF
+        static perf_snapshot_t snap;
+        perf_snapshot(&snap);
+        perf_print(&snap);
+#endif
     }
-    
-    gyro_destroy(&gyro);
-    accel_destroy(&accel);
-    magn_destroy(&magn);
+}
+
+/*!
+* One UART write per drain; the driver's TX ring buffer takes it without waiting.
+* With OTIS_PERF or I2C_RECORD, then serve the host's commands; with IMU_CALIBRATE,
+* store a calibration the sampler posted; with SAMPLE_DRDY, print its data-ready
+* report. Runs after every drain, so a stalled sampler's timeouts still show.
+*/
+static void sender_flush(void *ctx)
+{
+    sender_t *se = (sender_t*)ctx;
+    if(se->n > 0)
+        telem_uart_write(se->batch, se->n);
+    se->n = 0;
+#if SENDER_COMMANDS
+    sender_serve(se);
+#endif
+#if IMU_CALIBRATE
+    sender_store_cal();
+#endif
+#if SAMPLE_DRDY
+    sender_print_drdy();
+#endif
 }
 
 /*!
@@ -58,5 +809,68 @@ static void gyro_test_task(void *arg)
 */
 void app_main()
 {
-    xTaskCreate(gyro_test_task, "i2c_test_task_0", 1024 * 2, (void *)0, 10, NULL);
+    /* The calibration record lives in NVS; a full or outdated partition is wiped */
+    esp_err_t err = nvs_flash_init();
+    if(err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND){
+        nvs_flash_erase();
+        err = nvs_flash_init();
+    }
+    if(err != ESP_OK){
+        printf("NVS initialization failed, calibration will not persist.\n");
+    }
+    if(telem_uart_init(TELEM_UART_BAUD) != TELEM_UART_SUCCESS){
+        printf("Telemetry UART setup failed.\n");
+    }
+
+#if I2C_RECORD
+    /* Before the sensors are opened, so the recording starts with their setup */
+    if(i2c_rec_start_ring(I2C_RECORD_SIZE) != I2C_REC_SUCCESS){
+        printf("I2C recording failed to start.\n");
+    }
+#endif
+
+#if MAGN_CALIBRATE
+    if(os_signal_init(&fxos_opened) != OS_SUCCESS){
+        printf("Magnetometer calibration signal setup failed.\n");
+    }
+#endif
+
+    /* Large (the UKF keeps its working matrices inside), so not on a task stack */
+    static sampler_t sampler;
+    static fuser_t fuser;
+    static sender_t sender;
+    pipeline_config_t config;
+    pipeline_default_config(&config);
+
+    pipeline_stage_config_t *stage = &config.stage[PIPELINE_SAMPLE];
+    stage->core = PIPELINE_SAMPLE_CORE;
+    stage->priority = PIPELINE_SAMPLE_PRIORITY;
+    stage->period_us = SAMPLE_DRDY ? 0 : SAMPLE_PERIOD * 1000;
+    stage->deadline_us = PIPELINE_SAMPLE_DEADLINE_US;
+    stage->ctx = &sampler;
+    stage->start = sampler_start;
+    stage->stop = sampler_stop;
+
+    stage = &config.stage[PIPELINE_FUSE];
+    stage->core = PIPELINE_FUSE_CORE;
+    stage->priority = PIPELINE_FUSE_PRIORITY;
+    stage->deadline_us = PIPELINE_FUSE_DEADLINE_US;
+    stage->ctx = &fuser;
+    stage->start = fuser_start;
+
+    stage = &config.stage[PIPELINE_OUTPUT];
+    stage->core = PIPELINE_FUSE_CORE;
+    stage->priority = PIPELINE_OUTPUT_PRIORITY;
+    stage->period_us = OUTPUT_PERIOD * 1000;
+    stage->deadline_us = PIPELINE_OUTPUT_DEADLINE_US;
+    stage->ctx = &sender;
+    stage->start = sender_start;
+
+    config.sample = sampler_step;
+    config.fuse = fuser_step;
+    config.output = sender_step;
+    config.flush = sender_flush;
+    if(pipeline_start(&pipeline, &config) != PIPELINE_SUCCESS){
+        printf("Pipeline start failed.\n");
+    }
 }
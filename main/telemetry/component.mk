@@ -0,0 +1,4 @@
+#
+# Binary telemetry: frame format, encoder, stream decoder and UART transport
+#
+COMPONENT_ADD_INCLUDEDIRS := .
@@ -0,0 +1,153 @@
+#include <string.h>
+#include "telem_decode.h"
+
+/* Encoder defaults (telemetry.h), repeated so the decoder has no firmware dependencies */
+#define TELEM_DEFAULT_ACCEL_LSB (0.000244F * 9.80665F)
+#define TELEM_DEFAULT_GYRO_LSB (0.0078125F * 0.017453293F)
+#define TELEM_DEFAULT_MAGN_LSB (0.1F)
+
+static void telem_decode_scan(telem_decoder_t *dec);
+
+static void telem_decode_frame(telem_decoder_t *dec);
+
+static void telem_decode_drop(telem_decoder_t *dec, size_t n);
+
+void telem_decode_init(telem_decoder_t *dec, telem_frame_cb_t cb, void *ctx){
+    memset(dec, 0, sizeof(telem_decoder_t));
+    dec->lsb[0] = TELEM_DEFAULT_ACCEL_LSB;
+    dec->lsb[1] = TELEM_DEFAULT_GYRO_LSB;
+    dec->lsb[2] = TELEM_DEFAULT_MAGN_LSB;
+    dec->cb = cb;
+    dec->ctx = ctx;
+}
+
+void telem_decode_feed(telem_decoder_t *dec, const uint8_t *data, size_t size){
+    for(size_t i = 0; i < size; i++){
+        /* Fast path while hunting: bytes that cannot start a frame are dropped here */
+        if(dec->len == 0 && data[i] != TELEM_SYNC0){
+            dec->stats.skipped++;
+            continue;
+        }
+        dec->buf[dec->len++] = data[i];
+        telem_decode_scan(dec);
+    }
+}
+
+/*!
+* Consume complete candidates at the front of the buffer
+*   1. The buffer must start with the sync word, otherwise drop a byte and retry
+*   2. Once the header is in, the length gives the frame size; wait for the rest
+*   3. A frame with a good CRC is emitted and removed; after a bad CRC only its
+*      first byte is dropped, so the search resumes inside it
+*/
+static void telem_decode_scan(telem_decoder_t *dec){
+    while(dec->len > 0){
+        if(dec->buf[0] != TELEM_SYNC0 || (dec->len > 1 && dec->buf[1] != TELEM_SYNC1)){
+            dec->stats.skipped++;
+            telem_decode_drop(dec, 1);
+            continue;
+        }
+        if(dec->len < TELEM_HEADER_SIZE)
+            return;
+        size_t size = TELEM_OVERHEAD + dec->buf[3];
+        if(dec->len < size)
+            return;
+        if(telem_crc16(dec->buf + 2, size - 4) != telem_get16(dec->buf + size - TELEM_CRC_SIZE)){
+            dec->stats.crc_errors++;
+            dec->stats.skipped++;
+            telem_decode_drop(dec, 1);
+            continue;
+        }
+        telem_decode_frame(dec);
+        telem_decode_drop(dec, size);
+    }
+}
+
+static void telem_decode_drop(telem_decoder_t *dec, size_t n){
+    dec->len -= n;
+    memmove(dec->buf, dec->buf + n, dec->len);
+}
+
+static void telem_decode_frame(telem_decoder_t *dec){
+    telem_frame_t frame;
+    const uint8_t *p = dec->buf + TELEM_HEADER_SIZE;
+    uint8_t size = dec->buf[3];
+    memset(&frame, 0, sizeof(frame));
+    frame.type = (telem_type_t)dec->buf[2];
+    frame.seq = telem_get16(dec->buf + 4);
+    frame.stamp = telem_get64(dec->buf + 6);
+
+    if(dec->synced)
+        dec->stats.lost += (uint16_t)(frame.seq - dec->seq - 1);
+    dec->synced = 1;
+    dec->seq = frame.seq;
+    dec->stats.frames++;
+
+    /* Frames of unknown type or of an unexpected size are counted and passed on bare */
+    switch(frame.type){
+        case TELEM_TYPE_RAW:
+        if(size < TELEM_RAW_PAYLOAD)
+            break;
+        frame.status = p[0];
+        for(int i = 0; i < 9; i++){
+            frame.raw[i] = (int16_t)telem_get16(p + 1 + 2 * i);
+            frame.values[i] = frame.raw[i] * dec->lsb[i / 3];
+        }
+        break;
+        case TELEM_TYPE_QUAT:
+        if(size < TELEM_QUAT_PAYLOAD)
+            break;
+        frame.status = p[0];
+        for(int i = 0; i < 4; i++)
+            frame.q[i] = (int16_t)telem_get16(p + 1 + 2 * i) * (1.0F / TELEM_QUAT_ONE);
+        break;
+        case TELEM_TYPE_INFO:
+        if(size < TELEM_INFO_PAYLOAD)
+            break;
+        frame.version = p[0];
+        frame.period_us = telem_get32(p + 1);
+        for(int i = 0; i < 3; i++){
+            uint32_t bits = telem_get32(p + 5 + 4 * i);
+            memcpy(&frame.lsb[i], &bits, sizeof(float));
+            dec->lsb[i] = frame.lsb[i];
+        }
+        break;
+        case TELEM_TYPE_PERF:
+        if(size < TELEM_PERF_PAYLOAD)
+            break;
+        frame.probe = p[0];
+        frame.unit = p[1];
+        frame.cycles_per_us = telem_get32(p + 2);
+        frame.count = telem_get32(p + 6);
+        frame.min = telem_get32(p + 10);
+        frame.max = telem_get32(p + 14);
+        frame.sum = telem_get64(p + 18);
+        for(int i = 0; i < TELEM_PERF_BINS; i++)
+            frame.hist[i] = telem_get32(p + 26 + 4 * i);
+        break;
+        case TELEM_TYPE_COUNTERS:
+        if(size < TELEM_COUNTERS_PAYLOAD(0) || p[0] > TELEM_COUNTERS_MAX || size < TELEM_COUNTERS_PAYLOAD(p[0]))
+            break;
+        frame.counters = p[0];
+        frame.since_us = telem_get64(p + 1);
+        for(int i = 0; i < frame.counters; i++)
+            frame.counter[i] = telem_get32(p + 9 + 4 * i);
+        break;
+        case TELEM_TYPE_CMD:
+        if(size < TELEM_CMD_PAYLOAD)
+            break;
+        frame.cmd = p[0];
+        break;
+        case TELEM_TYPE_REC:
+        if(size < TELEM_REC_PAYLOAD(0) || size > TELEM_REC_PAYLOAD(TELEM_REC_CHUNK))
+            break;
+        frame.offset = telem_get32(p);
+        frame.total = telem_get32(p + 4);
+        frame.data_size = (uint8_t)(size - TELEM_REC_PAYLOAD(0));
+        frame.data = p + 8;
+        break;
+    }
+
+    if(dec->cb)
+        dec->cb(&frame, dec->ctx);
+}
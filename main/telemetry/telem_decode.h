@@ -0,0 +1,88 @@
+/*!
+* @file telem_decode.h
+* @author Ethan Lew
+* @brief Streaming decoder of the binary telemetry format
+*
+* Bytes are fed in arbitrary chunks; every frame with a valid CRC is handed to a
+* callback. After a bad CRC the decoder resumes the sync search one byte past the
+* rejected sync word, so a false sync in console text cannot swallow a real frame.
+* Platform independent; used by the host tools.
+*/
+
+#ifndef TELEM_DECODE_H
+#define TELEM_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "telem_proto.h"
+
+/*!
+* A decoded frame
+*/
+typedef struct telem_frame_s {
+    telem_type_t type;
+    uint16_t seq;
+    uint64_t stamp;             /**< Sample time (us) */
+    uint8_t status;             /**< IMU_SAMPLE_* flags (RAW, QUAT) */
+    int16_t raw[9];             /**< RAW: accel, gyro, magn counts */
+    float values[9];            /**< RAW: accel (m/s^2), gyro (rad/s), magn (uT) */
+    float q[4];                 /**< QUAT: {w, x, y, z} */
+    uint8_t version;            /**< INFO */
+    uint32_t period_us;         /**< INFO */
+    float lsb[3];               /**< INFO: accel, gyro, magn LSB sizes */
+    uint8_t probe;              /**< PERF: probe id */
+    uint8_t unit;               /**< PERF: 0 cycles, 1 us */
+    uint32_t cycles_per_us;     /**< PERF */
+    uint32_t count;             /**< PERF: values recorded */
+    uint32_t min;               /**< PERF */
+    uint32_t max;               /**< PERF */
+    uint64_t sum;               /**< PERF */
+    uint32_t hist[TELEM_PERF_BINS]; /**< PERF: log2 histogram */
+    uint64_t since_us;          /**< COUNTERS: time of the last reset */
+    uint8_t counters;           /**< COUNTERS: values in counter */
+    uint32_t counter[TELEM_COUNTERS_MAX]; /**< COUNTERS */
+    uint8_t cmd;                /**< CMD: TELEM_CMD_* */
+    uint32_t offset;            /**< REC: where data goes in the log */
+    uint32_t total;             /**< REC: size of the whole log */
+    uint8_t data_size;          /**< REC: bytes in data, 0 at the end */
+    const uint8_t *data;        /**< REC: valid during the callback */
+} telem_frame_t;
+
+typedef void (*telem_frame_cb_t)(const telem_frame_t *frame, void *ctx);
+
+/*!
+* Decoder counters
+*/
+typedef struct telem_decode_stats_s {
+    uint32_t frames;         /**< Frames accepted */
+    uint32_t crc_errors;     /**< Frames rejected by their CRC */
+    uint32_t lost;           /**< Frames missing according to the sequence numbers */
+    uint32_t skipped;        /**< Bytes discarded while searching for a sync word */
+} telem_decode_stats_t;
+
+typedef struct telem_decoder_s {
+    uint8_t buf[TELEM_MAX_FRAME];
+    size_t len;                  /**< Bytes of the current candidate frame */
+    uint8_t synced;              /**< A frame has been accepted, seq is valid */
+    uint16_t seq;                /**< Sequence number of the last frame */
+    float lsb[3];                /**< LSB sizes from the last INFO frame */
+    telem_frame_cb_t cb;
+    void *ctx;
+    telem_decode_stats_t stats;
+} telem_decoder_t;
+
+/*!
+* @brief reset the decoder
+* Until an INFO frame arrives RAW values are converted with the encoder defaults.
+* @param dec the decoder
+* @param cb called for every accepted frame
+* @param ctx callback argument
+*/
+void telem_decode_init(telem_decoder_t *dec, telem_frame_cb_t cb, void *ctx);
+
+/*!
+* @brief feed stream bytes
+*/
+void telem_decode_feed(telem_decoder_t *dec, const uint8_t *data, size_t size);
+
+#endif
@@ -0,0 +1,16 @@
+#include "telem_proto.h"
+
+/* CRC-16/CCITT-FALSE, four bits at a time: a 32 byte table instead of 512 */
+static const uint16_t telem_crc_nibble[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+uint16_t telem_crc16(const uint8_t *data, size_t size){
+    uint16_t crc = 0xFFFF;
+    for(size_t i = 0; i < size; i++){
+        crc = (uint16_t)((crc << 4) ^ telem_crc_nibble[(crc >> 12) ^ (data[i] >> 4)]);
+        crc = (uint16_t)((crc << 4) ^ telem_crc_nibble[(crc >> 12) ^ (data[i] & 0x0F)]);
+    }
+    return crc;
+}
@@ -0,0 +1,138 @@
+/*!
+* @file telem_proto.h
+* @author Ethan Lew
+* @brief Wire format of the binary telemetry stream
+*
+* The stream is a sequence of self delimiting frames, all fields little-endian:
+*
+*     offset  size  field
+*     0       2     sync, 0xA5 0x5A
+*     2       1     type (TELEM_TYPE_*)
+*     3       1     payload length n
+*     4       2     frame sequence number, +1 per frame, wrapping
+*     6       8     sample time (us)
+*     14      n     payload
+*     14 + n  2     CRC-16/CCITT-FALSE over bytes 2 .. 13 + n
+*
+* A decoder hunts for the sync word and only accepts a frame whose CRC matches, so
+* console text or line noise on the same port is skipped, and sequence gaps count
+* lost frames.
+*
+* Payloads:
+*   RAW  (19 bytes) status, accel[3], gyro[3], magn[3] as int16 counts of the LSB
+*                   sizes announced in the last INFO frame
+*   QUAT (9 bytes)  status, q[4] {w, x, y, z} as Q14 int16
+*   INFO (17 bytes) version, sample period (us, u32), accel, gyro and magn LSB
+*                   sizes (float32: m/s^2, rad/s, uT)
+*   PERF (154 bytes) probe id, unit (0 cycles, 1 us), cycles per us (u32), count,
+*                   min, max (u32), sum (u64), TELEM_PERF_BINS log2 histogram bins
+*                   (u32), see hal/perf.h
+*   COUNTERS (9 + 4n bytes) n, time the counters were reset (us, u64), n event
+*                   counters (u32)
+*   CMD  (1 byte)   command (TELEM_CMD_*), sent by the host to the firmware
+*   REC  (8 + n bytes) offset (u32), total size (u32), n bytes of an I2C log,
+*                   n <= TELEM_REC_CHUNK; n = 0 ends the dump
+*
+* The firmware answers TELEM_CMD_PERF with a PERF frame per probe that has values and
+* a COUNTERS frame; TELEM_CMD_PERF_RESET starts them over. Firmware built without
+* OTIS_PERF ignores both. TELEM_CMD_REC_DUMP has firmware built with I2C_RECORD send
+* its bus recording (hal/i2c_rec.h) as REC frames, written at their offsets into a log
+* file.
+*
+* This header and telem_proto.c have no platform dependencies and are shared by the
+* firmware and the host decoder.
+*/
+
+#ifndef TELEM_PROTO_H
+#define TELEM_PROTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TELEM_SYNC0 (0xA5)
+#define TELEM_SYNC1 (0x5A)
+#define TELEM_VERSION (1)
+
+#define TELEM_HEADER_SIZE (14)
+#define TELEM_CRC_SIZE (2)
+#define TELEM_OVERHEAD (TELEM_HEADER_SIZE + TELEM_CRC_SIZE)
+#define TELEM_MAX_PAYLOAD (255)
+#define TELEM_MAX_FRAME (TELEM_OVERHEAD + TELEM_MAX_PAYLOAD)
+
+typedef enum {
+    TELEM_TYPE_RAW = 0x01,
+    TELEM_TYPE_QUAT = 0x02,
+    TELEM_TYPE_INFO = 0x03,
+    TELEM_TYPE_PERF = 0x04,
+    TELEM_TYPE_COUNTERS = 0x05,
+    TELEM_TYPE_CMD = 0x06,
+    TELEM_TYPE_REC = 0x07,
+} telem_type_t;
+
+typedef enum {
+    TELEM_CMD_PERF = 0x01,
+    TELEM_CMD_PERF_RESET = 0x02,
+    TELEM_CMD_REC_DUMP = 0x03,
+} telem_cmd_t;
+
+/* Histogram bins of a PERF frame, PERF_BINS; at most this many COUNTERS values */
+#define TELEM_PERF_BINS 32
+#define TELEM_COUNTERS_MAX 16
+/* Largest log chunk of a REC frame */
+#define TELEM_REC_CHUNK 200
+
+#define TELEM_RAW_PAYLOAD (1 + 9 * 2)
+#define TELEM_QUAT_PAYLOAD (1 + 4 * 2)
+#define TELEM_INFO_PAYLOAD (1 + 4 + 3 * 4)
+#define TELEM_PERF_PAYLOAD (2 + 4 * 4 + 8 + 4 * TELEM_PERF_BINS)
+#define TELEM_COUNTERS_PAYLOAD(n) (1 + 8 + 4 * (n))
+#define TELEM_CMD_PAYLOAD (1)
+#define TELEM_REC_PAYLOAD(n) (8 + (n))
+
+#define TELEM_RAW_FRAME (TELEM_OVERHEAD + TELEM_RAW_PAYLOAD)
+#define TELEM_QUAT_FRAME (TELEM_OVERHEAD + TELEM_QUAT_PAYLOAD)
+#define TELEM_INFO_FRAME (TELEM_OVERHEAD + TELEM_INFO_PAYLOAD)
+#define TELEM_PERF_FRAME (TELEM_OVERHEAD + TELEM_PERF_PAYLOAD)
+#define TELEM_COUNTERS_FRAME(n) (TELEM_OVERHEAD + TELEM_COUNTERS_PAYLOAD(n))
+#define TELEM_CMD_FRAME (TELEM_OVERHEAD + TELEM_CMD_PAYLOAD)
+#define TELEM_REC_FRAME(n) (TELEM_OVERHEAD + TELEM_REC_PAYLOAD(n))
+
+/* Quaternion components are sent as Q14: 1.0 is 16384 */
+#define TELEM_QUAT_ONE (16384.0F)
+
+/*!
+* @brief CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) of size bytes
+*/
+uint16_t telem_crc16(const uint8_t *data, size_t size);
+
+/*!
+* @brief little-endian field access
+*/
+static inline void telem_put16(uint8_t *p, uint16_t v){
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline uint16_t telem_get16(const uint8_t *p){
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline void telem_put32(uint8_t *p, uint32_t v){
+    telem_put16(p, (uint16_t)v);
+    telem_put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static inline uint32_t telem_get32(const uint8_t *p){
+    return (uint32_t)telem_get16(p) | ((uint32_t)telem_get16(p + 2) << 16);
+}
+
+static inline void telem_put64(uint8_t *p, uint64_t v){
+    telem_put32(p, (uint32_t)v);
+    telem_put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline uint64_t telem_get64(const uint8_t *p){
+    return (uint64_t)telem_get32(p) | ((uint64_t)telem_get32(p + 4) << 32);
+}
+
+#endif
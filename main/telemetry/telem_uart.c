@@ -0,0 +1,104 @@
+#include "telem_uart.h"
+
+#ifdef OTIS_HOST
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#else
+#include "driver/uart.h"
+#include "esp_vfs_dev.h"
+
+#define TELEM_UART_NUM UART_NUM_0
+#endif
+
+static telem_uart_stats_t telem_stats;
+
+#ifdef OTIS_HOST
+static int telem_fd = STDOUT_FILENO;
+static int telem_rx_fd = -1;
+
+void telem_uart_set_fd(int fd){
+    telem_fd = fd;
+}
+
+void telem_uart_set_rx_fd(int fd){
+    telem_rx_fd = fd;
+}
+#endif
+
+/*!
+* Target setup
+*   1. Line parameters on the console UART
+*   2. Install the driver with a TX ring buffer, so writes do not wait on the line
+*   3. Route the console through the driver, so printf and telemetry share one
+*      serialized path
+*/
+telem_uart_err_t telem_uart_init(uint32_t baud){
+    telem_stats = (telem_uart_stats_t){0};
+#ifdef OTIS_HOST
+    (void)baud;
+    return TELEM_UART_SUCCESS;
+#else
+    uart_config_t config = {
+        .baud_rate = (int)baud,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
+    if(uart_param_config(TELEM_UART_NUM, &config) != ESP_OK)
+        return TELEM_UART_INSTALL_ERROR;
+    if(uart_driver_install(TELEM_UART_NUM, TELEM_UART_RX_BUF, TELEM_UART_TX_BUF, 0, NULL, 0) != ESP_OK)
+        return TELEM_UART_INSTALL_ERROR;
+    esp_vfs_dev_uart_use_driver(TELEM_UART_NUM);
+    return TELEM_UART_SUCCESS;
+#endif
+}
+
+telem_uart_err_t telem_uart_write(const uint8_t *data, size_t size){
+    telem_stats.writes++;
+#ifdef OTIS_HOST
+    size_t done = 0;
+    while(done < size){
+        ssize_t n = write(telem_fd, data + done, size - done);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        done += (size_t)n;
+    }
+    telem_stats.bytes += done;
+    if(done != size){
+        telem_stats.failures++;
+        return TELEM_UART_WRITE_FAIL;
+    }
+#else
+    int n = uart_write_bytes(TELEM_UART_NUM, (const char*)data, size);
+    if(n != (int)size){
+        telem_stats.failures++;
+        if(n > 0)
+            telem_stats.bytes += n;
+        return TELEM_UART_WRITE_FAIL;
+    }
+    telem_stats.bytes += size;
+#endif
+    return TELEM_UART_SUCCESS;
+}
+
+size_t telem_uart_read(uint8_t *data, size_t size){
+#ifdef OTIS_HOST
+    struct pollfd pfd = {.fd = telem_rx_fd, .events = POLLIN};
+    if(telem_rx_fd < 0 || poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
+        return 0;
+    ssize_t n = read(telem_rx_fd, data, size);
+    return n > 0 ? (size_t)n : 0;
+#else
+    int n = uart_read_bytes(TELEM_UART_NUM, data, size, 0);
+    return n > 0 ? (size_t)n : 0;
+#endif
+}
+
+void telem_uart_stats(telem_uart_stats_t *stats){
+    *stats = telem_stats;
+}
@@ -0,0 +1,82 @@
+/*!
+* @file telem_uart.h
+* @author Ethan Lew
+* @brief Telemetry transport
+*
+* On target, frames go out of the console UART through the ESP-IDF UART driver with
+* a TX ring buffer: telem_uart_write copies into the ring and returns, and the driver
+* ISR refills the hardware FIFO, so the output task never waits on the line. (The
+* ESP32 UART has no general DMA path from the driver; the ring buffer plus FIFO
+* interrupts is the equivalent.) The console is routed through the same driver, so
+* log lines and frames never interleave inside a write; the decoder skips the text.
+*
+* On host builds frames are written to a file descriptor (stdout by default).
+*
+* Commands from the host (CMD frames) come back on the same UART; telem_uart_read
+* polls for them without waiting.
+*/
+
+#ifndef TELEM_UART_H
+#define TELEM_UART_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TELEM_UART_BAUD 921600
+/* TX ring buffer; at 921600 baud this is about 45 ms of output */
+#define TELEM_UART_TX_BUF 4096
+#define TELEM_UART_RX_BUF 256
+
+typedef enum {
+    TELEM_UART_SUCCESS = 0x0,
+    TELEM_UART_INSTALL_ERROR = 0x1,
+    TELEM_UART_WRITE_FAIL = 0x2,
+} telem_uart_err_t;
+
+/*!
+* Transport counters
+*/
+typedef struct telem_uart_stats_s {
+    uint32_t writes;     /**< telem_uart_write calls */
+    uint32_t bytes;      /**< Bytes accepted */
+    uint32_t failures;   /**< Writes that were not fully accepted */
+} telem_uart_stats_t;
+
+/*!
+* @brief install the UART driver (target) or select stdout (host)
+* @param baud the line rate, ignored on host
+* @returns telemetry transport status
+*/
+telem_uart_err_t telem_uart_init(uint32_t baud);
+
+#ifdef OTIS_HOST
+/*!
+* @brief send telemetry to fd instead of stdout
+*/
+void telem_uart_set_fd(int fd);
+
+/*!
+* @brief receive commands from fd, -1 (the default) for none
+*/
+void telem_uart_set_rx_fd(int fd);
+#endif
+
+/*!
+* @brief queue size bytes for transmission
+* Blocks only if the TX ring buffer is full.
+* @returns telemetry transport status
+*/
+telem_uart_err_t telem_uart_write(const uint8_t *data, size_t size);
+
+/*!
+* @brief take up to size received bytes, without waiting
+* @returns the number of bytes taken
+*/
+size_t telem_uart_read(uint8_t *data, size_t size);
+
+/*!
+* @brief counters since telem_uart_init
+*/
+void telem_uart_stats(telem_uart_stats_t *stats);
+
+#endif
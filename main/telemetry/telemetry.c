@@ -0,0 +1,157 @@
+#include <string.h>
+#include "telemetry.h"
+
+_Static_assert(TELEM_PERF_BINS == PERF_BINS, "PERF frames carry every histogram bin");
+_Static_assert(PERF_COUNTERS <= TELEM_COUNTERS_MAX, "COUNTERS frames carry every counter");
+
+static uint8_t *telem_header(telem_encoder_t *enc, telem_type_t type, uint8_t size, uint64_t stamp, uint8_t *buf);
+
+static size_t telem_finish(telem_encoder_t *enc, uint8_t size, uint8_t *buf);
+
+static int16_t telem_quantize(telem_encoder_t *enc, float v, float inv);
+
+void telem_init(telem_encoder_t *enc, uint32_t period_us){
+    memset(enc, 0, sizeof(telem_encoder_t));
+    enc->period_us = period_us;
+    telem_set_lsb(enc, TELEM_ACCEL_LSB, TELEM_GYRO_LSB, TELEM_MAGN_LSB);
+}
+
+void telem_set_lsb(telem_encoder_t *enc, float accel_lsb, float gyro_lsb, float magn_lsb){
+    enc->accel_lsb = accel_lsb;
+    enc->gyro_lsb = gyro_lsb;
+    enc->magn_lsb = magn_lsb;
+    enc->accel_inv = 1.0F / accel_lsb;
+    enc->gyro_inv = 1.0F / gyro_lsb;
+    enc->magn_inv = 1.0F / magn_lsb;
+}
+
+size_t telem_encode_info(telem_encoder_t *enc, uint64_t stamp, uint8_t *buf){
+    uint8_t *p = telem_header(enc, TELEM_TYPE_INFO, TELEM_INFO_PAYLOAD, stamp, buf);
+    float lsb[3] = {enc->accel_lsb, enc->gyro_lsb, enc->magn_lsb};
+
+    p[0] = TELEM_VERSION;
+    telem_put32(p + 1, enc->period_us);
+    for(int i = 0; i < 3; i++){
+        uint32_t bits;
+        memcpy(&bits, &lsb[i], sizeof(bits));
+        telem_put32(p + 5 + 4 * i, bits);
+    }
+    return telem_finish(enc, TELEM_INFO_PAYLOAD, buf);
+}
+
+size_t telem_encode_raw(telem_encoder_t *enc, const imu_sample_t *sample, uint8_t *buf){
+    uint8_t *p = telem_header(enc, TELEM_TYPE_RAW, TELEM_RAW_PAYLOAD, sample->stamp, buf);
+
+    p[0] = sample->status;
+    telem_put16(p + 1, (uint16_t)telem_quantize(enc, sample->accel.x, enc->accel_inv));
+    telem_put16(p + 3, (uint16_t)telem_quantize(enc, sample->accel.y, enc->accel_inv));
+    telem_put16(p + 5, (uint16_t)telem_quantize(enc, sample->accel.z, enc->accel_inv));
+    telem_put16(p + 7, (uint16_t)telem_quantize(enc, sample->gyro.x, enc->gyro_inv));
+    telem_put16(p + 9, (uint16_t)telem_quantize(enc, sample->gyro.y, enc->gyro_inv));
+    telem_put16(p + 11, (uint16_t)telem_quantize(enc, sample->gyro.z, enc->gyro_inv));
+    telem_put16(p + 13, (uint16_t)telem_quantize(enc, sample->magn.x, enc->magn_inv));
+    telem_put16(p + 15, (uint16_t)telem_quantize(enc, sample->magn.y, enc->magn_inv));
+    telem_put16(p + 17, (uint16_t)telem_quantize(enc, sample->magn.z, enc->magn_inv));
+    return telem_finish(enc, TELEM_RAW_PAYLOAD, buf);
+}
+
+size_t telem_encode_quat(telem_encoder_t *enc, uint64_t stamp, uint8_t status, const float *q, uint8_t *buf){
+    uint8_t *p = telem_header(enc, TELEM_TYPE_QUAT, TELEM_QUAT_PAYLOAD, stamp, buf);
+
+    p[0] = status;
+    for(int i = 0; i < 4; i++)
+        telem_put16(p + 1 + 2 * i, (uint16_t)telem_quantize(enc, q[i], TELEM_QUAT_ONE));
+    return telem_finish(enc, TELEM_QUAT_PAYLOAD, buf);
+}
+
+size_t telem_encode_perf(telem_encoder_t *enc, uint64_t stamp, const perf_snapshot_t *snap, perf_probe_id_t id, uint8_t *buf){
+    uint8_t *p = telem_header(enc, TELEM_TYPE_PERF, TELEM_PERF_PAYLOAD, stamp, buf);
+    const perf_probe_t *probe = &snap->probe[id];
+
+    p[0] = (uint8_t)id;
+    p[1] = (uint8_t)perf_probe_unit(id);
+    telem_put32(p + 2, snap->cycles_per_us);
+    telem_put32(p + 6, probe->count);
+    telem_put32(p + 10, probe->min);
+    telem_put32(p + 14, probe->max);
+    telem_put64(p + 18, probe->sum);
+    for(int i = 0; i < TELEM_PERF_BINS; i++)
+        telem_put32(p + 26 + 4 * i, probe->hist[i]);
+    return telem_finish(enc, TELEM_PERF_PAYLOAD, buf);
+}
+
+size_t telem_encode_counters(telem_encoder_t *enc, uint64_t stamp, const perf_snapshot_t *snap, uint8_t *buf){
+    uint8_t *p = telem_header(enc, TELEM_TYPE_COUNTERS, TELEM_COUNTERS_PAYLOAD(PERF_COUNTERS), stamp, buf);
+
+    p[0] = PERF_COUNTERS;
+    telem_put64(p + 1, snap->since_us);
+    for(int i = 0; i < PERF_COUNTERS; i++)
+        telem_put32(p + 9 + 4 * i, snap->counter[i]);
+    return telem_finish(enc, TELEM_COUNTERS_PAYLOAD(PERF_COUNTERS), buf);
+}
+
+size_t telem_encode_perf_report(telem_encoder_t *enc, uint64_t stamp, const perf_snapshot_t *snap, uint8_t *buf){
+    size_t n = 0;
+    for(int i = 0; i < PERF_PROBES; i++){
+        if(snap->probe[i].count)
+            n += telem_encode_perf(enc, stamp, snap, (perf_probe_id_t)i, buf + n);
+    }
+    return n + telem_encode_counters(enc, stamp, snap, buf + n);
+}
+
+size_t telem_encode_cmd(telem_encoder_t *enc, telem_cmd_t cmd, uint8_t *buf){
+    uint8_t *p = telem_header(enc, TELEM_TYPE_CMD, TELEM_CMD_PAYLOAD, 0, buf);
+
+    p[0] = (uint8_t)cmd;
+    return telem_finish(enc, TELEM_CMD_PAYLOAD, buf);
+}
+
+size_t telem_encode_rec(telem_encoder_t *enc, uint64_t stamp, uint32_t offset, uint32_t total, const uint8_t *data,
+                        size_t n, uint8_t *buf){
+    uint8_t *p = telem_header(enc, TELEM_TYPE_REC, TELEM_REC_PAYLOAD(n), stamp, buf);
+
+    telem_put32(p, offset);
+    telem_put32(p + 4, total);
+    if(n)
+        memcpy(p + 8, data, n);
+    return telem_finish(enc, TELEM_REC_PAYLOAD(n), buf);
+}
+
+/*!
+* Write the header, return where the payload goes
+*/
+static uint8_t *telem_header(telem_encoder_t *enc, telem_type_t type, uint8_t size, uint64_t stamp, uint8_t *buf){
+    buf[0] = TELEM_SYNC0;
+    buf[1] = TELEM_SYNC1;
+    buf[2] = (uint8_t)type;
+    buf[3] = size;
+    telem_put16(buf + 4, enc->seq++);
+    telem_put64(buf + 6, stamp);
+    return buf + TELEM_HEADER_SIZE;
+}
+
+/*!
+* Append the CRC of everything after the sync word
+*/
+static size_t telem_finish(telem_encoder_t *enc, uint8_t size, uint8_t *buf){
+    size_t crc_at = TELEM_HEADER_SIZE + size;
+    telem_put16(buf + crc_at, telem_crc16(buf + 2, crc_at - 2));
+    enc->frames++;
+    return crc_at + TELEM_CRC_SIZE;
+}
+
+/*!
+* Round to nearest, saturating
+*/
+static int16_t telem_quantize(telem_encoder_t *enc, float v, float inv){
+    float c = v * inv;
+    if(c >= 32767.0F){
+        enc->saturated += c >= 32767.5F;
+        return 32767;
+    }
+    if(c <= -32768.0F){
+        enc->saturated += c < -32768.5F;
+        return -32768;
+    }
+    return (int16_t)(c >= 0.0F ? c + 0.5F : c - 0.5F);
+}
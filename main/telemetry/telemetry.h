@@ -0,0 +1,126 @@
+/*!
+* @file telemetry.h
+* @author Ethan Lew
+* @brief Binary telemetry encoder
+*
+* Replaces the printf text output: a sample is 35 bytes as a RAW frame and 25 bytes
+* as a QUAT frame (see telem_proto.h), against roughly 100 characters of "%2.3f"
+* text, and encoding is integer packing plus a table CRC rather than float
+* formatting. Frames are built into a caller buffer so several can be batched into
+* one transport write.
+*
+* RAW frames quantize the converted sample back to counts of fixed LSB sizes, which
+* also covers resampled samples that have no sensor counts of their own. The
+* defaults equal the driver resolutions (2 g, 250 dps, 0.1 uT), so those counts are
+* lossless; values beyond the int16 range saturate.
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include "imu_sample.h"
+#include "perf.h"
+#include "telem_proto.h"
+
+/* Default LSB sizes of RAW frames */
+#define TELEM_ACCEL_LSB (0.000244F * SENSORS_GRAVITY_STANDARD)      /**< m/s^2 */
+#define TELEM_GYRO_LSB (GYRO_SENSITIVITY_250DPS * SENSORS_DPS_TO_RADS) /**< rad/s */
+#define TELEM_MAGN_LSB (0.1F)                                         /**< uT */
+
+/* Largest answer to TELEM_CMD_PERF */
+#define TELEM_PERF_REPORT_MAX (PERF_PROBES * TELEM_PERF_FRAME + TELEM_COUNTERS_FRAME(PERF_COUNTERS))
+
+typedef struct telem_encoder_s {
+    uint16_t seq;            /**< Sequence number of the next frame */
+    uint32_t period_us;      /**< Sample period announced in INFO frames */
+    float accel_lsb;         /**< RAW frame LSB sizes */
+    float gyro_lsb;
+    float magn_lsb;
+    float accel_inv;         /**< Reciprocals, so quantizing is a multiply */
+    float gyro_inv;
+    float magn_inv;
+    uint32_t frames;         /**< Frames encoded */
+    uint32_t saturated;      /**< RAW values clipped to the int16 range */
+} telem_encoder_t;
+
+/*!
+* @brief reset the encoder with the default LSB sizes
+* @param enc the encoder
+* @param period_us the sample period, reported to decoders
+*/
+void telem_init(telem_encoder_t *enc, uint32_t period_us);
+
+/*!
+* @brief change the RAW frame LSB sizes (m/s^2, rad/s, uT per count)
+*/
+void telem_set_lsb(telem_encoder_t *enc, float accel_lsb, float gyro_lsb, float magn_lsb);
+
+/*!
+* @brief encode an INFO frame; send one at start and periodically
+* @param enc the encoder
+* @param stamp the current time (us)
+* @param buf at least TELEM_INFO_FRAME bytes
+* @returns the frame length
+*/
+size_t telem_encode_info(telem_encoder_t *enc, uint64_t stamp, uint8_t *buf);
+
+/*!
+* @brief encode a sample as a RAW frame
+* @param enc the encoder
+* @param sample the sample
+* @param buf at least TELEM_RAW_FRAME bytes
+* @returns the frame length
+*/
+size_t telem_encode_raw(telem_encoder_t *enc, const imu_sample_t *sample, uint8_t *buf);
+
+/*!
+* @brief encode a fused orientation as a QUAT frame
+* @param enc the encoder
+* @param stamp the time of the sample it was fused from (us)
+* @param status the IMU_SAMPLE_* flags of that sample
+* @param q the unit quaternion {w, x, y, z}
+* @param buf at least TELEM_QUAT_FRAME bytes
+* @returns the frame length
+*/
+size_t telem_encode_quat(telem_encoder_t *enc, uint64_t stamp, uint8_t status, const float *q, uint8_t *buf);
+
+/*!
+* @brief encode one probe of a snapshot as a PERF frame
+* @param buf at least TELEM_PERF_FRAME bytes
+* @returns the frame length
+*/
+size_t telem_encode_perf(telem_encoder_t *enc, uint64_t stamp, const perf_snapshot_t *snap, perf_probe_id_t id, uint8_t *buf);
+
+/*!
+* @brief encode the event counters of a snapshot as a COUNTERS frame
+* @param buf at least TELEM_COUNTERS_FRAME(PERF_COUNTERS) bytes
+* @returns the frame length
+*/
+size_t telem_encode_counters(telem_encoder_t *enc, uint64_t stamp, const perf_snapshot_t *snap, uint8_t *buf);
+
+/*!
+* @brief the answer to TELEM_CMD_PERF: a PERF frame per probe with values, then the
+* COUNTERS frame
+* @param buf at least TELEM_PERF_REPORT_MAX bytes
+* @returns the length of the frames
+*/
+size_t telem_encode_perf_report(telem_encoder_t *enc, uint64_t stamp, const perf_snapshot_t *snap, uint8_t *buf);
+
+/*!
+* @brief encode a command to the firmware (host side)
+* @param buf at least TELEM_CMD_FRAME bytes
+* @returns the frame length
+*/
+size_t telem_encode_cmd(telem_encoder_t *enc, telem_cmd_t cmd, uint8_t *buf);
+
+/*!
+* @brief encode a REC frame: a chunk of an I2C log, or the end of a dump (n = 0)
+* @param n at most TELEM_REC_CHUNK bytes
+* @param buf at least TELEM_REC_FRAME(n) bytes
+* @returns the frame length
+*/
+size_t telem_encode_rec(telem_encoder_t *enc, uint64_t stamp, uint32_t offset, uint32_t total, const uint8_t *data,
+                        size_t n, uint8_t *buf);
+
+#endif
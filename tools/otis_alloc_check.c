@@ -0,0 +1,202 @@
+/*!
+* @file otis_alloc_check.c
+* @author Ethan Lew
+* @brief Host check that the sensor sample path never touches the heap
+*
+* Linked with malloc, calloc, realloc and free wrapped (-Wl,--wrap), so every heap
+* call from the drivers, i2c_utils and the simulated bus goes through a counter.
+* Opening the drivers may allocate; then, on the simulated sensors in virtual time,
+* it counts the heap calls made by
+*   - gyro_update, accel_update, magn_update and accel_magn_update
+*   - gyro_read_batch draining the FIFO
+*   - the device adapters' read_batch, and the batched read (imu_dev_sample_link,
+*     executed, then each device's sample_done)
+*
+*     otis_alloc_check [-n samples]
+*
+* Fails if any of them made a single heap call.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fxas21002c.h"
+#include "fxos8700.h"
+#include "imu_dev.h"
+#include "sim/imu_sim.h"
+
+#define CHECK_DEFAULT_SAMPLES 1000
+/* Virtual time between samples (us), the sampler's period */
+#define CHECK_PERIOD_US 10000
+
+/*!
+* Heap calls counted while a call under test runs
+*/
+typedef struct check_heap_s {
+    uint32_t allocs;
+    uint32_t frees;
+} check_heap_t;
+
+static int check_counting;
+static check_heap_t check_heap;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void __wrap_free(void *ptr);
+
+static void check_begin(void);
+
+static int check_end(const char *what, uint32_t calls);
+
+int main(int argc, char **argv){
+    uint32_t samples = CHECK_DEFAULT_SAMPLES;
+    int opt;
+    while((opt = getopt(argc, argv, "n:")) != -1){
+        switch(opt){
+            case 'n': samples = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:
+            fprintf(stderr, "usage: %s [-n samples]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(samples == 0)
+        return 1;
+
+    /* 1. Models on virtual time */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    motion_sim_init(&motion, &config);
+    imu_sim_init(&sim, &motion, NULL);
+    imu_sim_attach(&sim, 0);
+    int failures = 0;
+
+    /* 2. Driver updates */
+    gyro_t *gyro = NULL;
+    accel_t *accel = NULL;
+    magn_t *magn = NULL;
+    if(gyro_init(&gyro) != GYRO_SUCCESS || accel_init(&accel) != ACCEL_SUCCESS || magn_init(&magn) != MAGN_SUCCESS){
+        fprintf(stderr, "sensor init failed\n");
+        return 1;
+    }
+    printf("%-22s %8s %8s %8s\n", "call", "calls", "allocs", "frees");
+    check_begin();
+    for(uint32_t i = 0; i < samples; i++){
+        imu_sim_advance(&sim, sim.now_us + CHECK_PERIOD_US);
+        gyro_update(gyro);
+    }
+    failures += check_end("gyro_update", samples);
+    check_begin();
+    for(uint32_t i = 0; i < samples; i++){
+        imu_sim_advance(&sim, sim.now_us + CHECK_PERIOD_US);
+        accel_update(accel);
+        magn_update(magn);
+    }
+    failures += check_end("accel/magn_update", samples);
+    check_begin();
+    for(uint32_t i = 0; i < samples; i++){
+        imu_sim_advance(&sim, sim.now_us + CHECK_PERIOD_US);
+        accel_magn_update(accel, magn);
+    }
+    failures += check_end("accel_magn_update", samples);
+
+    /* 3. FIFO drains, links built when the FIFO is enabled */
+    static gyro_float_data_t out[GYRO_FIFO_SIZE];
+    if(gyro_fifo_enable(gyro, GYRO_FIFO_WATERMARK) != GYRO_SUCCESS){
+        fprintf(stderr, "gyro FIFO enable failed\n");
+        return 1;
+    }
+    check_begin();
+    for(uint32_t i = 0; i < samples; i++){
+        imu_sim_advance(&sim, sim.now_us + CHECK_PERIOD_US);
+        gyro_read_batch(gyro, out, GYRO_FIFO_SIZE);
+    }
+    failures += check_end("gyro_read_batch", samples);
+    magn_destroy(&magn);
+    accel_destroy(&accel);
+    gyro_destroy(&gyro);
+
+    /* 4. Device adapters, separately and batched */
+    imu_dev_t gyro_dev, fxos_dev;
+    if(IMU_GYRO_OPEN(&gyro_dev) != IMU_DEV_SUCCESS || IMU_ACCEL_OPEN(&fxos_dev) != IMU_DEV_SUCCESS){
+        fprintf(stderr, "device open failed\n");
+        return 1;
+    }
+    imu_dev_t *const devs[2] = {&gyro_dev, &fxos_dev};
+    i2c_link_t link = NULL;
+    if(imu_dev_sample_link(devs, 2, &link) != IMU_DEV_SUCCESS){
+        fprintf(stderr, "batch build failed\n");
+        return 1;
+    }
+    imu_sample_t reading;
+    size_t count;
+    check_begin();
+    for(uint32_t i = 0; i < samples; i++){
+        imu_sim_advance(&sim, sim.now_us + CHECK_PERIOD_US);
+        IMU_GYRO_CALL(read_batch)(&gyro_dev, &reading, 1, &count);
+        IMU_ACCEL_CALL(read_batch)(&fxos_dev, &reading, 1, &count);
+    }
+    failures += check_end("imu_dev read_batch", samples);
+    check_begin();
+    for(uint32_t i = 0; i < samples; i++){
+        imu_sim_advance(&sim, sim.now_us + CHECK_PERIOD_US);
+        i2c_err_t ret = i2c_utils_link_exec(link);
+        IMU_GYRO_CALL(sample_done)(&gyro_dev, ret, &reading);
+        IMU_ACCEL_CALL(sample_done)(&fxos_dev, ret, &reading);
+    }
+    failures += check_end("imu_dev sample link", samples);
+
+    i2c_utils_link_destroy(&link);
+    IMU_ACCEL_CALL(destroy)(&fxos_dev);
+    IMU_GYRO_CALL(destroy)(&gyro_dev);
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    printf("%s\n", failures ? "heap used on the sample path" : "no heap calls on the sample path");
+    return failures ? 2 : 0;
+}
+
+void *__wrap_malloc(size_t size){
+    if(check_counting)
+        check_heap.allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size){
+    if(check_counting)
+        check_heap.allocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size){
+    if(check_counting)
+        check_heap.allocs++;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr){
+    if(check_counting && ptr)
+        check_heap.frees++;
+    __real_free(ptr);
+}
+
+static void check_begin(void){
+    memset(&check_heap, 0, sizeof(check_heap));
+    check_counting = 1;
+}
+
+/*!
+* Stop counting and report one call under test, non-zero if it used the heap
+*/
+static int check_end(const char *what, uint32_t calls){
+    check_counting = 0;
+    printf("%-22s %8u %8u %8u\n", what, calls, check_heap.allocs, check_heap.frees);
+    return check_heap.allocs != 0 || check_heap.frees != 0;
+}
@@ -0,0 +1,204 @@
+/*!
+* @file otis_batch_bench.c
+* @author Ethan Lew
+* @brief Host benchmark of batched sensor reads on the simulated bus
+*
+* Opens the FXAS21002C and FXOS8700 adapters on the simulated sensors and, at each
+* step of virtual time, reads one 9-DoF sample twice
+*   - separately: the gyroscope's read_batch, then the FXOS8700's, two bus
+*     transactions as the sampler makes without SAMPLE_BATCH
+*   - batched: both reads in one transaction built by imu_dev_sample_link, then each
+*     device's sample_done, as the sampler makes with SAMPLE_BATCH
+* and checks that both give the same values. The bus runs at the given clock, and a
+* fixed cost can be added to every transaction to model the driver around it on the
+* target (the command link, i2c_master_cmd_begin, its interrupt and the wake up of the
+* waiting task), which a batch pays once per sample instead of once per sensor.
+*
+*     otis_batch_bench [-n samples] [-c clk_hz] [-d overhead_us]
+*
+* Reports transactions, modelled bus time and wall time per sample for both ways.
+* The same figures on target come from an OTIS_PERF build: "sample read" against
+* "gyro read" plus "fxos read".
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include "imu_dev.h"
+#include "time_utils.h"
+#include "sim/imu_sim.h"
+#include "sim/i2c_fake_bus.h"
+#include "sim/host_clock.h"
+
+#define BENCH_DEFAULT_SAMPLES 2000
+#define BENCH_DEFAULT_CLK_HZ 400000
+/* Virtual time between samples (us), the sampler's period */
+#define BENCH_PERIOD_US 10000
+
+typedef enum {
+    BENCH_SEPARATE = 0,
+    BENCH_BATCHED,
+    BENCH_WAYS
+} bench_way_t;
+
+static const char *bench_way_name[BENCH_WAYS] = {"separate", "batched"};
+
+/*!
+* Totals of one way over the run
+*/
+typedef struct bench_total_s {
+    uint64_t wall_ns;
+    uint64_t busy_ns;
+    uint32_t transactions;
+    uint32_t failures;
+} bench_total_t;
+
+static void bench_account(bench_total_t *total, const i2c_fake_bus_stats_t *before, uint64_t t0);
+
+static int bench_same(const imu_sample_t *a, const imu_sample_t *b);
+
+int main(int argc, char **argv){
+    uint32_t samples = BENCH_DEFAULT_SAMPLES;
+    uint32_t clk_hz = BENCH_DEFAULT_CLK_HZ;
+    double overhead_us = 0.0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:c:d:")) != -1){
+        switch(opt){
+            case 'n': samples = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'c': clk_hz = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'd': overhead_us = atof(optarg); break;
+            default:
+            fprintf(stderr, "usage: %s [-n samples] [-c clk_hz] [-d overhead_us]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(samples == 0 || overhead_us < 0.0)
+        return 1;
+
+    /* 1. Models on virtual time, the bus at full speed while the devices open */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    motion_sim_init(&motion, &config);
+    imu_sim_init(&sim, &motion, NULL);
+    imu_sim_attach(&sim, 0);
+
+    imu_dev_t gyro_dev, fxos_dev;
+    if(IMU_GYRO_OPEN(&gyro_dev) != IMU_DEV_SUCCESS || IMU_ACCEL_OPEN(&fxos_dev) != IMU_DEV_SUCCESS){
+        fprintf(stderr, "device open failed\n");
+        return 1;
+    }
+    imu_dev_t *const devs[2] = {&gyro_dev, &fxos_dev};
+    int failures = 0;
+
+    /* 2. A device in FIFO mode cannot take part in a batch */
+    i2c_link_t link = NULL;
+    imu_dev_config_t fifo = gyro_dev.config;
+    fifo.fifo_watermark = 8;
+    if(IMU_GYRO_CALL(configure)(&gyro_dev, &fifo) != IMU_DEV_SUCCESS ||
+       imu_dev_sample_link(devs, 2, &link) != IMU_DEV_UNSUPPORTED){
+        printf("batch built with the gyroscope FIFO running\n");
+        failures++;
+    }
+    fifo.fifo_watermark = 0;
+    IMU_GYRO_CALL(configure)(&gyro_dev, &fifo);
+    if(imu_dev_sample_link(devs, 2, &link) != IMU_DEV_SUCCESS){
+        fprintf(stderr, "batch build failed\n");
+        return 1;
+    }
+
+    /* 3. Bus timing from here on */
+    imu_sim_attach(&sim, clk_hz);
+    i2c_fake_bus_set_overhead((uint32_t)(overhead_us * 1000.0));
+
+    bench_total_t total[BENCH_WAYS];
+    memset(total, 0, sizeof(total));
+    uint32_t same = 0;
+    imu_sample_t sample[BENCH_WAYS];
+    imu_sample_t reading;
+    size_t count;
+    for(uint32_t i = 0; i < samples; i++){
+        i2c_fake_bus_stats_t before;
+        uint64_t t0;
+        imu_sim_advance(&sim, sim.now_us + BENCH_PERIOD_US);
+
+        /* Separately */
+        memset(&sample[BENCH_SEPARATE], 0, sizeof(imu_sample_t));
+        i2c_fake_bus_stats(&before);
+        t0 = host_clock_now_ns();
+        if(IMU_GYRO_CALL(read_batch)(&gyro_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+            imu_dev_merge(&sample[BENCH_SEPARATE], &reading);
+        else
+            total[BENCH_SEPARATE].failures++;
+        if(IMU_ACCEL_CALL(read_batch)(&fxos_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+            imu_dev_merge(&sample[BENCH_SEPARATE], &reading);
+        else
+            total[BENCH_SEPARATE].failures++;
+        bench_account(&total[BENCH_SEPARATE], &before, t0);
+
+        /* Batched, the same registers again */
+        memset(&sample[BENCH_BATCHED], 0, sizeof(imu_sample_t));
+        i2c_fake_bus_stats(&before);
+        t0 = host_clock_now_ns();
+        i2c_err_t ret = i2c_utils_link_exec(link);
+        if(IMU_GYRO_CALL(sample_done)(&gyro_dev, ret, &reading) == IMU_DEV_SUCCESS)
+            imu_dev_merge(&sample[BENCH_BATCHED], &reading);
+        else
+            total[BENCH_BATCHED].failures++;
+        if(IMU_ACCEL_CALL(sample_done)(&fxos_dev, ret, &reading) == IMU_DEV_SUCCESS)
+            imu_dev_merge(&sample[BENCH_BATCHED], &reading);
+        else
+            total[BENCH_BATCHED].failures++;
+        bench_account(&total[BENCH_BATCHED], &before, t0);
+
+        same += bench_same(&sample[BENCH_SEPARATE], &sample[BENCH_BATCHED]);
+    }
+
+    /* 4. Report */
+    printf("%u samples, %u Hz bus, %.1f us per transaction besides the wire\n", samples, clk_hz, overhead_us);
+    printf("%-10s %12s %10s %10s %9s\n", "way", "transactions", "bus us", "wall us", "failures");
+    for(int w = 0; w < BENCH_WAYS; w++){
+        printf("%-10s %12.2f %10.2f %10.2f %9u\n", bench_way_name[w], (double)total[w].transactions / samples,
+               (double)total[w].busy_ns / samples / 1000.0, (double)total[w].wall_ns / samples / 1000.0,
+               total[w].failures);
+        failures += total[w].failures;
+    }
+    printf("%-10s %12.2f %10.2f %10.2f\n", "saved",
+           ((double)total[BENCH_SEPARATE].transactions - total[BENCH_BATCHED].transactions) / samples,
+           ((double)total[BENCH_SEPARATE].busy_ns - total[BENCH_BATCHED].busy_ns) / samples / 1000.0,
+           ((double)total[BENCH_SEPARATE].wall_ns - total[BENCH_BATCHED].wall_ns) / samples / 1000.0);
+    printf("identical samples: %u of %u\n", same, samples);
+    if(same != samples)
+        failures++;
+
+    i2c_utils_link_destroy(&link);
+    IMU_ACCEL_CALL(destroy)(&fxos_dev);
+    IMU_GYRO_CALL(destroy)(&gyro_dev);
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    return failures ? 2 : 0;
+}
+
+static void bench_account(bench_total_t *total, const i2c_fake_bus_stats_t *before, uint64_t t0){
+    uint64_t t1 = host_clock_now_ns();
+    i2c_fake_bus_stats_t after;
+    i2c_fake_bus_stats(&after);
+    total->wall_ns += t1 - t0;
+    total->busy_ns += after.busy_ns - before->busy_ns;
+    total->transactions += after.transactions - before->transactions;
+}
+
+/*!
+* Same sensors, values and counts; stamps, sequence numbers and the fresh flags
+* differ, as the second read finds the data-ready flags already cleared
+*/
+static int bench_same(const imu_sample_t *a, const imu_sample_t *b){
+    const uint8_t valid = IMU_SAMPLE_ACCEL_VALID | IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_MAGN_VALID;
+    if((a->status & valid) != (b->status & valid))
+        return 0;
+    return memcmp(&a->accel, &b->accel, offsetof(imu_sample_t, status) - offsetof(imu_sample_t, accel)) == 0;
+}
@@ -0,0 +1,508 @@
+/*!
+* @file otis_config_check.c
+* @author Ethan Lew
+* @brief Host check of the runtime rate, range and oversampling configuration
+*
+* Applies every output data rate / range combination of the FXAS21002C, and every
+* rate / range / magnetometer oversampling combination of the FXOS8700 in both
+* sensor modes, to the register models on the simulated bus. For each one it checks
+*   - the register writes, recorded by a backend wrapped around the simulated bus:
+*     standby first, then the configuration registers, then active with the new rate
+*   - that the models saw no write the real parts would ignore
+*   - the model registers and output period against the driver's period_us
+*   - the driver's scale factor against the model's counts per unit, and a sample read
+*     at the new setting against the (constant) simulated motion
+* A gyroscope reconfiguration with the FIFO on must also flush the samples queued at
+* the old setting. Configurations the parts do not have must be refused without
+* touching the bus.
+*
+*     otis_config_check [-v]
+*
+*   -v  print every configuration checked
+*
+* Exits non-zero on any failure.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fxas21002c.h"
+#include "fxos8700.h"
+#include "sim/i2c_fake_bus.h"
+#include "sim/imu_sim.h"
+
+#define CHECK_MAX_WRITES 16
+/* Relative error allowed between driver and model scale factors */
+#define CHECK_SCALE_TOLERANCE (1e-3F)
+/* Sample error allowed, in counts at the configured scale */
+#define CHECK_SAMPLE_COUNTS (2.0F)
+/* Longest FXOS8700 output period (1.5625Hz hybrid) */
+#define CHECK_MAX_PERIOD_US 1280000
+
+typedef struct check_write_s {
+    uint8_t addr;
+    uint8_t reg;
+    uint8_t value;
+} check_write_t;
+
+static const gyro_range_t gyro_ranges[] = {
+    GYRO_RANGE_250DPS, GYRO_RANGE_500DPS, GYRO_RANGE_1000DPS, GYRO_RANGE_2000DPS
+};
+
+static const fxos8700AccelRange_t accel_ranges[] = {ACCEL_RANGE_2G, ACCEL_RANGE_4G, ACCEL_RANGE_8G};
+
+static const i2c_backend_t *check_inner;
+static check_write_t check_log[CHECK_MAX_WRITES];
+static uint32_t check_writes;
+static int check_verbose;
+
+static i2c_err_t check_setup(i2c_peripheral_t i2c_setup);
+
+static i2c_err_t check_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size);
+
+static i2c_err_t check_write(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size);
+
+static i2c_err_t check_link_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link);
+
+static i2c_err_t check_link_exec(i2c_link_t link);
+
+static void check_link_destroy(i2c_link_t *link);
+
+static i2c_err_t check_link_batch(const i2c_op_t *ops, size_t count, i2c_link_t *link);
+
+static void check_log_write(i2c_peripheral_t i2c_dev, const uint8_t *data_wr, size_t size);
+
+static const i2c_backend_t check_backend = {
+    check_setup,
+    check_read,
+    check_write,
+    check_link_read,
+    check_link_exec,
+    check_link_destroy,
+    check_link_batch,
+};
+
+static int check_sequence(const char *what, const check_write_t *expect, uint32_t n);
+
+static int check_vector(const char *what, const float *got, const float *truth, float tolerance);
+
+static int check_scale(const char *what, float scale, float model);
+
+static int check_gyro(imu_sim_t *sim, gyro_t *gyro, const gyro_config_t *config, const motion_frame_t *truth);
+
+static int check_gyro_fifo(imu_sim_t *sim, gyro_t *gyro, const motion_frame_t *truth);
+
+static int check_fxos(imu_sim_t *sim, accel_t *accel, magn_t *magn, const fxos8700_config_t *config,
+                      const motion_frame_t *truth, uint32_t settle_us);
+
+int main(int argc, char **argv){
+    int opt;
+    while((opt = getopt(argc, argv, "v")) != -1){
+        switch(opt){
+            case 'v': check_verbose = 1; break;
+            default:
+            fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* 1. Constant motion, so any sample can be compared with one truth frame */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.field[0] = 20.0F;
+    config.field[2] = -45.0F;
+    config.gyro_bias[0] = 0.5F;
+    config.gyro_bias[1] = -1.2F;
+    config.gyro_bias[2] = 2.0F;
+    config.accel_bias[0] = 0.3F;
+    config.accel_bias[1] = -0.5F;
+    config.magn_bias[0] = 5.0F;
+    config.magn_bias[1] = -3.0F;
+    config.magn_bias[2] = 8.0F;
+    config.seed = 1;
+    motion_sim_init(&motion, &config);
+    motion_frame_t truth;
+    motion_sim_sample(&motion, 0, &truth);
+
+    /* 2. Virtual time, every transaction through the recording backend */
+    imu_sim_init(&sim, &motion, NULL);
+    imu_sim_attach(&sim, 0);
+    check_inner = i2c_utils_get_backend();
+    i2c_utils_set_backend(&check_backend);
+
+    gyro_t *gyro = NULL;
+    accel_t *accel = NULL;
+    magn_t *magn = NULL;
+    if(gyro_init(&gyro) != GYRO_SUCCESS || accel_init(&accel) != ACCEL_SUCCESS || magn_init(&magn) != MAGN_SUCCESS){
+        fprintf(stderr, "sensor init failed\n");
+        return 1;
+    }
+    int failures = 0;
+    if(sim.fxas.illegal_writes || sim.fxos.illegal_writes){
+        printf("init: %u gyro, %u accel/magn illegal writes\n", sim.fxas.illegal_writes, sim.fxos.illegal_writes);
+        failures++;
+    }
+
+    /* 3. Every gyroscope rate and range */
+    uint32_t gyro_configs = 0;
+    for(int odr = GYRO_ODR_800HZ; odr <= GYRO_ODR_12_5HZ; odr++){
+        for(size_t r = 0; r < sizeof(gyro_ranges) / sizeof(gyro_ranges[0]); r++){
+            gyro_config_t gc = {(gyro_odr_t)odr, gyro_ranges[r]};
+            failures += check_gyro(&sim, gyro, &gc, &truth);
+            gyro_configs++;
+        }
+    }
+
+    /* 3b. A reconfiguration with samples queued in the FIFO */
+    failures += check_gyro_fifo(&sim, gyro, &truth);
+    gyro_configs++;
+
+    /* 4. Every accelerometer/magnetometer rate, range and oversampling, in both modes */
+    uint32_t fxos_configs = 0;
+    uint32_t settle_us = accel->fxos->period_us;
+    for(int mode = FXOS8700_MODE_HYBRID; mode <= FXOS8700_MODE_ACCEL_ONLY; mode++){
+        if(accel_set_mode(accel, (fxos8700_mode_t)mode) != ACCEL_SUCCESS){
+            printf("mode %d: set failed\n", mode);
+            failures++;
+        }
+        for(int odr = FXOS8700_ODR_800HZ; odr <= FXOS8700_ODR_1_56HZ; odr++){
+            for(size_t r = 0; r < sizeof(accel_ranges) / sizeof(accel_ranges[0]); r++){
+                for(uint8_t osr = 0; osr <= FXOS8700_MCTRL_REG1_OS_MAX; osr++){
+                    fxos8700_config_t fc = {(fxos8700_odr_t)odr, accel_ranges[r], osr};
+                    failures += check_fxos(&sim, accel, magn, &fc, &truth, settle_us);
+                    settle_us = accel->fxos->period_us;
+                    fxos_configs++;
+                }
+            }
+        }
+    }
+
+    /* 5. Configurations the parts do not have */
+    const gyro_config_t bad_gyro[] = {{GYRO_ODR_100HZ, (gyro_range_t)300}, {(gyro_odr_t)7, GYRO_RANGE_250DPS}};
+    const fxos8700_config_t bad_fxos[] = {
+        {FXOS8700_ODR_100HZ, (fxos8700AccelRange_t)3, 0},
+        {(fxos8700_odr_t)8, ACCEL_RANGE_2G, 0},
+        {FXOS8700_ODR_100HZ, ACCEL_RANGE_2G, FXOS8700_MCTRL_REG1_OS_MAX + 1},
+    };
+    uint32_t refused = 0;
+    for(size_t i = 0; i < sizeof(bad_gyro) / sizeof(bad_gyro[0]); i++){
+        check_writes = 0;
+        refused += gyro_configure(gyro, &bad_gyro[i]) == GYRO_INVALID && check_writes == 0;
+    }
+    for(size_t i = 0; i < sizeof(bad_fxos) / sizeof(bad_fxos[0]); i++){
+        check_writes = 0;
+        refused += accel_configure(accel, &bad_fxos[i]) == ACCEL_INVALID && check_writes == 0;
+    }
+    uint32_t bad = sizeof(bad_gyro) / sizeof(bad_gyro[0]) + sizeof(bad_fxos) / sizeof(bad_fxos[0]);
+    failures += bad - refused;
+
+    /* 6. Report */
+    printf("gyro: %u configurations, accel/magn: %u configurations, %u/%u invalid ones refused\n",
+           gyro_configs, fxos_configs, refused, bad);
+    printf("models: %u gyro, %u accel/magn illegal writes, %u nacks\n", sim.fxas.illegal_writes,
+           sim.fxos.illegal_writes, sim.nacks);
+    failures += sim.fxas.illegal_writes != 0 || sim.fxos.illegal_writes != 0 || sim.nacks != 0;
+    printf("failures: %d\n%s\n", failures, failures ? "FAILED" : "passed");
+
+    gyro_destroy(&gyro);
+    accel_destroy(&accel);
+    magn_destroy(&magn);
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    return failures ? 2 : 0;
+}
+
+/*!
+* One gyroscope configuration
+*   1. Standby, CTRL_REG0 FS, then CTRL_REG1 with the rate and the active bit
+*   2. Model registers, period and counts per dps (16 << FS) against the driver
+*   3. A sample produced at the new setting
+*/
+static int check_gyro(imu_sim_t *sim, gyro_t *gyro, const gyro_config_t *config, const motion_frame_t *truth){
+    char what[64];
+    int failures = 0;
+    uint8_t fs = config->range == GYRO_RANGE_250DPS ? 3 : config->range == GYRO_RANGE_500DPS ? 2 :
+                 config->range == GYRO_RANGE_1000DPS ? 1 : 0;
+    uint8_t before = gyro->ctrl_reg1;
+    uint32_t settle_us = gyro->period_us;
+    snprintf(what, sizeof(what), "gyro dr %d, %d dps", config->odr, config->range);
+
+    check_writes = 0;
+    if(gyro_configure(gyro, config) != GYRO_SUCCESS){
+        printf("%s: configure failed\n", what);
+        return 1;
+    }
+    uint8_t ctrl_reg1 = (uint8_t)((before & ~(GYRO_CTRL_REG1_DR | GYRO_CTRL_REG1_ACTIVE)) |
+                                  (config->odr << GYRO_CTRL_REG1_DR_SHIFT) | GYRO_CTRL_REG1_ACTIVE);
+    const check_write_t expect[3] = {
+        {IMU_SIM_FXAS_ADDR, GYRO_REGISTER_CTRL_REG1, (uint8_t)(before & ~GYRO_CTRL_REG1_ACTIVE)},
+        {IMU_SIM_FXAS_ADDR, GYRO_REGISTER_CTRL_REG0, fs},
+        {IMU_SIM_FXAS_ADDR, GYRO_REGISTER_CTRL_REG1, ctrl_reg1},
+    };
+    failures += check_sequence(what, expect, 3);
+
+    if((sim->fxas.regs[GYRO_REGISTER_CTRL_REG0] & GYRO_CTRL_REG0_FS) != fs ||
+       sim->fxas.regs[GYRO_REGISTER_CTRL_REG1] != ctrl_reg1){
+        printf("%s: model CTRL_REG0 0x%02x CTRL_REG1 0x%02x\n", what, sim->fxas.regs[GYRO_REGISTER_CTRL_REG0],
+               sim->fxas.regs[GYRO_REGISTER_CTRL_REG1]);
+        failures++;
+    }
+    if(gyro->period_us != fxas_sim_period_us(&sim->fxas)){
+        printf("%s: period %u us, model %u us\n", what, gyro->period_us, fxas_sim_period_us(&sim->fxas));
+        failures++;
+    }
+    failures += check_scale(what, gyro->scale, SENSORS_DPS_TO_RADS / (float)(16 << fs));
+
+    /* The sample in the output registers must have been produced after the change */
+    imu_sim_advance(sim, sim->now_us + settle_us + 2 * gyro->period_us);
+    if(gyro_update(gyro) != GYRO_SUCCESS){
+        printf("%s: read failed\n", what);
+        return failures + 1;
+    }
+    failures += check_vector(what, &gyro->converted.x, truth->gyro, CHECK_SAMPLE_COUNTS * gyro->scale);
+
+    if(check_verbose)
+        printf("%-28s period %6u us  scale %.4e rad/s  %s\n", what, gyro->period_us, gyro->scale,
+               failures ? "FAILED" : "ok");
+    return failures;
+}
+
+/*!
+* A gyroscope reconfiguration with the FIFO on
+*   1. Queue samples at 800Hz and 250 dps, after a drain that starts the stamps
+*   2. Reconfigure to 200Hz and 2000 dps: standby, F_SETUP disabled and re-armed,
+*      then CTRL_REG0 and CTRL_REG1; the model's FIFO is left empty
+*   3. The next drain returns only samples produced at the new setting, converted at
+*      the new range, one new period apart and stamped after the last drain
+*/
+static int check_gyro_fifo(imu_sim_t *sim, gyro_t *gyro, const motion_frame_t *truth){
+    static gyro_float_data_t out[GYRO_FIFO_SIZE];
+    const char *what = "gyro reconfigured with the FIFO on";
+    const gyro_config_t from = {GYRO_ODR_800HZ, GYRO_RANGE_250DPS};
+    const gyro_config_t to = {GYRO_ODR_200HZ, GYRO_RANGE_2000DPS};
+    const uint32_t fresh = 5;
+    int failures = 0;
+    uint32_t settle_us = gyro->period_us;
+
+    if(gyro_configure(gyro, &from) != GYRO_SUCCESS || gyro_fifo_enable(gyro, GYRO_FIFO_WATERMARK) != GYRO_SUCCESS){
+        printf("%s: setup failed\n", what);
+        return 1;
+    }
+    imu_sim_advance(sim, sim->now_us + settle_us + 10 * gyro->period_us);
+    gyro_read_batch(gyro, out, GYRO_FIFO_SIZE);
+    imu_sim_advance(sim, sim->now_us + 12 * gyro->period_us);
+    uint64_t last = gyro->fifo.last_stamp;
+    uint8_t before = gyro->ctrl_reg1;
+    settle_us = gyro->period_us;
+    if(last == 0 || sim->fxas.fifo_count == 0){
+        printf("%s: nothing queued at the old setting\n", what);
+        failures++;
+    }
+
+    check_writes = 0;
+    if(gyro_configure(gyro, &to) != GYRO_SUCCESS){
+        printf("%s: configure failed\n", what);
+        gyro_fifo_disable(gyro);
+        return 1;
+    }
+    uint8_t ctrl_reg1 = (uint8_t)((before & ~(GYRO_CTRL_REG1_DR | GYRO_CTRL_REG1_ACTIVE)) |
+                                  (to.odr << GYRO_CTRL_REG1_DR_SHIFT) | GYRO_CTRL_REG1_ACTIVE);
+    const check_write_t expect[5] = {
+        {IMU_SIM_FXAS_ADDR, GYRO_REGISTER_CTRL_REG1, (uint8_t)(before & ~GYRO_CTRL_REG1_ACTIVE)},
+        {IMU_SIM_FXAS_ADDR, GYRO_REGISTER_F_SETUP, GYRO_F_MODE_DISABLED},
+        {IMU_SIM_FXAS_ADDR, GYRO_REGISTER_F_SETUP, GYRO_F_MODE_CIRCULAR | GYRO_FIFO_WATERMARK},
+        {IMU_SIM_FXAS_ADDR, GYRO_REGISTER_CTRL_REG0, 0x00},
+        {IMU_SIM_FXAS_ADDR, GYRO_REGISTER_CTRL_REG1, ctrl_reg1},
+    };
+    failures += check_sequence(what, expect, 5);
+    if(sim->fxas.fifo_count != 0){
+        printf("%s: %u samples of the old setting left queued\n", what, sim->fxas.fifo_count);
+        failures++;
+    }
+
+    imu_sim_advance(sim, sim->now_us + settle_us + fresh * gyro->period_us);
+    gyro_err_t ret = gyro_read_batch(gyro, out, GYRO_FIFO_SIZE);
+    size_t n = gyro->fifo.count;
+    if(ret != GYRO_SUCCESS || n < fresh || n > fresh + 1){
+        printf("%s: drain returned %d with %u samples, %u produced\n", what, ret, (unsigned)n, fresh);
+        failures++;
+    }
+    for(size_t i = 0; i < n; i++){
+        if(check_vector(what, &out[i].x, truth->gyro, CHECK_SAMPLE_COUNTS * gyro->scale)){
+            failures++;
+            break;
+        }
+    }
+    for(size_t i = 0; i < n; i++){
+        uint64_t prev = i ? gyro->fifo.stamp[i - 1] : last;
+        if(gyro->fifo.stamp[i] <= prev || (i && gyro->fifo.stamp[i] - prev != gyro->period_us)){
+            printf("%s: stamp %u at %llu after %llu\n", what, (unsigned)i, (unsigned long long)gyro->fifo.stamp[i],
+                   (unsigned long long)prev);
+            failures++;
+            break;
+        }
+    }
+    if(gyro_fifo_disable(gyro) != GYRO_SUCCESS){
+        printf("%s: FIFO disable failed\n", what);
+        failures++;
+    }
+
+    if(check_verbose)
+        printf("%-28s %u samples  %s\n", what, (unsigned)n, failures ? "FAILED" : "ok");
+    return failures;
+}
+
+/*!
+* One accelerometer/magnetometer configuration
+*   1. Standby, XYZ_DATA_CFG, M_CTRL_REG1 with the sensor mode kept, then CTRL_REG1
+*      with the rate, low noise below 8g, and the active bit
+*   2. Model registers, period and counts per g against the driver
+*   3. A sample produced at the new setting; the magnetometer only in hybrid mode
+*/
+static int check_fxos(imu_sim_t *sim, accel_t *accel, magn_t *magn, const fxos8700_config_t *config,
+                      const motion_frame_t *truth, uint32_t settle_us){
+    char what[64];
+    int failures = 0;
+    fxos8700_t *fxos = accel->fxos;
+    uint8_t before = fxos->ctrl_reg1;
+    uint8_t hms = fxos->mode == FXOS8700_MODE_HYBRID ? FXOS8700_MCTRL_REG1_HYBRID : FXOS8700_MCTRL_REG1_ACCEL_ONLY;
+    snprintf(what, sizeof(what), "fxos %s dr %d, %dg, osr %u", fxos->mode == FXOS8700_MODE_HYBRID ? "hybrid" : "accel",
+             config->odr, 2 << config->range, config->magn_osr);
+
+    check_writes = 0;
+    if(accel_configure(accel, config) != ACCEL_SUCCESS){
+        printf("%s: configure failed\n", what);
+        return 1;
+    }
+    uint8_t ctrl_reg1 = (uint8_t)((before & ~(FXOS8700_CTRL_REG1_DR | FXOS8700_CTRL_REG1_LNOISE)) |
+                                  (config->odr << FXOS8700_CTRL_REG1_DR_SHIFT) | FXOS8700_CTRL_REG1_ACTIVE);
+    if(config->range != ACCEL_RANGE_8G)
+        ctrl_reg1 |= FXOS8700_CTRL_REG1_LNOISE;
+    uint8_t mctrl = (uint8_t)(config->magn_osr << FXOS8700_MCTRL_REG1_OS_SHIFT) | hms;
+    const check_write_t expect[4] = {
+        {IMU_SIM_FXOS_ADDR, FXOS8700_REGISTER_CTRL_REG1, (uint8_t)(before & ~FXOS8700_CTRL_REG1_ACTIVE)},
+        {IMU_SIM_FXOS_ADDR, FXOS8700_REGISTER_XYZ_DATA_CFG, (uint8_t)config->range},
+        {IMU_SIM_FXOS_ADDR, FXOS8700_REGISTER_MCTRL_REG1, mctrl},
+        {IMU_SIM_FXOS_ADDR, FXOS8700_REGISTER_CTRL_REG1, ctrl_reg1},
+    };
+    failures += check_sequence(what, expect, 4);
+
+    const uint8_t *regs = sim->fxos.regs;
+    if(regs[FXOS8700_REGISTER_CTRL_REG1] != ctrl_reg1 || regs[FXOS8700_REGISTER_MCTRL_REG1] != mctrl ||
+       (regs[FXOS8700_REGISTER_XYZ_DATA_CFG] & FXOS8700_XYZ_DATA_CFG_FS) != config->range){
+        printf("%s: model CTRL_REG1 0x%02x M_CTRL_REG1 0x%02x XYZ_DATA_CFG 0x%02x\n", what,
+               regs[FXOS8700_REGISTER_CTRL_REG1], regs[FXOS8700_REGISTER_MCTRL_REG1],
+               regs[FXOS8700_REGISTER_XYZ_DATA_CFG]);
+        failures++;
+    }
+    if(fxos->period_us != fxos_sim_period_us(&sim->fxos)){
+        printf("%s: period %u us, model %u us\n", what, fxos->period_us, fxos_sim_period_us(&sim->fxos));
+        failures++;
+    }
+    failures += check_scale(what, fxos->accel_scale, SENSORS_GRAVITY_STANDARD / fxos_sim_counts_per_g(&sim->fxos));
+
+    imu_sim_advance(sim, sim->now_us + settle_us + 2 * fxos->period_us);
+    if(accel_magn_update(accel, magn) != ACCEL_SUCCESS){
+        printf("%s: read failed\n", what);
+        return failures + 1;
+    }
+    float accel_truth[3];
+    for(int i = 0; i < 3; i++)
+        accel_truth[i] = truth->accel[i] * SENSORS_GRAVITY_STANDARD;
+    float tolerance = CHECK_SAMPLE_COUNTS * fxos->accel_scale + CHECK_SCALE_TOLERANCE * 2.0F * SENSORS_GRAVITY_STANDARD;
+    failures += check_vector(what, &accel->converted.x, accel_truth, tolerance);
+    if(fxos->mode == FXOS8700_MODE_HYBRID)
+        failures += check_vector(what, &magn->converted.x, truth->magn, CHECK_SAMPLE_COUNTS * 0.1F);
+
+    if(check_verbose)
+        printf("%-34s period %7u us  scale %.4e m/s^2  %s\n", what, fxos->period_us, fxos->accel_scale,
+               failures ? "FAILED" : "ok");
+    return failures;
+}
+
+static int check_sequence(const char *what, const check_write_t *expect, uint32_t n){
+    int match = check_writes == n;
+    for(uint32_t i = 0; match && i < n; i++)
+        match = memcmp(&check_log[i], &expect[i], sizeof(check_write_t)) == 0;
+    if(match)
+        return 0;
+
+    printf("%s: register writes", what);
+    for(uint32_t i = 0; i < check_writes && i < CHECK_MAX_WRITES; i++)
+        printf(" %02x:%02x=%02x", check_log[i].addr, check_log[i].reg, check_log[i].value);
+    printf(", expected");
+    for(uint32_t i = 0; i < n; i++)
+        printf(" %02x:%02x=%02x", expect[i].addr, expect[i].reg, expect[i].value);
+    printf("\n");
+    return 1;
+}
+
+static int check_vector(const char *what, const float *got, const float *truth, float tolerance){
+    for(int i = 0; i < 3; i++){
+        if(fabsf(got[i] - truth[i]) > tolerance){
+            printf("%s: sample (%.4f, %.4f, %.4f), expected (%.4f, %.4f, %.4f)\n", what, got[0], got[1], got[2],
+                   truth[0], truth[1], truth[2]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_scale(const char *what, float scale, float model){
+    if(fabsf(scale - model) <= CHECK_SCALE_TOLERANCE * model)
+        return 0;
+    printf("%s: scale %.6e, model %.6e\n", what, scale, model);
+    return 1;
+}
+
+static i2c_err_t check_setup(i2c_peripheral_t i2c_setup){
+    return check_inner->setup(i2c_setup);
+}
+
+static i2c_err_t check_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size){
+    return check_inner->read(i2c_dev, i2c_reg, data_rd, size);
+}
+
+/*!
+* Log each register written, then pass the transaction on
+*/
+static i2c_err_t check_write(i2c_peripheral_t i2c_dev, uint8_t *data_wr, size_t size){
+    check_log_write(i2c_dev, data_wr, size);
+    return check_inner->write(i2c_dev, data_wr, size);
+}
+
+static i2c_err_t check_link_read(i2c_peripheral_t i2c_dev, uint8_t i2c_reg, uint8_t *data_rd, size_t size, i2c_link_t *link){
+    return check_inner->link_read(i2c_dev, i2c_reg, data_rd, size, link);
+}
+
+static i2c_err_t check_link_exec(i2c_link_t link){
+    return check_inner->link_exec(link);
+}
+
+static void check_link_destroy(i2c_link_t *link){
+    check_inner->link_destroy(link);
+}
+
+/*!
+* The writes of a batch are logged as it is built: the drivers build configuration
+* batches and run them at once
+*/
+static i2c_err_t check_link_batch(const i2c_op_t *ops, size_t count, i2c_link_t *link){
+    for(size_t i = 0; i < count; i++){
+        if(ops[i].type == I2C_XFER_WRITE)
+            check_log_write(ops[i].i2c_dev, ops[i].data, ops[i].size);
+    }
+    return check_inner->link_batch(ops, count, link);
+}
+
+static void check_log_write(i2c_peripheral_t i2c_dev, const uint8_t *data_wr, size_t size){
+    for(size_t i = 1; i < size; i++){
+        if(check_writes < CHECK_MAX_WRITES)
+            check_log[check_writes] = (check_write_t){i2c_dev.addr, (uint8_t)(data_wr[0] + i - 1), data_wr[i]};
+        check_writes++;
+    }
+}
@@ -0,0 +1,251 @@
+/*!
+* @file otis_conv_bench.c
+* @author Ethan Lew
+* @brief Host benchmark and bit exactness check of the batch conversion kernels
+*
+* Converts blocks of random big endian frames with the parameters of three sensors:
+* the gyroscope (16 bit, scale and bias), the accelerometer (14 bit, offset and
+* gain) and the accelerometer with a full misalignment matrix, the last one from the
+* 13 byte FXOS8700 block, so frames are neither aligned nor 6 bytes apart. Then:
+*   1. every float kernel the host has against conv_float_ref, counts and values
+*      compared bit for bit, over lengths that leave every possible tail
+*   2. conv_fixed against gyro_convert_fixed / accel_convert_fixed, bit for bit,
+*      and against the float reference for the full matrix
+*   3. samples per second of each kernel and of conv_fixed
+*
+*     otis_conv_bench [-n samples] [-k repeats]
+*
+* Exits non-zero on any mismatch.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "conv.h"
+#include "fxas21002c.h"
+#include "fxos8700.h"
+#include "sim/host_clock.h"
+
+#define CONV_BENCH_DEFAULT_SAMPLES 4096
+#define CONV_BENCH_DEFAULT_REPEATS 2000
+/* Acceptance of the fixed point full matrix against float */
+#define CONV_BENCH_MAX_FIXED (1e-3F)
+
+typedef struct conv_bench_case_s {
+    const char *name;
+    size_t stride;
+    conv_params_t p;
+} conv_bench_case_t;
+
+/* Keeps the timed loops from being optimized away */
+static volatile float conv_bench_sink;
+
+static uint32_t conv_bench_check(const conv_bench_case_t *c, const conv_kernel_t *k, const uint8_t *src, size_t n);
+
+static uint32_t conv_bench_check_fixed(const conv_bench_case_t *c, const uint8_t *src, size_t n, float *max_err);
+
+int main(int argc, char **argv){
+    size_t samples = CONV_BENCH_DEFAULT_SAMPLES;
+    uint32_t repeats = CONV_BENCH_DEFAULT_REPEATS;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:k:")) != -1){
+        switch(opt){
+            case 'n': samples = (size_t)strtoul(optarg, NULL, 0); break;
+            case 'k': repeats = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:
+            fprintf(stderr, "usage: %s [-n samples] [-k repeats]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(samples == 0 || repeats == 0)
+        return 1;
+
+    /* 1. Sensors */
+    static conv_bench_case_t cases[3];
+    const float gyro_bias[3] = {0.011F, -0.023F, 0.0047F};
+    const float accel_offset[3] = {0.052F, -0.098F, 0.21F};
+    const float accel_gain[3] = {1.012F, 0.987F, 1.004F};
+    const float misalign[9] = {1.012F, 0.0042F, -0.0031F,
+                               -0.0027F, 0.987F, 0.0068F,
+                               0.0015F, -0.0054F, 1.004F};
+
+    cases[0].name = "gyro";
+    cases[0].stride = GYRO_FIFO_FRAME_SIZE;
+    conv_init(&cases[0].p, 0);
+    conv_set_scale(&cases[0].p, GYRO_SENSITIVITY_2000DPS * SENSORS_DPS_TO_RADS);
+    conv_set_bias(&cases[0].p, gyro_bias);
+
+    /* 4g range, 0.488 mg per count */
+    cases[1].name = "accel";
+    cases[1].stride = 6;
+    conv_init(&cases[1].p, 2);
+    conv_set_scale(&cases[1].p, 0.000488F * SENSORS_GRAVITY_STANDARD);
+    conv_set_bias(&cases[1].p, accel_offset);
+    conv_set_gain(&cases[1].p, accel_gain);
+
+    cases[2].name = "accel matrix";
+    cases[2].stride = ACCEL_BUFF_SIZE;
+    cases[2].p = cases[1].p;
+    conv_set_matrix(&cases[2].p, misalign);
+
+    uint8_t *frames = (uint8_t*)malloc(samples * ACCEL_BUFF_SIZE + 1);
+    int16_t *raw = (int16_t*)malloc(3 * samples * sizeof(int16_t));
+    float *out = (float*)malloc(3 * samples * sizeof(float));
+    q16_t *out_q = (q16_t*)malloc(3 * samples * sizeof(q16_t));
+    if(!frames || !raw || !out || !out_q)
+        return 1;
+    srand(20);
+    for(size_t i = 0; i < samples * ACCEL_BUFF_SIZE + 1; i++)
+        frames[i] = (uint8_t)(rand() >> 7);
+
+    size_t kernel_count;
+    const conv_kernel_t *kernels = conv_kernels(&kernel_count);
+
+    /* 2. Bit exactness, odd start for the 13 byte block as in fxos8700_convert */
+    uint32_t failures = 0;
+    for(int c = 0; c < 3; c++){
+        const uint8_t *src = frames + (cases[c].stride == ACCEL_BUFF_SIZE ? 1 : 0);
+        for(size_t k = 0; k < kernel_count; k++){
+            if(!kernels[k].available)
+                continue;
+            for(size_t n = 1; n <= 2 * CONV_BLOCK + 9 && n <= samples; n++)
+                failures += conv_bench_check(&cases[c], &kernels[k], src, n);
+            failures += conv_bench_check(&cases[c], &kernels[k], src, samples);
+        }
+        float max_err = 0.0F;
+        failures += conv_bench_check_fixed(&cases[c], src, samples, &max_err);
+        if(cases[c].p.diagonal){
+            printf("%-13s fixed matches the driver conversion\n", cases[c].name);
+        } else {
+            printf("%-13s fixed within %.3g of float (bound %.3g)\n", cases[c].name, max_err, CONV_BENCH_MAX_FIXED);
+        }
+    }
+
+    /* 3. Throughput */
+    int16_t *const raw_soa[3] = {raw, raw + samples, raw + 2 * samples};
+    float *const out_soa[3] = {out, out + samples, out + 2 * samples};
+    q16_t *const out_q_soa[3] = {out_q, out_q + samples, out_q + 2 * samples};
+    printf("\n%-13s %-8s %14s\n", "sensor", "kernel", "Msamples/s");
+    for(int c = 0; c < 3; c++){
+        const uint8_t *src = frames + (cases[c].stride == ACCEL_BUFF_SIZE ? 1 : 0);
+        for(size_t k = 0; k <= kernel_count; k++){
+            const char *name = k < kernel_count ? kernels[k].name : "fixed";
+            if(k < kernel_count && !kernels[k].available){
+                printf("%-13s %-8s %14s\n", cases[c].name, name, "n/a");
+                continue;
+            }
+            uint64_t t0 = host_clock_now_ns();
+            for(uint32_t r = 0; r < repeats; r++){
+                if(k < kernel_count){
+                    kernels[k].fn(&cases[c].p, src, cases[c].stride, samples, raw_soa, out_soa);
+                    conv_bench_sink = out[r % samples];
+                } else {
+                    conv_fixed(&cases[c].p, src, cases[c].stride, samples, raw_soa, out_q_soa);
+                    conv_bench_sink = (float)out_q[r % samples];
+                }
+            }
+            double s = (double)(host_clock_now_ns() - t0) * 1e-9;
+            printf("%-13s %-8s %14.1f\n", cases[c].name, name, (double)samples * repeats / s * 1e-6);
+        }
+    }
+
+    free(frames);
+    free(raw);
+    free(out);
+    free(out_q);
+    if(failures){
+        printf("\nFAIL: %u mismatches\n", failures);
+        return 1;
+    }
+    printf("\nall kernels bit exact\n");
+    return 0;
+}
+
+/*!
+* One kernel against the reference on the first n frames; 1 on a mismatch
+*/
+static uint32_t conv_bench_check(const conv_bench_case_t *c, const conv_kernel_t *k, const uint8_t *src, size_t n){
+    int16_t *raw = (int16_t*)malloc(6 * n * sizeof(int16_t));
+    float *out = (float*)malloc(6 * n * sizeof(float));
+    if(!raw || !out){
+        free(raw);
+        free(out);
+        return 1;
+    }
+    int16_t *const raw_ref[3] = {raw, raw + n, raw + 2 * n};
+    int16_t *const raw_k[3] = {raw + 3 * n, raw + 4 * n, raw + 5 * n};
+    float *const out_ref[3] = {out, out + n, out + 2 * n};
+    float *const out_k[3] = {out + 3 * n, out + 4 * n, out + 5 * n};
+
+    conv_float_ref(&c->p, src, c->stride, n, raw_ref, out_ref);
+    k->fn(&c->p, src, c->stride, n, raw_k, out_k);
+    uint32_t bad = memcmp(raw, raw + 3 * n, 3 * n * sizeof(int16_t)) != 0 ||
+                   memcmp(out, out + 3 * n, 3 * n * sizeof(float)) != 0;
+    if(bad)
+        printf("%s: %s differs from the reference at n = %zu\n", c->name, k->name, n);
+    free(raw);
+    free(out);
+    return bad;
+}
+
+/*!
+* conv_fixed against the drivers' conversion where that exists (diagonal), else
+* against the float reference; 1 on a mismatch
+*/
+static uint32_t conv_bench_check_fixed(const conv_bench_case_t *c, const uint8_t *src, size_t n, float *max_err){
+    int16_t *raw = (int16_t*)malloc(3 * n * sizeof(int16_t));
+    q16_t *out_q = (q16_t*)malloc(3 * n * sizeof(q16_t));
+    float *out = (float*)malloc(3 * n * sizeof(float));
+    if(!raw || !out_q || !out){
+        free(raw);
+        free(out_q);
+        free(out);
+        return 1;
+    }
+    int16_t *const raw_soa[3] = {raw, raw + n, raw + 2 * n};
+    q16_t *const q_soa[3] = {out_q, out_q + n, out_q + 2 * n};
+    float *const out_soa[3] = {out, out + n, out + 2 * n};
+    conv_fixed(&c->p, src, c->stride, n, raw_soa, q_soa);
+    conv_float_ref(&c->p, src, c->stride, n, NULL, out_soa);
+
+    static gyro_t gyro;
+    static fxos8700_t fxos;
+    accel_t accel = {.fxos = &fxos};
+    gyro.conv = c->p;
+    fxos.accel_conv = c->p;
+
+    uint32_t bad = 0;
+    *max_err = 0.0F;
+    for(size_t i = 0; i < n && !bad; i++){
+        q16_t q[3] = {q_soa[0][i], q_soa[1][i], q_soa[2][i]};
+        if(!c->p.diagonal){
+            for(int a = 0; a < 3; a++)
+                *max_err = fmaxf(*max_err, fabsf(q16_to_float(q[a]) - out_soa[a][i]));
+            continue;
+        }
+        if(c->p.shift == 0){
+            gyro_int_data_t r = {raw_soa[0][i], raw_soa[1][i], raw_soa[2][i]};
+            gyro_fixed_data_t d;
+            gyro_convert_fixed(&gyro, &r, &d);
+            bad = d.x != q[0] || d.y != q[1] || d.z != q[2];
+        } else {
+            raw_int_data_t r = {raw_soa[0][i], raw_soa[1][i], raw_soa[2][i]};
+            raw_fixed_data_t d;
+            accel_convert_fixed(&accel, &r, &d);
+            bad = d.x != q[0] || d.y != q[1] || d.z != q[2];
+        }
+        if(bad)
+            printf("%s: conv_fixed differs from the driver at sample %zu\n", c->name, i);
+    }
+    if(*max_err > CONV_BENCH_MAX_FIXED){
+        printf("%s: conv_fixed off the float reference by %g\n", c->name, *max_err);
+        bad = 1;
+    }
+    free(raw);
+    free(out_q);
+    free(out);
+    return bad;
+}
@@ -0,0 +1,237 @@
+/*!
+* @file otis_dev_bench.c
+* @author Ethan Lew
+* @brief Host benchmark of the imu_dev interface against direct driver calls
+*
+* Opens the FXAS21002C and FXOS8700 adapters on the simulated sensors, runs their
+* self tests, then times one sample read per call made
+*   - natively: gyro_update, accel_magn_update
+*   - statically: fxas21002c_dev_read_batch, ..., what IMU_GYRO_CALL / IMU_ACCEL_CALL
+*     expand to with IMU_DEV_STATIC
+*   - dynamically: imu_dev_read_batch through the ops table
+* A null device defined here isolates the cost of dispatch itself: its static reads
+* inline into the timing loop, its dynamic reads are indirect calls.
+*
+*     otis_dev_bench [-n reads] [-r rounds]
+*
+* Each figure is the fastest of the rounds, in ns per read.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "imu_dev.h"
+#include "time_utils.h"
+#include "sim/imu_sim.h"
+#include "sim/host_clock.h"
+
+#define BENCH_DEFAULT_READS 2000
+#define BENCH_DEFAULT_ROUNDS 5
+/* Null device reads per simulated read, so both loops run for similar times */
+#define BENCH_NULL_SCALE 1000
+
+IMU_DEV_DECLARE(null);
+
+const imu_dev_ops_t null_dev_ops = {
+    "null",
+    null_dev_init,
+    null_dev_configure,
+    null_dev_read_batch,
+    null_dev_self_test,
+    null_dev_calibrate,
+    null_dev_destroy,
+    NULL,
+    NULL,
+};
+
+typedef enum {
+    BENCH_NATIVE = 0,
+    BENCH_STATIC,
+    BENCH_DYNAMIC,
+    BENCH_WAYS
+} bench_way_t;
+
+static const char *bench_way_name[BENCH_WAYS] = {"native", "static", "dynamic"};
+
+static uint64_t bench_min(uint64_t a, uint64_t b);
+
+int main(int argc, char **argv){
+    uint32_t reads = BENCH_DEFAULT_READS;
+    uint32_t rounds = BENCH_DEFAULT_ROUNDS;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:r:")) != -1){
+        switch(opt){
+            case 'n': reads = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'r': rounds = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:
+            fprintf(stderr, "usage: %s [-n reads] [-r rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(reads == 0 || rounds == 0)
+        return 1;
+
+    /* 1. Models on the monotonic clock for the self tests, which wait on real time */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    motion_sim_init(&motion, &config);
+    imu_sim_init(&sim, &motion, get_time_micros);
+    imu_sim_attach(&sim, 0);
+
+    imu_dev_t gyro_dev, fxos_dev, null_dev;
+    if(IMU_GYRO_OPEN(&gyro_dev) != IMU_DEV_SUCCESS || IMU_ACCEL_OPEN(&fxos_dev) != IMU_DEV_SUCCESS ||
+       imu_dev_open(&null_dev, &null_dev_ops) != IMU_DEV_SUCCESS){
+        fprintf(stderr, "device open failed\n");
+        return 1;
+    }
+    imu_dev_t *devs[2] = {&gyro_dev, &fxos_dev};
+    int failures = 0;
+    for(int d = 0; d < 2; d++){
+        imu_dev_err_t ret = imu_dev_self_test(devs[d]);
+        printf("%-10s sensors 0x%02x self test %s (%d)\n", devs[d]->ops->name, devs[d]->sensors,
+               ret == IMU_DEV_SUCCESS ? "passed" : "FAILED", ret);
+        failures += ret != IMU_DEV_SUCCESS;
+    }
+
+    /* 2. Native handles onto the same chips */
+    gyro_t *gyro = NULL;
+    accel_t *accel = NULL;
+    magn_t *magn = NULL;
+    if(gyro_init(&gyro) != GYRO_SUCCESS || accel_init(&accel) != ACCEL_SUCCESS || magn_init(&magn) != MAGN_SUCCESS){
+        fprintf(stderr, "sensor init failed\n");
+        return 1;
+    }
+
+    /* 3. Virtual time from here on, so every round reads the same register traffic */
+    sim.clock = NULL;
+    imu_sim_advance(&sim, sim.now_us + 100000);
+
+    uint64_t gyro_ns[BENCH_WAYS], fxos_ns[BENCH_WAYS], null_ns[BENCH_WAYS];
+    for(int w = 0; w < BENCH_WAYS; w++)
+        gyro_ns[w] = fxos_ns[w] = null_ns[w] = UINT64_MAX;
+
+    imu_sample_t out;
+    size_t count;
+    uint32_t null_reads = reads * BENCH_NULL_SCALE;
+    for(uint32_t r = 0; r < rounds; r++){
+        uint64_t t0, t1;
+
+        t0 = host_clock_now_ns();
+        for(uint32_t i = 0; i < reads; i++)
+            failures += gyro_update(gyro) != GYRO_SUCCESS;
+        t1 = host_clock_now_ns();
+        gyro_ns[BENCH_NATIVE] = bench_min(gyro_ns[BENCH_NATIVE], t1 - t0);
+        t0 = host_clock_now_ns();
+        for(uint32_t i = 0; i < reads; i++)
+            failures += IMU_DEV_FN(IMU_GYRO_DRIVER, read_batch)(&gyro_dev, &out, 1, &count) != IMU_DEV_SUCCESS;
+        t1 = host_clock_now_ns();
+        gyro_ns[BENCH_STATIC] = bench_min(gyro_ns[BENCH_STATIC], t1 - t0);
+        t0 = host_clock_now_ns();
+        for(uint32_t i = 0; i < reads; i++)
+            failures += imu_dev_read_batch(&gyro_dev, &out, 1, &count) != IMU_DEV_SUCCESS;
+        t1 = host_clock_now_ns();
+        gyro_ns[BENCH_DYNAMIC] = bench_min(gyro_ns[BENCH_DYNAMIC], t1 - t0);
+
+        t0 = host_clock_now_ns();
+        for(uint32_t i = 0; i < reads; i++)
+            failures += accel_magn_update(accel, magn) != ACCEL_SUCCESS;
+        t1 = host_clock_now_ns();
+        fxos_ns[BENCH_NATIVE] = bench_min(fxos_ns[BENCH_NATIVE], t1 - t0);
+        t0 = host_clock_now_ns();
+        for(uint32_t i = 0; i < reads; i++)
+            failures += IMU_DEV_FN(IMU_ACCEL_DRIVER, read_batch)(&fxos_dev, &out, 1, &count) != IMU_DEV_SUCCESS;
+        t1 = host_clock_now_ns();
+        fxos_ns[BENCH_STATIC] = bench_min(fxos_ns[BENCH_STATIC], t1 - t0);
+        t0 = host_clock_now_ns();
+        for(uint32_t i = 0; i < reads; i++)
+            failures += imu_dev_read_batch(&fxos_dev, &out, 1, &count) != IMU_DEV_SUCCESS;
+        t1 = host_clock_now_ns();
+        fxos_ns[BENCH_DYNAMIC] = bench_min(fxos_ns[BENCH_DYNAMIC], t1 - t0);
+
+        /* The null device has no native driver; its native figure is an empty loop */
+        t0 = host_clock_now_ns();
+        for(uint32_t i = 0; i < null_reads; i++)
+            __asm__ volatile("" ::: "memory");
+        t1 = host_clock_now_ns();
+        null_ns[BENCH_NATIVE] = bench_min(null_ns[BENCH_NATIVE], t1 - t0);
+        t0 = host_clock_now_ns();
+        for(uint32_t i = 0; i < null_reads; i++){
+            null_dev_read_batch(&null_dev, &out, 1, &count);
+            __asm__ volatile("" ::: "memory");
+        }
+        t1 = host_clock_now_ns();
+        null_ns[BENCH_STATIC] = bench_min(null_ns[BENCH_STATIC], t1 - t0);
+        t0 = host_clock_now_ns();
+        for(uint32_t i = 0; i < null_reads; i++){
+            imu_dev_read_batch(&null_dev, &out, 1, &count);
+            __asm__ volatile("" ::: "memory");
+        }
+        t1 = host_clock_now_ns();
+        null_ns[BENCH_DYNAMIC] = bench_min(null_ns[BENCH_DYNAMIC], t1 - t0);
+    }
+
+    /* 4. Report */
+    printf("%u reads x %u rounds (null device x %u), ns per read\n", reads, rounds, BENCH_NULL_SCALE);
+    printf("%-10s %10s %10s %10s %10s\n", "device", bench_way_name[0], bench_way_name[1], bench_way_name[2],
+           "dispatch");
+    printf("%-10s %10.1f %10.1f %10.1f %+10.1f\n", gyro_dev.ops->name, (double)gyro_ns[0] / reads,
+           (double)gyro_ns[1] / reads, (double)gyro_ns[2] / reads, ((double)gyro_ns[2] - gyro_ns[1]) / reads);
+    printf("%-10s %10.1f %10.1f %10.1f %+10.1f\n", fxos_dev.ops->name, (double)fxos_ns[0] / reads,
+           (double)fxos_ns[1] / reads, (double)fxos_ns[2] / reads, ((double)fxos_ns[2] - fxos_ns[1]) / reads);
+    printf("%-10s %10.2f %10.2f %10.2f %+10.2f\n", null_dev.ops->name, (double)null_ns[0] / null_reads,
+           (double)null_ns[1] / null_reads, (double)null_ns[2] / null_reads,
+           ((double)null_ns[2] - null_ns[1]) / null_reads);
+    printf("driver failures: %d\n", failures);
+
+    gyro_destroy(&gyro);
+    accel_destroy(&accel);
+    magn_destroy(&magn);
+    imu_dev_destroy(&null_dev);
+    imu_dev_destroy(&fxos_dev);
+    imu_dev_destroy(&gyro_dev);
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    return failures ? 2 : 0;
+}
+
+imu_dev_err_t null_dev_init(imu_dev_t *dev){
+    dev->sensors = IMU_DEV_GYRO;
+    dev->config.sensors = IMU_DEV_GYRO;
+    return IMU_DEV_SUCCESS;
+}
+
+imu_dev_err_t null_dev_configure(imu_dev_t *dev, const imu_dev_config_t *config){
+    (void)dev;
+    return config->sensors == IMU_DEV_GYRO ? IMU_DEV_SUCCESS : IMU_DEV_UNSUPPORTED;
+}
+
+imu_dev_err_t null_dev_read_batch(imu_dev_t *dev, imu_sample_t *out, size_t max, size_t *count){
+    (void)max;
+    out->seq = dev->seq++;
+    out->status = IMU_SAMPLE_GYRO_VALID;
+    *count = 1;
+    return IMU_DEV_SUCCESS;
+}
+
+imu_dev_err_t null_dev_self_test(imu_dev_t *dev){
+    (void)dev;
+    return IMU_DEV_SUCCESS;
+}
+
+imu_dev_err_t null_dev_calibrate(imu_dev_t *dev, const imu_cal_t *cal){
+    (void)dev;
+    (void)cal;
+    return IMU_DEV_SUCCESS;
+}
+
+void null_dev_destroy(imu_dev_t *dev){
+    (void)dev;
+}
+
+static uint64_t bench_min(uint64_t a, uint64_t b){
+    return a < b ? a : b;
+}
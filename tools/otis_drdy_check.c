@@ -0,0 +1,238 @@
+/*!
+* @file otis_drdy_check.c
+* @author Ethan Lew
+* @brief Host check of data-ready sampling on simulated sensors
+*
+* Runs the SAMPLE_DRDY sampling step of the firmware against the simulated board: a
+* drdy_sim generator per sensor raises the edges on the wall clock, each first
+* moving the chip models one output period on in virtual time, so every edge
+* announces exactly one new sample (grid points a generator skips after a stall of the
+* host still move them on, and are reported). The sampler, on its own thread like the sampling
+* task, waits on both sources, serves the ones that signalled, reads those sensors
+* through imu_dev and resamples onto the 10 ms grid, as sampler_step does. Once the
+* generators are stopped and the last edges served, it prints both latency
+* histograms and checks that
+*   - every edge was served (served == edges) and none missed, with no timeout
+*   - the stamps of each source, and of the resampled output, only increase
+*   - every FXOS8700 read after an edge was a new sample
+*
+*     otis_drdy_check [-s seconds] [-j jitter_us]
+*
+* Exits non-zero if a check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "imu_dev.h"
+#include "drdy.h"
+#include "resample.h"
+#include "os_utils.h"
+#include "time_utils.h"
+#include "sim/drdy_sim.h"
+#include "sim/imu_sim.h"
+
+#define CHECK_DEFAULT_SECONDS 3
+#define CHECK_DEFAULT_JITTER_US 500
+/* Edge periods: GYRO_ODR, and FXOS8700_ODR shared by both sensors in hybrid mode */
+#define CHECK_GYRO_PERIOD_US 10000
+#define CHECK_FXOS_PERIOD_US 10000
+/* The firmware's notification bits, wait timeout and resampling */
+#define CHECK_BIT_GYRO (1 << 0)
+#define CHECK_BIT_FXOS (1 << 1)
+#define CHECK_TIMEOUT_MS 100
+#define CHECK_GRID_US 10000
+#define CHECK_MAX_DELAY_US 25000
+
+/*!
+* Virtual time of one generator: its grid index in periods from the start
+*/
+typedef struct check_edge_s {
+    imu_sim_t *sim;
+    drdy_sim_t *gen;
+    uint64_t start_us;
+} check_edge_t;
+
+typedef struct check_sampler_s {
+    imu_dev_t gyro_dev;
+    imu_dev_t fxos_dev;
+    drdy_group_t group;
+    drdy_source_t gyro_drdy;
+    drdy_source_t fxos_drdy;
+    resampler_t resampler;
+    uint64_t gyro_stamp;       /**< Last served stamp of each source */
+    uint64_t fxos_stamp;
+    uint64_t out_stamp;        /**< Last resampled output */
+    uint32_t outputs;
+    uint32_t backwards;        /**< Stamps not after the one before */
+    uint32_t stale;            /**< FXOS8700 reads after an edge with no new sample */
+    uint32_t timeouts;         /**< Waits that timed out before the generators stopped */
+    int done;                  /**< Set once the generators stopped, accessed atomically */
+} check_sampler_t;
+
+static void check_on_edge(void *ctx);
+
+static void *check_sampler(void *arg);
+
+static uint32_t check_step(check_sampler_t *sp);
+
+int main(int argc, char **argv){
+    uint32_t seconds = CHECK_DEFAULT_SECONDS;
+    uint32_t jitter_us = CHECK_DEFAULT_JITTER_US;
+    int opt;
+    while((opt = getopt(argc, argv, "s:j:")) != -1){
+        switch(opt){
+            case 's': seconds = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'j': jitter_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:
+            fprintf(stderr, "usage: %s [-s seconds] [-j jitter_us]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(seconds == 0 || jitter_us >= CHECK_GYRO_PERIOD_US / 2)
+        return 1;
+
+    /* 1. Simulated board in virtual time, devices opened and routed as sampler_start does */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t motion_config;
+    motion_sim_default_config(&motion_config);
+    motion_sim_init(&motion, &motion_config);
+    imu_sim_init(&sim, &motion, NULL);
+    imu_sim_attach(&sim, 0);
+
+    static check_sampler_t sampler;
+    check_sampler_t *sp = &sampler;
+    if(IMU_GYRO_OPEN(&sp->gyro_dev) != IMU_DEV_SUCCESS || IMU_ACCEL_OPEN(&sp->fxos_dev) != IMU_DEV_SUCCESS){
+        fprintf(stderr, "sensor init failed\n");
+        return 1;
+    }
+    drdy_group_init(&sp->group);
+    drdy_source_init(&sp->gyro_drdy, &sp->group, DRDY_NO_PIN, CHECK_BIT_GYRO);
+    drdy_source_init(&sp->fxos_drdy, &sp->group, DRDY_NO_PIN, CHECK_BIT_FXOS);
+    imu_dev_config_t config = sp->gyro_dev.config;
+    config.drdy = 1;
+    IMU_GYRO_CALL(configure)(&sp->gyro_dev, &config);
+    config = sp->fxos_dev.config;
+    config.drdy = 1;
+    IMU_ACCEL_CALL(configure)(&sp->fxos_dev, &config);
+    imu_sample_t reading;
+    size_t count;
+    IMU_GYRO_CALL(read_batch)(&sp->gyro_dev, &reading, 1, &count);
+    IMU_ACCEL_CALL(read_batch)(&sp->fxos_dev, &reading, 1, &count);
+    resample_init(&sp->resampler, CHECK_GRID_US, CHECK_MAX_DELAY_US, RESAMPLE_LINEAR,
+                  RESAMPLE_USE_GYRO | RESAMPLE_USE_ACCEL | RESAMPLE_USE_MAGN);
+
+    /* 2. Edges for the run, served until both generators stopped, then the last pending ones */
+    static drdy_sim_t gyro_gen, fxos_gen;
+    check_edge_t gyro_edge = {&sim, &gyro_gen, sim.now_us};
+    check_edge_t fxos_edge = {&sim, &fxos_gen, sim.now_us};
+    gyro_gen.on_edge = check_on_edge;
+    gyro_gen.ctx = &gyro_edge;
+    fxos_gen.on_edge = check_on_edge;
+    fxos_gen.ctx = &fxos_edge;
+    if(drdy_sim_start(&gyro_gen, &sp->gyro_drdy, CHECK_GYRO_PERIOD_US, jitter_us) != 0 ||
+       drdy_sim_start(&fxos_gen, &sp->fxos_drdy, CHECK_FXOS_PERIOD_US, jitter_us) != 0){
+        fprintf(stderr, "edge generator start failed\n");
+        return 1;
+    }
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, check_sampler, sp) != 0){
+        fprintf(stderr, "sampler start failed\n");
+        return 1;
+    }
+    os_sleep_us(seconds * 1000000U);
+    drdy_sim_stop(&gyro_gen);
+    drdy_sim_stop(&fxos_gen);
+    __atomic_store_n(&sp->done, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    if(sp->gyro_drdy.served != sp->gyro_drdy.edges || sp->fxos_drdy.served != sp->fxos_drdy.edges)
+        check_step(sp);
+
+    /* 3. Report */
+    int failures = 0;
+    drdy_print(&sp->gyro_drdy, "gyro");
+    drdy_print(&sp->fxos_drdy, "fxos8700");
+    printf("edges     gyro %u fxos8700 %u (%u, %u skipped in host stalls), %u outputs, %u timeouts\n",
+           (unsigned)gyro_gen.edges, (unsigned)fxos_gen.edges, (unsigned)gyro_gen.skipped,
+           (unsigned)fxos_gen.skipped, (unsigned)sp->outputs, (unsigned)sp->timeouts);
+    printf("stamps    %u backwards, %u stale FXOS8700 reads\n", (unsigned)sp->backwards, (unsigned)sp->stale);
+    failures += sp->gyro_drdy.served != gyro_gen.edges || sp->fxos_drdy.served != fxos_gen.edges;
+    failures += sp->gyro_drdy.missed != 0 || sp->fxos_drdy.missed != 0;
+    failures += sp->timeouts != 0 || sp->backwards != 0 || sp->stale != 0;
+    failures += gyro_gen.edges == 0 || fxos_gen.edges == 0 || sp->outputs == 0;
+
+    drdy_source_destroy(&sp->gyro_drdy);
+    drdy_source_destroy(&sp->fxos_drdy);
+    IMU_GYRO_CALL(destroy)(&sp->gyro_dev);
+    IMU_ACCEL_CALL(destroy)(&sp->fxos_dev);
+    imu_sim_destroy(&sim);
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 2 : 0;
+}
+
+/*!
+* Runs on a generator thread before its edge: the chip produces the sample the edge
+* announces. Skipped grid points count, so both generators keep one virtual time.
+*/
+static void check_on_edge(void *ctx){
+    check_edge_t *edge = (check_edge_t*)ctx;
+    uint64_t index = (uint64_t)edge->gen->edges + edge->gen->skipped + 1;
+    imu_sim_advance(edge->sim, edge->start_us + index * edge->gen->period_us);
+}
+
+/*!
+* The sampling task: steps until the generators have stopped
+*/
+static void *check_sampler(void *arg){
+    check_sampler_t *sp = (check_sampler_t*)arg;
+    while(!__atomic_load_n(&sp->done, __ATOMIC_ACQUIRE)){
+        if(check_step(sp) == 0 && !__atomic_load_n(&sp->done, __ATOMIC_ACQUIRE))
+            sp->timeouts++;
+    }
+    return NULL;
+}
+
+/*!
+* sampler_step of the firmware with SAMPLE_DRDY, counting what the checks need
+* @returns the sources that signalled, 0 on a timeout
+*/
+static uint32_t check_step(check_sampler_t *sp){
+    imu_sample_t sample;
+    imu_sample_t reading;
+    size_t count;
+
+    uint32_t bits = drdy_wait(&sp->group, CHECK_TIMEOUT_MS);
+    if(bits == 0)
+        return 0;
+    if(bits & CHECK_BIT_FXOS){
+        uint64_t stamp = drdy_serve(&sp->fxos_drdy);
+        sp->backwards += stamp <= sp->fxos_stamp;
+        sp->fxos_stamp = stamp;
+        if(IMU_ACCEL_CALL(read_batch)(&sp->fxos_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1){
+            raw_float_data_t accel = reading.accel;
+            raw_float_data_t magn = reading.magn;
+            sp->stale += !(reading.status & IMU_SAMPLE_ACCEL_FRESH);
+            resample_push_accel(&sp->resampler, stamp, &accel);
+            if(reading.status & IMU_SAMPLE_MAGN_VALID)
+                resample_push_magn(&sp->resampler, stamp, &magn);
+        }
+    }
+    if(bits & CHECK_BIT_GYRO){
+        uint64_t stamp = drdy_serve(&sp->gyro_drdy);
+        sp->backwards += stamp <= sp->gyro_stamp;
+        sp->gyro_stamp = stamp;
+        if(IMU_GYRO_CALL(read_batch)(&sp->gyro_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1){
+            gyro_float_data_t gyro = reading.gyro;
+            resample_push_gyro(&sp->resampler, stamp, &gyro);
+        }
+    }
+    while(resample_pull(&sp->resampler, &sample) == RESAMPLE_SUCCESS){
+        sp->backwards += sample.stamp <= sp->out_stamp;
+        sp->out_stamp = sample.stamp;
+        sp->outputs++;
+    }
+    return bits;
+}
@@ -0,0 +1,247 @@
+/*!
+* @file otis_engine_bench.c
+* @author Ethan Lew
+* @brief Host benchmark of the I2C transaction engine on the simulated 400 kHz bus
+*
+* Two measurements against the sensor models, the bus holding each transaction for
+* its modelled time (plus an optional fixed cost per transaction, -d):
+*   - throughput: gyroscope sample reads (7 bytes) made back to back by the caller
+*     with i2c_utils_link_exec, against the same reads kept queued on the engine with
+*     i2c_utils_submit, with the ring refilled as they complete
+*   - per sample: a 9-DoF sample read by the sampler's three ways, the devices' own
+*     reads one after the other, the two reads queued on the engine (imu_dev_queue_t,
+*     SAMPLE_BATCH=0) and one batched transaction (imu_dev_sample_link, SAMPLE_BATCH)
+*
+*     otis_engine_bench [-n count] [-c clk_hz] [-d overhead_us]
+*
+* Reports transactions per second against the modelled bus limit, bus use, and the
+* wall time and CPU time of the calling thread: time the caller is blocked on the bus
+* is CPU time for a direct read, and free for other work with the engine.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "fxas21002c.h"
+#include "imu_dev.h"
+#include "sim/imu_sim.h"
+#include "sim/i2c_fake_bus.h"
+#include "sim/host_clock.h"
+
+#define BENCH_DEFAULT_COUNT 2000
+#define BENCH_DEFAULT_CLK_HZ 400000
+/* Virtual time between samples (us), the sampler's period */
+#define BENCH_PERIOD_US 10000
+#define BENCH_TIMEOUT_US 100000
+
+typedef enum {
+    BENCH_DIRECT = 0,
+    BENCH_QUEUED,
+    BENCH_BATCHED,
+    BENCH_WAYS
+} bench_way_t;
+
+static const char *bench_way_name[BENCH_WAYS] = {"direct", "queued", "batched"};
+
+/*!
+* Totals of one way over the run
+*/
+typedef struct bench_total_s {
+    uint64_t wall_ns;
+    uint64_t cpu_ns;        /**< CPU time of the calling thread */
+    uint64_t busy_ns;       /**< Modelled bus occupancy */
+    uint32_t transactions;
+    uint32_t failures;
+} bench_total_t;
+
+static volatile uint32_t bench_left;
+
+static void bench_begin(bench_total_t *total, i2c_fake_bus_stats_t *before);
+
+static void bench_end(bench_total_t *total, const i2c_fake_bus_stats_t *before);
+
+static void bench_resubmit(i2c_xfer_t *xfer);
+
+int main(int argc, char **argv){
+    uint32_t count = BENCH_DEFAULT_COUNT;
+    uint32_t clk_hz = BENCH_DEFAULT_CLK_HZ;
+    double overhead_us = 0.0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:c:d:")) != -1){
+        switch(opt){
+            case 'n': count = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'c': clk_hz = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'd': overhead_us = atof(optarg); break;
+            default:
+            fprintf(stderr, "usage: %s [-n count] [-c clk_hz] [-d overhead_us]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(count == 0 || clk_hz == 0 || overhead_us < 0.0)
+        return 1;
+
+    /* 1. Models on virtual time, the devices opened at full speed */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    motion_sim_init(&motion, &config);
+    imu_sim_init(&sim, &motion, NULL);
+    imu_sim_attach(&sim, 0);
+
+    imu_dev_t gyro_dev, fxos_dev;
+    if(IMU_GYRO_OPEN(&gyro_dev) != IMU_DEV_SUCCESS || IMU_ACCEL_OPEN(&fxos_dev) != IMU_DEV_SUCCESS){
+        fprintf(stderr, "device open failed\n");
+        return 1;
+    }
+    imu_dev_t *const devs[2] = {&gyro_dev, &fxos_dev};
+    i2c_link_t sample_link = NULL;
+    imu_dev_queue_t queue;
+    static uint8_t frame[GYRO_SAMPLE_SIZE];
+    i2c_link_t read_link = NULL;
+    i2c_peripheral_t gyro_i2c = {.port = I2C_MASTER_PORT, .addr = FXAS21002C_ADDRESS, .mode = I2C_MODE_TYPE_MASTER,
+                                 .clk_speed = I2C_MASTER_FAST_FREQ_HZ};
+    if(imu_dev_sample_link(devs, 2, &sample_link) != IMU_DEV_SUCCESS ||
+       imu_dev_queue_init(&queue, devs, 2) != IMU_DEV_SUCCESS ||
+       i2c_utils_link_read(gyro_i2c, GYRO_REGISTER_STATUS | 0x80, frame, GYRO_SAMPLE_SIZE, &read_link) != I2C_SUCCESS ||
+       i2c_utils_engine_start(NULL, 0) != I2C_SUCCESS){
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+
+    /* 2. Bus timing from here on */
+    imu_sim_attach(&sim, clk_hz);
+    i2c_fake_bus_set_overhead((uint32_t)(overhead_us * 1000.0));
+    int failures = 0;
+    i2c_fake_bus_stats_t before;
+
+    /* 3. Throughput of single reads, made by the caller or kept queued */
+    bench_total_t xfer[2];
+    memset(xfer, 0, sizeof(xfer));
+    bench_begin(&xfer[0], &before);
+    for(uint32_t i = 0; i < count; i++)
+        xfer[0].failures += i2c_utils_link_exec(read_link) != I2C_SUCCESS;
+    bench_end(&xfer[0], &before);
+
+    static i2c_xfer_t ring[I2C_ENGINE_RING_SIZE];
+    bench_left = count;
+    bench_begin(&xfer[1], &before);
+    for(uint32_t i = 0; i < I2C_ENGINE_RING_SIZE && i < count; i++){
+        ring[i] = (i2c_xfer_t){.type = I2C_XFER_LINK, .i2c_dev = gyro_i2c, .link = read_link};
+        ring[i].done = bench_resubmit;
+        __atomic_sub_fetch(&bench_left, 1, __ATOMIC_ACQ_REL);
+        xfer[1].failures += i2c_utils_submit(&ring[i]) != I2C_SUCCESS;
+    }
+    i2c_engine_stats_t stats;
+    do {
+        usleep(1000);
+        i2c_utils_engine_stats(&stats);
+    } while(stats.completed < count);
+    bench_end(&xfer[1], &before);
+    xfer[1].failures += stats.errors;
+
+    uint64_t read_ns = i2c_fake_bus_read_ns(GYRO_SAMPLE_SIZE) + (uint64_t)(overhead_us * 1000.0);
+    printf("%u reads of %u bytes, %u Hz bus, %.1f us per transaction besides the wire, bus limit %.0f/s\n",
+           count, GYRO_SAMPLE_SIZE, clk_hz, overhead_us, 1e9 / read_ns);
+    printf("%-8s %12s %9s %12s %12s %9s\n", "reads", "per second", "bus use", "wall us", "caller cpu", "failures");
+    const char *xfer_name[2] = {"direct", "engine"};
+    for(int w = 0; w < 2; w++){
+        printf("%-8s %12.0f %8.1f%% %12.2f %11.1f%% %9u\n", xfer_name[w], count * 1e9 / xfer[w].wall_ns,
+               100.0 * xfer[w].busy_ns / xfer[w].wall_ns, (double)xfer[w].wall_ns / count / 1000.0,
+               100.0 * xfer[w].cpu_ns / xfer[w].wall_ns, xfer[w].failures);
+        failures += xfer[w].failures;
+    }
+    printf("engine ring: max depth %u, %u rejected\n\n", stats.max_depth, stats.rejected);
+
+    /* 4. One 9-DoF sample, the sampler's three ways */
+    bench_total_t total[BENCH_WAYS];
+    memset(total, 0, sizeof(total));
+    imu_sample_t reading;
+    size_t n;
+    for(uint32_t i = 0; i < count; i++){
+        imu_sim_advance(&sim, sim.now_us + BENCH_PERIOD_US);
+        int way = i % BENCH_WAYS;
+        imu_sample_t sample;
+        memset(&sample, 0, sizeof(sample));
+        bench_begin(&total[way], &before);
+        switch(way){
+            case BENCH_DIRECT:
+            if(IMU_GYRO_CALL(read_batch)(&gyro_dev, &reading, 1, &n) == IMU_DEV_SUCCESS && n == 1)
+                imu_dev_merge(&sample, &reading);
+            if(IMU_ACCEL_CALL(read_batch)(&fxos_dev, &reading, 1, &n) == IMU_DEV_SUCCESS && n == 1)
+                imu_dev_merge(&sample, &reading);
+            break;
+            case BENCH_QUEUED:
+            imu_dev_queue_submit(&queue);
+            imu_dev_queue_collect(&queue, &sample, BENCH_TIMEOUT_US);
+            break;
+            default: {
+            i2c_err_t ret = i2c_utils_link_exec(sample_link);
+            if(IMU_GYRO_CALL(sample_done)(&gyro_dev, ret, &reading) == IMU_DEV_SUCCESS)
+                imu_dev_merge(&sample, &reading);
+            if(IMU_ACCEL_CALL(sample_done)(&fxos_dev, ret, &reading) == IMU_DEV_SUCCESS)
+                imu_dev_merge(&sample, &reading);
+            break;
+            }
+        }
+        bench_end(&total[way], &before);
+        if((sample.status & (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID | IMU_SAMPLE_MAGN_VALID)) !=
+           (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID | IMU_SAMPLE_MAGN_VALID))
+            total[way].failures++;
+    }
+    printf("%-8s %12s %10s %10s %12s %9s\n", "sample", "transactions", "bus us", "wall us", "caller cpu us",
+           "failures");
+    for(int w = 0; w < BENCH_WAYS; w++){
+        uint32_t samples = count / BENCH_WAYS + ((uint32_t)w < count % BENCH_WAYS);
+        if(samples == 0)
+            continue;
+        printf("%-8s %12.2f %10.2f %10.2f %12.2f %9u\n", bench_way_name[w], (double)total[w].transactions / samples,
+               (double)total[w].busy_ns / samples / 1000.0, (double)total[w].wall_ns / samples / 1000.0,
+               (double)total[w].cpu_ns / samples / 1000.0, total[w].failures);
+        failures += total[w].failures;
+    }
+
+    i2c_utils_engine_stop();
+    imu_dev_queue_destroy(&queue);
+    i2c_utils_link_destroy(&read_link);
+    i2c_utils_link_destroy(&sample_link);
+    IMU_ACCEL_CALL(destroy)(&fxos_dev);
+    IMU_GYRO_CALL(destroy)(&gyro_dev);
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    return failures ? 2 : 0;
+}
+
+/*!
+* Start timing, as the negated clocks; bench_end adds the end values
+*/
+static void bench_begin(bench_total_t *total, i2c_fake_bus_stats_t *before){
+    i2c_fake_bus_stats(before);
+    total->cpu_ns -= host_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    total->wall_ns -= host_clock_now_ns();
+}
+
+static void bench_end(bench_total_t *total, const i2c_fake_bus_stats_t *before){
+    total->wall_ns += host_clock_now_ns();
+    total->cpu_ns += host_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    i2c_fake_bus_stats_t after;
+    i2c_fake_bus_stats(&after);
+    total->busy_ns += after.busy_ns - before->busy_ns;
+    total->transactions += after.transactions - before->transactions;
+}
+
+/*!
+* Keep the ring full: each completed read goes back in while reads are left
+*/
+static void bench_resubmit(i2c_xfer_t *xfer){
+    uint32_t left = __atomic_load_n(&bench_left, __ATOMIC_ACQUIRE);
+    while(left > 0){
+        if(__atomic_compare_exchange_n(&bench_left, &left, left - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            i2c_utils_submit(xfer);
+            return;
+        }
+    }
+}
@@ -0,0 +1,309 @@
+/*!
+* @file otis_engine_check.c
+* @author Ethan Lew
+* @brief Host check of the I2C transaction engine on the simulated bus
+*
+* Runs i2c_utils_submit against the sensor models on the fake bus at 400 kHz, so
+* transactions take their bus time and queue up behind each other, and checks
+*   - submitting before the engine starts, and starting it twice, are refused
+*   - reads, writes and links run in submission order, with the right bytes
+*   - a full ring refuses the next submission and counts it
+*   - a read nobody acknowledges fails alone, the next one still runs
+*   - a completion callback can resubmit its transaction
+*   - stopping runs what is still queued
+*   - imu_dev_queue_t reads the same samples as the devices' own reads
+*
+*     otis_engine_check [-v]
+*
+* Exits non-zero on a failed check.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include "fxas21002c.h"
+#include "fxos8700.h"
+#include "imu_dev.h"
+#include "sim/imu_sim.h"
+#include "sim/i2c_fake_bus.h"
+
+#define CHECK_CLK_HZ 400000
+/* Transactions of the ordering check */
+#define CHECK_ORDER_XFERS 12
+/* Times the chained transaction resubmits itself */
+#define CHECK_CHAIN 20
+/* An address no model answers */
+#define CHECK_ABSENT_ADDR 0x50
+#define CHECK_SAMPLES 200
+#define CHECK_TIMEOUT_US 100000
+
+static volatile uint32_t check_done;
+static uint32_t check_order[I2C_ENGINE_RING_SIZE + 1];
+
+static int check_verbose;
+static volatile int check_gate_open;
+
+static void check_record(i2c_xfer_t *xfer);
+
+static void check_chain(i2c_xfer_t *xfer);
+
+static void check_gate(i2c_xfer_t *xfer);
+
+static int check_wait(i2c_xfer_t *xfers, size_t n);
+
+static int check_report(const char *what, int failures);
+
+static i2c_peripheral_t check_dev(uint8_t addr);
+
+static i2c_xfer_t check_read(i2c_peripheral_t dev, uint8_t reg, uint8_t *data, size_t size);
+
+static int check_same(const imu_sample_t *a, const imu_sample_t *b);
+
+int main(int argc, char **argv){
+    int opt;
+    while((opt = getopt(argc, argv, "v")) != -1){
+        switch(opt){
+            case 'v': check_verbose = 1; break;
+            default:
+            fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* 1. Models on virtual time, the bus at 400 kHz */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    motion_sim_init(&motion, &config);
+    imu_sim_init(&sim, &motion, NULL);
+    imu_sim_attach(&sim, CHECK_CLK_HZ);
+    int failures = 0;
+    int f;
+    i2c_engine_stats_t stats;
+    const i2c_peripheral_t gyro = check_dev(FXAS21002C_ADDRESS);
+    const i2c_peripheral_t fxos = check_dev(FXOS8700_ADDRESS);
+
+    /* 2. Start and stop */
+    static i2c_xfer_t xfers[I2C_ENGINE_RING_SIZE + 1];
+    static uint8_t data[I2C_ENGINE_RING_SIZE + 1][8];
+    xfers[0] = check_read(gyro, GYRO_REGISTER_WHO_AM_I, data[0], 1);
+    f = i2c_utils_submit(&xfers[0]) != I2C_INVALID_STATE;
+    if(i2c_utils_engine_start(NULL, 0) != I2C_SUCCESS){
+        fprintf(stderr, "engine start failed\n");
+        return 1;
+    }
+    f += i2c_utils_engine_start(NULL, 0) != I2C_INVALID_STATE;
+    failures += check_report("start", f);
+
+    /* 3. Order and data: WHO_AM_I of both parts, a write and read back, a link */
+    static uint8_t link_rd[2];
+    i2c_link_t link = NULL;
+    if(i2c_utils_link_read(fxos, FXOS8700_REGISTER_WHO_AM_I, link_rd, 1, &link) != I2C_SUCCESS){
+        fprintf(stderr, "link build failed\n");
+        return 1;
+    }
+    uint8_t thresh_wr[2] = {GYRO_REGISTER_CTRL_REG3, 0x08};
+    check_done = 0;
+    memset(data, 0, sizeof(data));
+    f = 0;
+    for(uint32_t i = 0; i < CHECK_ORDER_XFERS; i++){
+        i2c_xfer_t *x = &xfers[i];
+        switch(i % 4){
+            case 0: *x = check_read(gyro, GYRO_REGISTER_WHO_AM_I, data[i], 1); break;
+            case 1: *x = check_read(fxos, FXOS8700_REGISTER_WHO_AM_I, data[i], 1); break;
+            case 2: *x = (i2c_xfer_t){.type = I2C_XFER_WRITE, .i2c_dev = gyro, .data = thresh_wr, .size = 2}; break;
+            default: *x = (i2c_xfer_t){.type = I2C_XFER_LINK, .i2c_dev = fxos, .link = link}; break;
+        }
+        x->done = check_record;
+        x->ctx = (void*)(uintptr_t)i;
+        if(i2c_utils_submit(x) != I2C_SUCCESS)
+            f++;
+    }
+    f += check_wait(xfers, CHECK_ORDER_XFERS);
+    for(uint32_t i = 0; i < CHECK_ORDER_XFERS && !f; i++){
+        f += check_order[i] != i || xfers[i].result != I2C_SUCCESS;
+        if(i % 4 == 0)
+            f += data[i][0] != FXAS21002C_ID;
+        if(i % 4 == 1)
+            f += data[i][0] != FXOS8700_ID;
+    }
+    f += link_rd[0] != FXOS8700_ID;
+    uint8_t reg3 = 0;
+    f += i2c_utils_read(gyro, GYRO_REGISTER_CTRL_REG3, &reg3, 1) != I2C_SUCCESS || reg3 != thresh_wr[1];
+    failures += check_report("order and data", f);
+
+    /* 4. A full ring, held full by a completion callback that blocks the bus task */
+    i2c_engine_stats_t before;
+    static i2c_xfer_t gate;
+    gate = check_read(gyro, GYRO_REGISTER_WHO_AM_I, data[0], 1);
+    gate.done = check_gate;
+    check_gate_open = 0;
+    f = i2c_utils_submit(&gate) != I2C_SUCCESS;
+    f += check_wait(&gate, 1);
+    i2c_utils_engine_stats(&before);
+    uint32_t accepted = 0;
+    for(uint32_t i = 0; i <= I2C_ENGINE_RING_SIZE; i++){
+        xfers[i] = check_read(gyro, GYRO_REGISTER_OUT_X_MSB, data[i], 6);
+        i2c_err_t ret = i2c_utils_submit(&xfers[i]);
+        accepted += ret == I2C_SUCCESS;
+        if(ret != I2C_SUCCESS && (ret != I2C_QUEUE_FULL || i != I2C_ENGINE_RING_SIZE))
+            f++;
+    }
+    __atomic_store_n(&check_gate_open, 1, __ATOMIC_RELEASE);
+    f += check_wait(xfers, accepted);
+    i2c_utils_engine_stats(&stats);
+    f += accepted != I2C_ENGINE_RING_SIZE || stats.rejected != before.rejected + 1 ||
+         stats.max_depth != I2C_ENGINE_RING_SIZE;
+    failures += check_report("full ring", f);
+
+    /* 5. A NACK fails its own transaction only */
+    i2c_utils_engine_stats(&before);
+    xfers[0] = check_read(check_dev(CHECK_ABSENT_ADDR), 0, data[0], 1);
+    xfers[1] = check_read(gyro, GYRO_REGISTER_WHO_AM_I, data[1], 1);
+    data[1][0] = 0;
+    f = i2c_utils_submit(&xfers[0]) != I2C_SUCCESS || i2c_utils_submit(&xfers[1]) != I2C_SUCCESS;
+    f += check_wait(xfers, 2);
+    i2c_utils_engine_stats(&stats);
+    f += xfers[0].result == I2C_SUCCESS || xfers[1].result != I2C_SUCCESS || data[1][0] != FXAS21002C_ID;
+    f += stats.errors != before.errors + 1;
+    failures += check_report("nack", f);
+
+    /* 6. Resubmitted from its own callback */
+    check_done = 0;
+    xfers[0] = check_read(gyro, GYRO_REGISTER_WHO_AM_I, data[0], 1);
+    xfers[0].done = check_chain;
+    f = i2c_utils_submit(&xfers[0]) != I2C_SUCCESS;
+    uint64_t deadline = get_time_micros() + CHECK_TIMEOUT_US;
+    while(__atomic_load_n(&check_done, __ATOMIC_ACQUIRE) < CHECK_CHAIN && get_time_micros() < deadline)
+        usleep(100);
+    f += check_wait(xfers, 1);
+    f += check_done != CHECK_CHAIN;
+    failures += check_report("resubmit", f);
+
+    /* 7. Device reads queued on the engine against the devices' own reads */
+    imu_dev_t gyro_dev, fxos_dev;
+    imu_dev_queue_t queue;
+    imu_dev_t *const devs[2] = {&gyro_dev, &fxos_dev};
+    if(IMU_GYRO_OPEN(&gyro_dev) != IMU_DEV_SUCCESS || IMU_ACCEL_OPEN(&fxos_dev) != IMU_DEV_SUCCESS ||
+       imu_dev_queue_init(&queue, devs, 2) != IMU_DEV_SUCCESS){
+        fprintf(stderr, "device open failed\n");
+        return 1;
+    }
+    f = 0;
+    for(uint32_t i = 0; i < CHECK_SAMPLES; i++){
+        imu_sample_t direct, queued, reading;
+        size_t count;
+        imu_sim_advance(&sim, sim.now_us + 10000);
+        memset(&direct, 0, sizeof(direct));
+        memset(&queued, 0, sizeof(queued));
+        if(IMU_GYRO_CALL(read_batch)(&gyro_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+            imu_dev_merge(&direct, &reading);
+        if(IMU_ACCEL_CALL(read_batch)(&fxos_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+            imu_dev_merge(&direct, &reading);
+        if(imu_dev_queue_submit(&queue) != IMU_DEV_SUCCESS ||
+           imu_dev_queue_collect(&queue, &queued, CHECK_TIMEOUT_US) != IMU_DEV_SUCCESS){
+            f++;
+            continue;
+        }
+        f += !check_same(&direct, &queued);
+    }
+    failures += check_report("imu_dev queue", f);
+
+    /* 8. Stopping runs what is queued */
+    for(uint32_t i = 0; i < 4; i++){
+        xfers[i] = check_read(gyro, GYRO_REGISTER_WHO_AM_I, data[i], 1);
+        data[i][0] = 0;
+        i2c_utils_submit(&xfers[i]);
+    }
+    i2c_utils_engine_stop();
+    f = 0;
+    for(uint32_t i = 0; i < 4; i++)
+        f += xfers[i].busy || data[i][0] != FXAS21002C_ID;
+    failures += check_report("stop", f);
+
+    i2c_utils_engine_stats(&stats);
+    printf("%u submitted, %u completed, %u rejected, %u errors, max depth %u: %s\n", stats.submitted,
+           stats.completed, stats.rejected, stats.errors, stats.max_depth, failures ? "FAILED" : "ok");
+
+    imu_dev_queue_destroy(&queue);
+    i2c_utils_link_destroy(&link);
+    IMU_ACCEL_CALL(destroy)(&fxos_dev);
+    IMU_GYRO_CALL(destroy)(&gyro_dev);
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    return failures ? 2 : 0;
+}
+
+/*!
+* Completion order, on the bus task
+*/
+static void check_record(i2c_xfer_t *xfer){
+    uint32_t n = __atomic_fetch_add(&check_done, 1, __ATOMIC_ACQ_REL);
+    if(n < sizeof(check_order) / sizeof(check_order[0]))
+        check_order[n] = (uint32_t)(uintptr_t)xfer->ctx;
+}
+
+static void check_chain(i2c_xfer_t *xfer){
+    if(__atomic_add_fetch(&check_done, 1, __ATOMIC_ACQ_REL) < CHECK_CHAIN)
+        i2c_utils_submit(xfer);
+}
+
+/*!
+* Hold the bus task until the check opens the gate
+*/
+static void check_gate(i2c_xfer_t *xfer){
+    (void)xfer;
+    while(!__atomic_load_n(&check_gate_open, __ATOMIC_ACQUIRE))
+        usleep(100);
+}
+
+/*!
+* Wait until none of the transactions is in flight; non-zero on timeout
+*/
+static int check_wait(i2c_xfer_t *xfers, size_t n){
+    uint64_t deadline = get_time_micros() + CHECK_TIMEOUT_US;
+    for(size_t i = 0; i < n; i++){
+        while(__atomic_load_n(&xfers[i].busy, __ATOMIC_ACQUIRE)){
+            if(get_time_micros() > deadline)
+                return 1;
+            usleep(100);
+        }
+    }
+    return 0;
+}
+
+static int check_report(const char *what, int failures){
+    if(failures || check_verbose)
+        printf("%-16s %s\n", what, failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
+
+static i2c_peripheral_t check_dev(uint8_t addr){
+    i2c_peripheral_t dev;
+    memset(&dev, 0, sizeof(dev));
+    dev.port = I2C_MASTER_PORT;
+    dev.addr = addr;
+    dev.mode = I2C_MODE_TYPE_MASTER;
+    dev.clk_speed = I2C_MASTER_FAST_FREQ_HZ;
+    return dev;
+}
+
+/*!
+* A register read for the engine, without callback
+*/
+static i2c_xfer_t check_read(i2c_peripheral_t dev, uint8_t reg, uint8_t *data, size_t size){
+    return (i2c_xfer_t){.type = I2C_XFER_READ, .i2c_dev = dev, .i2c_reg = reg, .data = data, .size = size};
+}
+
+/*!
+* Same sensors and values; the stamps and sequence numbers differ
+*/
+static int check_same(const imu_sample_t *a, const imu_sample_t *b){
+    const uint8_t valid = IMU_SAMPLE_ACCEL_VALID | IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_MAGN_VALID;
+    if((a->status & valid) != (b->status & valid) || (a->status & valid) == 0)
+        return 0;
+    return memcmp(&a->accel, &b->accel, offsetof(imu_sample_t, status) - offsetof(imu_sample_t, accel)) == 0;
+}
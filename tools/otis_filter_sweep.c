@@ -0,0 +1,181 @@
+/*!
+* @file otis_filter_sweep.c
+* @author Ethan Lew
+* @brief Host sweep of every filter mode: I2C bytes and CPU cost per fused sample
+*
+* For each filter_mode_t, sets the devices up as the firmware does for that mode (the
+* FXOS8700 accelerometer only when the filter takes no magnetometer) and samples the
+* simulated sensors with the batched read, in virtual time, counting the transactions
+* and payload bytes on the bus. The samples read are then fused again with the timer
+* running, best of several passes, so only filter_update is timed. Reports per fused
+* sample
+*   - the gyroscope and FXOS8700 read sizes and the payload bytes on the bus (register
+*     address and bus overhead not included)
+*   - transactions
+*   - ns per update, and relative to the 9 DoF Madgwick
+* The figures in filter.h come from this tool.
+*
+*     otis_filter_sweep [-n samples]
+*
+* Exits non-zero if a read failed or the bus moved other bytes than the reads describe.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "imu_dev.h"
+#include "filter.h"
+#include "sim/i2c_fake_bus.h"
+#include "sim/imu_sim.h"
+#include "sim/host_clock.h"
+
+#define SWEEP_DEFAULT_SAMPLES 20000
+#define SWEEP_PASSES 5
+/* Virtual time between samples (us), the sampler's period */
+#define SWEEP_PERIOD_US 10000
+
+typedef struct sweep_result_s {
+    size_t gyro_bytes;         /**< Gyroscope read per sample */
+    size_t fxos_bytes;         /**< FXOS8700 read per sample */
+    double bus_bytes;          /**< Payload moved per sample */
+    double transactions;       /**< Per sample */
+    double ns;                 /**< Per update */
+    uint32_t failures;
+} sweep_result_t;
+
+static const char *sweep_mode_name[FILTER_MODE_COUNT] = {
+    "FILTER_MADGWICK", "FILTER_MADGWICK_IMU", "FILTER_MAHONY",
+    "FILTER_COMPLEMENTARY", "FILTER_UKF", "FILTER_MAHONY_FIXED",
+};
+
+static int sweep_mode(imu_sim_t *sim, filter_mode_t mode, imu_sample_t *samples, uint32_t n, sweep_result_t *result);
+
+int main(int argc, char **argv){
+    uint32_t n = SWEEP_DEFAULT_SAMPLES;
+    int opt;
+    while((opt = getopt(argc, argv, "n:")) != -1){
+        switch(opt){
+            case 'n': n = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:
+            fprintf(stderr, "usage: %s [-n samples]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(n == 0)
+        return 1;
+
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    motion_sim_init(&motion, &config);
+    imu_sim_init(&sim, &motion, NULL);
+    imu_sim_attach(&sim, 0);
+    imu_sample_t *samples = (imu_sample_t*)malloc(n * sizeof(imu_sample_t));
+    if(!samples)
+        return 1;
+
+    sweep_result_t result[FILTER_MODE_COUNT];
+    int failures = 0;
+    for(int m = 0; m < FILTER_MODE_COUNT; m++){
+        if(sweep_mode(&sim, (filter_mode_t)m, samples, n, &result[m])){
+            fprintf(stderr, "%s: setup failed\n", sweep_mode_name[m]);
+            return 1;
+        }
+    }
+
+    printf("%u samples per mode, batched reads, %u us apart\n", n, SWEEP_PERIOD_US);
+    printf("%-22s %5s %9s %10s %13s %9s %9s\n", "mode", "gyro", "fxos8700", "bus bytes", "transactions", "ns",
+           "relative");
+    for(int m = 0; m < FILTER_MODE_COUNT; m++){
+        const sweep_result_t *r = &result[m];
+        printf("%-22s %5u %9u %10.2f %13.2f %9.1f %9.2f\n", sweep_mode_name[m], (unsigned)r->gyro_bytes,
+               (unsigned)r->fxos_bytes, r->bus_bytes, r->transactions, r->ns, r->ns / result[FILTER_MADGWICK].ns);
+        if(r->failures || r->bus_bytes != (double)(r->gyro_bytes + r->fxos_bytes)){
+            printf("%s: %u failed reads, %.2f bytes moved for %u described\n", sweep_mode_name[m], r->failures,
+                   r->bus_bytes, (unsigned)(r->gyro_bytes + r->fxos_bytes));
+            failures++;
+        }
+    }
+
+    free(samples);
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    return failures ? 2 : 0;
+}
+
+/*!
+* One mode
+*   1. Open and configure the devices as the firmware does, and build the batched read
+*   2. Read n samples, counting the bus traffic
+*   3. Fuse them SWEEP_PASSES times from a fresh filter, keeping the fastest pass
+*/
+static int sweep_mode(imu_sim_t *sim, filter_mode_t mode, imu_sample_t *samples, uint32_t n, sweep_result_t *result){
+    imu_dev_t gyro_dev, fxos_dev;
+    memset(result, 0, sizeof(sweep_result_t));
+    if(IMU_GYRO_OPEN(&gyro_dev) != IMU_DEV_SUCCESS)
+        return 1;
+    if(IMU_ACCEL_OPEN(&fxos_dev) != IMU_DEV_SUCCESS){
+        IMU_GYRO_CALL(destroy)(&gyro_dev);
+        return 1;
+    }
+    imu_dev_config_t config = fxos_dev.config;
+    config.sensors = IMU_DEV_ACCEL | (filter_uses_magn(mode) ? IMU_DEV_MAGN : 0);
+    imu_dev_t *const devs[2] = {&gyro_dev, &fxos_dev};
+    i2c_link_t link = NULL;
+    i2c_op_t op[2];
+    int ret = 1;
+    if(IMU_ACCEL_CALL(configure)(&fxos_dev, &config) != IMU_DEV_SUCCESS ||
+       IMU_GYRO_CALL(sample_op)(&gyro_dev, &op[0]) != IMU_DEV_SUCCESS ||
+       IMU_ACCEL_CALL(sample_op)(&fxos_dev, &op[1]) != IMU_DEV_SUCCESS ||
+       imu_dev_sample_link(devs, 2, &link) != IMU_DEV_SUCCESS)
+        goto done;
+    result->gyro_bytes = op[0].size;
+    result->fxos_bytes = op[1].size;
+
+    i2c_fake_bus_stats_t before, after;
+    i2c_fake_bus_stats(&before);
+    for(uint32_t i = 0; i < n; i++){
+        imu_sim_advance(sim, sim->now_us + SWEEP_PERIOD_US);
+        imu_sample_t reading;
+        memset(&samples[i], 0, sizeof(imu_sample_t));
+        i2c_err_t err = i2c_utils_link_exec(link);
+        if(IMU_GYRO_CALL(sample_done)(&gyro_dev, err, &reading) == IMU_DEV_SUCCESS)
+            imu_dev_merge(&samples[i], &reading);
+        else
+            result->failures++;
+        if(IMU_ACCEL_CALL(sample_done)(&fxos_dev, err, &reading) == IMU_DEV_SUCCESS)
+            imu_dev_merge(&samples[i], &reading);
+        else
+            result->failures++;
+    }
+    i2c_fake_bus_stats(&after);
+    result->bus_bytes = (double)(after.bytes - before.bytes) / n;
+    result->transactions = (double)(after.transactions - before.transactions) / n;
+
+    static filter_t filter;
+    uint64_t best = UINT64_MAX;
+    for(int p = 0; p < SWEEP_PASSES; p++){
+        if(filter_init(&filter, mode, 1e6F / SWEEP_PERIOD_US) != FILTER_SUCCESS)
+            goto done;
+        uint64_t t0 = host_clock_now_ns();
+        for(uint32_t i = 0; i < n; i++){
+            gyro_float_data_t gyro = samples[i].gyro;
+            raw_float_data_t accel = samples[i].accel;
+            raw_float_data_t magn = samples[i].magn;
+            filter_update(&filter, &gyro, &accel, (samples[i].status & IMU_SAMPLE_MAGN_VALID) ? &magn : NULL);
+        }
+        uint64_t t1 = host_clock_now_ns();
+        if(t1 - t0 < best)
+            best = t1 - t0;
+    }
+    result->ns = (double)best / n;
+    ret = 0;
+
+done:
+    i2c_utils_link_destroy(&link);
+    IMU_ACCEL_CALL(destroy)(&fxos_dev);
+    IMU_GYRO_CALL(destroy)(&gyro_dev);
+    return ret;
+}
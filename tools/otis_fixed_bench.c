@@ -0,0 +1,254 @@
+/*!
+* @file otis_fixed_bench.c
+* @author Ethan Lew
+* @brief Host benchmark and accuracy check of the fixed point path against the float one
+*
+* Records samples from the drivers on the simulated sensors (synthetic motion, or a
+* recorded log with -r), with the gyroscope bias and an accelerometer correction set
+* so every term of the conversion is exercised. Then, over the recorded counts:
+*   1. conversion: float (count * scale - bias, (count * scale - offset) * gain)
+*      against gyro_convert_fixed / accel_convert_fixed, largest difference and time
+*   2. fusion: mahony_update_imu on the float samples against mahony_fixed_update_imu
+*      on the fixed ones, the angle between the two orientations, the error of each
+*      against the true orientation (synthetic motion only) and time per update
+*
+*     otis_fixed_bench [-n samples] [-r replay file] [-k repeats]
+*
+* Host timings only rank the two paths; a host FPU makes float cheap, unlike the
+* ESP32-S2/C3 this path is for. Exits non-zero if the paths disagree by more than
+* the FIXED_BENCH_MAX_* bounds.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fxas21002c.h"
+#include "fxos8700.h"
+#include "fixed.h"
+#include "mahony.h"
+#include "mahony_fixed.h"
+#include "sim/imu_sim.h"
+#include "sim/host_clock.h"
+
+#define FIXED_BENCH_DEFAULT_SAMPLES 20000
+#define FIXED_BENCH_DEFAULT_REPEATS 20
+#define FIXED_BENCH_WARMUP_S (2.0F)
+/* Acceptance */
+#define FIXED_BENCH_MAX_GYRO (1e-4F)       /* rad/s */
+#define FIXED_BENCH_MAX_ACCEL (1e-3F)      /* m/s^2 */
+#define FIXED_BENCH_MAX_ANGLE (0.05F)      /* degrees between the float and fixed orientation */
+
+typedef struct fixed_bench_rec_s {
+    gyro_int_data_t gyro_raw;
+    raw_int_data_t accel_raw;
+    float q_true[4];
+} fixed_bench_rec_t;
+
+/* Keeps the timed loops from being optimized away */
+static volatile int64_t fixed_bench_sink;
+
+static float fixed_bench_angle(const float *a, const float *b);
+
+int main(int argc, char **argv){
+    uint32_t samples = FIXED_BENCH_DEFAULT_SAMPLES;
+    uint32_t repeats = FIXED_BENCH_DEFAULT_REPEATS;
+    const char *replay = NULL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:r:k:")) != -1){
+        switch(opt){
+            case 'n': samples = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'r': replay = optarg; break;
+            case 'k': repeats = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:
+            fprintf(stderr, "usage: %s [-n samples] [-r replay] [-k repeats]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(samples == 0 || repeats == 0)
+        return 1;
+
+    /* 1. Simulated sensors and drivers, with a correction in place */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    if(replay){
+        motion_sim_err_t err = motion_sim_open(&motion, replay);
+        if(err != MOTION_SIM_SUCCESS){
+            fprintf(stderr, "cannot replay %s (%d)\n", replay, err);
+            return 1;
+        }
+    } else {
+        motion_sim_init(&motion, &config);
+    }
+    imu_sim_init(&sim, &motion, NULL);
+    imu_sim_attach(&sim, 0);
+
+    gyro_t *gyro = NULL;
+    accel_t *accel = NULL;
+    if(gyro_init(&gyro) != GYRO_SUCCESS || accel_init(&accel) != ACCEL_SUCCESS){
+        fprintf(stderr, "sensor init failed\n");
+        return 1;
+    }
+    fxos8700_accel_cal_t accel_cal;
+    for(int i = 0; i < 3; i++){
+        accel_cal.offset[i] = config.accel_bias[i] * SENSORS_GRAVITY_STANDARD;
+        accel_cal.gain[i] = 1.0F - 0.01F * (float)(i - 1);
+    }
+    gyro_set_bias(gyro, config.gyro_bias);
+    accel_set_calibration(accel, &accel_cal);
+
+    /* 2. Record */
+    fixed_bench_rec_t *rec = (fixed_bench_rec_t*)malloc(samples * sizeof(fixed_bench_rec_t));
+    gyro_float_data_t *gf = (gyro_float_data_t*)malloc(samples * sizeof(gyro_float_data_t));
+    raw_float_data_t *af = (raw_float_data_t*)malloc(samples * sizeof(raw_float_data_t));
+    gyro_fixed_data_t *gq = (gyro_fixed_data_t*)malloc(samples * sizeof(gyro_fixed_data_t));
+    raw_fixed_data_t *aq = (raw_fixed_data_t*)malloc(samples * sizeof(raw_fixed_data_t));
+    if(!rec || !gf || !af || !gq || !aq)
+        return 1;
+    uint32_t period_us = gyro->period_us;
+    float freq = 1e6F / (float)period_us;
+    uint32_t failures = 0;
+    for(uint32_t i = 0; i < samples; i++){
+        imu_sim_advance(&sim, sim.now_us + period_us);
+        if(gyro_update(gyro) != GYRO_SUCCESS || accel_update(accel) != ACCEL_SUCCESS)
+            failures++;
+        rec[i].gyro_raw = gyro->raw;
+        rec[i].accel_raw = accel->raw;
+        memcpy(rec[i].q_true, motion.q, sizeof(rec[i].q_true));
+    }
+
+    /* 3. Conversion: accuracy, then cost */
+    float gyro_err = 0.0F, accel_err = 0.0F;
+    for(uint32_t i = 0; i < samples; i++){
+        const gyro_int_data_t *g = &rec[i].gyro_raw;
+        const raw_int_data_t *a = &rec[i].accel_raw;
+        gf[i].x = g->x * gyro->scale - gyro->bias[0];
+        gf[i].y = g->y * gyro->scale - gyro->bias[1];
+        gf[i].z = g->z * gyro->scale - gyro->bias[2];
+        af[i].x = (a->x * accel->fxos->accel_scale - accel_cal.offset[0]) * accel_cal.gain[0];
+        af[i].y = (a->y * accel->fxos->accel_scale - accel_cal.offset[1]) * accel_cal.gain[1];
+        af[i].z = (a->z * accel->fxos->accel_scale - accel_cal.offset[2]) * accel_cal.gain[2];
+        gyro_convert_fixed(gyro, g, &gq[i]);
+        accel_convert_fixed(accel, a, &aq[i]);
+        gyro_err = fmaxf(gyro_err, fabsf(q16_to_float(gq[i].x) - gf[i].x));
+        gyro_err = fmaxf(gyro_err, fabsf(q16_to_float(gq[i].y) - gf[i].y));
+        gyro_err = fmaxf(gyro_err, fabsf(q16_to_float(gq[i].z) - gf[i].z));
+        accel_err = fmaxf(accel_err, fabsf(q16_to_float(aq[i].x) - af[i].x));
+        accel_err = fmaxf(accel_err, fabsf(q16_to_float(aq[i].y) - af[i].y));
+        accel_err = fmaxf(accel_err, fabsf(q16_to_float(aq[i].z) - af[i].z));
+    }
+
+    uint64_t t0 = host_clock_now_ns();
+    for(uint32_t k = 0; k < repeats; k++){
+        float sum = 0.0F;
+        for(uint32_t i = 0; i < samples; i++){
+            const gyro_int_data_t *g = &rec[i].gyro_raw;
+            const raw_int_data_t *a = &rec[i].accel_raw;
+            gyro_float_data_t r = {g->x * gyro->scale - gyro->bias[0], g->y * gyro->scale - gyro->bias[1],
+                                   g->z * gyro->scale - gyro->bias[2]};
+            raw_float_data_t c = {(a->x * accel->fxos->accel_scale - accel_cal.offset[0]) * accel_cal.gain[0],
+                                  (a->y * accel->fxos->accel_scale - accel_cal.offset[1]) * accel_cal.gain[1],
+                                  (a->z * accel->fxos->accel_scale - accel_cal.offset[2]) * accel_cal.gain[2]};
+            sum += r.x + r.y + r.z + c.x + c.y + c.z;
+        }
+        fixed_bench_sink += (int64_t)sum;
+    }
+    uint64_t t1 = host_clock_now_ns();
+    for(uint32_t k = 0; k < repeats; k++){
+        int64_t sum = 0;
+        for(uint32_t i = 0; i < samples; i++){
+            gyro_fixed_data_t r;
+            raw_fixed_data_t c;
+            gyro_convert_fixed(gyro, &rec[i].gyro_raw, &r);
+            accel_convert_fixed(accel, &rec[i].accel_raw, &c);
+            sum += r.x + r.y + r.z + c.x + c.y + c.z;
+        }
+        fixed_bench_sink += sum;
+    }
+    uint64_t t2 = host_clock_now_ns();
+    double n_conv = (double)samples * repeats;
+
+    /* 4. Fusion: accuracy, then cost */
+    static mahony_t mf;
+    static mahony_fixed_t mq;
+    mahony_init(&mf, MAHONY_KP_DEFAULT, MAHONY_KI_DEFAULT, freq);
+    mahony_fixed_init(&mq, MAHONY_KP_DEFAULT, MAHONY_KI_DEFAULT, freq);
+    uint32_t warmup = (uint32_t)(FIXED_BENCH_WARMUP_S * freq);
+    float apart_max = 0.0F;
+    double apart_sq = 0.0, float_sq = 0.0, fixed_sq = 0.0;
+    uint32_t n_err = 0;
+    for(uint32_t i = 0; i < samples; i++){
+        mahony_update_imu(&mf, &gf[i], &af[i]);
+        mahony_fixed_update_imu(&mq, &gq[i], &aq[i]);
+        float q[4];
+        for(int j = 0; j < 4; j++)
+            q[j] = q30_to_float(mq.q[j]);
+        float apart = fixed_bench_angle(mf.q, q);
+        apart_max = fmaxf(apart_max, apart);
+        apart_sq += (double)apart * apart;
+        if(!replay && i >= warmup){
+            float ef = fixed_bench_angle(mf.q, rec[i].q_true);
+            float eq = fixed_bench_angle(q, rec[i].q_true);
+            float_sq += (double)ef * ef;
+            fixed_sq += (double)eq * eq;
+            n_err++;
+        }
+    }
+
+    uint64_t t3 = host_clock_now_ns();
+    for(uint32_t k = 0; k < repeats; k++){
+        mahony_init(&mf, MAHONY_KP_DEFAULT, MAHONY_KI_DEFAULT, freq);
+        for(uint32_t i = 0; i < samples; i++)
+            mahony_update_imu(&mf, &gf[i], &af[i]);
+        fixed_bench_sink += (int64_t)(mf.q[0] * 1000.0F);
+    }
+    uint64_t t4 = host_clock_now_ns();
+    for(uint32_t k = 0; k < repeats; k++){
+        mahony_fixed_init(&mq, MAHONY_KP_DEFAULT, MAHONY_KI_DEFAULT, freq);
+        for(uint32_t i = 0; i < samples; i++)
+            mahony_fixed_update_imu(&mq, &gq[i], &aq[i]);
+        fixed_bench_sink += mq.q[0];
+    }
+    uint64_t t5 = host_clock_now_ns();
+
+    /* 5. Report */
+    const float deg = 57.29578F;
+    int failed = failures || gyro_err > FIXED_BENCH_MAX_GYRO || accel_err > FIXED_BENCH_MAX_ACCEL ||
+                 apart_max * deg > FIXED_BENCH_MAX_ANGLE;
+    printf("%u samples at %.1f Hz from %s, %u repeats\n", samples, freq, replay ? replay : "synthetic motion", repeats);
+    printf("conversion  float %6.1f ns/sample, fixed %6.1f ns/sample; largest difference gyro %.2e rad/s, "
+           "accel %.2e m/s^2\n", (t1 - t0) / n_conv, (t2 - t1) / n_conv, gyro_err, accel_err);
+    printf("mahony      float %6.1f ns/update, fixed %6.1f ns/update\n", (t4 - t3) / n_conv, (t5 - t4) / n_conv);
+    printf("fixed against float: rms %.4f deg, max %.4f deg apart\n", sqrt(apart_sq / samples) * deg, apart_max * deg);
+    if(n_err)
+        printf("attitude error after %.0f s: float rms %.3f deg, fixed rms %.3f deg\n", FIXED_BENCH_WARMUP_S,
+               sqrt(float_sq / n_err) * deg, sqrt(fixed_sq / n_err) * deg);
+    printf("driver failures: %u\n%s\n", failures, failed ? "FAILED" : "passed");
+
+    free(rec);
+    free(gf);
+    free(af);
+    free(gq);
+    free(aq);
+    gyro_destroy(&gyro);
+    accel_destroy(&accel);
+    imu_sim_destroy(&sim);
+    motion_sim_close(&motion);
+    return failed ? 2 : 0;
+}
+
+/*!
+* Rotation angle between two orientations, from the vector part of a^-1 b in double:
+* the acos of a float dot product cannot resolve less than about 0.04 degrees
+*/
+static float fixed_bench_angle(const float *a, const float *b){
+    double w = (double)a[0] * b[0] + (double)a[1] * b[1] + (double)a[2] * b[2] + (double)a[3] * b[3];
+    double x = (double)a[0] * b[1] - (double)a[1] * b[0] - (double)a[2] * b[3] + (double)a[3] * b[2];
+    double y = (double)a[0] * b[2] + (double)a[1] * b[3] - (double)a[2] * b[0] - (double)a[3] * b[1];
+    double z = (double)a[0] * b[3] - (double)a[1] * b[2] + (double)a[2] * b[1] - (double)a[3] * b[0];
+    return (float)(2.0 * atan2(sqrt(x * x + y * y + z * z), fabs(w)));
+}
@@ -0,0 +1,686 @@
+/*!
+* @file otis_fuse_batch.c
+* @author Ethan Lew
+* @brief Offline fusion of a recorded bus log, sharded across cores, for gain sweeps
+*
+* Maps a log written by the bus recorder (i2c_rec.h), from a file or a dumped ring,
+* and runs the firmware's fusion over all of it without going through the drivers:
+*   1. One pass over the mapping indexes the samples: a gyroscope STATUS burst read
+*      and the FXOS8700 one right after it make a sample, as the sampling stage reads
+*      them. Range writes (CTRL_REG0, XYZ_DATA_CFG) change the conversion from then
+*      on, with the sensitivities of fxas21002c.h and fxos8700.h. Any other record
+*      between the two reads (a self test, a WHO_AM_I) leaves them separate samples,
+*      which are not fused.
+*   2. The samples are cut into segments, and each segment is fused for each gain as
+*      one job. A job starts its own filter the warm-up time before its segment, so
+*      its orientation has settled by the first sample it reports; the first segment
+*      starts with the log, as the firmware did.
+*   3. Workers, one per core, take jobs in turn. The sensor blocks are converted
+*      straight from the mapping with the batch kernels (conv.h), a block of samples
+*      at a time, as the records of one device sit a fixed stride apart; the filter
+*      then runs sample by sample through filter_update, as on target.
+*
+* The conversions are the drivers' own, so the first segment must match a replay of
+* the log through the drivers (sim/i2c_replay.h) bit for bit; it is checked every run.
+* Runtime calibration (stillcal, magcal) is not re-run: its corrections are not in the
+* log. A stored calibration record can be applied to all of it with -c.
+*
+*     otis_fuse_batch [-m mode] [-g gain,...] [-t threads] [-s segments] [-w warm-up s] [-f Hz] [-c cal] [-o csv] log
+*
+*   -m  filter mode, see filter_mode_t (default 0, Madgwick); a log of a 6 DoF mode
+*       has no magnetometer data, so 9 DoF modes run their 6 DoF step on it
+*   -g  gains to sweep, see filter_set_gain (default: the mode's own)
+*   -t  worker threads (default: one per core)
+*   -s  segments (default: one per worker)
+*   -w  warm-up of each segment but the first (default 10 s)
+*   -f  filter rate (default 100 Hz, the firmware's SAMPLE_PERIOD)
+*   -c  calibration record (imu_cal.h) applied to every sample
+*   -o  write the orientations, one row per sample and w, x, y, z per gain
+*
+* The report gives the accelerometer tilt residual of each gain, the angle between the
+* measured and the estimated gravity, and the fused samples per second of each core.
+* Exits non-zero if the first segment differs from the driver replay.
+*/
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "conv.h"
+#include "fxas21002c.h"
+#include "fxos8700.h"
+#include "imu_cal.h"
+#include "imu_dev.h"
+#include "i2c_rec.h"
+#include "os_utils.h"
+#include "filter.h"
+#include "sim/i2c_replay.h"
+#include "sim/host_clock.h"
+
+#define FUSE_BATCH_MAX_GAINS 32
+#define FUSE_BATCH_MAX_WORKERS 64
+#define FUSE_BATCH_MAX_SETUPS 64
+/* Samples converted per kernel call */
+#define FUSE_BATCH_BLOCK 256
+#define FUSE_BATCH_DEFAULT_RATE 100.0F
+#define FUSE_BATCH_DEFAULT_WARMUP 10.0F
+#define FUSE_BATCH_STACK 16384
+
+/* Sample parts, set when the read succeeded */
+#define FUSE_BATCH_GYRO  (0x01)
+#define FUSE_BATCH_ACCEL (0x02)
+#define FUSE_BATCH_MAGN  (0x04)
+
+/*!
+* Conversions in force from a range write on
+*/
+typedef struct fuse_batch_setup_s {
+    conv_params_t gyro;
+    conv_params_t accel;
+} fuse_batch_setup_t;
+
+/*!
+* One indexed sample, its bytes left in the mapping
+*/
+typedef struct fuse_batch_sample_s {
+    size_t gyro;          /**< Offset of the gyroscope X MSB, 0 for no read */
+    size_t fxos;          /**< Offset of the accelerometer X MSB, 0 for no read */
+    uint64_t t_us;        /**< Time of the first read */
+    uint16_t setup;       /**< Index of its conversions */
+    uint8_t parts;        /**< FUSE_BATCH_* */
+} fuse_batch_sample_t;
+
+typedef struct fuse_batch_log_s {
+    const uint8_t *map;
+    size_t size;
+    fuse_batch_sample_t *samples;
+    size_t count;
+    size_t capacity;
+    size_t fusable;       /**< Samples with a gyroscope and an accelerometer reading */
+    uint32_t records;
+    uint32_t other;       /**< Records that are neither a sample read nor a range write */
+    uint8_t hybrid;       /**< The FXOS8700 reads carry the magnetometer */
+    fuse_batch_setup_t setups[FUSE_BATCH_MAX_SETUPS];
+    uint16_t setup_count;
+} fuse_batch_log_t;
+
+/*!
+* One segment fused with one gain
+*/
+typedef struct fuse_batch_job_s {
+    float gain;           /**< NAN for the mode's default */
+    size_t warm;          /**< First sample run */
+    size_t begin;         /**< First sample reported */
+    size_t end;
+    float *q;             /**< 4 per reported sample, or NULL */
+    double tilt_sq;       /**< Sum of the squared tilt residuals (rad^2) */
+    uint32_t tilt_count;
+} fuse_batch_job_t;
+
+typedef struct fuse_batch_worker_s {
+    os_task_t task;
+    uint32_t jobs;
+    uint64_t samples;     /**< Samples run, warm-up included */
+    uint64_t cpu_ns;
+    float gyro[3][FUSE_BATCH_BLOCK];
+    float accel[3][FUSE_BATCH_BLOCK];
+#if OTIS_FIXED_POINT
+    q16_t gyro_q[3][FUSE_BATCH_BLOCK];
+    q16_t accel_q[3][FUSE_BATCH_BLOCK];
+#endif
+} fuse_batch_worker_t;
+
+static fuse_batch_log_t batch_log;
+static fuse_batch_job_t *batch_jobs;
+static uint32_t batch_job_count;
+static uint32_t batch_next_job;
+static filter_mode_t batch_mode = FILTER_MADGWICK;
+static float batch_rate = FUSE_BATCH_DEFAULT_RATE;
+
+static int fuse_batch_map(const char *path, fuse_batch_log_t *log);
+
+static int fuse_batch_index(fuse_batch_log_t *log, const imu_cal_t *cal);
+
+static int fuse_batch_push(fuse_batch_log_t *log, const fuse_batch_sample_t *sample);
+
+static void fuse_batch_worker(void *arg);
+
+static void fuse_batch_run(fuse_batch_worker_t *worker, fuse_batch_job_t *job);
+
+static void fuse_batch_convert(fuse_batch_worker_t *worker, size_t first, size_t n, uint8_t accel);
+
+static int fuse_batch_verify(const fuse_batch_job_t *job, const imu_cal_t *cal, size_t *compared, uint64_t *elapsed_ns);
+
+static int fuse_batch_write(const char *path, const float *const *q, uint32_t gains);
+
+int main(int argc, char **argv){
+    float gains[FUSE_BATCH_MAX_GAINS] = {NAN};
+    uint32_t gain_count = 1;
+    uint32_t threads = os_core_count();
+    uint32_t segments = 0;
+    float warmup_s = FUSE_BATCH_DEFAULT_WARMUP;
+    const char *cal_path = NULL;
+    const char *out = NULL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "m:g:t:s:w:f:c:o:")) != -1){
+        switch(opt){
+            case 'm': batch_mode = (filter_mode_t)atoi(optarg); break;
+            case 'g': {
+                char *p = optarg;
+                gain_count = 0;
+                while(*p && gain_count < FUSE_BATCH_MAX_GAINS){
+                    gains[gain_count++] = strtof(p, &p);
+                    if(*p == ',')
+                        p++;
+                    else if(*p)
+                        break;
+                }
+                break;
+            }
+            case 't': threads = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 's': segments = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'w': warmup_s = strtof(optarg, NULL); break;
+            case 'f': batch_rate = strtof(optarg, NULL); break;
+            case 'c': cal_path = optarg; break;
+            case 'o': out = optarg; break;
+            default:
+            fprintf(stderr, "usage: %s [-m mode] [-g gain,...] [-t threads] [-s segments] [-w warm-up s] [-f Hz] [-c cal] [-o csv] log\n", argv[0]);
+            return 1;
+        }
+    }
+    if(optind != argc - 1 || gain_count == 0 || batch_rate <= 0.0F || warmup_s < 0.0F){
+        fprintf(stderr, "usage: %s [-m mode] [-g gain,...] [-t threads] [-s segments] [-w warm-up s] [-f Hz] [-c cal] [-o csv] log\n", argv[0]);
+        return 1;
+    }
+    filter_t probe;
+    if(filter_init(&probe, batch_mode, batch_rate) != FILTER_SUCCESS ||
+       (!isnan(gains[0]) && filter_set_gain(&probe, gains[0]) != FILTER_SUCCESS)){
+        fprintf(stderr, "mode %d cannot run%s\n", batch_mode, isnan(gains[0]) ? "" : " with a gain");
+        return 1;
+    }
+    if(threads == 0)
+        threads = 1;
+    if(threads > FUSE_BATCH_MAX_WORKERS)
+        threads = FUSE_BATCH_MAX_WORKERS;
+    if(segments == 0)
+        segments = threads;
+
+    /* 1. Map and index */
+    imu_cal_t cal;
+    imu_cal_identity(&cal);
+    if(cal_path){
+        imu_cal_set_path(cal_path);
+        if(imu_cal_load(&cal) != IMU_CAL_SUCCESS){
+            fprintf(stderr, "cannot load the calibration %s\n", cal_path);
+            return 1;
+        }
+    }
+    if(fuse_batch_map(argv[optind], &batch_log) != 0)
+        return 1;
+    uint64_t start_ns = host_clock_now_ns();
+    if(fuse_batch_index(&batch_log, &cal) != 0)
+        return 1;
+    uint64_t index_ns = host_clock_now_ns() - start_ns;
+    size_t count = batch_log.count;
+    if(count == 0){
+        fprintf(stderr, "no samples in %s\n", argv[optind]);
+        return 1;
+    }
+    if(segments > count)
+        segments = (uint32_t)count;
+    printf("log: %zu bytes, %u records, %zu samples (%zu fusable), %.1f s, %u conversion setups, %u other records, indexed in %.3f s\n",
+           batch_log.size, batch_log.records, count, batch_log.fusable,
+           (batch_log.samples[count - 1].t_us - batch_log.samples[0].t_us) * 1e-6, batch_log.setup_count,
+           batch_log.other, index_ns * 1e-9);
+
+    /* 2. Jobs: segments of every gain, with their warm-up */
+    size_t warm = (size_t)(warmup_s * batch_rate);
+    float *q[FUSE_BATCH_MAX_GAINS] = {NULL};
+    batch_job_count = gain_count * segments;
+    batch_jobs = (fuse_batch_job_t*)calloc(batch_job_count, sizeof(fuse_batch_job_t));
+    if(batch_jobs == NULL){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for(uint32_t g = 0; g < gain_count; g++){
+        if(out || g == 0){
+            q[g] = (float*)malloc((out ? count : count / segments) * 4 * sizeof(float));
+            if(q[g] == NULL){
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+        }
+        for(uint32_t s = 0; s < segments; s++){
+            fuse_batch_job_t *job = &batch_jobs[g * segments + s];
+            job->gain = gains[g];
+            job->begin = count * s / segments;
+            job->end = count * (s + 1) / segments;
+            job->warm = job->begin > warm ? job->begin - warm : 0;
+            if(out)
+                job->q = &q[g][4 * job->begin];
+            else if(g == 0 && s == 0)
+                job->q = q[0];
+        }
+    }
+
+    /* 3. Workers, pinned a core each */
+    if(threads > batch_job_count)
+        threads = batch_job_count;
+    fuse_batch_worker_t *workers = (fuse_batch_worker_t*)calloc(threads, sizeof(fuse_batch_worker_t));
+    if(workers == NULL){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    start_ns = host_clock_now_ns();
+    for(uint32_t i = 0; i < threads; i++){
+        if(os_task_start(&workers[i].task, "fuse", fuse_batch_worker, &workers[i], FUSE_BATCH_STACK, 1,
+                         (int)(i % os_core_count())) != OS_SUCCESS){
+            fprintf(stderr, "cannot start worker %u\n", i);
+            return 1;
+        }
+    }
+    for(uint32_t i = 0; i < threads; i++)
+        os_task_join(&workers[i].task);
+    uint64_t wall_ns = host_clock_now_ns() - start_ns;
+
+    /* 4. Report */
+    printf("%u gains x %u segments, %.1f s warm-up, mode %d\n", gain_count, segments, warm / batch_rate, batch_mode);
+    for(uint32_t g = 0; g < gain_count; g++){
+        double tilt_sq = 0.0;
+        uint32_t tilt_count = 0;
+        for(uint32_t s = 0; s < segments; s++){
+            tilt_sq += batch_jobs[g * segments + s].tilt_sq;
+            tilt_count += batch_jobs[g * segments + s].tilt_count;
+        }
+        if(isnan(gains[g]))
+            printf("  gain default   ");
+        else
+            printf("  gain %-10g", gains[g]);
+        printf("  tilt residual rms %.3f deg over %u samples\n",
+               tilt_count ? sqrt(tilt_sq / tilt_count) * 180.0 / M_PI : 0.0, tilt_count);
+    }
+    uint64_t samples = 0;
+    uint64_t cpu_ns = 0;
+    for(uint32_t i = 0; i < threads; i++){
+        fuse_batch_worker_t *w = &workers[i];
+        printf("  worker %u%s: %u jobs, %llu samples in %.3f s cpu, %.0f samples/s\n", i,
+               w->task.pinned ? "" : " (unpinned)", w->jobs, (unsigned long long)w->samples, w->cpu_ns * 1e-9,
+               w->cpu_ns ? w->samples / (w->cpu_ns * 1e-9) : 0.0);
+        samples += w->samples;
+        cpu_ns += w->cpu_ns;
+    }
+    printf("fused %llu samples, warm-up included, in %.3f s on %u workers: %.0f samples/s, %.0f samples/s per core\n",
+           (unsigned long long)samples, wall_ns * 1e-9, threads, samples / (wall_ns * 1e-9),
+           cpu_ns ? samples / (cpu_ns * 1e-9) : 0.0);
+
+    /* 5. The first segment against the drivers */
+    uint64_t replay_ns = 0;
+    size_t n = 0;
+    int ret = fuse_batch_verify(&batch_jobs[0], &cal, &n, &replay_ns);
+    if(ret == 0){
+        printf("first segment matches the driver replay: %zu orientations bit exact; replay %.0f samples/s, batch %.1fx that per core\n",
+               n, replay_ns ? n / (replay_ns * 1e-9) : 0.0, n && cpu_ns ? (replay_ns * 1e-9 / n) / (cpu_ns * 1e-9 / samples) : 0.0);
+    }
+    if(ret == 0 && out)
+        ret = fuse_batch_write(out, (const float *const *)q, gain_count);
+
+    for(uint32_t g = 0; g < gain_count; g++)
+        free(q[g]);
+    free(workers);
+    free(batch_jobs);
+    free(batch_log.samples);
+    munmap((void*)batch_log.map, batch_log.size);
+    return ret;
+}
+
+static int fuse_batch_map(const char *path, fuse_batch_log_t *log){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        perror(path);
+        return 1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < I2C_REC_FILE_HEADER){
+        fprintf(stderr, "%s: not a bus log\n", path);
+        close(fd);
+        return 1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        perror("mmap");
+        return 1;
+    }
+    log->map = (const uint8_t*)map;
+    log->size = (size_t)st.st_size;
+    if(i2c_rec_check(log->map, log->size) != I2C_REC_SUCCESS){
+        fprintf(stderr, "%s: not a bus log\n", path);
+        munmap(map, log->size);
+        return 1;
+    }
+    madvise(map, log->size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+/*!
+* Index the samples of the log
+*   1. Start from the ranges the drivers open with, and the calibration
+*   2. A successful range write starts a new setup with the sensitivity of the new
+*      range, as gyro_configure and fxos8700_configure do
+*   3. A gyroscope read starts a sample; the FXOS8700 read right after it completes
+*      it, one with anything else in between starts its own
+*/
+static int fuse_batch_index(fuse_batch_log_t *log, const imu_cal_t *cal){
+    /*! 1. Initial setup, GYRO_RANGE and ACCEL_RANGE */
+    fuse_batch_setup_t *setup = &log->setups[0];
+    conv_init(&setup->gyro, 0);
+    conv_set_scale(&setup->gyro, GYRO_SENSITIVITY_250DPS * SENSORS_DPS_TO_RADS);
+    conv_init(&setup->accel, 2);
+    conv_set_scale(&setup->accel, ACCEL_MG_LSB_4G * SENSORS_GRAVITY_STANDARD);
+    if(cal->flags & IMU_CAL_GYRO)
+        conv_set_bias(&setup->gyro, cal->gyro_bias);
+    if(cal->flags & IMU_CAL_ACCEL){
+        conv_set_bias(&setup->accel, cal->accel_offset);
+        conv_set_gain(&setup->accel, cal->accel_gain);
+    }
+    log->setup_count = 1;
+
+    fuse_batch_sample_t pending = {0};
+    uint8_t open = 0;
+    uint64_t clock = 0;
+    size_t pos = I2C_REC_FILE_HEADER;
+    i2c_rec_record_t rec;
+    size_t n;
+    while((n = i2c_rec_parse(&log->map[pos], log->size - pos, &clock, &rec)) > 0){
+        size_t data = pos + I2C_REC_HEADER;
+        pos += n;
+        log->records++;
+        if(rec.type == I2C_REC_TIME)
+            continue;
+        uint8_t ok = rec.result == I2C_SUCCESS;
+
+        /*! 2. Range writes */
+        if(rec.type == I2C_REC_WRITE && rec.size == 2 && ok &&
+           ((rec.addr == FXAS21002C_ADDRESS && rec.data[0] == GYRO_REGISTER_CTRL_REG0) ||
+            (rec.addr == FXOS8700_ADDRESS && rec.data[0] == FXOS8700_REGISTER_XYZ_DATA_CFG))){
+            static const float gyro_lsb[4] = {GYRO_SENSITIVITY_2000DPS, GYRO_SENSITIVITY_1000DPS,
+                                              GYRO_SENSITIVITY_500DPS, GYRO_SENSITIVITY_250DPS};
+            static const float accel_lsb[4] = {ACCEL_MG_LSB_2G, ACCEL_MG_LSB_4G, ACCEL_MG_LSB_8G, ACCEL_MG_LSB_8G};
+            if(log->setup_count == FUSE_BATCH_MAX_SETUPS){
+                fprintf(stderr, "more than %d range changes in the log\n", FUSE_BATCH_MAX_SETUPS);
+                return 1;
+            }
+            fuse_batch_setup_t *next = &log->setups[log->setup_count];
+            *next = log->setups[log->setup_count - 1];
+            if(rec.addr == FXAS21002C_ADDRESS)
+                conv_set_scale(&next->gyro, gyro_lsb[rec.data[1] & GYRO_CTRL_REG0_FS] * SENSORS_DPS_TO_RADS);
+            else
+                conv_set_scale(&next->accel, accel_lsb[rec.data[1] & FXOS8700_XYZ_DATA_CFG_FS] * SENSORS_GRAVITY_STANDARD);
+            log->setup_count++;
+            continue;
+        }
+
+        /*! 3. Sample reads */
+        uint8_t gyro = rec.type == I2C_REC_READ && rec.addr == FXAS21002C_ADDRESS &&
+                       (rec.reg & 0x7F) == GYRO_REGISTER_STATUS && rec.size == 7;
+        uint8_t fxos = rec.type == I2C_REC_READ && rec.addr == FXOS8700_ADDRESS &&
+                       rec.reg == FXOS8700_REGISTER_STATUS && (rec.size == 13 || rec.size == FXOS_ACCEL_READ_SIZE);
+        if(open && (!fxos || pending.fxos)){
+            if(fuse_batch_push(log, &pending) != 0)
+                return 1;
+            open = 0;
+        }
+        if(!gyro && !fxos){
+            log->other++;
+            continue;
+        }
+        if(!open){
+            memset(&pending, 0, sizeof(pending));
+            pending.t_us = rec.t_us;
+            pending.setup = log->setup_count - 1;
+            open = 1;
+        }
+        if(gyro){
+            pending.gyro = data + 1;
+            pending.parts |= ok ? FUSE_BATCH_GYRO : 0;
+        } else {
+            pending.fxos = data + 1;
+            log->hybrid |= rec.size == 13;
+            pending.parts |= ok ? (FUSE_BATCH_ACCEL | (rec.size == 13 ? FUSE_BATCH_MAGN : 0)) : 0;
+        }
+    }
+    if(open && fuse_batch_push(log, &pending) != 0)
+        return 1;
+    return 0;
+}
+
+static int fuse_batch_push(fuse_batch_log_t *log, const fuse_batch_sample_t *sample){
+    if(log->count == log->capacity){
+        size_t capacity = log->capacity ? 2 * log->capacity : 4096;
+        fuse_batch_sample_t *samples = (fuse_batch_sample_t*)realloc(log->samples, capacity * sizeof(fuse_batch_sample_t));
+        if(samples == NULL){
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        log->samples = samples;
+        log->capacity = capacity;
+    }
+    log->samples[log->count++] = *sample;
+    if((sample->parts & (FUSE_BATCH_GYRO | FUSE_BATCH_ACCEL)) == (FUSE_BATCH_GYRO | FUSE_BATCH_ACCEL))
+        log->fusable++;
+    return 0;
+}
+
+static void fuse_batch_worker(void *arg){
+    fuse_batch_worker_t *worker = (fuse_batch_worker_t*)arg;
+    uint64_t start_ns = host_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    uint32_t j;
+    while((j = __atomic_fetch_add(&batch_next_job, 1, __ATOMIC_RELAXED)) < batch_job_count){
+        fuse_batch_run(worker, &batch_jobs[j]);
+        worker->jobs++;
+    }
+    worker->cpu_ns = host_clock_ns(CLOCK_THREAD_CPUTIME_ID) - start_ns;
+}
+
+/*!
+* Fuse a job's samples a block at a time, with the firmware's rule: an update for
+* each sample with a gyroscope and an accelerometer reading, the magnetometer when the
+* FXOS8700 read was a hybrid one
+*/
+static void fuse_batch_run(fuse_batch_worker_t *worker, fuse_batch_job_t *job){
+    const fuse_batch_sample_t *samples = batch_log.samples;
+    filter_t filter;
+    filter_init(&filter, batch_mode, batch_rate);
+    if(!isnan(job->gain))
+        filter_set_gain(&filter, job->gain);
+
+    for(size_t first = job->warm; first < job->end; first += FUSE_BATCH_BLOCK){
+        size_t n = job->end - first < FUSE_BATCH_BLOCK ? job->end - first : FUSE_BATCH_BLOCK;
+        fuse_batch_convert(worker, first, n, 0);
+        fuse_batch_convert(worker, first, n, 1);
+        for(size_t k = 0; k < n; k++){
+            const fuse_batch_sample_t *s = &samples[first + k];
+            uint8_t fused = (s->parts & (FUSE_BATCH_GYRO | FUSE_BATCH_ACCEL)) == (FUSE_BATCH_GYRO | FUSE_BATCH_ACCEL);
+            raw_float_data_t accel = {worker->accel[0][k], worker->accel[1][k], worker->accel[2][k]};
+            if(fused){
+                gyro_float_data_t gyro = {worker->gyro[0][k], worker->gyro[1][k], worker->gyro[2][k]};
+                raw_float_data_t magn;
+                if(s->parts & FUSE_BATCH_MAGN){
+                    const uint8_t *m = &batch_log.map[s->fxos + 6];
+                    magn.x = (int16_t)((m[0] << 8) | m[1]);
+                    magn.y = (int16_t)((m[2] << 8) | m[3]);
+                    magn.z = (int16_t)((m[4] << 8) | m[5]);
+                    magn.x *= MAG_UT_LSB;
+                    magn.y *= MAG_UT_LSB;
+                    magn.z *= MAG_UT_LSB;
+                }
+                filter_update(&filter, &gyro, &accel, (s->parts & FUSE_BATCH_MAGN) ? &magn : NULL);
+            }
+            if(first + k < job->begin)
+                continue;
+
+            float q[4];
+            filter_quaternion(&filter, q);
+            if(job->q)
+                memcpy(&job->q[4 * (first + k - job->begin)], q, sizeof(q));
+            float norm = sqrtf(accel.x * accel.x + accel.y * accel.y + accel.z * accel.z);
+            if(fused && norm > 0.0F){
+                /* Gravity as the orientation has it, the third row of R(q) */
+                float vx = 2.0F * (q[1] * q[3] - q[0] * q[2]);
+                float vy = 2.0F * (q[0] * q[1] + q[2] * q[3]);
+                float vz = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+                float c = (vx * accel.x + vy * accel.y + vz * accel.z) / norm;
+                float angle = acosf(c > 1.0F ? 1.0F : (c < -1.0F ? -1.0F : c));
+                job->tilt_sq += (double)angle * angle;
+                job->tilt_count++;
+            }
+        }
+    }
+    worker->samples += job->end - job->warm;
+}
+
+/*!
+* Convert one sensor of n samples from the mapping: runs of samples whose reads sit
+* the same stride apart under the same setup go to the kernels in one call
+*/
+static void fuse_batch_convert(fuse_batch_worker_t *worker, size_t first, size_t n, uint8_t accel){
+    const fuse_batch_sample_t *samples = &batch_log.samples[first];
+    size_t i = 0;
+    while(i < n){
+        size_t at = accel ? samples[i].fxos : samples[i].gyro;
+        if(at == 0){
+            i++;
+            continue;
+        }
+        size_t run = 1;
+        size_t stride = 0;
+        size_t last = at;
+        while(i + run < n){
+            size_t next = accel ? samples[i + run].fxos : samples[i + run].gyro;
+            if(next == 0 || samples[i + run].setup != samples[i].setup || (run > 1 && next - last != stride))
+                break;
+            stride = next - last;
+            last = next;
+            run++;
+        }
+
+        const fuse_batch_setup_t *setup = &batch_log.setups[samples[i].setup];
+        const conv_params_t *p = accel ? &setup->accel : &setup->gyro;
+        float (*out)[FUSE_BATCH_BLOCK] = accel ? worker->accel : worker->gyro;
+#if OTIS_FIXED_POINT
+        /* As the fixed point drivers: Q16, then float */
+        q16_t (*out_q)[FUSE_BATCH_BLOCK] = accel ? worker->accel_q : worker->gyro_q;
+        q16_t *const dst_q[3] = {&out_q[0][i], &out_q[1][i], &out_q[2][i]};
+        conv_fixed(p, &batch_log.map[at], stride, run, NULL, dst_q);
+        for(size_t k = i; k < i + run; k++){
+            out[0][k] = q16_to_float(out_q[0][k]);
+            out[1][k] = q16_to_float(out_q[1][k]);
+            out[2][k] = q16_to_float(out_q[2][k]);
+        }
+#else
+        float *const dst[3] = {&out[0][i], &out[1][i], &out[2][i]};
+        conv_float(p, &batch_log.map[at], stride, run, NULL, dst);
+#endif
+        i += run;
+    }
+}
+
+/*!
+* Replay the first segment's samples through the drivers and the filter, as
+* otis_replay_bench does, and compare with the job's orientations. Only samples with
+* both reads are a release of the sampling loop; the others did not move the filter.
+*/
+static int fuse_batch_verify(const fuse_batch_job_t *job, const imu_cal_t *cal, size_t *compared, uint64_t *elapsed_ns){
+    static imu_dev_t gyro_dev;
+    static imu_dev_t fxos_dev;
+    filter_t filter;
+    if(i2c_replay_init(batch_log.map, batch_log.size) != I2C_REPLAY_SUCCESS)
+        return 1;
+    i2c_utils_set_backend(&i2c_replay_backend);
+    if(IMU_GYRO_OPEN(&gyro_dev) != IMU_DEV_SUCCESS){
+        fprintf(stderr, "driver replay: gyroscope init failed\n");
+        i2c_replay_close();
+        return 1;
+    }
+    if(IMU_ACCEL_OPEN(&fxos_dev) != IMU_DEV_SUCCESS){
+        fprintf(stderr, "driver replay: FXOS8700 init failed\n");
+        IMU_GYRO_CALL(destroy)(&gyro_dev);
+        i2c_replay_close();
+        return 1;
+    }
+    imu_dev_config_t config = fxos_dev.config;
+    config.sensors = IMU_DEV_ACCEL | (batch_log.hybrid ? IMU_DEV_MAGN : 0);
+    int ret = IMU_ACCEL_CALL(configure)(&fxos_dev, &config) == IMU_DEV_SUCCESS ? 0 : 1;
+    IMU_GYRO_CALL(calibrate)(&gyro_dev, cal);
+    IMU_ACCEL_CALL(calibrate)(&fxos_dev, cal);
+    filter_init(&filter, batch_mode, batch_rate);
+    if(!isnan(job->gain))
+        filter_set_gain(&filter, job->gain);
+
+    size_t first = SIZE_MAX;
+    uint64_t start_ns = host_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    for(size_t i = 0; ret == 0 && i < job->end; i++){
+        /* A read on its own, e.g. cut by the ring, is no sampling release */
+        if(batch_log.samples[i].gyro == 0 || batch_log.samples[i].fxos == 0)
+            continue;
+        imu_sample_t sample;
+        imu_sample_t reading;
+        size_t count;
+        memset(&sample, 0, sizeof(imu_sample_t));
+        if(IMU_GYRO_CALL(read_batch)(&gyro_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+            imu_dev_merge(&sample, &reading);
+        if(IMU_ACCEL_CALL(read_batch)(&fxos_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+            imu_dev_merge(&sample, &reading);
+        if((sample.status & (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID)) ==
+           (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID)){
+            gyro_float_data_t gyro = sample.gyro;
+            raw_float_data_t accel = sample.accel;
+            raw_float_data_t magn = sample.magn;
+            filter_update(&filter, &gyro, &accel, (sample.status & IMU_SAMPLE_MAGN_VALID) ? &magn : NULL);
+        }
+        float q[4];
+        filter_quaternion(&filter, q);
+        (*compared)++;
+        if(first == SIZE_MAX && memcmp(q, &job->q[4 * i], sizeof(q)) != 0)
+            first = i;
+    }
+    *elapsed_ns = host_clock_ns(CLOCK_THREAD_CPUTIME_ID) - start_ns;
+
+    IMU_GYRO_CALL(destroy)(&gyro_dev);
+    IMU_ACCEL_CALL(destroy)(&fxos_dev);
+    i2c_replay_close();
+    if(ret != 0){
+        fprintf(stderr, "driver replay: FXOS8700 configure failed\n");
+        return 1;
+    }
+    if(first != SIZE_MAX){
+        fprintf(stderr, "first segment differs from the driver replay from sample %zu on\n", first);
+        return 2;
+    }
+    return 0;
+}
+
+static int fuse_batch_write(const char *path, const float *const *q, uint32_t gains){
+    FILE *f = fopen(path, "w");
+    if(f == NULL){
+        perror(path);
+        return 1;
+    }
+    fprintf(f, "t_us");
+    for(uint32_t g = 0; g < gains; g++)
+        fprintf(f, ",w%u,x%u,y%u,z%u", g, g, g, g);
+    fprintf(f, "\n");
+    for(size_t i = 0; i < batch_log.count; i++){
+        fprintf(f, "%llu", (unsigned long long)batch_log.samples[i].t_us);
+        for(uint32_t g = 0; g < gains; g++)
+            fprintf(f, ",%.7g,%.7g,%.7g,%.7g", q[g][4 * i], q[g][4 * i + 1], q[g][4 * i + 2], q[g][4 * i + 3]);
+        fprintf(f, "\n");
+    }
+    return fclose(f) == 0 ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+/*!
+* @file otis_fxos_multi.c
+* @author Ethan Lew
+* @brief Host exercise of several FXOS8700 devices opened, sampled and closed concurrently
+*
+* Two FXOS8700 models sit on the simulated bus, at 0x1F and 0x1E. First the two views
+* of one device are polled in turn, back to back and so mostly faster than the output
+* rate: every magnetometer update must share the read the accelerometer update made,
+* stale or not, for one transaction per pair. Then one sampler thread per device
+* repeatedly
+*   1. opens an accelerometer and a magnetometer view of its device
+*   2. samples through both
+*   3. closes the accelerometer view and keeps sampling through the magnetometer view,
+*      which must still own the device
+*   4. closes the magnetometer view
+* while churn threads open and close views of both devices in random order, so the
+* devices are created, shared and destroyed under contention. At the end every device
+* must be closed.
+*
+*     otis_fxos_multi [-t churn threads] [-r rounds] [-s samples per round]
+*
+* Exits non-zero on any failure. Build with -fsanitize=thread or run under helgrind
+* to check the locking as well.
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "fxos8700.h"
+#include "time_utils.h"
+#include "sim/imu_sim.h"
+
+#define MULTI_DEFAULT_CHURN 4
+#define MULTI_DEFAULT_ROUNDS 50
+#define MULTI_DEFAULT_SAMPLES 20
+#define MULTI_MAX_CHURN 16
+/* Samples further than this from 1 g (m/s^2) are counted as implausible */
+#define MULTI_ACCEL_TOLERANCE (4.0F)
+/* accel_update/magn_update pairs polled back to back */
+#define MULTI_SHARE_PAIRS 200
+
+static const uint8_t multi_addr[2] = {IMU_SIM_FXOS_ADDR, IMU_SIM_FXOS_AUX_ADDR};
+
+typedef struct multi_thread_s {
+    pthread_t thread;
+    uint8_t addr;          /**< Device of a sampler thread */
+    uint32_t seed;
+    uint32_t rounds;
+    uint32_t samples;
+    uint32_t reads;        /**< Samples read */
+    uint32_t implausible;  /**< Samples off 1 g */
+    uint32_t failures;     /**< Driver calls that failed */
+} multi_thread_t;
+
+static int multi_running = 1;
+
+static int multi_share(imu_sim_t *sim);
+
+static void *multi_sampler(void *arg);
+
+static void *multi_churn(void *arg);
+
+static void multi_check(multi_thread_t *t, accel_err_t ret, const accel_t *accel);
+
+int main(int argc, char **argv){
+    uint32_t churn = MULTI_DEFAULT_CHURN;
+    uint32_t rounds = MULTI_DEFAULT_ROUNDS;
+    uint32_t samples = MULTI_DEFAULT_SAMPLES;
+    int opt;
+
+    while((opt = getopt(argc, argv, "t:r:s:")) != -1){
+        switch(opt){
+            case 't': churn = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'r': rounds = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 's': samples = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:
+            fprintf(stderr, "usage: %s [-t churn threads] [-r rounds] [-s samples]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(churn > MULTI_MAX_CHURN)
+        churn = MULTI_MAX_CHURN;
+
+    /* 1. Both models on the monotonic clock, so concurrent threads see one time line */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    motion_sim_init(&motion, &config);
+    imu_sim_init(&sim, &motion, get_time_micros);
+    imu_sim_attach(&sim, I2C_MASTER_FAST_FREQ_HZ);
+
+    /* 2. Views sharing reads */
+    int failed = multi_share(&sim);
+
+    /* 3. One sampler per device, plus the churn */
+    static multi_thread_t samplers[2], churners[MULTI_MAX_CHURN];
+    for(int i = 0; i < 2; i++){
+        samplers[i] = (multi_thread_t){0};
+        samplers[i].addr = multi_addr[i];
+        samplers[i].seed = 1 + i;
+        samplers[i].rounds = rounds;
+        samplers[i].samples = samples;
+        pthread_create(&samplers[i].thread, NULL, multi_sampler, &samplers[i]);
+    }
+    for(uint32_t i = 0; i < churn; i++){
+        churners[i] = (multi_thread_t){0};
+        churners[i].seed = 100 + i;
+        pthread_create(&churners[i].thread, NULL, multi_churn, &churners[i]);
+    }
+    for(int i = 0; i < 2; i++)
+        pthread_join(samplers[i].thread, NULL);
+    __atomic_store_n(&multi_running, 0, __ATOMIC_RELEASE);
+    for(uint32_t i = 0; i < churn; i++)
+        pthread_join(churners[i].thread, NULL);
+
+    /* 4. Report */
+    for(int i = 0; i < 2; i++){
+        multi_thread_t *t = &samplers[i];
+        printf("device 0x%02x: %u samples, %u implausible, %u failures\n", t->addr, t->reads,
+               t->implausible, t->failures);
+        failed |= t->failures != 0 || t->reads == 0 || t->implausible * 100 > t->reads;
+    }
+    uint32_t opens = 0, churn_failures = 0;
+    for(uint32_t i = 0; i < churn; i++){
+        opens += churners[i].reads;
+        churn_failures += churners[i].failures;
+    }
+    printf("churn: %u threads, %u views opened, %u failures\n", churn, opens, churn_failures);
+    printf("models: 0x%02x %u samples, 0x%02x %u samples, %u illegal writes, %u nacks\n",
+           IMU_SIM_FXOS_ADDR, sim.fxos.samples, IMU_SIM_FXOS_AUX_ADDR, sim.fxos_aux.samples,
+           sim.fxos.illegal_writes + sim.fxos_aux.illegal_writes, sim.nacks);
+    uint8_t left = fxos8700_open_devices();
+    printf("devices still open: %u\n", left);
+    failed |= churn_failures != 0 || left != 0 || sim.nacks != 0;
+
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed ? 2 : 0;
+}
+
+/*!
+* Poll the accelerometer and magnetometer views of the default device in turn; each
+* pair must cost one read on the bus, shared whether it brought a new sample or not
+*/
+static int multi_share(imu_sim_t *sim){
+    accel_t *accel = NULL;
+    magn_t *magn = NULL;
+    if(accel_init(&accel) != ACCEL_SUCCESS || magn_init(&magn) != MAGN_SUCCESS){
+        printf("shared views: open FAILED\n");
+        accel_destroy(&accel);
+        magn_destroy(&magn);
+        return 1;
+    }
+    const fxos8700_stats_t *fs = &accel->fxos->stats;
+    uint32_t transactions = sim->fxos.transactions;
+    uint32_t stale = fs->stale;
+    uint32_t coalesced = fs->coalesced;
+    uint32_t failures = 0;
+    for(uint32_t i = 0; i < MULTI_SHARE_PAIRS; i++){
+        failures += accel_update(accel) != ACCEL_SUCCESS;
+        failures += magn_update(magn) != MAGN_SUCCESS;
+        failures += magn->seq != accel->seq;
+    }
+    transactions = sim->fxos.transactions - transactions;
+    stale = fs->stale - stale;
+    coalesced = fs->coalesced - coalesced;
+    int bad = failures != 0 || transactions != MULTI_SHARE_PAIRS || coalesced != MULTI_SHARE_PAIRS || stale == 0;
+    printf("shared views: %u pairs, %u transactions, %u stale reads, %u coalesced, %u failures%s\n",
+           MULTI_SHARE_PAIRS, transactions, stale, coalesced, failures, bad ? " FAILED" : "");
+    accel_destroy(&accel);
+    magn_destroy(&magn);
+    return bad;
+}
+
+static void *multi_sampler(void *arg){
+    multi_thread_t *t = (multi_thread_t*)arg;
+
+    for(uint32_t r = 0; r < t->rounds; r++){
+        accel_t *accel = NULL;
+        magn_t *magn = NULL;
+        /* Either view may create the device */
+        if(rand_r(&t->seed) & 1){
+            t->failures += accel_init_at(&accel, I2C_MASTER_PORT, t->addr) != ACCEL_SUCCESS;
+            t->failures += magn_init_at(&magn, I2C_MASTER_PORT, t->addr) != MAGN_SUCCESS;
+        } else {
+            t->failures += magn_init_at(&magn, I2C_MASTER_PORT, t->addr) != MAGN_SUCCESS;
+            t->failures += accel_init_at(&accel, I2C_MASTER_PORT, t->addr) != ACCEL_SUCCESS;
+        }
+        if(!accel || !magn){
+            accel_destroy(&accel);
+            magn_destroy(&magn);
+            continue;
+        }
+        if(accel->fxos != magn->fxos || accel->fxos->i2c.addr != t->addr)
+            t->failures++;
+
+        for(uint32_t i = 0; i < t->samples; i++){
+            multi_check(t, accel_magn_update(accel, magn), accel);
+            usleep(1000);
+        }
+
+        /* The magnetometer view keeps the device alive on its own */
+        accel_destroy(&accel);
+        for(uint32_t i = 0; i < t->samples; i++){
+            accel_err_t ret = accel_magn_update(NULL, magn);
+            t->failures += ret != ACCEL_SUCCESS;
+            if(ret == ACCEL_SUCCESS && magn->raw.x == 0 && magn->raw.y == 0 && magn->raw.z == 0)
+                t->implausible++;
+            t->reads++;
+            usleep(1000);
+        }
+        magn_destroy(&magn);
+    }
+    return NULL;
+}
+
+static void *multi_churn(void *arg){
+    multi_thread_t *t = (multi_thread_t*)arg;
+
+    while(__atomic_load_n(&multi_running, __ATOMIC_ACQUIRE)){
+        uint8_t addr = multi_addr[rand_r(&t->seed) & 1];
+        accel_t *accel = NULL;
+        magn_t *magn = NULL;
+        if(rand_r(&t->seed) & 1){
+            t->failures += accel_init_at(&accel, I2C_MASTER_PORT, addr) != ACCEL_SUCCESS;
+        } else {
+            t->failures += magn_init_at(&magn, I2C_MASTER_PORT, addr) != MAGN_SUCCESS;
+        }
+        t->reads++;
+        usleep(rand_r(&t->seed) % 2000);
+        accel_destroy(&accel);
+        magn_destroy(&magn);
+        usleep(rand_r(&t->seed) % 500);
+    }
+    return NULL;
+}
+
+static void multi_check(multi_thread_t *t, accel_err_t ret, const accel_t *accel){
+    t->reads++;
+    if(ret != ACCEL_SUCCESS){
+        t->failures++;
+        return;
+    }
+    float g = sqrtf(accel->converted.x * accel->converted.x + accel->converted.y * accel->converted.y +
+                    accel->converted.z * accel->converted.z);
+    if(fabsf(g - SENSORS_GRAVITY_STANDARD) > MULTI_ACCEL_TOLERANCE)
+        t->implausible++;
+}
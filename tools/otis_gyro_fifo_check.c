@@ -0,0 +1,308 @@
+/*!
+* @file otis_gyro_fifo_check.c
+* @author Ethan Lew
+* @brief Host check of the FXAS21002C FIFO drain on the simulated gyroscope
+*
+* Runs gyro_read_batch against the FIFO model in virtual time, sleeping as long as
+* the virtual time advanced so that the read time stamps move with it:
+*   - fewer samples queued than the watermark, and more
+*   - a drain capped by max, then the rest
+*   - an overflow and the drain after it
+*   - an overflow with max below the queued count, and the held frames after it
+*   - a corrupt F_STATUS count above the FIFO size, with max larger than the FIFO
+* For each drain it checks that the queued frames come back oldest first and bit for
+* bit as the model produced them, in one burst read after F_STATUS (none for held
+* frames), and that the stamps are one output period apart and continue across
+* drains until an overflow restarts them from the read time.
+* Then it runs a gyroscope clock CHECK_FAST_PPM fast, with each read early by up to
+* CHECK_FAST_JITTER output periods, and checks that the stamps only increase.
+*
+*     otis_gyro_fifo_check [-v] [-n drains]
+*
+* Exits non-zero on a failed check.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fxas21002c.h"
+#include "time_utils.h"
+#include "sim/imu_sim.h"
+#include "sim/i2c_fake_bus.h"
+
+#define CHECK_WATERMARK 8
+/* Room for more than the FIFO, as a direct caller may pass */
+#define CHECK_OUT_SIZE (2 * GYRO_FIFO_SIZE)
+/* Gyroscope clock error of the fast oscillator run */
+#define CHECK_FAST_PPM 10000
+#define CHECK_FAST_DRAINS 200
+/* Largest read jitter of that run, in output periods */
+#define CHECK_FAST_JITTER 1.5
+
+/*!
+* One drain: frames to produce before it, the max passed in and what is expected
+*/
+typedef struct check_step_s {
+    const char *what;
+    uint32_t produce;      /**< Output periods to advance */
+    size_t max;
+    size_t count;          /**< Samples expected back */
+    gyro_err_t ret;
+    uint8_t continues;     /**< Stamps follow on from the previous drain */
+    uint8_t held;          /**< Served from the frames held at the last overflow */
+} check_step_t;
+
+static const check_step_t check_steps[] = {
+    {"first drain",          5,  CHECK_OUT_SIZE, 5,  GYRO_SUCCESS,  0, 0},
+    {"below watermark",      3,  CHECK_OUT_SIZE, 3,  GYRO_SUCCESS,  1, 0},
+    {"above watermark",      20, CHECK_OUT_SIZE, 20, GYRO_SUCCESS,  1, 0},
+    {"capped by max",        12, 4,              4,  GYRO_SUCCESS,  1, 0},
+    {"rest of the FIFO",     0,  CHECK_OUT_SIZE, 8,  GYRO_SUCCESS,  1, 0},
+    {"full FIFO",            32, CHECK_OUT_SIZE, 32, GYRO_SUCCESS,  1, 0},
+    {"overflow",             45, CHECK_OUT_SIZE, 32, GYRO_FIFO_OVF, 0, 0},
+    {"after overflow",       6,  CHECK_OUT_SIZE, 6,  GYRO_SUCCESS,  0, 0},
+    {"continues again",      9,  CHECK_OUT_SIZE, 9,  GYRO_SUCCESS,  1, 0},
+    {"overflow, capped",     45, 10,             10, GYRO_FIFO_OVF, 0, 0},
+    {"held frames",          0,  16,             16, GYRO_SUCCESS,  1, 1},
+    {"rest of held",         0,  CHECK_OUT_SIZE, 6,  GYRO_SUCCESS,  1, 1},
+    {"after held",           5,  CHECK_OUT_SIZE, 5,  GYRO_SUCCESS,  0, 0},
+};
+
+static const i2c_backend_t *check_inner;
+static i2c_backend_t check_backend;
+static gyro_t *check_gyro;
+static uint8_t check_corrupt;
+
+static i2c_err_t check_link_exec(i2c_link_t link);
+
+static int check_step(imu_sim_t *sim, gyro_t *gyro, const check_step_t *step, int verbose);
+
+static int check_fast(imu_sim_t *sim, gyro_t *gyro, uint32_t drains);
+
+int main(int argc, char **argv){
+    int verbose = 0;
+    uint32_t drains = CHECK_FAST_DRAINS;
+    int opt;
+    while((opt = getopt(argc, argv, "vn:")) != -1){
+        switch(opt){
+            case 'v': verbose = 1; break;
+            case 'n': drains = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:
+            fprintf(stderr, "usage: %s [-v] [-n drains]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* 1. Virtual time, with the F_STATUS read open to corruption */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    config.amp[0] = 3.0F;
+    config.freq[0] = 20.0F;
+    motion_sim_init(&motion, &config);
+    imu_sim_init(&sim, &motion, NULL);
+    imu_sim_attach(&sim, 0);
+    check_inner = i2c_utils_get_backend();
+    check_backend = *check_inner;
+    check_backend.link_exec = check_link_exec;
+    i2c_utils_set_backend(&check_backend);
+
+    gyro_t *gyro = NULL;
+    const gyro_config_t rate = {GYRO_ODR_800HZ, GYRO_RANGE_250DPS};
+    if(gyro_init(&gyro) != GYRO_SUCCESS || gyro_configure(gyro, &rate) != GYRO_SUCCESS ||
+       gyro_fifo_enable(gyro, CHECK_WATERMARK) != GYRO_SUCCESS){
+        fprintf(stderr, "gyro init failed\n");
+        return 1;
+    }
+    check_gyro = gyro;
+    int failures = 0;
+
+    /* Start from an empty FIFO, whatever was produced around the enable */
+    static gyro_float_data_t out[CHECK_OUT_SIZE];
+    imu_sim_advance(&sim, sim.now_us + 1);
+    gyro_read_batch(gyro, out, CHECK_OUT_SIZE);
+    gyro->fifo.last_stamp = 0;
+    gyro->fifo.follow = 0;
+
+    /* 2. The scripted drains */
+    for(size_t s = 0; s < sizeof(check_steps) / sizeof(check_steps[0]); s++)
+        failures += check_step(&sim, gyro, &check_steps[s], verbose);
+    if(gyro->fifo.overflows != 2 || sim.fxas.dropped == 0){
+        printf("overflows: driver %u, model dropped %u\n", gyro->fifo.overflows, sim.fxas.dropped);
+        failures++;
+    }
+
+    /* 3. A corrupt count is clamped to the FIFO size */
+    imu_sim_advance(&sim, sim.now_us + 2 * gyro->period_us);
+    check_corrupt = 1;
+    gyro_err_t ret = gyro_read_batch(gyro, out, CHECK_OUT_SIZE);
+    check_corrupt = 0;
+    if(ret != GYRO_SUCCESS || gyro->fifo.count != GYRO_FIFO_SIZE){
+        printf("corrupt F_STATUS: returned %d, %u samples\n", ret, (unsigned)gyro->fifo.count);
+        failures++;
+    } else if(verbose){
+        printf("%-20s %2u samples  ok\n", "corrupt F_STATUS", (unsigned)gyro->fifo.count);
+    }
+
+    /* 4. A fast gyroscope clock and early reads */
+    failures += check_fast(&sim, gyro, drains);
+
+    printf("%u drains, %u overflows, %s\n", (unsigned)(sizeof(check_steps) / sizeof(check_steps[0])),
+           gyro->fifo.overflows, failures ? "FAILED" : "ok");
+
+    gyro_destroy(&gyro);
+    i2c_utils_set_backend(check_inner);
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    return failures ? 2 : 0;
+}
+
+/*!
+* Forward to the simulated bus; when asked, report every count field bit set in
+* F_STATUS, 63 queued samples
+*/
+static i2c_err_t check_link_exec(i2c_link_t link){
+    i2c_err_t ret = check_inner->link_exec(link);
+    if(check_corrupt && check_gyro && link == check_gyro->fifo.status_link)
+        check_gyro->fifo.f_status |= GYRO_F_STATUS_CNT;
+    return ret;
+}
+
+/*!
+* One drain
+*   1. Produce the frames, with the same real time passing as virtual time
+*   2. Snapshot the model's queue: the frames expected back, oldest first
+*   3. Drain, then compare count, return, transactions, counts and stamps
+*/
+static int check_step(imu_sim_t *sim, gyro_t *gyro, const check_step_t *step, int verbose){
+    static gyro_float_data_t out[CHECK_OUT_SIZE];
+    static int16_t expect[GYRO_FIFO_SIZE][3];
+    static size_t expect_at;
+    static uint64_t last;     /* Newest stamp handed out */
+    int failures = 0;
+    uint32_t period = gyro->period_us;
+
+    if(step->produce){
+        imu_sim_advance(sim, sim->now_us + (uint64_t)step->produce * period);
+        usleep(step->produce * period);
+    }
+
+    /* Held frames were snapshot with the overflow drain */
+    fxas_sim_t *fxas = &sim->fxas;
+    size_t queued = fxas->fifo_count;
+    if(!step->held){
+        for(size_t i = 0; i < queued; i++)
+            memcpy(expect[i], fxas->fifo[(fxas->fifo_head + i) % FXAS_SIM_FIFO_SIZE], sizeof(expect[i]));
+        expect_at = 0;
+    }
+
+    i2c_fake_bus_stats_t before, after;
+    i2c_fake_bus_stats(&before);
+    uint64_t t0 = get_time_micros();
+    gyro_err_t ret = gyro_read_batch(gyro, out, step->max);
+    uint64_t t1 = get_time_micros();
+    i2c_fake_bus_stats(&after);
+    size_t n = gyro->fifo.count;
+
+    if(ret != step->ret || n != step->count){
+        printf("%s: returned %d with %u samples, expected %d with %u\n", step->what, ret, (unsigned)n, step->ret,
+               (unsigned)step->count);
+        return 1;
+    }
+    /* F_STATUS and one burst, none for held frames; an overflow also re-arms the FIFO */
+    uint32_t transactions = after.transactions - before.transactions;
+    if(ret == GYRO_SUCCESS && transactions != (step->held ? 0U : 2U)){
+        printf("%s: %u transactions\n", step->what, transactions);
+        failures++;
+    }
+    for(size_t i = 0; i < n; i++){
+        for(int a = 0; a < 3; a++){
+            if(gyro->fifo.soa_raw[a][i] != expect[expect_at + i][a]){
+                printf("%s: sample %u axis %d read %d, queued %d\n", step->what, (unsigned)i, a,
+                       gyro->fifo.soa_raw[a][i], expect[expect_at + i][a]);
+                failures++;
+                i = n;
+                break;
+            }
+        }
+    }
+    if(n > 0 && (gyro->converted.x != out[n - 1].x || gyro->raw.x != expect[expect_at + n - 1][0])){
+        printf("%s: newest sample not kept\n", step->what);
+        failures++;
+    }
+
+    for(size_t i = 1; i < n; i++){
+        if(gyro->fifo.stamp[i] - gyro->fifo.stamp[i - 1] != period){
+            printf("%s: stamps %u and %u are %llu us apart\n", step->what, (unsigned)i - 1, (unsigned)i,
+                   (unsigned long long)(gyro->fifo.stamp[i] - gyro->fifo.stamp[i - 1]));
+            failures++;
+            break;
+        }
+    }
+    if(step->continues){
+        if(gyro->fifo.stamp[0] != last + period){
+            printf("%s: first stamp %llu, previous drain ended at %llu\n", step->what,
+                   (unsigned long long)gyro->fifo.stamp[0], (unsigned long long)last);
+            failures++;
+        }
+    } else {
+        /* Restarted from the read time, less the samples left queued */
+        uint64_t newest = gyro->fifo.stamp[n - 1] + (uint64_t)(queued - n) * period;
+        if(newest < t0 || newest > t1){
+            printf("%s: newest stamp %llu outside the read %llu..%llu\n", step->what, (unsigned long long)newest,
+                   (unsigned long long)t0, (unsigned long long)t1);
+            failures++;
+        }
+    }
+    /* The newest stamp handed out or held; an overflow drops the sequence, so the next
+       drain read restarts it */
+    if(gyro->fifo.last_stamp != gyro->fifo.stamp[n - 1] + (uint64_t)gyro->fifo.held * period ||
+       (ret == GYRO_FIFO_OVF && gyro->fifo.follow)){
+        printf("%s: last stamp %llu, %s\n", step->what, (unsigned long long)gyro->fifo.last_stamp,
+               gyro->fifo.follow ? "following" : "restarting");
+        failures++;
+    }
+    expect_at += n;
+    last = gyro->fifo.stamp[n - 1];
+
+    if(verbose)
+        printf("%-20s %2u samples  %u transactions  %s\n", step->what, (unsigned)n, transactions,
+               failures ? "FAILED" : "ok");
+    return failures;
+}
+
+/*!
+* Drains of 1 to 4 output periods, the real time between them CHECK_FAST_PPM short
+* of what the frames take and less again by a random jitter of up to
+* CHECK_FAST_JITTER periods, so that reads come close together with frames queued.
+* The read time estimate then falls at or before the previous stamp.
+*/
+static int check_fast(imu_sim_t *sim, gyro_t *gyro, uint32_t drains){
+    static gyro_float_data_t out[CHECK_OUT_SIZE];
+    uint32_t period = gyro->period_us;
+    unsigned int seed = 1;
+    uint64_t last = gyro->fifo.last_stamp;
+    uint32_t samples = 0;
+    uint32_t repeats = 0;
+
+    for(uint32_t d = 0; d < drains; d++){
+        uint32_t produce = 1 + (uint32_t)(rand_r(&seed) % 4);
+        uint64_t real = (uint64_t)produce * period * 1000000ULL / (1000000ULL + CHECK_FAST_PPM);
+        uint64_t early = (uint64_t)(rand_r(&seed) % (uint32_t)(CHECK_FAST_JITTER * period));
+        imu_sim_advance(sim, sim->now_us + (uint64_t)produce * period);
+        usleep((useconds_t)(real > early ? real - early : 0));
+        if(gyro_read_batch(gyro, out, CHECK_OUT_SIZE) != GYRO_SUCCESS)
+            continue;
+        for(size_t i = 0; i < gyro->fifo.count; i++){
+            if(gyro->fifo.stamp[i] <= last)
+                repeats++;
+            last = gyro->fifo.stamp[i];
+        }
+        samples += gyro->fifo.count;
+    }
+    printf("%-20s %u samples in %u drains, %u stamps not after the one before%s\n", "fast oscillator", samples,
+           drains, repeats, repeats ? " FAILED" : "");
+    return repeats != 0;
+}
@@ -0,0 +1,250 @@
+/*!
+* @file otis_host_bench.c
+* @author Ethan Lew
+* @brief Host benchmark of the sensor drivers and fusion on simulated sensors
+*
+* Runs the unmodified FXAS21002C/FXOS8700 drivers against the register models on the
+* simulated I2C bus, then fuses every sample, and reports the cost of each stage.
+* Meant to be run under perf or valgrind (callgrind, cachegrind, massif) as well as
+* on its own:
+*
+*     otis_host_bench [-n samples] [-m filter mode] [-c scl_hz] [-r replay file] [-w] [-p]
+*
+*   -n  number of fused samples (default 20000)
+*   -m  filter mode, see filter_mode_t (default 0, Madgwick)
+*   -c  modelled SCL frequency; 0 runs transactions without bus timing (default 0)
+*   -r  replay a recorded log instead of synthetic motion (see motion_sim.h)
+*   -w  wall clock: the models follow the monotonic clock and the loop is paced at
+*       the gyroscope rate, rather than stepping virtual time as fast as possible
+*   -p  poll the accelerometer and magnetometer views separately (accel_update,
+*       magn_update) instead of the combined accel_magn_update; the views share every
+*       read, new or stale, see the transactions per fused sample
+*
+* The synthetic motion carries sensor bias and a hard iron offset, so the attitude
+* error reported for the 9 DoF modes includes the heading error of an uncalibrated
+* magnetometer. Built with OTIS_PERF=1 the perf.h probes of the loop are printed too.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fxas21002c.h"
+#include "fxos8700.h"
+#include "time_utils.h"
+#include "filter.h"
+#include "perf.h"
+#include "sim/i2c_fake_bus.h"
+#include "sim/imu_sim.h"
+#include "sim/host_clock.h"
+
+#define BENCH_DEFAULT_SAMPLES 20000
+/* Samples skipped before attitude error is accumulated */
+#define BENCH_WARMUP_S (2.0F)
+#define BENCH_HIST_BINS 32
+
+typedef struct bench_stage_s {
+    const char *name;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint32_t hist[BENCH_HIST_BINS];  /**< log2(ns) buckets */
+} bench_stage_t;
+
+static void bench_record(bench_stage_t *stage, uint64_t ns);
+
+static void bench_report(const bench_stage_t *stage, uint32_t n);
+
+static float bench_angle_error(const float *q_est, const float *q_true);
+
+int main(int argc, char **argv){
+    uint32_t samples = BENCH_DEFAULT_SAMPLES;
+    filter_mode_t mode = FILTER_MADGWICK;
+    uint32_t scl_hz = 0;
+    const char *replay = NULL;
+    int wall = 0;
+    int polled = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:m:c:r:wp")) != -1){
+        switch(opt){
+            case 'n': samples = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'm': mode = (filter_mode_t)atoi(optarg); break;
+            case 'c': scl_hz = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'r': replay = optarg; break;
+            case 'w': wall = 1; break;
+            case 'p': polled = 1; break;
+            default:
+            fprintf(stderr, "usage: %s [-n samples] [-m mode] [-c scl_hz] [-r replay] [-w] [-p]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* 1. Motion source and chip models on the fake bus */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    if(replay){
+        motion_sim_err_t err = motion_sim_open(&motion, replay);
+        if(err != MOTION_SIM_SUCCESS){
+            fprintf(stderr, "cannot replay %s (%d)\n", replay, err);
+            return 1;
+        }
+    } else {
+        motion_sim_config_t config;
+        motion_sim_default_config(&config);
+        motion_sim_init(&motion, &config);
+    }
+    imu_sim_init(&sim, &motion, wall ? get_time_micros : NULL);
+    imu_sim_attach(&sim, scl_hz);
+
+    /* 2. Drivers, exactly as on target */
+    gyro_t *gyro = NULL;
+    accel_t *accel = NULL;
+    magn_t *magn = NULL;
+    if(gyro_init(&gyro) != GYRO_SUCCESS || accel_init(&accel) != ACCEL_SUCCESS || magn_init(&magn) != MAGN_SUCCESS){
+        fprintf(stderr, "sensor init failed\n");
+        return 1;
+    }
+
+    uint32_t period_us = gyro->period_us;
+    float freq = 1e6F / (float)period_us;
+    static filter_t filter;
+    if(filter_init(&filter, mode, freq) != FILTER_SUCCESS){
+        fprintf(stderr, "bad filter mode %d\n", mode);
+        return 1;
+    }
+
+    bench_stage_t stages[3] = {
+        {"gyro read", 0, UINT64_MAX, 0, {0}},
+        {"accel/magn read", 0, UINT64_MAX, 0, {0}},
+        {"fusion", 0, UINT64_MAX, 0, {0}},
+    };
+    uint32_t warmup = (uint32_t)(BENCH_WARMUP_S * freq);
+    double err_sq = 0.0;
+    float err_max = 0.0F;
+    uint32_t err_n = 0;
+    uint32_t failures = 0;
+
+    /* 3. Fixed rate loop: one gyroscope period per sample */
+    i2c_fake_bus_stats_t bus_start;
+    i2c_fake_bus_stats(&bus_start);
+    uint32_t fxos_start = sim.fxos.transactions;
+    uint64_t t_us = sim.now_us;
+#if OTIS_PERF
+    perf_reset();
+#endif
+    uint64_t start_ns = host_clock_now_ns();
+    for(uint32_t i = 0; i < samples; i++){
+        t_us += period_us;
+        if(wall){
+            while(get_time_micros() < t_us)
+                ;
+        } else {
+            imu_sim_advance(&sim, t_us);
+        }
+
+        uint64_t t0 = host_clock_now_ns();
+        if(gyro_update(gyro) != GYRO_SUCCESS)
+            failures++;
+        uint64_t t1 = host_clock_now_ns();
+        if(polled){
+            if(accel_update(accel) != ACCEL_SUCCESS)
+                failures++;
+            if(filter_uses_magn(mode) && magn_update(magn) != MAGN_SUCCESS)
+                failures++;
+        } else if(accel_magn_update(accel, magn) != ACCEL_SUCCESS){
+            failures++;
+        }
+        uint64_t t2 = host_clock_now_ns();
+        filter_update(&filter, &gyro->converted, &accel->converted, filter_uses_magn(mode) ? &magn->converted : NULL);
+        uint64_t t3 = host_clock_now_ns();
+
+        bench_record(&stages[0], t1 - t0);
+        bench_record(&stages[1], t2 - t1);
+        bench_record(&stages[2], t3 - t2);
+
+        if(!replay && i >= warmup){
+            float q[4];
+            filter_quaternion(&filter, q);
+            float e = bench_angle_error(q, motion.q);
+            err_sq += (double)e * e;
+            err_n++;
+            if(e > err_max)
+                err_max = e;
+        }
+    }
+    uint64_t elapsed_ns = host_clock_now_ns() - start_ns;
+
+    /* 4. Report */
+    i2c_fake_bus_stats_t bus;
+    i2c_fake_bus_stats(&bus);
+    printf("%u samples at %.1f Hz, filter mode %d, %s time, SCL %u Hz, %s accel/magn reads\n",
+           samples, freq, mode, wall ? "wall" : "virtual", scl_hz, polled ? "polled" : "combined");
+    for(int s = 0; s < 3; s++)
+        bench_report(&stages[s], samples);
+    printf("loop: %.3f s, %.0f samples/s\n", elapsed_ns * 1e-9, samples / (elapsed_ns * 1e-9));
+    printf("bus: %u transactions, %u bytes, %.1f%% modelled occupancy\n", bus.transactions, bus.bytes,
+           wall && elapsed_ns ? 100.0 * bus.busy_ns / elapsed_ns : 100.0 * bus.busy_ns / ((double)samples * period_us * 1e3));
+    printf("bus per fused sample: %.2f transactions, %.2f to the FXOS8700\n",
+           (double)(bus.transactions - bus_start.transactions) / samples,
+           (double)(sim.fxos.transactions - fxos_start) / samples);
+    const fxos8700_stats_t *fs = &accel->fxos->stats;
+    printf("fxos8700 reads: %u, new samples %u, stale %u, overwritten %u, coalesced %u; missed by accel %u, magn %u\n",
+           fs->reads, fs->samples, fs->stale, fs->overwritten, fs->coalesced, accel->missed, magn->missed);
+    printf("gyro model: %u samples, %u dropped, %u illegal writes\n",
+           sim.fxas.samples, sim.fxas.dropped, sim.fxas.illegal_writes);
+    printf("accel/magn model: %u samples, %u overwritten, %u illegal writes\n",
+           sim.fxos.samples, sim.fxos.overwritten, sim.fxos.illegal_writes);
+    printf("driver failures: %u, nacks: %u\n", failures, sim.nacks);
+#if OTIS_PERF
+    static perf_snapshot_t snap;
+    perf_snapshot(&snap);
+    perf_print(&snap);
+#endif
+    if(err_n)
+        printf("attitude error after %.0f s: rms %.2f deg, max %.2f deg\n", BENCH_WARMUP_S,
+               sqrt(err_sq / err_n) * 57.29578, err_max * 57.29578F);
+
+    gyro_destroy(&gyro);
+    accel_destroy(&accel);
+    magn_destroy(&magn);
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    return failures ? 2 : 0;
+}
+
+static void bench_record(bench_stage_t *stage, uint64_t ns){
+    int bin = 0;
+    while(bin < BENCH_HIST_BINS - 1 && (ns >> (bin + 1)) != 0)
+        bin++;
+    stage->hist[bin]++;
+    stage->total_ns += ns;
+    if(ns < stage->min_ns)
+        stage->min_ns = ns;
+    if(ns > stage->max_ns)
+        stage->max_ns = ns;
+}
+
+static void bench_report(const bench_stage_t *stage, uint32_t n){
+    printf("%-16s min %6llu ns  mean %8.1f ns  max %8llu ns\n", stage->name,
+           (unsigned long long)stage->min_ns, (double)stage->total_ns / n, (unsigned long long)stage->max_ns);
+    printf("%-16s", "");
+    for(int b = 0; b < BENCH_HIST_BINS; b++){
+        if(stage->hist[b])
+            printf(" <%lluns:%u", 2ULL << b, stage->hist[b]);
+    }
+    printf("\n");
+}
+
+/*!
+* Rotation angle of q_est^-1 q_true. q_est is normalized first: the fast inverse
+* square root leaves the Madgwick quaternion slightly short of unit length.
+*/
+static float bench_angle_error(const float *q_est, const float *q_true){
+    float n = sqrtf(q_est[0] * q_est[0] + q_est[1] * q_est[1] + q_est[2] * q_est[2] + q_est[3] * q_est[3]);
+    float d = fabsf(q_est[0] * q_true[0] + q_est[1] * q_true[1] + q_est[2] * q_true[2] + q_est[3] * q_true[3]) / n;
+    if(d > 1.0F)
+        d = 1.0F;
+    return 2.0F * acosf(d);
+}
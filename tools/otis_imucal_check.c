@@ -0,0 +1,436 @@
+/*!
+* @file otis_imucal_check.c
+* @author Ethan Lew
+* @brief Host check of the gyroscope bias and accelerometer offset/gain calibration
+*
+* The calibration record is checked first: it must round trip, and corrupt, truncated
+* or other version records must be rejected.
+*
+* Then the simulated board is held still in eight orientations in turn, with a known
+* gyroscope bias and accelerometer offset and gain error. The devices are read at the
+* filter rate through imu_dev, as the sampling task does, stillcal is fed the samples
+* and every update is applied with the calibrate op. The time until the gyroscope
+* bias is within CHECK_GYRO_TOL and until the accelerometer is fitted is reported,
+* and the final coefficients and the corrected output must be within tolerance.
+*
+* Last the calibration is stored to a file and the devices opened again: the first
+* second of output must already be corrected, where it is not without the file.
+*
+*     otis_imucal_check [-s seed]
+*
+* Exits non-zero on any failure.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "imu_dev.h"
+#include "imu_cal.h"
+#include "stillcal.h"
+#include "sim/imu_sim.h"
+
+#define CHECK_RATE_US 10000
+#define CHECK_HOLD_US 3000000
+#define CHECK_TURN_US 1000000
+#define CHECK_FRAME_US 1000
+/* Acceptance */
+#define CHECK_GYRO_TOL (0.002F)          /* rad/s */
+#define CHECK_OFFSET_TOL (0.03F)         /* m/s^2 */
+#define CHECK_GAIN_TOL (0.003F)
+#define CHECK_NORM_TOL (0.02F)           /* m/s^2 */
+#define CHECK_GYRO_SECONDS (1.5F)        /* Bias within tolerance this long after the start */
+
+/* Orientations held: the direction of gravity in the body frame */
+static const float check_poses[][3] = {
+    {0.0F, 0.0F, 1.0F}, {1.0F, 0.0F, 0.0F}, {0.0F, 1.0F, 0.0F}, {0.0F, 0.0F, -1.0F},
+    {-1.0F, 0.0F, 0.0F}, {0.0F, -1.0F, 0.0F}, {0.57735F, 0.57735F, 0.57735F}, {-0.6F, 0.0F, 0.8F},
+};
+#define CHECK_POSES (sizeof(check_poses) / sizeof(check_poses[0]))
+
+/* Errors of the simulated parts */
+static const float check_gyro_bias[3] = {0.03F, -0.045F, 0.015F};      /* rad/s */
+static const float check_accel_bias[3] = {0.025F, -0.03F, 0.04F};      /* g */
+static const float check_accel_scale[3] = {1.03F, 0.96F, 1.015F};
+
+static uint32_t check_rng;
+
+static int check_record(void);
+
+static int check_calibrate(imu_cal_t *cal);
+
+static int check_restart(const imu_cal_t *cal);
+
+static void check_motion(motion_sim_t *motion, const motion_sim_config_t *config);
+
+static int check_open(imu_sim_t *sim, motion_sim_t *motion, imu_dev_t *gyro_dev, imu_dev_t *fxos_dev);
+
+static int check_read(imu_sim_t *sim, imu_dev_t *gyro_dev, imu_dev_t *fxos_dev, imu_sample_t *sample);
+
+static float check_norm_error(const double *accel_sum, uint32_t n);
+
+static uint32_t check_crc32(const uint8_t *data, size_t size);
+
+static float check_gauss(void);
+
+int main(int argc, char **argv){
+    check_rng = 0x2545F491;
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:")) != -1){
+        switch(opt){
+            case 's': check_rng = (uint32_t)strtoul(optarg, NULL, 0) | 1; break;
+            default:
+            fprintf(stderr, "usage: %s [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int failures = check_record();
+    imu_cal_t cal;
+    failures += check_calibrate(&cal);
+    failures += check_restart(&cal);
+
+    printf("failures: %d\n%s\n", failures, failures ? "FAILED" : "passed");
+    return failures ? 2 : 0;
+}
+
+/*!
+* The record: round trip, rejection of damaged and foreign records, and the file
+*/
+static int check_record(void){
+    int failures = 0;
+    imu_cal_t cal, back;
+    imu_cal_identity(&cal);
+    cal.flags = IMU_CAL_GYRO | IMU_CAL_ACCEL;
+    for(int i = 0; i < 3; i++){
+        cal.gyro_bias[i] = check_gyro_bias[i];
+        cal.accel_offset[i] = check_accel_bias[i] * SENSORS_GRAVITY_STANDARD;
+        cal.accel_gain[i] = 1.0F / check_accel_scale[i];
+    }
+    uint8_t record[IMU_CAL_RECORD_SIZE];
+    imu_cal_encode(&cal, record);
+
+    if(imu_cal_decode(record, sizeof(record), &back) != IMU_CAL_SUCCESS || memcmp(&cal, &back, sizeof(cal)) != 0){
+        printf("record round trip FAILED\n");
+        failures++;
+    }
+    for(size_t i = 0; i < sizeof(record); i++){
+        uint8_t damaged[IMU_CAL_RECORD_SIZE];
+        memcpy(damaged, record, sizeof(record));
+        damaged[i] ^= 0x10;
+        if(imu_cal_decode(damaged, sizeof(damaged), &back) == IMU_CAL_SUCCESS){
+            printf("record with byte %zu damaged accepted FAILED\n", i);
+            failures++;
+        }
+    }
+    if(imu_cal_decode(record, sizeof(record) - 4, &back) != IMU_CAL_CORRUPT){
+        printf("truncated record not rejected FAILED\n");
+        failures++;
+    }
+    /* A well formed record of the next version */
+    uint8_t next[IMU_CAL_RECORD_SIZE];
+    memcpy(next, record, sizeof(record));
+    next[4] = IMU_CAL_VERSION + 1;
+    uint32_t crc = check_crc32(next, sizeof(next) - 4);
+    for(int b = 0; b < 4; b++)
+        next[sizeof(next) - 4 + b] = (uint8_t)(crc >> (8 * b));
+    if(imu_cal_decode(next, sizeof(next), &back) != IMU_CAL_VERSION_MISMATCH){
+        printf("record of another version not rejected FAILED\n");
+        failures++;
+    }
+
+    char dir[] = "/tmp/otis_imucalXXXXXX";
+    if(!mkdtemp(dir)){
+        printf("no temporary directory FAILED\n");
+        return failures + 1;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "%s/imu_cal.bin", dir);
+    imu_cal_set_path(NULL);
+    if(imu_cal_load(&back) != IMU_CAL_NONE || imu_cal_store(&cal) != IMU_CAL_NONE){
+        printf("storage used with no path FAILED\n");
+        failures++;
+    }
+    imu_cal_set_path(path);
+    if(imu_cal_load(&back) != IMU_CAL_NONE){
+        printf("missing file not reported FAILED\n");
+        failures++;
+    }
+    if(imu_cal_store(&cal) != IMU_CAL_SUCCESS || imu_cal_load(&back) != IMU_CAL_SUCCESS ||
+       memcmp(&cal, &back, sizeof(cal)) != 0){
+        printf("file round trip FAILED\n");
+        failures++;
+    }
+    FILE *f = fopen(path, "wb");
+    if(f){
+        fputs("not a calibration record at all, and longer than one", f);
+        fclose(f);
+    }
+    if(imu_cal_load(&back) != IMU_CAL_CORRUPT){
+        printf("foreign file not rejected FAILED\n");
+        failures++;
+    }
+    remove(path);
+    rmdir(dir);
+    imu_cal_set_path(NULL);
+    printf("%-12s %s\n", "record", failures ? "FAILED" : "ok");
+    return failures;
+}
+
+/*!
+* Calibrate from still periods
+*   1. Open the devices with nothing stored, on the scripted poses
+*   2. Read at the filter rate, feed stillcal, apply every update
+*   3. Compare the coefficients with the simulated errors, and the corrected output
+*      in the last hold with the truth
+*/
+static int check_calibrate(imu_cal_t *cal){
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    static stillcal_t still;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    check_motion(&motion, &config);
+    imu_dev_t gyro_dev, fxos_dev;
+    if(check_open(&sim, &motion, &gyro_dev, &fxos_dev))
+        return 1;
+
+    imu_cal_identity(cal);
+    stillcal_init(&still);
+    float gyro_s = -1.0F;
+    float accel_s = -1.0F;
+    uint64_t end_us = (uint64_t)CHECK_POSES * (CHECK_HOLD_US + CHECK_TURN_US);
+    double gyro_sum[3] = {0};
+    double accel_sum[3] = {0};
+    uint32_t last_n = 0;
+    while(sim.now_us < end_us){
+        imu_sample_t sample;
+        if(check_read(&sim, &gyro_dev, &fxos_dev, &sample))
+            continue;
+        gyro_float_data_t gyro = sample.gyro;
+        raw_float_data_t accel = sample.accel;
+        if(stillcal_add(&still, &gyro, &accel) == STILLCAL_STILL){
+            uint32_t changed = stillcal_update(&still, cal);
+            if(changed & IMU_CAL_GYRO)
+                IMU_GYRO_CALL(calibrate)(&gyro_dev, cal);
+            if(changed & IMU_CAL_ACCEL){
+                IMU_ACCEL_CALL(calibrate)(&fxos_dev, cal);
+                if(accel_s < 0.0F)
+                    accel_s = sim.now_us * 1e-6F;
+            }
+        }
+        float worst = 0.0F;
+        for(int i = 0; i < 3; i++)
+            worst = fmaxf(worst, fabsf(cal->gyro_bias[i] - check_gyro_bias[i]));
+        if(gyro_s < 0.0F && (cal->flags & IMU_CAL_GYRO) && worst < CHECK_GYRO_TOL)
+            gyro_s = sim.now_us * 1e-6F;
+
+        /* Second half of the last hold, corrected */
+        uint64_t hold_start = (uint64_t)(CHECK_POSES - 1) * (CHECK_HOLD_US + CHECK_TURN_US);
+        if(sim.now_us > hold_start + CHECK_HOLD_US / 2 && sim.now_us < hold_start + CHECK_HOLD_US){
+            gyro_sum[0] += gyro.x;
+            gyro_sum[1] += gyro.y;
+            gyro_sum[2] += gyro.z;
+            accel_sum[0] += accel.x;
+            accel_sum[1] += accel.y;
+            accel_sum[2] += accel.z;
+            last_n++;
+        }
+    }
+
+    float gyro_err = 0.0F, offset_err = 0.0F, gain_err = 0.0F, residual = 0.0F;
+    for(int i = 0; i < 3; i++){
+        gyro_err = fmaxf(gyro_err, fabsf(cal->gyro_bias[i] - check_gyro_bias[i]));
+        offset_err = fmaxf(offset_err, fabsf(cal->accel_offset[i] - check_accel_bias[i] * SENSORS_GRAVITY_STANDARD));
+        gain_err = fmaxf(gain_err, fabsf(cal->accel_gain[i] * check_accel_scale[i] - 1.0F));
+        if(last_n)
+            residual = fmaxf(residual, fabsf((float)(gyro_sum[i] / last_n)));
+    }
+    float norm_err = check_norm_error(accel_sum, last_n);
+    int failed = gyro_s < 0.0F || gyro_s > CHECK_GYRO_SECONDS || accel_s < 0.0F ||
+                 !(cal->flags & IMU_CAL_ACCEL) || gyro_err > CHECK_GYRO_TOL || offset_err > CHECK_OFFSET_TOL ||
+                 gain_err > CHECK_GAIN_TOL || residual > CHECK_GYRO_TOL || norm_err > CHECK_NORM_TOL;
+    printf("%-12s gyro bias within %.3f rad/s after %.2f s, accelerometer fitted after %.1f s (%u of %u blocks still, "
+           "pose rms %.4f m/s^2)\n", "calibrate", CHECK_GYRO_TOL, gyro_s, accel_s, still.still_blocks, still.blocks,
+           still.pose_error);
+    printf("%-12s bias err %.5f rad/s, offset err %.4f m/s^2, gain err %.5f; corrected: rate %.5f rad/s, "
+           "|a| - g %.4f m/s^2  %s\n", "", gyro_err, offset_err, gain_err, residual, norm_err,
+           failed ? "FAILED" : "ok");
+
+    IMU_GYRO_CALL(destroy)(&gyro_dev);
+    IMU_ACCEL_CALL(destroy)(&fxos_dev);
+    imu_sim_destroy(&sim);
+    motion_sim_close(&motion);
+    return failed;
+}
+
+/*!
+* Cold start in the first pose, without and then with the stored calibration: the
+* drivers must load it at init
+*/
+static int check_restart(const imu_cal_t *cal){
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    char dir[] = "/tmp/otis_imucalXXXXXX";
+    if(!mkdtemp(dir))
+        return 1;
+    char path[64];
+    snprintf(path, sizeof(path), "%s/imu_cal.bin", dir);
+
+    float rate[2], norm[2];
+    for(int stored = 0; stored < 2; stored++){
+        imu_cal_set_path(stored ? path : NULL);
+        if(stored && imu_cal_store(cal) != IMU_CAL_SUCCESS){
+            printf("store FAILED\n");
+            return 1;
+        }
+        motion_sim_config_t config;
+        motion_sim_default_config(&config);
+        check_motion(&motion, &config);
+        imu_dev_t gyro_dev, fxos_dev;
+        if(check_open(&sim, &motion, &gyro_dev, &fxos_dev))
+            return 1;
+        double sum[3] = {0};
+        double accel_sum[3] = {0};
+        uint32_t n = 0;
+        while(sim.now_us < 1000000){
+            imu_sample_t sample;
+            if(check_read(&sim, &gyro_dev, &fxos_dev, &sample))
+                continue;
+            sum[0] += sample.gyro.x;
+            sum[1] += sample.gyro.y;
+            sum[2] += sample.gyro.z;
+            accel_sum[0] += sample.accel.x;
+            accel_sum[1] += sample.accel.y;
+            accel_sum[2] += sample.accel.z;
+            n++;
+        }
+        rate[stored] = n ? (float)sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]) / n : 1.0F;
+        norm[stored] = check_norm_error(accel_sum, n);
+        IMU_GYRO_CALL(destroy)(&gyro_dev);
+        IMU_ACCEL_CALL(destroy)(&fxos_dev);
+        imu_sim_destroy(&sim);
+        motion_sim_close(&motion);
+    }
+    remove(path);
+    rmdir(dir);
+    imu_cal_set_path(NULL);
+
+    int failed = rate[1] > CHECK_GYRO_TOL || norm[1] > CHECK_NORM_TOL;
+    printf("%-12s first second after init: rate %.4f rad/s, |a| - g %.4f m/s^2 uncalibrated; "
+           "%.4f rad/s, %.4f m/s^2 with the stored calibration  %s\n", "restart", rate[0], norm[0], rate[1], norm[1],
+           failed ? "FAILED" : "ok");
+    return failed;
+}
+
+/*!
+* Replay log of the poses: each held for CHECK_HOLD_US, then turned into the next
+* over CHECK_TURN_US about the axis between them. Readings carry the part errors and
+* the noise of config.
+*/
+static void check_motion(motion_sim_t *motion, const motion_sim_config_t *config){
+    uint32_t per_pose = (CHECK_HOLD_US + CHECK_TURN_US) / CHECK_FRAME_US;
+    motion_sim_init(motion, config);
+    motion->log_len = (uint32_t)CHECK_POSES * per_pose;
+    motion->log = (motion_frame_t*)malloc(motion->log_len * sizeof(motion_frame_t));
+
+    motion_frame_t *fr = motion->log;
+    for(uint32_t p = 0; p < CHECK_POSES; p++){
+        const float *from = check_poses[p];
+        const float *to = check_poses[(p + 1) % CHECK_POSES];
+        float axis[3] = {from[1] * to[2] - from[2] * to[1], from[2] * to[0] - from[0] * to[2],
+                         from[0] * to[1] - from[1] * to[0]};
+        float s = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        float angle = atan2f(s, from[0] * to[0] + from[1] * to[1] + from[2] * to[2]);
+        if(s < 1e-6F){
+            /* Opposite: turn about any perpendicular axis */
+            axis[0] = fabsf(from[0]) < 0.9F ? 1.0F : 0.0F;
+            axis[1] = fabsf(from[0]) < 0.9F ? 0.0F : 1.0F;
+            axis[2] = 0.0F;
+            s = 1.0F;
+        }
+        for(uint32_t k = 0; k < per_pose; k++, fr++){
+            uint32_t t = k * CHECK_FRAME_US;
+            float f = t < CHECK_HOLD_US ? 0.0F : (float)(t - CHECK_HOLD_US) / CHECK_TURN_US;
+            float w = t < CHECK_HOLD_US ? 0.0F : angle / (CHECK_TURN_US * 1e-6F);
+            float g[3], n = 0.0F;
+            for(int i = 0; i < 3; i++){
+                g[i] = (1.0F - f) * from[i] + f * to[i];
+                n += g[i] * g[i];
+            }
+            n = n > 1e-6F ? 1.0F / sqrtf(n) : 0.0F;
+            fr->t_us = (uint64_t)(p * per_pose + k) * CHECK_FRAME_US;
+            for(int i = 0; i < 3; i++){
+                fr->accel[i] = check_accel_scale[i] * g[i] * n + check_accel_bias[i] + config->accel_noise * check_gauss();
+                fr->gyro[i] = w * axis[i] / s + check_gyro_bias[i] + config->gyro_noise * check_gauss();
+                fr->magn[i] = config->field[i] + config->magn_noise * check_gauss();
+            }
+        }
+    }
+}
+
+static int check_open(imu_sim_t *sim, motion_sim_t *motion, imu_dev_t *gyro_dev, imu_dev_t *fxos_dev){
+    imu_sim_init(sim, motion, NULL);
+    imu_sim_attach(sim, 0);
+    if(IMU_GYRO_OPEN(gyro_dev) != IMU_DEV_SUCCESS || IMU_ACCEL_OPEN(fxos_dev) != IMU_DEV_SUCCESS){
+        printf("device open FAILED\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*!
+* One sample at the filter rate, as the sampling task assembles it
+*/
+static int check_read(imu_sim_t *sim, imu_dev_t *gyro_dev, imu_dev_t *fxos_dev, imu_sample_t *sample){
+    imu_sample_t reading;
+    size_t count;
+    imu_sim_advance(sim, sim->now_us + CHECK_RATE_US);
+    memset(sample, 0, sizeof(imu_sample_t));
+    if(IMU_GYRO_CALL(read_batch)(gyro_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+        imu_dev_merge(sample, &reading);
+    if(IMU_ACCEL_CALL(read_batch)(fxos_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+        imu_dev_merge(sample, &reading);
+    return (sample->status & (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID)) !=
+           (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID);
+}
+
+/*!
+* Distance of the mean acceleration from g: the noise averages out, the calibration
+* error does not
+*/
+static float check_norm_error(const double *accel_sum, uint32_t n){
+    if(!n)
+        return 1.0F;
+    double sq = 0.0;
+    for(int i = 0; i < 3; i++)
+        sq += (accel_sum[i] / n) * (accel_sum[i] / n);
+    return fabsf((float)(sqrt(sq) - SENSORS_GRAVITY_STANDARD));
+}
+
+/*!
+* CRC-32 as the record uses it, to forge a well formed record of another version
+*/
+static uint32_t check_crc32(const uint8_t *data, size_t size){
+    uint32_t crc = 0xFFFFFFFFU;
+    for(size_t i = 0; i < size; i++){
+        crc ^= data[i];
+        for(int b = 0; b < 8; b++)
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+    }
+    return ~crc;
+}
+
+static float check_gauss(void){
+    check_rng ^= check_rng << 13;
+    check_rng ^= check_rng >> 17;
+    check_rng ^= check_rng << 5;
+    float u = ((check_rng >> 8) + 1) * (1.0F / 16777217.0F);
+    check_rng ^= check_rng << 13;
+    check_rng ^= check_rng >> 17;
+    check_rng ^= check_rng << 5;
+    float v = (check_rng >> 8) * (1.0F / 16777216.0F);
+    return sqrtf(-2.0F * logf(u)) * cosf(6.2831853F * v);
+}
@@ -0,0 +1,259 @@
+/*!
+* @file otis_madgwick_bench.c
+* @author Ethan Lew
+* @brief Host benchmark of the Madgwick filter on a motion_sim trajectory
+*
+* Samples the synthetic motion into memory first, so that only the filter is timed,
+* then for the 9 DoF and the 6 DoF update reports
+*   - the cost per update, in ns and in TSC cycles on x86, best of several passes
+*   - the attitude error against the trajectory after a warm-up: the full rotation
+*     angle for 9 DoF, the tilt (gravity direction) for 6 DoF, whose heading is free
+* on two trajectories: the default one with MEMS grade bias, noise and an uncalibrated
+* hard iron offset, and the same motion with ideal sensors, which leaves only the
+* filter's own error.
+*
+*     otis_madgwick_bench [-n samples] [-f rate_hz] [-b beta]
+*
+* Exits non-zero if the filter diverges (a non-finite quaternion) or its error on the
+* ideal sensors exceeds MADGWICK_BENCH_MAX_ERR_DEG.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+#include "madgwick.h"
+#include "sim/motion_sim.h"
+#include "sim/host_clock.h"
+
+#define BENCH_DEFAULT_SAMPLES 20000
+#define BENCH_DEFAULT_RATE_HZ 100.0F
+#define BENCH_PASSES 5
+/* Time before the error is accumulated */
+#define BENCH_WARMUP_S (2.0F)
+/* Largest rms error on ideal sensors that passes (deg) */
+#define MADGWICK_BENCH_MAX_ERR_DEG (2.0F)
+
+/*!
+* The sampled trajectory, sensor readings and true orientation
+*/
+typedef struct bench_track_s {
+    gyro_float_data_t *gyro;
+    raw_float_data_t *accel;
+    raw_float_data_t *magn;
+    float (*q)[4];
+    uint32_t n;
+} bench_track_t;
+
+typedef struct bench_result_s {
+    double ns;              /**< Per update */
+    double cycles;          /**< Per update, 0 off x86 */
+    double err_rms;         /**< deg */
+    float err_max;          /**< deg */
+    uint8_t finite;
+} bench_result_t;
+
+static int bench_track(bench_track_t *track, const motion_sim_config_t *config, uint32_t n, float freq);
+
+static void bench_free(bench_track_t *track);
+
+static void bench_run(const bench_track_t *track, int full, float beta, float freq, bench_result_t *result);
+
+static float bench_angle(const float *q_est, const float *q_true);
+
+static float bench_tilt(const float *q_est, const float *q_true);
+
+int main(int argc, char **argv){
+    uint32_t n = BENCH_DEFAULT_SAMPLES;
+    float freq = BENCH_DEFAULT_RATE_HZ;
+    float beta = MADGWICK_BETA_DEFAULT;
+    int opt;
+    while((opt = getopt(argc, argv, "n:f:b:")) != -1){
+        switch(opt){
+            case 'n': n = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'f': freq = (float)atof(optarg); break;
+            case 'b': beta = (float)atof(optarg); break;
+            default:
+            fprintf(stderr, "usage: %s [-n samples] [-f rate_hz] [-b beta]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(n <= (uint32_t)(BENCH_WARMUP_S * freq) || freq <= 0.0F || beta < 0.0F)
+        return 1;
+
+    /* 1. Both trajectories, the same motion */
+    motion_sim_config_t config[2];
+    motion_sim_default_config(&config[0]);
+    config[1] = config[0];
+    memset(config[1].gyro_bias, 0, sizeof(config[1].gyro_bias));
+    memset(config[1].accel_bias, 0, sizeof(config[1].accel_bias));
+    memset(config[1].magn_bias, 0, sizeof(config[1].magn_bias));
+    config[1].gyro_noise = 0.0F;
+    config[1].accel_noise = 0.0F;
+    config[1].magn_noise = 0.0F;
+    const char *track_name[2] = {"default", "ideal"};
+    static bench_track_t track[2];
+    for(int t = 0; t < 2; t++){
+        if(bench_track(&track[t], &config[t], n, freq)){
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+
+    /* 2. Both updates on both */
+    int failures = 0;
+    printf("%u samples at %.1f Hz, beta %.4f, %s inverse square root\n", n, freq, beta,
+           MADGWICK_FAST_INV_SQRT ? "fast" : "exact");
+    printf("%-8s %-8s %10s %10s %12s %12s\n", "update", "sensors", "ns", "cycles", "rms deg", "max deg");
+    for(int full = 1; full >= 0; full--){
+        for(int t = 0; t < 2; t++){
+            bench_result_t result;
+            bench_run(&track[t], full, beta, freq, &result);
+            printf("%-8s %-8s %10.1f %10.0f %12.3f %12.3f%s\n", full ? "9 DoF" : "6 DoF", track_name[t], result.ns,
+                   result.cycles, result.err_rms, result.err_max, full ? "" : " (tilt)");
+            if(!result.finite || (t == 1 && result.err_rms > MADGWICK_BENCH_MAX_ERR_DEG)){
+                printf("%s on %s sensors: %s\n", full ? "9 DoF" : "6 DoF", track_name[t],
+                       result.finite ? "error too large" : "diverged");
+                failures++;
+            }
+        }
+    }
+
+    bench_free(&track[0]);
+    bench_free(&track[1]);
+    return failures ? 2 : 0;
+}
+
+/*!
+* Sample the motion at the filter rate, in the driver units: rad/s, m/s^2 and uT
+*/
+static int bench_track(bench_track_t *track, const motion_sim_config_t *config, uint32_t n, float freq){
+    track->gyro = (gyro_float_data_t*)malloc(n * sizeof(gyro_float_data_t));
+    track->accel = (raw_float_data_t*)malloc(n * sizeof(raw_float_data_t));
+    track->magn = (raw_float_data_t*)malloc(n * sizeof(raw_float_data_t));
+    track->q = malloc(n * sizeof(*track->q));
+    track->n = n;
+    if(!track->gyro || !track->accel || !track->magn || !track->q)
+        return 1;
+
+    static motion_sim_t motion;
+    motion_sim_init(&motion, config);
+    motion_frame_t frame;
+    for(uint32_t i = 0; i < n; i++){
+        motion_sim_sample(&motion, (uint64_t)((i + 1) * 1e6 / freq), &frame);
+        track->gyro[i].x = frame.gyro[0];
+        track->gyro[i].y = frame.gyro[1];
+        track->gyro[i].z = frame.gyro[2];
+        track->accel[i].x = frame.accel[0] * 9.80665F;
+        track->accel[i].y = frame.accel[1] * 9.80665F;
+        track->accel[i].z = frame.accel[2] * 9.80665F;
+        track->magn[i].x = frame.magn[0];
+        track->magn[i].y = frame.magn[1];
+        track->magn[i].z = frame.magn[2];
+        memcpy(track->q[i], motion.q, sizeof(motion.q));
+    }
+    motion_sim_close(&motion);
+    return 0;
+}
+
+static void bench_free(bench_track_t *track){
+    free(track->gyro);
+    free(track->accel);
+    free(track->magn);
+    free(track->q);
+}
+
+/*!
+* 1. Time the updates over the whole trajectory, keeping the fastest pass
+* 2. Run once more comparing each output with the truth
+*/
+static void bench_run(const bench_track_t *track, int full, float beta, float freq, bench_result_t *result){
+    madgwick_t filter;
+    uint64_t best_ns = UINT64_MAX;
+    uint64_t best_cycles = 0;
+    for(int p = 0; p < BENCH_PASSES; p++){
+        madgwick_init(&filter, beta, freq);
+        uint64_t c0 = BENCH_CYCLES();
+        uint64_t t0 = host_clock_now_ns();
+        if(full){
+            for(uint32_t i = 0; i < track->n; i++)
+                madgwick_update(&filter, &track->gyro[i], &track->accel[i], &track->magn[i]);
+        } else {
+            for(uint32_t i = 0; i < track->n; i++)
+                madgwick_update_imu(&filter, &track->gyro[i], &track->accel[i]);
+        }
+        uint64_t t1 = host_clock_now_ns();
+        uint64_t c1 = BENCH_CYCLES();
+        if(t1 - t0 < best_ns){
+            best_ns = t1 - t0;
+            best_cycles = c1 - c0;
+        }
+    }
+    result->ns = (double)best_ns / track->n;
+    result->cycles = (double)best_cycles / track->n;
+
+    uint32_t warmup = (uint32_t)(BENCH_WARMUP_S * freq);
+    double err_sq = 0.0;
+    result->err_max = 0.0F;
+    result->finite = 1;
+    madgwick_init(&filter, beta, freq);
+    for(uint32_t i = 0; i < track->n; i++){
+        if(full)
+            madgwick_update(&filter, &track->gyro[i], &track->accel[i], &track->magn[i]);
+        else
+            madgwick_update_imu(&filter, &track->gyro[i], &track->accel[i]);
+        float q[4] = {filter.q0, filter.q1, filter.q2, filter.q3};
+        if(!isfinite(q[0]) || !isfinite(q[1]) || !isfinite(q[2]) || !isfinite(q[3])){
+            result->finite = 0;
+            break;
+        }
+        if(i < warmup)
+            continue;
+        float e = (full ? bench_angle(q, track->q[i]) : bench_tilt(q, track->q[i])) * 57.29578F;
+        err_sq += (double)e * e;
+        if(e > result->err_max)
+            result->err_max = e;
+    }
+    result->err_rms = sqrt(err_sq / (track->n - warmup));
+}
+
+/*!
+* Rotation angle of q_est^-1 q_true, q_est normalized first
+*/
+static float bench_angle(const float *q_est, const float *q_true){
+    float n = sqrtf(q_est[0] * q_est[0] + q_est[1] * q_est[1] + q_est[2] * q_est[2] + q_est[3] * q_est[3]);
+    float d = fabsf(q_est[0] * q_true[0] + q_est[1] * q_true[1] + q_est[2] * q_true[2] + q_est[3] * q_true[3]) / n;
+    if(d > 1.0F)
+        d = 1.0F;
+    return 2.0F * acosf(d);
+}
+
+/*!
+* Angle between the earth vertical seen in the body frame by both orientations
+*/
+static float bench_tilt(const float *q_est, const float *q_true){
+    const float *q[2] = {q_est, q_true};
+    float up[2][3];
+    for(int k = 0; k < 2; k++){
+        float w = q[k][0], x = q[k][1], y = q[k][2], z = q[k][3];
+        up[k][0] = 2.0F * (x * z - w * y);
+        up[k][1] = 2.0F * (y * z + w * x);
+        up[k][2] = w * w - x * x - y * y + z * z;
+    }
+    float dot = up[0][0] * up[1][0] + up[0][1] * up[1][1] + up[0][2] * up[1][2];
+    float norm = sqrtf((up[0][0] * up[0][0] + up[0][1] * up[0][1] + up[0][2] * up[0][2]) *
+                       (up[1][0] * up[1][0] + up[1][1] * up[1][1] + up[1][2] * up[1][2]));
+    float c = dot / norm;
+    if(c > 1.0F)
+        c = 1.0F;
+    if(c < -1.0F)
+        c = -1.0F;
+    return acosf(c);
+}
@@ -0,0 +1,345 @@
+/*!
+* @file otis_magcal_check.c
+* @author Ethan Lew
+* @brief Host check of the magnetometer calibrator on synthetic distorted spheres
+*
+* Every case samples a field of known strength over random directions, distorts it
+* with a soft iron matrix and a hard iron offset, adds noise, and feeds it to magcal.
+* The fit must recover the offset, the field strength and the soft iron correction (up
+* to scale), and the corrected samples must lie on a sphere. Samples from a single
+* plane of rotation must be reported as poorly covered.
+*
+* Then the drivers run on the simulated sensors while the board tumbles: the
+* calibrator is fed the converted magnetometer samples until its fit is usable, the
+* fit is applied with magn_set_calibration, and the field the driver converts from
+* then on must have the fitted strength. The time to a usable fit is reported in
+* seconds of motion.
+*
+*     otis_magcal_check [-n samples] [-s seed]
+*
+* Exits non-zero on any failure.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fxos8700.h"
+#include "magcal.h"
+#include "sim/imu_sim.h"
+#include "sim/host_clock.h"
+
+#define CHECK_DEFAULT_SAMPLES 400
+#define CHECK_FIELD_UT (48.0F)
+#define CHECK_NOISE_UT (0.3F)
+/* Acceptance */
+#define CHECK_MAX_OFFSET_UT (0.5F)
+#define CHECK_MAX_FIELD_ERROR (0.01F)
+#define CHECK_MAX_SOFT_ERROR (0.02F)
+#define CHECK_MAX_SPHERE_ERROR (0.015F)
+/* Simulated run: longest motion allowed to reach a usable fit, and its tumble */
+#define CHECK_SIM_SECONDS (30.0F)
+#define CHECK_SIM_TUMBLE (2.5F)
+
+/* Directions sampled */
+#define CHECK_SPHERE 0
+#define CHECK_HEMISPHERE 1
+#define CHECK_PLANE 2
+
+typedef struct check_case_s {
+    const char *name;
+    float soft[9];          /**< Distortion S of m = S h + b */
+    float offset[3];        /**< b (uT) */
+    int coverage;           /**< CHECK_SPHERE, CHECK_HEMISPHERE or CHECK_PLANE */
+} check_case_t;
+
+static const check_case_t check_cases[] = {
+    {"sphere", {1, 0, 0, 0, 1, 0, 0, 0, 1}, {0, 0, 0}, CHECK_SPHERE},
+    {"hard iron", {1, 0, 0, 0, 1, 0, 0, 0, 1}, {25.0F, -40.0F, 12.0F}, CHECK_SPHERE},
+    {"hard iron > field", {1, 0, 0, 0, 1, 0, 0, 0, 1}, {-90.0F, 120.0F, 45.0F}, CHECK_SPHERE},
+    {"hard and soft iron", {1.15F, 0.08F, -0.05F, 0.08F, 0.85F, 0.1F, -0.05F, 0.1F, 1.05F}, {-18.0F, 7.0F, 30.0F}, CHECK_SPHERE},
+    {"strong soft iron", {1.3F, 0.15F, 0.0F, 0.15F, 0.8F, 0.1F, 0.0F, 0.1F, 1.0F}, {60.0F, 10.0F, -35.0F}, CHECK_SPHERE},
+    {"hemisphere", {1, 0, 0, 0, 1, 0, 0, 0, 1}, {10.0F, 5.0F, -8.0F}, CHECK_HEMISPHERE},
+    {"planar rotation", {1, 0, 0, 0, 1, 0, 0, 0, 1}, {10.0F, 5.0F, -8.0F}, CHECK_PLANE},
+};
+
+static uint32_t check_rng;
+
+static float check_uniform(void);
+
+static float check_gauss(void);
+
+static void check_direction(float *h, int coverage);
+
+static void check_apply(const fxos8700_magn_cal_t *cal, const float *m, float *out);
+
+static int check_case(const check_case_t *c, uint32_t samples);
+
+static int check_compose(void);
+
+static int check_sim(void);
+
+int main(int argc, char **argv){
+    uint32_t samples = CHECK_DEFAULT_SAMPLES;
+    check_rng = 0x9E3779B9;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:s:")) != -1){
+        switch(opt){
+            case 'n': samples = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 's': check_rng = (uint32_t)strtoul(optarg, NULL, 0) | 1; break;
+            default:
+            fprintf(stderr, "usage: %s [-n samples] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    for(size_t i = 0; i < sizeof(check_cases) / sizeof(check_cases[0]); i++)
+        failures += check_case(&check_cases[i], samples);
+    failures += check_compose();
+    failures += check_sim();
+
+    printf("failures: %d\n%s\n", failures, failures ? "FAILED" : "passed");
+    return failures ? 2 : 0;
+}
+
+/*!
+* One synthetic case
+*   1. Feed the distorted, noisy samples (timing magcal_add)
+*   2. Fit, and compare offset, field strength and W S, which must be a rotation
+*      times the field scale; as both are symmetric with positive eigenvalues, the
+*      identity times a scale
+*   3. Fresh samples corrected with the fit must have the fitted strength
+*/
+static int check_case(const check_case_t *c, uint32_t samples){
+    static magcal_t cal;
+    magcal_init(&cal);
+    uint64_t add_ns = 0;
+    for(uint32_t i = 0; i < samples; i++){
+        float h[3], m[3];
+        check_direction(h, c->coverage);
+        for(int r = 0; r < 3; r++){
+            m[r] = c->offset[r] + CHECK_FIELD_UT * (c->soft[r * 3] * h[0] + c->soft[r * 3 + 1] * h[1] +
+                                                    c->soft[r * 3 + 2] * h[2]) + CHECK_NOISE_UT * check_gauss();
+        }
+        raw_float_data_t sample = {m[0], m[1], m[2]};
+        uint64_t t0 = host_clock_now_ns();
+        magcal_add(&cal, &sample);
+        add_ns += host_clock_now_ns() - t0;
+    }
+    magcal_result_t fit;
+    uint64_t t0 = host_clock_now_ns();
+    magcal_err_t ret = magcal_fit(&cal, &fit);
+    uint64_t fit_ns = host_clock_now_ns() - t0;
+    if(ret != MAGCAL_SUCCESS){
+        /* Samples from one plane may not describe an ellipsoid at all */
+        int failed = c->coverage != CHECK_PLANE;
+        printf("%-20s no fit (%d)  %s\n", c->name, ret, failed ? "FAILED" : "ok");
+        return failed;
+    }
+
+    float offset_err = 0.0F;
+    for(int r = 0; r < 3; r++)
+        offset_err = fmaxf(offset_err, fabsf(fit.cal.offset[r] - c->offset[r]));
+    float ws[9];
+    for(int r = 0; r < 3; r++){
+        for(int k = 0; k < 3; k++)
+            ws[r * 3 + k] = fit.cal.soft[r * 3] * c->soft[k] + fit.cal.soft[r * 3 + 1] * c->soft[3 + k] +
+                            fit.cal.soft[r * 3 + 2] * c->soft[6 + k];
+    }
+    float scale = (ws[0] + ws[4] + ws[8]) / 3.0F;
+    float soft_err = 0.0F;
+    for(int i = 0; i < 9; i++)
+        soft_err = fmaxf(soft_err, fabsf(ws[i] / scale - ((i % 4 == 0) ? 1.0F : 0.0F)));
+    /* The fitted strength is that of S h, which has the determinant of S folded in */
+    float det = c->soft[0] * (c->soft[4] * c->soft[8] - c->soft[5] * c->soft[7]) -
+                c->soft[1] * (c->soft[3] * c->soft[8] - c->soft[5] * c->soft[6]) +
+                c->soft[2] * (c->soft[3] * c->soft[7] - c->soft[4] * c->soft[6]);
+    float field = CHECK_FIELD_UT * cbrtf(det);
+    float field_err = fabsf(fit.field - field) / field;
+
+    double sq = 0.0;
+    for(int i = 0; i < 1000; i++){
+        float h[3], m[3], out[3];
+        check_direction(h, c->coverage);
+        for(int r = 0; r < 3; r++)
+            m[r] = c->offset[r] + CHECK_FIELD_UT * (c->soft[r * 3] * h[0] + c->soft[r * 3 + 1] * h[1] + c->soft[r * 3 + 2] * h[2]);
+        check_apply(&fit.cal, m, out);
+        float e = sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]) / fit.field - 1.0F;
+        sq += (double)e * e;
+    }
+    float sphere_err = (float)sqrt(sq / 1000);
+
+    int failed;
+    if(c->coverage != CHECK_SPHERE){
+        /* Too little of the sphere seen; the fit must not be taken as usable */
+        failed = magcal_usable(&fit);
+    } else {
+        failed = !magcal_usable(&fit) || offset_err > CHECK_MAX_OFFSET_UT || field_err > CHECK_MAX_FIELD_ERROR ||
+                 soft_err > CHECK_MAX_SOFT_ERROR || sphere_err > CHECK_MAX_SPHERE_ERROR;
+    }
+    printf("%-20s %u/%u samples, fit error %.2f%%, coverage %.2f, anisotropy %.2f, offset err %.2f uT, field %.2f uT (err %.2f%%), "
+           "soft err %.4f, sphere err %.2f%%, add %.0f ns, fit %.1f us  %s\n",
+           c->name, fit.samples, samples, 100.0F * fit.fit_error, fit.coverage, fit.anisotropy, offset_err, fit.field, 100.0F * field_err,
+           soft_err, 100.0F * sphere_err, (double)add_ns / samples, fit_ns * 1e-3, failed ? "FAILED" : "ok");
+    return failed;
+}
+
+/*!
+* magcal_compose(first, next) must equal next applied after first
+*/
+static int check_compose(void){
+    const fxos8700_magn_cal_t first = {{3.0F, -4.0F, 1.5F}, {1.1F, 0.05F, 0.0F, 0.05F, 0.9F, -0.02F, 0.0F, -0.02F, 1.0F}};
+    const fxos8700_magn_cal_t next = {{-0.7F, 0.4F, 0.2F}, {0.98F, 0.01F, 0.0F, 0.01F, 1.02F, 0.0F, 0.0F, 0.0F, 1.0F}};
+    fxos8700_magn_cal_t both;
+    magcal_compose(&first, &next, &both);
+    float worst = 0.0F;
+    for(int i = 0; i < 100; i++){
+        float m[3] = {60.0F * check_uniform() - 30.0F, 60.0F * check_uniform() - 30.0F, 60.0F * check_uniform() - 30.0F};
+        float a[3], b[3], c[3];
+        check_apply(&first, m, a);
+        check_apply(&next, a, b);
+        check_apply(&both, m, c);
+        for(int r = 0; r < 3; r++)
+            worst = fmaxf(worst, fabsf(b[r] - c[r]));
+    }
+    int failed = worst > 1e-3F;
+    printf("%-20s max difference %.2e uT  %s\n", "compose", worst, failed ? "FAILED" : "ok");
+    return failed;
+}
+
+/*!
+* The calibrator on the driver's output while the simulated board tumbles
+*   1. Feed converted samples at the FXOS8700 rate, fitting twice a second, until a
+*      fit is usable
+*   2. Apply it; from then on the driver's field must have the fitted strength and
+*      the hard iron of the motion source must be gone
+*/
+static int check_sim(void){
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    config.amp[0] = CHECK_SIM_TUMBLE;
+    config.amp[1] = 0.8F * CHECK_SIM_TUMBLE;
+    config.amp[2] = 0.6F * CHECK_SIM_TUMBLE;
+    config.seed = check_rng;
+    motion_sim_init(&motion, &config);
+    imu_sim_init(&sim, &motion, NULL);
+    imu_sim_attach(&sim, 0);
+
+    accel_t *accel = NULL;
+    magn_t *magn = NULL;
+    if(accel_init(&accel) != ACCEL_SUCCESS || magn_init(&magn) != MAGN_SUCCESS){
+        printf("sensor init failed\n");
+        return 1;
+    }
+    uint32_t period_us = accel->fxos->period_us;
+    uint32_t fit_every = 500000 / period_us;
+
+    static magcal_t cal;
+    magcal_init(&cal);
+    magcal_result_t fit;
+    int usable = 0;
+    uint32_t i = 0;
+    uint32_t limit = (uint32_t)(CHECK_SIM_SECONDS * 1e6F / period_us);
+    for(; i < limit && !usable; i++){
+        imu_sim_advance(&sim, sim.now_us + period_us);
+        if(accel_magn_update(accel, magn) != ACCEL_SUCCESS)
+            break;
+        magcal_add(&cal, &magn->converted);
+        if(i % fit_every == fit_every - 1)
+            usable = magcal_fit(&cal, &fit) == MAGCAL_SUCCESS && magcal_usable(&fit);
+    }
+    float seconds = i * period_us * 1e-6F;
+    if(!usable){
+        printf("%-20s no usable fit after %.1f s of motion\n", "simulated", seconds);
+        accel_destroy(&accel);
+        magn_destroy(&magn);
+        imu_sim_destroy(&sim);
+        return 1;
+    }
+
+    float offset_err = 0.0F;
+    for(int r = 0; r < 3; r++)
+        offset_err = fmaxf(offset_err, fabsf(fit.cal.offset[r] - config.magn_bias[r]));
+    float truth = sqrtf(config.field[0] * config.field[0] + config.field[1] * config.field[1] +
+                        config.field[2] * config.field[2]);
+
+    /* The correction now runs in the driver's conversion */
+    magn_set_calibration(magn, &fit.cal);
+    double sq = 0.0;
+    uint32_t n = 0;
+    for(uint32_t k = 0; k < 2000; k++){
+        imu_sim_advance(&sim, sim.now_us + period_us);
+        if(accel_magn_update(accel, magn) != ACCEL_SUCCESS)
+            break;
+        raw_float_data_t *m = &magn->converted;
+        float e = sqrtf(m->x * m->x + m->y * m->y + m->z * m->z) / truth - 1.0F;
+        sq += (double)e * e;
+        n++;
+    }
+    float sphere_err = n ? (float)sqrt(sq / n) : 1.0F;
+    int failed = offset_err > 2.0F * CHECK_MAX_OFFSET_UT || sphere_err > 2.0F * CHECK_MAX_SPHERE_ERROR ||
+                 magn_get_calibration(magn) == NULL;
+    printf("%-20s usable after %.1f s of motion (%u samples taken), fit error %.2f%%, coverage %.2f, "
+           "offset err %.2f uT, corrected field err %.2f%%  %s\n",
+           "simulated", seconds, cal.samples, 100.0F * fit.fit_error, fit.coverage, offset_err, 100.0F * sphere_err,
+           failed ? "FAILED" : "ok");
+
+    accel_destroy(&accel);
+    magn_destroy(&magn);
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    return failed;
+}
+
+static void check_apply(const fxos8700_magn_cal_t *cal, const float *m, float *out){
+    float x = m[0] - cal->offset[0];
+    float y = m[1] - cal->offset[1];
+    float z = m[2] - cal->offset[2];
+    for(int r = 0; r < 3; r++)
+        out[r] = cal->soft[r * 3] * x + cal->soft[r * 3 + 1] * y + cal->soft[r * 3 + 2] * z;
+}
+
+/*!
+* Uniform direction on the sphere (Marsaglia), its upper half, or the equator
+*/
+static void check_direction(float *h, int coverage){
+    if(coverage == CHECK_PLANE){
+        float a = 6.2831853F * check_uniform();
+        h[0] = cosf(a);
+        h[1] = sinf(a);
+        h[2] = 0.0F;
+        return;
+    }
+    float u, v, s;
+    do {
+        u = 2.0F * check_uniform() - 1.0F;
+        v = 2.0F * check_uniform() - 1.0F;
+        s = u * u + v * v;
+    } while(s >= 1.0F || s == 0.0F);
+    float r = 2.0F * sqrtf(1.0F - s);
+    h[0] = u * r;
+    h[1] = v * r;
+    h[2] = 1.0F - 2.0F * s;
+    if(coverage == CHECK_HEMISPHERE)
+        h[2] = fabsf(h[2]);
+}
+
+static float check_uniform(void){
+    check_rng ^= check_rng << 13;
+    check_rng ^= check_rng >> 17;
+    check_rng ^= check_rng << 5;
+    return (check_rng >> 8) * (1.0F / 16777216.0F);
+}
+
+static float check_gauss(void){
+    float u = check_uniform();
+    float v = check_uniform();
+    if(u < 1e-7F)
+        u = 1e-7F;
+    return sqrtf(-2.0F * logf(u)) * cosf(6.2831853F * v);
+}
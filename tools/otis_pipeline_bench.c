@@ -0,0 +1,358 @@
+/*!
+* @file otis_pipeline_bench.c
+* @author Ethan Lew
+* @brief Host throughput test of the staged pipeline on simulated sensors
+*
+* Runs hal/pipeline.h as on target, the stages as pthreads pinned to CPUs: the
+* sampling stage reads the drivers on the simulated bus, the fusion stage runs the
+* filter, the output stage encodes telemetry frames into memory. Then
+*   1. throughput, and every stage's counters (deadline misses, skipped releases,
+*      drops, worst latency, busy time, core)
+*   2. every published sample reached the output stage once and in order
+*   3. the orientation of the last output equals the filter run over the same
+*      samples on one thread, bit for bit (when nothing was dropped)
+*
+*     otis_pipeline_bench [-n samples] [-m filter mode] [-s core] [-f core] [-r rate_hz]
+*
+*   -s  core of the sampling stage, -1 for none (default 0)
+*   -f  core of the fusion and output stages, -1 for none (default 1)
+*   -r  pace sampling at this rate on the wall clock, with the models following it;
+*       by default virtual time advances one gyroscope period per sample as fast as
+*       the fusion stage keeps up (sampling waits while PIPELINE_BENCH_IN_FLIGHT
+*       samples are queued, so nothing is dropped)
+*
+* Built with OTIS_PERF=1 it also prints the perf.h probes and checks that the answer
+* to TELEM_CMD_PERF decodes back to them.
+*
+* Exits non-zero if a sample was lost or reordered beyond the counted drops, or the
+* orientations differ.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fxas21002c.h"
+#include "fxos8700.h"
+#include "time_utils.h"
+#include "pipeline.h"
+#include "filter.h"
+#include "telem_proto.h"
+#include "telemetry.h"
+#include "telem_decode.h"
+#include "sim/imu_sim.h"
+
+#define PIPELINE_BENCH_DEFAULT_SAMPLES 20000
+/* Queued samples the unpaced sampling stage waits at, below both ring sizes */
+#define PIPELINE_BENCH_IN_FLIGHT (IMU_RING_SIZE / 2)
+/* Deadlines of the paced run, in sample periods from the stamp */
+#define PIPELINE_BENCH_DEADLINE_PERIODS 2
+
+typedef struct bench_sampler_s {
+    imu_sim_t *sim;
+    gyro_t *gyro;
+    accel_t *accel;
+    magn_t *magn;
+    pipeline_t *pipe;
+    imu_sample_t *log;        /**< Every published sample, for the reference run */
+    uint32_t samples;
+    uint32_t seq;
+    uint32_t period_us;       /**< Virtual time per sample */
+    uint8_t paced;
+    uint32_t failures;
+} bench_sampler_t;
+
+typedef struct bench_sender_s {
+    telem_encoder_t telem;
+    uint8_t frames[TELEM_RAW_FRAME + TELEM_QUAT_FRAME];
+    uint64_t bytes;
+    uint32_t next_seq;
+    uint32_t gaps;            /**< Samples missing before an output */
+    uint32_t reordered;       /**< Outputs older than one already seen */
+    float q[4];               /**< Orientation of the last output */
+} bench_sender_t;
+
+static filter_mode_t bench_mode;
+static float bench_freq;
+static filter_t bench_filter;
+
+static void bench_sample(void *ctx, pipeline_t *pipe);
+
+static void bench_fuse(void *ctx, const imu_sample_t *sample, pipeline_fused_t *fused);
+
+static void bench_fuse_start(void *ctx);
+
+static void bench_output(void *ctx, const pipeline_fused_t *fused);
+
+#if OTIS_PERF
+static int bench_perf_report(const perf_snapshot_t *snap);
+
+static void bench_perf_frame(const telem_frame_t *frame, void *ctx);
+#endif
+
+int main(int argc, char **argv){
+    uint32_t samples = PIPELINE_BENCH_DEFAULT_SAMPLES;
+    int sample_core = 0;
+    int fuse_core = 1;
+    uint32_t rate = 0;
+    int opt;
+
+    bench_mode = FILTER_MADGWICK;
+    while((opt = getopt(argc, argv, "n:m:s:f:r:")) != -1){
+        switch(opt){
+            case 'n': samples = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'm': bench_mode = (filter_mode_t)atoi(optarg); break;
+            case 's': sample_core = atoi(optarg); break;
+            case 'f': fuse_core = atoi(optarg); break;
+            case 'r': rate = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:
+            fprintf(stderr, "usage: %s [-n samples] [-m mode] [-s core] [-f core] [-r rate_hz]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(samples == 0 || bench_mode >= FILTER_MODE_COUNT)
+        return 1;
+
+    /* 1. Simulated sensors and drivers */
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    motion_sim_config_t motion_config;
+    motion_sim_default_config(&motion_config);
+    motion_sim_init(&motion, &motion_config);
+    imu_sim_init(&sim, &motion, rate ? get_time_micros : NULL);
+    imu_sim_attach(&sim, 0);
+
+    static bench_sampler_t sampler;
+    if(gyro_init(&sampler.gyro) != GYRO_SUCCESS || accel_init(&sampler.accel) != ACCEL_SUCCESS ||
+       magn_init(&sampler.magn) != MAGN_SUCCESS){
+        fprintf(stderr, "sensor init failed\n");
+        return 1;
+    }
+    static pipeline_t pipe;
+    sampler.sim = &sim;
+    sampler.pipe = &pipe;
+    sampler.samples = samples;
+    sampler.period_us = sampler.gyro->period_us;
+    sampler.paced = rate != 0;
+    bench_freq = 1e6F / (float)sampler.period_us;
+    sampler.log = (imu_sample_t*)malloc(samples * sizeof(imu_sample_t));
+    if(!sampler.log)
+        return 1;
+    static bench_sender_t sender;
+    telem_init(&sender.telem, sampler.period_us);
+
+    /* 2. Stages */
+    pipeline_config_t config;
+    pipeline_default_config(&config);
+    uint32_t period_us = rate ? 1000000 / rate : sampler.period_us;
+    config.stage[PIPELINE_SAMPLE].core = sample_core;
+    config.stage[PIPELINE_SAMPLE].period_us = rate ? period_us : 0;
+    config.stage[PIPELINE_SAMPLE].ctx = &sampler;
+    config.stage[PIPELINE_FUSE].core = fuse_core;
+    config.stage[PIPELINE_FUSE].start = bench_fuse_start;
+    config.stage[PIPELINE_OUTPUT].core = fuse_core;
+    config.stage[PIPELINE_OUTPUT].ctx = &sender;
+    for(int s = 0; s < PIPELINE_STAGES; s++)
+        config.stage[s].deadline_us = rate ? (uint32_t)(s + PIPELINE_BENCH_DEADLINE_PERIODS - 1) * period_us : 0;
+    config.sample = bench_sample;
+    config.fuse = bench_fuse;
+    config.output = bench_output;
+
+    /* 3. Run until every sample is through or lost */
+#if OTIS_PERF
+    perf_reset();
+#endif
+    uint64_t t0 = get_time_micros();
+    if(pipeline_start(&pipe, &config) != PIPELINE_SUCCESS){
+        fprintf(stderr, "pipeline start failed\n");
+        return 1;
+    }
+    pipeline_stage_stats_t stats[PIPELINE_STAGES];
+    while(1){
+        pipeline_stats(&pipe, stats);
+        uint32_t lost = stats[PIPELINE_SAMPLE].dropped + stats[PIPELINE_FUSE].dropped;
+        if(stats[PIPELINE_OUTPUT].items + lost >= samples)
+            break;
+        os_sleep_us(1000);
+    }
+    uint64_t elapsed_us = get_time_micros() - t0;
+    uint8_t pinned[PIPELINE_STAGES];
+    for(int s = 0; s < PIPELINE_STAGES; s++)
+        pinned[s] = pipe.task[s].pinned;
+    pipeline_stop(&pipe);
+    pipeline_stats(&pipe, stats);
+
+    /* 4. The same samples through the filter on one thread */
+    uint32_t lost = stats[PIPELINE_SAMPLE].dropped + stats[PIPELINE_FUSE].dropped;
+    uint32_t published = stats[PIPELINE_SAMPLE].items;
+    int compared = 0, equal = 0;
+    double ref_s = 0.0;
+    if(lost == 0){
+        static filter_t ref;
+        float q[4];
+        filter_init(&ref, bench_mode, bench_freq);
+        uint64_t r0 = get_time_micros();
+        for(uint32_t i = 0; i < published; i++){
+            gyro_float_data_t g = sampler.log[i].gyro;
+            raw_float_data_t a = sampler.log[i].accel;
+            raw_float_data_t m = sampler.log[i].magn;
+            filter_update(&ref, &g, &a, filter_uses_magn(bench_mode) ? &m : NULL);
+        }
+        ref_s = (get_time_micros() - r0) * 1e-6;
+        filter_quaternion(&ref, q);
+        compared = 1;
+        equal = memcmp(q, sender.q, sizeof(q)) == 0;
+    }
+
+    /* 5. Report */
+    printf("%u samples, filter mode %d, %s, %u cores\n", samples, bench_mode,
+           rate ? "paced on the wall clock" : "virtual time as fast as fusion keeps up", os_core_count());
+    printf("stage cores: sample %d%s, fuse %d%s, output %d%s\n",
+           stats[PIPELINE_SAMPLE].core, pinned[PIPELINE_SAMPLE] ? " (pinned)" : "",
+           stats[PIPELINE_FUSE].core, pinned[PIPELINE_FUSE] ? " (pinned)" : "",
+           stats[PIPELINE_OUTPUT].core, pinned[PIPELINE_OUTPUT] ? " (pinned)" : "");
+    pipeline_print(&pipe);
+    printf("throughput: %.0f samples/s end to end, %.1f MB/s of frames\n",
+           stats[PIPELINE_OUTPUT].items / (elapsed_us * 1e-6), sender.bytes / (elapsed_us * 1e-6) * 1e-6);
+    if(compared)
+        printf("one thread fusion: %.0f samples/s; last orientation %s\n",
+               published / ref_s, equal ? "identical" : "DIFFERS");
+    printf("outputs: %u, gaps %u (drops %u), reordered %u, driver failures %u\n",
+           stats[PIPELINE_OUTPUT].items, sender.gaps, lost, sender.reordered, sampler.failures);
+
+    int fail = sender.reordered != 0 || sender.gaps != lost || (compared && !equal) || sampler.failures != 0;
+#if OTIS_PERF
+    static perf_snapshot_t snap;
+    perf_snapshot(&snap);
+    perf_print(&snap);
+    if(!bench_perf_report(&snap)){
+        printf("perf report does not decode to the probes\n");
+        fail = 1;
+    }
+#endif
+    gyro_destroy(&sampler.gyro);
+    accel_destroy(&sampler.accel);
+    magn_destroy(&sampler.magn);
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    free(sampler.log);
+    if(fail){
+        printf("FAIL\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*!
+* One sample: unpaced, wait for room and step virtual time one period; then read
+* both devices and publish
+*/
+static void bench_sample(void *ctx, pipeline_t *pipe){
+    bench_sampler_t *sp = (bench_sampler_t*)ctx;
+    if(sp->seq == sp->samples){
+        os_sleep_us(1000);
+        return;
+    }
+    if(!sp->paced){
+        while(pipeline_in_flight(pipe) >= PIPELINE_BENCH_IN_FLIGHT)
+            os_yield();
+        imu_sim_advance(sp->sim, sp->sim->now_us + sp->period_us);
+    }
+
+    uint8_t status = IMU_SAMPLE_GYRO_FRESH | IMU_SAMPLE_ACCEL_FRESH;
+    if(gyro_update(sp->gyro) == GYRO_SUCCESS){
+        status |= IMU_SAMPLE_GYRO_VALID;
+    } else {
+        sp->failures++;
+    }
+    if(accel_magn_update(sp->accel, sp->magn) == ACCEL_SUCCESS){
+        status |= IMU_SAMPLE_ACCEL_VALID | IMU_SAMPLE_MAGN_VALID;
+    } else {
+        sp->failures++;
+    }
+    imu_sample_t *sample = &sp->log[sp->seq];
+    imu_sample_fill(sample, sp->accel, sp->gyro, sp->magn, get_time_micros(), sp->seq, status);
+    sp->seq++;
+    pipeline_publish(pipe, sample);
+}
+
+static void bench_fuse_start(void *ctx){
+    (void)ctx;
+    filter_init(&bench_filter, bench_mode, bench_freq);
+}
+
+static void bench_fuse(void *ctx, const imu_sample_t *sample, pipeline_fused_t *fused){
+    (void)ctx;
+    gyro_float_data_t g = sample->gyro;
+    raw_float_data_t a = sample->accel;
+    raw_float_data_t m = sample->magn;
+    filter_update(&bench_filter, &g, &a, filter_uses_magn(bench_mode) ? &m : NULL);
+    filter_quaternion(&bench_filter, fused->q);
+    filter_euler(&bench_filter, &fused->roll, &fused->pitch, &fused->yaw);
+}
+
+/*!
+* Encode the frames as the firmware does, and check the sequence
+*/
+static void bench_output(void *ctx, const pipeline_fused_t *fused){
+    bench_sender_t *se = (bench_sender_t*)ctx;
+    const imu_sample_t *sample = &fused->sample;
+    size_t n = telem_encode_raw(&se->telem, sample, se->frames);
+    n += telem_encode_quat(&se->telem, sample->stamp, sample->status, fused->q, se->frames + n);
+    se->bytes += n;
+
+    if(sample->seq < se->next_seq){
+        se->reordered++;
+    } else {
+        se->gaps += sample->seq - se->next_seq;
+        se->next_seq = sample->seq + 1;
+    }
+    memcpy(se->q, fused->q, sizeof(se->q));
+}
+
+#if OTIS_PERF
+typedef struct bench_perf_check_s {
+    const perf_snapshot_t *snap;
+    uint32_t frames;
+    uint32_t mismatches;
+} bench_perf_check_t;
+
+/*!
+* Encode the answer to TELEM_CMD_PERF and decode it again: one frame per probe with
+* values plus the counters, each equal to the snapshot
+*/
+static int bench_perf_report(const perf_snapshot_t *snap){
+    static uint8_t report[TELEM_PERF_REPORT_MAX];
+    static telem_decoder_t dec;
+    telem_encoder_t enc;
+    bench_perf_check_t check = {snap, 0, 0};
+    uint32_t expected = 1;
+
+    for(int i = 0; i < PERF_PROBES; i++)
+        expected += snap->probe[i].count != 0;
+    telem_init(&enc, 0);
+    telem_decode_init(&dec, bench_perf_frame, &check);
+    telem_decode_feed(&dec, report, telem_encode_perf_report(&enc, get_time_micros(), snap, report));
+    return check.frames == expected && check.mismatches == 0 && dec.stats.crc_errors == 0;
+}
+
+static void bench_perf_frame(const telem_frame_t *frame, void *ctx){
+    bench_perf_check_t *check = (bench_perf_check_t*)ctx;
+    const perf_snapshot_t *snap = check->snap;
+    check->frames++;
+    if(frame->type == TELEM_TYPE_PERF){
+        const perf_probe_t *p = &snap->probe[frame->probe < PERF_PROBES ? frame->probe : 0];
+        if(frame->probe >= PERF_PROBES || frame->count != p->count || frame->min != p->min || frame->max != p->max ||
+           frame->sum != p->sum || memcmp(frame->hist, p->hist, sizeof(p->hist)) != 0 ||
+           frame->unit != perf_probe_unit((perf_probe_id_t)frame->probe) || frame->cycles_per_us != snap->cycles_per_us)
+            check->mismatches++;
+    } else if(frame->type == TELEM_TYPE_COUNTERS){
+        if(frame->counters != PERF_COUNTERS || frame->since_us != snap->since_us ||
+           memcmp(frame->counter, snap->counter, sizeof(snap->counter)) != 0)
+            check->mismatches++;
+    } else {
+        check->mismatches++;
+    }
+}
+#endif
@@ -0,0 +1,330 @@
+/*!
+* @file otis_replay_bench.c
+* @author Ethan Lew
+* @brief Record the sensor bus to a log, replay it through the drivers and fusion
+*
+* Runs the sensors and a filter on the simulated parts as the firmware's sampling and
+* fusion stages do (imu_dev open, configure and read_batch every SAMPLE_PERIOD), with
+* the bus recorder (i2c_rec.h) wrapped around the fake bus. Then opens the log with
+* the replay backend (sim/i2c_replay.h) and runs fresh devices and a fresh filter over
+* it. The replayed orientation must match the recorded one bit for bit, sample for
+* sample; the report gives both rates, the replay in fused samples per second.
+*
+*     otis_replay_bench [-n samples] [-m filter mode] [-c scl_hz] [-k ring bytes] [-o log] [-r log]
+*
+*   -n  fused samples recorded (default 20000)
+*   -m  filter mode, see filter_mode_t (default 0, Madgwick)
+*   -c  modelled SCL frequency of the recorded run (default 0, no bus timing)
+*   -k  record into a ring of this size, as the firmware does with I2C_RECORD, and
+*       replay its dump; once the ring wraps, the replay starts with the devices'
+*       setup and then the newest samples, so it is checked for unmatched
+*       transactions rather than against the recorded orientations
+*   -o  keep the log in this file (default: a temporary, removed)
+*   -r  only replay this log until it runs out, e.g. a ring dumped from firmware
+*       sampling on its timer (not SAMPLE_DRDY) with the same filter mode
+*
+* Exits non-zero if the replay diverges from the recording.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "imu_dev.h"
+#include "filter.h"
+#include "i2c_rec.h"
+#include "sim/i2c_replay.h"
+#include "sim/imu_sim.h"
+#include "sim/host_clock.h"
+
+#define REPLAY_BENCH_DEFAULT_SAMPLES 20000
+/* The firmware's sampling and filter period */
+#define REPLAY_BENCH_PERIOD_US 10000
+
+typedef struct replay_bench_sensors_s {
+    imu_dev_t gyro_dev;
+    imu_dev_t fxos_dev;
+    filter_t filter;
+} replay_bench_sensors_t;
+
+typedef struct replay_bench_run_s {
+    uint32_t samples;
+    uint32_t failures;
+    uint32_t evicted;     /**< Records the ring lost (recorded run) */
+    uint32_t unmatched;   /**< Transactions not in the log (replayed run) */
+    uint64_t elapsed_ns;
+} replay_bench_run_t;
+
+static int replay_bench_open(replay_bench_sensors_t *sensors, filter_mode_t mode);
+
+static uint32_t replay_bench_step(replay_bench_sensors_t *sensors);
+
+static void replay_bench_close(replay_bench_sensors_t *sensors);
+
+static int replay_bench_record(const char *path, uint32_t samples, filter_mode_t mode, uint32_t scl_hz, size_t ring, float *q, replay_bench_run_t *run);
+
+static int replay_bench_dump(const char *path);
+
+static int replay_bench_replay(const char *path, uint32_t samples, filter_mode_t mode, float *q, replay_bench_run_t *run);
+
+int main(int argc, char **argv){
+    uint32_t samples = REPLAY_BENCH_DEFAULT_SAMPLES;
+    filter_mode_t mode = FILTER_MADGWICK;
+    uint32_t scl_hz = 0;
+    size_t ring = 0;
+    const char *out = NULL;
+    const char *replay = NULL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:m:c:k:o:r:")) != -1){
+        switch(opt){
+            case 'n': samples = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'm': mode = (filter_mode_t)atoi(optarg); break;
+            case 'c': scl_hz = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'k': ring = (size_t)strtoul(optarg, NULL, 0); break;
+            case 'o': out = optarg; break;
+            case 'r': replay = optarg; break;
+            default:
+            fprintf(stderr, "usage: %s [-n samples] [-m mode] [-c scl_hz] [-k ring] [-o log] [-r log]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* 1. A log given: replay it to the end */
+    replay_bench_run_t played = {0};
+    if(replay){
+        if(replay_bench_replay(replay, UINT32_MAX, mode, NULL, &played) != 0)
+            return 1;
+        printf("replay: %u samples in %.3f s, %.0f samples/s, %u driver failures\n", played.samples,
+               played.elapsed_ns * 1e-9, played.samples / (played.elapsed_ns * 1e-9), played.failures);
+        return 0;
+    }
+
+    /* 2. Record a run, keeping its orientations */
+    char tmp[] = "/tmp/otis_replay_XXXXXX";
+    const char *path = out;
+    if(path == NULL){
+        int fd = mkstemp(tmp);
+        if(fd < 0){
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+        path = tmp;
+    }
+    float *q_rec = (float*)malloc(samples * 4 * sizeof(float));
+    float *q_play = (float*)malloc(samples * 4 * sizeof(float));
+    if(q_rec == NULL || q_play == NULL){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    replay_bench_run_t recorded = {0};
+    int ret = replay_bench_record(path, samples, mode, scl_hz, ring, q_rec, &recorded);
+
+    /* 3. Replay it and compare */
+    if(ret == 0)
+        ret = replay_bench_replay(path, samples, mode, q_play, &played);
+    if(ret == 0){
+        uint32_t first = UINT32_MAX;
+        for(uint32_t i = 0; i < played.samples && first == UINT32_MAX; i++){
+            if(memcmp(&q_rec[4 * i], &q_play[4 * i], 4 * sizeof(float)) != 0)
+                first = i;
+        }
+        printf("record: %u samples in %.3f s, %.0f samples/s\n", recorded.samples, recorded.elapsed_ns * 1e-9,
+               recorded.samples / (recorded.elapsed_ns * 1e-9));
+        printf("replay: %u samples in %.3f s, %.0f samples/s, %.1fx the recorded run\n", played.samples,
+               played.elapsed_ns * 1e-9, played.samples / (played.elapsed_ns * 1e-9),
+               ((double)recorded.elapsed_ns / recorded.samples) / ((double)played.elapsed_ns / played.samples));
+        if(recorded.evicted){
+            if(played.unmatched || played.failures){
+                fprintf(stderr, "ring replay failed: %u unmatched transactions, %u driver failures\n",
+                        played.unmatched, played.failures);
+                ret = 2;
+            } else {
+                printf("ring replay clean: %u of %u samples, %u records lost to the ring\n", played.samples,
+                       recorded.samples, recorded.evicted);
+            }
+        } else if(played.samples != recorded.samples || played.failures != recorded.failures || first != UINT32_MAX){
+            fprintf(stderr, "replay diverged: %u of %u samples, %u of %u failures, first differing sample %d\n",
+                    played.samples, recorded.samples, played.failures, recorded.failures,
+                    first == UINT32_MAX ? -1 : (int)first);
+            ret = 2;
+        } else {
+            printf("replay matches the recording: %u orientations bit exact\n", played.samples);
+        }
+    }
+
+    if(out == NULL)
+        remove(path);
+    free(q_rec);
+    free(q_play);
+    return ret;
+}
+
+/*!
+* The firmware's sensor setup and filter
+*/
+static int replay_bench_open(replay_bench_sensors_t *sensors, filter_mode_t mode){
+    if(IMU_GYRO_OPEN(&sensors->gyro_dev) != IMU_DEV_SUCCESS)
+        return 1;
+    if(IMU_ACCEL_OPEN(&sensors->fxos_dev) != IMU_DEV_SUCCESS){
+        IMU_GYRO_CALL(destroy)(&sensors->gyro_dev);
+        return 1;
+    }
+    imu_dev_config_t config = sensors->fxos_dev.config;
+    config.sensors = IMU_DEV_ACCEL | (filter_uses_magn(mode) ? IMU_DEV_MAGN : 0);
+    if(IMU_ACCEL_CALL(configure)(&sensors->fxos_dev, &config) != IMU_DEV_SUCCESS ||
+       filter_init(&sensors->filter, mode, 1e6F / REPLAY_BENCH_PERIOD_US) != FILTER_SUCCESS){
+        replay_bench_close(sensors);
+        return 1;
+    }
+    return 0;
+}
+
+/*!
+* One sampling release and its fusion
+* @returns the reads that failed
+*/
+static uint32_t replay_bench_step(replay_bench_sensors_t *sensors){
+    imu_sample_t sample;
+    imu_sample_t reading;
+    size_t count;
+    uint32_t failures = 0;
+
+    memset(&sample, 0, sizeof(imu_sample_t));
+    if(IMU_GYRO_CALL(read_batch)(&sensors->gyro_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+        imu_dev_merge(&sample, &reading);
+    else
+        failures++;
+    if(IMU_ACCEL_CALL(read_batch)(&sensors->fxos_dev, &reading, 1, &count) == IMU_DEV_SUCCESS && count == 1)
+        imu_dev_merge(&sample, &reading);
+    else
+        failures++;
+    if((sample.status & (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID)) ==
+       (IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_ACCEL_VALID)){
+        gyro_float_data_t gyro = sample.gyro;
+        raw_float_data_t accel = sample.accel;
+        raw_float_data_t magn = sample.magn;
+        filter_update(&sensors->filter, &gyro, &accel, (sample.status & IMU_SAMPLE_MAGN_VALID) ? &magn : NULL);
+    }
+    return failures;
+}
+
+static void replay_bench_close(replay_bench_sensors_t *sensors){
+    IMU_GYRO_CALL(destroy)(&sensors->gyro_dev);
+    IMU_ACCEL_CALL(destroy)(&sensors->fxos_dev);
+}
+
+/*!
+* The recorded run, in virtual time, with the recorder started before the devices so
+* the log holds their initialization
+*/
+static int replay_bench_record(const char *path, uint32_t samples, filter_mode_t mode, uint32_t scl_hz, size_t ring, float *q, replay_bench_run_t *run){
+    static motion_sim_t motion;
+    static imu_sim_t sim;
+    static replay_bench_sensors_t sensors;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    motion_sim_init(&motion, &config);
+    imu_sim_init(&sim, &motion, NULL);
+    imu_sim_attach(&sim, scl_hz);
+    if((ring ? i2c_rec_start_ring(ring) : i2c_rec_start_file(path)) != I2C_REC_SUCCESS){
+        fprintf(stderr, "cannot record to %s\n", ring ? "the ring" : path);
+        return 1;
+    }
+    if(replay_bench_open(&sensors, mode) != 0){
+        fprintf(stderr, "recorded run: init failed\n");
+        i2c_rec_stop();
+        return 1;
+    }
+    if(ring && i2c_rec_keep() != I2C_REC_SUCCESS){
+        fprintf(stderr, "ring of %zu bytes too small for the setup\n", ring);
+        i2c_rec_stop();
+        return 1;
+    }
+
+    uint64_t t_us = sim.now_us;
+    uint64_t start_ns = host_clock_now_ns();
+    for(uint32_t i = 0; i < samples; i++){
+        t_us += REPLAY_BENCH_PERIOD_US;
+        imu_sim_advance(&sim, t_us);
+        run->failures += replay_bench_step(&sensors);
+        filter_quaternion(&sensors.filter, &q[4 * i]);
+    }
+    run->elapsed_ns = host_clock_now_ns() - start_ns;
+    run->samples = samples;
+
+    replay_bench_close(&sensors);
+    i2c_rec_stats_t stats;
+    i2c_rec_stats(&stats);
+    int ret = ring ? replay_bench_dump(path) : 0;
+    i2c_rec_stop();
+    motion_sim_close(&motion);
+    imu_sim_destroy(&sim);
+    run->evicted = stats.evicted;
+    printf("log: %u records, %llu bytes, %.1f bytes per fused sample, %u not logged", stats.records,
+           (unsigned long long)stats.bytes, (double)stats.bytes / samples, stats.skipped);
+    if(ring)
+        printf(", ring dump %zu bytes, %u records lost", stats.size, stats.evicted);
+    printf("\n");
+    return ret;
+}
+
+/*!
+* Write the ring out as the firmware sends it, in chunks
+*/
+static int replay_bench_dump(const char *path){
+    FILE *f = fopen(path, "wb");
+    if(f == NULL){
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+    }
+    uint8_t chunk[200];
+    size_t offset = 0;
+    size_t n;
+    i2c_rec_pause(1);
+    while((n = i2c_rec_read(offset, chunk, sizeof(chunk))) > 0){
+        fwrite(chunk, 1, n, f);
+        offset += n;
+    }
+    i2c_rec_pause(0);
+    return fclose(f) == 0 ? 0 : 1;
+}
+
+/*!
+* The replayed run: the same calls on the replay backend, until samples are done or
+* the log runs out. q may be NULL.
+*/
+static int replay_bench_replay(const char *path, uint32_t samples, filter_mode_t mode, float *q, replay_bench_run_t *run){
+    static replay_bench_sensors_t sensors;
+    i2c_replay_err_t err = i2c_replay_load(path);
+    if(err != I2C_REPLAY_SUCCESS){
+        fprintf(stderr, "cannot replay %s (%d)\n", path, err);
+        return 1;
+    }
+    i2c_utils_set_backend(&i2c_replay_backend);
+    if(replay_bench_open(&sensors, mode) != 0){
+        fprintf(stderr, "replayed run: init failed, not a log of this configuration?\n");
+        i2c_replay_close();
+        return 1;
+    }
+
+    uint64_t first_us = i2c_replay_now();
+    uint64_t start_ns = host_clock_now_ns();
+    for(uint32_t i = 0; i < samples && !i2c_replay_done(); i++){
+        run->failures += replay_bench_step(&sensors);
+        if(q)
+            filter_quaternion(&sensors.filter, &q[4 * i]);
+        run->samples++;
+    }
+    run->elapsed_ns = host_clock_now_ns() - start_ns;
+
+    i2c_replay_stats_t stats;
+    i2c_replay_stats(&stats);
+    run->unmatched = stats.unmatched;
+    printf("replayed %.3f s of recording: %u reads, %u writes, %u records passed over, %u unmatched, %u diverged writes\n",
+           (i2c_replay_now() - first_us) * 1e-6, stats.reads, stats.writes, stats.skipped, stats.unmatched, stats.diverged);
+    replay_bench_close(&sensors);
+    i2c_replay_close();
+    return 0;
+}
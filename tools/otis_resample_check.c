@@ -0,0 +1,254 @@
+/*!
+* @file otis_resample_check.c
+* @author Ethan Lew
+* @brief Host check of the resampler on jittered synthetic sensor streams
+*
+* Feeds resample.h the firmware's streams, with known signals, in stamp order as the
+* sampler would: a gyroscope at 200 Hz running 400 ppm fast and the FXOS8700
+* accelerometer and magnetometer (one stamp) at 100 Hz running 300 ppm slow, every
+* stamp jittered uniformly by up to -j us. Each value is a sine of the stamp it is
+* pushed with, so the value the resampler should emit at a grid time is known exactly.
+* For linear and cubic interpolation, and then with the FXOS8700 silent for a while,
+* it reports per channel the rms and largest alignment error, and the cost of the
+* pushes and pulls per output sample (timed around each push and its pulls), and
+* checks that
+*   - outputs land exactly on the 10 ms grid with consecutive sequence numbers
+*   - none is emitted later than the latency bound after its grid time, plus the
+*     time to the push that forces it
+*   - without a gap no channel is held, the linear error stays within its bound and
+*     the cubic error below the linear one; with the gap the FXOS8700 channels are held and flagged invalid (the
+*     error is then only reported, as the points after the gap interpolate across it)
+*
+*     otis_resample_check [-s seconds] [-j jitter_us] [-v]
+*
+* Exits non-zero on a failed check.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "resample.h"
+#include "sim/host_clock.h"
+
+#define CHECK_DEFAULT_SECONDS 60
+#define CHECK_DEFAULT_JITTER_US 500
+/* The sampler's output grid and latency bound */
+#define CHECK_PERIOD_US 10000
+#define CHECK_MAX_DELAY_US 25000
+#define CHECK_GYRO_PERIOD_US 5000
+#define CHECK_GYRO_PPM (400.0)
+#define CHECK_FXOS_PERIOD_US 10000
+#define CHECK_FXOS_PPM (-300.0)
+/* Signal: 2 Hz sines of unit amplitude, a phase per axis and channel */
+#define CHECK_SIGNAL_HZ (2.0)
+/* FXOS8700 silent from 5 s for this long in the gap run */
+#define CHECK_GAP_START_US 5000000ULL
+#define CHECK_GAP_US 60000ULL
+
+/* Largest rms error of linear interpolation that passes, for unit amplitude: a little
+   above its error on a 2 Hz sine sampled at 100 Hz */
+#define CHECK_LINEAR_MAX_RMS (1.5e-3)
+static const char *check_channel_name[RESAMPLE_CHANNELS] = {"gyro", "accel", "magn"};
+
+typedef struct check_result_s {
+    double err_sq[RESAMPLE_CHANNELS];
+    double err_max[RESAMPLE_CHANNELS];
+    uint32_t valid[RESAMPLE_CHANNELS];   /**< Outputs with the channel valid */
+    uint32_t held[RESAMPLE_CHANNELS];
+    uint32_t outputs;
+    uint32_t off_grid;                   /**< Outputs not on the next grid point */
+    uint32_t misnumbered;
+    uint64_t max_late_us;                /**< Largest emit time after a grid time */
+    uint64_t ns;                         /**< Pushes and pulls */
+} check_result_t;
+
+static uint32_t check_rng;
+
+static double check_signal(int channel, int axis, uint64_t t_us);
+
+static uint32_t check_jitter(uint32_t jitter_us);
+
+static void check_run(resample_order_t order, uint32_t seconds, uint32_t jitter_us, int gap, check_result_t *result);
+
+static double check_rms(const check_result_t *result, int channel);
+
+static int check_report(const char *what, const check_result_t *result, const double *max_rms, int gap,
+                        uint64_t max_late_us, int verbose);
+
+int main(int argc, char **argv){
+    uint32_t seconds = CHECK_DEFAULT_SECONDS;
+    uint32_t jitter_us = CHECK_DEFAULT_JITTER_US;
+    int verbose = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "s:j:v")) != -1){
+        switch(opt){
+            case 's': seconds = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'j': jitter_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'v': verbose = 1; break;
+            default:
+            fprintf(stderr, "usage: %s [-s seconds] [-j jitter_us] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    /* Stamps must stay in order within a stream */
+    if(seconds * 1000000ULL <= CHECK_GAP_START_US + CHECK_GAP_US || jitter_us >= CHECK_GYRO_PERIOD_US / 2)
+        return 1;
+
+    printf("%u s, gyro %u us %+.0f ppm, fxos8700 %u us %+.0f ppm, jitter +-%u us, grid %u us\n", seconds,
+           CHECK_GYRO_PERIOD_US, CHECK_GYRO_PPM, CHECK_FXOS_PERIOD_US, CHECK_FXOS_PPM, jitter_us, CHECK_PERIOD_US);
+    printf("%-13s %-6s %10s %10s %6s %8s %9s\n", "run", "", "rms", "max", "held", "late us", "ns/sample");
+    /* A forced output goes out with the first push past the bound, a gyroscope period
+       and the jitter of two stamps later at most */
+    uint64_t max_late_us = CHECK_MAX_DELAY_US + CHECK_GYRO_PERIOD_US * (1.0 - CHECK_GYRO_PPM * 1e-6) + 2 * jitter_us + 1;
+    int failures = 0;
+    static check_result_t linear, cubic, gap;
+    /* Linear within its bound; cubic must do better than linear on every channel */
+    double max_rms[RESAMPLE_CHANNELS];
+    check_run(RESAMPLE_LINEAR, seconds, jitter_us, 0, &linear);
+    for(int c = 0; c < RESAMPLE_CHANNELS; c++)
+        max_rms[c] = CHECK_LINEAR_MAX_RMS;
+    failures += check_report("linear", &linear, max_rms, 0, max_late_us, verbose);
+    check_run(RESAMPLE_CUBIC, seconds, jitter_us, 0, &cubic);
+    for(int c = 0; c < RESAMPLE_CHANNELS; c++)
+        max_rms[c] = check_rms(&linear, c);
+    failures += check_report("cubic", &cubic, max_rms, 0, max_late_us, verbose);
+    check_run(RESAMPLE_LINEAR, seconds, jitter_us, 1, &gap);
+    failures += check_report("linear gap", &gap, NULL, 1, max_late_us, verbose);
+
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 2 : 0;
+}
+
+static double check_signal(int channel, int axis, uint64_t t_us){
+    return sin(2.0 * M_PI * CHECK_SIGNAL_HZ * (double)t_us * 1e-6 + 0.7 * (3 * channel + axis));
+}
+
+/*!
+* Uniform in [0, 2 jitter_us], xorshift32
+*/
+static uint32_t check_jitter(uint32_t jitter_us){
+    check_rng ^= check_rng << 13;
+    check_rng ^= check_rng >> 17;
+    check_rng ^= check_rng << 5;
+    return jitter_us ? check_rng % (2 * jitter_us + 1) : 0;
+}
+
+/*!
+* One run
+*   1. Next stamp of each stream: nominal time scaled by its rate error, plus jitter
+*   2. Push whichever is older (accelerometer and magnetometer together), then pull
+*      every ready output and compare it with the signal at its grid time
+*/
+static void check_run(resample_order_t order, uint32_t seconds, uint32_t jitter_us, int gap, check_result_t *result){
+    static resampler_t rs;
+    memset(result, 0, sizeof(check_result_t));
+    resample_init(&rs, CHECK_PERIOD_US, CHECK_MAX_DELAY_US, order,
+                  RESAMPLE_USE_GYRO | RESAMPLE_USE_ACCEL | RESAMPLE_USE_MAGN);
+    check_rng = 0x2545F491;
+
+    const uint64_t start = 1000000ULL;
+    const uint64_t end = start + seconds * 1000000ULL;
+    const double period[2] = {CHECK_GYRO_PERIOD_US * (1.0 - CHECK_GYRO_PPM * 1e-6),
+                              CHECK_FXOS_PERIOD_US * (1.0 - CHECK_FXOS_PPM * 1e-6)};
+    uint32_t k[2] = {0, 0};
+    uint64_t next[2];
+    for(int s = 0; s < 2; s++)
+        next[s] = start + check_jitter(jitter_us);
+    uint64_t expect = 0;
+    uint32_t seq = 0;
+
+    while(next[0] < end || next[1] < end){
+        int s = next[0] <= next[1] ? 0 : 1;
+        uint64_t now = next[s];
+        uint64_t t0 = host_clock_now_ns();
+        if(s == 0){
+            gyro_float_data_t g = {(float)check_signal(0, 0, now), (float)check_signal(0, 1, now),
+                                   (float)check_signal(0, 2, now)};
+            resample_push_gyro(&rs, now, &g);
+        } else if(!gap || now < start + CHECK_GAP_START_US || now >= start + CHECK_GAP_START_US + CHECK_GAP_US){
+            raw_float_data_t a = {(float)check_signal(1, 0, now), (float)check_signal(1, 1, now),
+                                  (float)check_signal(1, 2, now)};
+            raw_float_data_t m = {(float)check_signal(2, 0, now), (float)check_signal(2, 1, now),
+                                  (float)check_signal(2, 2, now)};
+            resample_push_accel(&rs, now, &a);
+            resample_push_magn(&rs, now, &m);
+        }
+        imu_sample_t out[4];
+        int pulled = 0;
+        while(pulled < 4 && resample_pull(&rs, &out[pulled]) == RESAMPLE_SUCCESS)
+            pulled++;
+        result->ns += host_clock_now_ns() - t0;
+
+        for(int p = 0; p < pulled; p++){
+            const imu_sample_t *o = &out[p];
+            if(result->outputs == 0)
+                expect = o->stamp;
+            if(o->stamp != expect || o->stamp % CHECK_PERIOD_US != 0)
+                result->off_grid++;
+            if(o->seq != seq)
+                result->misnumbered++;
+            expect = o->stamp + CHECK_PERIOD_US;
+            seq = o->seq + 1;
+            result->outputs++;
+            if(now - o->stamp > result->max_late_us)
+                result->max_late_us = now - o->stamp;
+
+            const float v[RESAMPLE_CHANNELS][3] = {{o->gyro.x, o->gyro.y, o->gyro.z},
+                                                   {o->accel.x, o->accel.y, o->accel.z},
+                                                   {o->magn.x, o->magn.y, o->magn.z}};
+            const uint8_t flag[RESAMPLE_CHANNELS] = {IMU_SAMPLE_GYRO_VALID, IMU_SAMPLE_ACCEL_VALID,
+                                                     IMU_SAMPLE_MAGN_VALID};
+            for(int c = 0; c < RESAMPLE_CHANNELS; c++){
+                if(!(o->status & flag[c]))
+                    continue;
+                result->valid[c]++;
+                for(int a = 0; a < 3; a++){
+                    double e = fabs((double)v[c][a] - check_signal(c, a, o->stamp));
+                    result->err_sq[c] += e * e / 3.0;
+                    if(e > result->err_max[c])
+                        result->err_max[c] = e;
+                }
+            }
+        }
+
+        k[s]++;
+        next[s] = start + (uint64_t)(k[s] * period[s]) + check_jitter(jitter_us);
+    }
+    for(int c = 0; c < RESAMPLE_CHANNELS; c++)
+        result->held[c] = rs.channel[c].held;
+}
+
+static double check_rms(const check_result_t *result, int channel){
+    return result->valid[channel] ? sqrt(result->err_sq[channel] / result->valid[channel]) : 0.0;
+}
+
+/*!
+* Print one run and check it; max_rms per channel, NULL to leave the error unchecked
+*/
+static int check_report(const char *what, const check_result_t *result, const double *max_rms, int gap,
+                        uint64_t max_late_us, int verbose){
+    int failures = 0;
+    if(result->outputs == 0 || result->off_grid || result->misnumbered || result->max_late_us > max_late_us){
+        printf("%s: %u outputs, %u off the grid, %u misnumbered, %llu us late\n", what, result->outputs,
+               result->off_grid, result->misnumbered, (unsigned long long)result->max_late_us);
+        failures++;
+    }
+    for(int c = 0; c < RESAMPLE_CHANNELS; c++){
+        double rms = check_rms(result, c);
+        printf("%-13s %-6s %10.2e %10.2e %6u %8llu %9.1f\n", c == 0 ? what : "", check_channel_name[c], rms,
+               result->err_max[c], result->held[c], (unsigned long long)result->max_late_us,
+               (double)result->ns / (result->outputs ? result->outputs : 1));
+        /* The gyroscope is never held; the FXOS8700 channels only across the gap */
+        int held_ok = (c == RESAMPLE_GYRO || !gap) ? result->held[c] == 0 : result->held[c] > 0;
+        if(!held_ok || (max_rms && rms > max_rms[c]) || result->valid[c] + result->held[c] != result->outputs){
+            printf("%s %s: rms %.2e, %u held, %u valid of %u\n", what, check_channel_name[c], rms,
+                   result->held[c], result->valid[c], result->outputs);
+            failures++;
+        }
+    }
+    if(verbose)
+        printf("%s: %u outputs, %s\n", what, result->outputs, failures ? "FAILED" : "ok");
+    return failures;
+}
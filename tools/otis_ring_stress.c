@@ -0,0 +1,202 @@
+/*!
+* @file otis_ring_stress.c
+* @author Ethan Lew
+* @brief Host stress test of the imu_ring_t single-producer/single-consumer ring
+*
+* A producer and a consumer thread (os_utils.h tasks, pinned like the pipeline
+* stages) pass samples through one ring, twice:
+*   1. paced: the producer pushes at a fixed rate on the wall clock (default 200 kHz,
+*      twenty times the sampling rate), the consumer pops as fast as it can
+*   2. unpaced: the producer pushes as fast as it can, so the ring fills and drops
+* Every byte of a sample is a function of its sequence number, so the consumer checks
+* each pop for a torn record, and that sequence numbers only increase, with the gaps
+* adding up to the drops the producer counted.
+*
+*     otis_ring_stress [-n samples] [-r rate_hz] [-p core] [-c core]
+*
+*   -p  core of the producer, -1 for none (default 0)
+*   -c  core of the consumer, -1 for none (default 1)
+*
+* Exits non-zero on a torn or reordered sample, a count that does not add up, or a
+* paced run that fell short of 100 kHz.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "imu_ring.h"
+#include "os_utils.h"
+#include "time_utils.h"
+
+#define STRESS_DEFAULT_SAMPLES 1000000
+#define STRESS_DEFAULT_RATE_HZ 200000
+/* Slowest paced rate that passes */
+#define STRESS_MIN_RATE_HZ 100000
+#define STRESS_STACK 4096
+
+typedef struct stress_run_s {
+    imu_ring_t ring;
+    uint32_t samples;
+    uint32_t rate_hz;             /**< Producer pace, 0 for none */
+    uint32_t pushed;
+    uint32_t done;                /**< Set by the producer after its last push */
+    uint64_t wall_us;             /**< Producer's first to last push */
+    /* Consumer results */
+    uint32_t popped;
+    uint32_t torn;
+    uint32_t reordered;
+    uint32_t gaps;                /**< Samples skipped between pops and after the last */
+    uint32_t max_count;           /**< Most samples seen queued */
+    uint32_t last_seq;
+} stress_run_t;
+
+static void stress_fill(imu_sample_t *sample, uint32_t seq);
+
+static int stress_intact(const imu_sample_t *sample);
+
+static void stress_produce(void *arg);
+
+static void stress_consume(void *arg);
+
+static int stress_run(stress_run_t *run, int produce_core, int consume_core, const char *what);
+
+int main(int argc, char **argv){
+    uint32_t samples = STRESS_DEFAULT_SAMPLES;
+    uint32_t rate = STRESS_DEFAULT_RATE_HZ;
+    int produce_core = 0;
+    int consume_core = 1;
+    int opt;
+    while((opt = getopt(argc, argv, "n:r:p:c:")) != -1){
+        switch(opt){
+            case 'n': samples = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'r': rate = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'p': produce_core = atoi(optarg); break;
+            case 'c': consume_core = atoi(optarg); break;
+            default:
+            fprintf(stderr, "usage: %s [-n samples] [-r rate_hz] [-p core] [-c core]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(samples == 0 || rate == 0)
+        return 1;
+
+    static stress_run_t run;
+    int failures = 0;
+    printf("%u samples of %u bytes, ring of %u, %u cores\n", samples, (unsigned)sizeof(imu_sample_t),
+           IMU_RING_SIZE, os_core_count());
+    printf("%-8s %10s %10s %10s %10s %6s %6s %6s\n", "run", "rate Hz", "popped", "dropped", "gaps", "torn",
+           "order", "depth");
+
+    memset(&run, 0, sizeof(run));
+    run.samples = samples;
+    run.rate_hz = rate;
+    failures += stress_run(&run, produce_core, consume_core, "paced");
+    if(run.wall_us && (uint64_t)samples * 1000000ULL / run.wall_us < STRESS_MIN_RATE_HZ){
+        printf("paced run reached %llu Hz, below %u\n",
+               (unsigned long long)((uint64_t)samples * 1000000ULL / run.wall_us), STRESS_MIN_RATE_HZ);
+        failures++;
+    }
+
+    memset(&run, 0, sizeof(run));
+    run.samples = samples;
+    failures += stress_run(&run, produce_core, consume_core, "unpaced");
+
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 2 : 0;
+}
+
+/*!
+* Every byte after the sequence number follows from it
+*/
+static void stress_fill(imu_sample_t *sample, uint32_t seq){
+    uint8_t *bytes = (uint8_t*)sample;
+    for(size_t i = 0; i < sizeof(imu_sample_t); i++)
+        bytes[i] = (uint8_t)(seq * 131U + i * 7U);
+    sample->seq = seq;
+}
+
+static int stress_intact(const imu_sample_t *sample){
+    imu_sample_t expect;
+    stress_fill(&expect, sample->seq);
+    return memcmp(sample, &expect, sizeof(imu_sample_t)) == 0;
+}
+
+/*!
+* Push seq 1..samples, waiting for each one's release time when paced
+*/
+static void stress_produce(void *arg){
+    stress_run_t *run = (stress_run_t*)arg;
+    imu_sample_t sample;
+    uint64_t start = get_time_micros();
+    for(uint32_t seq = 1; seq <= run->samples; seq++){
+        if(run->rate_hz){
+            uint64_t release = start + (uint64_t)(seq - 1) * 1000000ULL / run->rate_hz;
+            while(get_time_micros() < release)
+                os_yield();
+        }
+        stress_fill(&sample, seq);
+        imu_ring_push(&run->ring, &sample);
+        run->pushed++;
+    }
+    run->wall_us = get_time_micros() - start;
+    __atomic_store_n(&run->done, 1, __ATOMIC_RELEASE);
+}
+
+/*!
+* Pop until the producer is done and the ring is empty, checking every sample
+*/
+static void stress_consume(void *arg){
+    stress_run_t *run = (stress_run_t*)arg;
+    imu_sample_t sample;
+    for(;;){
+        uint32_t count = imu_ring_count(&run->ring);
+        if(count > run->max_count)
+            run->max_count = count;
+        if(imu_ring_pop(&run->ring, &sample) != IMU_RING_SUCCESS){
+            if(__atomic_load_n(&run->done, __ATOMIC_ACQUIRE) && imu_ring_count(&run->ring) == 0)
+                break;
+            os_yield();
+            continue;
+        }
+        run->popped++;
+        if(!stress_intact(&sample))
+            run->torn++;
+        if(sample.seq <= run->last_seq)
+            run->reordered++;
+        else
+            run->gaps += sample.seq - run->last_seq - 1;
+        run->last_seq = sample.seq;
+    }
+    /* Drops after the last pop */
+    run->gaps += run->pushed - run->last_seq;
+}
+
+/*!
+* Run both sides to completion, then check that every push is accounted for
+*/
+static int stress_run(stress_run_t *run, int produce_core, int consume_core, const char *what){
+    static os_task_t producer, consumer;
+    imu_ring_init(&run->ring);
+    if(os_task_start(&consumer, "consume", stress_consume, run, STRESS_STACK, 1, consume_core) != OS_SUCCESS ||
+       os_task_start(&producer, "produce", stress_produce, run, STRESS_STACK, 1, produce_core) != OS_SUCCESS){
+        fprintf(stderr, "task start failed\n");
+        return 1;
+    }
+    os_task_join(&producer);
+    os_task_join(&consumer);
+
+    int failures = 0;
+    uint32_t dropped = run->ring.dropped;
+    printf("%-8s %10llu %10u %10u %10u %6u %6u %6u\n", what,
+           (unsigned long long)(run->wall_us ? (uint64_t)run->samples * 1000000ULL / run->wall_us : 0),
+           run->popped, dropped, run->gaps, run->torn, run->reordered, run->max_count);
+    if(run->torn || run->reordered)
+        failures++;
+    if(run->popped + dropped != run->pushed || run->gaps != dropped || run->max_count > IMU_RING_SIZE){
+        printf("%s: %u pushed, %u popped, %u dropped, %u skipped\n", what, run->pushed, run->popped, dropped,
+               run->gaps);
+        failures++;
+    }
+    return failures;
+}
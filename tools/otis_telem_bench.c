@@ -0,0 +1,162 @@
+/*!
+* @file otis_telem_bench.c
+* @author Ethan Lew
+* @brief Cost of binary telemetry against the former printf text output
+*
+*     otis_telem_bench [-n samples]
+*
+* Encodes the same synthetic samples as RAW + QUAT frames and as the "%2.3f" text
+* line the firmware used to print (formatted into memory, so no I/O is timed), and
+* reports bytes per sample and encode time (and TSC cycles on x86). The frames are
+* then decoded and compared with the input to check the round trip. On target,
+* build with TELEMETRY_BENCH=1 for the same comparison in CPU cycles.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+#include "telemetry.h"
+#include "telem_decode.h"
+#include "sim/host_clock.h"
+
+#define BENCH_DEFAULT_SAMPLES 100000
+
+typedef struct bench_check_s {
+    const imu_sample_t *samples;
+    const float (*q)[4];
+    uint32_t n;
+    uint32_t raw, quat;
+    float err[3];               /**< Largest accel, gyro, magn round trip error */
+    float q_err;
+} bench_check_t;
+
+static void bench_frame(const telem_frame_t *frame, void *ctx);
+
+int main(int argc, char **argv){
+    uint32_t n = BENCH_DEFAULT_SAMPLES;
+    int opt;
+    while((opt = getopt(argc, argv, "n:")) != -1){
+        if(opt == 'n'){
+            n = (uint32_t)strtoul(optarg, NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [-n samples]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* 1. Synthetic samples in the driver units */
+    imu_sample_t *samples = (imu_sample_t*)calloc(n, sizeof(imu_sample_t));
+    float (*q)[4] = calloc(n, sizeof(*q));
+    float (*euler)[3] = calloc(n, sizeof(*euler));
+    uint8_t *stream = (uint8_t*)malloc((size_t)n * (TELEM_RAW_FRAME + TELEM_QUAT_FRAME) + TELEM_INFO_FRAME);
+    if(!samples || !q || !euler || !stream)
+        return 1;
+    for(uint32_t i = 0; i < n; i++){
+        float t = i * 0.01F;
+        imu_sample_t *s = &samples[i];
+        s->stamp = 1000000ULL + 10000ULL * i;
+        s->seq = i;
+        s->status = IMU_SAMPLE_ACCEL_VALID | IMU_SAMPLE_GYRO_VALID | IMU_SAMPLE_MAGN_VALID;
+        s->accel.x = 2.0F * sinf(t);
+        s->accel.y = 1.5F * cosf(0.7F * t);
+        s->accel.z = 9.80665F + 0.3F * sinf(3.1F * t);
+        s->gyro.x = 1.2F * sinf(1.3F * t);
+        s->gyro.y = -0.8F * cosf(0.4F * t);
+        s->gyro.z = 0.05F * sinf(5.0F * t);
+        s->magn.x = 20.0F + 5.0F * sinf(0.2F * t);
+        s->magn.y = -3.0F * cosf(0.3F * t);
+        s->magn.z = -45.0F + 2.0F * sinf(t);
+        float h = 0.5F * sinf(0.1F * t);
+        q[i][0] = cosf(h);
+        q[i][1] = 0.6F * sinf(h);
+        q[i][2] = 0.0F;
+        q[i][3] = 0.8F * sinf(h);
+        euler[i][0] = t;
+        euler[i][1] = -t;
+        euler[i][2] = 0.5F * t;
+    }
+
+    /* 2. Binary frames */
+    telem_encoder_t enc;
+    telem_init(&enc, 10000);
+    size_t bytes = telem_encode_info(&enc, samples[0].stamp, stream);
+    size_t info_bytes = bytes;
+    uint64_t c0 = BENCH_CYCLES();
+    uint64_t t0 = host_clock_now_ns();
+    for(uint32_t i = 0; i < n; i++){
+        bytes += telem_encode_raw(&enc, &samples[i], stream + bytes);
+        bytes += telem_encode_quat(&enc, samples[i].stamp, samples[i].status, q[i], stream + bytes);
+    }
+    uint64_t t1 = host_clock_now_ns();
+    uint64_t c1 = BENCH_CYCLES();
+
+    /* 3. The former text line */
+    char text[160];
+    size_t text_bytes = 0;
+    uint64_t c2 = BENCH_CYCLES();
+    uint64_t t2 = host_clock_now_ns();
+    for(uint32_t i = 0; i < n; i++){
+        const imu_sample_t *s = &samples[i];
+        text_bytes += snprintf(text, sizeof(text), "%2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f %2.3f \n",
+                               s->accel.x, s->accel.y, s->accel.z, s->gyro.x, s->gyro.y, s->gyro.z,
+                               s->magn.x, s->magn.y, s->magn.z, euler[i][0], euler[i][1], euler[i][2]);
+    }
+    uint64_t t3 = host_clock_now_ns();
+    uint64_t c3 = BENCH_CYCLES();
+
+    /* 4. Decode and compare */
+    bench_check_t check = {samples, (const float (*)[4])q, n, 0, 0, {0}, 0};
+    static telem_decoder_t dec;
+    telem_decode_init(&dec, bench_frame, &check);
+    uint64_t t4 = host_clock_now_ns();
+    telem_decode_feed(&dec, stream, bytes);
+    uint64_t t5 = host_clock_now_ns();
+
+    double frame_b = (double)(bytes - info_bytes) / n;
+    double text_b = (double)text_bytes / n;
+    printf("%u samples\n", n);
+    printf("%-22s %8s %10s %10s %14s\n", "", "B/sample", "ns/sample", "cyc/sample", "max Hz @921600");
+    printf("%-22s %8.1f %10.1f %10.0f %14.0f\n", "RAW + QUAT frames", frame_b,
+           (double)(t1 - t0) / n, (double)(c1 - c0) / n, 92160.0 / frame_b);
+    printf("%-22s %8.1f %10.1f %10.0f %14.0f\n", "text (printf %2.3f)", text_b,
+           (double)(t3 - t2) / n, (double)(c3 - c2) / n, 92160.0 / text_b);
+    printf("decode: %.1f ns/sample, %u raw + %u quat frames, %u lost, %u crc errors\n",
+           (double)(t5 - t4) / n, check.raw, check.quat, dec.stats.lost, dec.stats.crc_errors);
+    printf("round trip max error: accel %.2e m/s^2, gyro %.2e rad/s, magn %.2e uT, q %.2e\n",
+           check.err[0], check.err[1], check.err[2], check.q_err);
+
+    free(samples);
+    free(q);
+    free(euler);
+    free(stream);
+    return check.raw == n && check.quat == n ? 0 : 2;
+}
+
+static void bench_frame(const telem_frame_t *frame, void *ctx){
+    bench_check_t *check = (bench_check_t*)ctx;
+    if(frame->type == TELEM_TYPE_RAW && check->raw < check->n){
+        const imu_sample_t *s = &check->samples[check->raw++];
+        float ref[9] = {s->accel.x, s->accel.y, s->accel.z, s->gyro.x, s->gyro.y, s->gyro.z,
+                        s->magn.x, s->magn.y, s->magn.z};
+        for(int i = 0; i < 9; i++){
+            float e = fabsf(frame->values[i] - ref[i]);
+            if(e > check->err[i / 3])
+                check->err[i / 3] = e;
+        }
+    } else if(frame->type == TELEM_TYPE_QUAT && check->quat < check->n){
+        const float *ref = check->q[check->quat++];
+        for(int i = 0; i < 4; i++){
+            float e = fabsf(frame->q[i] - ref[i]);
+            if(e > check->q_err)
+                check->q_err = e;
+        }
+    }
+}
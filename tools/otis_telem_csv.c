@@ -0,0 +1,296 @@
+/*!
+* @file otis_telem_csv.c
+* @author Ethan Lew
+* @brief Convert a binary telemetry stream to CSV
+*
+*     otis_telem_csv [-b baud] [-o out.csv] [-p seconds] [-r] [-l log] [input]
+*
+* input is a capture file, a serial device (put in raw mode at -b baud, default
+* 921600) or stdin when omitted or "-". One CSV row is written per sample; the RAW
+* and QUAT frames of a sample share its timestamp and are merged into the same row,
+* with empty cells for a frame that was not sent. Decoder statistics go to stderr.
+*
+* With -p the performance counters of firmware built with OTIS_PERF=1 are requested
+* from a serial device every that many seconds and printed to stderr as they arrive
+* (PERF and COUNTERS frames, see hal/perf.h); -r resets them after every report.
+*
+* With -l the I2C recording of firmware built with I2C_RECORD=1 is requested from a
+* serial device and written to a log file from its REC frames (see hal/i2c_rec.h),
+* for tools/otis_replay_bench -r; the tool exits once the dump has ended.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "telem_decode.h"
+#include "telemetry.h"
+#include "time_utils.h"
+
+/*!
+* An I2C recording being received
+*/
+typedef struct csv_log_s {
+    FILE *f;
+    uint32_t bytes;             /**< Log bytes received */
+    uint32_t total;             /**< Log size announced by the firmware */
+    uint8_t done;               /**< The closing REC frame arrived */
+} csv_log_t;
+
+typedef struct csv_row_s {
+    FILE *out;
+    csv_log_t *log;             /**< REC frames go here, may be NULL */
+    uint8_t pending;            /**< A row is being assembled */
+    uint8_t has_raw;
+    uint8_t has_quat;
+    uint64_t stamp;
+    uint32_t seq;
+    uint8_t status;
+    float values[9];
+    float q[4];
+    uint32_t rows;
+} csv_row_t;
+
+static void csv_flush(csv_row_t *row);
+
+static void csv_frame(const telem_frame_t *frame, void *ctx);
+
+static int csv_open_input(const char *path, unsigned long baud, int writable);
+
+static void csv_perf(const telem_frame_t *frame);
+
+static void csv_rec(csv_log_t *log, const telem_frame_t *frame);
+
+static void csv_command(int fd, telem_encoder_t *enc, telem_cmd_t cmd);
+
+int main(int argc, char **argv){
+    const char *out_path = NULL;
+    unsigned long baud = 921600;
+    double perf_s = 0.0;
+    int perf_reset = 0;
+    const char *log_path = NULL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "b:o:p:rl:")) != -1){
+        switch(opt){
+            case 'b': baud = strtoul(optarg, NULL, 0); break;
+            case 'o': out_path = optarg; break;
+            case 'p': perf_s = atof(optarg); break;
+            case 'r': perf_reset = 1; break;
+            case 'l': log_path = optarg; break;
+            default:
+            fprintf(stderr, "usage: %s [-b baud] [-o out.csv] [-p seconds] [-r] [-l log] [input]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int fd = csv_open_input(optind < argc ? argv[optind] : "-", baud, perf_s > 0.0 || log_path);
+    if(fd < 0)
+        return 1;
+    if((perf_s > 0.0 || log_path) && !isatty(fd)){
+        fprintf(stderr, "-p and -l need a serial device\n");
+        return 1;
+    }
+    telem_encoder_t enc;
+    telem_init(&enc, 0);
+    uint64_t perf_us = (uint64_t)(perf_s * 1e6);
+    uint64_t perf_next = get_time_micros() + perf_us;
+
+    csv_row_t row;
+    memset(&row, 0, sizeof(row));
+    row.out = out_path ? fopen(out_path, "w") : stdout;
+    if(!row.out){
+        perror(out_path);
+        return 1;
+    }
+    fprintf(row.out, "t_us,seq,status,ax,ay,az,gx,gy,gz,mx,my,mz,qw,qx,qy,qz\n");
+    csv_log_t log;
+    memset(&log, 0, sizeof(log));
+    if(log_path){
+        log.f = fopen(log_path, "wb");
+        if(!log.f){
+            perror(log_path);
+            return 1;
+        }
+        row.log = &log;
+        csv_command(fd, &enc, TELEM_CMD_REC_DUMP);
+    }
+
+    static telem_decoder_t dec;
+    telem_decode_init(&dec, csv_frame, &row);
+
+    uint8_t buf[4096];
+    for(;;){
+        if(perf_us){
+            /* Wait for input no longer than the next request is due */
+            uint64_t now = get_time_micros();
+            if(now >= perf_next){
+                csv_command(fd, &enc, TELEM_CMD_PERF);
+                if(perf_reset)
+                    csv_command(fd, &enc, TELEM_CMD_PERF_RESET);
+                perf_next = now + perf_us;
+            }
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            if(poll(&pfd, 1, (int)((perf_next - now) / 1000) + 1) <= 0)
+                continue;
+        }
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        telem_decode_feed(&dec, buf, (size_t)n);
+        if(log.done)
+            break;
+    }
+    csv_flush(&row);
+    if(log.f){
+        fprintf(stderr, "i2c log: %u of %u bytes%s\n", log.bytes, log.total,
+                log.done && log.bytes == log.total ? "" : ", incomplete");
+        fclose(log.f);
+    }
+
+    fprintf(stderr, "%u rows, %u frames, %u lost, %u crc errors, %u bytes skipped\n", row.rows,
+            dec.stats.frames, dec.stats.lost, dec.stats.crc_errors, dec.stats.skipped);
+    if(row.out != stdout)
+        fclose(row.out);
+    if(fd != STDIN_FILENO)
+        close(fd);
+    return 0;
+}
+
+/*!
+* Frames of one sample arrive back to back; a new timestamp completes the row
+*/
+static void csv_frame(const telem_frame_t *frame, void *ctx){
+    csv_row_t *row = (csv_row_t*)ctx;
+    csv_perf(frame);
+    if(row->log)
+        csv_rec(row->log, frame);
+
+    if(frame->type != TELEM_TYPE_RAW && frame->type != TELEM_TYPE_QUAT)
+        return;
+    if(row->pending && (frame->stamp != row->stamp ||
+       (frame->type == TELEM_TYPE_RAW ? row->has_raw : row->has_quat)))
+        csv_flush(row);
+
+    row->pending = 1;
+    row->stamp = frame->stamp;
+    row->status = frame->status;
+    if(frame->type == TELEM_TYPE_RAW){
+        row->has_raw = 1;
+        row->seq = frame->seq;
+        memcpy(row->values, frame->values, sizeof(row->values));
+    } else {
+        if(!row->has_raw)
+            row->seq = frame->seq;
+        row->has_quat = 1;
+        memcpy(row->q, frame->q, sizeof(row->q));
+    }
+}
+
+static void csv_flush(csv_row_t *row){
+    if(!row->pending)
+        return;
+    fprintf(row->out, "%llu,%u,%u", (unsigned long long)row->stamp, row->seq, row->status);
+    for(int i = 0; i < 9; i++){
+        if(row->has_raw)
+            fprintf(row->out, ",%.6g", row->values[i]);
+        else
+            fputc(',', row->out);
+    }
+    for(int i = 0; i < 4; i++){
+        if(row->has_quat)
+            fprintf(row->out, ",%.5f", row->q[i]);
+        else
+            fputc(',', row->out);
+    }
+    fputc('\n', row->out);
+    row->rows++;
+    row->pending = row->has_raw = row->has_quat = 0;
+}
+
+/*!
+* A PERF frame as one line per probe, values in us; COUNTERS as one line
+*/
+static void csv_perf(const telem_frame_t *frame){
+    if(frame->type == TELEM_TYPE_PERF && frame->count){
+        float scale = frame->unit == PERF_UNIT_US ? 1.0F : 1.0F / (float)(frame->cycles_per_us ? frame->cycles_per_us : 1);
+        uint32_t p50 = perf_percentile(frame->hist, frame->count, 0.5F);
+        uint32_t p99 = perf_percentile(frame->hist, frame->count, 0.99F);
+        fprintf(stderr, "perf %-11s %8u: min %8.2f, mean %8.2f, p50 <= %8.2f, p99 <= %8.2f, max %8.2f us\n",
+                perf_probe_name((perf_probe_id_t)frame->probe), frame->count, frame->min * scale,
+                (float)frame->sum / (float)frame->count * scale, (p50 < frame->max ? p50 : frame->max) * scale,
+                (p99 < frame->max ? p99 : frame->max) * scale, frame->max * scale);
+    } else if(frame->type == TELEM_TYPE_COUNTERS){
+        fprintf(stderr, "perf counters over %.1f s:", (frame->stamp - frame->since_us) * 1e-6);
+        for(int i = 0; i < frame->counters; i++)
+            fprintf(stderr, " %s %u%s", perf_counter_name((perf_counter_id_t)i), frame->counter[i],
+                    i + 1 < frame->counters ? "," : "\n");
+    }
+}
+
+/*!
+* A REC frame's chunk at its offset in the log; a lost frame leaves a hole, which the
+* byte count shows
+*/
+static void csv_rec(csv_log_t *log, const telem_frame_t *frame){
+    if(frame->type != TELEM_TYPE_REC || log->done)
+        return;
+    log->total = frame->total;
+    if(frame->data_size == 0){
+        log->done = 1;
+        return;
+    }
+    if(fseek(log->f, (long)frame->offset, SEEK_SET) != 0 || fwrite(frame->data, 1, frame->data_size, log->f) != frame->data_size){
+        perror("i2c log");
+        return;
+    }
+    log->bytes += frame->data_size;
+}
+
+static void csv_command(int fd, telem_encoder_t *enc, telem_cmd_t cmd){
+    uint8_t frame[TELEM_CMD_FRAME];
+    size_t n = telem_encode_cmd(enc, cmd, frame);
+    if(write(fd, frame, n) != (ssize_t)n)
+        perror("command");
+}
+
+static int csv_open_input(const char *path, unsigned long baud, int writable){
+    if(strcmp(path, "-") == 0)
+        return STDIN_FILENO;
+
+    int fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_NOCTTY);
+    if(fd < 0){
+        perror(path);
+        return -1;
+    }
+    if(!isatty(fd))
+        return fd;
+
+    static const struct { unsigned long baud; speed_t speed; } rates[] = {
+        {115200, B115200}, {230400, B230400}, {460800, B460800}, {921600, B921600},
+    };
+    speed_t speed = 0;
+    for(size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++){
+        if(rates[i].baud == baud)
+            speed = rates[i].speed;
+    }
+    struct termios tio;
+    if(speed == 0 || tcgetattr(fd, &tio) != 0){
+        fprintf(stderr, "%s: cannot set %lu baud\n", path, baud);
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &tio);
+    return fd;
+}
@@ -0,0 +1,186 @@
+/*!
+* @file otis_time_check.c
+* @author Ethan Lew
+* @brief Host check of the time_utils.h time base and timer_hal_t
+*
+* The time base is a 64 bit microsecond count that does not wrap in practice, but every
+* consumer takes differences of it, and a 32 bit truncation anywhere would wrap after
+* 71 minutes. With the host clock offset (time_utils_offset_us) the check starts the
+* clock where that would show, and checks
+*   1. reads: monotonic, the smallest step seen and the cost of a read
+*   2. rate: elapsed time over several sleeps against CLOCK_MONOTONIC_RAW, in ppm
+*   3. get_time_millis agrees with get_time_micros
+*   4. timer_hal_t: start counts from 0, update measures from prev, reset moves prev on
+*   5. across 2^32 us: stamps increase, timer diffs are the sleep, and os_signal_wait
+*      and os_period_wait still time out and release on time
+*   6. across 2^64 us: timer diffs stay correct in modular arithmetic
+*
+*     otis_time_check [-n reads] [-s sleep_ms]
+*
+* Exits non-zero if any check fails.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "os_utils.h"
+#include "time_utils.h"
+#include "sim/host_clock.h"
+
+#define TIME_DEFAULT_READS 1000000
+#define TIME_DEFAULT_SLEEP_MS 200
+#define TIME_RATE_PASSES 5
+/* Largest rate error against CLOCK_MONOTONIC_RAW that passes; NTP slews by 500 at most */
+#define TIME_MAX_PPM 1000.0
+/* Slack on a sleep or wait measured with the time base (us): scheduling noise, where a
+   wrap or truncation error would be hours */
+#define TIME_SLACK_US 20000
+/* Time left before a wrap when the clock is moved (us) */
+#define TIME_LEAD_US 20000ULL
+#define TIME_PERIOD_US 2000
+#define TIME_PERIODS 20
+
+static int time_near(const char *what, uint64_t got_us, uint64_t want_us);
+
+static int time_timer_step(const char *what, uint32_t sleep_us);
+
+int main(int argc, char **argv){
+    uint32_t reads = TIME_DEFAULT_READS;
+    uint32_t sleep_ms = TIME_DEFAULT_SLEEP_MS;
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:")) != -1){
+        switch(opt){
+            case 'n': reads = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 's': sleep_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+            default:
+            fprintf(stderr, "usage: %s [-n reads] [-s sleep_ms]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(reads < 2 || sleep_ms == 0)
+        return 1;
+    int failures = 0;
+
+    /* 1. Reads */
+    uint32_t backwards = 0;
+    uint64_t min_step = UINT64_MAX;
+    uint64_t t0 = host_clock_ns(CLOCK_MONOTONIC_RAW);
+    uint64_t prev = get_time_micros();
+    for(uint32_t i = 1; i < reads; i++){
+        uint64_t now = get_time_micros();
+        if(now < prev)
+            backwards++;
+        else if(now > prev && now - prev < min_step)
+            min_step = now - prev;
+        prev = now;
+    }
+    double read_ns = (double)(host_clock_ns(CLOCK_MONOTONIC_RAW) - t0) / reads;
+    printf("reads     %u, %u backwards, smallest step %llu us, %.1f ns per read\n", reads, backwards,
+           (unsigned long long)min_step, read_ns);
+    failures += backwards != 0 || min_step != 1;
+
+    /* 2. Rate */
+    double worst_ppm = 0.0;
+    for(int p = 0; p < TIME_RATE_PASSES; p++){
+        uint64_t r0 = host_clock_ns(CLOCK_MONOTONIC_RAW);
+        uint64_t u0 = get_time_micros();
+        os_sleep_us(sleep_ms * 1000U);
+        uint64_t u1 = get_time_micros();
+        uint64_t r1 = host_clock_ns(CLOCK_MONOTONIC_RAW);
+        /* Each end is read in the same order, so the read cost falls out; 2 us of rounding is left */
+        double ppm = ((double)(u1 - u0) * 1000.0 - (double)(r1 - r0)) / (double)(r1 - r0) * 1e6;
+        if(fabs(ppm) > fabs(worst_ppm))
+            worst_ppm = ppm;
+    }
+    double bound = TIME_MAX_PPM + 2e9 / (sleep_ms * 1e6);
+    printf("rate      %+.1f ppm worst of %u sleeps of %u ms against CLOCK_MONOTONIC_RAW\n", worst_ppm,
+           TIME_RATE_PASSES, sleep_ms);
+    failures += fabs(worst_ppm) > bound;
+
+    /* 3. Milliseconds */
+    uint64_t us0 = get_time_micros();
+    uint64_t ms = get_time_millis();
+    uint64_t us1 = get_time_micros();
+    printf("millis    %llu in [%llu, %llu]\n", (unsigned long long)ms, (unsigned long long)(us0 / 1000ULL),
+           (unsigned long long)(us1 / 1000ULL));
+    failures += ms < us0 / 1000ULL || ms > us1 / 1000ULL;
+
+    /* 4. timer_hal_t, from boot */
+    failures += time_timer_step("timer", sleep_ms * 100U);
+
+    /* 5. Across 2^32 us */
+    time_utils_offset_us = (1ULL << 32) - TIME_LEAD_US - get_time_micros();
+    uint64_t before = get_time_micros();
+    failures += time_timer_step("2^32", (uint32_t)(2 * TIME_LEAD_US));
+    uint64_t after = get_time_micros();
+    printf("2^32      stamps %llu -> %llu\n", (unsigned long long)before, (unsigned long long)after);
+    failures += before >= (1ULL << 32) || after <= (1ULL << 32);
+
+    time_utils_offset_us += (1ULL << 32) - TIME_LEAD_US - get_time_micros();
+    os_signal_t signal;
+    os_signal_init(&signal);
+    uint64_t w0 = get_time_micros();
+    uint8_t set = os_signal_wait(&signal, (uint32_t)(2 * TIME_LEAD_US));
+    failures += time_near("2^32 signal wait", get_time_micros() - w0, 2 * TIME_LEAD_US) || set;
+    os_signal_destroy(&signal);
+
+    time_utils_offset_us += (1ULL << 32) - TIME_LEAD_US - get_time_micros();
+    os_period_t period;
+    os_period_init(&period, TIME_PERIOD_US);
+    uint64_t p0 = period.release_us;
+    uint32_t skipped = 0;
+    for(int i = 0; i < TIME_PERIODS; i++)
+        skipped += os_period_wait(&period);
+    uint64_t periods = (uint64_t)(TIME_PERIODS + skipped) * TIME_PERIOD_US;
+    failures += time_near("2^32 period releases", period.release_us - p0, periods);
+    failures += time_near("2^32 period wall", get_time_micros() - p0, periods);
+
+    /* 6. Across 2^64 us */
+    time_utils_offset_us += 0ULL - TIME_LEAD_US - get_time_micros();
+    before = get_time_micros();
+    failures += time_timer_step("2^64", (uint32_t)(2 * TIME_LEAD_US));
+    after = get_time_micros();
+    printf("2^64      stamps %llu -> %llu\n", (unsigned long long)before, (unsigned long long)after);
+    failures += before < (1ULL << 63) || after >= (1ULL << 63);
+    time_utils_offset_us = 0;
+
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 2 : 0;
+}
+
+/*!
+* A time measured with the time base, which may run over by the slack but not under
+*/
+static int time_near(const char *what, uint64_t got_us, uint64_t want_us){
+    int bad = got_us < want_us || got_us > want_us + TIME_SLACK_US;
+    printf("%-24s %llu us for %llu%s\n", what, (unsigned long long)got_us, (unsigned long long)want_us,
+           bad ? " FAILED" : "");
+    return bad;
+}
+
+/*!
+* Start, reset and update a timer around two sleeps
+*   1. start: prev 0 and diff the whole count
+*   2. reset after a sleep: prev the start, diff the sleep
+*   3. update after half as long again: prev kept, diff both sleeps
+*/
+static int time_timer_step(const char *what, uint32_t sleep_us){
+    timer_hal_t timer;
+    int bad = 0;
+    start_hal_timer(&timer);
+    bad += timer.prev != 0 || timer.diff != timer.curr;
+    uint64_t start = timer.curr;
+
+    os_sleep_us(sleep_us);
+    reset_hal_timer(&timer);
+    bad += timer.prev != start;
+    bad += time_near(what, timer.diff, sleep_us);
+
+    os_sleep_us(sleep_us / 2);
+    update_hal_timer(&timer);
+    bad += timer.prev != start;
+    bad += time_near(what, timer.diff, sleep_us + sleep_us / 2);
+    return bad;
+}
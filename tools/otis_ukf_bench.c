@@ -0,0 +1,456 @@
+/*!
+* @file otis_ukf_bench.c
+* @author Ethan Lew
+* @brief Host latency benchmark of the UKF step against a heap allocating reference
+*
+* Runs ukf_predict + ukf_update on a motion_sim trajectory sampled into memory, and
+* the same filter written the usual generic way: dimensions held at run time and every
+* working matrix malloc'd and freed inside each step, on the same matrix.h and
+* quaternion.h kernels. Reports per step latency (min, mean, p99, max) of both and the
+* heap calls each made, and checks that both follow the same estimate. The attitude
+* error is reported too; like otis_host_bench's, it includes the heading error of the
+* uncalibrated hard iron offset of the synthetic motion.
+*
+*     otis_ukf_bench [-n steps] [-f rate_hz]
+*
+* Exits non-zero if the two disagree, ukf.c touched the heap in a step or either failed
+* a factorization.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ukf.h"
+#include "quaternion.h"
+#include "sim/motion_sim.h"
+#include "sim/host_clock.h"
+
+#define BENCH_DEFAULT_STEPS 20000
+#define BENCH_DEFAULT_RATE_HZ 100.0F
+/* Time before the error is accumulated */
+#define BENCH_WARMUP_S (5.0F)
+/* Largest difference between both filters' quaternion components */
+#define UKF_BENCH_MAX_DIFF (1e-5F)
+
+/*!
+* The reference filter: the state of ukf_t with its sizes and covariances on the heap
+*/
+typedef struct ref_ukf_s {
+    int n;
+    int m;
+    float q[4];
+    float bias[3];
+    float *P;
+    float *Q;
+    float *R;
+    float m_ref[3];
+    float dt;
+    float wm0, wc0, wi;
+    float gamma;
+} ref_ukf_t;
+
+/*!
+* Per step latencies of one filter
+*/
+typedef struct bench_lat_s {
+    const char *name;
+    uint64_t *ns;
+    uint32_t heap;         /**< Heap calls made in the steps */
+    uint32_t failures;     /**< Steps that did not return success */
+    double err_sq;
+    float err_max;
+} bench_lat_t;
+
+static uint32_t bench_heap;
+
+static int bench_cmp(const void *a, const void *b);
+
+static void bench_report(bench_lat_t *lat, uint32_t n, uint32_t warmup);
+
+static float bench_angle(const float *q_est, const float *q_true);
+
+static void *ref_alloc(size_t size);
+
+static void ref_free(void *ptr);
+
+static int ref_init(ref_ukf_t *ref, int n, int m, float sample_freq);
+
+static void ref_destroy(ref_ukf_t *ref);
+
+static int ref_sigma(const ref_ukf_t *ref, float *chi);
+
+static int ref_predict(ref_ukf_t *ref, const gyro_float_data_t *gyro);
+
+static int ref_update(ref_ukf_t *ref, const raw_float_data_t *accel, const raw_float_data_t *magn);
+
+int main(int argc, char **argv){
+    uint32_t n = BENCH_DEFAULT_STEPS;
+    float freq = BENCH_DEFAULT_RATE_HZ;
+    int opt;
+    while((opt = getopt(argc, argv, "n:f:")) != -1){
+        switch(opt){
+            case 'n': n = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'f': freq = (float)atof(optarg); break;
+            default:
+            fprintf(stderr, "usage: %s [-n steps] [-f rate_hz]\n", argv[0]);
+            return 1;
+        }
+    }
+    uint32_t warmup = (uint32_t)(BENCH_WARMUP_S * freq);
+    if(freq <= 0.0F || n <= warmup)
+        return 1;
+
+    /* 1. The trajectory, in the driver units */
+    gyro_float_data_t *gyro = (gyro_float_data_t*)malloc(n * sizeof(gyro_float_data_t));
+    raw_float_data_t *accel = (raw_float_data_t*)malloc(n * sizeof(raw_float_data_t));
+    raw_float_data_t *magn = (raw_float_data_t*)malloc(n * sizeof(raw_float_data_t));
+    float (*truth)[4] = malloc(n * sizeof(*truth));
+    bench_lat_t lat[2] = {{"ukf.c", NULL, 0, 0, 0.0, 0.0F}, {"heap ref", NULL, 0, 0, 0.0, 0.0F}};
+    lat[0].ns = (uint64_t*)malloc(n * sizeof(uint64_t));
+    lat[1].ns = (uint64_t*)malloc(n * sizeof(uint64_t));
+    if(!gyro || !accel || !magn || !truth || !lat[0].ns || !lat[1].ns)
+        return 1;
+    static motion_sim_t motion;
+    motion_sim_config_t config;
+    motion_sim_default_config(&config);
+    motion_sim_init(&motion, &config);
+    motion_frame_t frame;
+    for(uint32_t i = 0; i < n; i++){
+        motion_sim_sample(&motion, (uint64_t)((i + 1) * 1e6 / freq), &frame);
+        gyro[i] = (gyro_float_data_t){frame.gyro[0], frame.gyro[1], frame.gyro[2]};
+        accel[i] = (raw_float_data_t){frame.accel[0] * 9.80665F, frame.accel[1] * 9.80665F, frame.accel[2] * 9.80665F};
+        magn[i] = (raw_float_data_t){frame.magn[0], frame.magn[1], frame.magn[2]};
+        memcpy(truth[i], motion.q, sizeof(motion.q));
+    }
+    motion_sim_close(&motion);
+
+    /* 2. Both filters from the same alignment */
+    static ukf_t ukf;
+    static ref_ukf_t ref;
+    ukf_init(&ukf, freq);
+    ukf_align(&ukf, &accel[0], &magn[0]);
+    if(ref_init(&ref, UKF_N, UKF_M, freq)){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memcpy(ref.q, ukf.q, sizeof(ref.q));
+    memcpy(ref.m_ref, ukf.m_ref, sizeof(ref.m_ref));
+
+    /* 3. Interleaved steps, each timed on its own */
+    float diff_max = 0.0F;
+    for(uint32_t i = 0; i < n; i++){
+        bench_heap = 0;
+        uint64_t t0 = host_clock_now_ns();
+        lat[0].failures += ukf_predict(&ukf, &gyro[i]) != UKF_SUCCESS;
+        lat[0].failures += ukf_update(&ukf, &accel[i], &magn[i]) != UKF_SUCCESS;
+        uint64_t t1 = host_clock_now_ns();
+        lat[0].ns[i] = t1 - t0;
+        lat[0].heap += bench_heap;
+
+        bench_heap = 0;
+        t0 = host_clock_now_ns();
+        lat[1].failures += ref_predict(&ref, &gyro[i]) != 0;
+        lat[1].failures += ref_update(&ref, &accel[i], &magn[i]) != 0;
+        t1 = host_clock_now_ns();
+        lat[1].ns[i] = t1 - t0;
+        lat[1].heap += bench_heap;
+
+        for(int k = 0; k < 4; k++){
+            float d = fabsf(ukf.q[k] - ref.q[k]);
+            if(d > diff_max)
+                diff_max = d;
+        }
+        if(i >= warmup){
+            float e[2] = {bench_angle(ukf.q, truth[i]) * 57.29578F, bench_angle(ref.q, truth[i]) * 57.29578F};
+            for(int k = 0; k < 2; k++){
+                lat[k].err_sq += (double)e[k] * e[k];
+                if(e[k] > lat[k].err_max)
+                    lat[k].err_max = e[k];
+            }
+        }
+    }
+
+    /* 4. Report */
+    printf("%u predict + update steps at %.1f Hz, N = %d, M = %d\n", n, freq, UKF_N, UKF_M);
+    printf("%-9s %8s %8s %8s %8s %10s %8s %8s\n", "filter", "min ns", "mean ns", "p99 ns", "max ns", "heap/step",
+           "rms deg", "max deg");
+    bench_report(&lat[0], n, warmup);
+    bench_report(&lat[1], n, warmup);
+    printf("largest difference between both quaternions: %.2e\n", diff_max);
+
+    int failures = 0;
+    if(diff_max > UKF_BENCH_MAX_DIFF || lat[0].heap || lat[0].failures || lat[1].failures)
+        failures++;
+    printf("%s\n", failures ? "FAILED" : "ok");
+
+    ref_destroy(&ref);
+    free(lat[0].ns);
+    free(lat[1].ns);
+    free(gyro);
+    free(accel);
+    free(magn);
+    free(truth);
+    return failures ? 2 : 0;
+}
+
+static int bench_cmp(const void *a, const void *b){
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/*!
+* Sorts the latencies in place
+*/
+static void bench_report(bench_lat_t *lat, uint32_t n, uint32_t warmup){
+    uint64_t total = 0;
+    for(uint32_t i = 0; i < n; i++)
+        total += lat->ns[i];
+    qsort(lat->ns, n, sizeof(uint64_t), bench_cmp);
+    printf("%-9s %8llu %8.0f %8llu %8llu %10.1f %8.3f %8.3f\n", lat->name, (unsigned long long)lat->ns[0],
+           (double)total / n, (unsigned long long)lat->ns[(uint32_t)(0.99 * (n - 1))],
+           (unsigned long long)lat->ns[n - 1], (double)lat->heap / n, sqrt(lat->err_sq / (n - warmup)),
+           lat->err_max);
+}
+
+/*!
+* Rotation angle between two unit quaternions
+*/
+static float bench_angle(const float *q_est, const float *q_true){
+    float d = fabsf(q_est[0] * q_true[0] + q_est[1] * q_true[1] + q_est[2] * q_true[2] + q_est[3] * q_true[3]);
+    if(d > 1.0F)
+        d = 1.0F;
+    return 2.0F * acosf(d);
+}
+
+/*!
+* malloc and free, counted
+*/
+static void *ref_alloc(size_t size){
+    bench_heap++;
+    return malloc(size);
+}
+
+static void ref_free(void *ptr){
+    bench_heap++;
+    free(ptr);
+}
+
+static int ref_init(ref_ukf_t *ref, int n, int m, float sample_freq){
+    float lambda = UKF_ALPHA * UKF_ALPHA * (n + UKF_KAPPA) - n;
+
+    memset(ref, 0, sizeof(ref_ukf_t));
+    ref->n = n;
+    ref->m = m;
+    ref->P = (float*)calloc((size_t)n * n, sizeof(float));
+    ref->Q = (float*)calloc((size_t)n, sizeof(float));
+    ref->R = (float*)calloc((size_t)m, sizeof(float));
+    if(!ref->P || !ref->Q || !ref->R)
+        return 1;
+    ref->q[0] = 1.0F;
+    ref->dt = 1.0F / sample_freq;
+    ref->gamma = sqrtf(n + lambda);
+    ref->wm0 = lambda / (n + lambda);
+    ref->wc0 = ref->wm0 + (1.0F - UKF_ALPHA * UKF_ALPHA + UKF_BETA);
+    ref->wi = 0.5F / (n + lambda);
+    for(int i = 0; i < 3; i++){
+        ref->P[i * n + i] = UKF_ATT_INIT * UKF_ATT_INIT;
+        ref->P[(i + 3) * n + i + 3] = UKF_BIAS_INIT * UKF_BIAS_INIT;
+        ref->Q[i] = UKF_GYRO_NOISE * UKF_GYRO_NOISE;
+        ref->Q[i + 3] = UKF_BIAS_WALK * UKF_BIAS_WALK;
+        ref->R[i] = UKF_ACCEL_NOISE * UKF_ACCEL_NOISE;
+        ref->R[i + 3] = UKF_MAGN_NOISE * UKF_MAGN_NOISE;
+    }
+    ref->m_ref[0] = 1.0F;
+    return 0;
+}
+
+static void ref_destroy(ref_ukf_t *ref){
+    free(ref->P);
+    free(ref->Q);
+    free(ref->R);
+}
+
+/*!
+* Sigma points into chi (2n+1 rows of n), the factor in a scratch allocation
+*/
+static int ref_sigma(const ref_ukf_t *ref, float *chi){
+    int n = ref->n;
+    float *l = (float*)ref_alloc((size_t)n * n * sizeof(float));
+    memcpy(l, ref->P, (size_t)n * n * sizeof(float));
+    if(mat_cholesky(l, n) != MATRIX_SUCCESS){
+        ref_free(l);
+        return 1;
+    }
+    for(int r = 0; r < n; r++)
+        chi[r] = 0.0F;
+    for(int j = 0; j < n; j++){
+        for(int r = 0; r < n; r++){
+            float v = ref->gamma * l[r * n + j];
+            chi[(1 + j) * n + r] = v;
+            chi[(1 + n + j) * n + r] = -v;
+        }
+    }
+    ref_free(l);
+    return 0;
+}
+
+/*!
+* ukf_predict with its working arrays allocated per call
+*/
+static int ref_predict(ref_ukf_t *ref, const gyro_float_data_t *gyro){
+    int n = ref->n;
+    int s = 2 * n + 1;
+    float *chi = (float*)ref_alloc((size_t)s * n * sizeof(float));
+    float *q_sig = (float*)ref_alloc((size_t)s * 4 * sizeof(float));
+    float *mean = (float*)ref_alloc((size_t)n * sizeof(float));
+    float tmp[4], dq[4], rot[3], q_conj[4];
+    int ret = ref_sigma(ref, chi);
+    if(ret)
+        goto done;
+
+    for(int i = 0; i < s; i++){
+        float *c = chi + i * n;
+        quat_exp(c, dq);
+        quat_mul(ref->q, dq, tmp);
+        rot[0] = (gyro->x - ref->bias[0] - c[3]) * ref->dt;
+        rot[1] = (gyro->y - ref->bias[1] - c[4]) * ref->dt;
+        rot[2] = (gyro->z - ref->bias[2] - c[5]) * ref->dt;
+        quat_exp(rot, dq);
+        quat_mul(tmp, dq, q_sig + i * 4);
+    }
+    q_conj[0] = q_sig[0];
+    q_conj[1] = -q_sig[1];
+    q_conj[2] = -q_sig[2];
+    q_conj[3] = -q_sig[3];
+    for(int i = 0; i < s; i++){
+        quat_mul(q_conj, q_sig + i * 4, tmp);
+        quat_log(tmp, chi + i * n);
+    }
+    for(int j = 0; j < n; j++){
+        mean[j] = ref->wm0 * chi[j];
+        for(int i = 1; i < s; i++)
+            mean[j] += ref->wi * chi[i * n + j];
+    }
+    quat_exp(mean, dq);
+    quat_mul(q_sig, dq, ref->q);
+    quat_normalize(ref->q);
+    for(int k = 0; k < 3; k++)
+        ref->bias[k] += mean[3 + k];
+
+    mat_zero(ref->P, n, n);
+    for(int i = 0; i < s; i++){
+        for(int j = 0; j < n; j++)
+            chi[i * n + j] -= mean[j];
+        mat_add_outer(ref->P, chi + i * n, chi + i * n, i == 0 ? ref->wc0 : ref->wi, n, n);
+    }
+    for(int j = 0; j < n; j++)
+        ref->P[j * n + j] += ref->Q[j] * ref->dt;
+    mat_symmetrize(ref->P, n);
+
+done:
+    ref_free(mean);
+    ref_free(q_sig);
+    ref_free(chi);
+    return ret;
+}
+
+/*!
+* ukf_update with its working arrays allocated per call
+*/
+static int ref_update(ref_ukf_t *ref, const raw_float_data_t *accel, const raw_float_data_t *magn){
+    static const float up[3] = {0.0F, 0.0F, 1.0F};
+    int n = ref->n;
+    int m = ref->m;
+    int s = 2 * n + 1;
+    float an = sqrtf(accel->x * accel->x + accel->y * accel->y + accel->z * accel->z);
+    float mn = sqrtf(magn->x * magn->x + magn->y * magn->y + magn->z * magn->z);
+    if(an == 0.0F || mn == 0.0F)
+        return 0;
+
+    float *meas = (float*)ref_alloc((size_t)m * sizeof(float));
+    float *chi = (float*)ref_alloc((size_t)s * n * sizeof(float));
+    float *z = (float*)ref_alloc((size_t)s * m * sizeof(float));
+    float *z_mean = (float*)ref_alloc((size_t)m * sizeof(float));
+    float *dz = (float*)ref_alloc((size_t)m * sizeof(float));
+    float *pzz = (float*)ref_alloc((size_t)m * m * sizeof(float));
+    float *pxz = (float*)ref_alloc((size_t)n * m * sizeof(float));
+    float *kt = (float*)ref_alloc((size_t)m * n * sizeof(float));
+    float *dx = (float*)ref_alloc((size_t)n * sizeof(float));
+    float *pk = (float*)ref_alloc((size_t)n * n * sizeof(float));
+    float dq[4], q_i[4];
+    meas[0] = accel->x / an;
+    meas[1] = accel->y / an;
+    meas[2] = accel->z / an;
+    meas[3] = magn->x / mn;
+    meas[4] = magn->y / mn;
+    meas[5] = magn->z / mn;
+    int ret = ref_sigma(ref, chi);
+    if(ret)
+        goto done;
+
+    for(int i = 0; i < s; i++){
+        quat_exp(chi + i * n, dq);
+        quat_mul(ref->q, dq, q_i);
+        quat_rotate_inv(q_i, up, z + i * m);
+        quat_rotate_inv(q_i, ref->m_ref, z + i * m + 3);
+    }
+    for(int k = 0; k < m; k++){
+        z_mean[k] = ref->wm0 * z[k];
+        for(int i = 1; i < s; i++)
+            z_mean[k] += ref->wi * z[i * m + k];
+    }
+    mat_zero(pzz, m, m);
+    mat_zero(pxz, n, m);
+    for(int i = 0; i < s; i++){
+        float w = i == 0 ? ref->wc0 : ref->wi;
+        for(int k = 0; k < m; k++)
+            dz[k] = z[i * m + k] - z_mean[k];
+        mat_add_outer(pzz, dz, dz, w, m, m);
+        mat_add_outer(pxz, chi + i * n, dz, w, n, m);
+    }
+    for(int k = 0; k < m; k++)
+        pzz[k * m + k] += ref->R[k];
+    if(mat_cholesky(pzz, m) != MATRIX_SUCCESS){
+        ret = 1;
+        goto done;
+    }
+    for(int k = 0; k < m; k++){
+        for(int j = 0; j < n; j++)
+            kt[k * n + j] = pxz[j * m + k];
+    }
+    mat_chol_solve(pzz, kt, m, n);
+
+    for(int k = 0; k < m; k++)
+        dz[k] = meas[k] - z_mean[k];
+    for(int j = 0; j < n; j++){
+        dx[j] = 0.0F;
+        for(int k = 0; k < m; k++)
+            dx[j] += kt[k * n + j] * dz[k];
+    }
+    quat_exp(dx, dq);
+    quat_mul(ref->q, dq, q_i);
+    memcpy(ref->q, q_i, sizeof(q_i));
+    quat_normalize(ref->q);
+    for(int k = 0; k < 3; k++)
+        ref->bias[k] += dx[3 + k];
+
+    mat_mul(pxz, kt, pk, n, m, n);
+    for(int j = 0; j < n * n; j++)
+        ref->P[j] -= pk[j];
+    mat_symmetrize(ref->P, n);
+
+done:
+    ref_free(pk);
+    ref_free(dx);
+    ref_free(kt);
+    ref_free(pxz);
+    ref_free(pzz);
+    ref_free(dz);
+    ref_free(z_mean);
+    ref_free(z);
+    ref_free(chi);
+    ref_free(meas);
+    return ret;
+}